@@ -56,4 +56,8 @@ auto OrbitingCamera::ComputeProjMatrix(float const aspect_ratio) const -> Direct
 
   return proj_mtx;
 }
+
+auto OrbitingCamera::GetVerticalFovDegrees() const -> float {
+  return vertical_fov_degrees_;
+}
 }
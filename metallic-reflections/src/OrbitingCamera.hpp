@@ -14,6 +14,7 @@ public:
   [[nodiscard]] auto ComputePosition() const -> DirectX::XMFLOAT3;
   [[nodiscard]] auto ComputeViewMatrix() const -> DirectX::XMFLOAT4X4;
   [[nodiscard]] auto ComputeProjMatrix(float aspect_ratio) const -> DirectX::XMFLOAT4X4;
+  [[nodiscard]] auto GetVerticalFovDegrees() const -> float;
 
 private:
   DirectX::XMFLOAT3 orbit_center_;
@@ -0,0 +1,831 @@
+#include "bc6h.hpp"
+
+#include "parallel.hpp"
+#include "pixel_packing.hpp"
+
+import std;
+
+namespace refl {
+namespace {
+float constexpr kMaxHalf{65504.0f};
+
+// Partitions the quality mode tries the two region modes on, picked by how well a line fits each region
+std::size_t constexpr kQualityPartitionCount{4};
+// Candidates the quality mode refits the endpoints of with least squares, and the refits per candidate
+std::size_t constexpr kQualityRefineCandidateCount{4};
+int constexpr kQualityRefineCount{2};
+
+// A run of bits of a stored endpoint. Modes scatter the endpoint bits over the header one run after the other.
+struct BitRun {
+  std::uint8_t endpoint; // 0 and 1 belong to region 0, 2 and 3 to region 1
+  std::uint8_t channel;
+  std::uint8_t low_bit;
+  std::uint8_t count;
+};
+
+
+// The helpers below read like the layouts of the BC6H documentation, R(1, 4, 0) is rx[4:0]
+
+constexpr auto R(std::uint8_t const endpoint, std::uint8_t const high, std::uint8_t const low) -> BitRun {
+  return {endpoint, 0, low, static_cast<std::uint8_t>(high - low + 1)};
+}
+
+
+constexpr auto G(std::uint8_t const endpoint, std::uint8_t const high, std::uint8_t const low) -> BitRun {
+  return {endpoint, 1, low, static_cast<std::uint8_t>(high - low + 1)};
+}
+
+
+constexpr auto B(std::uint8_t const endpoint, std::uint8_t const high, std::uint8_t const low) -> BitRun {
+  return {endpoint, 2, low, static_cast<std::uint8_t>(high - low + 1)};
+}
+
+
+std::array constexpr kMode1Layout{
+  G(2, 4, 4), B(2, 4, 4), B(3, 4, 4), R(0, 9, 0), G(0, 9, 0), B(0, 9, 0), R(1, 4, 0), G(3, 4, 4), G(2, 3, 0),
+  G(1, 4, 0), B(3, 0, 0), G(3, 3, 0), B(1, 4, 0), B(3, 1, 1), B(2, 3, 0), R(2, 4, 0), B(3, 2, 2), R(3, 4, 0),
+  B(3, 3, 3)
+};
+
+std::array constexpr kMode2Layout{
+  G(2, 5, 5), G(3, 4, 4), G(3, 5, 5), R(0, 6, 0), B(3, 0, 0), B(3, 1, 1), B(2, 4, 4), G(0, 6, 0), B(2, 5, 5),
+  B(3, 2, 2), G(2, 4, 4), B(0, 6, 0), B(3, 3, 3), B(3, 5, 5), B(3, 4, 4), R(1, 5, 0), G(2, 3, 0), G(1, 5, 0),
+  G(3, 3, 0), B(1, 5, 0), B(2, 3, 0), R(2, 5, 0), R(3, 5, 0)
+};
+
+std::array constexpr kMode3Layout{
+  R(0, 9, 0), G(0, 9, 0), B(0, 9, 0), R(1, 4, 0), R(0, 10, 10), G(2, 3, 0), G(1, 3, 0), G(0, 10, 10), B(3, 0, 0),
+  G(3, 3, 0), B(1, 3, 0), B(0, 10, 10), B(3, 1, 1), B(2, 3, 0), R(2, 4, 0), B(3, 2, 2), R(3, 4, 0), B(3, 3, 3)
+};
+
+std::array constexpr kMode4Layout{
+  R(0, 9, 0), G(0, 9, 0), B(0, 9, 0), R(1, 3, 0), R(0, 10, 10), G(3, 4, 4), G(2, 3, 0), G(1, 4, 0), G(0, 10, 10),
+  G(3, 3, 0), B(1, 3, 0), B(0, 10, 10), B(3, 1, 1), B(2, 3, 0), R(2, 3, 0), B(3, 0, 0), B(3, 2, 2), R(3, 3, 0),
+  G(2, 4, 4), B(3, 3, 3)
+};
+
+std::array constexpr kMode5Layout{
+  R(0, 9, 0), G(0, 9, 0), B(0, 9, 0), R(1, 3, 0), R(0, 10, 10), B(2, 4, 4), G(2, 3, 0), G(1, 3, 0), G(0, 10, 10),
+  B(3, 0, 0), G(3, 3, 0), B(1, 4, 0), B(0, 10, 10), B(2, 3, 0), R(2, 3, 0), B(3, 1, 1), B(3, 2, 2), R(3, 3, 0),
+  B(3, 4, 4), B(3, 3, 3)
+};
+
+std::array constexpr kMode6Layout{
+  R(0, 8, 0), B(2, 4, 4), G(0, 8, 0), G(2, 4, 4), B(0, 8, 0), B(3, 4, 4), R(1, 4, 0), G(3, 4, 4), G(2, 3, 0),
+  G(1, 4, 0), B(3, 0, 0), G(3, 3, 0), B(1, 4, 0), B(3, 1, 1), B(2, 3, 0), R(2, 4, 0), B(3, 2, 2), R(3, 4, 0),
+  B(3, 3, 3)
+};
+
+std::array constexpr kMode7Layout{
+  R(0, 7, 0), G(3, 4, 4), B(2, 4, 4), G(0, 7, 0), B(3, 2, 2), G(2, 4, 4), B(0, 7, 0), B(3, 3, 3), B(3, 4, 4),
+  R(1, 5, 0), G(2, 3, 0), G(1, 4, 0), B(3, 0, 0), G(3, 3, 0), B(1, 4, 0), B(3, 1, 1), B(2, 3, 0), R(2, 5, 0),
+  R(3, 5, 0)
+};
+
+std::array constexpr kMode8Layout{
+  R(0, 7, 0), B(3, 0, 0), B(2, 4, 4), G(0, 7, 0), G(2, 5, 5), G(2, 4, 4), B(0, 7, 0), G(3, 5, 5), B(3, 4, 4),
+  R(1, 4, 0), G(3, 4, 4), G(2, 3, 0), G(1, 5, 0), G(3, 3, 0), B(1, 4, 0), B(3, 1, 1), B(2, 3, 0), R(2, 4, 0),
+  B(3, 2, 2), R(3, 4, 0), B(3, 3, 3)
+};
+
+std::array constexpr kMode9Layout{
+  R(0, 7, 0), B(3, 1, 1), B(2, 4, 4), G(0, 7, 0), B(2, 5, 5), G(2, 4, 4), B(0, 7, 0), B(3, 5, 5), B(3, 4, 4),
+  R(1, 4, 0), G(3, 4, 4), G(2, 3, 0), G(1, 4, 0), B(3, 0, 0), G(3, 3, 0), B(1, 5, 0), B(2, 3, 0), R(2, 4, 0),
+  B(3, 2, 2), R(3, 4, 0), B(3, 3, 3)
+};
+
+std::array constexpr kMode10Layout{
+  R(0, 5, 0), G(3, 4, 4), B(3, 0, 0), B(3, 1, 1), B(2, 4, 4), G(0, 5, 0), G(2, 5, 5), B(2, 5, 5), B(3, 2, 2),
+  G(2, 4, 4), B(0, 5, 0), G(3, 5, 5), B(3, 3, 3), B(3, 5, 5), B(3, 4, 4), R(1, 5, 0), G(2, 3, 0), G(1, 5, 0),
+  G(3, 3, 0), B(1, 5, 0), B(2, 3, 0), R(2, 5, 0), R(3, 5, 0)
+};
+
+std::array constexpr kMode11Layout{R(0, 9, 0), G(0, 9, 0), B(0, 9, 0), R(1, 9, 0), G(1, 9, 0), B(1, 9, 0)};
+
+std::array constexpr kMode12Layout{
+  R(0, 9, 0), G(0, 9, 0), B(0, 9, 0), R(1, 8, 0), R(0, 10, 10), G(1, 8, 0), G(0, 10, 10), B(1, 8, 0), B(0, 10, 10)
+};
+
+// The high bits of the base endpoint are stored in reverse order in the last two modes
+std::array constexpr kMode13Layout{
+  R(0, 9, 0), G(0, 9, 0), B(0, 9, 0), R(1, 7, 0), R(0, 11, 11), R(0, 10, 10), G(1, 7, 0), G(0, 11, 11),
+  G(0, 10, 10), B(1, 7, 0), B(0, 11, 11), B(0, 10, 10)
+};
+
+std::array constexpr kMode14Layout{
+  R(0, 9, 0), G(0, 9, 0), B(0, 9, 0), R(1, 3, 0), R(0, 15, 15), R(0, 14, 14), R(0, 13, 13), R(0, 12, 12),
+  R(0, 11, 11), R(0, 10, 10), G(1, 3, 0), G(0, 15, 15), G(0, 14, 14), G(0, 13, 13), G(0, 12, 12), G(0, 11, 11),
+  G(0, 10, 10), B(1, 3, 0), B(0, 15, 15), B(0, 14, 14), B(0, 13, 13), B(0, 12, 12), B(0, 11, 11), B(0, 10, 10)
+};
+
+
+struct ModeInfo {
+  std::uint8_t value; // Mode bits as stored
+  std::uint8_t value_bit_count;
+  std::uint8_t region_count;
+  bool transformed; // Endpoints after the first one are stored as deltas from it
+  std::uint8_t endpoint_bits;
+  std::array<std::uint8_t, 3> delta_bits; // Per channel, endpoint_bits if not transformed
+  std::span<BitRun const> layout;
+};
+
+
+std::array<ModeInfo, 14> constexpr kModes{
+  ModeInfo{0x00, 2, 2, true, 10, {5, 5, 5}, kMode1Layout},
+  ModeInfo{0x01, 2, 2, true, 7, {6, 6, 6}, kMode2Layout},
+  ModeInfo{0x02, 5, 2, true, 11, {5, 4, 4}, kMode3Layout},
+  ModeInfo{0x06, 5, 2, true, 11, {4, 5, 4}, kMode4Layout},
+  ModeInfo{0x0a, 5, 2, true, 11, {4, 4, 5}, kMode5Layout},
+  ModeInfo{0x0e, 5, 2, true, 9, {5, 5, 5}, kMode6Layout},
+  ModeInfo{0x12, 5, 2, true, 8, {6, 5, 5}, kMode7Layout},
+  ModeInfo{0x16, 5, 2, true, 8, {5, 6, 5}, kMode8Layout},
+  ModeInfo{0x1a, 5, 2, true, 8, {5, 5, 6}, kMode9Layout},
+  ModeInfo{0x1e, 5, 2, false, 6, {6, 6, 6}, kMode10Layout},
+  ModeInfo{0x03, 5, 1, false, 10, {10, 10, 10}, kMode11Layout},
+  ModeInfo{0x07, 5, 1, true, 11, {9, 9, 9}, kMode12Layout},
+  ModeInfo{0x0b, 5, 1, true, 12, {8, 8, 8}, kMode13Layout},
+  ModeInfo{0x0f, 5, 1, true, 16, {4, 4, 4}, kMode14Layout},
+};
+
+std::size_t constexpr kFirstSingleRegionMode{10};
+
+// Two region partitions shared with BC7, bit i is the region of texel i
+std::array<std::uint16_t, 32> constexpr kPartitions{
+  0xCCCC, 0x8888, 0xEEEE, 0xECC8, 0xC880, 0xFEEC, 0xFEC8, 0xEC80, 0xC800, 0xFFEC, 0xFE80, 0xE800, 0xFFE8, 0xFF00,
+  0xFFF0, 0xF000, 0xF710, 0x008E, 0x7100, 0x08CE, 0x008C, 0x7310, 0x3100, 0x8CCE, 0x088C, 0x3110, 0x6666, 0x366C,
+  0x17E8, 0x0FF0, 0x718E, 0x399C
+};
+
+// Texel of region 1 whose index is stored with its top bit implied to be 0. Texel 0 is the anchor of region 0.
+std::array<std::uint8_t, 32> constexpr kRegion1Anchors{
+  15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+  15, 2, 8, 2, 2, 8, 8, 15, 2, 8, 2, 2, 8, 8, 2, 2
+};
+
+std::array<int, 8> constexpr kWeights3{0, 9, 18, 27, 37, 46, 55, 64};
+std::array<int, 16> constexpr kWeights4{0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+using IntColor = std::array<int, 3>;
+using FloatColor = std::array<float, 3>;
+using Endpoints = std::array<IntColor, 4>;
+
+
+auto GetWeights(ModeInfo const& mode) -> std::span<int const> {
+  return mode.region_count == 2 ? std::span<int const>{kWeights3} : std::span<int const>{kWeights4};
+}
+
+
+auto GetRegion(std::uint16_t const partition_mask, std::size_t const texel) -> std::size_t {
+  return (partition_mask >> texel) & 1u;
+}
+
+
+auto IsAnchor(ModeInfo const& mode, std::uint32_t const partition, std::size_t const texel) -> bool {
+  return texel == 0 || (mode.region_count == 2 && texel == kRegion1Anchors[partition]);
+}
+
+
+auto WriteBits(Bc6hBlock& block, std::uint32_t& pos, std::uint32_t const value, std::uint32_t const count) -> void {
+  for (std::uint32_t i{0}; i < count; i++, pos++) {
+    block[pos / 8] |= static_cast<std::uint8_t>(((value >> i) & 1u) << (pos % 8));
+  }
+}
+
+
+auto ReadBits(Bc6hBlock const& block, std::uint32_t& pos, std::uint32_t const count) -> std::uint32_t {
+  std::uint32_t value{0};
+
+  for (std::uint32_t i{0}; i < count; i++, pos++) {
+    value |= ((block[pos / 8] >> (pos % 8)) & 1u) << i;
+  }
+
+  return value;
+}
+
+
+auto SignExtend(int const value, int const bits) -> int {
+  auto const shift{32 - bits};
+  return static_cast<int>(static_cast<std::uint32_t>(value) << shift) >> shift;
+}
+
+
+// Maps a quantized endpoint to the 16-bit interpolation domain
+auto Unquantize(int const value, int const bits) -> int {
+  if (bits >= 15 || value == 0) {
+    return value;
+  }
+
+  if (value == (1 << bits) - 1) {
+    return 0xFFFF;
+  }
+
+  return ((value << 16) + 0x8000) >> bits;
+}
+
+
+// Maps the interpolation domain to half bits
+auto FinishUnquantize(int const value) -> int {
+  return (value * 31) >> 6;
+}
+
+
+auto Interpolate(int const a, int const b, int const weight) -> int {
+  return ((64 - weight) * a + weight * b + 32) >> 6;
+}
+
+
+// Closest quantized value to a position in the interpolation domain
+auto Quantize(float const value, int const bits) -> int {
+  auto const max_value{(1 << bits) - 1};
+  auto const low{std::clamp(static_cast<int>(value * static_cast<float>(1 << bits) / 65536.0f), 0, max_value)};
+  auto const high{std::min(low + 1, max_value)};
+  return std::abs(static_cast<float>(Unquantize(high, bits)) - value) <
+         std::abs(static_cast<float>(Unquantize(low, bits)) - value) ? high : low;
+}
+
+
+// Texels as half bits and as positions in the interpolation domain that unquantize to them
+struct BlockTexels {
+  std::array<IntColor, 16> halves;
+  std::array<FloatColor, 16> values;
+};
+
+
+auto LoadBlockTexels(std::span<Vector4 const, 16> const texels) -> BlockTexels {
+  BlockTexels block;
+
+  for (std::size_t i{0}; i < 16; i++) {
+    for (std::size_t c{0}; c < 3; c++) {
+      // Also maps NaN to 0
+      auto const value{texels[i][c] > 0 ? std::min(texels[i][c], kMaxHalf) : 0.0f};
+      auto const half{static_cast<int>(FloatToHalf(value))};
+      block.halves[i][c] = half;
+      block.values[i][c] = std::min((static_cast<float>(half) + 0.5f) * (64.0f / 31.0f), 65535.0f);
+    }
+  }
+
+  return block;
+}
+
+
+auto Dot(FloatColor const& a, FloatColor const& b) -> float {
+  return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+
+// Line through the texels of a region: endpoints spanning the projections onto the principal axis, and the squared
+// distance of the texels from the line
+struct RegionFit {
+  std::array<FloatColor, 2> endpoints;
+  float error;
+};
+
+
+auto FitRegion(BlockTexels const& texels, std::uint16_t const partition_mask, std::size_t const region) -> RegionFit {
+  FloatColor mean{};
+  auto count{0};
+
+  for (std::size_t i{0}; i < 16; i++) {
+    if (GetRegion(partition_mask, i) == region) {
+      for (std::size_t c{0}; c < 3; c++) {
+        mean[c] += texels.values[i][c];
+      }
+      count++;
+    }
+  }
+
+  for (auto& value : mean) {
+    value /= static_cast<float>(count);
+  }
+
+  std::array<float, 6> cov{}; // xx, xy, xz, yy, yz, zz
+
+  for (std::size_t i{0}; i < 16; i++) {
+    if (GetRegion(partition_mask, i) == region) {
+      FloatColor const d{
+        texels.values[i][0] - mean[0], texels.values[i][1] - mean[1], texels.values[i][2] - mean[2]
+      };
+      cov[0] += d[0] * d[0];
+      cov[1] += d[0] * d[1];
+      cov[2] += d[0] * d[2];
+      cov[3] += d[1] * d[1];
+      cov[4] += d[1] * d[2];
+      cov[5] += d[2] * d[2];
+    }
+  }
+
+  // Power iteration for the principal axis, starting from the diagonal of the bounding box of the covariance
+  FloatColor axis{cov[0], cov[3], cov[5]};
+
+  for (auto iteration{0}; iteration < 8; iteration++) {
+    FloatColor const next{
+      cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+      cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+      cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2]
+    };
+    auto const length{std::sqrt(Dot(next, next))};
+
+    if (length < 1e-6f) {
+      break;
+    }
+
+    axis = {next[0] / length, next[1] / length, next[2] / length};
+  }
+
+  auto const axis_length{std::sqrt(Dot(axis, axis))};
+
+  if (axis_length < 1e-6f) {
+    return {.endpoints = {mean, mean}, .error = 0};
+  }
+
+  axis = {axis[0] / axis_length, axis[1] / axis_length, axis[2] / axis_length};
+
+  auto min_t{std::numeric_limits<float>::max()};
+  auto max_t{std::numeric_limits<float>::lowest()};
+  auto error{0.0f};
+
+  for (std::size_t i{0}; i < 16; i++) {
+    if (GetRegion(partition_mask, i) == region) {
+      FloatColor const d{
+        texels.values[i][0] - mean[0], texels.values[i][1] - mean[1], texels.values[i][2] - mean[2]
+      };
+      auto const t{Dot(d, axis)};
+      min_t = std::min(min_t, t);
+      max_t = std::max(max_t, t);
+      error += std::max(Dot(d, d) - t * t, 0.0f);
+    }
+  }
+
+  auto const clamp_color{
+    [](FloatColor const& color) {
+      return FloatColor{
+        std::clamp(color[0], 0.0f, 65535.0f), std::clamp(color[1], 0.0f, 65535.0f),
+        std::clamp(color[2], 0.0f, 65535.0f)
+      };
+    }
+  };
+
+  return {
+    .endpoints = {
+      clamp_color({mean[0] + axis[0] * min_t, mean[1] + axis[1] * min_t, mean[2] + axis[2] * min_t}),
+      clamp_color({mean[0] + axis[0] * max_t, mean[1] + axis[1] * max_t, mean[2] + axis[2] * max_t})
+    },
+    .error = error
+  };
+}
+
+
+struct Candidate {
+  std::size_t mode;
+  std::uint32_t partition;
+  Endpoints endpoints; // Quantized, deltas already resolved
+  std::array<std::uint8_t, 16> indices;
+  std::int64_t error; // Squared difference of the half bits
+};
+
+
+// Quantizes the endpoints for a mode, picks the best index of every texel and measures the error. Endpoints are
+// swapped so that the anchor texels tend to land in the lower half of the palette, where their index is storable.
+auto EvaluateCandidate(BlockTexels const& texels, std::size_t const mode_index, std::uint32_t const partition,
+                       std::array<std::array<FloatColor, 2>, 2> endpoints) -> Candidate {
+  auto const& mode{kModes[mode_index]};
+  auto const partition_mask{mode.region_count == 2 ? kPartitions[partition] : std::uint16_t{0}};
+  auto const weights{GetWeights(mode)};
+
+  Candidate candidate{.mode = mode_index, .partition = partition, .endpoints = {}, .indices = {}, .error = 0};
+
+  for (std::size_t region{0}; region < mode.region_count; region++) {
+    auto const anchor{region == 0 ? std::size_t{0} : std::size_t{kRegion1Anchors[partition]}};
+    auto& [a, b]{endpoints[region]};
+    FloatColor const ab{b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+    FloatColor const at{
+      texels.values[anchor][0] - a[0], texels.values[anchor][1] - a[1], texels.values[anchor][2] - a[2]
+    };
+
+    if (Dot(at, ab) > 0.5f * Dot(ab, ab)) {
+      std::swap(a, b);
+    }
+
+    for (std::size_t c{0}; c < 3; c++) {
+      candidate.endpoints[2 * region][c] = Quantize(a[c], mode.endpoint_bits);
+      candidate.endpoints[2 * region + 1][c] = Quantize(b[c], mode.endpoint_bits);
+    }
+  }
+
+  // Deltas that do not fit are clamped, which keeps every mode encodable at the cost of accuracy
+  if (mode.transformed) {
+    for (std::size_t e{1}; e < 2u * mode.region_count; e++) {
+      for (std::size_t c{0}; c < 3; c++) {
+        auto const limit{1 << (mode.delta_bits[c] - 1)};
+        auto const delta{std::clamp(candidate.endpoints[e][c] - candidate.endpoints[0][c], -limit, limit - 1)};
+        candidate.endpoints[e][c] = candidate.endpoints[0][c] + delta;
+      }
+    }
+  }
+
+  Endpoints unquantized;
+  std::array<FloatColor, 2> axes;
+  std::array<float, 2> inv_axis_lengths;
+  std::array<std::array<IntColor, 16>, 2> palettes;
+
+  for (std::size_t region{0}; region < mode.region_count; region++) {
+    auto const& a{unquantized[2 * region]};
+    auto const& b{unquantized[2 * region + 1]};
+
+    for (std::size_t c{0}; c < 3; c++) {
+      unquantized[2 * region][c] = Unquantize(candidate.endpoints[2 * region][c], mode.endpoint_bits);
+      unquantized[2 * region + 1][c] = Unquantize(candidate.endpoints[2 * region + 1][c], mode.endpoint_bits);
+      axes[region][c] = static_cast<float>(b[c] - a[c]);
+    }
+
+    auto const length_sq{Dot(axes[region], axes[region])};
+    inv_axis_lengths[region] = length_sq > 0 ? 1 / length_sq : 0;
+
+    for (std::size_t k{0}; k < weights.size(); k++) {
+      for (std::size_t c{0}; c < 3; c++) {
+        palettes[region][k][c] = FinishUnquantize(Interpolate(a[c], b[c], weights[k]));
+      }
+    }
+  }
+
+  // The weights are close to uniform, so the projection onto the endpoint segment lands within one index of the best
+  // one. Only those neighbors are measured.
+  auto const max_index{static_cast<int>(weights.size()) - 1};
+
+  for (std::size_t i{0}; i < 16; i++) {
+    auto const region{GetRegion(partition_mask, i)};
+    auto const& palette{palettes[region]};
+    auto const& a{unquantized[2 * region]};
+    FloatColor const offset{
+      texels.values[i][0] - static_cast<float>(a[0]), texels.values[i][1] - static_cast<float>(a[1]),
+      texels.values[i][2] - static_cast<float>(a[2])
+    };
+    auto const t{std::clamp(Dot(offset, axes[region]) * inv_axis_lengths[region], 0.0f, 1.0f)};
+    auto const last_index{IsAnchor(mode, partition, i) ? max_index / 2 : max_index};
+    auto const guess{std::min(static_cast<int>(t * static_cast<float>(max_index) + 0.5f), last_index)};
+    auto best_error{std::numeric_limits<std::int64_t>::max()};
+
+    for (auto k{std::max(guess - 1, 0)}; k <= std::min(guess + 1, last_index); k++) {
+      std::int64_t error{0};
+
+      for (std::size_t c{0}; c < 3; c++) {
+        auto const d{static_cast<std::int64_t>(palette[k][c] - texels.halves[i][c])};
+        error += d * d;
+      }
+
+      if (error < best_error) {
+        best_error = error;
+        candidate.indices[i] = static_cast<std::uint8_t>(k);
+      }
+    }
+
+    candidate.error += best_error;
+  }
+
+  return candidate;
+}
+
+
+// Least squares endpoints for the indices a candidate picked
+auto RefitEndpoints(BlockTexels const& texels, Candidate const& candidate) -> std::array<std::array<FloatColor, 2>, 2> {
+  auto const& mode{kModes[candidate.mode]};
+  auto const partition_mask{mode.region_count == 2 ? kPartitions[candidate.partition] : std::uint16_t{0}};
+  auto const weights{GetWeights(mode)};
+
+  std::array<std::array<FloatColor, 2>, 2> endpoints{};
+
+  for (std::size_t region{0}; region < mode.region_count; region++) {
+    auto aa{0.0f};
+    auto ab{0.0f};
+    auto bb{0.0f};
+    FloatColor ax{};
+    FloatColor bx{};
+
+    for (std::size_t i{0}; i < 16; i++) {
+      if (GetRegion(partition_mask, i) != region) {
+        continue;
+      }
+
+      auto const t{static_cast<float>(weights[candidate.indices[i]]) / 64.0f};
+      aa += (1 - t) * (1 - t);
+      ab += (1 - t) * t;
+      bb += t * t;
+
+      for (std::size_t c{0}; c < 3; c++) {
+        ax[c] += (1 - t) * texels.values[i][c];
+        bx[c] += t * texels.values[i][c];
+      }
+    }
+
+    auto const det{aa * bb - ab * ab};
+
+    for (std::size_t c{0}; c < 3; c++) {
+      if (std::abs(det) < 1e-6f) {
+        // Every texel uses the same index, so collapse the region to the mean of its texels
+        auto const mean{(ax[c] + bx[c]) / (aa + 2 * ab + bb)};
+        endpoints[region][0][c] = mean;
+        endpoints[region][1][c] = mean;
+      } else {
+        endpoints[region][0][c] = std::clamp((ax[c] * bb - bx[c] * ab) / det, 0.0f, 65535.0f);
+        endpoints[region][1][c] = std::clamp((bx[c] * aa - ax[c] * ab) / det, 0.0f, 65535.0f);
+      }
+    }
+  }
+
+  return endpoints;
+}
+
+
+auto WriteBlock(Candidate const& candidate) -> Bc6hBlock {
+  auto const& mode{kModes[candidate.mode]};
+  auto const index_bits{mode.region_count == 2 ? 3u : 4u};
+
+  Bc6hBlock block{};
+  std::uint32_t pos{0};
+  WriteBits(block, pos, mode.value, mode.value_bit_count);
+
+  auto stored{candidate.endpoints};
+
+  if (mode.transformed) {
+    for (std::size_t e{1}; e < 2u * mode.region_count; e++) {
+      for (std::size_t c{0}; c < 3; c++) {
+        stored[e][c] = (candidate.endpoints[e][c] - candidate.endpoints[0][c]) & ((1 << mode.delta_bits[c]) - 1);
+      }
+    }
+  }
+
+  for (auto const& run : mode.layout) {
+    auto const value{static_cast<std::uint32_t>(stored[run.endpoint][run.channel]) >> run.low_bit};
+    WriteBits(block, pos, value & ((1u << run.count) - 1), run.count);
+  }
+
+  if (mode.region_count == 2) {
+    WriteBits(block, pos, candidate.partition, 5);
+  }
+
+  for (std::size_t i{0}; i < 16; i++) {
+    WriteBits(block, pos, candidate.indices[i], IsAnchor(mode, candidate.partition, i) ? index_bits - 1 : index_bits);
+  }
+
+  return block;
+}
+
+
+// Partitions ordered by how well a line fits each of their regions
+auto RankPartitions(BlockTexels const& texels) -> std::array<std::uint32_t, 32> {
+  std::array<float, 32> errors;
+
+  for (std::uint32_t partition{0}; partition < 32; partition++) {
+    errors[partition] = FitRegion(texels, kPartitions[partition], 0).error +
+                        FitRegion(texels, kPartitions[partition], 1).error;
+  }
+
+  std::array<std::uint32_t, 32> ranking;
+  std::iota(ranking.begin(), ranking.end(), 0u);
+  std::ranges::stable_sort(ranking, {}, [&](std::uint32_t const partition) { return errors[partition]; });
+  return ranking;
+}
+
+
+// Calls func(face, mip, block_row) for every row of blocks of every face and of the mips in mip_mask in parallel
+template<typename Func>
+auto ForEachBlockRow(Bc6hCubeMap const& cube, std::uint32_t const mip_mask, unsigned const thread_count,
+                     Func&& func) -> void {
+  std::vector<std::array<std::uint32_t, 3>> rows;
+
+  for (std::uint32_t face{0}; face < 6; face++) {
+    for (std::uint32_t mip{0}; mip < cube.mip_count; mip++) {
+      if ((mip_mask >> mip & 1) == 0) {
+        continue;
+      }
+
+      for (std::uint32_t row{0}; row < cube.GetMipBlockCount(mip); row++) {
+        rows.push_back({face, mip, row});
+      }
+    }
+  }
+
+  ParallelFor(rows.size(), thread_count, [&](std::size_t const i) {
+    func(rows[i][0], rows[i][1], rows[i][2]);
+  });
+}
+}
+
+
+auto EncodeBc6hBlock(std::span<Vector4 const, 16> const texels, Bc6hQuality const quality) -> Bc6hBlock {
+  auto const block_texels{LoadBlockTexels(texels)};
+  auto const single_fit{FitRegion(block_texels, 0, 0)};
+
+  std::vector<Candidate> candidates;
+
+  for (auto mode{kFirstSingleRegionMode}; mode < kModes.size(); mode++) {
+    candidates.push_back(EvaluateCandidate(block_texels, mode, 0, {single_fit.endpoints, {}}));
+
+    if (candidates.back().error == 0) {
+      return WriteBlock(candidates.back());
+    }
+  }
+
+  if (quality == Bc6hQuality::kQuality) {
+    auto const ranking{RankPartitions(block_texels)};
+
+    for (std::size_t i{0}; i < kQualityPartitionCount; i++) {
+      auto const partition{ranking[i]};
+      std::array const endpoints{
+        FitRegion(block_texels, kPartitions[partition], 0).endpoints,
+        FitRegion(block_texels, kPartitions[partition], 1).endpoints
+      };
+
+      for (std::size_t mode{0}; mode < kFirstSingleRegionMode; mode++) {
+        candidates.push_back(EvaluateCandidate(block_texels, mode, partition, endpoints));
+      }
+    }
+
+    // Refitting is the expensive part, so only the most promising candidates get it
+    auto const refine_count{std::min(kQualityRefineCandidateCount, candidates.size())};
+    std::ranges::partial_sort(candidates, candidates.begin() + refine_count, {}, &Candidate::error);
+
+    for (std::size_t i{0}; i < refine_count; i++) {
+      auto& candidate{candidates[i]};
+
+      for (auto j{0}; j < kQualityRefineCount && candidate.error > 0; j++) {
+        auto refined{
+          EvaluateCandidate(block_texels, candidate.mode, candidate.partition, RefitEndpoints(block_texels, candidate))
+        };
+
+        if (refined.error >= candidate.error) {
+          break;
+        }
+
+        candidate = refined;
+      }
+    }
+  }
+
+  return WriteBlock(*std::ranges::min_element(candidates, {}, &Candidate::error));
+}
+
+
+auto DecodeBc6hBlock(Bc6hBlock const& block) -> std::array<Vector4, 16> {
+  std::array<Vector4, 16> texels;
+  texels.fill({0, 0, 0, 1});
+
+  std::uint32_t pos{0};
+  auto value{ReadBits(block, pos, 2)};
+
+  if (value > 1) {
+    value |= ReadBits(block, pos, 3) << 2;
+  }
+
+  auto const mode_it{std::ranges::find_if(kModes, [value](ModeInfo const& mode) { return mode.value == value; })};
+
+  if (mode_it == kModes.end()) {
+    return texels;
+  }
+
+  auto const& mode{*mode_it};
+  auto const index_bits{mode.region_count == 2 ? 3u : 4u};
+  auto const weights{GetWeights(mode)};
+
+  Endpoints endpoints{};
+
+  for (auto const& run : mode.layout) {
+    endpoints[run.endpoint][run.channel] |= static_cast<int>(ReadBits(block, pos, run.count) << run.low_bit);
+  }
+
+  auto const partition{mode.region_count == 2 ? ReadBits(block, pos, 5) : 0u};
+  auto const partition_mask{mode.region_count == 2 ? kPartitions[partition] : std::uint16_t{0}};
+
+  if (mode.transformed) {
+    auto const mask{(1 << mode.endpoint_bits) - 1};
+
+    for (std::size_t e{1}; e < 2u * mode.region_count; e++) {
+      for (std::size_t c{0}; c < 3; c++) {
+        endpoints[e][c] = (endpoints[0][c] + SignExtend(endpoints[e][c], mode.delta_bits[c])) & mask;
+      }
+    }
+  }
+
+  for (std::size_t i{0}; i < 16; i++) {
+    auto const index{ReadBits(block, pos, IsAnchor(mode, partition, i) ? index_bits - 1 : index_bits)};
+    auto const region{GetRegion(partition_mask, i)};
+
+    for (std::size_t c{0}; c < 3; c++) {
+      auto const a{Unquantize(endpoints[2 * region][c], mode.endpoint_bits)};
+      auto const b{Unquantize(endpoints[2 * region + 1][c], mode.endpoint_bits)};
+      auto const half{static_cast<std::uint16_t>(FinishUnquantize(Interpolate(a, b, weights[index])))};
+      texels[i][c] = HalfToFloat(half);
+    }
+  }
+
+  return texels;
+}
+
+
+auto Bc6hCubeMap::GetMipSize(std::uint32_t const mip) const -> std::uint32_t {
+  return std::max(face_size >> mip, 1u);
+}
+
+
+auto Bc6hCubeMap::GetMipBlockCount(std::uint32_t const mip) const -> std::uint32_t {
+  return (GetMipSize(mip) + 3) / 4;
+}
+
+
+auto Bc6hCubeMap::GetFaceMipOffset(std::uint32_t const face, std::uint32_t const mip) const -> std::size_t {
+  std::size_t face_block_count{0};
+  std::size_t mip_offset{0};
+
+  for (std::uint32_t i{0}; i < mip_count; i++) {
+    auto const count{static_cast<std::size_t>(GetMipBlockCount(i))};
+
+    if (i < mip) {
+      mip_offset += count * count;
+    }
+
+    face_block_count += count * count;
+  }
+
+  return face * face_block_count + mip_offset;
+}
+
+
+auto Bc6hCubeMap::GetFaceMip(std::uint32_t const face, std::uint32_t const mip) -> std::span<Bc6hBlock> {
+  auto const count{static_cast<std::size_t>(GetMipBlockCount(mip))};
+  return std::span{blocks}.subspan(GetFaceMipOffset(face, mip), count * count);
+}
+
+
+auto Bc6hCubeMap::GetFaceMip(std::uint32_t const face,
+                             std::uint32_t const mip) const -> std::span<Bc6hBlock const> {
+  auto const count{static_cast<std::size_t>(GetMipBlockCount(mip))};
+  return std::span{blocks}.subspan(GetFaceMipOffset(face, mip), count * count);
+}
+
+
+auto CreateBc6hCubeMap(std::uint32_t const face_size, std::uint32_t const mip_count) -> Bc6hCubeMap {
+  Bc6hCubeMap cube{
+    .face_size = face_size,
+    .mip_count = mip_count != 0 ? mip_count : static_cast<std::uint32_t>(std::bit_width(face_size)),
+    .blocks = {}
+  };
+  cube.blocks.resize(cube.GetFaceMipOffset(6, 0));
+  return cube;
+}
+
+
+auto EncodeBc6hCubeMap(CubeMap const& cube, Bc6hQuality const quality, unsigned const thread_count,
+                       std::uint32_t const mip_mask) -> Bc6hCubeMap {
+  auto compressed{CreateBc6hCubeMap(cube.face_size, cube.mip_count)};
+
+  ForEachBlockRow(compressed, mip_mask, thread_count, [&](std::uint32_t const face, std::uint32_t const mip,
+                                                          std::uint32_t const block_y) {
+    auto const size{cube.GetMipSize(mip)};
+    auto const block_count{compressed.GetMipBlockCount(mip)};
+    auto const src{cube.GetFaceMip(face, mip)};
+    auto const dst{compressed.GetFaceMip(face, mip)};
+
+    for (std::uint32_t block_x{0}; block_x < block_count; block_x++) {
+      // Mips smaller than a block repeat their edge texels
+      std::array<Vector4, 16> texels;
+
+      for (std::uint32_t y{0}; y < 4; y++) {
+        for (std::uint32_t x{0}; x < 4; x++) {
+          auto const src_x{std::min(block_x * 4 + x, size - 1)};
+          auto const src_y{std::min(block_y * 4 + y, size - 1)};
+          texels[y * 4 + x] = src[static_cast<std::size_t>(src_y) * size + src_x];
+        }
+      }
+
+      dst[static_cast<std::size_t>(block_y) * block_count + block_x] = EncodeBc6hBlock(texels, quality);
+    }
+  });
+
+  return compressed;
+}
+
+
+auto DecodeBc6hCubeMap(Bc6hCubeMap const& cube, unsigned const thread_count) -> CubeMap {
+  auto decoded{CreateCubeMap(cube.face_size, cube.mip_count)};
+
+  ForEachBlockRow(cube, ~0u, thread_count, [&](std::uint32_t const face, std::uint32_t const mip,
+                                               std::uint32_t const block_y) {
+    auto const size{decoded.GetMipSize(mip)};
+    auto const block_count{cube.GetMipBlockCount(mip)};
+    auto const src{cube.GetFaceMip(face, mip)};
+    auto const dst{decoded.GetFaceMip(face, mip)};
+
+    for (std::uint32_t block_x{0}; block_x < block_count; block_x++) {
+      auto const texels{DecodeBc6hBlock(src[static_cast<std::size_t>(block_y) * block_count + block_x])};
+
+      for (std::uint32_t y{0}; y < 4 && block_y * 4 + y < size; y++) {
+        for (std::uint32_t x{0}; x < 4 && block_x * 4 + x < size; x++) {
+          dst[static_cast<std::size_t>(block_y * 4 + y) * size + block_x * 4 + x] = texels[y * 4 + x];
+        }
+      }
+    }
+  });
+
+  return decoded;
+}
+}
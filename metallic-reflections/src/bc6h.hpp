@@ -0,0 +1,48 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "environment_map.hpp"
+#include "scene.hpp"
+
+namespace refl {
+using Bc6hBlock = std::array<std::uint8_t, 16>; // 4x4 texels of DXGI_FORMAT_BC6H_UF16
+
+enum class Bc6hQuality : std::uint32_t {
+  kFast, // One region modes only
+  kQuality // Two region modes as well on the most promising partitions, with least squares endpoint refinement
+};
+
+// Encodes 4x4 texels given row by row. BC6H_UF16 stores unsigned halves, so negative and NaN channels become 0 and
+// values beyond the half range are clamped. Alpha is ignored.
+[[nodiscard]] auto EncodeBc6hBlock(std::span<Vector4 const, 16> texels, Bc6hQuality quality) -> Bc6hBlock;
+// Decodes a block the way D3D does, reserved modes decode to black. Alpha is 1.
+[[nodiscard]] auto DecodeBc6hBlock(Bc6hBlock const& block) -> std::array<Vector4, 16>;
+
+// BC6H counterpart of CubeMap, blocks stored in the same subresource order, each mip row by row
+struct Bc6hCubeMap {
+  std::uint32_t face_size; // Of mip 0, a multiple of 4
+  std::uint32_t mip_count;
+  std::vector<Bc6hBlock> blocks;
+
+  [[nodiscard]] auto GetMipSize(std::uint32_t mip) const -> std::uint32_t;
+  // Blocks along an edge of a face of the mip. Mips smaller than a block still take a whole one.
+  [[nodiscard]] auto GetMipBlockCount(std::uint32_t mip) const -> std::uint32_t;
+  [[nodiscard]] auto GetFaceMipOffset(std::uint32_t face, std::uint32_t mip) const -> std::size_t;
+  [[nodiscard]] auto GetFaceMip(std::uint32_t face, std::uint32_t mip) -> std::span<Bc6hBlock>;
+  [[nodiscard]] auto GetFaceMip(std::uint32_t face, std::uint32_t mip) const -> std::span<Bc6hBlock const>;
+};
+
+// Zeroed blocks, a mip_count of 0 gives the full chain down to 1x1
+[[nodiscard]] auto CreateBc6hCubeMap(std::uint32_t face_size, std::uint32_t mip_count = 0) -> Bc6hCubeMap;
+
+// Encodes every block of every face and of the mips whose bit is set in mip_mask in parallel, the blocks of the other
+// mips stay zeroed. The face size of the cube must be a multiple of 4.
+[[nodiscard]] auto EncodeBc6hCubeMap(CubeMap const& cube, Bc6hQuality quality, unsigned thread_count,
+                                     std::uint32_t mip_mask = ~0u) -> Bc6hCubeMap;
+[[nodiscard]] auto DecodeBc6hCubeMap(Bc6hCubeMap const& cube, unsigned thread_count) -> CubeMap;
+}
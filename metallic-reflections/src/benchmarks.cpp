@@ -0,0 +1,3483 @@
+#include "benchmarks.hpp"
+
+#include <assimp/Importer.hpp>
+#include <assimp/postprocess.h>
+#include <DirectXPackedVector.h>
+#include <stb_image.h>
+
+#include "bc6h.hpp"
+#include "brdf.hpp"
+#include "bvh.hpp"
+#include "dfg_lut.hpp"
+#include "environment_sampling.hpp"
+#include "frustum.hpp"
+#include "hdr_decoder.hpp"
+#include "ibl_baker.hpp"
+#include "ibl_lighting.hpp"
+#include "irradiance_sh.hpp"
+#include "mesh_lod.hpp"
+#include "mesh_optimization.hpp"
+#include "meshlets.hpp"
+#include "OrbitingCamera.hpp"
+#include "parallel.hpp"
+#include "pixel_packing.hpp"
+#include "scene.hpp"
+#include "scene_batching.hpp"
+#include "scene_culling.hpp"
+#include "scene_textures.hpp"
+#include "ssr.hpp"
+#include "vertex_packing.hpp"
+#include "winapi_helpers.hpp"
+
+import std;
+
+namespace refl {
+namespace {
+using Milliseconds = std::chrono::duration<double, std::milli>;
+
+// Largest relative difference per channel the fast IBL prefilter may have from the scalar reference. Channels darker
+// than kIblErrorFloor are compared in absolute terms.
+double constexpr kIblMaxRelativeError{1e-3};
+double constexpr kIblErrorFloor{1e-2};
+
+// Roughness ranges of scenes the partial IBL bakes are checked on, from mirrors only to rough materials only
+std::array<std::array<float, 2>, 5> constexpr kMipRangeRoughness{{{0, 0}, {0, 0.3f}, {0.2f, 0.6f}, {0.5f, 1}, {1, 1}}};
+// Roughness values within each range the mips the lighting pass reads are checked at
+std::uint32_t constexpr kMipRangeRoughnessSteps{1000};
+
+// Largest difference the vectorized DFG integration may have from the scalar one, and the largest difference the
+// table based lighting may have from brute force integration under a uniform environment, where the split sum is exact
+double constexpr kDfgMaxSimdError{1e-4};
+double constexpr kDfgMaxLightingError{1e-2};
+std::uint32_t constexpr kDfgReferenceGridSize{256};
+
+// Floats converted per work item of the sweep over every float bit pattern, and how many times each timed conversion
+// runs, the fastest run is reported
+std::size_t constexpr kFloatSweepChunkSize{1 << 16};
+std::uint32_t constexpr kPixelPackingRepetitions{5};
+
+// Face size of the equirect to cube orientation checks, odd so that a texel lies at the center of every face, the size
+// of the synthetic equirect maps they convert, and the largest angle in degrees a converted direction may be off by
+std::uint32_t constexpr kOrientationFaceSize{65};
+std::uint32_t constexpr kOrientationMapWidth{1024};
+double constexpr kOrientationMaxAngle{1.0};
+
+// Largest relative difference the solid angle weighted average of a cube mip may have from that of mip 0
+double constexpr kCubeMipMaxMeanDrift{1e-3};
+
+// The exact prefilter the environment sampling benchmark compares against sums over every texel of the largest mip
+// not larger than this
+std::uint32_t constexpr kSamplingGroundTruthSize{64};
+// Total variation distance allowed between the histogram of environment samples and the distribution
+double constexpr kSamplingMaxHistogramError{1e-2};
+std::uint32_t constexpr kSamplingHistogramSampleCount{1 << 22};
+std::uint32_t constexpr kSamplingDistributionWidth{512};
+
+// Largest difference of a fast SH projection from the double precision one, relative to the band 0 coefficient
+double constexpr kShMaxProjectionError{1e-4};
+// Largest difference of the SH irradiance from brute force convolution with the band-limited cosine, relative to the
+// mean irradiance over the test normals. The difference from the clamped cosine is only reported: it is the error of
+// bands 0 to 2 themselves, a few percent for skies but tens of percent next to a small light.
+double constexpr kShMaxIrradianceError{1e-3};
+std::uint32_t constexpr kShTestNormalCount{32};
+
+// Largest difference per channel the CPU SSR may have from the output of the shader, relative to the shader output,
+// channels darker than kSsrErrorFloor are compared in absolute terms. The GPU fuses multiplies and adds where the CPU
+// does not, which is enough for rays that pass a depth just at the thickness threshold to hit at a different step and
+// end up on another pixel, so a small fraction of the pixels may differ by more. Grazing rays over a mirror floor that
+// fills most of the screen flip for about two percent of the pixels.
+double constexpr kSsrMaxError{1e-3};
+double constexpr kSsrErrorFloor{1e-2};
+double constexpr kSsrMaxMismatchFraction{5e-2};
+// The Hi-Z march only differs from the linear one where rounding moves a step across the edge of a pyramid cell
+double constexpr kSsrMaxHiZMismatchFraction{1e-4};
+// Relative view depth difference of neighbors the SSR upsampling error is reported separately for
+float constexpr kSsrEdgeDepthRatio{0.02f};
+// Largest distance in pixels a still camera may reproject a pixel center from itself, and largest distance of the
+// mirror image of a hit point from its reflection across the surface, relative to the distance of the camera to the
+// surface plus that of the surface to the hit
+double constexpr kSsrMaxReprojectionError{1e-2};
+double constexpr kSsrMaxMirrorError{1e-4};
+// Frames the SSR temporal pass accumulates in the ssr-temporal benchmark
+std::uint32_t constexpr kSsrTemporalFrameCount{16};
+// Frame size, vertical field of view in degrees and clip planes of the mirror floor the ssr-temporal-synthetic
+// benchmark renders, and distance of every floor pixel to the point its reflection hits
+std::uint32_t constexpr kSsrSyntheticWidth{96};
+std::uint32_t constexpr kSsrSyntheticHeight{64};
+float constexpr kSsrSyntheticFov{60};
+float constexpr kSsrSyntheticNear{0.1f};
+float constexpr kSsrSyntheticFar{20};
+float constexpr kSsrSyntheticHitDistance{1.5f};
+
+// Output size the culling and LOD statistics are computed for
+float constexpr kBenchmarkViewportHeight{1080};
+float constexpr kBenchmarkAspectRatio{16.0f / 9.0f};
+
+
+template<typename T>
+auto StreamsEqual(std::vector<T> const& a, std::vector<T> const& b) -> bool {
+  return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0;
+}
+
+
+auto ScenesEqual(CpuScene const& a, CpuScene const& b) -> bool {
+  auto const meshes_equal{
+    [](CpuMesh const& x, CpuMesh const& y) {
+      return StreamsEqual(x.positions, y.positions) && StreamsEqual(x.normals, y.normals) &&
+             StreamsEqual(x.texcoords, y.texcoords) && StreamsEqual(x.tangents, y.tangents) &&
+             StreamsEqual(x.indices, y.indices);
+    }
+  };
+
+  return std::ranges::equal(a.meshes, b.meshes, meshes_equal) && StreamsEqual(a.materials, b.materials) &&
+         StreamsEqual(a.instances, b.instances) && a.textures == b.textures;
+}
+
+
+// Returns 1, 2, 4, ... up to and including the hardware thread count
+auto GetThreadCountSweep() -> std::vector<unsigned> {
+  std::vector<unsigned> thread_counts;
+
+  for (auto thread_count{1u}; thread_count < GetDefaultThreadCount(); thread_count *= 2) {
+    thread_counts.push_back(thread_count);
+  }
+
+  thread_counts.push_back(GetDefaultThreadCount());
+  return thread_counts;
+}
+
+
+auto ParseCount(wchar_t const* const arg, std::string_view const name) -> std::optional<std::uint32_t> {
+  wchar_t* end;
+  auto const value{std::wcstoul(arg, &end, 10)};
+
+  if (end == arg || *end != L'\0' || value == 0 || value > std::numeric_limits<std::uint32_t>::max()) {
+    std::cerr << std::format("{} must be a positive number.\n", name);
+    return std::nullopt;
+  }
+
+  return static_cast<std::uint32_t>(value);
+}
+
+
+// Times the mesh conversion stage of the import on an already loaded Assimp scene, so the numbers are not drowned
+// out by Assimp's own post-processing. Every result is checked against the single threaded conversion.
+auto BenchmarkSceneConversion(std::span<wchar_t* const> const args) -> bool {
+  Assimp::Importer importer;
+  auto const ai_scene{ReadAssimpScene(importer, args[0])};
+
+  if (!ai_scene) {
+    return false;
+  }
+
+  auto constexpr repetitions{5};
+  auto const reference{ConvertAssimpScene(*ai_scene, 1)};
+
+  std::cout << std::format("Converting {} meshes referenced by {} instances, best of {} runs\n",
+                           reference.meshes.size(), reference.instances.size(), repetitions);
+  std::cout << std::format("{:>8} {:>12} {:>8} {:>10}\n", "threads", "time (ms)", "speedup", "identical");
+
+  auto all_identical{true};
+  double single_thread_ms{0};
+
+  for (auto const thread_count : GetThreadCountSweep()) {
+    auto best_ms{std::numeric_limits<double>::max()};
+    auto identical{true};
+
+    for (auto i{0}; i < repetitions; i++) {
+      auto const begin{std::chrono::steady_clock::now()};
+      auto const scene{ConvertAssimpScene(*ai_scene, thread_count)};
+      auto const end{std::chrono::steady_clock::now()};
+
+      best_ms = std::min(best_ms, Milliseconds{end - begin}.count());
+      identical = identical && ScenesEqual(scene, reference);
+    }
+
+    if (thread_count == 1) {
+      single_thread_ms = best_ms;
+    }
+
+    all_identical = all_identical && identical;
+    std::cout << std::format("{:>8} {:>12.2f} {:>7.2f}x {:>10}\n", thread_count, best_ms, single_thread_ms / best_ms,
+                             identical ? "yes" : "NO");
+  }
+
+  return all_identical;
+}
+
+
+// Compares our mesh optimization pass against Assimp's aiProcess_ImproveCacheLocality on the same input
+auto BenchmarkMeshOptimization(std::span<wchar_t* const> const args) -> bool {
+  Assimp::Importer importer;
+  auto const ai_scene{ReadAssimpScene(importer, args[0])};
+
+  if (!ai_scene) {
+    return false;
+  }
+
+  auto scene{ConvertAssimpScene(*ai_scene, GetDefaultThreadCount())};
+  auto const input_stats{AnalyzeScene(scene, GetDefaultThreadCount())};
+
+  auto const optimize_begin{std::chrono::steady_clock::now()};
+  ParallelFor(scene.meshes.size(), GetDefaultThreadCount(), [&scene](std::size_t const i) {
+    OptimizeMesh(scene.meshes[i]);
+  });
+  auto const optimize_end{std::chrono::steady_clock::now()};
+  auto const optimized_stats{AnalyzeScene(scene, GetDefaultThreadCount())};
+
+  auto const assimp_begin{std::chrono::steady_clock::now()};
+  auto const assimp_ai_scene{importer.ApplyPostProcessing(aiProcess_ImproveCacheLocality)};
+  auto const assimp_end{std::chrono::steady_clock::now()};
+
+  if (!assimp_ai_scene) {
+    std::cerr << "Assimp post-processing failed: " << importer.GetErrorString() << "\n";
+    return false;
+  }
+
+  auto const assimp_stats{AnalyzeScene(ConvertAssimpScene(*assimp_ai_scene, GetDefaultThreadCount()),
+                                       GetDefaultThreadCount())};
+
+  std::cout << std::format("{:>8} {:>12} {:>8} {:>8} {:>9}\n", "", "time (ms)", "ACMR", "ATVR", "overdraw");
+
+  auto const print_row{
+    [](std::string_view const name, double const ms, MeshOptimizationStats const& stats) {
+      std::cout << std::format("{:>8} {:>12.2f} {:>8.3f} {:>8.3f} {:>9.3f}\n", name, ms,
+                               stats.vertex_cache.GetAcmr(), stats.vertex_cache.GetAtvr(),
+                               stats.overdraw.GetOverdraw());
+    }
+  };
+
+  print_row("input", 0, input_stats);
+  print_row("ours", Milliseconds{optimize_end - optimize_begin}.count(), optimized_stats);
+  print_row("assimp", Milliseconds{assimp_end - assimp_begin}.count(), assimp_stats);
+
+  return true;
+}
+
+
+// Builds the meshlets of the scene, then culls them from a camera orbiting the scene like the interactive one
+auto BenchmarkMeshletCulling(std::span<wchar_t* const> const args) -> bool {
+  auto const scene{LoadCpuScene(args[0])};
+
+  if (!scene) {
+    return false;
+  }
+
+  auto const build_begin{std::chrono::steady_clock::now()};
+  auto const meshlet_meshes{BuildMeshlets(*scene, GetDefaultThreadCount())};
+  auto const build_end{std::chrono::steady_clock::now()};
+
+  auto const fill_stats{ComputeMeshletFillStats(meshlet_meshes)};
+  std::cout << std::format("Built {} meshlets in {:.2f} ms, vertex fill {:.1f}%, triangle fill {:.1f}%\n",
+                           fill_stats.meshlet_count, Milliseconds{build_end - build_begin}.count(),
+                           fill_stats.GetVertexFillRate() * 100, fill_stats.GetTriangleFillRate() * 100);
+
+  OrbitingCamera cam{{0, 0, 0}, 2.5f, 0.1f, 5.0f, 65.0f};
+  auto constexpr step_count{36};
+  auto constexpr step_degrees{360.0f / step_count};
+
+  std::cout << std::format("{:>8} {:>10} {:>10} {:>10} {:>10}\n", "yaw", "tested", "frustum", "cone", "visible");
+
+  MeshletCullingStats total_stats{};
+  std::vector<std::uint32_t> visible_meshlets;
+  Milliseconds cull_time{0};
+
+  for (auto step{0}; step < step_count; step++) {
+    auto const frustum{ComputeFrustum(cam.ComputeViewMatrix(), cam.ComputeProjMatrix(kBenchmarkAspectRatio))};
+    auto const camera_pos{cam.ComputePosition()};
+
+    MeshletCullingStats stats{};
+    visible_meshlets.clear();
+
+    auto const cull_begin{std::chrono::steady_clock::now()};
+
+    for (auto const& instance : scene->instances) {
+      CullMeshlets(meshlet_meshes[instance.mesh_idx], instance.transform, frustum, camera_pos, visible_meshlets,
+                   stats);
+    }
+
+    cull_time += std::chrono::steady_clock::now() - cull_begin;
+
+    // Print every 30 degrees to keep the table short
+    if (step % 3 == 0) {
+      std::cout << std::format("{:>8.0f} {:>10} {:>10} {:>10} {:>10}\n", step * step_degrees, stats.tested_count,
+                               stats.frustum_culled_count, stats.cone_culled_count, visible_meshlets.size());
+    }
+
+    total_stats.tested_count += stats.tested_count;
+    total_stats.frustum_culled_count += stats.frustum_culled_count;
+    total_stats.cone_culled_count += stats.cone_culled_count;
+    cam.Rotate(step_degrees);
+  }
+
+  auto const percent_of_tested{
+    [&total_stats](std::size_t const count) {
+      return total_stats.tested_count == 0
+               ? 0.0
+               : 100.0 * static_cast<double>(count) / static_cast<double>(total_stats.tested_count);
+    }
+  };
+
+  std::cout << std::format("Over the orbit: {:.1f}% frustum culled, {:.1f}% cone culled, {:.3f} ms per view\n",
+                           percent_of_tested(total_stats.frustum_culled_count),
+                           percent_of_tested(total_stats.cone_culled_count), cull_time.count() / step_count);
+  return true;
+}
+
+
+// Tiles copies of the instances of the scene on a square grid in the XZ plane until there are at least
+// instance_count of them
+auto ReplicateInstances(CpuScene& scene, std::size_t const instance_count) -> void {
+  if (scene.instances.empty()) {
+    return;
+  }
+
+  std::vector<Aabb> mesh_bounds;
+  mesh_bounds.reserve(scene.meshes.size());
+
+  for (auto const& mesh : scene.meshes) {
+    mesh_bounds.push_back(ComputeAabb(mesh.positions));
+  }
+
+  auto max_extent{0.0f};
+
+  for (auto const& instance : scene.instances) {
+    auto const aabb{TransformAabb(mesh_bounds[instance.mesh_idx], instance.transform.world_mtx)};
+    max_extent = std::max({max_extent, aabb.max.x - aabb.min.x, aabb.max.z - aabb.min.z});
+  }
+
+  auto const copy_count{(instance_count + scene.instances.size() - 1) / scene.instances.size()};
+  auto const grid_size{static_cast<std::size_t>(std::ceil(std::sqrt(static_cast<double>(copy_count))))};
+  auto const spacing{max_extent * 1.25f};
+  auto const grid_offset{static_cast<float>(grid_size - 1) * 0.5f};
+
+  auto const original_instances{scene.instances};
+  scene.instances.clear();
+  scene.instances.reserve(copy_count * original_instances.size());
+
+  for (std::size_t copy{0}; copy < copy_count; copy++) {
+    auto const x{(static_cast<float>(copy % grid_size) - grid_offset) * spacing};
+    auto const z{(static_cast<float>(copy / grid_size) - grid_offset) * spacing};
+
+    for (auto instance : original_instances) {
+      instance.transform.world_mtx._41 += x;
+      instance.transform.world_mtx._43 += z;
+      scene.instances.push_back(instance);
+    }
+  }
+}
+
+
+// Culls the scene tiled to the requested instance count from a camera orbiting the center like the interactive one.
+// The BVH traversal is timed against testing every instance and must find exactly the same instances.
+auto BenchmarkFrustumCulling(std::span<wchar_t* const> const args) -> bool {
+  auto scene{LoadCpuScene(args[0])};
+
+  if (!scene) {
+    return false;
+  }
+
+  wchar_t* count_end;
+  auto const instance_count{std::wcstoull(args[1], &count_end, 10)};
+
+  if (count_end == args[1] || *count_end != L'\0') {
+    std::cerr << "Instance count must be a number.\n";
+    return false;
+  }
+
+  ReplicateInstances(*scene, instance_count);
+  auto const pools{BuildScenePools(*scene, VertexLayout::kPacked, GetDefaultThreadCount())};
+
+  auto const build_begin{std::chrono::steady_clock::now()};
+  auto const culling_scene{BuildCullingScene(pools)};
+  auto const build_end{std::chrono::steady_clock::now()};
+
+  std::cout << std::format("Built a BVH of {} nodes over {} instances in {:.2f} ms\n", culling_scene.bvh.nodes.size(),
+                           pools.instance_bounds.size(), Milliseconds{build_end - build_begin}.count());
+
+  OrbitingCamera cam{{0, 0, 0}, 2.5f, 0.1f, 5.0f, 65.0f};
+  auto constexpr step_count{36};
+  auto constexpr step_degrees{360.0f / step_count};
+  // Every view is culled this many times and the fastest run is kept
+  auto constexpr repetitions{10};
+
+  std::cout << std::format("{:>8} {:>10} {:>10} {:>10} {:>12} {:>12} {:>12}\n", "yaw", "visible", "culled %",
+                           "draws", "bvh (ms)", "frame (ms)", "linear (ms)");
+
+  VisibleDraws visible_draws;
+  std::vector<std::uint32_t> bvh_visible;
+  std::vector<std::uint32_t> linear_visible;
+  auto all_match{true};
+  double culled_fraction_sum{0};
+  double bvh_ms_sum{0};
+  double frame_ms_sum{0};
+  double linear_ms_sum{0};
+
+  auto const time_best{
+    [](auto&& func) {
+      auto best_ms{std::numeric_limits<double>::max()};
+
+      for (auto i{0}; i < repetitions; i++) {
+        auto const begin{std::chrono::steady_clock::now()};
+        func();
+        best_ms = std::min(best_ms, Milliseconds{std::chrono::steady_clock::now() - begin}.count());
+      }
+
+      return best_ms;
+    }
+  };
+
+  for (auto step{0}; step < step_count; step++) {
+    auto const frustum{ComputeFrustum(cam.ComputeViewMatrix(), cam.ComputeProjMatrix(kBenchmarkAspectRatio))};
+    LodSelection const lod_selection{
+      .camera_pos = cam.ComputePosition(),
+      .lod_scale = ComputeLodScale(cam.GetVerticalFovDegrees(), kBenchmarkViewportHeight),
+      .max_pixel_error = kDefaultMaxLodPixelError
+    };
+
+    auto const bvh_ms{
+      time_best([&] {
+        bvh_visible.clear();
+        CullBvh(culling_scene.bvh, frustum, bvh_visible);
+      })
+    };
+
+    auto const frame_ms{
+      time_best([&] {
+        CullScene(culling_scene, frustum, lod_selection, visible_draws);
+      })
+    };
+
+    auto const linear_ms{
+      time_best([&] {
+        linear_visible.clear();
+        CullAabbs(pools.instance_bounds, frustum, linear_visible);
+      })
+    };
+
+    std::ranges::sort(bvh_visible);
+    all_match = all_match && bvh_visible == linear_visible;
+
+    auto const culled_fraction{
+      pools.instance_bounds.empty()
+        ? 0.0
+        : 1.0 - static_cast<double>(bvh_visible.size()) / static_cast<double>(pools.instance_bounds.size())
+    };
+
+    // Print every 30 degrees to keep the table short
+    if (step % 3 == 0) {
+      std::cout << std::format("{:>8.0f} {:>10} {:>10.1f} {:>10} {:>12.3f} {:>12.3f} {:>12.3f}\n",
+                               step * step_degrees, bvh_visible.size(), culled_fraction * 100,
+                               visible_draws.draws.size(), bvh_ms, frame_ms, linear_ms);
+    }
+
+    culled_fraction_sum += culled_fraction;
+    bvh_ms_sum += bvh_ms;
+    frame_ms_sum += frame_ms;
+    linear_ms_sum += linear_ms;
+    cam.Rotate(step_degrees);
+  }
+
+  std::cout << std::format(
+    "Average over the orbit: {:.1f}% culled, BVH {:.3f} ms, with draw list {:.3f} ms, linear {:.3f} ms\n",
+    culled_fraction_sum / step_count * 100, bvh_ms_sum / step_count, frame_ms_sum / step_count,
+    linear_ms_sum / step_count);
+  std::cout << std::format("BVH results {} the linear test\n", all_match ? "match" : "DO NOT match");
+  return all_match;
+}
+
+
+// Times LOD generation on increasing thread counts against the single threaded result, then compares the triangles
+// drawn with LOD selection to the full detail ones from a camera orbiting the scene like the interactive one
+auto BenchmarkMeshLods(std::span<wchar_t* const> const args) -> bool {
+  auto scene{LoadCpuScene(args[0])};
+
+  if (!scene) {
+    return false;
+  }
+
+  auto const generate_lods{
+    [&scene](unsigned const thread_count) {
+      auto meshes{scene->meshes};
+
+      ParallelFor(meshes.size(), thread_count, [&meshes](std::size_t const i) {
+        GenerateLods(meshes[i]);
+      });
+
+      return meshes;
+    }
+  };
+
+  auto const lods_equal{
+    [](std::vector<CpuMesh> const& a, std::vector<CpuMesh> const& b) {
+      return std::ranges::equal(a, b, [](CpuMesh const& x, CpuMesh const& y) {
+        return StreamsEqual(x.lods, y.lods) && StreamsEqual(x.lod_indices, y.lod_indices);
+      });
+    }
+  };
+
+  auto const reference{generate_lods(1)};
+
+  std::cout << std::format("{:>8} {:>12} {:>8} {:>10}\n", "threads", "time (ms)", "speedup", "identical");
+
+  auto all_identical{true};
+  double single_thread_ms{0};
+
+  for (auto const thread_count : GetThreadCountSweep()) {
+    auto const begin{std::chrono::steady_clock::now()};
+    auto const meshes{generate_lods(thread_count)};
+    auto const ms{Milliseconds{std::chrono::steady_clock::now() - begin}.count()};
+
+    if (thread_count == 1) {
+      single_thread_ms = ms;
+    }
+
+    auto const identical{lods_equal(meshes, reference)};
+    all_identical = all_identical && identical;
+    std::cout << std::format("{:>8} {:>12.2f} {:>8.2f} {:>10}\n", thread_count, ms, single_thread_ms / ms,
+                             identical ? "yes" : "NO");
+  }
+
+  for (auto level{0u}; level <= kMaxLodCount; level++) {
+    std::size_t mesh_count{0};
+    std::size_t triangle_count{0};
+    auto max_error{0.0f};
+
+    for (auto const& mesh : reference) {
+      if (level == 0) {
+        mesh_count += 1;
+        triangle_count += mesh.indices.size() / 3;
+      } else if (level <= mesh.lods.size()) {
+        mesh_count += 1;
+        triangle_count += mesh.lods[level - 1].index_count / 3;
+        max_error = std::max(max_error, mesh.lods[level - 1].error);
+      }
+    }
+
+    std::cout << std::format("LOD {}: {} meshes, {} triangles, max error {:.5f}\n", level, mesh_count,
+                             triangle_count, max_error);
+  }
+
+  auto const pools{BuildScenePools(*scene, VertexLayout::kPacked, GetDefaultThreadCount())};
+  auto const culling_scene{BuildCullingScene(pools)};
+
+  OrbitingCamera cam{{0, 0, 0}, 2.5f, 0.1f, 5.0f, 65.0f};
+  auto constexpr step_count{36};
+  auto constexpr step_degrees{360.0f / step_count};
+
+  std::cout << std::format("{:>8} {:>14} {:>14} {:>8}\n", "yaw", "full detail", "with LODs", "ratio");
+
+  VisibleDraws visible_draws;
+  std::size_t full_detail_sum{0};
+  std::size_t lod_sum{0};
+
+  for (auto step{0}; step < step_count; step++) {
+    LodSelection const lod_selection{
+      .camera_pos = cam.ComputePosition(),
+      .lod_scale = ComputeLodScale(cam.GetVerticalFovDegrees(), kBenchmarkViewportHeight),
+      .max_pixel_error = kDefaultMaxLodPixelError
+    };
+
+    CullScene(culling_scene, ComputeFrustum(cam.ComputeViewMatrix(), cam.ComputeProjMatrix(kBenchmarkAspectRatio)),
+              lod_selection, visible_draws);
+
+    std::size_t full_detail_triangles{0};
+    std::size_t lod_triangles{0};
+
+    for (auto const& draw : visible_draws.draws) {
+      full_detail_triangles += std::size_t{culling_scene.lods[draw.first_lod].index_count} / 3 * draw.instance_count;
+      lod_triangles += std::size_t{draw.index_count} / 3 * draw.instance_count;
+    }
+
+    auto const ratio{
+      full_detail_triangles == 0
+        ? 1.0
+        : static_cast<double>(lod_triangles) / static_cast<double>(full_detail_triangles)
+    };
+
+    // Print every 30 degrees to keep the table short
+    if (step % 3 == 0) {
+      std::cout << std::format("{:>8.0f} {:>14} {:>14} {:>8.3f}\n", step * step_degrees, full_detail_triangles,
+                               lod_triangles, ratio);
+    }
+
+    full_detail_sum += full_detail_triangles;
+    lod_sum += lod_triangles;
+    cam.Rotate(step_degrees);
+  }
+
+  std::cout << std::format("Over the orbit the LODs draw {:.1f}% of the full detail triangles at {}p\n",
+                           full_detail_sum == 0
+                             ? 100.0
+                             : 100.0 * static_cast<double>(lod_sum) / static_cast<double>(full_detail_sum),
+                           kBenchmarkViewportHeight);
+  return all_identical;
+}
+
+
+// Builds the merged vertex/index pools and draw table, then checks them against the scene
+auto BenchmarkScenePools(std::span<wchar_t* const> const args) -> bool {
+  auto const scene{LoadCpuScene(args[0])};
+
+  if (!scene) {
+    return false;
+  }
+
+  auto all_valid{true};
+
+  for (auto const vertex_layout : {VertexLayout::kPacked, VertexLayout::kFloat}) {
+    auto const begin{std::chrono::steady_clock::now()};
+    auto const pools{BuildScenePools(*scene, vertex_layout, GetDefaultThreadCount())};
+    auto const end{std::chrono::steady_clock::now()};
+
+    std::cout << std::format("Built {} pools in {:.2f} ms: {} vertices, {} indices, {} transforms, {} materials\n",
+                             vertex_layout == VertexLayout::kPacked ? "packed" : "float",
+                             Milliseconds{end - begin}.count(), pools.vertex_count, pools.indices.size(),
+                             pools.transforms.size(), pools.materials.size());
+    std::cout << std::format("{} draws for {} instances of {} meshes\n", pools.draws.size(),
+                             scene->instances.size(), scene->meshes.size());
+
+    auto const valid{ValidateScenePools(*scene, pools)};
+    std::cout << std::format("Valid: {}\n", valid ? "yes" : "NO");
+    all_valid = all_valid && valid;
+  }
+
+  return all_valid;
+}
+
+
+// Packs every mesh and checks the round-trip error of each stream against its bound
+auto CheckVertexPacking(std::span<CpuMesh const> const meshes) -> bool {
+  std::size_t packed_size{0};
+  std::size_t unpacked_size{0};
+  PackingErrorReport worst{};
+  auto position_error_ratio{0.0f};
+  auto all_within_bounds{true};
+
+  for (auto const& mesh : meshes) {
+    auto const packed{PackMesh(mesh)};
+    auto const report{MeasurePackingError(mesh, packed)};
+
+    packed_size += GetPackedVertexDataSize(packed);
+    unpacked_size += GetUnpackedVertexDataSize(mesh);
+
+    if (report.position_error_bound > 0) {
+      position_error_ratio = std::max(position_error_ratio, report.max_position_error / report.position_error_bound);
+    }
+
+    worst.max_normal_error_degrees = std::max(worst.max_normal_error_degrees, report.max_normal_error_degrees);
+    worst.max_tangent_error_degrees = std::max(worst.max_tangent_error_degrees, report.max_tangent_error_degrees);
+    worst.max_texcoord_error = std::max(worst.max_texcoord_error, report.max_texcoord_error);
+    worst.handedness_mismatches += report.handedness_mismatches;
+    all_within_bounds = all_within_bounds && report.IsWithinBounds();
+  }
+
+  auto constexpr mib{1024.0 * 1024.0};
+  std::cout << std::format("Packed {} meshes: {:.2f} MiB instead of {:.2f} MiB, saved {:.2f} MiB\n",
+                           meshes.size(), packed_size / mib, unpacked_size / mib,
+                           (unpacked_size - packed_size) / mib);
+  std::cout << std::format("Position error: {:.3f} of bound\n", position_error_ratio);
+  std::cout << std::format("Normal error: {:.4f} deg, bound {:.4f} deg\n", worst.max_normal_error_degrees,
+                           kMaxPackedNormalErrorDegrees);
+  std::cout << std::format("Tangent error: {:.4f} deg, bound {:.4f} deg\n", worst.max_tangent_error_degrees,
+                           kMaxPackedTangentErrorDegrees);
+  std::cout << std::format("Texcoord error: {:.3f} of bound\n", worst.max_texcoord_error);
+  std::cout << std::format("Handedness mismatches: {}\n", worst.handedness_mismatches);
+  std::cout << std::format("Within bounds: {}\n", all_within_bounds ? "yes" : "NO");
+
+  return all_within_bounds;
+}
+
+
+// Packs every mesh of the scene and checks the round-trip error of each stream against its bound
+auto BenchmarkVertexPacking(std::span<wchar_t* const> const args) -> bool {
+  auto const scene{LoadCpuScene(args[0])};
+
+  if (!scene) {
+    return false;
+  }
+
+  return CheckVertexPacking(scene->meshes);
+}
+
+
+// Checks the packing bounds without a model: directions on a latitude-longitude grid that hits the poles, the
+// octahedron edges and the axes exactly, then vertex_count seeded random vertices. Texture coordinates cover the
+// whole finite half range including subnormals.
+auto BenchmarkVertexPackingSweep(std::span<wchar_t* const> const args) -> bool {
+  auto const vertex_count{ParseCount(args[0], "Vertex count")};
+
+  if (!vertex_count) {
+    return false;
+  }
+
+  CpuMesh mesh;
+
+  auto const add_vertex{
+    [&mesh](Vector4 const& pos, Vector4 const& normal, Vector2 const& uv, Vector4 const& tangent) {
+      mesh.positions.push_back(pos);
+      mesh.normals.push_back(normal);
+      mesh.texcoords.push_back(uv);
+      mesh.tangents.push_back(tangent);
+    }
+  };
+
+  auto constexpr grid_size{256};
+
+  for (auto i{0}; i <= grid_size; i++) {
+    // Multiples of 45 degrees land on grid lines, so the octahedron vertices and edge midpoints are hit exactly
+    auto const theta{std::numbers::pi * i / grid_size};
+
+    for (auto j{0}; j < 2 * grid_size; j++) {
+      auto const phi{std::numbers::pi * j / grid_size};
+      auto const dir{
+        Vector4{
+          static_cast<float>(std::sin(theta) * std::cos(phi)), static_cast<float>(std::cos(theta)),
+          static_cast<float>(std::sin(theta) * std::sin(phi)), 0
+        }
+      };
+
+      add_vertex(Vector4{dir[0], dir[1], dir[2], 1}, dir, Vector2{static_cast<float>(j) / grid_size, 1.0f - dir[1]},
+                 Vector4{dir[0], dir[1], dir[2], j % 2 == 0 ? 1.0f : -1.0f});
+    }
+  }
+
+  auto const grid_vertex_count{mesh.positions.size()};
+
+  std::mt19937 rng{42};
+  std::normal_distribution<float> dir_dist{0.0f, 1.0f};
+  std::uniform_real_distribution<float> pos_dist{-1000.0f, 1000.0f};
+  std::uniform_real_distribution<float> exponent_dist{-26.0f, 15.9f};
+  std::uniform_int_distribution<int> sign_dist{0, 1};
+
+  auto const random_dir{
+    [&] {
+      Vector4 dir{};
+
+      // Rejects directions too short to normalize reliably
+      while (dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2] < 1e-6f) {
+        dir = Vector4{dir_dist(rng), dir_dist(rng), dir_dist(rng), 0};
+      }
+
+      auto const len{std::sqrt(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2])};
+      return Vector4{dir[0] / len, dir[1] / len, dir[2] / len, 0};
+    }
+  };
+
+  auto const random_sign{[&] { return sign_dist(rng) == 0 ? -1.0f : 1.0f; }};
+  auto const random_texcoord{[&] { return std::exp2(exponent_dist(rng)) * random_sign(); }};
+
+  for (std::uint32_t i{0}; i < *vertex_count; i++) {
+    auto const normal{random_dir()};
+    auto tangent{random_dir()};
+    tangent[3] = random_sign();
+
+    add_vertex(Vector4{pos_dist(rng), pos_dist(rng), pos_dist(rng), 1}, normal,
+               Vector2{random_texcoord(), random_texcoord()}, tangent);
+  }
+
+  std::cout << std::format("{} grid and {} random vertices\n", grid_vertex_count,
+                           mesh.positions.size() - grid_vertex_count);
+  return CheckVertexPacking(std::span{&mesh, 1});
+}
+
+
+// Decodes and mipmaps every texture of the scene without the cache on a sweep of thread counts, then measures a cold
+// and a warm cached load. Every result is checked against the single threaded decode.
+auto BenchmarkTextureLoading(std::span<wchar_t* const> const args) -> bool {
+  auto const scene{LoadCpuScene(args[0])};
+
+  if (!scene) {
+    return false;
+  }
+
+  auto const reference{LoadSceneTextures(*scene, args[0], 1, false)};
+  auto constexpr bytes_per_mib{1024.0 * 1024.0};
+
+  std::cout << std::format("{} textures, {} unique, {} loaded: {:.2f} MiB of image files, {:.2f} Mpixels\n",
+                           reference.stats.referenced_count, reference.stats.unique_count, reference.images.size(),
+                           reference.stats.encoded_bytes / bytes_per_mib, reference.stats.decoded_pixels / 1e6);
+  std::cout << std::format("{:>8} {:>12} {:>8} {:>10} {:>12} {:>10} {:>10}\n", "threads", "time (ms)", "speedup",
+                           "MiB/s", "Mpixels/s", "peak MiB", "identical");
+
+  auto all_identical{true};
+  double single_thread_ms{0};
+
+  for (auto const thread_count : GetThreadCountSweep()) {
+    auto const textures{LoadSceneTextures(*scene, args[0], thread_count, false)};
+    auto const& stats{textures.stats};
+    auto const identical{textures.images == reference.images && textures.image_indices == reference.image_indices};
+
+    if (thread_count == 1) {
+      single_thread_ms = stats.load_ms;
+    }
+
+    all_identical = all_identical && identical;
+    std::cout << std::format("{:>8} {:>12.2f} {:>7.2f}x {:>10.2f} {:>12.2f} {:>10.2f} {:>10}\n", thread_count,
+                             stats.load_ms, single_thread_ms / stats.load_ms,
+                             stats.encoded_bytes / bytes_per_mib / (stats.load_ms / 1000.0),
+                             stats.decoded_pixels / 1e6 / (stats.load_ms / 1000.0), stats.peak_bytes / bytes_per_mib,
+                             identical ? "yes" : "NO");
+  }
+
+  // The first cached load may still find caches of earlier runs
+  for (auto const name : {"cached", "warm"}) {
+    auto const textures{LoadSceneTextures(*scene, args[0], GetDefaultThreadCount(), true)};
+    auto const identical{textures.images == reference.images && textures.image_indices == reference.image_indices};
+    all_identical = all_identical && identical;
+    std::cout << std::format("{:>8}: {:.2f} ms, {} from cache, {} decoded, peak {:.2f} MiB, identical: {}\n", name,
+                             textures.stats.total_ms, textures.stats.cached_count, textures.stats.decoded_count,
+                             textures.stats.peak_bytes / bytes_per_mib, identical ? "yes" : "NO");
+  }
+
+  return all_identical;
+}
+
+
+// Times every stage of the IBL bake over the thread counts and checks the fast prefilter against the scalar port of
+// the shader, mip by mip
+auto BenchmarkIblBaking(std::span<wchar_t* const> const args) -> bool {
+  auto const face_size{ParseCount(args[1], "Face size")};
+  auto const sample_count{ParseCount(args[2], "Sample count")};
+
+  if (!face_size || !sample_count) {
+    return false;
+  }
+
+  auto const equirect{LoadEquirectMap(args[0])};
+
+  if (!equirect) {
+    std::cerr << "Failed to load environment map image.\n";
+    return false;
+  }
+
+  std::cout << std::format("{}x{} equirect map to {} mips of {}x{} faces with {} samples per texel\n", equirect->width,
+                           equirect->height, std::bit_width(*face_size), *face_size, *face_size, *sample_count);
+  std::cout << std::format("{:>8} {:>12} {:>12} {:>14} {:>12} {:>8} {:>10}\n", "threads", "convert (ms)", "mips (ms)",
+                           "prefilter (ms)", "total (ms)", "speedup", "identical");
+
+  std::optional<CubeMap> env;
+  std::optional<CubeMap> prefiltered;
+  auto all_identical{true};
+  double single_thread_ms{0};
+
+  for (auto const thread_count : GetThreadCountSweep()) {
+    auto const convert_begin{std::chrono::steady_clock::now()};
+    auto thread_env{ConvertEquirectToCube(*equirect, *face_size, thread_count)};
+    auto const mips_begin{std::chrono::steady_clock::now()};
+    GenerateCubeMips(thread_env, thread_count);
+    auto const prefilter_begin{std::chrono::steady_clock::now()};
+    auto thread_prefiltered{PrefilterCubeMap(thread_env, *sample_count, thread_count)};
+    auto const prefilter_end{std::chrono::steady_clock::now()};
+
+    auto const total_ms{Milliseconds{prefilter_end - convert_begin}.count()};
+    auto const identical{!prefiltered || thread_prefiltered.texels == prefiltered->texels};
+
+    if (thread_count == 1) {
+      single_thread_ms = total_ms;
+      env = std::move(thread_env);
+      prefiltered = std::move(thread_prefiltered);
+    }
+
+    all_identical = all_identical && identical;
+    std::cout << std::format("{:>8} {:>12.2f} {:>12.2f} {:>14.2f} {:>12.2f} {:>7.2f}x {:>10}\n", thread_count,
+                             Milliseconds{mips_begin - convert_begin}.count(),
+                             Milliseconds{prefilter_begin - mips_begin}.count(),
+                             Milliseconds{prefilter_end - prefilter_begin}.count(), total_ms,
+                             single_thread_ms / total_ms, identical ? "yes" : "NO");
+  }
+
+  auto const reference_begin{std::chrono::steady_clock::now()};
+  auto const reference{PrefilterCubeMapReference(*env, *sample_count, GetDefaultThreadCount())};
+  auto const reference_end{std::chrono::steady_clock::now()};
+
+  std::cout << std::format("Scalar reference prefilter took {:.2f} ms on {} threads\n",
+                           Milliseconds{reference_end - reference_begin}.count(), GetDefaultThreadCount());
+  std::cout << std::format("{:>8} {:>10} {:>16} {:>16}\n", "mip", "roughness", "max abs error", "max rel error");
+
+  auto max_relative_error{0.0};
+
+  for (std::uint32_t mip{0}; mip < reference.mip_count; mip++) {
+    auto mip_abs_error{0.0};
+    auto mip_rel_error{0.0};
+
+    for (std::uint32_t face{0}; face < 6; face++) {
+      auto const expected{reference.GetFaceMip(face, mip)};
+      auto const actual{prefiltered->GetFaceMip(face, mip)};
+
+      for (std::size_t i{0}; i < expected.size(); i++) {
+        for (std::size_t c{0}; c < 4; c++) {
+          auto const error{std::abs(static_cast<double>(actual[i][c]) - expected[i][c])};
+          mip_abs_error = std::max(mip_abs_error, error);
+          mip_rel_error = std::max(mip_rel_error, error / std::max<double>(std::abs(expected[i][c]), kIblErrorFloor));
+        }
+      }
+    }
+
+    max_relative_error = std::max(max_relative_error, mip_rel_error);
+    std::cout << std::format("{:>8} {:>10.3f} {:>16.3e} {:>16.3e}\n", mip,
+                             reference.mip_count > 1 ? static_cast<double>(mip) / (reference.mip_count - 1) : 0.0,
+                             mip_abs_error, mip_rel_error);
+  }
+
+  auto const matches_reference{max_relative_error <= kIblMaxRelativeError};
+  std::cout << std::format("Matches the reference within {:.0e}: {}\n", kIblMaxRelativeError,
+                           matches_reference ? "yes" : "NO");
+
+  // The first cached load may still find a cache of an earlier run
+  IblBakeSettings const settings{
+    .face_size = *face_size, .sample_count = *sample_count, .sampling = PrefilterSampling::kGgx
+  };
+
+  for (auto const name : {"cached", "warm"}) {
+    auto const load_begin{std::chrono::steady_clock::now()};
+    auto const loaded{LoadPrefilteredEnvironment(args[0], settings, GetDefaultThreadCount())};
+    auto const load_end{std::chrono::steady_clock::now()};
+    auto const identical{loaded && loaded->texels == prefiltered->texels};
+    all_identical = all_identical && identical;
+    std::cout << std::format("{:>8}: {:.2f} ms, identical: {}\n", name, Milliseconds{load_end - load_begin}.count(),
+                             identical ? "yes" : "NO");
+  }
+
+  return all_identical && matches_reference;
+}
+
+
+// Times the DFG table generation over the thread counts, checks the vectorized integration against the scalar one,
+// and checks the CPU lighting evaluation that samples the table against brute force integration
+auto BenchmarkDfgLut(std::span<wchar_t* const> const args) -> bool {
+  auto const size{ParseCount(args[0], "Table size")};
+  auto const sample_count{ParseCount(args[1], "Sample count")};
+
+  if (!size || !sample_count) {
+    return false;
+  }
+
+  DfgLutSettings const settings{.size = *size, .sample_count = *sample_count};
+
+  std::cout << std::format("{}x{} table with {} samples per texel\n", *size, *size, *sample_count);
+  std::cout << std::format("{:>8} {:>12} {:>8} {:>10}\n", "threads", "time (ms)", "speedup", "identical");
+
+  std::optional<DfgLut> lut;
+  auto all_identical{true};
+  double single_thread_ms{0};
+
+  for (auto const thread_count : GetThreadCountSweep()) {
+    auto const begin{std::chrono::steady_clock::now()};
+    auto thread_lut{GenerateDfgLut(settings, thread_count)};
+    auto const end{std::chrono::steady_clock::now()};
+
+    auto const ms{Milliseconds{end - begin}.count()};
+    auto const identical{!lut || thread_lut.texels == lut->texels};
+
+    if (thread_count == 1) {
+      single_thread_ms = ms;
+      lut = std::move(thread_lut);
+    }
+
+    all_identical = all_identical && identical;
+    std::cout << std::format("{:>8} {:>12.2f} {:>7.2f}x {:>10}\n", thread_count, ms, single_thread_ms / ms,
+                             identical ? "yes" : "NO");
+  }
+
+  // Scalar integration of every texel
+  std::vector<std::array<float, 2>> reference(lut->texels.size());
+  auto const reference_begin{std::chrono::steady_clock::now()};
+
+  ParallelFor(*size, GetDefaultThreadCount(), [&](std::size_t const y) {
+    auto const roughness{(static_cast<float>(y) + 0.5f) / static_cast<float>(*size)};
+
+    for (std::uint32_t x{0}; x < *size; x++) {
+      auto const n_dot_v{(static_cast<float>(x) + 0.5f) / static_cast<float>(*size)};
+      reference[y * *size + x] = IntegrateDfg(n_dot_v, roughness, *sample_count);
+    }
+  });
+
+  auto const reference_end{std::chrono::steady_clock::now()};
+  auto max_simd_error{0.0};
+
+  for (std::size_t i{0}; i < reference.size(); i++) {
+    for (std::size_t c{0}; c < 2; c++) {
+      auto const expected{std::clamp(static_cast<double>(reference[i][c]), 0.0, 1.0)};
+      max_simd_error = std::max(max_simd_error, std::abs(lut->texels[i][c] / 65535.0 - expected));
+    }
+  }
+
+  auto const matches_scalar{max_simd_error <= kDfgMaxSimdError};
+  std::cout << std::format("Scalar integration took {:.2f} ms on {} threads, max error {:.3e}, within {:.0e}: {}\n",
+                           Milliseconds{reference_end - reference_begin}.count(), GetDefaultThreadCount(),
+                           max_simd_error, kDfgMaxSimdError, matches_scalar ? "yes" : "NO");
+
+  // Under a uniform white environment the prefiltered lookup is exact, so any difference comes from the table
+  auto env{CreateCubeMap(4)};
+  std::ranges::fill(env.texels, Vector4{1, 1, 1, 1});
+
+  std::cout << std::format("{:>10} {:>10} {:>16} {:>16}\n", "roughness", "f0", "max abs error", "at n_dot_v");
+
+  auto max_lighting_error{0.0};
+  DirectX::XMFLOAT3 const normal{0.48f, 0.6f, 0.64f};
+  DirectX::XMFLOAT3 tangent;
+  DirectX::XMFLOAT3 bitangent;
+  BuildBasis(normal, tangent, bitangent);
+
+  for (auto const roughness : {0.05f, 0.25f, 0.5f, 0.75f, 1.0f}) {
+    for (auto const f0 : {0.04f, 0.5f, 1.0f}) {
+      auto error{0.0};
+      auto worst_n_dot_v{0.0f};
+
+      for (auto const n_dot_v : {0.05f, 0.1f, 0.25f, 0.5f, 0.75f, 1.0f}) {
+        auto const sin_v{std::sqrt(1 - n_dot_v * n_dot_v)};
+        DirectX::XMFLOAT3 const view{
+          normal.x * n_dot_v + tangent.x * sin_v, normal.y * n_dot_v + tangent.y * sin_v,
+          normal.z * n_dot_v + tangent.z * sin_v
+        };
+        Vector4 const base_color{f0, f0, f0, 1};
+        auto const actual{EvaluateIblSpecular(env, *lut, normal, view, base_color, roughness)};
+        auto const expected{IntegrateIblSpecular(env, normal, view, base_color, roughness, kDfgReferenceGridSize)};
+        auto const texel_error{std::abs(static_cast<double>(actual[0]) - expected[0])};
+
+        if (texel_error > error) {
+          error = texel_error;
+          worst_n_dot_v = n_dot_v;
+        }
+      }
+
+      max_lighting_error = std::max(max_lighting_error, error);
+      std::cout << std::format("{:>10.2f} {:>10.2f} {:>16.3e} {:>16.2f}\n", roughness, f0, error, worst_n_dot_v);
+    }
+  }
+
+  auto const matches_brute_force{max_lighting_error <= kDfgMaxLightingError};
+  std::cout << std::format("Lighting matches brute force integration within {:.0e}: {}\n", kDfgMaxLightingError,
+                           matches_brute_force ? "yes" : "NO");
+
+  return all_identical && matches_scalar && matches_brute_force;
+}
+
+
+// Peak signal to noise ratio of a mip over the rgb channels, relative to the brightest channel of the reference.
+// The reference is clamped to what BC6H_UF16 can store first, so only the compression error is measured.
+auto ComputeMipPsnr(CubeMap const& reference, CubeMap const& decoded, std::uint32_t const mip) -> double {
+  auto peak{0.0};
+  auto squared_error{0.0};
+  std::size_t count{0};
+
+  for (std::uint32_t face{0}; face < 6; face++) {
+    auto const expected{reference.GetFaceMip(face, mip)};
+    auto const actual{decoded.GetFaceMip(face, mip)};
+
+    for (std::size_t i{0}; i < expected.size(); i++) {
+      for (std::size_t c{0}; c < 3; c++) {
+        auto const value{std::clamp(static_cast<double>(expected[i][c]), 0.0, 65504.0)};
+        auto const error{static_cast<double>(actual[i][c]) - value};
+        peak = std::max(peak, value);
+        squared_error += error * error;
+        count++;
+      }
+    }
+  }
+
+  if (squared_error == 0) {
+    return std::numeric_limits<double>::infinity();
+  }
+
+  return 10 * std::log10(peak * peak / (squared_error / static_cast<double>(count)));
+}
+
+
+// Times BC6H compression of a baked environment in both modes over the thread counts, checks that every thread count
+// gives the same blocks, and reports the PSNR of every mip after decoding
+auto BenchmarkBc6hCompression(std::span<wchar_t* const> const args) -> bool {
+  auto const face_size{ParseCount(args[1], "Face size")};
+
+  if (!face_size) {
+    return false;
+  }
+
+  if (*face_size % 4 != 0) {
+    std::cerr << "Face size must be a multiple of 4.\n";
+    return false;
+  }
+
+  auto const equirect{LoadEquirectMap(args[0])};
+
+  if (!equirect) {
+    std::cerr << "Failed to load environment map image.\n";
+    return false;
+  }
+
+  IblBakeSettings const settings{
+    .face_size = *face_size, .sample_count = kDefaultIblBakeSettings.sample_count,
+    .sampling = kDefaultIblBakeSettings.sampling
+  };
+  auto const cube{BakeIbl(*equirect, settings, GetDefaultThreadCount())};
+
+  auto constexpr bytes_per_mib{1024.0 * 1024.0};
+  std::cout << std::format("{} mips of {}x{} faces, {:.2f} MiB as RGBA32F\n", cube.mip_count, *face_size, *face_size,
+                           cube.texels.size() * sizeof(Vector4) / bytes_per_mib);
+
+  auto all_identical{true};
+  std::vector<CubeMap> decoded;
+  std::optional<Bc6hCubeMap> quality_cube;
+
+  std::array constexpr qualities{std::pair{Bc6hQuality::kFast, "fast"}, std::pair{Bc6hQuality::kQuality, "quality"}};
+
+  for (auto const& [quality, name] : qualities) {
+    std::cout << std::format("{} mode\n{:>8} {:>12} {:>12} {:>8} {:>10}\n", name, "threads", "time (ms)",
+                             "Mtexels/s", "speedup", "identical");
+
+    std::optional<Bc6hCubeMap> compressed;
+    double single_thread_ms{0};
+
+    for (auto const thread_count : GetThreadCountSweep()) {
+      auto const begin{std::chrono::steady_clock::now()};
+      auto thread_compressed{EncodeBc6hCubeMap(cube, quality, thread_count)};
+      auto const end{std::chrono::steady_clock::now()};
+
+      auto const ms{Milliseconds{end - begin}.count()};
+      auto const identical{!compressed || thread_compressed.blocks == compressed->blocks};
+
+      if (thread_count == 1) {
+        single_thread_ms = ms;
+        compressed = std::move(thread_compressed);
+      }
+
+      all_identical = all_identical && identical;
+      std::cout << std::format("{:>8} {:>12.2f} {:>12.2f} {:>7.2f}x {:>10}\n", thread_count, ms,
+                               static_cast<double>(cube.texels.size()) / 1e3 / ms, single_thread_ms / ms,
+                               identical ? "yes" : "NO");
+    }
+
+    std::cout << std::format("{:.2f} MiB compressed, {:.1f}x smaller\n",
+                             compressed->blocks.size() * sizeof(Bc6hBlock) / bytes_per_mib,
+                             static_cast<double>(cube.texels.size() * sizeof(Vector4)) /
+                             static_cast<double>(compressed->blocks.size() * sizeof(Bc6hBlock)));
+
+    decoded.push_back(DecodeBc6hCubeMap(*compressed, GetDefaultThreadCount()));
+
+    if (quality == Bc6hQuality::kQuality) {
+      quality_cube = std::move(compressed);
+    }
+  }
+
+  std::cout << std::format("{:>8} {:>8} {:>16} {:>16}\n", "mip", "size", "fast PSNR (dB)", "quality PSNR (dB)");
+
+  for (std::uint32_t mip{0}; mip < cube.mip_count; mip++) {
+    std::cout << std::format("{:>8} {:>8} {:>16.2f} {:>16.2f}\n", mip, cube.GetMipSize(mip),
+                             ComputeMipPsnr(cube, decoded[0], mip), ComputeMipPsnr(cube, decoded[1], mip));
+  }
+
+  // The first cached load may still find a cache of an earlier run
+  for (auto const name : {"cached", "warm"}) {
+    auto const load_begin{std::chrono::steady_clock::now()};
+    auto const loaded{
+      LoadCompressedPrefilteredEnvironment(args[0], settings, Bc6hQuality::kQuality, GetDefaultThreadCount())
+    };
+    auto const load_end{std::chrono::steady_clock::now()};
+    auto const identical{loaded && loaded->blocks == quality_cube->blocks};
+    all_identical = all_identical && identical;
+    std::cout << std::format("{:>8}: {:.2f} ms, identical: {}\n", name, Milliseconds{load_end - load_begin}.count(),
+                             identical ? "yes" : "NO");
+  }
+
+  return all_identical;
+}
+
+
+// Polls the working set on a background thread to find the peak of a single run. The peak counter of the process
+// cannot be reset between runs.
+class PeakMemorySampler {
+public:
+  PeakMemorySampler() :
+    baseline_{GetWorkingSetSize()}, peak_{baseline_}, thread_{
+      [this](std::stop_token const& stop_token) {
+        while (!stop_token.stop_requested()) {
+          Sample();
+          std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        }
+      }
+    } {
+  }
+
+  // Peak working set above the one at construction in bytes
+  [[nodiscard]] auto Stop() -> std::size_t {
+    thread_.request_stop();
+    thread_.join();
+    Sample();
+    return peak_ - baseline_;
+  }
+
+private:
+  auto Sample() -> void {
+    peak_ = std::max(peak_.load(), GetWorkingSetSize());
+  }
+
+  std::size_t baseline_;
+  std::atomic<std::size_t> peak_;
+  std::jthread thread_;
+};
+
+
+// Checks that the reachable mips cover every lookup of lighting.hlsli over each roughness range, that baking only those
+// mips gives the texels of the full bake, and that the lazily filled BC6H cache returns the blocks of the full chain.
+// The compressed loads only bake anything on a map without a compressed cache.
+auto BenchmarkPrefilterMipRanges(std::span<wchar_t* const> const args) -> bool {
+  auto const face_size{ParseCount(args[1], "Face size")};
+  auto const sample_count{ParseCount(args[2], "Sample count")};
+
+  if (!face_size || !sample_count) {
+    return false;
+  }
+
+  if (*face_size % 4 != 0) {
+    std::cerr << "Face size must be a multiple of 4.\n";
+    return false;
+  }
+
+  auto const equirect{LoadEquirectMap(args[0])};
+
+  if (!equirect) {
+    std::cerr << "Failed to load environment map image.\n";
+    return false;
+  }
+
+  IblBakeSettings const settings{
+    .face_size = *face_size, .sample_count = *sample_count, .sampling = PrefilterSampling::kGgx
+  };
+
+  auto const full_begin{std::chrono::steady_clock::now()};
+  auto const full{BakeIbl(*equirect, settings, GetDefaultThreadCount())};
+  auto const full_end{std::chrono::steady_clock::now()};
+  auto const full_ms{Milliseconds{full_end - full_begin}.count()};
+
+  auto constexpr bytes_per_mib{1024.0 * 1024.0};
+  auto const get_bc6h_mib{
+    [&full](std::uint32_t const mip_count) {
+      return static_cast<double>(CreateBc6hCubeMap(full.face_size, mip_count).blocks.size() * sizeof(Bc6hBlock)) /
+             bytes_per_mib;
+    }
+  };
+
+  auto const format_mips{
+    [](std::uint32_t const mip_mask) {
+      std::string mips;
+
+      for (std::uint32_t mip{0}; mip < 32; mip++) {
+        if ((mip_mask >> mip & 1) != 0) {
+          mips += std::format("{}{}", mips.empty() ? "" : ",", mip);
+        }
+      }
+
+      return mips;
+    }
+  };
+
+  std::cout << std::format("Full bake of {} mips of {}x{} faces took {:.2f} ms, {:.2f} MiB as BC6H\n", full.mip_count,
+                           *face_size, *face_size, full_ms, get_bc6h_mib(full.mip_count));
+  std::cout << std::format("{:>12} {:>16} {:>10} {:>8} {:>8} {:>8} {:>10}\n", "roughness", "mips", "bake (ms)",
+                           "speedup", "MiB", "covered", "identical");
+
+  auto all_covered{true};
+  auto all_identical{true};
+  std::vector<std::uint32_t> mip_masks;
+
+  for (auto const& [min_roughness, max_roughness] : kMipRangeRoughness) {
+    auto const mip_mask{ComputeReachablePrefilteredMips(min_roughness, max_roughness, full.mip_count)};
+    mip_masks.push_back(mip_mask);
+
+    // A trilinear lookup reads the mips below and above its own
+    auto covered{true};
+
+    for (std::uint32_t i{0}; i <= kMipRangeRoughnessSteps; i++) {
+      auto const roughness{
+        std::lerp(min_roughness, max_roughness, static_cast<float>(i) / static_cast<float>(kMipRangeRoughnessSteps))
+      };
+      auto const mip{ComputePrefilteredMip(roughness, full.mip_count)};
+      covered = covered && (mip_mask >> static_cast<std::uint32_t>(std::floor(mip)) & 1) != 0 &&
+                (mip_mask >> static_cast<std::uint32_t>(std::ceil(mip)) & 1) != 0;
+    }
+
+    auto const begin{std::chrono::steady_clock::now()};
+    auto const partial{BakeIbl(*equirect, settings, GetDefaultThreadCount(), mip_mask)};
+    auto const end{std::chrono::steady_clock::now()};
+    auto const ms{Milliseconds{end - begin}.count()};
+
+    auto identical{partial.mip_count == static_cast<std::uint32_t>(std::bit_width(mip_mask))};
+
+    for (std::uint32_t mip{0}; identical && mip < partial.mip_count; mip++) {
+      for (std::uint32_t face{0}; (mip_mask >> mip & 1) != 0 && face < 6; face++) {
+        identical = identical && std::ranges::equal(partial.GetFaceMip(face, mip), full.GetFaceMip(face, mip));
+      }
+    }
+
+    all_covered = all_covered && covered;
+    all_identical = all_identical && identical;
+    std::cout << std::format("{:>5.2f}-{:<6.2f} {:>16} {:>10.2f} {:>7.2f}x {:>8.2f} {:>8} {:>10}\n", min_roughness,
+                             max_roughness, format_mips(mip_mask), ms, full_ms / ms, get_bc6h_mib(partial.mip_count),
+                             covered ? "yes" : "NO", identical ? "yes" : "NO");
+  }
+
+  // Every load after the first only bakes the mips the earlier ones did not
+  auto const full_compressed{EncodeBc6hCubeMap(full, Bc6hQuality::kQuality, GetDefaultThreadCount())};
+
+  for (auto const mip_mask : mip_masks) {
+    auto const loaded{
+      LoadCompressedPrefilteredEnvironment(args[0], settings, mip_mask, Bc6hQuality::kQuality, GetDefaultThreadCount())
+    };
+
+    auto identical{
+      loaded && loaded->cube.mip_count == static_cast<std::uint32_t>(std::bit_width(mip_mask)) &&
+      (loaded->valid_mips & mip_mask) == mip_mask
+    };
+
+    for (std::uint32_t mip{0}; identical && mip < loaded->cube.mip_count; mip++) {
+      for (std::uint32_t face{0}; (mip_mask >> mip & 1) != 0 && face < 6; face++) {
+        identical = identical && std::ranges::equal(loaded->cube.GetFaceMip(face, mip),
+                                                    full_compressed.GetFaceMip(face, mip));
+      }
+    }
+
+    all_identical = all_identical && identical;
+    std::cout << std::format("Compressed load of mips {}, identical: {}\n", format_mips(mip_mask),
+                             identical ? "yes" : "NO");
+  }
+
+  return all_covered && all_identical;
+}
+
+
+// Compares the streaming Radiance decoder against stb_image, decoding only and feeding the cube conversion. Every
+// result is checked against the one computed from the stb_image decode.
+auto BenchmarkHdrDecoding(std::span<wchar_t* const> const args) -> bool {
+  auto const face_size{ParseCount(args[1], "Face size")};
+
+  if (!face_size) {
+    return false;
+  }
+
+  auto constexpr bytes_per_mib{1024.0 * 1024.0};
+  auto const path_utf8{std::filesystem::path{args[0]}.u8string()};
+
+  if (!HdrDecoder::New(args[0])) {
+    std::cerr << "Not a supported Radiance file.\n";
+    return false;
+  }
+
+  auto all_identical{true};
+  double pixel_count{0};
+
+  auto const print_run{
+    [&](std::string_view const name, auto const begin, auto const end, std::size_t const peak_bytes,
+        std::optional<bool> const identical) {
+      auto const ms{Milliseconds{end - begin}.count()};
+      all_identical = all_identical && identical.value_or(true);
+      std::cout << std::format("{:>22} {:>12.2f} {:>12.2f} {:>12.2f} {:>10}\n", name, ms, peak_bytes / bytes_per_mib,
+                               pixel_count / 1e3 / ms, identical ? (*identical ? "yes" : "NO") : "-");
+    }
+  };
+
+  std::cout << std::format("{:>22} {:>12} {:>12} {:>12} {:>10}\n", "", "time (ms)", "peak MiB", "Mpixels/s",
+                           "identical");
+
+  // stb_image decodes to RGBA32F in one go
+  int width;
+  int height;
+  int channel_count;
+  PeakMemorySampler stb_memory;
+  auto const stb_begin{std::chrono::steady_clock::now()};
+  std::unique_ptr<float, decltype(&stbi_image_free)> const reference{
+    stbi_loadf(reinterpret_cast<char const*>(path_utf8.data()), &width, &height, &channel_count, 4), &stbi_image_free
+  };
+  auto const stb_end{std::chrono::steady_clock::now()};
+
+  if (!reference) {
+    std::cerr << "Failed to load environment map image.\n";
+    return false;
+  }
+
+  pixel_count = static_cast<double>(width) * height;
+  print_run("stbi_loadf (RGBA32F)", stb_begin, stb_end, stb_memory.Stop(), std::nullopt);
+
+  auto const texel_count{static_cast<std::size_t>(width) * static_cast<std::size_t>(height)};
+  std::span const reference_texels{reinterpret_cast<Vector4 const*>(reference.get()), texel_count};
+
+  // Row by row into a single reused scanline, the bounded memory case
+  {
+    PeakMemorySampler memory;
+    auto const begin{std::chrono::steady_clock::now()};
+    auto const decoder{HdrDecoder::New(args[0])};
+    std::vector<HalfVector4> row(decoder->GetWidth());
+    auto success{true};
+
+    while (success && decoder->GetNextRow() < decoder->GetHeight()) {
+      success = decoder->DecodeRows(row);
+    }
+
+    auto const end{std::chrono::steady_clock::now()};
+    print_run("streamed rows (half)", begin, end, memory.Stop(), success);
+  }
+
+  // The whole image, to compare with stb_image
+  {
+    PeakMemorySampler memory;
+    auto const begin{std::chrono::steady_clock::now()};
+    auto const decoder{HdrDecoder::New(args[0])};
+    std::vector<HalfVector4> texels(reference_texels.size());
+    auto const success{decoder->DecodeRows(texels)};
+    auto const end{std::chrono::steady_clock::now()};
+    auto const peak_bytes{memory.Stop()};
+
+    auto identical{success};
+
+    for (std::size_t i{0}; identical && i < texels.size(); i++) {
+      for (std::size_t c{0}; c < 4; c++) {
+        auto const expected{std::min(reference_texels[i][c], 65504.0f)};
+        identical = identical && texels[i][c] == DirectX::PackedVector::XMConvertFloatToHalf(expected);
+      }
+    }
+
+    print_run("streamed image (half)", begin, end, peak_bytes, identical);
+  }
+
+  {
+    PeakMemorySampler memory;
+    auto const begin{std::chrono::steady_clock::now()};
+    auto const decoder{HdrDecoder::New(args[0])};
+    std::vector<Vector4> texels(reference_texels.size());
+    auto const success{decoder->DecodeRows(texels)};
+    auto const end{std::chrono::steady_clock::now()};
+    auto const peak_bytes{memory.Stop()};
+    auto const identical{success && std::ranges::equal(texels, reference_texels)};
+    print_run("streamed image (float)", begin, end, peak_bytes, identical);
+  }
+
+  // Equirect to cube conversion, through the whole image and through bands of rows
+  std::optional<CubeMap> expected_cube;
+
+  {
+    PeakMemorySampler memory;
+    auto const begin{std::chrono::steady_clock::now()};
+    auto const equirect{LoadEquirectMap(args[0])};
+    expected_cube = ConvertEquirectToCube(*equirect, *face_size, GetDefaultThreadCount());
+    auto const end{std::chrono::steady_clock::now()};
+    print_run("stb_image to cube", begin, end, memory.Stop(), std::nullopt);
+  }
+
+  {
+    PeakMemorySampler memory;
+    auto const begin{std::chrono::steady_clock::now()};
+    auto const decoder{HdrDecoder::New(args[0])};
+    auto const cube{ConvertEquirectToCube(*decoder, *face_size, GetDefaultThreadCount())};
+    auto const end{std::chrono::steady_clock::now()};
+    auto const peak_bytes{memory.Stop()};
+    print_run("streamed bands to cube", begin, end, peak_bytes, cube && cube->texels == expected_cube->texels);
+  }
+
+  std::cout << std::format("Cube texels alone take {:.2f} MiB\n",
+                           expected_cube->texels.size() * sizeof(Vector4) / bytes_per_mib);
+  return all_identical;
+}
+
+
+// Converts spans of floats to the codes of one small float format and back at a given SIMD level. Codes are halves or
+// the bits of a single R11G11B10 channel.
+struct SmallFloatFormat {
+  std::string_view name;
+  std::uint32_t code_count;
+  std::uint32_t magnitude_mask; // Code bits besides the sign
+  std::uint32_t infinity; // Code of +INF
+  std::vector<std::pair<float, std::uint32_t>> limits; // Values around the ends of the range and their codes
+  void (*encode)(std::span<float const> values, std::span<std::uint32_t> codes, SimdLevel level);
+  void (*decode)(std::span<std::uint32_t const> codes, std::span<float> values, SimdLevel level);
+};
+
+
+auto EncodeHalves(std::span<float const> const values, std::span<std::uint32_t> const codes,
+                  SimdLevel const level) -> void {
+  std::vector<std::uint16_t> halves(values.size());
+  ConvertFloatsToHalves(values, halves, level);
+  std::ranges::copy(halves, codes.begin());
+}
+
+
+auto DecodeHalves(std::span<std::uint32_t const> const codes, std::span<float> const values,
+                  SimdLevel const level) -> void {
+  std::vector<std::uint16_t> halves(codes.size());
+  std::ranges::transform(codes, halves.begin(), [](std::uint32_t const code) {
+    return static_cast<std::uint16_t>(code);
+  });
+  ConvertHalvesToFloats(halves, values, level);
+}
+
+
+template<std::size_t kChannel>
+auto EncodeR11G11B10Channel(std::span<float const> const values, std::span<std::uint32_t> const codes,
+                            SimdLevel const level) -> void {
+  std::vector<Vector4> texels(values.size(), Vector4{0, 0, 0, 1});
+  std::vector<PackedR11G11B10> packed(values.size());
+
+  for (std::size_t i{0}; i < values.size(); i++) {
+    texels[i][kChannel] = values[i];
+  }
+
+  PackR11G11B10(texels, packed, level);
+  std::ranges::transform(packed, codes.begin(), [](PackedR11G11B10 const p) {
+    return p >> (11 * kChannel) & (kChannel == 2 ? 0x3FF : 0x7FF);
+  });
+}
+
+
+template<std::size_t kChannel>
+auto DecodeR11G11B10Channel(std::span<std::uint32_t const> const codes, std::span<float> const values,
+                            SimdLevel const level) -> void {
+  std::vector<PackedR11G11B10> packed(codes.size());
+  std::vector<Vector4> texels(codes.size());
+  std::ranges::transform(codes, packed.begin(), [](std::uint32_t const code) { return code << (11 * kChannel); });
+  UnpackR11G11B10(packed, texels, level);
+  std::ranges::transform(texels, values.begin(), [](Vector4 const& texel) { return texel[kChannel]; });
+}
+
+
+auto GetSmallFloatFormats() -> std::array<SmallFloatFormat, 4> {
+  auto constexpr infinity{std::numeric_limits<float>::infinity()};
+  auto constexpr max_r11{65024.0f};
+  auto constexpr max_b10{64512.0f};
+
+  auto const unsigned_limits{
+    [&](float const max, std::uint32_t const max_code) -> std::vector<std::pair<float, std::uint32_t>> {
+      // Finite values past the range saturate, negative ones become 0
+      return {
+        {max, max_code}, {std::nextafter(max, infinity), max_code}, {1e9f, max_code}, {infinity, max_code + 1},
+        {-1.0f, 0}, {-0.0f, 0}, {-infinity, 0}
+      };
+    }
+  };
+
+  return {
+    SmallFloatFormat{
+      "half", 1 << 16, 0x7FFF, 0x7C00,
+      {
+        {65504.0f, 0x7BFF}, {std::nextafter(65520.0f, 0.0f), 0x7BFF}, {65520.0f, 0x7C00}, {1e9f, 0x7C00},
+        {-1e9f, 0xFC00}, {infinity, 0x7C00}, {-infinity, 0xFC00}
+      },
+      &EncodeHalves, &DecodeHalves
+    },
+    SmallFloatFormat{
+      "r11", 1 << 11, 0x7FF, 0x7C0, unsigned_limits(max_r11, 0x7BF), &EncodeR11G11B10Channel<0>,
+      &DecodeR11G11B10Channel<0>
+    },
+    SmallFloatFormat{
+      "g11", 1 << 11, 0x7FF, 0x7C0, unsigned_limits(max_r11, 0x7BF), &EncodeR11G11B10Channel<1>,
+      &DecodeR11G11B10Channel<1>
+    },
+    SmallFloatFormat{
+      "b10", 1 << 10, 0x3FF, 0x3E0, unsigned_limits(max_b10, 0x3DF), &EncodeR11G11B10Channel<2>,
+      &DecodeR11G11B10Channel<2>
+    },
+  };
+}
+
+
+// Checks a format exhaustively at a SIMD level and returns the number of failures. Every code must decode bit for bit
+// like the scalar conversion and encode back to itself, NaNs to any NaN. Values halfway between neighbouring finite
+// codes must round to the even one and the floats right next to the halfway point to the nearer one.
+auto CountSmallFloatErrors(SmallFloatFormat const& format, SimdLevel const level) -> std::size_t {
+  std::vector<std::uint32_t> codes(format.code_count);
+  std::iota(codes.begin(), codes.end(), 0u);
+
+  std::vector<float> decoded(codes.size());
+  std::vector<float> reference(codes.size());
+  format.decode(codes, decoded, level);
+  format.decode(codes, reference, SimdLevel::kScalar);
+
+  std::size_t error_count{0};
+
+  for (std::size_t i{0}; i < codes.size(); i++) {
+    if (std::bit_cast<std::uint32_t>(decoded[i]) != std::bit_cast<std::uint32_t>(reference[i])) {
+      error_count++;
+    }
+  }
+
+  auto values{reference};
+  auto expected{codes};
+
+  for (std::uint32_t code{0}; code + 1 < format.code_count; code++) {
+    auto const next_magnitude{(code + 1) & format.magnitude_mask};
+
+    // Both codes must be finite and of the same sign
+    if (next_magnitude == 0 || next_magnitude >= format.infinity) {
+      continue;
+    }
+
+    auto const lower{reference[code]};
+    auto const upper{reference[code + 1]};
+    // Exact, the formats have far fewer mantissa bits than floats
+    auto const halfway{static_cast<float>((static_cast<double>(lower) + upper) / 2)};
+
+    values.insert(values.end(), {halfway, std::nextafter(halfway, lower), std::nextafter(halfway, upper)});
+    expected.insert(expected.end(), {code % 2 == 0 ? code : code + 1, code, code + 1});
+  }
+
+  for (auto const& [value, code] : format.limits) {
+    values.push_back(value);
+    expected.push_back(code);
+  }
+
+  std::vector<std::uint32_t> encoded(values.size());
+  format.encode(values, encoded, level);
+
+  for (std::size_t i{0}; i < values.size(); i++) {
+    auto const is_nan_code{(encoded[i] & format.magnitude_mask) > format.infinity};
+
+    if (std::isnan(values[i]) ? !is_nan_code : encoded[i] != expected[i]) {
+      error_count++;
+    }
+  }
+
+  return error_count;
+}
+
+
+// Converts every float bit pattern to half and, as all three channels, to R11G11B10 at a SIMD level, and counts the
+// results that differ from the scalar conversion
+auto CountFloatSweepMismatches(SimdLevel const level, unsigned const thread_count) -> std::size_t {
+  std::atomic<std::size_t> mismatch_count{0};
+
+  ParallelFor((std::size_t{1} << 32) / kFloatSweepChunkSize, thread_count, [&](std::size_t const chunk) {
+    std::vector<float> values(kFloatSweepChunkSize);
+    std::vector<Vector4> texels(kFloatSweepChunkSize);
+
+    for (std::size_t i{0}; i < values.size(); i++) {
+      values[i] = std::bit_cast<float>(static_cast<std::uint32_t>(chunk * kFloatSweepChunkSize + i));
+      texels[i] = {values[i], values[i], values[i], 0};
+    }
+
+    std::vector<std::uint16_t> halves(values.size());
+    std::vector<std::uint16_t> reference_halves(values.size());
+    ConvertFloatsToHalves(values, halves, level);
+    ConvertFloatsToHalves(values, reference_halves, SimdLevel::kScalar);
+
+    std::vector<PackedR11G11B10> packed(texels.size());
+    std::vector<PackedR11G11B10> reference_packed(texels.size());
+    PackR11G11B10(texels, packed, level);
+    PackR11G11B10(texels, reference_packed, SimdLevel::kScalar);
+
+    std::size_t count{0};
+
+    for (std::size_t i{0}; i < values.size(); i++) {
+      count += (halves[i] != reference_halves[i]) + (packed[i] != reference_packed[i]);
+    }
+
+    mismatch_count += count;
+  });
+
+  return mismatch_count;
+}
+
+
+// Checks the half and R11G11B10 conversions exhaustively at every SIMD level the CPU supports, then times them on
+// value_count random values
+auto BenchmarkPixelPacking(std::span<wchar_t* const> const args) -> bool {
+  auto const value_count{ParseCount(args[0], "Value count")};
+
+  if (!value_count) {
+    return false;
+  }
+
+  std::vector<SimdLevel> levels;
+
+  for (auto const level : {SimdLevel::kScalar, SimdLevel::kSse2, SimdLevel::kAvx2}) {
+    if (level <= GetSimdLevel()) {
+      levels.push_back(level);
+    }
+  }
+
+  std::cout << std::format("Best supported level: {}\n", GetSimdLevelName(GetSimdLevel()));
+  std::cout << std::format("{:>8} {:>8} {:>8} {:>8} {:>8} {:>14}\n", "level", "half", "r11", "g11", "b10",
+                           "float sweep");
+
+  auto all_correct{true};
+  auto const formats{GetSmallFloatFormats()};
+
+  for (auto const level : levels) {
+    std::cout << std::format("{:>8}", GetSimdLevelName(level));
+
+    for (auto const& format : formats) {
+      auto const error_count{CountSmallFloatErrors(format, level)};
+      all_correct = all_correct && error_count == 0;
+      std::cout << std::format(" {:>8}", error_count);
+    }
+
+    // The scalar conversion is what the sweep compares against
+    if (level == SimdLevel::kScalar) {
+      std::cout << std::format(" {:>14}\n", "-");
+      continue;
+    }
+
+    auto const mismatch_count{CountFloatSweepMismatches(level, GetDefaultThreadCount())};
+    all_correct = all_correct && mismatch_count == 0;
+    std::cout << std::format(" {:>14}\n", mismatch_count);
+  }
+
+  std::cout << std::format("Exhaustive checks passed: {}\n", all_correct ? "yes" : "NO");
+
+  // Random magnitudes over the whole half range and a bit beyond, a quarter of them negative
+  std::mt19937 rng{42};
+  std::uniform_real_distribution<float> exponent_dist{-20.0f, 17.0f};
+  std::uniform_int_distribution<int> sign_dist{0, 3};
+
+  std::vector<float> values(*value_count);
+  std::ranges::generate(values, [&] { return std::exp2(exponent_dist(rng)) * (sign_dist(rng) == 0 ? -1.0f : 1.0f); });
+
+  std::vector<Vector4> texels(*value_count / 4);
+  std::memcpy(texels.data(), values.data(), texels.size() * sizeof(Vector4));
+
+  std::vector<std::uint16_t> halves(values.size());
+  std::vector<float> unpacked_values(values.size());
+  std::vector<PackedR11G11B10> packed(texels.size());
+  std::vector<Vector4> unpacked_texels(texels.size());
+
+  std::cout << std::format("{:>18} {:>8} {:>12} {:>12} {:>8}\n", "", "level", "time (ms)", "Melements/s", "speedup");
+
+  auto const time_conversion{
+    [&](std::string_view const name, std::size_t const element_count, auto const& convert) {
+      double scalar_ms{0};
+
+      for (auto const level : levels) {
+        auto ms{std::numeric_limits<double>::max()};
+
+        for (std::uint32_t i{0}; i < kPixelPackingRepetitions; i++) {
+          auto const begin{std::chrono::steady_clock::now()};
+          convert(level);
+          auto const end{std::chrono::steady_clock::now()};
+          ms = std::min(ms, Milliseconds{end - begin}.count());
+        }
+
+        if (level == SimdLevel::kScalar) {
+          scalar_ms = ms;
+        }
+
+        std::cout << std::format("{:>18} {:>8} {:>12.3f} {:>12.1f} {:>7.2f}x\n", name, GetSimdLevelName(level), ms,
+                                 element_count / 1e3 / ms, scalar_ms / ms);
+      }
+    }
+  };
+
+  time_conversion("float to half", values.size(), [&](SimdLevel const level) {
+    ConvertFloatsToHalves(values, halves, level);
+  });
+  time_conversion("half to float", halves.size(), [&](SimdLevel const level) {
+    ConvertHalvesToFloats(halves, unpacked_values, level);
+  });
+  time_conversion("rgba to r11g11b10", texels.size(), [&](SimdLevel const level) {
+    PackR11G11B10(texels, packed, level);
+  });
+  time_conversion("r11g11b10 to rgba", packed.size(), [&](SimdLevel const level) {
+    UnpackR11G11B10(packed, unpacked_texels, level);
+  });
+
+  return all_correct;
+}
+
+
+// Equirect map whose texels hold the direction through their center, like ConvertEquirectToCube maps it
+auto CreateDirectionEquirectMap(std::uint32_t const width) -> EquirectMap {
+  EquirectMap map{.width = width, .height = width / 2, .texels = {}};
+  map.texels.resize(static_cast<std::size_t>(map.width) * map.height);
+
+  for (std::uint32_t y{0}; y < map.height; y++) {
+    for (std::uint32_t x{0}; x < map.width; x++) {
+      auto const lon{((static_cast<float>(x) + 0.5f) / static_cast<float>(map.width) - 0.5f) * 2 * kPi};
+      auto const lat{(static_cast<float>(y) + 0.5f) / static_cast<float>(map.height) * kPi};
+      map.texels[static_cast<std::size_t>(y) * map.width + x] = {
+        std::sin(lat) * std::cos(lon), std::cos(lat), std::sin(lat) * std::sin(lon), 1
+      };
+    }
+  }
+
+  return map;
+}
+
+
+// Checks the converted direction map at the center and the corners of every face against the face frames of the
+// D3D11 cube map spec: the direction a face looks along, and the directions its texel columns and rows grow in
+auto CheckCubeFaceOrientation(CubeMap const& cube) -> bool {
+  using Vector3 = std::array<double, 3>;
+
+  struct FaceFrame {
+    std::string_view name;
+    Vector3 forward;
+    Vector3 right;
+    Vector3 down;
+  };
+
+  std::array constexpr frames{
+    FaceFrame{"+X", {1, 0, 0}, {0, 0, -1}, {0, -1, 0}},
+    FaceFrame{"-X", {-1, 0, 0}, {0, 0, 1}, {0, -1, 0}},
+    FaceFrame{"+Y", {0, 1, 0}, {1, 0, 0}, {0, 0, 1}},
+    FaceFrame{"-Y", {0, -1, 0}, {1, 0, 0}, {0, 0, -1}},
+    FaceFrame{"+Z", {0, 0, 1}, {1, 0, 0}, {0, -1, 0}},
+    FaceFrame{"-Z", {0, 0, -1}, {-1, 0, 0}, {0, -1, 0}},
+  };
+
+  auto const size{cube.face_size};
+  auto const last{size - 1};
+  std::array<std::array<std::uint32_t, 2>, 5> const texels{{{size / 2, size / 2}, {0, 0}, {last, 0}, {0, last},
+                                                            {last, last}}};
+  auto max_angle{0.0};
+
+  for (std::uint32_t face{0}; face < 6; face++) {
+    auto const& frame{frames[face]};
+    auto face_max_angle{0.0};
+
+    for (auto const [x, y] : texels) {
+      auto const ndc_u{2 * ((x + 0.5) / size) - 1};
+      auto const ndc_v{2 * ((y + 0.5) / size) - 1};
+      Vector3 expected;
+
+      for (std::size_t c{0}; c < 3; c++) {
+        expected[c] = frame.forward[c] + ndc_u * frame.right[c] + ndc_v * frame.down[c];
+      }
+
+      auto const& actual{cube.GetFaceMip(face, 0)[static_cast<std::size_t>(y) * size + x]};
+      auto dot{0.0};
+      auto expected_length{0.0};
+      auto actual_length{0.0};
+
+      for (std::size_t c{0}; c < 3; c++) {
+        dot += expected[c] * actual[c];
+        expected_length += expected[c] * expected[c];
+        actual_length += static_cast<double>(actual[c]) * actual[c];
+      }
+
+      auto const cos_angle{std::clamp(dot / std::sqrt(expected_length * actual_length), -1.0, 1.0)};
+      face_max_angle = std::max(face_max_angle, std::acos(cos_angle) * 180 / std::numbers::pi);
+    }
+
+    max_angle = std::max(max_angle, face_max_angle);
+    std::cout << std::format("{:>8} {:>16.3f}\n", frame.name, face_max_angle);
+  }
+
+  return max_angle <= kOrientationMaxAngle;
+}
+
+
+// Checks the face orientations and the longitude wrap of the equirect to cube conversion, then times it over the cube
+// sizes from 128 up to the given one against the scalar port of the shader. A 4096 cube takes about 2 GiB and three
+// of them are alive at once.
+auto BenchmarkEquirectToCube(std::span<wchar_t* const> const args) -> bool {
+  auto const max_face_size{ParseCount(args[1], "Max face size")};
+
+  if (!max_face_size) {
+    return false;
+  }
+
+  auto const equirect{LoadEquirectMap(args[0])};
+
+  if (!equirect) {
+    std::cerr << "Failed to load environment map image.\n";
+    return false;
+  }
+
+  std::cout << std::format("Face orientation, {}x{} faces, SIMD level: {}\n", kOrientationFaceSize,
+                           kOrientationFaceSize, GetSimdLevelName(GetSimdLevel()));
+  std::cout << std::format("{:>8} {:>16}\n", "face", "max error (deg)");
+
+  auto const direction_map{CreateDirectionEquirectMap(kOrientationMapWidth)};
+  auto const oriented{
+    CheckCubeFaceOrientation(ConvertEquirectToCube(direction_map, kOrientationFaceSize, GetDefaultThreadCount()))
+  };
+  std::cout << std::format("Faces match the D3D11 orientation within {} degree: {}\n", kOrientationMaxAngle,
+                           oriented ? "yes" : "NO");
+
+  // The center of -X looks along the seam of the map, so it must blend the last column with the first one
+  EquirectMap ramp{.width = kOrientationMapWidth, .height = kOrientationMapWidth / 2, .texels = {}};
+  ramp.texels.resize(static_cast<std::size_t>(ramp.width) * ramp.height);
+
+  for (std::size_t i{0}; i < ramp.texels.size(); i++) {
+    ramp.texels[i] = {(static_cast<float>(i % ramp.width) + 0.5f) / static_cast<float>(ramp.width), 0, 0, 1};
+  }
+
+  auto const ramp_cube{ConvertEquirectToCube(ramp, kOrientationFaceSize, GetDefaultThreadCount())};
+  auto const seam_value{ramp_cube.GetFaceMip(1, 0)[kOrientationFaceSize * kOrientationFaceSize / 2][0]};
+  auto const wraps{std::abs(seam_value - 0.5f) < 1e-3f};
+  std::cout << std::format("Longitude wraps at the seam: {} (-X center {:.4f}, expected 0.5)\n", wraps ? "yes" : "NO",
+                           seam_value);
+
+  // Timed on the given map. The error is measured on the smooth direction map instead, where it reflects how far the
+  // lookups are off rather than how much contrast the image has next to them.
+  std::cout << std::format("{}x{} equirect map, reference on {} threads\n", equirect->width, equirect->height,
+                           GetDefaultThreadCount());
+  std::cout << std::format("{:>6} {:>14} {:>14} {:>14} {:>12} {:>8} {:>16} {:>10}\n", "size", "reference (ms)",
+                           "1 thread (ms)", "threads (ms)", "Mtexels/s", "speedup", "max rel error", "identical");
+
+  auto all_identical{true};
+  auto max_relative_error{0.0};
+
+  for (std::uint32_t face_size{128}; face_size <= *max_face_size; face_size *= 2) {
+    // Scoped so that at most three cubes are alive at once
+    bool identical;
+    double reference_ms;
+    double single_ms;
+    double multi_ms;
+
+    {
+      auto const reference_begin{std::chrono::steady_clock::now()};
+      auto const reference{ConvertEquirectToCubeReference(*equirect, face_size, GetDefaultThreadCount())};
+      auto const reference_end{std::chrono::steady_clock::now()};
+
+      auto const single_begin{std::chrono::steady_clock::now()};
+      auto const single{ConvertEquirectToCube(*equirect, face_size, 1)};
+      auto const single_end{std::chrono::steady_clock::now()};
+
+      auto const multi_begin{std::chrono::steady_clock::now()};
+      auto const multi{ConvertEquirectToCube(*equirect, face_size, GetDefaultThreadCount())};
+      auto const multi_end{std::chrono::steady_clock::now()};
+
+      identical = single.texels == multi.texels;
+      reference_ms = Milliseconds{reference_end - reference_begin}.count();
+      single_ms = Milliseconds{single_end - single_begin}.count();
+      multi_ms = Milliseconds{multi_end - multi_begin}.count();
+    }
+
+    auto const expected_directions{ConvertEquirectToCubeReference(direction_map, face_size, GetDefaultThreadCount())};
+    auto const directions{ConvertEquirectToCube(direction_map, face_size, GetDefaultThreadCount())};
+    auto size_rel_error{0.0};
+
+    for (std::size_t i{0}; i < directions.texels.size(); i++) {
+      for (std::size_t c{0}; c < 4; c++) {
+        auto const expected{static_cast<double>(expected_directions.texels[i][c])};
+        auto const error{std::abs(directions.texels[i][c] - expected)};
+        size_rel_error = std::max(size_rel_error, error / std::max(std::abs(expected), kIblErrorFloor));
+      }
+    }
+
+    all_identical = all_identical && identical;
+    max_relative_error = std::max(max_relative_error, size_rel_error);
+    std::cout << std::format("{:>6} {:>14.2f} {:>14.2f} {:>14.2f} {:>12.2f} {:>7.2f}x {:>16.3e} {:>10}\n", face_size,
+                             reference_ms, single_ms, multi_ms,
+                             6.0 * face_size * face_size / 1e3 / multi_ms, reference_ms / multi_ms, size_rel_error,
+                             identical ? "yes" : "NO");
+  }
+
+  auto const matches_reference{max_relative_error <= kIblMaxRelativeError};
+  std::cout << std::format("Matches the reference within {:.0e}: {}\n", kIblMaxRelativeError,
+                           matches_reference ? "yes" : "NO");
+  return oriented && wraps && all_identical && matches_reference;
+}
+
+
+// Average of the rgb channels of a mip over the sphere, every texel weighted by its solid angle
+auto ComputeCubeMipMean(CubeMap const& cube, std::uint32_t const mip) -> double {
+  auto const solid_angles{ComputeCubeMapSolidAngles(cube.GetMipSize(mip))};
+  auto sum{0.0};
+
+  for (std::uint32_t face{0}; face < 6; face++) {
+    auto const texels{cube.GetFaceMip(face, mip)};
+
+    for (std::size_t i{0}; i < texels.size(); i++) {
+      sum += solid_angles[i] * (static_cast<double>(texels[i][0]) + texels[i][1] + texels[i][2]) / 3;
+    }
+  }
+
+  return sum / (4 * std::numbers::pi);
+}
+
+
+// Mean difference between neighbouring texels on different faces over the mean difference between neighbouring
+// texels within a face. Around 1 if the faces join up without a seam.
+auto ComputeCubeMipSeamRatio(CubeMap const& cube, std::uint32_t const mip) -> double {
+  auto const size{cube.GetMipSize(mip)};
+
+  if (size < 2) {
+    return 1;
+  }
+
+  auto const difference{
+    [&](CubeMapTexel const& a, CubeMapTexel const& b) {
+      auto const& texel_a{cube.GetFaceMip(a.face, mip)[static_cast<std::size_t>(a.y) * size + a.x]};
+      auto const& texel_b{cube.GetFaceMip(b.face, mip)[static_cast<std::size_t>(b.y) * size + b.x]};
+      auto sum{0.0};
+
+      for (std::size_t c{0}; c < 3; c++) {
+        sum += std::abs(static_cast<double>(texel_a[c]) - texel_b[c]);
+      }
+
+      return sum / 3;
+    }
+  };
+
+  auto const last{static_cast<std::int32_t>(size) - 1};
+  auto seam_sum{0.0};
+  auto interior_sum{0.0};
+  std::size_t seam_count{0};
+  std::size_t interior_count{0};
+
+  for (std::uint32_t face{0}; face < 6; face++) {
+    for (std::int32_t i{0}; i <= last; i++) {
+      // Every texel along the four edges against the texel across the edge, and against its neighbour inward
+      for (auto const [x, y, inward_x, inward_y, outer_x, outer_y] : {
+             std::array{0, i, 1, i, -1, i}, std::array{last, i, last - 1, i, last + 1, i},
+             std::array{i, 0, i, 1, i, -1}, std::array{i, last, i, last - 1, i, last + 1}
+           }) {
+        CubeMapTexel const texel{face, static_cast<std::uint32_t>(x), static_cast<std::uint32_t>(y)};
+        seam_sum += difference(texel, WrapCubeMapTexel(face, outer_x, outer_y, size));
+        interior_sum += difference(texel, {face, static_cast<std::uint32_t>(inward_x),
+                                           static_cast<std::uint32_t>(inward_y)});
+        seam_count++;
+        interior_count++;
+      }
+    }
+  }
+
+  auto const interior_mean{interior_sum / static_cast<double>(interior_count)};
+  return interior_mean > 0 ? seam_sum / static_cast<double>(seam_count) / interior_mean : 1;
+}
+
+
+// Times the seam aware mip generation over the thread counts and compares its mips with per face box filtering: how
+// visible the face edges are, and how far the average radiance of every mip drifts from that of mip 0
+auto BenchmarkCubeMips(std::span<wchar_t* const> const args) -> bool {
+  auto const face_size{ParseCount(args[1], "Face size")};
+
+  if (!face_size) {
+    return false;
+  }
+
+  auto const equirect{LoadEquirectMap(args[0])};
+
+  if (!equirect) {
+    std::cerr << "Failed to load environment map image.\n";
+    return false;
+  }
+
+  auto const env{ConvertEquirectToCube(*equirect, *face_size, GetDefaultThreadCount())};
+
+  std::cout << std::format("{} mips of {}x{} faces\n", env.mip_count, *face_size, *face_size);
+  std::cout << std::format("{:>8} {:>12} {:>12} {:>8} {:>10}\n", "threads", "box (ms)", "seams (ms)", "speedup",
+                           "identical");
+
+  std::optional<CubeMap> seamless;
+  auto all_identical{true};
+  double single_thread_ms{0};
+
+  for (auto const thread_count : GetThreadCountSweep()) {
+    auto box{env};
+    auto const box_begin{std::chrono::steady_clock::now()};
+    GenerateCubeMipsBox(box, thread_count);
+    auto const box_end{std::chrono::steady_clock::now()};
+
+    auto thread_seamless{env};
+    auto const begin{std::chrono::steady_clock::now()};
+    GenerateCubeMips(thread_seamless, thread_count);
+    auto const end{std::chrono::steady_clock::now()};
+
+    auto const ms{Milliseconds{end - begin}.count()};
+    auto const identical{!seamless || thread_seamless.texels == seamless->texels};
+
+    if (thread_count == 1) {
+      single_thread_ms = ms;
+      seamless = std::move(thread_seamless);
+    }
+
+    all_identical = all_identical && identical;
+    std::cout << std::format("{:>8} {:>12.2f} {:>12.2f} {:>7.2f}x {:>10}\n", thread_count,
+                             Milliseconds{box_end - box_begin}.count(), ms, single_thread_ms / ms,
+                             identical ? "yes" : "NO");
+  }
+
+  auto box{env};
+  GenerateCubeMipsBox(box, GetDefaultThreadCount());
+  auto const mean{ComputeCubeMipMean(env, 0)};
+
+  std::cout << std::format("{:>6} {:>6} {:>12} {:>12} {:>14} {:>14}\n", "mip", "size", "box seams", "seams",
+                           "box mean drift", "mean drift");
+
+  auto max_drift{0.0};
+
+  for (std::uint32_t mip{1}; mip < env.mip_count; mip++) {
+    auto const box_drift{std::abs(ComputeCubeMipMean(box, mip) / mean - 1)};
+    auto const drift{std::abs(ComputeCubeMipMean(*seamless, mip) / mean - 1)};
+    max_drift = std::max(max_drift, drift);
+    std::cout << std::format("{:>6} {:>6} {:>12.3f} {:>12.3f} {:>14.3e} {:>14.3e}\n", mip, env.GetMipSize(mip),
+                             ComputeCubeMipSeamRatio(box, mip), ComputeCubeMipSeamRatio(*seamless, mip), box_drift,
+                             drift);
+  }
+
+  auto const keeps_mean{max_drift <= kCubeMipMaxMeanDrift};
+  std::cout << std::format("Keeps the mean radiance within {:.0e}: {}\n", kCubeMipMaxMeanDrift,
+                           keeps_mean ? "yes" : "NO");
+  return all_identical && keeps_mean;
+}
+
+
+// Relative RMS difference of the rgb channels of a mip, every texel weighted by its solid angle. Channels darker than
+// kIblErrorFloor count as kIblErrorFloor.
+auto ComputeMipRelativeRmsError(CubeMap const& reference, CubeMap const& actual, std::uint32_t const mip) -> double {
+  auto const solid_angles{ComputeCubeMapSolidAngles(reference.GetMipSize(mip))};
+  auto sum{0.0};
+
+  for (std::uint32_t face{0}; face < 6; face++) {
+    auto const expected{reference.GetFaceMip(face, mip)};
+    auto const texels{actual.GetFaceMip(face, mip)};
+
+    for (std::size_t i{0}; i < expected.size(); i++) {
+      for (std::size_t c{0}; c < 3; c++) {
+        auto const error{
+          (static_cast<double>(texels[i][c]) - expected[i][c]) / std::max<double>(expected[i][c], kIblErrorFloor)
+        };
+        sum += solid_angles[i] * error * error / 3;
+      }
+    }
+  }
+
+  return std::sqrt(sum / (4 * std::numbers::pi));
+}
+
+
+// The integral PrefilterCubeMap estimates, sum(L * N.L * D) / sum(N.L * D) over the directions of every texel of a
+// mip of the environment, weighted by their solid angles. Exact up to the resolution of that mip.
+auto PrefilterCubeMapExact(CubeMap const& env, unsigned const thread_count) -> CubeMap {
+  auto source_mip{0u};
+
+  while (env.GetMipSize(source_mip) > kSamplingGroundTruthSize && source_mip + 1 < env.mip_count) {
+    source_mip++;
+  }
+
+  auto const source_size{env.GetMipSize(source_mip)};
+  auto const face_solid_angles{ComputeCubeMapSolidAngles(source_size)};
+  std::vector<DirectX::XMFLOAT3> directions;
+  std::vector<Vector4> radiances;
+  std::vector<float> solid_angles;
+
+  for (std::uint32_t face{0}; face < 6; face++) {
+    auto const texels{env.GetFaceMip(face, source_mip)};
+
+    for (std::uint32_t y{0}; y < source_size; y++) {
+      for (std::uint32_t x{0}; x < source_size; x++) {
+        auto const idx{static_cast<std::size_t>(y) * source_size + x};
+        directions.push_back(ComputeCubeMapDirection(face, x, y, source_size));
+        radiances.push_back(texels[idx]);
+        solid_angles.push_back(face_solid_angles[idx]);
+      }
+    }
+  }
+
+  auto prefiltered{CreateCubeMap(env.face_size, env.mip_count)};
+
+  for (std::uint32_t face{0}; face < 6; face++) {
+    std::ranges::copy(env.GetFaceMip(face, 0), prefiltered.GetFaceMip(face, 0).begin());
+  }
+
+  for (std::uint32_t mip{1}; mip < env.mip_count; mip++) {
+    auto const size{env.GetMipSize(mip)};
+    auto const roughness{static_cast<float>(mip) / static_cast<float>(env.mip_count - 1)};
+
+    ParallelFor(6 * static_cast<std::size_t>(size) * size, thread_count, [&](std::size_t const texel_idx) {
+      auto const face{static_cast<std::uint32_t>(texel_idx / (static_cast<std::size_t>(size) * size))};
+      auto const texel_in_face{texel_idx % (static_cast<std::size_t>(size) * size)};
+      auto const n{
+        ComputeCubeMapDirection(face, static_cast<std::uint32_t>(texel_in_face % size),
+                                static_cast<std::uint32_t>(texel_in_face / size), size)
+      };
+
+      std::array<double, 3> sum{};
+      auto total_weight{0.0};
+
+      for (std::size_t i{0}; i < directions.size(); i++) {
+        auto const& l{directions[i]};
+        auto const n_dot_l{n.x * l.x + n.y * l.y + n.z * l.z};
+
+        if (n_dot_l <= 0) {
+          continue;
+        }
+
+        // |N + L| = sqrt(2 + 2 * N.L) and N.H = (1 + N.L) / |N + L|
+        auto const n_dot_h{std::sqrt((1 + n_dot_l) / 2)};
+        auto const weight{
+          static_cast<double>(n_dot_l) * DistributionTrowbridgeReitz(n_dot_h, roughness) * solid_angles[i]
+        };
+
+        for (std::size_t c{0}; c < 3; c++) {
+          sum[c] += weight * radiances[i][c];
+        }
+
+        total_weight += weight;
+      }
+
+      auto& texel{prefiltered.GetFaceMip(face, mip)[texel_in_face]};
+
+      for (std::size_t c{0}; c < 3; c++) {
+        texel[c] = total_weight > 0 ? static_cast<float>(sum[c] / total_weight) : 0.0f;
+      }
+
+      texel[3] = 1;
+    });
+  }
+
+  return prefiltered;
+}
+
+
+// Relative RMS error over every prefiltered mip
+auto ComputePrefilterRelativeRmsError(CubeMap const& reference, CubeMap const& actual) -> double {
+  auto sum{0.0};
+
+  for (std::uint32_t mip{1}; mip < reference.mip_count; mip++) {
+    auto const error{ComputeMipRelativeRmsError(reference, actual, mip)};
+    sum += error * error;
+  }
+
+  return reference.mip_count > 1 ? std::sqrt(sum / (reference.mip_count - 1)) : 0.0;
+}
+
+
+// Draws samples from the distribution and compares how often every cell was hit with how often it should have been
+auto ComputeEnvironmentHistogramError(EnvironmentDistribution const& distribution) -> double {
+  std::vector<std::uint32_t> hits(distribution.pdfs.size(), 0);
+
+  for (std::uint32_t i{0}; i < kSamplingHistogramSampleCount; i++) {
+    auto const sample{SampleEnvironment(distribution, Hammersley(i, kSamplingHistogramSampleCount))};
+    auto const u{std::atan2(sample.dir.z, sample.dir.x) / (2 * std::numbers::pi) + 0.5};
+    auto const v{std::acos(std::clamp(sample.dir.y, -1.0f, 1.0f)) / std::numbers::pi};
+    auto const x{std::min(static_cast<std::uint32_t>(u * distribution.width), distribution.width - 1)};
+    auto const y{std::min(static_cast<std::uint32_t>(v * distribution.height), distribution.height - 1)};
+    hits[static_cast<std::size_t>(y) * distribution.width + x]++;
+  }
+
+  // Half the summed difference of the probabilities of every cell
+  auto distance{0.0};
+
+  for (std::uint32_t y{0}; y < distribution.height; y++) {
+    auto const solid_angle{
+      2 * std::numbers::pi / distribution.width * (std::cos(std::numbers::pi * y / distribution.height) -
+                                                    std::cos(std::numbers::pi * (y + 1) / distribution.height))
+    };
+
+    for (std::uint32_t x{0}; x < distribution.width; x++) {
+      auto const idx{static_cast<std::size_t>(y) * distribution.width + x};
+      auto const observed{static_cast<double>(hits[idx]) / kSamplingHistogramSampleCount};
+      distance += std::abs(observed - distribution.pdfs[idx] * solid_angle);
+    }
+  }
+
+  return distance / 2;
+}
+
+
+// Checks that the environment distribution draws directions in proportion to its pdf, then plots the error of the
+// GGX and the MIS prefilter against the exact integral as the sample count doubles
+auto BenchmarkEnvironmentSampling(std::span<wchar_t* const> const args) -> bool {
+  auto const face_size{ParseCount(args[1], "Face size")};
+  auto const max_sample_count{ParseCount(args[2], "Max sample count")};
+
+  if (!face_size || !max_sample_count) {
+    return false;
+  }
+
+  auto const equirect{LoadEquirectMap(args[0])};
+
+  if (!equirect) {
+    std::cerr << "Failed to load environment map image.\n";
+    return false;
+  }
+
+  auto const thread_count{GetDefaultThreadCount()};
+  auto env{ConvertEquirectToCube(*equirect, *face_size, thread_count)};
+  GenerateCubeMips(env, thread_count);
+
+  auto const build_begin{std::chrono::steady_clock::now()};
+  auto const distribution{BuildEnvironmentDistribution(*equirect, kSamplingDistributionWidth)};
+  auto const build_end{std::chrono::steady_clock::now()};
+
+  std::cout << std::format("Built a {}x{} environment distribution in {:.2f} ms\n", distribution.width,
+                           distribution.height, Milliseconds{build_end - build_begin}.count());
+
+  auto const histogram_error{ComputeEnvironmentHistogramError(distribution)};
+  auto const matches_distribution{histogram_error <= kSamplingMaxHistogramError};
+  std::cout << std::format("Samples follow the pdf within {:.0e}: {} ({:.3e})\n", kSamplingMaxHistogramError,
+                           matches_distribution ? "yes" : "NO", histogram_error);
+
+  auto const reference_begin{std::chrono::steady_clock::now()};
+  auto const reference{PrefilterCubeMapExact(env, thread_count)};
+  auto const reference_end{std::chrono::steady_clock::now()};
+
+  auto const exact_size{std::min(*face_size, kSamplingGroundTruthSize)};
+  std::cout << std::format("Exact prefilter over {}x{} faces took {:.2f} ms\n", exact_size, exact_size,
+                           Milliseconds{reference_end - reference_begin}.count());
+  std::cout << std::format("{:>8} {:>10} {:>10} {:>12} {:>12} {:>14} {:>14}\n", "samples", "ggx (ms)", "mis (ms)",
+                           "ggx error", "mis error", "ggx mip 1 err", "mis mip 1 err");
+
+  // Mip 1 has the lowest roughness and the narrowest lobe, where a small bright light is easiest to miss
+  auto const mip_1_error{
+    [&](CubeMap const& prefiltered) {
+      return env.mip_count > 1 ? ComputeMipRelativeRmsError(reference, prefiltered, 1) : 0.0;
+    }
+  };
+
+  std::vector<std::pair<std::uint32_t, double>> mis_errors;
+  auto ggx_error{0.0};
+
+  for (std::uint32_t sample_count{16}; sample_count <= *max_sample_count; sample_count *= 2) {
+    auto const ggx_begin{std::chrono::steady_clock::now()};
+    auto const ggx{PrefilterCubeMap(env, sample_count, thread_count)};
+    auto const mis_begin{std::chrono::steady_clock::now()};
+    auto const mis{PrefilterCubeMapMis(env, sample_count, thread_count)};
+    auto const mis_end{std::chrono::steady_clock::now()};
+
+    ggx_error = ComputePrefilterRelativeRmsError(reference, ggx);
+    auto const mis_error{ComputePrefilterRelativeRmsError(reference, mis)};
+    mis_errors.emplace_back(sample_count, mis_error);
+
+    std::cout << std::format("{:>8} {:>10.2f} {:>10.2f} {:>12.3e} {:>12.3e} {:>14.3e} {:>14.3e}\n", sample_count,
+                             Milliseconds{mis_begin - ggx_begin}.count(), Milliseconds{mis_end - mis_begin}.count(),
+                             ggx_error, mis_error, mip_1_error(ggx), mip_1_error(mis));
+  }
+
+  auto const match{
+    std::ranges::find_if(mis_errors, [ggx_error](auto const& entry) { return entry.second <= ggx_error; })
+  };
+
+  if (match != mis_errors.end()) {
+    std::cout << std::format("MIS reaches the error of GGX with {} samples at {} samples\n", *max_sample_count,
+                             match->first);
+  } else {
+    std::cout << std::format("MIS does not reach the error of GGX with {} samples\n", *max_sample_count);
+  }
+
+  return matches_distribution;
+}
+
+
+// Largest difference between the coefficients of two projections, relative to the band 0 coefficient of the channel
+auto ComputeShDifference(IrradianceSh const& expected, IrradianceSh const& actual) -> double {
+  auto max_error{0.0};
+
+  for (std::size_t i{0}; i < expected.coeffs.size(); i++) {
+    for (std::size_t c{0}; c < 3; c++) {
+      auto const scale{std::max<double>(std::abs(expected.coeffs[0][c]), std::numeric_limits<float>::min())};
+      max_error = std::max(max_error,
+                           std::abs(static_cast<double>(actual.coeffs[i][c]) - expected.coeffs[i][c]) / scale);
+    }
+  }
+
+  return max_error;
+}
+
+
+// Times the SH projection of the environment over the thread counts, from memory, streamed from the file and from
+// a cube, checks it against the double precision projection, and checks the irradiance it gives at random normals
+// against brute force convolution of every texel
+auto BenchmarkShIrradiance(std::span<wchar_t* const> const args) -> bool {
+  auto const face_size{ParseCount(args[1], "Face size")};
+
+  if (!face_size) {
+    return false;
+  }
+
+  auto const equirect{LoadEquirectMap(args[0])};
+
+  if (!equirect) {
+    std::cerr << "Failed to load environment map image.\n";
+    return false;
+  }
+
+  auto const texel_count{static_cast<double>(equirect->texels.size())};
+  std::cout << std::format("{}x{} equirect map\n", equirect->width, equirect->height);
+  std::cout << std::format("{:>8} {:>10} {:>12} {:>8} {:>10}\n", "threads", "time (ms)", "Mtexels/s", "speedup",
+                           "identical");
+
+  std::optional<IrradianceSh> sh;
+  auto all_identical{true};
+  double single_thread_ms{0};
+
+  for (auto const thread_count : GetThreadCountSweep()) {
+    auto const begin{std::chrono::steady_clock::now()};
+    auto const thread_sh{ProjectIrradianceSh(*equirect, thread_count)};
+    auto const end{std::chrono::steady_clock::now()};
+
+    auto const ms{Milliseconds{end - begin}.count()};
+    auto const identical{!sh || std::memcmp(&thread_sh, &*sh, sizeof(IrradianceSh)) == 0};
+
+    if (thread_count == 1) {
+      single_thread_ms = ms;
+      sh = thread_sh;
+    }
+
+    all_identical = all_identical && identical;
+    std::cout << std::format("{:>8} {:>10.2f} {:>12.1f} {:>7.2f}x {:>10}\n", thread_count, ms,
+                             texel_count / 1e3 / ms, single_thread_ms / ms, identical ? "yes" : "NO");
+  }
+
+  if (auto const decoder{HdrDecoder::New(args[0])}) {
+    auto const begin{std::chrono::steady_clock::now()};
+    auto const streamed{ProjectIrradianceSh(*decoder, GetDefaultThreadCount())};
+    auto const end{std::chrono::steady_clock::now()};
+    auto const identical{streamed && std::memcmp(&*streamed, &*sh, sizeof(IrradianceSh)) == 0};
+    all_identical = all_identical && identical;
+    std::cout << std::format("Decoding and projecting streamed bands took {:.2f} ms, identical: {}\n",
+                             Milliseconds{end - begin}.count(), identical ? "yes" : "NO");
+  }
+
+  auto const reference_begin{std::chrono::steady_clock::now()};
+  auto const reference{ProjectIrradianceShReference(*equirect)};
+  auto const reference_end{std::chrono::steady_clock::now()};
+  auto const projection_error{ComputeShDifference(reference, *sh)};
+  auto const matches_reference{projection_error <= kShMaxProjectionError};
+
+  std::cout << std::format("Scalar double precision projection took {:.2f} ms\n",
+                           Milliseconds{reference_end - reference_begin}.count());
+  std::cout << std::format("Matches it within {:.0e}: {} ({:.3e})\n", kShMaxProjectionError,
+                           matches_reference ? "yes" : "NO", projection_error);
+
+  auto const cube{ConvertEquirectToCube(*equirect, *face_size, GetDefaultThreadCount())};
+  auto const cube_begin{std::chrono::steady_clock::now()};
+  auto const cube_sh{ProjectIrradianceSh(cube, GetDefaultThreadCount())};
+  auto const cube_end{std::chrono::steady_clock::now()};
+
+  std::cout << std::format("Projecting the {}x{} cube took {:.2f} ms, differs from the equirect projection by "
+                           "{:.3e}\n", *face_size, *face_size, Milliseconds{cube_end - cube_begin}.count(),
+                           ComputeShDifference(*sh, cube_sh));
+
+  // Uniformly distributed unit normals
+  std::mt19937 rng{42};
+  std::normal_distribution<float> normal_dist;
+  std::vector<Vector4> band_limited;
+  std::vector<Vector4> clamped;
+  std::vector<Vector4> actual;
+
+  auto const integrate_begin{std::chrono::steady_clock::now()};
+
+  for (std::uint32_t i{0}; i < kShTestNormalCount; i++) {
+    DirectX::XMFLOAT3 n{normal_dist(rng), normal_dist(rng), normal_dist(rng)};
+    DirectX::XMStoreFloat3(&n, DirectX::XMVector3Normalize(DirectX::XMLoadFloat3(&n)));
+    band_limited.push_back(IntegrateIrradiance(*equirect, n, IrradianceKernel::kBandLimited));
+    clamped.push_back(IntegrateIrradiance(*equirect, n, IrradianceKernel::kClampedCosine));
+    actual.push_back(EvaluateIrradianceSh(*sh, n));
+  }
+
+  auto const integrate_end{std::chrono::steady_clock::now()};
+
+  // Max and RMS of the per-channel differences, relative to the mean of the expected irradiance
+  auto const compute_error{
+    [&actual](std::vector<Vector4> const& expected) {
+      std::array<double, 3> mean{};
+
+      for (auto const& irradiance : expected) {
+        for (std::size_t c{0}; c < 3; c++) {
+          mean[c] += irradiance[c] / kShTestNormalCount;
+        }
+      }
+
+      auto max_error{0.0};
+      auto squared_error_sum{0.0};
+
+      for (std::size_t i{0}; i < expected.size(); i++) {
+        for (std::size_t c{0}; c < 3; c++) {
+          auto const error{
+            std::abs(static_cast<double>(actual[i][c]) - expected[i][c]) /
+            std::max(mean[c], static_cast<double>(std::numeric_limits<float>::min()))
+          };
+          max_error = std::max(max_error, error);
+          squared_error_sum += error * error;
+        }
+      }
+
+      return std::pair{max_error, std::sqrt(squared_error_sum / (3.0 * kShTestNormalCount))};
+    }
+  };
+
+  auto const [band_limited_max, band_limited_rms]{compute_error(band_limited)};
+  auto const [clamped_max, clamped_rms]{compute_error(clamped)};
+  auto const matches_convolution{band_limited_max <= kShMaxIrradianceError};
+  std::cout << std::format("Brute force convolution at {} normals took {:.2f} ms\n", kShTestNormalCount,
+                           Milliseconds{integrate_end - integrate_begin}.count());
+  std::cout << std::format("Error relative to the mean with the band-limited cosine: {:.3e} max, {:.3e} RMS\n",
+                           band_limited_max, band_limited_rms);
+  std::cout << std::format("Matches it within {:.0e}: {}\n", kShMaxIrradianceError,
+                           matches_convolution ? "yes" : "NO");
+  std::cout << std::format("Error relative to the mean with the clamped cosine: {:.3e} max, {:.3e} RMS\n",
+                           clamped_max, clamped_rms);
+  return all_identical && matches_reference && matches_convolution;
+}
+
+
+
+// Min and max of mip 0 over the pixels a cell of every mip covers, computed directly rather than mip by mip
+auto HiZPyramidMatchesDepth(HiZPyramid const& hiz) -> bool {
+  auto const& base{hiz.mips.front()};
+
+  for (std::size_t level{0}; level < hiz.mips.size(); level++) {
+    auto const& mip{hiz.mips[level]};
+
+    for (std::uint32_t cell_y{0}; cell_y < mip.height; cell_y++) {
+      for (std::uint32_t cell_x{0}; cell_x < mip.width; cell_x++) {
+        auto const x1{cell_x == mip.width - 1 ? base.width : (cell_x + 1) << level};
+        auto const y1{cell_y == mip.height - 1 ? base.height : (cell_y + 1) << level};
+        Vector2 expected{std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity()};
+
+        for (auto y{cell_y << level}; y < y1; y++) {
+          for (auto x{cell_x << level}; x < x1; x++) {
+            auto const& texel{base.texels[static_cast<std::size_t>(y) * base.width + x]};
+            expected = {std::min(expected[0], texel[0]), std::max(expected[1], texel[1])};
+          }
+        }
+
+        if (mip.texels[static_cast<std::size_t>(cell_y) * mip.width + cell_x] != expected) {
+          return false;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+
+// Step count at or below which the given fraction of the pixels that march stay
+auto SsrStepCountPercentile(std::vector<std::uint32_t> const& step_counts, double const fraction) -> std::uint32_t {
+  std::vector<std::uint32_t> marching;
+  std::ranges::copy_if(step_counts, std::back_inserter(marching), [](std::uint32_t const n) { return n > 0; });
+
+  if (marching.empty()) {
+    return 0;
+  }
+
+  auto const rank{
+    std::min(static_cast<std::size_t>(std::ceil(fraction * static_cast<double>(marching.size()))), marching.size())
+  };
+  auto const nth{marching.begin() + static_cast<std::ptrdiff_t>(std::max(rank, std::size_t{1}) - 1)};
+  std::ranges::nth_element(marching, nth);
+  return *nth;
+}
+
+
+// Prints how many steps the pixels that march take, in power of two buckets
+auto PrintSsrStepCounts(std::vector<std::uint32_t> const& step_counts) -> void {
+  std::vector<std::size_t> histogram;
+  std::uint64_t total_step_count{0};
+  std::uint32_t max_step_count{0};
+  std::size_t ray_count{0};
+
+  for (auto const step_count : step_counts) {
+    if (step_count == 0) {
+      continue;
+    }
+
+    auto const bucket{static_cast<std::size_t>(std::bit_width(step_count) - 1)};
+    histogram.resize(std::max(histogram.size(), bucket + 1));
+    histogram[bucket] += 1;
+    total_step_count += step_count;
+    max_step_count = std::max(max_step_count, step_count);
+    ray_count += 1;
+  }
+
+  auto const mean_step_count{
+    ray_count == 0 ? 0.0 : static_cast<double>(total_step_count) / static_cast<double>(ray_count)
+  };
+  std::cout << std::format("{} of {} pixels march, {:.1f} steps on average, {} at the 99th percentile, {} at most\n",
+                           ray_count, step_counts.size(), mean_step_count, SsrStepCountPercentile(step_counts, 0.99),
+                           max_step_count);
+  std::cout << std::format("{:>13} {:>10} {:>8}\n", "steps", "pixels", "share");
+
+  for (std::size_t bucket{0}; bucket < histogram.size(); bucket++) {
+    std::cout << std::format("{:>6}-{:<6} {:>10} {:>7.2f}%\n", std::size_t{1} << bucket,
+                             (std::size_t{2} << bucket) - 1, histogram[bucket],
+                             100.0 * static_cast<double>(histogram[bucket]) / static_cast<double>(ray_count));
+  }
+}
+
+
+// Largest difference of a channel of the CPU SSR output from the expected one, see kSsrMaxError
+auto SsrPixelError(Vector4 const& actual, Vector4 const& expected) -> double {
+  auto error{0.0};
+
+  for (std::size_t c{0}; c < 4; c++) {
+    auto const e{static_cast<double>(expected[c])};
+    error = std::max(error, std::abs(static_cast<double>(actual[c]) - e) / std::max(std::abs(e), kSsrErrorFloor));
+  }
+
+  return error;
+}
+
+
+// Pixels next to a neighbor whose view depth differs by more than kSsrEdgeDepthRatio or whose normal is more than
+// about 25 degrees off, where upsampling from fewer rays can bleed across
+auto FindSsrEdges(SsrFrame const& frame) -> std::vector<bool> {
+  auto const view_depth{
+    [&frame](std::size_t const idx) {
+      auto const near_clip{frame.camera.near_clip};
+      auto const far_clip{frame.camera.far_clip};
+      return near_clip * far_clip / (far_clip - frame.depth[idx] * (far_clip - near_clip));
+    }
+  };
+
+  std::vector<bool> edges(frame.depth.size());
+
+  for (std::uint32_t y{0}; y < frame.height; y++) {
+    for (std::uint32_t x{0}; x < frame.width; x++) {
+      auto const idx{static_cast<std::size_t>(y) * frame.width + x};
+      auto const& normal{frame.gbuffer1[idx]};
+
+      auto const differs{
+        [&](std::size_t const other) {
+          auto const& other_normal{frame.gbuffer1[other]};
+          auto const n_dot_n{normal[0] * other_normal[0] + normal[1] * other_normal[1] + normal[2] * other_normal[2]};
+          return std::abs(view_depth(other) - view_depth(idx)) > kSsrEdgeDepthRatio * view_depth(idx) ||
+                 n_dot_n < 0.9f;
+        }
+      };
+
+      edges[idx] = (x > 0 && differs(idx - 1)) || (x + 1 < frame.width && differs(idx + 1)) ||
+                   (y > 0 && differs(idx - frame.width)) || (y + 1 < frame.height && differs(idx + frame.width));
+    }
+  }
+
+  return edges;
+}
+
+
+// How the pixels the rays of one march hit compare to those of another
+struct SsrHitAgreement {
+  std::size_t both_miss;
+  std::size_t same_pixel;
+  std::size_t adjacent_pixel; // Within one pixel horizontally and vertically
+  std::size_t other_pixel;
+  std::size_t only_first_hits;
+  std::size_t only_second_hits;
+};
+
+
+auto CompareSsrHits(std::vector<std::uint32_t> const& first, std::vector<std::uint32_t> const& second,
+                    std::uint32_t const width) -> SsrHitAgreement {
+  SsrHitAgreement agreement{};
+
+  for (std::size_t i{0}; i < first.size(); i++) {
+    if (first[i] == kSsrNoHit && second[i] == kSsrNoHit) {
+      agreement.both_miss += 1;
+    } else if (second[i] == kSsrNoHit) {
+      agreement.only_first_hits += 1;
+    } else if (first[i] == kSsrNoHit) {
+      agreement.only_second_hits += 1;
+    } else if (first[i] == second[i]) {
+      agreement.same_pixel += 1;
+    } else {
+      auto const dist_x{std::abs(static_cast<std::int64_t>(first[i] % width) - second[i] % width)};
+      auto const dist_y{std::abs(static_cast<std::int64_t>(first[i] / width) - second[i] / width)};
+      (std::max(dist_x, dist_y) <= 1 ? agreement.adjacent_pixel : agreement.other_pixel) += 1;
+    }
+  }
+
+  return agreement;
+}
+
+
+// Runs the CPU port of the SSR pass on a frame the renderer dumped with every march mode and a few DDA settings over
+// the thread counts and reports how many steps the rays take and how their hits compare to those of the linear march,
+// and how far tracing a ray per block of pixels and upsampling lands from a ray per pixel. Checks the depth pyramid,
+// that the Hi-Z march hits where the linear one does, and compares the settings the frame was dumped with against the
+// shader output in the dump.
+auto BenchmarkSsrReference(std::span<wchar_t* const> const args) -> bool {
+  auto const frame{ReadSsrFrame(args[0])};
+
+  if (!frame) {
+    std::cerr << "Failed to load SSR frame dump.\n";
+    return false;
+  }
+
+  std::cout << std::format("{}x{} frame\n", frame->width, frame->height);
+
+  auto const hiz_begin{std::chrono::steady_clock::now()};
+  auto const hiz{BuildHiZPyramid(*frame, GetDefaultThreadCount())};
+  auto const hiz_end{std::chrono::steady_clock::now()};
+  auto const hiz_matches{HiZPyramidMatchesDepth(hiz)};
+
+  std::cout << std::format("Building the {} mip depth pyramid took {:.2f} ms, matches the depth buffer: {}\n",
+                           hiz.mips.size(), Milliseconds{hiz_end - hiz_begin}.count(), hiz_matches ? "yes" : "NO");
+
+  auto const make_constants{
+    [](SsrMarchMode const march_mode, float const pixel_stride, std::uint32_t const refine_steps) {
+      auto constants{kDefaultSsrConstants};
+      constants.march_mode = static_cast<std::uint32_t>(march_mode);
+      constants.dda_pixel_stride = pixel_stride;
+      // Enough strides to cross the screen at every stride
+      constants.dda_max_steps = static_cast<std::uint32_t>(
+        std::ceil(kDefaultSsrConstants.dda_pixel_stride * static_cast<float>(kDefaultSsrConstants.dda_max_steps) /
+                  pixel_stride));
+      constants.dda_refine_steps = refine_steps;
+      return constants;
+    }
+  };
+
+  // The linear march comes first, the others are compared against it
+  std::array const march_modes{
+    std::pair{"linear", make_constants(SsrMarchMode::kLinear, 1, 0)},
+    std::pair{"Hi-Z", make_constants(SsrMarchMode::kHiZ, 1, 0)},
+    std::pair{"DDA stride 1", make_constants(SsrMarchMode::kDda, 1, 0)},
+    std::pair{"DDA stride 4", make_constants(SsrMarchMode::kDda, 4, 2)},
+    std::pair{"DDA stride 8", make_constants(SsrMarchMode::kDda, 8, 3)}
+  };
+
+  std::vector<SsrResult> results;
+  std::vector<double> single_thread_mrays;
+  auto all_identical{true};
+
+  for (auto const& [mode_name, constants] : march_modes) {
+    std::cout << std::format("\n{} march\n", mode_name);
+    std::cout << std::format("{:>8} {:>10} {:>10} {:>11} {:>8} {:>10}\n", "threads", "time (ms)", "Mrays/s",
+                             "Msteps/s", "speedup", "identical");
+
+    std::optional<SsrResult> result;
+    double single_thread_ms{0};
+
+    for (auto const thread_count : GetThreadCountSweep()) {
+      auto const begin{std::chrono::steady_clock::now()};
+      auto thread_result{TraceSsr(*frame, constants, hiz, thread_count)};
+      auto const end{std::chrono::steady_clock::now()};
+
+      auto const ms{Milliseconds{end - begin}.count()};
+      auto const identical{
+        !result || (StreamsEqual(thread_result.color, result->color) &&
+                    StreamsEqual(thread_result.step_counts, result->step_counts) &&
+                    StreamsEqual(thread_result.hits, result->hits))
+      };
+      auto const ray_count{
+        std::ranges::count_if(thread_result.step_counts, [](std::uint32_t const n) { return n > 0; })
+      };
+      auto const step_count{
+        std::accumulate(thread_result.step_counts.begin(), thread_result.step_counts.end(), std::uint64_t{0})
+      };
+
+      if (thread_count == 1) {
+        single_thread_ms = ms;
+        single_thread_mrays.push_back(static_cast<double>(ray_count) / 1e3 / ms);
+        result = std::move(thread_result);
+      }
+
+      all_identical = all_identical && identical;
+      std::cout << std::format("{:>8} {:>10.2f} {:>10.2f} {:>11.1f} {:>7.2f}x {:>10}\n", thread_count, ms,
+                               static_cast<double>(ray_count) / 1e3 / ms, static_cast<double>(step_count) / 1e3 / ms,
+                               single_thread_ms / ms, identical ? "yes" : "NO");
+    }
+
+    PrintSsrStepCounts(result->step_counts);
+    results.push_back(std::move(*result));
+  }
+
+  // Where the rays of every march end up compared to the linear one, over the pixels that march
+  std::cout << std::format("\nHits compared to the linear march, single threaded\n");
+  std::cout << std::format("{:<14} {:>10} {:>8} {:>8} {:>8} {:>8} {:>8} {:>8} {:>8}\n", "march", "Mrays/s",
+                           "mean", "p99", "same", "1 px", "other", "lost", "new");
+
+  auto const ray_count{
+    std::ranges::count_if(results[0].step_counts, [](std::uint32_t const n) { return n > 0; })
+  };
+  auto const percentage{
+    [ray_count](std::size_t const count) {
+      return ray_count == 0 ? 0.0 : 100.0 * static_cast<double>(count) / static_cast<double>(ray_count);
+    }
+  };
+
+  for (std::size_t mode{0}; mode < march_modes.size(); mode++) {
+    auto const& step_counts{results[mode].step_counts};
+    auto const step_count{std::accumulate(step_counts.begin(), step_counts.end(), std::uint64_t{0})};
+    auto const agreement{CompareSsrHits(results[0].hits, results[mode].hits, frame->width)};
+    std::cout << std::format("{:<14} {:>10.2f} {:>8.1f} {:>8} {:>7.2f}% {:>7.2f}% {:>7.2f}% {:>7.2f}% {:>7.2f}%\n",
+                             march_modes[mode].first, single_thread_mrays[mode],
+                             ray_count == 0 ? 0.0 : static_cast<double>(step_count) / static_cast<double>(ray_count),
+                             SsrStepCountPercentile(step_counts, 0.99), percentage(agreement.same_pixel),
+                             percentage(agreement.adjacent_pixel), percentage(agreement.other_pixel),
+                             percentage(agreement.only_first_hits), percentage(agreement.only_second_hits));
+  }
+
+  // Fewer rays upsampled to every pixel against a ray per pixel, with the default march. The errors are RMS differences
+  // of the color channels, over all pixels and over those at edges, and relative to the RMS of the full resolution
+  // color. The pixels over kSsrMaxError are counted as for the comparison with the shader.
+  std::cout << std::format("\nRays traced per block of pixels and upsampled compared to one per pixel, "
+                           "single threaded\n");
+  std::cout << std::format("{:<7} {:>8} {:>8} {:>10} {:>8} {:>10} {:>10} {:>10} {:>9}\n", "blocks", "rays",
+                           "Msteps", "time (ms)", "speedup", "RMSE", "relative", "edge RMSE", "over");
+
+  auto const edges{FindSsrEdges(*frame)};
+  auto const edge_count{std::ranges::count(edges, true)};
+  std::optional<SsrResult> full_res;
+  double full_res_ms{0};
+  auto full_res_squared_sum{0.0};
+
+  for (std::uint32_t trace_scale_log2{0}; trace_scale_log2 <= 2; trace_scale_log2++) {
+    auto constants{kDefaultSsrConstants};
+    constants.trace_scale_log2 = trace_scale_log2;
+
+    auto const begin{std::chrono::steady_clock::now()};
+    auto result{TraceSsr(*frame, constants, hiz, 1)};
+    auto const end{std::chrono::steady_clock::now()};
+    auto const ms{Milliseconds{end - begin}.count()};
+
+    if (!full_res) {
+      full_res_ms = ms;
+      full_res = result;
+
+      for (auto const& color : full_res->color) {
+        full_res_squared_sum += color[0] * color[0] + color[1] * color[1] + color[2] * color[2];
+      }
+    }
+
+    auto const ray_count{std::ranges::count_if(result.step_counts, [](std::uint32_t const n) { return n > 0; })};
+    auto const step_count{std::accumulate(result.step_counts.begin(), result.step_counts.end(), std::uint64_t{0})};
+
+    auto squared_error_sum{0.0};
+    auto edge_squared_error_sum{0.0};
+    std::size_t over_count{0};
+
+    for (std::size_t i{0}; i < result.color.size(); i++) {
+      auto squared_error{0.0};
+
+      for (std::size_t c{0}; c < 3; c++) {
+        auto const diff{static_cast<double>(result.color[i][c]) - static_cast<double>(full_res->color[i][c])};
+        squared_error += diff * diff;
+      }
+
+      squared_error_sum += squared_error;
+      edge_squared_error_sum += edges[i] ? squared_error : 0;
+      over_count += SsrPixelError(result.color[i], full_res->color[i]) > kSsrMaxError ? 1 : 0;
+    }
+
+    auto const value_count{3 * static_cast<double>(result.color.size())};
+    auto const edge_value_count{std::max(3 * static_cast<double>(edge_count), 1.0)};
+    std::cout << std::format("{:<7} {:>8} {:>8.2f} {:>10.2f} {:>7.2f}x {:>10.2e} {:>9.2f}% {:>10.2e} {:>8.2f}%\n",
+                             std::format("{}x{}", 1u << trace_scale_log2, 1u << trace_scale_log2), ray_count,
+                             static_cast<double>(step_count) / 1e6, ms, full_res_ms / ms,
+                             std::sqrt(squared_error_sum / value_count),
+                             100.0 * std::sqrt(squared_error_sum / std::max(full_res_squared_sum, 1e-30)),
+                             std::sqrt(edge_squared_error_sum / edge_value_count),
+                             100.0 * static_cast<double>(over_count) / static_cast<double>(result.color.size()));
+  }
+
+  std::cout << std::format("{} of {} pixels are at depth or normal edges\n", edge_count, edges.size());
+
+  // The Hi-Z march takes the same steps as the linear one where it does not skip them
+  auto const hiz_mismatch_count{
+    std::ranges::count_if(std::views::iota(std::size_t{0}, results[0].color.size()), [&results](std::size_t const i) {
+      return results[0].color[i] != results[1].color[i];
+    })
+  };
+  auto const hiz_mismatch_fraction{
+    static_cast<double>(hiz_mismatch_count) / static_cast<double>(results[0].color.size())
+  };
+  auto const hiz_matches_linear{hiz_mismatch_fraction <= kSsrMaxHiZMismatchFraction};
+
+  std::cout << std::format("\nThe Hi-Z march differs from the linear one at {} pixels ({:.4f}%)\n", hiz_mismatch_count,
+                           100.0 * hiz_mismatch_fraction);
+  std::cout << std::format("Matches it on all but {:.1e} of the pixels: {}\n", kSsrMaxHiZMismatchFraction,
+                           hiz_matches_linear ? "yes" : "NO");
+
+  // Compare with the shader
+  auto const dumped_result{TraceSsr(*frame, frame->constants, hiz, GetDefaultThreadCount())};
+  std::size_t mismatch_count{0};
+  auto max_error{0.0};
+
+  for (std::size_t i{0}; i < frame->ssr.size(); i++) {
+    auto const pixel_error{SsrPixelError(dumped_result.color[i], frame->ssr[i])};
+    max_error = std::max(max_error, pixel_error);
+
+    if (!(pixel_error <= kSsrMaxError)) {
+      mismatch_count += 1;
+    }
+  }
+
+  std::array constexpr mode_names{"linear", "Hi-Z", "DDA"};
+  auto const mismatch_fraction{static_cast<double>(mismatch_count) / static_cast<double>(frame->ssr.size())};
+  auto const matches_shader{mismatch_fraction <= kSsrMaxMismatchFraction};
+  std::cout << std::format("{} pixels ({:.4f}%) differ from the output of the {} march of the shader by more than "
+                           "{:.0e}, the largest difference is {:.3e}\n", mismatch_count, 100.0 * mismatch_fraction,
+                           frame->constants.march_mode < mode_names.size()
+                             ? mode_names[frame->constants.march_mode]
+                             : "unknown",
+                           kSsrMaxError, max_error);
+  std::cout << std::format("Matches it on all but {:.1e} of the pixels: {}\n", kSsrMaxMismatchFraction,
+                           matches_shader ? "yes" : "NO");
+  return hiz_matches && all_identical && hiz_matches_linear && matches_shader;
+}
+
+
+// Position of the center of a pixel in world space, as ssr_temporal.hlsli reconstructs it
+auto SsrPixelCenterWs(SsrFrame const& frame, std::uint32_t const x, std::uint32_t const y) -> DirectX::XMFLOAT3 {
+  auto const u{(static_cast<float>(x) + 0.5f) / static_cast<float>(frame.width)};
+  auto const v{(static_cast<float>(y) + 0.5f) / static_cast<float>(frame.height)};
+  auto const depth{frame.depth[static_cast<std::size_t>(y) * frame.width + x]};
+  auto const pos4_ws{
+    DirectX::XMVector4Transform(DirectX::XMVectorSet(u * 2 - 1, v * -2 + 1, depth, 1),
+                                DirectX::XMLoadFloat4x4(&frame.camera.view_proj_inv_mtx))
+  };
+
+  DirectX::XMFLOAT3 pos_ws;
+  DirectX::XMStoreFloat3(&pos_ws, DirectX::XMVectorDivide(pos4_ws, DirectX::XMVectorSplatW(pos4_ws)));
+  return pos_ws;
+}
+
+
+// RMS difference of the color channels
+auto SsrRmsError(std::vector<Vector4> const& actual, std::vector<Vector4> const& expected) -> double {
+  auto squared_error_sum{0.0};
+
+  for (std::size_t i{0}; i < actual.size(); i++) {
+    for (std::size_t c{0}; c < 3; c++) {
+      auto const diff{static_cast<double>(actual[i][c]) - static_cast<double>(expected[i][c])};
+      squared_error_sum += diff * diff;
+    }
+  }
+
+  return std::sqrt(squared_error_sum / std::max(3 * static_cast<double>(actual.size()), 1.0));
+}
+
+
+// Checks the steps of the SSR temporal pass one by one on the camera and the surfaces of a frame the renderer dumped:
+// a still camera reprojects every pixel onto itself, the point a reflection moves with is the mirror image of the hit
+// point, points behind the previous camera or off its screen have no history, and the depth test rejects the history
+// of surfaces that were hidden. Then resolves the frame against histories that a still camera has to keep, that are
+// out of the range of the neighborhood of every pixel, and that are all disoccluded, and reports how close
+// accumulating a ray per 2x2 block with rotating sources over frames gets to tracing a ray per pixel.
+auto BenchmarkSsrTemporal(std::span<wchar_t* const> const args) -> bool {
+  auto const frame{ReadSsrFrame(args[0])};
+
+  if (!frame) {
+    std::cerr << "Failed to load SSR frame dump.\n";
+    return false;
+  }
+
+  std::cout << std::format("{}x{} frame\n", frame->width, frame->height);
+
+  auto const& camera{frame->camera};
+  auto const cam_pos{DirectX::XMLoadFloat3(&camera.pos_ws)};
+
+  // Reprojection with the matrix of the frame itself, and mirror images of hits at distances around the scale of the
+  // frame
+
+  auto max_still_error{0.0};
+  std::size_t still_lost_count{0};
+  auto max_mirror_error{0.0};
+  std::size_t surface_count{0};
+
+  for (std::uint32_t y{0}; y < frame->height; y++) {
+    for (std::uint32_t x{0}; x < frame->width; x++) {
+      auto const idx{static_cast<std::size_t>(y) * frame->width + x};
+
+      if (frame->depth[idx] >= 1) {
+        continue;
+      }
+
+      surface_count += 1;
+      auto const pos_ws{SsrPixelCenterWs(*frame, x, y)};
+
+      if (auto const reprojection{ReprojectSsr(pos_ws, camera.view_proj_mtx)}) {
+        auto const error_x{std::abs(reprojection->uv[0] * frame->width - (static_cast<double>(x) + 0.5))};
+        auto const error_y{std::abs(reprojection->uv[1] * frame->height - (static_cast<double>(y) + 0.5))};
+        max_still_error = std::max({max_still_error, error_x, error_y});
+      } else {
+        still_lost_count += 1;
+      }
+
+      auto const pos{DirectX::XMLoadFloat3(&pos_ws)};
+      auto const& normal_ws{frame->gbuffer1[idx]};
+      auto const normal{DirectX::XMVector3Normalize(DirectX::XMVectorSet(normal_ws[0], normal_ws[1], normal_ws[2], 0))};
+      auto const view_dir{DirectX::XMVector3Normalize(DirectX::XMVectorSubtract(cam_pos, pos))};
+
+      if (!(DirectX::XMVectorGetX(DirectX::XMVector3Dot(normal, view_dir)) > 0)) {
+        continue;
+      }
+
+      auto const reflected{DirectX::XMVector3Reflect(DirectX::XMVectorNegate(view_dir), normal)};
+      auto const cam_dist{DirectX::XMVectorGetX(DirectX::XMVector3Length(DirectX::XMVectorSubtract(cam_pos, pos)))};
+
+      for (auto const hit_distance : {0.1f * cam_dist, cam_dist, 10 * cam_dist}) {
+        // The hit point reflected across the plane of the surface
+        auto const hit{DirectX::XMVectorAdd(pos, DirectX::XMVectorScale(reflected, hit_distance))};
+        auto const hit_height{
+          DirectX::XMVectorGetX(DirectX::XMVector3Dot(DirectX::XMVectorSubtract(hit, pos), normal))
+        };
+        auto const expected{DirectX::XMVectorSubtract(hit, DirectX::XMVectorScale(normal, 2 * hit_height))};
+
+        auto const mirror_ws{SsrReflectionPosition(pos_ws, camera.pos_ws, hit_distance)};
+        auto const error{
+          DirectX::XMVectorGetX(DirectX::XMVector3Length(
+            DirectX::XMVectorSubtract(DirectX::XMLoadFloat3(&mirror_ws), expected)))
+        };
+        max_mirror_error = std::max(max_mirror_error, static_cast<double>(error / (cam_dist + hit_distance)));
+      }
+    }
+  }
+
+  auto const still_ok{still_lost_count == 0 && max_still_error <= kSsrMaxReprojectionError};
+  auto const mirror_ok{max_mirror_error <= kSsrMaxMirrorError};
+
+  std::cout << std::format("\nA still camera reprojects the {} surface pixels by {:.2e} pixels at most, {} are lost: "
+                           "{}\n", surface_count, max_still_error, still_lost_count, still_ok ? "yes" : "NO");
+  std::cout << std::format("The mirror images of hits are off by {:.2e} of the ray length at most: {}\n",
+                           max_mirror_error, mirror_ok ? "yes" : "NO");
+
+  // Points in front of, behind, and beside the camera, whose axes are the rows of the inverse view matrix
+  auto const right{DirectX::XMVectorSet(camera.view_inv_mtx._11, camera.view_inv_mtx._12, camera.view_inv_mtx._13, 0)};
+  auto const forward{
+    DirectX::XMVectorSet(camera.view_inv_mtx._31, camera.view_inv_mtx._32, camera.view_inv_mtx._33, 0)
+  };
+  auto const center_dist{(camera.near_clip + camera.far_clip) / 2};
+
+  auto const reproject_point{
+    [&camera, cam_pos](DirectX::XMVECTOR const offset) {
+      DirectX::XMFLOAT3 pos_ws;
+      DirectX::XMStoreFloat3(&pos_ws, DirectX::XMVectorAdd(cam_pos, offset));
+      return ReprojectSsr(pos_ws, camera.view_proj_mtx);
+    }
+  };
+
+  auto const center{reproject_point(DirectX::XMVectorScale(forward, center_dist))};
+  auto const center_ok{
+    center && std::abs(center->uv[0] - 0.5f) < 1e-4f && std::abs(center->uv[1] - 0.5f) < 1e-4f &&
+    std::abs(center->depth_vs - center_dist) < 1e-4f * center_dist
+  };
+  auto const behind_ok{!reproject_point(DirectX::XMVectorScale(forward, -center_dist))};
+  auto const beside_ok{
+    !reproject_point(DirectX::XMVectorAdd(DirectX::XMVectorScale(forward, center_dist),
+                                          DirectX::XMVectorScale(right, 100 * center_dist)))
+  };
+
+  std::cout << std::format("A point ahead of the camera lands in the center at its distance: {}\n",
+                           center_ok ? "yes" : "NO");
+  std::cout << std::format("Points behind the camera and off screen have no history: {}\n",
+                           behind_ok && beside_ok ? "yes" : "NO");
+
+  // Depth test, the history holds within a few percent of the depth and is rejected well beyond it
+  std::array constexpr disocclusion_cases{
+    std::tuple{10.0f, 10.0f, false}, std::tuple{10.0f, 10.2f, false}, std::tuple{10.0f, 9.8f, false},
+    std::tuple{10.0f, 12.0f, true}, std::tuple{10.0f, 8.0f, true}, std::tuple{10.0f, 0.1f, true}
+  };
+  auto const disocclusion_ok{
+    std::ranges::all_of(disocclusion_cases, [](auto const& c) {
+      auto const [expected_depth_vs, prev_depth_vs, disoccluded]{c};
+      return IsSsrHistoryDisoccluded(expected_depth_vs, prev_depth_vs) == disoccluded;
+    })
+  };
+
+  std::cout << std::format("The depth test rejects only the history of surfaces that moved by far: {}\n",
+                           disocclusion_ok ? "yes" : "NO");
+
+  // Resolves of a frame traced at half resolution against made up histories with a still camera
+  auto const hiz{BuildHiZPyramid(*frame, GetDefaultThreadCount())};
+
+  auto constants{kDefaultSsrConstants};
+  constants.trace_scale_log2 = 1;
+  constants.rotate_sources = true;
+
+  auto const current{TraceSsr(*frame, constants, hiz, GetDefaultThreadCount())};
+
+  SsrHistory history{
+    .constants = {
+      .prev_view_proj_mtx = camera.view_proj_mtx, .current_weight = kDefaultSsrTemporalWeight, .history_valid = false,
+      .pad = {}
+    },
+    .reflection = current.reflection,
+    .depth = frame->depth
+  };
+
+  auto const invalid_output{ResolveSsrTemporal(*frame, current, history, GetDefaultThreadCount())};
+  auto const invalid_ok{
+    StreamsEqual(invalid_output.color, current.color) && StreamsEqual(invalid_output.reflection, current.reflection)
+  };
+
+  history.constants.history_valid = true;
+  auto const kept_output{ResolveSsrTemporal(*frame, current, history, GetDefaultThreadCount())};
+  auto const kept_ok{
+    std::ranges::all_of(std::views::iota(std::size_t{0}, kept_output.color.size()), [&](std::size_t const i) {
+      return SsrPixelError(kept_output.color[i], current.color[i]) <= kSsrMaxError;
+    })
+  };
+
+  std::ranges::fill(history.reflection, Vector4{1e3f, -1e3f, 1e3f, 1e3f});
+  auto const clamped_output{ResolveSsrTemporal(*frame, current, history, GetDefaultThreadCount())};
+  auto clamped_ok{true};
+
+  for (std::uint32_t y{0}; y < frame->height; y++) {
+    for (std::uint32_t x{0}; x < frame->width; x++) {
+      auto const& reflection{clamped_output.reflection[static_cast<std::size_t>(y) * frame->width + x]};
+
+      for (std::size_t c{0}; c < 4; c++) {
+        auto min{std::numeric_limits<float>::infinity()};
+        auto max{-std::numeric_limits<float>::infinity()};
+
+        for (auto ny{y > 0 ? y - 1 : 0}; ny <= std::min(y + 1, frame->height - 1); ny++) {
+          for (auto nx{x > 0 ? x - 1 : 0}; nx <= std::min(x + 1, frame->width - 1); nx++) {
+            auto const value{current.reflection[static_cast<std::size_t>(ny) * frame->width + nx][c]};
+            min = std::min(min, value);
+            max = std::max(max, value);
+          }
+        }
+
+        clamped_ok = clamped_ok && reflection[c] >= min && reflection[c] <= max;
+      }
+    }
+  }
+
+  // Every surface was behind the near plane
+  std::ranges::fill(history.depth, 0.0f);
+  auto const disoccluded_output{ResolveSsrTemporal(*frame, current, history, GetDefaultThreadCount())};
+  auto const disoccluded_ok{
+    std::ranges::all_of(std::views::iota(std::size_t{0}, disoccluded_output.color.size()), [&](std::size_t const i) {
+      auto const depth_vs{
+        camera.near_clip * camera.far_clip / (camera.far_clip - frame->depth[i] * (camera.far_clip - camera.near_clip))
+      };
+      return depth_vs < 2 * camera.near_clip || (disoccluded_output.color[i] == current.color[i] &&
+                                                 disoccluded_output.reflection[i] == current.reflection[i]);
+    })
+  };
+
+  std::cout << std::format("\nWithout a history the output is the current frame: {}\n", invalid_ok ? "yes" : "NO");
+  std::cout << std::format("A still camera keeps a history equal to the current frame: {}\n", kept_ok ? "yes" : "NO");
+  std::cout << std::format("A history out of range is clamped to the reflections around every pixel: {}\n",
+                           clamped_ok ? "yes" : "NO");
+  std::cout << std::format("The history of surfaces hidden last frame is rejected: {}\n",
+                           disoccluded_ok ? "yes" : "NO");
+
+  // Accumulation of a ray per 2x2 block with rotating sources, against a ray per pixel and a ray per block from the
+  // closest pixel without accumulation
+  auto const full_res{TraceSsr(*frame, kDefaultSsrConstants, hiz, GetDefaultThreadCount())};
+  auto static_constants{constants};
+  static_constants.rotate_sources = false;
+  auto const static_rms_error{SsrRmsError(TraceSsr(*frame, static_constants, hiz, 1).color, full_res.color)};
+
+  std::cout << std::format("\nA ray per 2x2 block accumulated over frames compared to a ray per pixel, single "
+                           "threaded\n");
+  std::cout << std::format("{:>7} {:>12} {:>12} {:>12}\n", "frames", "trace (ms)", "resolve (ms)", "RMSE");
+  std::cout << std::format("{:>7} {:>12} {:>12} {:>12.2e}\n", "static", "", "", static_rms_error);
+
+  history.constants.history_valid = false;
+  history.depth = frame->depth;
+  auto identical{true};
+  auto rms_error{0.0};
+
+  for (std::uint32_t frame_index{0}; frame_index < kSsrTemporalFrameCount; frame_index++) {
+    constants.frame_index = frame_index;
+
+    auto const trace_begin{std::chrono::steady_clock::now()};
+    auto const frame_result{TraceSsr(*frame, constants, hiz, 1)};
+    auto const trace_end{std::chrono::steady_clock::now()};
+    auto output{ResolveSsrTemporal(*frame, frame_result, history, 1)};
+    auto const resolve_end{std::chrono::steady_clock::now()};
+
+    auto const threaded_output{ResolveSsrTemporal(*frame, frame_result, history, GetDefaultThreadCount())};
+    identical = identical && StreamsEqual(output.color, threaded_output.color) &&
+                StreamsEqual(output.reflection, threaded_output.reflection);
+    rms_error = SsrRmsError(output.color, full_res.color);
+    history.reflection = std::move(output.reflection);
+    history.constants.history_valid = true;
+
+    if (std::has_single_bit(frame_index + 1)) {
+      std::cout << std::format("{:>7} {:>12.2f} {:>12.2f} {:>12.2e}\n", frame_index + 1,
+                               Milliseconds{trace_end - trace_begin}.count(),
+                               Milliseconds{resolve_end - trace_end}.count(), rms_error);
+    }
+  }
+
+  std::cout << std::format("The resolve does not depend on the thread count: {}\n", identical ? "yes" : "NO");
+  return still_ok && mirror_ok && center_ok && behind_ok && beside_ok && disocclusion_ok && invalid_ok && kept_ok &&
+         clamped_ok && disoccluded_ok && identical;
+}
+
+
+// Camera constants of a camera at pos looking at target with the conventions of OrbitingCamera
+auto MakeSsrSyntheticCamera(DirectX::XMFLOAT3 const& pos, DirectX::XMFLOAT3 const& target) -> CameraConstants {
+  auto const view{
+    DirectX::XMMatrixLookAtLH(DirectX::XMLoadFloat3(&pos), DirectX::XMLoadFloat3(&target),
+                              DirectX::XMVectorSet(0, 1, 0, 0))
+  };
+  auto const proj{
+    DirectX::XMMatrixPerspectiveFovLH(DirectX::XMConvertToRadians(kSsrSyntheticFov),
+                                      static_cast<float>(kSsrSyntheticWidth) / kSsrSyntheticHeight,
+                                      kSsrSyntheticNear, kSsrSyntheticFar)
+  };
+  auto const view_proj{DirectX::XMMatrixMultiply(view, proj)};
+
+  CameraConstants camera{};
+  DirectX::XMStoreFloat4x4(&camera.view_mtx, view);
+  DirectX::XMStoreFloat4x4(&camera.view_inv_mtx, DirectX::XMMatrixInverse(nullptr, view));
+  DirectX::XMStoreFloat4x4(&camera.proj_mtx, proj);
+  DirectX::XMStoreFloat4x4(&camera.proj_inv_mtx, DirectX::XMMatrixInverse(nullptr, proj));
+  DirectX::XMStoreFloat4x4(&camera.view_proj_mtx, view_proj);
+  DirectX::XMStoreFloat4x4(&camera.view_proj_inv_mtx, DirectX::XMMatrixInverse(nullptr, view_proj));
+  camera.pos_ws = pos;
+  camera.near_clip = kSsrSyntheticNear;
+  camera.far_clip = kSsrSyntheticFar;
+  return camera;
+}
+
+
+// A mirror floor in the plane y = 0 under uniform lighting, which has to fill the view of the camera
+auto MakeSsrSyntheticFrame(CameraConstants const& camera, Vector4 const& lighting) -> SsrFrame {
+  auto const pixel_count{static_cast<std::size_t>(kSsrSyntheticWidth) * kSsrSyntheticHeight};
+
+  SsrFrame frame{
+    .camera = camera,
+    .constants = kDefaultSsrConstants,
+    .width = kSsrSyntheticWidth,
+    .height = kSsrSyntheticHeight,
+    .depth = std::vector<float>(pixel_count),
+    .gbuffer0 = std::vector(pixel_count, Vector4{0.5f, 0.5f, 0.5f, 0}),
+    .gbuffer1 = std::vector(pixel_count, Vector4{0, 1, 0, 0}),
+    .ibl = std::vector(pixel_count, lighting),
+    .ssr = std::vector(pixel_count, lighting)
+  };
+
+  auto const view_proj{DirectX::XMLoadFloat4x4(&camera.view_proj_mtx)};
+  auto const view_proj_inv{DirectX::XMLoadFloat4x4(&camera.view_proj_inv_mtx)};
+
+  for (std::uint32_t y{0}; y < frame.height; y++) {
+    for (std::uint32_t x{0}; x < frame.width; x++) {
+      auto const ndc_x{(static_cast<float>(x) + 0.5f) / static_cast<float>(frame.width) * 2 - 1};
+      auto const ndc_y{1 - (static_cast<float>(y) + 0.5f) / static_cast<float>(frame.height) * 2};
+      auto const near{DirectX::XMVector3TransformCoord(DirectX::XMVectorSet(ndc_x, ndc_y, 0, 1), view_proj_inv)};
+      auto const far{DirectX::XMVector3TransformCoord(DirectX::XMVectorSet(ndc_x, ndc_y, 1, 1), view_proj_inv)};
+      auto const t{DirectX::XMVectorGetY(near) / (DirectX::XMVectorGetY(near) - DirectX::XMVectorGetY(far))};
+      auto const pos{DirectX::XMVectorLerp(near, far, t)};
+      frame.depth[static_cast<std::size_t>(y) * frame.width + x] = DirectX::XMVectorGetZ(
+        DirectX::XMVector3TransformCoord(pos, view_proj));
+    }
+  }
+
+  return frame;
+}
+
+
+// Where a camera at pos looking at target sees a point, in UV and view depth. Follows the pinhole model rather than
+// the camera matrices, to check the reprojection against.
+auto ProjectSsrSyntheticPoint(DirectX::XMFLOAT3 const& pos, DirectX::XMFLOAT3 const& target,
+                              std::array<double, 3> const& point) -> std::array<double, 3> {
+  auto const sub{[](auto const& a, auto const& b) { return std::array{a[0] - b[0], a[1] - b[1], a[2] - b[2]}; }};
+  auto const dot{[](auto const& a, auto const& b) { return a[0] * b[0] + a[1] * b[1] + a[2] * b[2]; }};
+  auto const cross{
+    [](auto const& a, auto const& b) {
+      return std::array{a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0]};
+    }
+  };
+  auto const normalize{
+    [&dot](std::array<double, 3> const& a) {
+      auto const len{std::sqrt(dot(a, a))};
+      return std::array{a[0] / len, a[1] / len, a[2] / len};
+    }
+  };
+
+  std::array<double, 3> const eye{pos.x, pos.y, pos.z};
+  auto const forward{normalize(sub(std::array<double, 3>{target.x, target.y, target.z}, eye))};
+  auto const right{normalize(cross(std::array<double, 3>{0, 1, 0}, forward))};
+  auto const up{cross(forward, right)};
+
+  auto const offset{sub(point, eye)};
+  auto const depth{dot(offset, forward)};
+  auto const tan_half_fov{std::tan(static_cast<double>(DirectX::XMConvertToRadians(kSsrSyntheticFov)) / 2)};
+  auto const aspect{static_cast<double>(kSsrSyntheticWidth) / kSsrSyntheticHeight};
+  auto const ndc_x{dot(offset, right) / (depth * tan_half_fov * aspect)};
+  auto const ndc_y{dot(offset, up) / (depth * tan_half_fov)};
+  return {ndc_x * 0.5 + 0.5, 0.5 - ndc_y * 0.5, depth};
+}
+
+
+// Checks the SSR temporal pass on a mirror floor rendered from two known cameras, without a frame dump. Every floor
+// pixel reflects a point a fixed distance beyond it, so the point the reflection has to be reprojected from is the
+// mirror image of that hit point across the floor, where the previous camera saw it by the pinhole model. The history
+// holds the pixel coordinates of every texel, so the blended reflection tells where the history was sampled, which
+// has to be that point for every pixel that keeps its history, while the pixels whose reflection was off screen keep
+// the current frame. Then the lighting of the floor changes between the frames, and the output has to composite the
+// accumulated reflection over the lighting of the current frame only.
+auto BenchmarkSsrTemporalSynthetic(std::span<wchar_t* const>) -> bool {
+  DirectX::XMFLOAT3 constexpr prev_pos{0, 4, -1.5f};
+  DirectX::XMFLOAT3 constexpr pos{0.2f, 4.1f, -1.4f};
+  DirectX::XMFLOAT3 constexpr target{0, 0, 0.5f};
+
+  auto const prev_frame{MakeSsrSyntheticFrame(MakeSsrSyntheticCamera(prev_pos, target), Vector4{0.2f, 0.2f, 0.2f, 1})};
+  auto const frame{MakeSsrSyntheticFrame(MakeSsrSyntheticCamera(pos, target), Vector4{0.8f, 0.6f, 0.4f, 1})};
+  auto const pixel_count{frame.depth.size()};
+  auto const width{static_cast<double>(frame.width)};
+  auto const height{static_cast<double>(frame.height)};
+
+  SsrResult current{
+    .color = frame.ssr,
+    .step_counts = std::vector<std::uint32_t>(pixel_count),
+    .hits = std::vector(pixel_count, kSsrNoHit),
+    .hit_distances = std::vector(pixel_count, kSsrSyntheticHitDistance),
+    .reflection = std::vector<Vector4>(pixel_count)
+  };
+
+  SsrHistory history{
+    .constants = {
+      .prev_view_proj_mtx = prev_frame.camera.view_proj_mtx, .current_weight = kDefaultSsrTemporalWeight,
+      .history_valid = true, .pad = {}
+    },
+    .reflection = std::vector<Vector4>(pixel_count),
+    .depth = prev_frame.depth
+  };
+
+  // A checkerboard of the extremes of the history, so that the neighborhood clamp keeps every history sample
+  for (std::uint32_t y{0}; y < frame.height; y++) {
+    for (std::uint32_t x{0}; x < frame.width; x++) {
+      auto const idx{static_cast<std::size_t>(y) * frame.width + x};
+      current.reflection[idx] = (x + y) % 2 == 0
+                                  ? Vector4{0, 0, 0, 1}
+                                  : Vector4{static_cast<float>(width), static_cast<float>(height), 0, 1};
+      history.reflection[idx] = {static_cast<float>(x) + 0.5f, static_cast<float>(y) + 0.5f, 0, 1};
+    }
+  }
+
+  auto const output{ResolveSsrTemporal(frame, current, history, GetDefaultThreadCount())};
+  auto const weight{static_cast<double>(kDefaultSsrTemporalWeight)};
+
+  // Pixels whose reprojections are within a pixel and a half of an edge of the screen are not checked, the history
+  // repeats the edge texels there and rounding decides whether the history is kept
+  auto const inside{
+    [width, height](std::array<double, 3> const& uv) {
+      return uv[2] > 0 && uv[0] * width >= 1.5 && uv[0] * width <= width - 1.5 && uv[1] * height >= 1.5 &&
+             uv[1] * height <= height - 1.5;
+    }
+  };
+  auto const outside{
+    [width, height](std::array<double, 3> const& uv) {
+      return uv[2] <= 0 || uv[0] * width < -0.5 || uv[0] * width > width + 0.5 || uv[1] * height < -0.5 ||
+             uv[1] * height > height + 0.5;
+    }
+  };
+
+  std::size_t kept_count{0};
+  std::size_t lost_count{0};
+  auto max_reprojection_error{0.0};
+  auto lost_ok{true};
+
+  for (std::uint32_t y{0}; y < frame.height; y++) {
+    for (std::uint32_t x{0}; x < frame.width; x++) {
+      auto const idx{static_cast<std::size_t>(y) * frame.width + x};
+      auto const pos_ws{SsrPixelCenterWs(frame, x, y)};
+      std::array<double, 3> const surface{pos_ws.x, pos_ws.y, pos_ws.z};
+
+      // The ray reflected off the floor, and the hit point reflected back across the floor
+      std::array const view_dir{surface[0] - pos.x, surface[1] - pos.y, surface[2] - pos.z};
+      auto const view_len{std::sqrt(view_dir[0] * view_dir[0] + view_dir[1] * view_dir[1] +
+                                    view_dir[2] * view_dir[2])};
+      auto const hit_distance{static_cast<double>(kSsrSyntheticHitDistance)};
+      std::array const hit{
+        surface[0] + view_dir[0] / view_len * hit_distance, surface[1] - view_dir[1] / view_len * hit_distance,
+        surface[2] + view_dir[2] / view_len * hit_distance
+      };
+      std::array const mirror{hit[0], -hit[1], hit[2]};
+
+      auto const prev_surface{ProjectSsrSyntheticPoint(prev_pos, target, surface)};
+      auto const prev_mirror{ProjectSsrSyntheticPoint(prev_pos, target, mirror)};
+
+      auto const& reflection{output.reflection[idx]};
+
+      if (inside(prev_surface) && inside(prev_mirror)) {
+        // Inverse of the blend, the history sample holds the pixel coordinates the history was sampled at
+        auto const& current_reflection{current.reflection[idx]};
+        auto const sample_x{(reflection[0] - weight * current_reflection[0]) / (1 - weight)};
+        auto const sample_y{(reflection[1] - weight * current_reflection[1]) / (1 - weight)};
+        max_reprojection_error = std::max({
+          max_reprojection_error, std::abs(sample_x - prev_mirror[0] * width),
+          std::abs(sample_y - prev_mirror[1] * height)
+        });
+        kept_count += 1;
+      } else if (outside(prev_surface) || outside(prev_mirror)) {
+        lost_ok = lost_ok && reflection == current.reflection[idx] && output.color[idx] == current.color[idx];
+        lost_count += 1;
+      }
+    }
+  }
+
+  auto const kept_ok{kept_count > 0 && max_reprojection_error <= kSsrMaxReprojectionError};
+  lost_ok = lost_ok && lost_count > 0;
+
+  std::cout << std::format("{}x{} mirror floor, the camera moves by ({:.2f}, {:.2f}, {:.2f})\n", frame.width,
+                           frame.height, pos.x - prev_pos.x, pos.y - prev_pos.y, pos.z - prev_pos.z);
+  std::cout << std::format("The {} pixels that keep their history sample it at the mirror image of the hit point the "
+                           "previous camera saw, {:.2e} pixels off at most: {}\n", kept_count,
+                           max_reprojection_error, kept_ok ? "yes" : "NO");
+  std::cout << std::format("The {} pixels whose reflection was off screen keep the current frame: {}\n", lost_count,
+                           lost_ok ? "yes" : "NO");
+
+  // Half coverage of a white reflection, over the lighting of this frame rather than the one the history saw
+  std::ranges::fill(current.reflection, Vector4{0.5f, 0.5f, 0.5f, 0.5f});
+  std::ranges::fill(history.reflection, Vector4{0.5f, 0.5f, 0.5f, 0.5f});
+
+  for (std::size_t i{0}; i < pixel_count; i++) {
+    for (std::size_t c{0}; c < 3; c++) {
+      current.color[i][c] = (frame.ibl[i][c] + 1) / 2;
+    }
+  }
+
+  auto const lit_output{ResolveSsrTemporal(frame, current, history, GetDefaultThreadCount())};
+  auto max_lighting_error{0.0};
+
+  for (std::size_t i{0}; i < pixel_count; i++) {
+    for (std::size_t c{0}; c < 3; c++) {
+      auto const expected{(static_cast<double>(frame.ibl[i][c]) + 1) / 2};
+      max_lighting_error = std::max(max_lighting_error, std::abs(lit_output.color[i][c] - expected));
+    }
+  }
+
+  auto const lighting_ok{max_lighting_error <= kSsrMaxError};
+  std::cout << std::format("The reflection is composited over the lighting of the current frame, {:.2e} off at "
+                           "most: {}\n", max_lighting_error, lighting_ok ? "yes" : "NO");
+
+  return kept_ok && lost_ok && lighting_ok;
+}
+
+
+struct Benchmark {
+  std::string_view name;
+  std::string_view usage;
+  std::size_t arg_count;
+  bool (*run)(std::span<wchar_t* const> args);
+};
+
+
+std::array constexpr kBenchmarks{
+  Benchmark{"scene-conversion", "<path-to-model-file>", 1, &BenchmarkSceneConversion},
+  Benchmark{"mesh-optimization", "<path-to-model-file>", 1, &BenchmarkMeshOptimization},
+  Benchmark{"frustum-culling", "<path-to-model-file> <instance-count>", 2, &BenchmarkFrustumCulling},
+  Benchmark{"mesh-lods", "<path-to-model-file>", 1, &BenchmarkMeshLods},
+  Benchmark{"meshlet-culling", "<path-to-model-file>", 1, &BenchmarkMeshletCulling},
+  Benchmark{"scene-pools", "<path-to-model-file>", 1, &BenchmarkScenePools},
+  Benchmark{"vertex-packing", "<path-to-model-file>", 1, &BenchmarkVertexPacking},
+  Benchmark{"vertex-packing-sweep", "<vertex-count>", 1, &BenchmarkVertexPackingSweep},
+  Benchmark{"texture-loading", "<path-to-model-file>", 1, &BenchmarkTextureLoading},
+  Benchmark{"cube-mips", "<path-to-environment-map> <face-size>", 2, &BenchmarkCubeMips},
+  Benchmark{"env-sampling", "<path-to-environment-map> <face-size> <max-sample-count>", 3,
+            &BenchmarkEnvironmentSampling},
+  Benchmark{"equirect-to-cube", "<path-to-environment-map> <max-face-size>", 2, &BenchmarkEquirectToCube},
+  Benchmark{"hdr-decoding", "<path-to-environment-map> <face-size>", 2, &BenchmarkHdrDecoding},
+  Benchmark{"sh-irradiance", "<path-to-environment-map> <face-size>", 2, &BenchmarkShIrradiance},
+  Benchmark{"ibl-baking", "<path-to-environment-map> <face-size> <sample-count>", 3, &BenchmarkIblBaking},
+  Benchmark{"bc6h-compression", "<path-to-environment-map> <face-size>", 2, &BenchmarkBc6hCompression},
+  Benchmark{"prefilter-mip-ranges", "<path-to-environment-map> <face-size> <sample-count>", 3,
+            &BenchmarkPrefilterMipRanges},
+  Benchmark{"ssr-reference", "<path-to-ssr-frame-dump>", 1, &BenchmarkSsrReference},
+  Benchmark{"ssr-temporal", "<path-to-ssr-frame-dump>", 1, &BenchmarkSsrTemporal},
+  Benchmark{"ssr-temporal-synthetic", "", 0, &BenchmarkSsrTemporalSynthetic},
+  Benchmark{"dfg-lut", "<table-size> <sample-count>", 2, &BenchmarkDfgLut},
+  Benchmark{"pixel-packing", "<value-count>", 1, &BenchmarkPixelPacking},
+};
+}
+
+
+auto RunBenchmark(std::span<wchar_t* const> const args) -> int {
+  if (!args.empty()) {
+    for (auto const& benchmark : kBenchmarks) {
+      if (std::ranges::equal(std::wstring_view{args[0]}, benchmark.name) && args.size() - 1 == benchmark.arg_count) {
+        return benchmark.run(args.subspan(1)) ? 0 : -1;
+      }
+    }
+  }
+
+  std::cerr << "Usage: metallic-reflections --benchmark <benchmark> <args...>\nAvailable benchmarks:\n";
+
+  for (auto const& benchmark : kBenchmarks) {
+    std::cerr << "  " << benchmark.name << " " << benchmark.usage << "\n";
+  }
+
+  return -1;
+}
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <span>
+
+namespace refl {
+// Headless benchmark mode: metallic-reflections --benchmark <benchmark> <args...>
+// Runs on the CPU only, so no window or D3D device is created. Returns the process exit code.
+[[nodiscard]] auto RunBenchmark(std::span<wchar_t* const> args) -> int;
+}
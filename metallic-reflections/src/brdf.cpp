@@ -0,0 +1,71 @@
+#include "brdf.hpp"
+
+import std;
+
+namespace refl {
+namespace {
+auto Normalize(DirectX::XMFLOAT3 const& v) -> DirectX::XMFLOAT3 {
+  auto const inv_length{1 / std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z)};
+  return {v.x * inv_length, v.y * inv_length, v.z * inv_length};
+}
+
+
+auto Cross(DirectX::XMFLOAT3 const& a, DirectX::XMFLOAT3 const& b) -> DirectX::XMFLOAT3 {
+  return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x};
+}
+
+
+auto GeometrySchlickGgx(float const n_dot_x, float const k) -> float {
+  return n_dot_x / (n_dot_x * (1 - k) + k);
+}
+}
+
+
+auto RadicalInverseVdC(std::uint32_t bits) -> float {
+  bits = (bits << 16u) | (bits >> 16u);
+  bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+  bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+  bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+  bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+  return static_cast<float>(bits) * 2.3283064365386963e-10f;
+}
+
+
+auto Hammersley(std::uint32_t const i, std::uint32_t const n) -> std::array<float, 2> {
+  return {static_cast<float>(i) / static_cast<float>(n), RadicalInverseVdC(i)};
+}
+
+
+auto SampleGgxNdf(std::array<float, 2> const& xi, float const alpha) -> DirectX::XMFLOAT3 {
+  auto const phi{2 * kPi * xi[0]};
+  auto const cos_theta{std::sqrt((1 - xi[1]) / (1 + (alpha * alpha - 1) * xi[1]))};
+  auto const sin_theta{std::sqrt(std::max(0.0f, 1 - cos_theta * cos_theta))};
+  return {sin_theta * std::cos(phi), sin_theta * std::sin(phi), cos_theta};
+}
+
+
+auto BuildBasis(DirectX::XMFLOAT3 const& normal, DirectX::XMFLOAT3& tangent, DirectX::XMFLOAT3& bitangent) -> void {
+  auto const up{std::abs(normal.z) < 0.999f ? DirectX::XMFLOAT3{0, 0, 1} : DirectX::XMFLOAT3{1, 0, 0}};
+  tangent = Normalize(Cross(up, normal));
+  bitangent = Cross(normal, tangent);
+}
+
+
+auto DistributionTrowbridgeReitz(float const n_dot_h, float const roughness) -> float {
+  auto const alpha{roughness * roughness};
+  auto const alpha2{alpha * alpha};
+  auto const denom{n_dot_h * n_dot_h * (alpha2 - 1) + 1};
+  return alpha2 / (kPi * denom * denom);
+}
+
+
+auto FresnelSchlick(float const v_dot_h, float const f0) -> float {
+  return f0 + (1 - f0) * std::pow(std::clamp(1 - v_dot_h, 0.0f, 1.0f), 5.0f);
+}
+
+
+auto GeometrySmithIbl(float const n_dot_v, float const n_dot_l, float const roughness) -> float {
+  auto const k{roughness * roughness / 2};
+  return GeometrySchlickGgx(n_dot_v, k) * GeometrySchlickGgx(n_dot_l, k);
+}
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <numbers>
+
+#include <DirectXMath.h>
+
+namespace refl {
+// The GGX sampling helpers of the IBL bake and CPU ports of brdf.hlsli. Keep the ports in sync with the shader.
+
+float constexpr kPi{std::numbers::pi_v<float>};
+
+[[nodiscard]] auto RadicalInverseVdC(std::uint32_t bits) -> float;
+[[nodiscard]] auto Hammersley(std::uint32_t i, std::uint32_t n) -> std::array<float, 2>;
+// GGX NDF sample, returns the microfacet normal in tangent space
+[[nodiscard]] auto SampleGgxNdf(std::array<float, 2> const& xi, float alpha) -> DirectX::XMFLOAT3;
+// Orthonormal basis around a unit normal
+auto BuildBasis(DirectX::XMFLOAT3 const& normal, DirectX::XMFLOAT3& tangent, DirectX::XMFLOAT3& bitangent) -> void;
+
+[[nodiscard]] auto DistributionTrowbridgeReitz(float n_dot_h, float roughness) -> float;
+[[nodiscard]] auto FresnelSchlick(float v_dot_h, float f0) -> float;
+// Smith-Schlick-GGX with k = alpha / 2, the remapping image based lighting uses. Has no shader counterpart, it only
+// enters the shaders through the DFG table.
+[[nodiscard]] auto GeometrySmithIbl(float n_dot_v, float n_dot_l, float roughness) -> float;
+}
@@ -0,0 +1,277 @@
+#include "bvh.hpp"
+
+#include <emmintrin.h>
+
+import std;
+
+namespace refl {
+namespace {
+// Deep enough for 4^20 items, every level leaves at most three siblings on the stack
+std::size_t constexpr kMaxBvhStackSize{64};
+
+
+auto GetAxis(DirectX::XMFLOAT3 const& v, int const axis) -> float {
+  return axis == 0 ? v.x : axis == 1 ? v.y : v.z;
+}
+
+
+auto ComputeItemBounds(std::span<Aabb const> const bounds, std::span<std::uint32_t const> const items) -> Aabb {
+  auto aabb{bounds[items[0]]};
+
+  for (auto const item : items.subspan(1)) {
+    auto const& other{bounds[item]};
+    aabb.min = {
+      std::min(aabb.min.x, other.min.x), std::min(aabb.min.y, other.min.y), std::min(aabb.min.z, other.min.z)
+    };
+    aabb.max = {
+      std::max(aabb.max.x, other.max.x), std::max(aabb.max.y, other.max.y), std::max(aabb.max.z, other.max.z)
+    };
+  }
+
+  return aabb;
+}
+
+
+// Partitions the items around the median centroid along the longest axis of the centroids and returns the size of
+// the first half
+auto SplitAtMedian(std::span<Aabb const> const bounds, std::span<std::uint32_t> const items) -> std::size_t {
+  // Doubled centroids, only their order matters
+  auto const centroid{
+    [bounds](std::uint32_t const item, int const axis) {
+      return GetAxis(bounds[item].min, axis) + GetAxis(bounds[item].max, axis);
+    }
+  };
+
+  auto split_axis{0};
+  auto max_extent{-1.0f};
+
+  for (auto axis{0}; axis < 3; axis++) {
+    auto const [min, max]{
+      std::ranges::minmax(items | std::views::transform([&centroid, axis](std::uint32_t const item) {
+        return centroid(item, axis);
+      }))
+    };
+
+    if (max - min > max_extent) {
+      max_extent = max - min;
+      split_axis = axis;
+    }
+  }
+
+  auto const half{items.size() / 2};
+  std::ranges::nth_element(items, items.begin() + static_cast<std::ptrdiff_t>(half), {},
+                           [&centroid, split_axis](std::uint32_t const item) {
+                             return centroid(item, split_axis);
+                           });
+  return half;
+}
+
+
+auto BuildNode(std::span<Aabb const> const bounds, Bvh& bvh, std::uint32_t const first_item,
+               std::uint32_t const item_count) -> std::uint32_t {
+  auto const node_idx{static_cast<std::uint32_t>(bvh.nodes.size())};
+  bvh.nodes.emplace_back();
+
+  // First item and item count of every child
+  std::array<std::pair<std::uint32_t, std::uint32_t>, 4> groups{};
+  auto group_count{0u};
+
+  if (item_count <= 4) {
+    for (auto i{0u}; i < item_count; i++) {
+      groups[group_count++] = {first_item + i, 1};
+    }
+  } else {
+    // Two binary splits give the four children, every quarter has at least one item
+    auto const items{std::span{bvh.items}.subspan(first_item, item_count)};
+    auto const half{static_cast<std::uint32_t>(SplitAtMedian(bounds, items))};
+    auto const first_quarter{static_cast<std::uint32_t>(SplitAtMedian(bounds, items.first(half)))};
+    auto const third_quarter{static_cast<std::uint32_t>(SplitAtMedian(bounds, items.subspan(half)))};
+
+    groups = {
+      std::pair{first_item, first_quarter},
+      std::pair{first_item + first_quarter, half - first_quarter},
+      std::pair{first_item + half, third_quarter},
+      std::pair{first_item + half + third_quarter, item_count - half - third_quarter}
+    };
+    group_count = 4;
+  }
+
+  BvhNode node{};
+  node.child_nodes.fill(kBvhLeaf);
+
+  for (auto i{0u}; i < group_count; i++) {
+    auto const [group_first, group_size]{groups[i]};
+    auto const aabb{ComputeItemBounds(bounds, std::span{bvh.items}.subspan(group_first, group_size))};
+
+    node.min_x[i] = aabb.min.x;
+    node.min_y[i] = aabb.min.y;
+    node.min_z[i] = aabb.min.z;
+    node.max_x[i] = aabb.max.x;
+    node.max_y[i] = aabb.max.y;
+    node.max_z[i] = aabb.max.z;
+    node.first_items[i] = group_first;
+    node.item_counts[i] = group_size;
+
+    if (group_size > 1) {
+      node.child_nodes[i] = BuildNode(bounds, bvh, group_first, group_size);
+    }
+  }
+
+  // Recursion may have reallocated the nodes, so the node is only written at the end
+  bvh.nodes[node_idx] = node;
+  return node_idx;
+}
+}
+
+
+auto ComputeAabb(std::span<Vector4 const> const positions) -> Aabb {
+  if (positions.empty()) {
+    return Aabb{.min = {0, 0, 0}, .max = {0, 0, 0}};
+  }
+
+  Aabb aabb{
+    .min = {positions[0][0], positions[0][1], positions[0][2]},
+    .max = {positions[0][0], positions[0][1], positions[0][2]}
+  };
+
+  for (auto const& pos : positions.subspan(1)) {
+    aabb.min = {std::min(aabb.min.x, pos[0]), std::min(aabb.min.y, pos[1]), std::min(aabb.min.z, pos[2])};
+    aabb.max = {std::max(aabb.max.x, pos[0]), std::max(aabb.max.y, pos[1]), std::max(aabb.max.z, pos[2])};
+  }
+
+  return aabb;
+}
+
+
+auto TransformAabb(Aabb const& aabb, DirectX::XMFLOAT4X4 const& mtx) -> Aabb {
+  std::array<float, 3> new_min{mtx._41, mtx._42, mtx._43};
+  std::array<float, 3> new_max{mtx._41, mtx._42, mtx._43};
+
+  // With row vectors, row i of the matrix is added scaled by coordinate i
+  for (auto i{0}; i < 3; i++) {
+    for (auto j{0}; j < 3; j++) {
+      auto const a{mtx.m[i][j] * GetAxis(aabb.min, i)};
+      auto const b{mtx.m[i][j] * GetAxis(aabb.max, i)};
+      new_min[j] += std::min(a, b);
+      new_max[j] += std::max(a, b);
+    }
+  }
+
+  return Aabb{.min = {new_min[0], new_min[1], new_min[2]}, .max = {new_max[0], new_max[1], new_max[2]}};
+}
+
+
+auto BuildBvh(std::span<Aabb const> const bounds) -> Bvh {
+  Bvh bvh;
+
+  if (bounds.empty()) {
+    return bvh;
+  }
+
+  bvh.items.resize(bounds.size());
+  std::iota(bvh.items.begin(), bvh.items.end(), 0u);
+  // A four-wide tree over n single item leaves has about n / 3 nodes
+  bvh.nodes.reserve(bounds.size() / 3 + 1);
+  BuildNode(bounds, bvh, 0, static_cast<std::uint32_t>(bounds.size()));
+  return bvh;
+}
+
+
+auto CullBvh(Bvh const& bvh, Frustum const& frustum, std::vector<std::uint32_t>& visible_items) -> void {
+  if (bvh.nodes.empty()) {
+    return;
+  }
+
+  struct SplatPlane {
+    __m128 x;
+    __m128 y;
+    __m128 z;
+    __m128 w;
+  };
+
+  std::array<SplatPlane, 6> planes;
+
+  for (std::size_t i{0}; i < planes.size(); i++) {
+    auto const& plane{frustum.planes[i]};
+    planes[i] = {_mm_set1_ps(plane.x), _mm_set1_ps(plane.y), _mm_set1_ps(plane.z), _mm_set1_ps(plane.w)};
+  }
+
+  auto const zero{_mm_setzero_ps()};
+
+  std::array<std::uint32_t, kMaxBvhStackSize> stack;
+  std::size_t stack_size{0};
+  stack[stack_size++] = 0;
+
+  while (stack_size > 0) {
+    auto const& node{bvh.nodes[stack[--stack_size]]};
+
+    auto const min_x{_mm_loadu_ps(node.min_x.data())};
+    auto const min_y{_mm_loadu_ps(node.min_y.data())};
+    auto const min_z{_mm_loadu_ps(node.min_z.data())};
+    auto const max_x{_mm_loadu_ps(node.max_x.data())};
+    auto const max_y{_mm_loadu_ps(node.max_y.data())};
+    auto const max_z{_mm_loadu_ps(node.max_z.data())};
+
+    // A box is outside if its corner farthest along the normal is behind a plane,
+    // and inside if its nearest corner is in front of all of them
+    auto outside{zero};
+    auto inside{_mm_cmpeq_ps(zero, zero)};
+
+    for (auto const& plane : planes) {
+      auto const x0{_mm_mul_ps(plane.x, min_x)};
+      auto const x1{_mm_mul_ps(plane.x, max_x)};
+      auto const y0{_mm_mul_ps(plane.y, min_y)};
+      auto const y1{_mm_mul_ps(plane.y, max_y)};
+      auto const z0{_mm_mul_ps(plane.z, min_z)};
+      auto const z1{_mm_mul_ps(plane.z, max_z)};
+
+      auto const far_dist{
+        _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_max_ps(x0, x1), _mm_max_ps(y0, y1)), _mm_max_ps(z0, z1)), plane.w)
+      };
+      auto const near_dist{
+        _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_min_ps(x0, x1), _mm_min_ps(y0, y1)), _mm_min_ps(z0, z1)), plane.w)
+      };
+
+      outside = _mm_or_ps(outside, _mm_cmplt_ps(far_dist, zero));
+      inside = _mm_and_ps(inside, _mm_cmpge_ps(near_dist, zero));
+    }
+
+    auto const outside_mask{_mm_movemask_ps(outside)};
+    auto const inside_mask{_mm_movemask_ps(inside)};
+
+    for (auto i{0}; i < 4; i++) {
+      if (node.item_counts[i] == 0 || (outside_mask & (1 << i)) != 0) {
+        continue;
+      }
+
+      if ((inside_mask & (1 << i)) != 0 || node.child_nodes[i] == kBvhLeaf) {
+        auto const items{std::span{bvh.items}.subspan(node.first_items[i], node.item_counts[i])};
+        visible_items.insert(visible_items.end(), items.begin(), items.end());
+      } else {
+        stack[stack_size++] = node.child_nodes[i];
+      }
+    }
+  }
+}
+
+
+auto CullAabbs(std::span<Aabb const> const bounds, Frustum const& frustum,
+               std::vector<std::uint32_t>& visible_items) -> void {
+  for (std::uint32_t i{0}; i < bounds.size(); i++) {
+    auto const& aabb{bounds[i]};
+
+    auto const is_outside{
+      std::ranges::any_of(frustum.planes, [&aabb](DirectX::XMFLOAT4 const& plane) {
+        // Same operations in the same order as CullBvh, so the results match exactly
+        return std::max(plane.x * aabb.min.x, plane.x * aabb.max.x) +
+               std::max(plane.y * aabb.min.y, plane.y * aabb.max.y) +
+               std::max(plane.z * aabb.min.z, plane.z * aabb.max.z) + plane.w < 0;
+      })
+    };
+
+    if (!is_outside) {
+      visible_items.push_back(i);
+    }
+  }
+}
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <vector>
+
+#include <DirectXMath.h>
+
+#include "frustum.hpp"
+#include "scene.hpp"
+
+namespace refl {
+struct Aabb {
+  DirectX::XMFLOAT3 min;
+  DirectX::XMFLOAT3 max;
+};
+
+[[nodiscard]] auto ComputeAabb(std::span<Vector4 const> positions) -> Aabb;
+// Bounds of the transformed box (Arvo, Transforming Axis-Aligned Bounding Boxes)
+[[nodiscard]] auto TransformAabb(Aabb const& aabb, DirectX::XMFLOAT4X4 const& mtx) -> Aabb;
+
+// Child of a BvhNode that is a single item instead of another node
+std::uint32_t constexpr kBvhLeaf{std::numeric_limits<std::uint32_t>::max()};
+
+// Four-wide node, the bounds of the children are laid out so that SSE tests all four against a plane at once
+struct BvhNode {
+  std::array<float, 4> min_x;
+  std::array<float, 4> min_y;
+  std::array<float, 4> min_z;
+  std::array<float, 4> max_x;
+  std::array<float, 4> max_y;
+  std::array<float, 4> max_z;
+  std::array<std::uint32_t, 4> child_nodes; // Into Bvh::nodes, or kBvhLeaf
+  // Range of Bvh::items under each child, so fully visible subtrees are emitted without visiting them.
+  // A count of 0 marks an unused child.
+  std::array<std::uint32_t, 4> first_items;
+  std::array<std::uint32_t, 4> item_counts;
+};
+
+struct Bvh {
+  std::vector<BvhNode> nodes; // The root is the first one, empty if there are no items
+  std::vector<std::uint32_t> items; // Indices into the bounds the hierarchy was built over
+};
+
+// Top-down median split along the longest axis of the centroids, two levels at a time
+[[nodiscard]] auto BuildBvh(std::span<Aabb const> bounds) -> Bvh;
+// Appends the items whose bounds are not completely outside one of the planes of the frustum
+auto CullBvh(Bvh const& bvh, Frustum const& frustum, std::vector<std::uint32_t>& visible_items) -> void;
+// Same test without the hierarchy, for reference
+auto CullAabbs(std::span<Aabb const> bounds, Frustum const& frustum, std::vector<std::uint32_t>& visible_items) -> void;
+}
@@ -0,0 +1,170 @@
+#include "cache.hpp"
+
+#include "mapped_file.hpp"
+
+import std;
+
+namespace refl {
+namespace {
+auto constexpr kPrime1{0x9E3779B185EBCA87ULL};
+auto constexpr kPrime2{0xC2B2AE3D27D4EB4FULL};
+auto constexpr kPrime3{0x165667B19E3779F9ULL};
+auto constexpr kPrime4{0x85EBCA77C2B2AE63ULL};
+auto constexpr kPrime5{0x27D4EB2F165667C5ULL};
+
+
+template<typename T>
+auto Read(std::byte const* const ptr) -> T {
+  T ret;
+  std::memcpy(&ret, ptr, sizeof(T));
+  return ret;
+}
+
+
+auto Round(std::uint64_t acc, std::uint64_t const input) -> std::uint64_t {
+  acc += input * kPrime2;
+  acc = std::rotl(acc, 31);
+  return acc * kPrime1;
+}
+
+
+auto MergeRound(std::uint64_t acc, std::uint64_t const val) -> std::uint64_t {
+  acc ^= Round(0, val);
+  return acc * kPrime1 + kPrime4;
+}
+}
+
+
+auto HashBytes(std::span<std::byte const> const bytes, std::uint64_t const seed) -> std::uint64_t {
+  auto ptr{bytes.data()};
+  auto const end{bytes.data() + bytes.size()};
+
+  std::uint64_t h64;
+
+  if (bytes.size() >= 32) {
+    auto v1{seed + kPrime1 + kPrime2};
+    auto v2{seed + kPrime2};
+    auto v3{seed};
+    auto v4{seed - kPrime1};
+
+    for (; ptr + 32 <= end; ptr += 32) {
+      v1 = Round(v1, Read<std::uint64_t>(ptr));
+      v2 = Round(v2, Read<std::uint64_t>(ptr + 8));
+      v3 = Round(v3, Read<std::uint64_t>(ptr + 16));
+      v4 = Round(v4, Read<std::uint64_t>(ptr + 24));
+    }
+
+    h64 = std::rotl(v1, 1) + std::rotl(v2, 7) + std::rotl(v3, 12) + std::rotl(v4, 18);
+    h64 = MergeRound(h64, v1);
+    h64 = MergeRound(h64, v2);
+    h64 = MergeRound(h64, v3);
+    h64 = MergeRound(h64, v4);
+  } else {
+    h64 = seed + kPrime5;
+  }
+
+  h64 += bytes.size();
+
+  for (; ptr + 8 <= end; ptr += 8) {
+    h64 ^= Round(0, Read<std::uint64_t>(ptr));
+    h64 = std::rotl(h64, 27) * kPrime1 + kPrime4;
+  }
+
+  if (ptr + 4 <= end) {
+    h64 ^= static_cast<std::uint64_t>(Read<std::uint32_t>(ptr)) * kPrime1;
+    h64 = std::rotl(h64, 23) * kPrime2 + kPrime3;
+    ptr += 4;
+  }
+
+  for (; ptr < end; ++ptr) {
+    h64 ^= static_cast<std::uint64_t>(*ptr) * kPrime5;
+    h64 = std::rotl(h64, 11) * kPrime1;
+  }
+
+  h64 ^= h64 >> 33;
+  h64 *= kPrime2;
+  h64 ^= h64 >> 29;
+  h64 *= kPrime3;
+  h64 ^= h64 >> 32;
+
+  return h64;
+}
+
+
+auto HashFileContents(std::filesystem::path const& path) -> std::optional<std::uint64_t> {
+  auto const file{MappedFile::New(path)};
+
+  if (!file) {
+    return std::nullopt;
+  }
+
+  return HashBytes(file->GetData());
+}
+
+
+auto HashFiles(std::span<std::filesystem::path const> const paths,
+               std::uint64_t seed) -> std::optional<std::uint64_t> {
+  for (auto const& path : paths) {
+    auto const contents_hash{HashFileContents(path)};
+
+    if (!contents_hash) {
+      return std::nullopt;
+    }
+
+    seed = HashValue(*contents_hash, HashBytes(std::as_bytes(std::span{path.native()}), seed));
+  }
+
+  return seed;
+}
+
+
+auto WriteFileAtomically(std::filesystem::path const& path,
+                         std::initializer_list<std::span<std::byte const>> const chunks) -> bool {
+  auto tmp_path{path};
+  tmp_path += ".tmp";
+
+  std::error_code ec;
+  std::ofstream out{tmp_path, std::ios::binary | std::ios::trunc};
+
+  if (!out) {
+    std::filesystem::remove(tmp_path, ec);
+    return false;
+  }
+
+  for (auto const chunk : chunks) {
+    out.write(reinterpret_cast<char const*>(chunk.data()), static_cast<std::streamsize>(chunk.size()));
+  }
+
+  // Closing flushes, which can fail as well, so the state is checked after it
+  out.close();
+
+  if (!out) {
+    std::filesystem::remove(tmp_path, ec);
+    return false;
+  }
+
+  std::filesystem::rename(tmp_path, path, ec);
+
+  if (ec) {
+    std::filesystem::remove(tmp_path, ec);
+    return false;
+  }
+
+  return true;
+}
+
+
+auto GetCacheFilePath(std::filesystem::path const& source_path,
+                      std::string_view const extension) -> std::filesystem::path {
+  auto const cache_dir{std::filesystem::current_path() / "cache"};
+
+  std::error_code ec;
+  std::filesystem::create_directories(cache_dir, ec);
+
+  // Different assets may share a file name, so the absolute source path is part of the cache file name.
+  auto const abs_path{std::filesystem::absolute(source_path)};
+  auto const path_hash{HashBytes(std::as_bytes(std::span{abs_path.native()}))};
+
+  return cache_dir / std::format("{}-{:016x}{}", source_path.stem().string(), path_hash, extension);
+}
+}
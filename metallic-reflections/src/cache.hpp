@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <initializer_list>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <type_traits>
+
+namespace refl {
+// Non-cryptographic 64-bit hash (XXH64) used to key on-disk caches.
+[[nodiscard]] auto HashBytes(std::span<std::byte const> bytes, std::uint64_t seed = 0) -> std::uint64_t;
+
+template<typename T> requires std::is_trivially_copyable_v<T>
+[[nodiscard]] auto HashValue(T const& value, std::uint64_t const seed = 0) -> std::uint64_t {
+  return HashBytes(std::as_bytes(std::span{&value, 1}), seed);
+}
+
+[[nodiscard]] auto HashFileContents(std::filesystem::path const& path) -> std::optional<std::uint64_t>;
+// Combines the paths and contents of the files with the seed. Returns nullopt if any of them cannot be read.
+[[nodiscard]] auto HashFiles(std::span<std::filesystem::path const> paths,
+                             std::uint64_t seed) -> std::optional<std::uint64_t>;
+
+// Writes the chunks one after another to a temporary file next to path and renames it to path, so that an
+// interrupted write never leaves a truncated file behind
+[[nodiscard]] auto WriteFileAtomically(std::filesystem::path const& path,
+                                       std::initializer_list<std::span<std::byte const>> chunks) -> bool;
+
+// Path of the cache file belonging to a source asset. Creates the cache directory if it does not exist yet.
+[[nodiscard]] auto GetCacheFilePath(std::filesystem::path const& source_path,
+                                    std::string_view extension) -> std::filesystem::path;
+}
@@ -0,0 +1,130 @@
+#include "cube_map_cache.hpp"
+
+#include "cache.hpp"
+#include "mapped_file.hpp"
+
+import std;
+
+namespace refl {
+namespace {
+std::array<char, 8> constexpr kCubeMapCacheMagic{'R', 'E', 'F', 'L', 'C', 'U', 'B', '\0'};
+std::array<char, 8> constexpr kBc6hCubeMapCacheMagic{'R', 'E', 'F', 'L', 'B', 'C', '6', '\0'};
+std::uint32_t constexpr kCubeMapCacheVersion{2};
+
+
+struct CubeMapCacheHeader {
+  std::array<char, 8> magic;
+  std::uint32_t version;
+  std::uint32_t face_size;
+  std::uint64_t key;
+  std::uint64_t file_size;
+  std::uint32_t mip_count;
+  std::uint32_t valid_mips; // Bit m is set if mip m holds data
+};
+
+
+// Both cube formats share the header and store their elements in subresource order right after it. Returns the cube
+// and the mips of it that hold data.
+template<typename Cube>
+auto ReadCache(std::filesystem::path const& cache_path, std::uint64_t const key, std::array<char, 8> const& magic,
+               Cube (*const create)(std::uint32_t, std::uint32_t),
+               auto const get_elements) -> std::optional<std::pair<Cube, std::uint32_t>> {
+  auto const file{MappedFile::New(cache_path)};
+
+  if (!file) {
+    return std::nullopt;
+  }
+
+  auto const data{file->GetData()};
+
+  if (data.size() < sizeof(CubeMapCacheHeader)) {
+    return std::nullopt;
+  }
+
+  CubeMapCacheHeader header;
+  std::memcpy(&header, data.data(), sizeof(header));
+
+  if (header.magic != magic || header.version != kCubeMapCacheVersion || header.key != key ||
+      header.file_size != data.size() || header.face_size == 0 ||
+      header.mip_count == 0 || header.mip_count > static_cast<std::uint32_t>(std::bit_width(header.face_size)) ||
+      (header.valid_mips & ~GetMipMask(header.mip_count)) != 0) {
+    return std::nullopt;
+  }
+
+  auto cube{create(header.face_size, header.mip_count)};
+  auto const elements{std::as_writable_bytes(std::span{get_elements(cube)})};
+
+  if (elements.size() != data.size() - sizeof(CubeMapCacheHeader)) {
+    return std::nullopt;
+  }
+
+  std::memcpy(elements.data(), data.data() + sizeof(CubeMapCacheHeader), elements.size());
+  return std::pair{std::move(cube), header.valid_mips};
+}
+
+
+template<typename Cube>
+auto WriteCache(std::filesystem::path const& cache_path, std::uint64_t const key, std::array<char, 8> const& magic,
+                Cube const& cube, std::uint32_t const valid_mips, auto const get_elements) -> bool {
+  auto const elements{std::as_bytes(std::span{get_elements(cube)})};
+
+  CubeMapCacheHeader const header{
+    .magic = magic,
+    .version = kCubeMapCacheVersion,
+    .face_size = cube.face_size,
+    .key = key,
+    .file_size = sizeof(CubeMapCacheHeader) + elements.size(),
+    .mip_count = cube.mip_count,
+    .valid_mips = valid_mips
+  };
+
+  return WriteFileAtomically(cache_path, {std::as_bytes(std::span{&header, 1}), elements});
+}
+}
+
+
+auto GetMipMask(std::uint32_t const mip_count) -> std::uint32_t {
+  return static_cast<std::uint32_t>((std::uint64_t{1} << std::min(mip_count, 32u)) - 1);
+}
+
+
+auto ReadCubeMapCache(std::filesystem::path const& cache_path, std::uint64_t const key) -> std::optional<CubeMap> {
+  auto cache{
+    ReadCache(cache_path, key, kCubeMapCacheMagic, &CreateCubeMap, [](auto& c) -> auto& { return c.texels; })
+  };
+
+  if (!cache || cache->second != GetMipMask(cache->first.mip_count)) {
+    return std::nullopt;
+  }
+
+  return std::move(cache->first);
+}
+
+
+auto WriteCubeMapCache(std::filesystem::path const& cache_path, std::uint64_t const key,
+                       CubeMap const& cube) -> bool {
+  return WriteCache(cache_path, key, kCubeMapCacheMagic, cube, GetMipMask(cube.mip_count),
+                    [](auto& c) -> auto& { return c.texels; });
+}
+
+
+auto ReadPartialBc6hCubeMapCache(std::filesystem::path const& cache_path,
+                                 std::uint64_t const key) -> std::optional<PartialBc6hCubeMap> {
+  auto cache{
+    ReadCache(cache_path, key, kBc6hCubeMapCacheMagic, &CreateBc6hCubeMap, [](auto& c) -> auto& { return c.blocks; })
+  };
+
+  if (!cache) {
+    return std::nullopt;
+  }
+
+  return PartialBc6hCubeMap{.cube = std::move(cache->first), .valid_mips = cache->second};
+}
+
+
+auto WritePartialBc6hCubeMapCache(std::filesystem::path const& cache_path, std::uint64_t const key,
+                                  PartialBc6hCubeMap const& cube) -> bool {
+  return WriteCache(cache_path, key, kBc6hCubeMapCacheMagic, cube.cube, cube.valid_mips,
+                    [](auto& c) -> auto& { return c.blocks; });
+}
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+
+#include "bc6h.hpp"
+#include "environment_map.hpp"
+
+namespace refl {
+// Baked cube map format. The texels are stored in the subresource order of CubeMap, so a cache is uploaded without
+// any conversion. The key identifies the source image and the bake settings; a cache with a different key is stale.
+[[nodiscard]] auto ReadCubeMapCache(std::filesystem::path const& cache_path,
+                                    std::uint64_t key) -> std::optional<CubeMap>;
+[[nodiscard]] auto WriteCubeMapCache(std::filesystem::path const& cache_path, std::uint64_t key,
+                                     CubeMap const& cube) -> bool;
+// Mask of the first mip_count mips, the valid_mips of a complete chain
+[[nodiscard]] auto GetMipMask(std::uint32_t mip_count) -> std::uint32_t;
+
+// BC6H cube of which only some mips hold data, the others are zeroed. Bit m of valid_mips is set if mip m holds data.
+struct PartialBc6hCubeMap {
+  Bc6hCubeMap cube;
+  std::uint32_t valid_mips;
+};
+
+// Same for BC6H compressed cubes, which use a different magic so the two never mistake each other for their own. The
+// cache records which mips are valid, so it can be filled in over several runs.
+[[nodiscard]] auto ReadPartialBc6hCubeMapCache(std::filesystem::path const& cache_path,
+                                               std::uint64_t key) -> std::optional<PartialBc6hCubeMap>;
+[[nodiscard]] auto WritePartialBc6hCubeMapCache(std::filesystem::path const& cache_path, std::uint64_t key,
+                                                PartialBc6hCubeMap const& cube) -> bool;
+}
@@ -0,0 +1,246 @@
+#include "dfg_lut.hpp"
+
+#include <xmmintrin.h>
+
+#include "brdf.hpp"
+#include "cache.hpp"
+#include "environment_map.hpp"
+#include "mapped_file.hpp"
+#include "parallel.hpp"
+
+import std;
+
+namespace refl {
+namespace {
+// Bump when the output of the generator changes
+std::uint32_t constexpr kDfgLutVersion{1};
+
+std::array<char, 8> constexpr kDfgLutCacheMagic{'R', 'E', 'F', 'L', 'D', 'F', 'G', '\0'};
+
+struct DfgCacheKey {
+  DfgLutSettings settings;
+  std::uint32_t version;
+};
+
+
+struct DfgLutCacheHeader {
+  std::array<char, 8> magic;
+  std::uint64_t key;
+  std::uint64_t file_size;
+  std::uint32_t size;
+  std::uint32_t pad;
+};
+
+
+auto GetTexelCenter(std::uint32_t const i, std::uint32_t const size) -> float {
+  return (static_cast<float>(i) + 0.5f) / static_cast<float>(size);
+}
+
+
+auto ToUnorm16(float const value) -> std::uint16_t {
+  return static_cast<std::uint16_t>(std::lround(std::clamp(value, 0.0f, 1.0f) * 65535.0f));
+}
+
+
+auto HorizontalSum(__m128 const value) -> float {
+  auto const shuffled{_mm_movehl_ps(value, value)};
+  auto const sum{_mm_add_ps(value, shuffled)};
+  return _mm_cvtss_f32(_mm_add_ss(sum, _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 1, 1, 1))));
+}
+
+
+// Microfacet normals of a roughness in the xz half of tangent space, laid out for four wide processing. V lies in the
+// xz plane, so the y component of H never enters N.L, V.H or N.H. The padding has H = 0, which makes N.L negative and
+// masks it out.
+struct DfgSamples {
+  std::vector<float> x;
+  std::vector<float> z;
+};
+
+
+auto BuildDfgSamples(float const roughness, std::uint32_t const sample_count) -> DfgSamples {
+  auto const padded_count{(static_cast<std::size_t>(sample_count) + 3) / 4 * 4};
+  DfgSamples samples{.x = std::vector(padded_count, 0.0f), .z = std::vector(padded_count, 0.0f)};
+
+  for (std::uint32_t i{0}; i < sample_count; i++) {
+    auto const h{SampleGgxNdf(Hammersley(i, sample_count), roughness * roughness)};
+    samples.x[i] = h.x;
+    samples.z[i] = h.z;
+  }
+
+  return samples;
+}
+
+
+auto IntegrateDfgSse(DfgSamples const& samples, float const n_dot_v, float const roughness,
+                     std::uint32_t const sample_count) -> std::array<float, 2> {
+  auto const k{roughness * roughness / 2};
+  auto const sin_v{_mm_set1_ps(std::sqrt(1 - n_dot_v * n_dot_v))};
+  auto const cos_v{_mm_set1_ps(n_dot_v)};
+  auto const one_minus_k{_mm_set1_ps(1 - k)};
+  auto const k4{_mm_set1_ps(k)};
+  auto const zero{_mm_setzero_ps()};
+  auto const one{_mm_set1_ps(1)};
+  auto const two{_mm_set1_ps(2)};
+  // G1(N.V) and the 1 / N.V of the visibility term are the same for every sample
+  auto const g1_v_over_n_dot_v{_mm_set1_ps(1 / (n_dot_v * (1 - k) + k))};
+
+  auto a{_mm_setzero_ps()};
+  auto b{_mm_setzero_ps()};
+
+  for (std::size_t i{0}; i < samples.x.size(); i += 4) {
+    auto const hx{_mm_loadu_ps(samples.x.data() + i)};
+    auto const hz{_mm_loadu_ps(samples.z.data() + i)};
+
+    auto const v_dot_h_raw{_mm_add_ps(_mm_mul_ps(sin_v, hx), _mm_mul_ps(cos_v, hz))};
+    auto const n_dot_l{_mm_sub_ps(_mm_mul_ps(_mm_mul_ps(two, v_dot_h_raw), hz), cos_v)};
+    auto const mask{_mm_cmpgt_ps(n_dot_l, zero)};
+    auto const v_dot_h{_mm_min_ps(_mm_max_ps(v_dot_h_raw, zero), one)};
+
+    auto const g1_l{_mm_div_ps(n_dot_l, _mm_add_ps(_mm_mul_ps(n_dot_l, one_minus_k), k4))};
+    auto const g_vis{_mm_div_ps(_mm_mul_ps(_mm_mul_ps(g1_v_over_n_dot_v, g1_l), v_dot_h), hz)};
+
+    auto const fc1{_mm_sub_ps(one, v_dot_h)};
+    auto const fc2{_mm_mul_ps(fc1, fc1)};
+    auto const fc{_mm_mul_ps(_mm_mul_ps(fc2, fc2), fc1)};
+
+    // The padding divides by N.H = 0, the mask also discards the resulting NaNs
+    a = _mm_add_ps(a, _mm_and_ps(mask, _mm_mul_ps(_mm_sub_ps(one, fc), g_vis)));
+    b = _mm_add_ps(b, _mm_and_ps(mask, _mm_mul_ps(fc, g_vis)));
+  }
+
+  auto const inv_count{1 / static_cast<float>(sample_count)};
+  return {HorizontalSum(a) * inv_count, HorizontalSum(b) * inv_count};
+}
+
+
+auto ReadDfgLutCache(std::filesystem::path const& cache_path, std::uint64_t const key) -> std::optional<DfgLut> {
+  auto const file{MappedFile::New(cache_path)};
+
+  if (!file) {
+    return std::nullopt;
+  }
+
+  auto const data{file->GetData()};
+
+  if (data.size() < sizeof(DfgLutCacheHeader)) {
+    return std::nullopt;
+  }
+
+  DfgLutCacheHeader header;
+  std::memcpy(&header, data.data(), sizeof(header));
+
+  auto const texel_count{static_cast<std::size_t>(header.size) * header.size};
+
+  if (header.magic != kDfgLutCacheMagic || header.key != key || header.file_size != data.size() ||
+      texel_count * sizeof(DfgTexel) != data.size() - sizeof(DfgLutCacheHeader)) {
+    return std::nullopt;
+  }
+
+  DfgLut lut{.size = header.size, .texels = std::vector<DfgTexel>(texel_count)};
+  std::memcpy(lut.texels.data(), data.data() + sizeof(DfgLutCacheHeader), texel_count * sizeof(DfgTexel));
+  return lut;
+}
+
+
+auto WriteDfgLutCache(std::filesystem::path const& cache_path, std::uint64_t const key, DfgLut const& lut) -> bool {
+  DfgLutCacheHeader const header{
+    .magic = kDfgLutCacheMagic,
+    .key = key,
+    .file_size = sizeof(DfgLutCacheHeader) + lut.texels.size() * sizeof(DfgTexel),
+    .size = lut.size,
+    .pad = 0
+  };
+
+  return WriteFileAtomically(cache_path, {std::as_bytes(std::span{&header, 1}), std::as_bytes(std::span{lut.texels})});
+}
+}
+
+
+auto GenerateDfgLut(DfgLutSettings const& settings, unsigned const thread_count) -> DfgLut {
+  DfgLut lut{
+    .size = settings.size,
+    .texels = std::vector<DfgTexel>(static_cast<std::size_t>(settings.size) * settings.size)
+  };
+
+  ParallelFor(settings.size, thread_count, [&](std::size_t const y) {
+    auto const roughness{GetTexelCenter(static_cast<std::uint32_t>(y), settings.size)};
+    auto const samples{BuildDfgSamples(roughness, settings.sample_count)};
+
+    for (std::uint32_t x{0}; x < settings.size; x++) {
+      auto const [a, b]{IntegrateDfgSse(samples, GetTexelCenter(x, settings.size), roughness, settings.sample_count)};
+      lut.texels[y * settings.size + x] = {ToUnorm16(a), ToUnorm16(b)};
+    }
+  });
+
+  return lut;
+}
+
+
+auto IntegrateDfg(float const n_dot_v, float const roughness,
+                  std::uint32_t const sample_count) -> std::array<float, 2> {
+  DirectX::XMFLOAT3 const v{std::sqrt(1 - n_dot_v * n_dot_v), 0, n_dot_v};
+  auto a{0.0f};
+  auto b{0.0f};
+
+  for (std::uint32_t i{0}; i < sample_count; i++) {
+    auto const h{SampleGgxNdf(Hammersley(i, sample_count), roughness * roughness)};
+    auto const v_dot_h_raw{v.x * h.x + v.y * h.y + v.z * h.z};
+    auto const n_dot_l{2 * v_dot_h_raw * h.z - v.z};
+
+    if (n_dot_l > 0) {
+      auto const v_dot_h{std::clamp(v_dot_h_raw, 0.0f, 1.0f)};
+      auto const g_vis{GeometrySmithIbl(n_dot_v, n_dot_l, roughness) * v_dot_h / (h.z * n_dot_v)};
+      auto const fc{std::pow(1 - v_dot_h, 5.0f)};
+      a += (1 - fc) * g_vis;
+      b += fc * g_vis;
+    }
+  }
+
+  return {a / static_cast<float>(sample_count), b / static_cast<float>(sample_count)};
+}
+
+
+auto LoadDfgLut(DfgLutSettings const& settings, unsigned const thread_count) -> DfgLut {
+  using Milliseconds = std::chrono::duration<double, std::milli>;
+
+  auto const cache_key{HashValue(DfgCacheKey{.settings = settings, .version = kDfgLutVersion})};
+  auto const cache_path{GetCacheFilePath("dfg-lut", ".refldfg")};
+
+  if (auto lut{ReadDfgLutCache(cache_path, cache_key)}) {
+    return std::move(*lut);
+  }
+
+  auto const begin{std::chrono::steady_clock::now()};
+  auto lut{GenerateDfgLut(settings, thread_count)};
+  auto const end{std::chrono::steady_clock::now()};
+
+  std::cout << std::format("DFG table generation took {:.2f} ms.\n", Milliseconds{end - begin}.count());
+
+  if (!WriteDfgLutCache(cache_path, cache_key, lut)) {
+    std::cerr << "Failed to write DFG table cache.\n";
+  }
+
+  return lut;
+}
+
+
+auto SampleDfgLut(DfgLut const& lut, float const n_dot_v, float const roughness) -> std::array<float, 2> {
+  auto const footprint{ComputeBilinearFootprint(lut.size, n_dot_v, roughness)};
+  auto const offsets{GetClampedTexelOffsets(footprint, lut.size)};
+
+  std::array<float, 2> ret;
+
+  for (std::size_t c{0}; c < 2; c++) {
+    auto const t00{static_cast<float>(lut.texels[offsets[0]][c])};
+    auto const t10{static_cast<float>(lut.texels[offsets[1]][c])};
+    auto const t01{static_cast<float>(lut.texels[offsets[2]][c])};
+    auto const t11{static_cast<float>(lut.texels[offsets[3]][c])};
+    auto const top{t00 + (t10 - t00) * footprint.tx};
+    auto const bottom{t01 + (t11 - t01) * footprint.tx};
+    ret[c] = (top + (bottom - top) * footprint.ty) / 65535.0f;
+  }
+
+  return ret;
+}
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace refl {
+// Everything that influences the table. Part of the DFG cache key.
+struct DfgLutSettings {
+  std::uint32_t size;
+  std::uint32_t sample_count; // GGX samples per texel
+};
+
+DfgLutSettings constexpr kDefaultDfgLutSettings{.size = 128, .sample_count = 1024};
+
+using DfgTexel = std::array<std::uint16_t, 2>; // R16G16_UNORM
+
+// Split-sum environment BRDF. Texel (x, y) holds the scale and bias of F0 for n_dot_v = (x + 0.5) / size and
+// roughness = (y + 0.5) / size, row by row from roughness 0, so the lighting pass can sample it with a clamping
+// bilinear sampler at (n_dot_v, roughness).
+struct DfgLut {
+  std::uint32_t size;
+  std::vector<DfgTexel> texels;
+};
+
+// Integrates the table with the Hammersley set and GGX sampling of brdf.hpp, four samples at a time with SSE
+[[nodiscard]] auto GenerateDfgLut(DfgLutSettings const& settings, unsigned thread_count) -> DfgLut;
+// Scalar integration of a single texel that GenerateDfgLut is checked against
+[[nodiscard]] auto IntegrateDfg(float n_dot_v, float roughness, std::uint32_t sample_count) -> std::array<float, 2>;
+// Loads the table from the cache if it was generated with the same settings, otherwise generates it on thread_count
+// threads and rewrites the cache
+[[nodiscard]] auto LoadDfgLut(DfgLutSettings const& settings, unsigned thread_count) -> DfgLut;
+
+// Bilinear lookup with clamped addressing, the way the lighting pass samples the table
+[[nodiscard]] auto SampleDfgLut(DfgLut const& lut, float n_dot_v, float roughness) -> std::array<float, 2>;
+}
@@ -0,0 +1,333 @@
+#include "environment_map.hpp"
+
+#include <stb_image.h>
+
+import std;
+
+namespace refl {
+namespace {
+auto Lerp(Vector4 const& a, Vector4 const& b, float const t) -> Vector4 {
+  return {a[0] + (b[0] - a[0]) * t, a[1] + (b[1] - a[1]) * t, a[2] + (b[2] - a[2]) * t, a[3] + (b[3] - a[3]) * t};
+}
+
+
+// Unnormalized direction through a point of a face given in [-1, 1], v pointing down the face
+auto ComputeFaceDirection(std::uint32_t const face, float const u, float const v) -> DirectX::XMFLOAT3 {
+  switch (face) {
+    case 0:
+      return {1, -v, -u};
+    case 1:
+      return {-1, -v, u};
+    case 2:
+      return {u, 1, v};
+    case 3:
+      return {u, -1, -v};
+    case 4:
+      return {u, -v, 1};
+    case 5:
+      return {-u, -v, -1};
+    default:
+      return {1, 0, 0};
+  }
+}
+
+
+// Solid angle of the part of a face between its center and a point in [-1, 1]
+auto ComputeFaceAreaElement(double const u, double const v) -> double {
+  return std::atan2(u * v, std::sqrt(u * u + v * v + 1));
+}
+}
+
+
+auto LoadEquirectMap(std::filesystem::path const& path) -> std::optional<EquirectMap> {
+  int width;
+  int height;
+  int channel_count;
+  auto const data{
+    stbi_loadf(reinterpret_cast<char const*>(path.u8string().data()), &width, &height, &channel_count, 4)
+  };
+
+  if (!data) {
+    return std::nullopt;
+  }
+
+  EquirectMap map{
+    .width = static_cast<std::uint32_t>(width),
+    .height = static_cast<std::uint32_t>(height),
+    .texels = {}
+  };
+  map.texels.resize(static_cast<std::size_t>(width) * static_cast<std::size_t>(height));
+  std::memcpy(map.texels.data(), data, map.texels.size() * sizeof(Vector4));
+  stbi_image_free(data);
+  return map;
+}
+
+
+auto ComputeBilinearFootprint(std::uint32_t const size, float const u, float const v) -> BilinearFootprint {
+  auto const x{u * static_cast<float>(size) - 0.5f};
+  auto const y{v * static_cast<float>(size) - 0.5f};
+  auto const x_floor{std::floor(x)};
+  auto const y_floor{std::floor(y)};
+
+  return {
+    .x0 = static_cast<std::int32_t>(x_floor),
+    .y0 = static_cast<std::int32_t>(y_floor),
+    .tx = x - x_floor,
+    .ty = y - y_floor
+  };
+}
+
+
+auto GetClampedTexelOffsets(BilinearFootprint const& footprint,
+                            std::uint32_t const size) -> std::array<std::size_t, 4> {
+  auto const max_coord{static_cast<std::int32_t>(size) - 1};
+  auto const x0{static_cast<std::size_t>(std::clamp(footprint.x0, 0, max_coord))};
+  auto const x1{static_cast<std::size_t>(std::clamp(footprint.x0 + 1, 0, max_coord))};
+  auto const y0{static_cast<std::size_t>(std::clamp(footprint.y0, 0, max_coord)) * size};
+  auto const y1{static_cast<std::size_t>(std::clamp(footprint.y0 + 1, 0, max_coord)) * size};
+  return {y0 + x0, y0 + x1, y1 + x0, y1 + x1};
+}
+
+
+auto ComputeEquirectFootprint(std::uint32_t const width, std::uint32_t const height, float const u,
+                              float const v) -> EquirectFootprint {
+  auto const x{u * static_cast<float>(width) - 0.5f};
+  auto const y{v * static_cast<float>(height) - 0.5f};
+  auto const x_floor{std::floor(x)};
+  auto const y_floor{std::floor(y)};
+  auto const int_width{static_cast<int>(width)};
+  auto const max_y{static_cast<int>(height) - 1};
+
+  // Column -1 is the last one, and column width, which rounding errors can reach for u at 1, is the first one
+  auto x0{static_cast<int>(x_floor)};
+  x0 = x0 < 0 ? x0 + int_width : x0 >= int_width ? x0 - int_width : x0;
+
+  return {
+    .x0 = static_cast<std::uint32_t>(x0),
+    .x1 = static_cast<std::uint32_t>(x0 + 1 == int_width ? 0 : x0 + 1),
+    .y0 = static_cast<std::uint32_t>(std::clamp(static_cast<int>(y_floor), 0, max_y)),
+    .y1 = static_cast<std::uint32_t>(std::clamp(static_cast<int>(y_floor) + 1, 0, max_y)),
+    .tx = x - x_floor,
+    .ty = y - y_floor
+  };
+}
+
+
+auto SampleEquirectFootprint(std::span<Vector4 const> const rows, std::uint32_t const first_row,
+                             std::uint32_t const width, EquirectFootprint const& footprint) -> Vector4 {
+  auto const row0{rows.subspan(static_cast<std::size_t>(footprint.y0 - first_row) * width, width)};
+  auto const row1{rows.subspan(static_cast<std::size_t>(footprint.y1 - first_row) * width, width)};
+  auto const top{Lerp(row0[footprint.x0], row0[footprint.x1], footprint.tx)};
+  auto const bottom{Lerp(row1[footprint.x0], row1[footprint.x1], footprint.tx)};
+  return Lerp(top, bottom, footprint.ty);
+}
+
+
+auto SampleEquirectMap(EquirectMap const& map, float const u, float const v) -> Vector4 {
+  return SampleEquirectFootprint(map.texels, 0, map.width, ComputeEquirectFootprint(map.width, map.height, u, v));
+}
+
+
+auto CubeMap::GetMipSize(std::uint32_t const mip) const -> std::uint32_t {
+  return std::max(face_size >> mip, 1u);
+}
+
+
+auto CubeMap::GetFaceMipOffset(std::uint32_t const face, std::uint32_t const mip) const -> std::size_t {
+  std::size_t face_texel_count{0};
+  std::size_t mip_offset{0};
+
+  for (std::uint32_t i{0}; i < mip_count; i++) {
+    auto const size{static_cast<std::size_t>(GetMipSize(i))};
+
+    if (i < mip) {
+      mip_offset += size * size;
+    }
+
+    face_texel_count += size * size;
+  }
+
+  return face * face_texel_count + mip_offset;
+}
+
+
+auto CubeMap::GetFaceMip(std::uint32_t const face, std::uint32_t const mip) -> std::span<Vector4> {
+  auto const size{static_cast<std::size_t>(GetMipSize(mip))};
+  return std::span{texels}.subspan(GetFaceMipOffset(face, mip), size * size);
+}
+
+
+auto CubeMap::GetFaceMip(std::uint32_t const face, std::uint32_t const mip) const -> std::span<Vector4 const> {
+  auto const size{static_cast<std::size_t>(GetMipSize(mip))};
+  return std::span{texels}.subspan(GetFaceMipOffset(face, mip), size * size);
+}
+
+
+auto CreateCubeMap(std::uint32_t const face_size, std::uint32_t const mip_count) -> CubeMap {
+  CubeMap cube{
+    .face_size = face_size,
+    .mip_count = mip_count != 0 ? mip_count : static_cast<std::uint32_t>(std::bit_width(face_size)),
+    .texels = {}
+  };
+  cube.texels.resize(cube.GetFaceMipOffset(6, 0));
+  return cube;
+}
+
+
+auto ComputeCubeMapDirection(std::uint32_t const face, std::uint32_t const x, std::uint32_t const y,
+                             std::uint32_t const face_size) -> DirectX::XMFLOAT3 {
+  auto const u{2 * ((static_cast<float>(x) + 0.5f) / static_cast<float>(face_size)) - 1};
+  auto const v{2 * ((static_cast<float>(y) + 0.5f) / static_cast<float>(face_size)) - 1};
+  auto const dir{ComputeFaceDirection(face, u, v)};
+  auto const inv_length{1 / std::sqrt(dir.x * dir.x + dir.y * dir.y + dir.z * dir.z)};
+  return {dir.x * inv_length, dir.y * inv_length, dir.z * inv_length};
+}
+
+
+auto ComputeCubeMapCoords(DirectX::XMFLOAT3 const& dir) -> CubeMapCoords {
+  auto const abs_x{std::abs(dir.x)};
+  auto const abs_y{std::abs(dir.y)};
+  auto const abs_z{std::abs(dir.z)};
+
+  // Inverse of ComputeCubeMapDirection, ties go to X, then Y like on the GPU
+  std::uint32_t face;
+  float major;
+  float sc;
+  float tc;
+
+  if (abs_x >= abs_y && abs_x >= abs_z) {
+    face = dir.x >= 0 ? 0 : 1;
+    major = abs_x;
+    sc = dir.x >= 0 ? -dir.z : dir.z;
+    tc = -dir.y;
+  } else if (abs_y >= abs_z) {
+    face = dir.y >= 0 ? 2 : 3;
+    major = abs_y;
+    sc = dir.x;
+    tc = dir.y >= 0 ? dir.z : -dir.z;
+  } else {
+    face = dir.z >= 0 ? 4 : 5;
+    major = abs_z;
+    sc = dir.z >= 0 ? dir.x : -dir.x;
+    tc = -dir.y;
+  }
+
+  return {.face = face, .u = 0.5f * (sc / major + 1), .v = 0.5f * (tc / major + 1)};
+}
+
+
+auto WrapCubeMapTexel(std::uint32_t const face, std::int32_t const x, std::int32_t const y,
+                      std::uint32_t const face_size) -> CubeMapTexel {
+  auto const size{static_cast<std::int32_t>(face_size)};
+
+  if (x >= 0 && x < size && y >= 0 && y < size) {
+    return {.face = face, .x = static_cast<std::uint32_t>(x), .y = static_cast<std::uint32_t>(y)};
+  }
+
+  // The center of a texel beyond the edge lies on the neighbouring face once projected onto the cube
+  auto const u{2 * ((static_cast<float>(x) + 0.5f) / static_cast<float>(face_size)) - 1};
+  auto const v{2 * ((static_cast<float>(y) + 0.5f) / static_cast<float>(face_size)) - 1};
+  auto const coords{ComputeCubeMapCoords(ComputeFaceDirection(face, u, v))};
+  auto const to_texel{
+    [&](float const coord) {
+      return static_cast<std::uint32_t>(std::clamp(static_cast<std::int32_t>(coord * static_cast<float>(face_size)), 0,
+                                                   size - 1));
+    }
+  };
+
+  return {.face = coords.face, .x = to_texel(coords.u), .y = to_texel(coords.v)};
+}
+
+
+auto ComputeCubeMapSolidAngles(std::uint32_t const face_size) -> std::vector<float> {
+  // Area elements at the texel corners, every texel is the difference of its four corners
+  auto const corner_count{static_cast<std::size_t>(face_size) + 1};
+  std::vector<double> area_elements(corner_count * corner_count);
+
+  for (std::size_t y{0}; y < corner_count; y++) {
+    for (std::size_t x{0}; x < corner_count; x++) {
+      auto const u{2.0 * static_cast<double>(x) / face_size - 1};
+      auto const v{2.0 * static_cast<double>(y) / face_size - 1};
+      area_elements[y * corner_count + x] = ComputeFaceAreaElement(u, v);
+    }
+  }
+
+  std::vector<float> solid_angles(static_cast<std::size_t>(face_size) * face_size);
+
+  for (std::size_t y{0}; y < face_size; y++) {
+    for (std::size_t x{0}; x < face_size; x++) {
+      auto const top{y * corner_count + x};
+      auto const bottom{top + corner_count};
+      solid_angles[y * face_size + x] = static_cast<float>(area_elements[top] - area_elements[top + 1] -
+                                                           area_elements[bottom] + area_elements[bottom + 1]);
+    }
+  }
+
+  return solid_angles;
+}
+
+
+auto GetSeamlessCubeTexels(BilinearFootprint const& footprint, std::uint32_t const face,
+                           std::uint32_t const face_size) -> std::array<CubeMapTexel, 4> {
+  return {
+    WrapCubeMapTexel(face, footprint.x0, footprint.y0, face_size),
+    WrapCubeMapTexel(face, footprint.x0 + 1, footprint.y0, face_size),
+    WrapCubeMapTexel(face, footprint.x0, footprint.y0 + 1, face_size),
+    WrapCubeMapTexel(face, footprint.x0 + 1, footprint.y0 + 1, face_size)
+  };
+}
+
+
+auto SampleCubeMap(CubeMap const& cube, DirectX::XMFLOAT3 const& dir, float const mip) -> Vector4 {
+  auto const [face, u, v]{ComputeCubeMapCoords(dir)};
+  auto const clamped_mip{std::clamp(mip, 0.0f, static_cast<float>(cube.mip_count - 1))};
+  auto const mip0{static_cast<std::uint32_t>(clamped_mip)};
+  auto const mip1{std::min(mip0 + 1, cube.mip_count - 1)};
+
+  auto const sample_mip{
+    [&cube, face, u, v](std::uint32_t const mip_idx) {
+      auto const size{cube.GetMipSize(mip_idx)};
+      auto const footprint{ComputeBilinearFootprint(size, u, v)};
+      auto const texels{GetSeamlessCubeTexels(footprint, face, size)};
+      auto const fetch{
+        [&cube, mip_idx, size](CubeMapTexel const& texel) -> Vector4 const& {
+          return cube.GetFaceMip(texel.face, mip_idx)[static_cast<std::size_t>(texel.y) * size + texel.x];
+        }
+      };
+
+      auto const top{Lerp(fetch(texels[0]), fetch(texels[1]), footprint.tx)};
+      auto const bottom{Lerp(fetch(texels[2]), fetch(texels[3]), footprint.tx)};
+      return Lerp(top, bottom, footprint.ty);
+    }
+  };
+
+  auto const sample0{sample_mip(mip0)};
+
+  if (mip1 == mip0) {
+    return sample0;
+  }
+
+  auto const sample1{sample_mip(mip1)};
+  return Lerp(sample0, sample1, clamped_mip - static_cast<float>(mip0));
+}
+
+
+auto ConvertCubeToEquirect(CubeMap const& cube, std::uint32_t const width, float const mip) -> EquirectMap {
+  EquirectMap equirect{.width = width, .height = std::max(width / 2, 1u), .texels = {}};
+  equirect.texels.resize(static_cast<std::size_t>(equirect.width) * equirect.height);
+
+  for (std::uint32_t y{0}; y < equirect.height; y++) {
+    auto const lat{(static_cast<float>(y) + 0.5f) / static_cast<float>(equirect.height) * std::numbers::pi_v<float>};
+
+    for (std::uint32_t x{0}; x < equirect.width; x++) {
+      auto const lon{
+        ((static_cast<float>(x) + 0.5f) / static_cast<float>(equirect.width) - 0.5f) * 2 * std::numbers::pi_v<float>
+      };
+      DirectX::XMFLOAT3 const dir{std::sin(lat) * std::cos(lon), std::cos(lat), std::sin(lat) * std::sin(lon)};
+      equirect.texels[static_cast<std::size_t>(y) * equirect.width + x] = SampleCubeMap(cube, dir, mip);
+    }
+  }
+
+  return equirect;
+}
+}
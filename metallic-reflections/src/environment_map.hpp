@@ -0,0 +1,120 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include <DirectXMath.h>
+
+#include "scene.hpp"
+
+namespace refl {
+// RGBA32F texels, row by row from the top, like the DXGI_FORMAT_R32G32B32A32_FLOAT texture the GPU path samples
+struct EquirectMap {
+  std::uint32_t width;
+  std::uint32_t height;
+  std::vector<Vector4> texels;
+};
+
+[[nodiscard]] auto LoadEquirectMap(std::filesystem::path const& path) -> std::optional<EquirectMap>;
+
+// Bilinear footprint of a lookup in a square grid of size x size texels: the texels from x0 and y0 to x0 + 1 and y0 + 1
+// blended with tx and ty. At the edges of the grid these are up to one texel outside of it, the sampler decides what
+// they address.
+struct BilinearFootprint {
+  std::int32_t x0;
+  std::int32_t y0;
+  float tx;
+  float ty;
+};
+
+// u and v in [0, 1]
+[[nodiscard]] auto ComputeBilinearFootprint(std::uint32_t size, float u, float v) -> BilinearFootprint;
+// Row by row offsets of the texels of a footprint in the order (x0, y0), (x0 + 1, y0), (x0, y0 + 1), (x0 + 1, y0 + 1),
+// with the coordinates outside of the grid clamped to its edge
+[[nodiscard]] auto GetClampedTexelOffsets(BilinearFootprint const& footprint,
+                                          std::uint32_t size) -> std::array<std::size_t, 4>;
+
+// Bilinear footprint of a lookup in an equirect map. Longitude wraps around, so lookups beyond the center of the last
+// column blend it with the first one. Latitude is clamped, y1 is the row below y0 if there is one.
+struct EquirectFootprint {
+  std::uint32_t x0;
+  std::uint32_t x1;
+  std::uint32_t y0;
+  std::uint32_t y1;
+  float tx;
+  float ty;
+};
+
+// u and v in [0, 1]
+[[nodiscard]] auto ComputeEquirectFootprint(std::uint32_t width, std::uint32_t height, float u,
+                                            float v) -> EquirectFootprint;
+// Blends the texels of a footprint, rows holds the rows of a map of the given width from first_row on
+[[nodiscard]] auto SampleEquirectFootprint(std::span<Vector4 const> rows, std::uint32_t first_row, std::uint32_t width,
+                                           EquirectFootprint const& footprint) -> Vector4;
+
+// Bilinear lookup, wrapping around in u and clamped in v, u and v in [0, 1]
+[[nodiscard]] auto SampleEquirectMap(EquirectMap const& map, float u, float v) -> Vector4;
+
+// Cube map with a mip chain, texels stored in the subresource order of a D3D11 texture cube: every mip of face 0,
+// then every mip of face 1 and so on. Faces are in D3D order: +X, -X, +Y, -Y, +Z, -Z.
+struct CubeMap {
+  std::uint32_t face_size; // Of mip 0
+  std::uint32_t mip_count;
+  std::vector<Vector4> texels;
+
+  [[nodiscard]] auto GetMipSize(std::uint32_t mip) const -> std::uint32_t;
+  [[nodiscard]] auto GetFaceMipOffset(std::uint32_t face, std::uint32_t mip) const -> std::size_t;
+  [[nodiscard]] auto GetFaceMip(std::uint32_t face, std::uint32_t mip) -> std::span<Vector4>;
+  [[nodiscard]] auto GetFaceMip(std::uint32_t face, std::uint32_t mip) const -> std::span<Vector4 const>;
+};
+
+// Zeroed texels, a mip_count of 0 gives the full chain down to 1x1
+[[nodiscard]] auto CreateCubeMap(std::uint32_t face_size, std::uint32_t mip_count = 0) -> CubeMap;
+
+// Direction through the center of a texel of a face of the given size, in the face layout of D3D11 cube textures
+[[nodiscard]] auto ComputeCubeMapDirection(std::uint32_t face, std::uint32_t x, std::uint32_t y,
+                                           std::uint32_t face_size) -> DirectX::XMFLOAT3;
+
+// Face a direction points into and the position on it in [0, 1]
+struct CubeMapCoords {
+  std::uint32_t face;
+  float u;
+  float v;
+};
+
+[[nodiscard]] auto ComputeCubeMapCoords(DirectX::XMFLOAT3 const& dir) -> CubeMapCoords;
+
+// Texel of a face of a cube map
+struct CubeMapTexel {
+  std::uint32_t face;
+  std::uint32_t x;
+  std::uint32_t y;
+};
+
+// Treats the six faces as one surface: coordinates up to one texel beyond the edge of the face land on the touching
+// texel of the neighbouring face. Beyond a corner the texel is on one of the two neighbours. Coordinates within the
+// face are returned as they are.
+[[nodiscard]] auto WrapCubeMapTexel(std::uint32_t face, std::int32_t x, std::int32_t y,
+                                    std::uint32_t face_size) -> CubeMapTexel;
+
+// Solid angles the texels of a face subtend, row by row. They are the same for every face and add up to 4 pi / 6.
+[[nodiscard]] auto ComputeCubeMapSolidAngles(std::uint32_t face_size) -> std::vector<float>;
+
+// Texels of a footprint on a face of the given size in the order of GetClampedTexelOffsets. Coordinates beyond the edge
+// of the face continue on the neighbouring faces through WrapCubeMapTexel.
+[[nodiscard]] auto GetSeamlessCubeTexels(BilinearFootprint const& footprint, std::uint32_t face,
+                                         std::uint32_t face_size) -> std::array<CubeMapTexel, 4>;
+
+// Trilinear lookup along an unnormalized direction. Bilinear footprints at the edge of a face blend across it like
+// seamless hardware cube filtering.
+[[nodiscard]] auto SampleCubeMap(CubeMap const& cube, DirectX::XMFLOAT3 const& dir, float mip) -> Vector4;
+
+// Resamples a cube map to an equirect map of the given width and half as many rows, through SampleCubeMap at the given
+// mip. The inverse of the mapping of ConvertEquirectToCube.
+[[nodiscard]] auto ConvertCubeToEquirect(CubeMap const& cube, std::uint32_t width, float mip) -> EquirectMap;
+}
@@ -0,0 +1,144 @@
+#include "environment_sampling.hpp"
+
+#include "brdf.hpp"
+
+import std;
+
+namespace refl {
+namespace {
+// Rec. 709 luminance
+auto ComputeLuminance(Vector4 const& texel) -> float {
+  return 0.2126f * texel[0] + 0.7152f * texel[1] + 0.0722f * texel[2];
+}
+
+
+// Writes the normalized running sum of the weights, one entry more than there are weights. If they are all zero, every
+// slot is equally likely.
+auto BuildCdf(std::span<double const> const weights, std::span<float> const cdf) -> void {
+  auto const sum{std::accumulate(weights.begin(), weights.end(), 0.0)};
+  auto running_sum{0.0};
+  cdf[0] = 0;
+
+  for (std::size_t i{0}; i < weights.size(); i++) {
+    running_sum += sum > 0 ? weights[i] : 1.0;
+    cdf[i + 1] = static_cast<float>(running_sum / (sum > 0 ? sum : static_cast<double>(weights.size())));
+  }
+
+  cdf.back() = 1;
+}
+
+
+// Finds the slot of the CDF xi falls into. The position of xi within the slot is rescaled to a fresh number in [0, 1),
+// so it can place the sample within the slot.
+auto SampleCdf(std::span<float const> const cdf, float const xi) -> std::pair<std::uint32_t, float> {
+  // Slots of zero probability are never found, their ends are equal
+  auto const slot{
+    static_cast<std::uint32_t>(std::upper_bound(cdf.begin() + 1, cdf.end() - 1, xi) - cdf.begin() - 1)
+  };
+  auto const slot_width{cdf[slot + 1] - cdf[slot]};
+  auto const remainder{slot_width > 0 ? (xi - cdf[slot]) / slot_width : 0.5f};
+  return {slot, std::clamp(remainder, 0.0f, std::nextafter(1.0f, 0.0f))};
+}
+
+
+// Cosine of the polar angle of the top edge of a row, the mapping of ConvertEquirectToCube
+auto GetRowEdgeCosine(std::uint32_t const row, std::uint32_t const height) -> double {
+  return std::cos(std::numbers::pi * row / height);
+}
+}
+
+
+auto BuildEnvironmentDistribution(EquirectMap const& equirect,
+                                  std::uint32_t const max_width) -> EnvironmentDistribution {
+  auto const cell_size{(equirect.width + max_width - 1) / max_width};
+  auto const width{(equirect.width + cell_size - 1) / cell_size};
+  auto const height{(equirect.height + cell_size - 1) / cell_size};
+  auto const cell_count{static_cast<std::size_t>(width) * height};
+
+  // Average luminance of every cell times its solid angle
+  std::vector<double> luminances(cell_count, 0.0);
+
+  for (std::uint32_t y{0}; y < equirect.height; y++) {
+    for (std::uint32_t x{0}; x < equirect.width; x++) {
+      luminances[static_cast<std::size_t>(y / cell_size) * width + x / cell_size] +=
+        std::max(ComputeLuminance(equirect.texels[static_cast<std::size_t>(y) * equirect.width + x]), 0.0f);
+    }
+  }
+
+  std::vector<double> solid_angles(height);
+  std::vector<double> weights(cell_count);
+  std::vector<double> row_weights(height);
+
+  for (std::uint32_t y{0}; y < height; y++) {
+    auto const cell_height{std::min(equirect.height, (y + 1) * cell_size) - y * cell_size};
+    solid_angles[y] = 2 * std::numbers::pi / width * (GetRowEdgeCosine(y, height) - GetRowEdgeCosine(y + 1, height));
+
+    for (std::uint32_t x{0}; x < width; x++) {
+      auto const cell_width{std::min(equirect.width, (x + 1) * cell_size) - x * cell_size};
+      auto const idx{static_cast<std::size_t>(y) * width + x};
+      weights[idx] = luminances[idx] / (cell_width * cell_height) * solid_angles[y];
+      row_weights[y] += weights[idx];
+    }
+  }
+
+  EnvironmentDistribution distribution{
+    .width = width,
+    .height = height,
+    .row_cdf = std::vector<float>(height + 1),
+    .column_cdfs = std::vector<float>(static_cast<std::size_t>(width + 1) * height),
+    .pdfs = std::vector<float>(cell_count)
+  };
+
+  BuildCdf(row_weights, distribution.row_cdf);
+  auto const total_weight{std::accumulate(row_weights.begin(), row_weights.end(), 0.0)};
+
+  for (std::uint32_t y{0}; y < height; y++) {
+    auto const row_offset{static_cast<std::size_t>(y) * width};
+    auto const row{std::span{weights}.subspan(row_offset, width)};
+    BuildCdf(row, std::span{distribution.column_cdfs}.subspan(static_cast<std::size_t>(y) * (width + 1), width + 1));
+
+    for (std::uint32_t x{0}; x < width; x++) {
+      // An all black map is sampled uniformly. The uniform CDF of a black row in a lit map is never used.
+      auto const probability{total_weight > 0 ? row[x] / total_weight : 1.0 / static_cast<double>(cell_count)};
+      distribution.pdfs[row_offset + x] = static_cast<float>(probability / solid_angles[y]);
+    }
+  }
+
+  return distribution;
+}
+
+
+auto SampleEnvironment(EnvironmentDistribution const& distribution,
+                       std::array<float, 2> const& xi) -> EnvironmentSample {
+  auto const& [width, height, row_cdf, column_cdfs, pdfs]{distribution};
+  auto const [y, v]{SampleCdf(row_cdf, xi[1])};
+  auto const [x, u]{
+    SampleCdf(std::span{column_cdfs}.subspan(static_cast<std::size_t>(y) * (width + 1), width + 1), xi[0])
+  };
+
+  // Uniform over the solid angle of the cell, which is uniform in the longitude and the cosine of the polar angle
+  auto const cos_top{static_cast<float>(GetRowEdgeCosine(y, height))};
+  auto const cos_bottom{static_cast<float>(GetRowEdgeCosine(y + 1, height))};
+  auto const cos_theta{std::clamp(cos_top + (cos_bottom - cos_top) * v, -1.0f, 1.0f)};
+  auto const sin_theta{std::sqrt(std::max(0.0f, 1 - cos_theta * cos_theta))};
+  auto const phi{((static_cast<float>(x) + u) / static_cast<float>(width) - 0.5f) * 2 * kPi};
+
+  return {
+    .dir = {sin_theta * std::cos(phi), cos_theta, sin_theta * std::sin(phi)},
+    .pdf = pdfs[static_cast<std::size_t>(y) * width + x]
+  };
+}
+
+
+auto ComputeEnvironmentPdf(EnvironmentDistribution const& distribution, DirectX::XMFLOAT3 const& dir) -> float {
+  auto const u{std::atan2(dir.z, dir.x) / (2 * kPi) + 0.5f};
+  auto const v{std::acos(std::clamp(dir.y, -1.0f, 1.0f)) / kPi};
+  auto const x{
+    std::min(static_cast<std::uint32_t>(u * static_cast<float>(distribution.width)), distribution.width - 1)
+  };
+  auto const y{
+    std::min(static_cast<std::uint32_t>(v * static_cast<float>(distribution.height)), distribution.height - 1)
+  };
+  return distribution.pdfs[static_cast<std::size_t>(y) * distribution.width + x];
+}
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include <DirectXMath.h>
+
+#include "environment_map.hpp"
+
+namespace refl {
+// Piecewise constant distribution over the sphere proportional to the luminance of an equirect map, for importance
+// sampling the environment. A row is drawn by inverting the marginal CDF, then a column by inverting the CDF of the
+// row, then a direction uniformly over the solid angle of the cell. Inverting CDFs keeps the stratification of low
+// discrepancy sequences, which an alias table would scramble.
+struct EnvironmentDistribution {
+  std::uint32_t width;
+  std::uint32_t height;
+  std::vector<float> row_cdf; // height + 1 entries from 0 to 1
+  std::vector<float> column_cdfs; // width + 1 entries from 0 to 1 per row
+  std::vector<float> pdfs; // Solid angle density of every cell, row by row
+};
+
+struct EnvironmentSample {
+  DirectX::XMFLOAT3 dir;
+  float pdf; // Solid angle density
+};
+
+// Maps wider than max_width are box filtered into cells of several texels first, which bounds the size of the tables
+[[nodiscard]] auto BuildEnvironmentDistribution(EquirectMap const& equirect,
+                                                std::uint32_t max_width) -> EnvironmentDistribution;
+// xi in [0, 1)^2
+[[nodiscard]] auto SampleEnvironment(EnvironmentDistribution const& distribution,
+                                     std::array<float, 2> const& xi) -> EnvironmentSample;
+// Density SampleEnvironment draws a unit direction with
+[[nodiscard]] auto ComputeEnvironmentPdf(EnvironmentDistribution const& distribution,
+                                         DirectX::XMFLOAT3 const& dir) -> float;
+}
@@ -0,0 +1,53 @@
+#include "frustum.hpp"
+
+import std;
+
+namespace refl {
+auto ComputeFrustum(DirectX::XMFLOAT4X4 const& view_mtx, DirectX::XMFLOAT4X4 const& proj_mtx) -> Frustum {
+  namespace dx = DirectX;
+
+  dx::XMFLOAT4X4 view_proj_mtx;
+  dx::XMStoreFloat4x4(&view_proj_mtx,
+                      dx::XMMatrixMultiply(dx::XMLoadFloat4x4(&view_mtx), dx::XMLoadFloat4x4(&proj_mtx)));
+
+  // Gribb and Hartmann, with row vectors the clip space coordinates are dot products with the columns.
+  // D3D clip space z is in [0, w].
+  auto const column{
+    [&view_proj_mtx](int const col) {
+      return std::array{view_proj_mtx.m[0][col], view_proj_mtx.m[1][col], view_proj_mtx.m[2][col],
+                        view_proj_mtx.m[3][col]};
+    }
+  };
+
+  auto const x{column(0)};
+  auto const y{column(1)};
+  auto const z{column(2)};
+  auto const w{column(3)};
+
+  std::array const unnormalized_planes{
+    std::array{w[0] + x[0], w[1] + x[1], w[2] + x[2], w[3] + x[3]},
+    std::array{w[0] - x[0], w[1] - x[1], w[2] - x[2], w[3] - x[3]},
+    std::array{w[0] + y[0], w[1] + y[1], w[2] + y[2], w[3] + y[3]},
+    std::array{w[0] - y[0], w[1] - y[1], w[2] - y[2], w[3] - y[3]},
+    z,
+    std::array{w[0] - z[0], w[1] - z[1], w[2] - z[2], w[3] - z[3]},
+  };
+
+  Frustum frustum;
+
+  for (std::size_t i{0}; i < unnormalized_planes.size(); i++) {
+    auto const& plane{unnormalized_planes[i]};
+    auto const length{std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2])};
+    frustum.planes[i] = dx::XMFLOAT4{plane[0] / length, plane[1] / length, plane[2] / length, plane[3] / length};
+  }
+
+  return frustum;
+}
+
+
+auto IsSphereInFrustum(Frustum const& frustum, DirectX::XMFLOAT3 const& center, float const radius) -> bool {
+  return std::ranges::all_of(frustum.planes, [&center, radius](DirectX::XMFLOAT4 const& plane) {
+    return plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w >= -radius;
+  });
+}
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <array>
+
+#include <DirectXMath.h>
+
+namespace refl {
+// World space planes pointing inwards, xyz is the unit normal and w the distance, in the order left, right, bottom,
+// top, near, far.
+struct Frustum {
+  std::array<DirectX::XMFLOAT4, 6> planes;
+};
+
+// For the row-vector matrices returned by OrbitingCamera
+[[nodiscard]] auto ComputeFrustum(DirectX::XMFLOAT4X4 const& view_mtx, DirectX::XMFLOAT4X4 const& proj_mtx) -> Frustum;
+
+// Conservative, may report spheres near the corners of the frustum as visible
+[[nodiscard]] auto IsSphereInFrustum(Frustum const& frustum, DirectX::XMFLOAT3 const& center, float radius) -> bool;
+}
@@ -0,0 +1,338 @@
+#include "gpu_scene.hpp"
+
+#include "parallel.hpp"
+#include "vertex_packing.hpp"
+
+import std;
+
+namespace refl {
+namespace {
+// D3D11 rejects buffers of 0 bytes, so the buffers of an empty scene hold a single zeroed element that is never read
+template<typename T>
+auto GetBufferElements(std::vector<T> const& data) -> std::span<T const> {
+  static T const zero{};
+  return data.empty() ? std::span{&zero, 1} : std::span{data};
+}
+
+
+template<typename T>
+auto CreateVertexBuffer(ID3D11Device& dev, std::vector<T> const& data,
+                        Microsoft::WRL::ComPtr<ID3D11Buffer>& buf) -> bool {
+  auto const elements{GetBufferElements(data)};
+
+  D3D11_BUFFER_DESC const buf_desc{
+    .ByteWidth = static_cast<UINT>(elements.size_bytes()),
+    .Usage = D3D11_USAGE_DEFAULT,
+    .BindFlags = D3D11_BIND_VERTEX_BUFFER,
+    .CPUAccessFlags = 0,
+    .MiscFlags = 0,
+    .StructureByteStride = 0
+  };
+
+  D3D11_SUBRESOURCE_DATA const buf_data{
+    .pSysMem = elements.data(),
+    .SysMemPitch = 0,
+    .SysMemSlicePitch = 0
+  };
+
+  return SUCCEEDED(dev.CreateBuffer(&buf_desc, &buf_data, &buf));
+}
+
+
+template<typename T>
+auto CreateStructuredBuffer(ID3D11Device& dev, std::vector<T> const& data, Microsoft::WRL::ComPtr<ID3D11Buffer>& buf,
+                            Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>& srv) -> bool {
+  auto const elements{GetBufferElements(data)};
+
+  D3D11_BUFFER_DESC const buf_desc{
+    .ByteWidth = static_cast<UINT>(elements.size_bytes()),
+    .Usage = D3D11_USAGE_IMMUTABLE,
+    .BindFlags = D3D11_BIND_SHADER_RESOURCE,
+    .CPUAccessFlags = 0,
+    .MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED,
+    .StructureByteStride = static_cast<UINT>(sizeof(T))
+  };
+
+  D3D11_SUBRESOURCE_DATA const buf_data{
+    .pSysMem = elements.data(),
+    .SysMemPitch = 0,
+    .SysMemSlicePitch = 0
+  };
+
+  if (FAILED(dev.CreateBuffer(&buf_desc, &buf_data, &buf))) {
+    return false;
+  }
+
+  D3D11_SHADER_RESOURCE_VIEW_DESC const srv_desc{
+    .Format = DXGI_FORMAT_UNKNOWN,
+    .ViewDimension = D3D11_SRV_DIMENSION_BUFFEREX,
+    .BufferEx = {.FirstElement = 0, .NumElements = static_cast<UINT>(elements.size()), .Flags = 0}
+  };
+
+  return SUCCEEDED(dev.CreateShaderResourceView(buf.Get(), &srv_desc, &srv));
+}
+
+
+// Creates the per-vertex buffers and strides of gpu_scene from the streams of either vertex layout
+template<typename Position, typename Normal, typename Texcoord, typename Tangent>
+auto CreateVertexStreams(ID3D11Device& dev, std::vector<Position> const& positions,
+                         std::vector<Normal> const& normals, std::vector<Texcoord> const& texcoords,
+                         std::vector<Tangent> const& tangents, GpuScene& gpu_scene) -> bool {
+  if (!CreateVertexBuffer(dev, positions, gpu_scene.pos_buf)) {
+    std::cerr << "Failed to create position buffer\n";
+    return false;
+  }
+
+  if (!CreateVertexBuffer(dev, normals, gpu_scene.norm_buf)) {
+    std::cerr << "Failed to create normal buffer\n";
+    return false;
+  }
+
+  if (texcoords.empty()) {
+    gpu_scene.uv_buf = gpu_scene.null_vertex_buf;
+  } else if (!CreateVertexBuffer(dev, texcoords, gpu_scene.uv_buf)) {
+    std::cerr << "Failed to create uv buffer\n";
+    return false;
+  }
+
+  if (tangents.empty()) {
+    gpu_scene.tan_buf = gpu_scene.null_vertex_buf;
+  } else if (!CreateVertexBuffer(dev, tangents, gpu_scene.tan_buf)) {
+    std::cerr << "Failed to create tangent buffer\n";
+    return false;
+  }
+
+  gpu_scene.vertex_strides = {
+    static_cast<UINT>(sizeof(Position)),
+    static_cast<UINT>(sizeof(Normal)),
+    texcoords.empty() ? 0u : static_cast<UINT>(sizeof(Texcoord)),
+    tangents.empty() ? 0u : static_cast<UINT>(sizeof(Tangent)),
+    static_cast<UINT>(sizeof(DrawInstance))
+  };
+
+  return true;
+}
+
+
+auto GetTextureFormat(TextureUsage const usage) -> DXGI_FORMAT {
+  switch (usage) {
+    case TextureUsage::BaseColor:
+      return DXGI_FORMAT_R8G8B8A8_UNORM_SRGB;
+    case TextureUsage::Normal:
+      return DXGI_FORMAT_R8G8B8A8_UNORM;
+    case TextureUsage::Roughness:
+    case TextureUsage::PackedRoughness:
+      return DXGI_FORMAT_R8_UNORM;
+  }
+
+  return DXGI_FORMAT_UNKNOWN;
+}
+
+
+auto CreateTexture(ID3D11Device& dev, TextureImage const& image,
+                   Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>& srv) -> bool {
+  D3D11_TEXTURE2D_DESC const tex_desc{
+    .Width = image.mips[0].width,
+    .Height = image.mips[0].height,
+    .MipLevels = static_cast<UINT>(image.mips.size()),
+    .ArraySize = 1,
+    .Format = GetTextureFormat(image.usage),
+    .SampleDesc = {.Count = 1, .Quality = 0},
+    .Usage = D3D11_USAGE_IMMUTABLE,
+    .BindFlags = D3D11_BIND_SHADER_RESOURCE,
+    .CPUAccessFlags = 0,
+    .MiscFlags = 0
+  };
+
+  std::vector<D3D11_SUBRESOURCE_DATA> tex_data;
+  tex_data.reserve(image.mips.size());
+
+  for (auto const& mip : image.mips) {
+    tex_data.push_back(D3D11_SUBRESOURCE_DATA{
+      .pSysMem = image.texels.data() + mip.offset,
+      .SysMemPitch = mip.width * GetTexelSize(image.usage),
+      .SysMemSlicePitch = 0
+    });
+  }
+
+  Microsoft::WRL::ComPtr<ID3D11Texture2D> tex;
+
+  if (FAILED(dev.CreateTexture2D(&tex_desc, tex_data.data(), &tex))) {
+    return false;
+  }
+
+  D3D11_SHADER_RESOURCE_VIEW_DESC const srv_desc{
+    .Format = tex_desc.Format,
+    .ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D,
+    .Texture2D = {.MostDetailedMip = 0, .MipLevels = tex_desc.MipLevels}
+  };
+
+  return SUCCEEDED(dev.CreateShaderResourceView(tex.Get(), &srv_desc, &srv));
+}
+}
+
+
+auto CreateGpuScene(CpuScene const& cpu_scene, SceneTextures const& textures, VertexLayout const vertex_layout,
+                    ID3D11Device& dev) -> std::optional<GpuScene> {
+  GpuScene gpu_scene;
+
+  {
+    // Zeroes for every vertex element, read by all vertices through a stride of 0
+    std::array<std::byte, 16> constexpr null_vertex_data{};
+
+    D3D11_BUFFER_DESC constexpr null_vertex_buf_desc{
+      .ByteWidth = static_cast<UINT>(null_vertex_data.size()),
+      .Usage = D3D11_USAGE_IMMUTABLE,
+      .BindFlags = D3D11_BIND_VERTEX_BUFFER,
+      .CPUAccessFlags = 0,
+      .MiscFlags = 0,
+      .StructureByteStride = 0
+    };
+
+    D3D11_SUBRESOURCE_DATA const null_vertex_buf_data{
+      .pSysMem = null_vertex_data.data(),
+      .SysMemPitch = 0,
+      .SysMemSlicePitch = 0
+    };
+
+    if (FAILED(dev.CreateBuffer(&null_vertex_buf_desc, &null_vertex_buf_data, &gpu_scene.null_vertex_buf))) {
+      std::cerr << "Failed to create null vertex buffer\n";
+      return std::nullopt;
+    }
+  }
+
+  gpu_scene.vertex_layout = vertex_layout;
+  auto pools{BuildScenePools(cpu_scene, vertex_layout, GetDefaultThreadCount())};
+
+  if (vertex_layout == VertexLayout::kPacked
+        ? !CreateVertexStreams(dev, pools.positions, pools.normals, pools.texcoords, pools.tangents, gpu_scene)
+        : !CreateVertexStreams(dev, pools.float_positions, pools.float_normals, pools.float_texcoords,
+                               pools.float_tangents, gpu_scene)) {
+    return std::nullopt;
+  }
+
+  {
+    // Sized for every instance, each frame overwrites the beginning with the visible ones
+    auto const draw_instances{GetBufferElements(pools.draw_instances)};
+
+    D3D11_BUFFER_DESC const draw_instance_buf_desc{
+      .ByteWidth = static_cast<UINT>(draw_instances.size_bytes()),
+      .Usage = D3D11_USAGE_DYNAMIC,
+      .BindFlags = D3D11_BIND_VERTEX_BUFFER,
+      .CPUAccessFlags = D3D11_CPU_ACCESS_WRITE,
+      .MiscFlags = 0,
+      .StructureByteStride = 0
+    };
+
+    D3D11_SUBRESOURCE_DATA const draw_instance_buf_data{
+      .pSysMem = draw_instances.data(),
+      .SysMemPitch = 0,
+      .SysMemSlicePitch = 0
+    };
+
+    if (FAILED(dev.CreateBuffer(&draw_instance_buf_desc, &draw_instance_buf_data, &gpu_scene.draw_instance_buf))) {
+      std::cerr << "Failed to create draw instance buffer\n";
+      return std::nullopt;
+    }
+  }
+
+  {
+    auto const indices{GetBufferElements(pools.indices)};
+
+    D3D11_BUFFER_DESC const idx_buf_desc{
+      .ByteWidth = static_cast<UINT>(indices.size_bytes()),
+      .Usage = D3D11_USAGE_DEFAULT,
+      .BindFlags = D3D11_BIND_INDEX_BUFFER,
+      .CPUAccessFlags = 0,
+      .MiscFlags = 0,
+      .StructureByteStride = 0
+    };
+
+    D3D11_SUBRESOURCE_DATA const idx_buf_data{
+      .pSysMem = indices.data(),
+      .SysMemPitch = 0,
+      .SysMemSlicePitch = 0
+    };
+
+    if (FAILED(dev.CreateBuffer(&idx_buf_desc, &idx_buf_data, &gpu_scene.idx_buf))) {
+      std::cerr << "Failed to create index buffer\n";
+      return std::nullopt;
+    }
+  }
+
+  if (!CreateStructuredBuffer(dev, pools.transforms, gpu_scene.transform_buf, gpu_scene.transform_srv)) {
+    std::cerr << "Failed to create transform buffer\n";
+    return std::nullopt;
+  }
+
+  gpu_scene.texture_srvs.resize(textures.images.size());
+
+  for (std::size_t i{0}; i < textures.images.size(); i++) {
+    if (!CreateTexture(dev, textures.images[i], gpu_scene.texture_srvs[i])) {
+      std::cerr << "Failed to create material texture\n";
+      return std::nullopt;
+    }
+  }
+
+  gpu_scene.material_maps.reserve(cpu_scene.materials.size());
+
+  for (std::size_t i{0}; i < cpu_scene.materials.size(); i++) {
+    auto const& cpu_mtl{cpu_scene.materials[i]};
+    auto& mtl{pools.materials[i]};
+
+    auto const get_srv{
+      [&gpu_scene, &textures](std::uint32_t const texture_idx) -> ID3D11ShaderResourceView* {
+        if (texture_idx == kNoTexture || textures.image_indices[texture_idx] == kNoTexture) {
+          return nullptr;
+        }
+
+        return gpu_scene.texture_srvs[textures.image_indices[texture_idx]].Get();
+      }
+    };
+
+    auto const& maps{
+      gpu_scene.material_maps.emplace_back(std::array{
+        get_srv(cpu_mtl.base_color_map_idx), get_srv(cpu_mtl.roughness_map_idx), get_srv(cpu_mtl.normal_map_idx)
+      })
+    };
+
+    // Maps that failed to load fall back to the constant material values
+    mtl.has_base_color_map = maps[0] != nullptr;
+    mtl.has_roughness_map = maps[1] != nullptr;
+    mtl.has_normal_map = maps[2] != nullptr;
+  }
+
+  if (!CreateStructuredBuffer(dev, pools.materials, gpu_scene.mtl_buf, gpu_scene.mtl_srv)) {
+    std::cerr << "Failed to create material buffer\n";
+    return std::nullopt;
+  }
+
+  std::size_t unpacked_vertex_bytes{0};
+
+  for (auto const& cpu_mesh : cpu_scene.meshes) {
+    unpacked_vertex_bytes += GetUnpackedVertexDataSize(cpu_mesh);
+  }
+
+  auto constexpr bytes_per_mib{1024.0 * 1024.0};
+
+  if (vertex_layout == VertexLayout::kPacked) {
+    auto const packed_vertex_bytes{
+      pools.positions.size() * sizeof(PackedPosition) + pools.normals.size() * sizeof(PackedNormal) +
+      pools.texcoords.size() * sizeof(PackedTexcoord) + pools.tangents.size() * sizeof(PackedTangent)
+    };
+
+    std::cout << std::format("Vertex data: {:.2f} MiB packed instead of {:.2f} MiB, saved {:.2f} MiB.\n",
+                             packed_vertex_bytes / bytes_per_mib, unpacked_vertex_bytes / bytes_per_mib,
+                             (static_cast<double>(unpacked_vertex_bytes) - static_cast<double>(packed_vertex_bytes)) /
+                             bytes_per_mib);
+  } else {
+    std::cout << std::format("Vertex data: {:.2f} MiB unpacked.\n", unpacked_vertex_bytes / bytes_per_mib);
+  }
+
+  std::cout << std::format("Instances: {} of {} unique meshes in {} draws.\n", cpu_scene.instances.size(),
+                           cpu_scene.meshes.size(), pools.draws.size());
+
+  gpu_scene.culling_scene = BuildCullingScene(pools);
+  return gpu_scene;
+}
+}
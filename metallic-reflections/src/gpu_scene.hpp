@@ -0,0 +1,44 @@
+#pragma once
+
+#include <array>
+#include <optional>
+#include <vector>
+
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <d3d11_4.h>
+#include <wrl/client.h>
+
+#include "scene.hpp"
+#include "scene_batching.hpp"
+#include "scene_culling.hpp"
+#include "scene_textures.hpp"
+
+namespace refl {
+// The whole scene in a single set of buffers, see ScenePools. Everything is bound once per pass, the draws only
+// differ in their offsets.
+struct GpuScene {
+  VertexLayout vertex_layout; // Of the vertex buffers, selects the vertex shader and input layout
+  Microsoft::WRL::ComPtr<ID3D11Buffer> pos_buf; // PackedPositions or float4s
+  Microsoft::WRL::ComPtr<ID3D11Buffer> norm_buf; // PackedNormals or float4s
+  Microsoft::WRL::ComPtr<ID3D11Buffer> uv_buf; // PackedTexcoords, float2s or null_vertex_buf
+  Microsoft::WRL::ComPtr<ID3D11Buffer> tan_buf; // PackedTangents, float4s or null_vertex_buf
+  Microsoft::WRL::ComPtr<ID3D11Buffer> draw_instance_buf; // Dynamic, VisibleDraws::draw_instances of the frame
+  std::array<UINT, 5> vertex_strides; // In the order of the buffers above, 0 for absent streams
+  Microsoft::WRL::ComPtr<ID3D11Buffer> idx_buf; // u32s
+  Microsoft::WRL::ComPtr<ID3D11Buffer> transform_buf;
+  Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> transform_srv; // InstanceTransforms
+  Microsoft::WRL::ComPtr<ID3D11Buffer> mtl_buf;
+  Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> mtl_srv; // Materials
+  std::vector<Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>> texture_srvs; // One per SceneTextures::images
+  // Base color, roughness and normal map of every material, bound from MATERIAL_BASE_COLOR_MAP_SLOT on per draw.
+  // Null for the maps a material does not have, owned by texture_srvs.
+  std::vector<std::array<ID3D11ShaderResourceView*, 3>> material_maps;
+  CullingScene culling_scene;
+  Microsoft::WRL::ComPtr<ID3D11Buffer> null_vertex_buf; // Bound with a stride of 0 in place of absent streams
+};
+
+
+auto CreateGpuScene(CpuScene const& cpu_scene, SceneTextures const& textures, VertexLayout vertex_layout,
+                    ID3D11Device& dev) -> std::optional<GpuScene>;
+}
@@ -0,0 +1,340 @@
+#include "hdr_decoder.hpp"
+
+#include <emmintrin.h>
+
+#include "pixel_packing.hpp"
+
+import std;
+
+namespace refl {
+namespace {
+std::size_t constexpr kReadBufferSize{64 * 1024};
+// Longest header line accepted, like stb_image
+std::size_t constexpr kMaxHeaderLineLength{1023};
+
+// New style RLE is only used for scanlines in this width range
+std::uint32_t constexpr kMinRleWidth{8};
+std::uint32_t constexpr kMaxRleWidth{0x7FFF};
+
+// Largest width and height accepted, like stb_image
+std::uint32_t constexpr kMaxDimension{1 << 24};
+
+float constexpr kMaxHalf{65504.0f};
+// Texels converted to half at a time
+std::size_t constexpr kHalfConversionChunkSize{256};
+
+
+// The value of an RGBE channel is mantissa * 2^(exponent - 136). Mantissas have 8 bits and the scales never
+// underflow, so splitting the scale into two normal powers of two rounds only once, in the second multiplication,
+// exactly like the single multiplication by a denormal scale in stb_image.
+auto RgbeToFloat(std::span<std::uint8_t const, 4> const rgbe) -> Vector4 {
+  if (rgbe[3] == 0) {
+    return {0, 0, 0, 1};
+  }
+
+  auto const scale{std::ldexp(1.0f, rgbe[3] - (128 + 8))};
+  return {rgbe[0] * scale, rgbe[1] * scale, rgbe[2] * scale, 1};
+}
+
+
+// Four RGBE texels to four RGBA float vectors
+auto RgbeToFloatSse2(std::uint8_t const* const rgbe, std::array<__m128, 4>& texels) -> void {
+  auto const zero{_mm_setzero_si128()};
+  auto const bias{_mm_set1_epi32(127 - 68)};
+  auto const rgb_mask{_mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0))};
+  auto const alpha{_mm_setr_ps(0, 0, 0, 1)};
+
+  auto const bytes{_mm_loadu_si128(reinterpret_cast<__m128i const*>(rgbe))};
+  auto const lo{_mm_unpacklo_epi8(bytes, zero)};
+  auto const hi{_mm_unpackhi_epi8(bytes, zero)};
+  std::array const ints{
+    _mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero), _mm_unpacklo_epi16(hi, zero),
+    _mm_unpackhi_epi16(hi, zero)
+  };
+
+  for (std::size_t i{0}; i < 4; i++) {
+    auto const exponent{_mm_shuffle_epi32(ints[i], _MM_SHUFFLE(3, 3, 3, 3))};
+    auto const exponent_lo{_mm_srli_epi32(exponent, 1)};
+    auto const scale_lo{_mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(exponent_lo, bias), 23))};
+    auto const scale_hi{
+      _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_sub_epi32(exponent, exponent_lo), bias), 23))
+    };
+    auto const value{_mm_mul_ps(_mm_mul_ps(_mm_cvtepi32_ps(ints[i]), scale_lo), scale_hi)};
+    // A zero exponent means black, whatever the mantissas
+    auto const is_zero{_mm_castsi128_ps(_mm_cmpeq_epi32(exponent, zero))};
+    texels[i] = _mm_or_ps(_mm_andnot_ps(is_zero, _mm_and_ps(value, rgb_mask)), alpha);
+  }
+}
+
+
+auto ConvertScanline(std::span<std::uint8_t const> const rgbe, std::span<Vector4> const texels) -> void {
+  std::size_t x{0};
+
+  for (std::array<__m128, 4> values; x + 4 <= texels.size(); x += 4) {
+    RgbeToFloatSse2(&rgbe[4 * x], values);
+
+    for (std::size_t i{0}; i < 4; i++) {
+      _mm_storeu_ps(texels[x + i].data(), values[i]);
+    }
+  }
+
+  for (; x < texels.size(); x++) {
+    texels[x] = RgbeToFloat(rgbe.subspan(4 * x).first<4>());
+  }
+}
+
+
+// Converts through a float buffer small enough to stay in the L1 cache
+auto ConvertScanline(std::span<std::uint8_t const> const rgbe, std::span<HalfVector4> const texels) -> void {
+  std::array<Vector4, kHalfConversionChunkSize> values;
+
+  for (std::size_t x{0}; x < texels.size(); x += values.size()) {
+    auto const chunk{std::span{values}.first(std::min(values.size(), texels.size() - x))};
+    ConvertScanline(rgbe.subspan(4 * x, 4 * chunk.size()), chunk);
+
+    for (auto& value : chunk) {
+      for (auto& channel : value) {
+        channel = std::min(channel, kMaxHalf);
+      }
+    }
+
+    ConvertFloatsToHalves(chunk, texels.subspan(x, chunk.size()));
+  }
+}
+
+
+// Parses a prefix followed by a number, advancing the text past them and the spaces after the number
+auto ParseDimension(std::string_view& text, std::string_view const prefix) -> std::optional<std::uint32_t> {
+  if (!text.starts_with(prefix)) {
+    return std::nullopt;
+  }
+
+  // Spaces around the number are skipped like strtol in stb_image does
+  text.remove_prefix(prefix.size());
+  text.remove_prefix(std::min(text.find_first_not_of(' '), text.size()));
+
+  std::uint32_t value;
+  auto const [end, ec]{std::from_chars(text.data(), text.data() + text.size(), value)};
+
+  if (ec != std::errc{} || value == 0 || value > kMaxDimension) {
+    return std::nullopt;
+  }
+
+  text.remove_prefix(static_cast<std::size_t>(end - text.data()));
+  text.remove_prefix(std::min(text.find_first_not_of(' '), text.size()));
+  return value;
+}
+}
+
+
+auto HdrDecoder::New(std::filesystem::path const& path) -> std::unique_ptr<HdrDecoder> {
+  std::ifstream file{path, std::ios::binary};
+
+  if (!file) {
+    return nullptr;
+  }
+
+  std::unique_ptr<HdrDecoder> decoder{new HdrDecoder{std::move(file)}};
+
+  if (!decoder->ReadHeader()) {
+    return nullptr;
+  }
+
+  return decoder;
+}
+
+
+auto HdrDecoder::GetWidth() const -> std::uint32_t {
+  return width_;
+}
+
+
+auto HdrDecoder::GetHeight() const -> std::uint32_t {
+  return height_;
+}
+
+
+auto HdrDecoder::GetNextRow() const -> std::uint32_t {
+  return next_row_;
+}
+
+
+auto HdrDecoder::DecodeRows(std::span<Vector4> const rows) -> bool {
+  return DecodeRows(rows, [](std::span<std::uint8_t const> const rgbe, std::span<Vector4> const texels) {
+    ConvertScanline(rgbe, texels);
+  });
+}
+
+
+auto HdrDecoder::DecodeRows(std::span<HalfVector4> const rows) -> bool {
+  return DecodeRows(rows, [](std::span<std::uint8_t const> const rgbe, std::span<HalfVector4> const texels) {
+    ConvertScanline(rgbe, texels);
+  });
+}
+
+
+HdrDecoder::HdrDecoder(std::ifstream file) :
+  file_{std::move(file)}, read_buffer_(kReadBufferSize), read_pos_{0}, read_size_{0}, width_{0}, height_{0},
+  next_row_{0}, flat_{false} {
+}
+
+
+auto HdrDecoder::ReadBytes(std::span<std::uint8_t> bytes) -> bool {
+  while (!bytes.empty()) {
+    if (read_pos_ == read_size_) {
+      file_.read(read_buffer_.data(), static_cast<std::streamsize>(read_buffer_.size()));
+      read_pos_ = 0;
+      read_size_ = static_cast<std::size_t>(file_.gcount());
+
+      if (read_size_ == 0) {
+        return false;
+      }
+    }
+
+    auto const count{std::min(bytes.size(), read_size_ - read_pos_)};
+    std::memcpy(bytes.data(), read_buffer_.data() + read_pos_, count);
+    read_pos_ += count;
+    bytes = bytes.subspan(count);
+  }
+
+  return true;
+}
+
+
+auto HdrDecoder::ReadLine(std::string& line) -> bool {
+  line.clear();
+
+  for (std::uint8_t c; ReadBytes(std::span{&c, 1});) {
+    if (c == '\n') {
+      return true;
+    }
+
+    if (line.size() == kMaxHeaderLineLength) {
+      return false;
+    }
+
+    line.push_back(static_cast<char>(c));
+  }
+
+  return false;
+}
+
+
+auto HdrDecoder::ReadHeader() -> bool {
+  std::string line;
+
+  if (!ReadLine(line) || (line != "#?RADIANCE" && line != "#?RGBE")) {
+    return false;
+  }
+
+  // Variables until an empty line, only the format matters
+  auto valid_format{false};
+
+  while (ReadLine(line) && !line.empty()) {
+    valid_format = valid_format || line == "FORMAT=32-bit_rle_rgbe";
+  }
+
+  if (!valid_format || !ReadLine(line)) {
+    return false;
+  }
+
+  std::string_view resolution{line};
+  auto const height{ParseDimension(resolution, "-Y ")};
+  auto const width{ParseDimension(resolution, "+X ")};
+
+  if (!height || !width) {
+    return false;
+  }
+
+  width_ = *width;
+  height_ = *height;
+  scanline_.resize(4 * static_cast<std::size_t>(width_));
+  flat_ = width_ < kMinRleWidth || width_ > kMaxRleWidth;
+  return true;
+}
+
+
+auto HdrDecoder::ReadScanline() -> bool {
+  if (flat_) {
+    return ReadBytes(scanline_);
+  }
+
+  std::array<std::uint8_t, 4> start;
+
+  if (!ReadBytes(start)) {
+    return false;
+  }
+
+  if (start[0] != 2 || start[1] != 2 || (start[2] & 0x80) != 0) {
+    // Not run length encoded. These four bytes are the first texel and the rest of the file is flat.
+    flat_ = true;
+    std::ranges::copy(start, scanline_.begin());
+    return ReadBytes(std::span{scanline_}.subspan(start.size()));
+  }
+
+  if ((static_cast<std::uint32_t>(start[2]) << 8 | start[3]) != width_) {
+    return false;
+  }
+
+  // Channels are stored one after the other, each as a sequence of runs and literal spans
+  for (std::size_t channel{0}; channel < 4; channel++) {
+    for (std::size_t x{0}; x < width_;) {
+      std::uint8_t count;
+
+      if (!ReadBytes(std::span{&count, 1})) {
+        return false;
+      }
+
+      auto const is_run{count > 128};
+      auto const length{is_run ? count - 128u : count};
+
+      if (length == 0 || length > width_ - x) {
+        return false;
+      }
+
+      if (is_run) {
+        std::uint8_t value;
+
+        if (!ReadBytes(std::span{&value, 1})) {
+          return false;
+        }
+
+        for (auto const end{x + length}; x < end; x++) {
+          scanline_[4 * x + channel] = value;
+        }
+      } else {
+        std::array<std::uint8_t, 128> values;
+
+        if (!ReadBytes(std::span{values}.first(length))) {
+          return false;
+        }
+
+        for (std::size_t i{0}; i < length; i++, x++) {
+          scanline_[4 * x + channel] = values[i];
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+
+template<typename Texel, typename Convert>
+auto HdrDecoder::DecodeRows(std::span<Texel> const rows, Convert const& convert) -> bool {
+  if (rows.size() % width_ != 0 || rows.size() / width_ > height_ - next_row_) {
+    return false;
+  }
+
+  for (std::size_t offset{0}; offset < rows.size(); offset += width_) {
+    if (!ReadScanline()) {
+      return false;
+    }
+
+    convert(scanline_, rows.subspan(offset, width_));
+    next_row_ += 1;
+  }
+
+  return true;
+}
+}
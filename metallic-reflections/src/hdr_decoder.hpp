@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "pixel_packing.hpp"
+#include "scene.hpp"
+
+namespace refl {
+// Decodes a Radiance RGBE (.hdr) file one scanline at a time, top to bottom. Only a small read buffer and a single
+// RGBE scanline are held, so the caller decides how much of the image is in memory at once.
+// Accepts the same files as stb_image: 32-bit_rle_rgbe data in -Y +X orientation, flat or with new style RLE.
+class HdrDecoder {
+public:
+  // Parses the header, returns null if the file cannot be opened or is not a supported Radiance file
+  [[nodiscard]] static auto New(std::filesystem::path const& path) -> std::unique_ptr<HdrDecoder>;
+
+  [[nodiscard]] auto GetWidth() const -> std::uint32_t;
+  [[nodiscard]] auto GetHeight() const -> std::uint32_t;
+  // Scanline the next decode starts at
+  [[nodiscard]] auto GetNextRow() const -> std::uint32_t;
+
+  // Decodes the next rows.size() / width scanlines to the exact values stbi_loadf returns with 4 components.
+  // Returns false if the file is truncated or corrupt, or if the rows run past the end of the image.
+  [[nodiscard]] auto DecodeRows(std::span<Vector4> rows) -> bool;
+  // Same as above, but rounds to half precision. Values beyond the half range are clamped to the largest finite half
+  // instead of becoming infinity.
+  [[nodiscard]] auto DecodeRows(std::span<HalfVector4> rows) -> bool;
+
+private:
+  explicit HdrDecoder(std::ifstream file);
+
+  [[nodiscard]] auto ReadBytes(std::span<std::uint8_t> bytes) -> bool;
+  [[nodiscard]] auto ReadLine(std::string& line) -> bool;
+  [[nodiscard]] auto ReadHeader() -> bool;
+  // Decodes the next scanline into scanline_
+  [[nodiscard]] auto ReadScanline() -> bool;
+
+  template<typename Texel, typename Convert>
+  [[nodiscard]] auto DecodeRows(std::span<Texel> rows, Convert const& convert) -> bool;
+
+  std::ifstream file_;
+  std::vector<char> read_buffer_;
+  std::size_t read_pos_;
+  std::size_t read_size_;
+  std::vector<std::uint8_t> scanline_; // RGBE
+  std::uint32_t width_;
+  std::uint32_t height_;
+  std::uint32_t next_row_;
+  bool flat_; // Files may switch from RLE to flat scanlines halfway, after which every remaining scanline is flat
+};
+}
@@ -0,0 +1,1282 @@
+#include "ibl_baker.hpp"
+
+#include <immintrin.h>
+
+#include "brdf.hpp"
+#include "cache.hpp"
+#include "cube_map_cache.hpp"
+#include "environment_sampling.hpp"
+#include "hdr_decoder.hpp"
+#include "parallel.hpp"
+#include "pixel_packing.hpp"
+
+import std;
+
+namespace refl {
+namespace {
+// Bump when the output of the baker changes
+std::uint32_t constexpr kIblBakeVersion{5};
+
+// Rows of a face are short, so several of them are handed out at once
+std::size_t constexpr kRowsPerChunk{4};
+std::size_t constexpr kTexelsPerChunk{256};
+
+// Equirect rows decoded at once when converting straight from a file. 64 rows of a 16K map take 16 MiB.
+std::uint32_t constexpr kEquirectBandHeight{64};
+
+// Columns of the equirect map the environment distribution of the MIS prefilter is built from
+std::uint32_t constexpr kMisDistributionWidth{512};
+
+// Per axis weights of the tent filter that builds a texel of a mip from the 4x4 texels of the previous mip around it
+std::array<float, 4> constexpr kCubeMipTentWeights{1, 3, 3, 1};
+
+// Cube texels whose equirect lookups are computed together, one per AVX2 lane
+std::size_t constexpr kEquirectLaneCount{8};
+// Faces are converted in square tiles of this many texels, so the equirect texels a thread reads stay close together
+std::uint32_t constexpr kEquirectTileSize{32};
+
+// Terms of the unnormalized direction through a cube texel, forward + ndc_u * right + ndc_v * down, the face mapping of
+// ComputeCubeMapDirection with ndc_v pointing down the face. Indexed by component, then face, faces 6 and 7 are unused.
+using FaceTable = std::array<std::array<float, 8>, 3>;
+FaceTable constexpr kFaceForward{{{1, -1, 0, 0, 0, 0, 0, 0}, {0, 0, 1, -1, 0, 0, 0, 0}, {0, 0, 0, 0, 1, -1, 0, 0}}};
+FaceTable constexpr kFaceRight{{{0, 0, 1, 1, 1, -1, 0, 0}, {0, 0, 0, 0, 0, 0, 0, 0}, {-1, 1, 0, 0, 0, 0, 0, 0}}};
+FaceTable constexpr kFaceDown{{{0, 0, 0, 0, 0, 0, 0, 0}, {-1, -1, 0, 0, -1, -1, 0, 0}, {0, 0, 1, -1, 0, 0, 0, 0}}};
+
+// The equirect footprints of the AVX2 path round differently than the scalar port, so a bake is only reused on the
+// SIMD level that produced it
+struct IblCacheKey {
+  IblBakeSettings settings;
+  SimdLevel simd_level;
+  std::uint32_t version;
+};
+
+
+struct CompressedIblCacheKey {
+  IblBakeSettings settings;
+  SimdLevel simd_level;
+  Bc6hQuality quality;
+  std::uint32_t version;
+};
+
+
+auto Load(Vector4 const& texel) -> __m128 {
+  return _mm_loadu_ps(texel.data());
+}
+
+
+auto Store(__m128 const value) -> Vector4 {
+  Vector4 ret;
+  _mm_storeu_ps(ret.data(), value);
+  return ret;
+}
+
+
+auto Normalize(DirectX::XMFLOAT3 const& v) -> DirectX::XMFLOAT3 {
+  auto const inv_length{1 / std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z)};
+  return {v.x * inv_length, v.y * inv_length, v.z * inv_length};
+}
+
+
+auto Dot(DirectX::XMFLOAT3 const& a, DirectX::XMFLOAT3 const& b) -> float {
+  return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+
+auto Saturate(float const value) -> float {
+  return std::clamp(value, 0.0f, 1.0f);
+}
+
+
+auto GetPrefilterRoughness(std::uint32_t const mip, std::uint32_t const mip_count) -> float {
+  return mip_count > 1 ? static_cast<float>(mip) / static_cast<float>(mip_count - 1) : 0.0f;
+}
+
+
+// Source mip a sample with the given pdf reads, so that the texels it averages cover its solid angle
+auto ComputeSampleMip(float const pdf, std::uint32_t const sample_count, std::uint32_t const face_size) -> float {
+  auto const omega_s{1 / (static_cast<float>(sample_count) * pdf)};
+  auto const omega_p{4 * kPi / (6 * static_cast<float>(face_size) * static_cast<float>(face_size))};
+  return 0.5f * std::log2(omega_s / omega_p);
+}
+
+
+// Mapping from a direction to the equirect map
+auto ComputeEquirectCoords(DirectX::XMFLOAT3 const& dir) -> std::array<float, 2> {
+  auto const lon{std::atan2(dir.z, dir.x)};
+  auto const lat{std::acos(std::clamp(dir.y, -1.0f, 1.0f))};
+  return {lon / (2 * kPi) + 0.5f, lat / kPi};
+}
+
+
+// Cube texels whose equirect footprints are computed at once. Unused lanes repeat a used one.
+struct CubeTexelLanes {
+  alignas(32) std::array<std::int32_t, kEquirectLaneCount> face;
+  alignas(32) std::array<std::int32_t, kEquirectLaneCount> x;
+  alignas(32) std::array<std::int32_t, kEquirectLaneCount> y;
+};
+
+using EquirectFootprintLanes = std::array<EquirectFootprint, kEquirectLaneCount>;
+
+
+// Lanes for lane_count texels of a row of a face, starting at column x
+auto GetCubeTexelLanes(std::uint32_t const face, std::uint32_t const x, std::uint32_t const y,
+                       std::size_t const lane_count) -> CubeTexelLanes {
+  CubeTexelLanes lanes;
+
+  for (std::size_t i{0}; i < kEquirectLaneCount; i++) {
+    lanes.face[i] = static_cast<std::int32_t>(face);
+    lanes.x[i] = static_cast<std::int32_t>(x + std::min(i, lane_count - 1));
+    lanes.y[i] = static_cast<std::int32_t>(y);
+  }
+
+  return lanes;
+}
+
+
+// Lanes for texels given by their index in mip 0 of a cube map, counting row by row and face by face
+auto GetCubeTexelLanes(std::span<std::uint32_t const> const texel_indices,
+                       std::uint32_t const face_size) -> CubeTexelLanes {
+  auto const face_texel_count{face_size * face_size};
+  CubeTexelLanes lanes;
+
+  for (std::size_t i{0}; i < kEquirectLaneCount; i++) {
+    auto const texel_idx{texel_indices[std::min(i, texel_indices.size() - 1)]};
+    auto const face{texel_idx / face_texel_count};
+    auto const face_texel_idx{texel_idx - face * face_texel_count};
+    auto const y{face_texel_idx / face_size};
+    lanes.face[i] = static_cast<std::int32_t>(face);
+    lanes.x[i] = static_cast<std::int32_t>(face_texel_idx - y * face_size);
+    lanes.y[i] = static_cast<std::int32_t>(y);
+  }
+
+  return lanes;
+}
+
+
+// atan2 on eight lanes, within a few ulps of std::atan2. Reduces to the arctangent of a ratio in [0, 1], then of one
+// in [-tan(pi/8), tan(pi/8)], where the minimax polynomial of the Cephes library is accurate to float precision.
+auto Atan2Avx2(__m256 const y, __m256 const x) -> __m256 {
+  auto const sign_mask{_mm256_set1_ps(-0.0f)};
+  auto const abs_y{_mm256_andnot_ps(sign_mask, y)};
+  auto const abs_x{_mm256_andnot_ps(sign_mask, x)};
+  auto const num{_mm256_min_ps(abs_y, abs_x)};
+  auto const den{_mm256_max_ps(abs_y, abs_x)};
+
+  // Both zero gives 0 instead of NaN
+  auto const zero{_mm256_setzero_ps()};
+  auto const ratio{_mm256_and_ps(_mm256_div_ps(num, den), _mm256_cmp_ps(den, zero, _CMP_NEQ_OQ))};
+
+  auto const one{_mm256_set1_ps(1)};
+  auto const above_pi_8{_mm256_cmp_ps(ratio, _mm256_set1_ps(0.41421356f), _CMP_GT_OQ)};
+  auto const t{
+    _mm256_blendv_ps(ratio, _mm256_div_ps(_mm256_sub_ps(ratio, one), _mm256_add_ps(ratio, one)), above_pi_8)
+  };
+
+  auto const z{_mm256_mul_ps(t, t)};
+  auto poly{_mm256_set1_ps(8.05374449538e-2f)};
+  poly = _mm256_sub_ps(_mm256_mul_ps(poly, z), _mm256_set1_ps(1.38776856032e-1f));
+  poly = _mm256_add_ps(_mm256_mul_ps(poly, z), _mm256_set1_ps(1.99777106478e-1f));
+  poly = _mm256_sub_ps(_mm256_mul_ps(poly, z), _mm256_set1_ps(3.33329491539e-1f));
+  auto angle{_mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(poly, z), t), t)};
+
+  angle = _mm256_add_ps(angle, _mm256_and_ps(above_pi_8, _mm256_set1_ps(kPi / 4)));
+  auto const y_major{_mm256_cmp_ps(abs_y, abs_x, _CMP_GT_OQ)};
+  angle = _mm256_blendv_ps(angle, _mm256_sub_ps(_mm256_set1_ps(kPi / 2), angle), y_major);
+  angle = _mm256_blendv_ps(angle, _mm256_sub_ps(_mm256_set1_ps(kPi), angle), x);
+  return _mm256_or_ps(angle, _mm256_and_ps(y, sign_mask));
+}
+
+
+// Vectorized ComputeEquirectFootprint(ComputeEquirectCoords(ComputeCubeMapDirection)), the lookups of
+// ConvertEquirectToCubeReference. Only atan2 is needed: both angles are scale invariant, so the direction is not
+// normalized, and the latitude acos(y / |dir|) is atan2 of the length in the xz plane and y.
+auto ComputeEquirectFootprintsAvx2(CubeTexelLanes const& lanes, std::uint32_t const face_size,
+                                   std::uint32_t const width,
+                                   std::uint32_t const height) -> EquirectFootprintLanes {
+  auto const face{_mm256_load_si256(reinterpret_cast<__m256i const*>(lanes.face.data()))};
+  auto const x{_mm256_load_si256(reinterpret_cast<__m256i const*>(lanes.x.data()))};
+  auto const y{_mm256_load_si256(reinterpret_cast<__m256i const*>(lanes.y.data()))};
+
+  auto const half{_mm256_set1_ps(0.5f)};
+  auto const one{_mm256_set1_ps(1)};
+  auto const two{_mm256_set1_ps(2)};
+  auto const size{_mm256_set1_ps(static_cast<float>(face_size))};
+  auto const to_ndc{
+    [&](__m256i const coord) {
+      auto const uv{_mm256_div_ps(_mm256_add_ps(_mm256_cvtepi32_ps(coord), half), size)};
+      return _mm256_sub_ps(_mm256_mul_ps(two, uv), one);
+    }
+  };
+  auto const ndc_u{to_ndc(x)};
+  auto const ndc_v{to_ndc(y)};
+
+  auto const get_component{
+    [&](std::size_t const c) {
+      auto const forward{_mm256_permutevar8x32_ps(_mm256_loadu_ps(kFaceForward[c].data()), face)};
+      auto const right{_mm256_permutevar8x32_ps(_mm256_loadu_ps(kFaceRight[c].data()), face)};
+      auto const down{_mm256_permutevar8x32_ps(_mm256_loadu_ps(kFaceDown[c].data()), face)};
+      return _mm256_add_ps(_mm256_add_ps(forward, _mm256_mul_ps(ndc_u, right)), _mm256_mul_ps(ndc_v, down));
+    }
+  };
+  auto const dir_x{get_component(0)};
+  auto const dir_y{get_component(1)};
+  auto const dir_z{get_component(2)};
+
+  auto const lon{Atan2Avx2(dir_z, dir_x)};
+  auto const xz_length{_mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(dir_x, dir_x), _mm256_mul_ps(dir_z, dir_z)))};
+  auto const lat{Atan2Avx2(xz_length, dir_y)};
+  auto const u{_mm256_add_ps(_mm256_div_ps(lon, _mm256_set1_ps(2 * kPi)), half)};
+  auto const v{_mm256_div_ps(lat, _mm256_set1_ps(kPi))};
+
+  // Same footprint arithmetic as ComputeEquirectFootprint
+  auto const int_width{_mm256_set1_epi32(static_cast<int>(width))};
+  auto const px{_mm256_sub_ps(_mm256_mul_ps(u, _mm256_set1_ps(static_cast<float>(width))), half)};
+  auto const py{_mm256_sub_ps(_mm256_mul_ps(v, _mm256_set1_ps(static_cast<float>(height))), half)};
+  auto const px_floor{_mm256_floor_ps(px)};
+  auto const py_floor{_mm256_floor_ps(py)};
+
+  auto x0{_mm256_cvttps_epi32(px_floor)};
+  x0 = _mm256_add_epi32(x0, _mm256_and_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), x0), int_width));
+  x0 = _mm256_sub_epi32(x0, _mm256_andnot_si256(_mm256_cmpgt_epi32(int_width, x0), int_width));
+  auto const x0_plus_one{_mm256_add_epi32(x0, _mm256_set1_epi32(1))};
+  auto const x1{_mm256_andnot_si256(_mm256_cmpeq_epi32(x0_plus_one, int_width), x0_plus_one)};
+
+  auto const max_y{_mm256_set1_epi32(static_cast<int>(height) - 1)};
+  auto const y_floor{_mm256_cvttps_epi32(py_floor)};
+  auto const y0{_mm256_max_epi32(_mm256_min_epi32(y_floor, max_y), _mm256_setzero_si256())};
+  auto const y1{
+    _mm256_max_epi32(_mm256_min_epi32(_mm256_add_epi32(y_floor, _mm256_set1_epi32(1)), max_y), _mm256_setzero_si256())
+  };
+
+  alignas(32) std::array<std::array<std::int32_t, kEquirectLaneCount>, 4> coords;
+  alignas(32) std::array<std::array<float, kEquirectLaneCount>, 2> fractions;
+  _mm256_store_si256(reinterpret_cast<__m256i*>(coords[0].data()), x0);
+  _mm256_store_si256(reinterpret_cast<__m256i*>(coords[1].data()), x1);
+  _mm256_store_si256(reinterpret_cast<__m256i*>(coords[2].data()), y0);
+  _mm256_store_si256(reinterpret_cast<__m256i*>(coords[3].data()), y1);
+  _mm256_store_ps(fractions[0].data(), _mm256_sub_ps(px, px_floor));
+  _mm256_store_ps(fractions[1].data(), _mm256_sub_ps(py, py_floor));
+
+  EquirectFootprintLanes footprints;
+
+  for (std::size_t i{0}; i < kEquirectLaneCount; i++) {
+    footprints[i] = {
+      .x0 = static_cast<std::uint32_t>(coords[0][i]),
+      .x1 = static_cast<std::uint32_t>(coords[1][i]),
+      .y0 = static_cast<std::uint32_t>(coords[2][i]),
+      .y1 = static_cast<std::uint32_t>(coords[3][i]),
+      .tx = fractions[0][i],
+      .ty = fractions[1][i]
+    };
+  }
+
+  return footprints;
+}
+
+
+// Footprints of the equirect lookups of the texels, on CPUs without AVX2 through the scalar port
+auto ComputeEquirectFootprints(CubeTexelLanes const& lanes, std::uint32_t const face_size, std::uint32_t const width,
+                               std::uint32_t const height) -> EquirectFootprintLanes {
+  if (GetSimdLevel() == SimdLevel::kAvx2) {
+    return ComputeEquirectFootprintsAvx2(lanes, face_size, width, height);
+  }
+
+  EquirectFootprintLanes footprints;
+
+  for (std::size_t i{0}; i < kEquirectLaneCount; i++) {
+    auto const dir{
+      ComputeCubeMapDirection(static_cast<std::uint32_t>(lanes.face[i]), static_cast<std::uint32_t>(lanes.x[i]),
+                              static_cast<std::uint32_t>(lanes.y[i]), face_size)
+    };
+    auto const [u, v]{ComputeEquirectCoords(dir)};
+    footprints[i] = ComputeEquirectFootprint(width, height, u, v);
+  }
+
+  return footprints;
+}
+
+
+// SampleEquirectFootprint with the texels in SSE registers, writes the texel with an alpha of 1
+auto SampleEquirectFootprintSse(std::span<Vector4 const> const rows, std::uint32_t const first_row,
+                                std::uint32_t const width, EquirectFootprint const& footprint, Vector4& texel) -> void {
+  auto const row0{rows.data() + static_cast<std::size_t>(footprint.y0 - first_row) * width};
+  auto const row1{rows.data() + static_cast<std::size_t>(footprint.y1 - first_row) * width};
+  auto const tx{_mm_set1_ps(footprint.tx)};
+
+  auto const t00{Load(row0[footprint.x0])};
+  auto const t10{Load(row0[footprint.x1])};
+  auto const t01{Load(row1[footprint.x0])};
+  auto const t11{Load(row1[footprint.x1])};
+
+  auto const top{_mm_add_ps(t00, _mm_mul_ps(_mm_sub_ps(t10, t00), tx))};
+  auto const bottom{_mm_add_ps(t01, _mm_mul_ps(_mm_sub_ps(t11, t01), tx))};
+  auto const sample{_mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), _mm_set1_ps(footprint.ty)))};
+
+  // (b, 1, a, 1), then (r, g, b, 1)
+  auto const alpha_high{_mm_unpackhi_ps(sample, _mm_set1_ps(1))};
+  _mm_storeu_ps(texel.data(), _mm_shuffle_ps(sample, alpha_high, _MM_SHUFFLE(1, 0, 1, 0)));
+}
+
+
+auto CopyMip0(CubeMap const& env, CubeMap& prefiltered) -> void {
+  for (std::uint32_t face{0}; face < 6; face++) {
+    std::ranges::copy(env.GetFaceMip(face, 0), prefiltered.GetFaceMip(face, 0).begin());
+  }
+}
+
+
+// Zeroed chain of the environment that ends at the last mip in mip_mask, with mip 0 copied if the mask contains it
+auto CreatePrefilteredCubeMap(CubeMap const& env, std::uint32_t const mip_mask) -> CubeMap {
+  auto const mip_count{std::clamp(static_cast<std::uint32_t>(std::bit_width(mip_mask)), 1u, env.mip_count)};
+  auto prefiltered{CreateCubeMap(env.face_size, mip_count)};
+
+  if ((mip_mask & 1) != 0) {
+    CopyMip0(env, prefiltered);
+  }
+
+  return prefiltered;
+}
+
+
+// Calls func(face, y) for every row of every face of a mip in parallel
+template<typename Func>
+auto ForEachFaceRow(std::uint32_t const size, unsigned const thread_count, Func&& func) -> void {
+  ParallelFor(6 * static_cast<std::size_t>(size), thread_count, [&](std::size_t const i) {
+    func(static_cast<std::uint32_t>(i / size), static_cast<std::uint32_t>(i % size));
+  }, kRowsPerChunk);
+}
+
+
+// Bilinear lookup in a mip of a face that continues across the edges of the face like SampleCubeMap. mip_offset is the
+// offset of the mip from the start of every face.
+auto SampleBilinearSse(CubeMap const& env, std::size_t const face_stride, std::size_t const mip_offset,
+                       std::uint32_t const size, std::uint32_t const face, float const u, float const v) -> __m128 {
+  auto const footprint{ComputeBilinearFootprint(size, u, v)};
+  std::array<std::size_t, 4> offsets;
+
+  if (footprint.x0 >= 0 && footprint.y0 >= 0 && footprint.x0 + 1 < static_cast<std::int32_t>(size) &&
+      footprint.y0 + 1 < static_cast<std::int32_t>(size)) {
+    auto const face_offset{face * face_stride + mip_offset};
+    auto const top_left{face_offset + static_cast<std::size_t>(footprint.y0) * size + footprint.x0};
+    offsets = {top_left, top_left + 1, top_left + size, top_left + size + 1};
+  } else {
+    auto const texels{GetSeamlessCubeTexels(footprint, face, size)};
+
+    for (std::size_t i{0}; i < offsets.size(); i++) {
+      offsets[i] = texels[i].face * face_stride + mip_offset + static_cast<std::size_t>(texels[i].y) * size +
+                   texels[i].x;
+    }
+  }
+
+  auto const tx{_mm_set1_ps(footprint.tx)};
+  auto const ty{_mm_set1_ps(footprint.ty)};
+
+  auto const t00{Load(env.texels[offsets[0]])};
+  auto const t10{Load(env.texels[offsets[1]])};
+  auto const t01{Load(env.texels[offsets[2]])};
+  auto const t11{Load(env.texels[offsets[3]])};
+
+  auto const top{_mm_add_ps(t00, _mm_mul_ps(_mm_sub_ps(t10, t00), tx))};
+  auto const bottom{_mm_add_ps(t01, _mm_mul_ps(_mm_sub_ps(t11, t01), tx))};
+  return _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), ty));
+}
+
+
+// Source texels a GGX sample of a prefiltered mip blends, relative to the start of a face
+struct SampleLookup {
+  std::size_t offset0;
+  std::size_t offset1;
+  std::uint32_t size0;
+  std::uint32_t size1;
+  float mip_fraction; // 0 if both lookups are in the same mip
+};
+
+
+// GGX samples of a prefiltered mip in the frame of the texel normal, laid out for four wide processing.
+// With V = N the reflected direction is L = 2 (N.H) H - N, so its tangent space coordinates, N.L and the pdf only
+// depend on the sample index.
+struct PrefilterSamples {
+  std::vector<float> tangent; // L.T
+  std::vector<float> bitangent; // L.B
+  std::vector<float> normal; // L.N, also the weight of the sample
+  std::vector<SampleLookup> lookups;
+  std::size_t face_stride;
+  float total_weight;
+};
+
+
+auto ComputePrefilterSamples(CubeMap const& env, std::uint32_t const mip, std::uint32_t const sample_count,
+                             std::uint32_t const mip_count) -> PrefilterSamples {
+  PrefilterSamples samples{};
+  samples.face_stride = env.GetFaceMipOffset(1, 0);
+  auto const roughness{GetPrefilterRoughness(mip, mip_count)};
+  auto const alpha{roughness * roughness};
+
+  for (std::uint32_t i{0}; i < sample_count; i++) {
+    auto const h{SampleGgxNdf(Hammersley(i, sample_count), alpha)};
+    auto const n_dot_l{2 * h.z * h.z - 1};
+
+    // Samples below the horizon do not contribute
+    if (n_dot_l <= 0) {
+      continue;
+    }
+
+    auto const n_dot_h{Saturate(h.z)};
+    auto const pdf{DistributionTrowbridgeReitz(n_dot_h, roughness) * n_dot_h / (4 * n_dot_h)};
+    auto const sample_mip{
+      std::clamp(ComputeSampleMip(pdf, sample_count, env.face_size), 0.0f, static_cast<float>(env.mip_count - 1))
+    };
+    auto const mip0{static_cast<std::uint32_t>(sample_mip)};
+    auto const mip1{std::min(mip0 + 1, env.mip_count - 1)};
+
+    samples.tangent.push_back(2 * h.z * h.x);
+    samples.bitangent.push_back(2 * h.z * h.y);
+    samples.normal.push_back(n_dot_l);
+    samples.lookups.push_back({
+      .offset0 = env.GetFaceMipOffset(0, mip0),
+      .offset1 = env.GetFaceMipOffset(0, mip1),
+      .size0 = env.GetMipSize(mip0),
+      .size1 = env.GetMipSize(mip1),
+      .mip_fraction = mip1 != mip0 ? sample_mip - static_cast<float>(mip0) : 0.0f
+    });
+    samples.total_weight += n_dot_l;
+  }
+
+  // Pad to whole groups of four. The padding is never sampled.
+  auto const padded_count{(samples.normal.size() + 3) & ~std::size_t{3}};
+  samples.tangent.resize(padded_count);
+  samples.bitangent.resize(padded_count);
+  samples.normal.resize(padded_count);
+  return samples;
+}
+
+
+auto PrefilterTexel(CubeMap const& env, PrefilterSamples const& samples, DirectX::XMFLOAT3 const& n) -> Vector4 {
+  DirectX::XMFLOAT3 t;
+  DirectX::XMFLOAT3 b;
+  BuildBasis(n, t, b);
+
+  auto const tx{_mm_set1_ps(t.x)};
+  auto const ty{_mm_set1_ps(t.y)};
+  auto const tz{_mm_set1_ps(t.z)};
+  auto const bx{_mm_set1_ps(b.x)};
+  auto const by{_mm_set1_ps(b.y)};
+  auto const bz{_mm_set1_ps(b.z)};
+  auto const nx{_mm_set1_ps(n.x)};
+  auto const ny{_mm_set1_ps(n.y)};
+  auto const nz{_mm_set1_ps(n.z)};
+
+  auto accum{_mm_setzero_ps()};
+  auto const sample_count{samples.lookups.size()};
+
+  for (std::size_t i{0}; i < sample_count; i += 4) {
+    auto const lt{_mm_loadu_ps(&samples.tangent[i])};
+    auto const lb{_mm_loadu_ps(&samples.bitangent[i])};
+    auto const ln{_mm_loadu_ps(&samples.normal[i])};
+
+    alignas(16) std::array<float, 4> lx;
+    alignas(16) std::array<float, 4> ly;
+    alignas(16) std::array<float, 4> lz;
+    _mm_store_ps(lx.data(), _mm_add_ps(_mm_add_ps(_mm_mul_ps(lt, tx), _mm_mul_ps(lb, bx)), _mm_mul_ps(ln, nx)));
+    _mm_store_ps(ly.data(), _mm_add_ps(_mm_add_ps(_mm_mul_ps(lt, ty), _mm_mul_ps(lb, by)), _mm_mul_ps(ln, ny)));
+    _mm_store_ps(lz.data(), _mm_add_ps(_mm_add_ps(_mm_mul_ps(lt, tz), _mm_mul_ps(lb, bz)), _mm_mul_ps(ln, nz)));
+
+    auto const lane_count{std::min<std::size_t>(4, sample_count - i)};
+
+    for (std::size_t lane{0}; lane < lane_count; lane++) {
+      auto const [face, u, v]{ComputeCubeMapCoords({lx[lane], ly[lane], lz[lane]})};
+      auto const& lookup{samples.lookups[i + lane]};
+      auto env_sample{SampleBilinearSse(env, samples.face_stride, lookup.offset0, lookup.size0, face, u, v)};
+
+      if (lookup.mip_fraction != 0) {
+        auto const sample1{SampleBilinearSse(env, samples.face_stride, lookup.offset1, lookup.size1, face, u, v)};
+        env_sample = _mm_add_ps(env_sample, _mm_mul_ps(_mm_sub_ps(sample1, env_sample),
+                                                       _mm_set1_ps(lookup.mip_fraction)));
+      }
+
+      accum = _mm_add_ps(accum, _mm_mul_ps(env_sample, _mm_set1_ps(samples.normal[i + lane])));
+    }
+  }
+
+  auto ret{samples.total_weight > 0 ? Store(_mm_div_ps(accum, _mm_set1_ps(samples.total_weight))) : Vector4{}};
+  ret[3] = 1;
+  return ret;
+}
+
+
+// Distribution of the environment over cells about as large as the texels of the mip it is resampled from. It serves
+// every prefiltered mip: one per mip, built from the mip its lookups read, costs more than it saves.
+auto BuildPrefilterDistribution(CubeMap const& env) -> EnvironmentDistribution {
+  auto const mip{std::max(0.0f, std::log2(static_cast<float>(env.face_size) * 4 / kMisDistributionWidth))};
+  return BuildEnvironmentDistribution(ConvertCubeToEquirect(env, kMisDistributionWidth, mip), kMisDistributionWidth);
+}
+
+
+// Samples of a prefiltered mip for MIS. GGX samples are microfacet normals in the frame of the texel normal, the
+// environment samples are directions shared by every texel.
+struct MisSamples {
+  std::vector<DirectX::XMFLOAT3> ggx;
+  std::vector<EnvironmentSample> environment;
+  float roughness;
+};
+
+
+auto ComputeMisSamples(EnvironmentDistribution const& distribution, std::uint32_t const mip,
+                       std::uint32_t const sample_count, std::uint32_t const mip_count) -> MisSamples {
+  auto const ggx_count{std::max(sample_count / 2, 1u)};
+  auto const environment_count{sample_count - ggx_count};
+
+  MisSamples samples{.ggx = {}, .environment = {}, .roughness = GetPrefilterRoughness(mip, mip_count)};
+  auto const alpha{samples.roughness * samples.roughness};
+
+  for (std::uint32_t i{0}; i < ggx_count; i++) {
+    samples.ggx.push_back(SampleGgxNdf(Hammersley(i, ggx_count), alpha));
+  }
+
+  for (std::uint32_t i{0}; i < environment_count; i++) {
+    samples.environment.push_back(SampleEnvironment(distribution, Hammersley(i, environment_count)));
+  }
+
+  return samples;
+}
+
+
+// The estimator of PrefilterTexel, sum(L * N.L) / sum(N.L) over GGX samples, is sum(L * f / p) / sum(f / p) with
+// f = N.L * pdf_ggx. With two strategies, the balance heuristic turns every sample into f / (n_ggx * pdf_ggx +
+// n_env * pdf_env). With V = N, pdf_ggx = D / 4.
+auto PrefilterTexelMis(CubeMap const& env, EnvironmentDistribution const& distribution, MisSamples const& samples,
+                       DirectX::XMFLOAT3 const& n) -> Vector4 {
+  DirectX::XMFLOAT3 t;
+  DirectX::XMFLOAT3 b;
+  BuildBasis(n, t, b);
+
+  auto const ggx_count{static_cast<float>(samples.ggx.size())};
+  auto const environment_count{static_cast<float>(samples.environment.size())};
+  auto const ggx_lookup_count{static_cast<std::uint32_t>(samples.ggx.size())};
+
+  auto accum{_mm_setzero_ps()};
+  auto total_weight{0.0f};
+
+  auto const add_sample{
+    [&](DirectX::XMFLOAT3 const& l, float const n_dot_l, float const n_dot_h, float const environment_pdf) {
+      auto const ggx_pdf{DistributionTrowbridgeReitz(n_dot_h, samples.roughness) / 4};
+      auto const combined_pdf{ggx_count * ggx_pdf + environment_count * environment_pdf};
+
+      if (combined_pdf <= 0) {
+        return;
+      }
+
+      // The lookup mip follows the GGX pdf alone, with footprints as large as the GGX samples leave between them. A
+      // mip picked from the combined pdf would depend on the strategy that drew the direction, so a bright light would
+      // be read sharp by the environment samples and also leak into the blurred reads of the GGX samples around it.
+      auto const weight{n_dot_l * ggx_pdf / combined_pdf};
+      auto const sample_mip{
+        std::clamp(ComputeSampleMip(ggx_pdf, ggx_lookup_count, env.face_size), 0.0f,
+                   static_cast<float>(env.mip_count - 1))
+      };
+      accum = _mm_add_ps(accum, _mm_mul_ps(Load(SampleCubeMap(env, l, sample_mip)), _mm_set1_ps(weight)));
+      total_weight += weight;
+    }
+  };
+
+  for (auto const& h : samples.ggx) {
+    auto const n_dot_l{2 * h.z * h.z - 1};
+
+    if (n_dot_l <= 0) {
+      continue;
+    }
+
+    DirectX::XMFLOAT3 const l{
+      2 * h.z * (h.x * t.x + h.y * b.x + h.z * n.x) - n.x,
+      2 * h.z * (h.x * t.y + h.y * b.y + h.z * n.y) - n.y,
+      2 * h.z * (h.x * t.z + h.y * b.z + h.z * n.z) - n.z
+    };
+    add_sample(l, n_dot_l, Saturate(h.z), ComputeEnvironmentPdf(distribution, Normalize(l)));
+  }
+
+  for (auto const& sample : samples.environment) {
+    auto const n_dot_l{Dot(n, sample.dir)};
+
+    if (n_dot_l <= 0) {
+      continue;
+    }
+
+    auto const h{Normalize({n.x + sample.dir.x, n.y + sample.dir.y, n.z + sample.dir.z})};
+    add_sample(sample.dir, n_dot_l, Saturate(Dot(n, h)), sample.pdf);
+  }
+
+  auto ret{total_weight > 0 ? Store(_mm_div_ps(accum, _mm_set1_ps(total_weight))) : Vector4{}};
+  ret[3] = 1;
+  return ret;
+}
+
+
+// Dispatches on the sampling of the settings
+auto Prefilter(CubeMap const& env, IblBakeSettings const& settings, unsigned const thread_count,
+               std::uint32_t const mip_mask) -> CubeMap {
+  if (settings.sampling == PrefilterSampling::kMultipleImportance) {
+    return PrefilterCubeMapMis(env, settings.sample_count, thread_count, mip_mask);
+  }
+
+  return PrefilterCubeMap(env, settings.sample_count, thread_count, mip_mask);
+}
+}
+
+
+auto ConvertEquirectToCube(EquirectMap const& equirect, std::uint32_t const face_size,
+                           unsigned const thread_count) -> CubeMap {
+  auto cube{CreateCubeMap(face_size)};
+  auto const tiles_per_row{(face_size + kEquirectTileSize - 1) / kEquirectTileSize};
+  auto const tiles_per_face{static_cast<std::size_t>(tiles_per_row) * tiles_per_row};
+
+  ParallelFor(6 * tiles_per_face, thread_count, [&](std::size_t const tile_idx) {
+    auto const face{static_cast<std::uint32_t>(tile_idx / tiles_per_face)};
+    auto const tile_x{static_cast<std::uint32_t>(tile_idx % tiles_per_face % tiles_per_row) * kEquirectTileSize};
+    auto const tile_y{static_cast<std::uint32_t>(tile_idx % tiles_per_face / tiles_per_row) * kEquirectTileSize};
+    auto const x_end{std::min(tile_x + kEquirectTileSize, face_size)};
+    auto const y_end{std::min(tile_y + kEquirectTileSize, face_size)};
+    auto const face_texels{cube.GetFaceMip(face, 0)};
+
+    for (auto y{tile_y}; y < y_end; y++) {
+      auto const row{face_texels.subspan(static_cast<std::size_t>(y) * face_size, face_size)};
+
+      for (auto x{tile_x}; x < x_end; x += kEquirectLaneCount) {
+        auto const lane_count{std::min<std::size_t>(kEquirectLaneCount, x_end - x)};
+        auto const footprints{
+          ComputeEquirectFootprints(GetCubeTexelLanes(face, x, y, lane_count), face_size, equirect.width,
+                                    equirect.height)
+        };
+
+        for (std::size_t i{0}; i < lane_count; i++) {
+          SampleEquirectFootprintSse(equirect.texels, 0, equirect.width, footprints[i], row[x + i]);
+        }
+      }
+    }
+  });
+
+  return cube;
+}
+
+
+auto ConvertEquirectToCubeReference(EquirectMap const& equirect, std::uint32_t const face_size,
+                                    unsigned const thread_count) -> CubeMap {
+  auto cube{CreateCubeMap(face_size)};
+
+  ForEachFaceRow(face_size, thread_count, [&](std::uint32_t const face, std::uint32_t const y) {
+    auto const row{cube.GetFaceMip(face, 0).subspan(static_cast<std::size_t>(y) * face_size, face_size)};
+
+    for (std::uint32_t x{0}; x < face_size; x++) {
+      auto const [u, v]{ComputeEquirectCoords(ComputeCubeMapDirection(face, x, y, face_size))};
+      row[x] = SampleEquirectMap(equirect, u, v);
+      row[x][3] = 1;
+    }
+  });
+
+  return cube;
+}
+
+
+auto ConvertEquirectToCube(HdrDecoder& decoder, std::uint32_t const face_size,
+                           unsigned const thread_count) -> std::optional<CubeMap> {
+  auto const width{decoder.GetWidth()};
+  auto const height{decoder.GetHeight()};
+  auto cube{CreateCubeMap(face_size)};
+
+  auto const face_texel_count{static_cast<std::size_t>(face_size) * face_size};
+  auto const texel_count{6 * face_texel_count};
+
+  // Sort the texels of mip 0 by the top row of their equirect footprint so that every band of rows knows which
+  // texels it completes
+  std::vector<std::uint32_t> order(texel_count);
+  std::vector<std::uint32_t> row_offsets(height + 1, 0);
+
+  {
+    std::vector<std::uint32_t> texel_rows(texel_count);
+
+    ForEachFaceRow(face_size, thread_count, [&](std::uint32_t const face, std::uint32_t const y) {
+      auto const row_texel_rows{
+        std::span{texel_rows}.subspan(face * face_texel_count + static_cast<std::size_t>(y) * face_size, face_size)
+      };
+
+      for (std::uint32_t x{0}; x < face_size; x += kEquirectLaneCount) {
+        auto const lane_count{std::min<std::size_t>(kEquirectLaneCount, face_size - x)};
+        auto const footprints{
+          ComputeEquirectFootprints(GetCubeTexelLanes(face, x, y, lane_count), face_size, width, height)
+        };
+
+        for (std::size_t i{0}; i < lane_count; i++) {
+          row_texel_rows[x + i] = footprints[i].y0;
+        }
+      }
+    });
+
+    for (auto const row : texel_rows) {
+      row_offsets[row + 1] += 1;
+    }
+
+    std::partial_sum(row_offsets.begin(), row_offsets.end(), row_offsets.begin());
+    auto next_offsets{row_offsets};
+
+    for (std::uint32_t i{0}; i < texel_count; i++) {
+      order[next_offsets[texel_rows[i]]++] = i;
+    }
+  }
+
+  // The band holds the rows of its texels and the row below the last of them
+  std::vector<Vector4> band(static_cast<std::size_t>(kEquirectBandHeight + 1) * width);
+  auto const band_span{std::span{band}};
+
+  auto const first_row_count{std::min(kEquirectBandHeight + 1, height)};
+
+  if (!decoder.DecodeRows(band_span.first(static_cast<std::size_t>(first_row_count) * width))) {
+    return std::nullopt;
+  }
+
+  for (std::uint32_t band_begin{0}; band_begin < height; band_begin += kEquirectBandHeight) {
+    auto const band_end{std::min(band_begin + kEquirectBandHeight, height)};
+
+    if (band_begin != 0) {
+      // The last row of the previous band is the first one of this band
+      std::ranges::copy(band_span.subspan(static_cast<std::size_t>(kEquirectBandHeight) * width, width), band.begin());
+      auto const row_count{std::min(band_end + 1, height) - (band_begin + 1)};
+
+      if (!decoder.DecodeRows(band_span.subspan(width, static_cast<std::size_t>(row_count) * width))) {
+        return std::nullopt;
+      }
+    }
+
+    auto const band_texels{
+      std::span{order}.subspan(row_offsets[band_begin], row_offsets[band_end] - row_offsets[band_begin])
+    };
+    auto const band_group_count{(band_texels.size() + kEquirectLaneCount - 1) / kEquirectLaneCount};
+
+    ParallelFor(band_group_count, thread_count, [&](std::size_t const group_idx) {
+      auto const texel_indices{
+        band_texels.subspan(group_idx * kEquirectLaneCount,
+                            std::min(kEquirectLaneCount, band_texels.size() - group_idx * kEquirectLaneCount))
+      };
+      auto const lanes{GetCubeTexelLanes(texel_indices, face_size)};
+      auto const footprints{ComputeEquirectFootprints(lanes, face_size, width, height)};
+
+      for (std::size_t i{0}; i < texel_indices.size(); i++) {
+        auto const face{static_cast<std::uint32_t>(lanes.face[i])};
+        auto const row{static_cast<std::size_t>(lanes.y[i])};
+        auto& texel{cube.GetFaceMip(face, 0)[row * face_size + static_cast<std::size_t>(lanes.x[i])]};
+        SampleEquirectFootprintSse(band, band_begin, width, footprints[i], texel);
+      }
+    }, kTexelsPerChunk / kEquirectLaneCount);
+  }
+
+  return cube;
+}
+
+
+auto GenerateCubeMips(CubeMap& cube, unsigned const thread_count) -> void {
+  for (std::uint32_t mip{1}; mip < cube.mip_count; mip++) {
+    auto const src_size{cube.GetMipSize(mip - 1)};
+    auto const dst_size{cube.GetMipSize(mip)};
+    auto const int_src_size{static_cast<std::int32_t>(src_size)};
+
+    auto const solid_angles{ComputeCubeMapSolidAngles(src_size)};
+    std::array<Vector4 const*, 6> src_faces;
+
+    for (std::uint32_t face{0}; face < 6; face++) {
+      src_faces[face] = cube.GetFaceMip(face, mip - 1).data();
+    }
+
+    ForEachFaceRow(dst_size, thread_count, [&](std::uint32_t const face, std::uint32_t const y) {
+      auto const dst{cube.GetFaceMip(face, mip).subspan(static_cast<std::size_t>(y) * dst_size, dst_size)};
+      auto const src_y{2 * static_cast<std::int32_t>(y) - 1};
+      auto const inside_rows{src_y >= 0 && src_y + 3 < int_src_size};
+
+      for (std::uint32_t x{0}; x < dst_size; x++) {
+        auto const src_x{2 * static_cast<std::int32_t>(x) - 1};
+        auto const inside{inside_rows && src_x >= 0 && src_x + 3 < int_src_size};
+        auto accum{_mm_setzero_ps()};
+        auto total_weight{0.0f};
+
+        for (std::int32_t j{0}; j < 4; j++) {
+          auto const sy{src_y + j};
+          auto const inside_y{sy >= 0 && sy < int_src_size};
+
+          for (std::int32_t i{0}; i < 4; i++) {
+            auto const sx{src_x + i};
+            auto const inside_x{sx >= 0 && sx < int_src_size};
+
+            // Only three faces meet at the corners of the cube, so there is no texel diagonally across them
+            if (!inside_x && !inside_y) {
+              continue;
+            }
+
+            auto const [src_face, texel_x, texel_y]{
+              inside ? CubeMapTexel{face, static_cast<std::uint32_t>(sx), static_cast<std::uint32_t>(sy)}
+                     : WrapCubeMapTexel(face, sx, sy, src_size)
+            };
+            auto const texel_idx{static_cast<std::size_t>(texel_y) * src_size + texel_x};
+            auto const weight{kCubeMipTentWeights[i] * kCubeMipTentWeights[j] * solid_angles[texel_idx]};
+            accum = _mm_add_ps(accum, _mm_mul_ps(Load(src_faces[src_face][texel_idx]), _mm_set1_ps(weight)));
+            total_weight += weight;
+          }
+        }
+
+        dst[x] = Store(_mm_div_ps(accum, _mm_set1_ps(total_weight)));
+      }
+    });
+  }
+}
+
+
+auto GenerateCubeMipsBox(CubeMap& cube, unsigned const thread_count) -> void {
+  auto const quarter{_mm_set1_ps(0.25f)};
+
+  for (std::uint32_t mip{1}; mip < cube.mip_count; mip++) {
+    auto const src_size{cube.GetMipSize(mip - 1)};
+    auto const dst_size{cube.GetMipSize(mip)};
+
+    ForEachFaceRow(dst_size, thread_count, [&](std::uint32_t const face, std::uint32_t const y) {
+      auto const src{cube.GetFaceMip(face, mip - 1)};
+      auto const dst{cube.GetFaceMip(face, mip)};
+      auto const src_row0{src.data() + static_cast<std::size_t>(2 * y) * src_size};
+      auto const src_row1{src.data() + static_cast<std::size_t>(std::min(2 * y + 1, src_size - 1)) * src_size};
+
+      for (std::uint32_t x{0}; x < dst_size; x++) {
+        auto const x0{2 * x};
+        auto const x1{std::min(2 * x + 1, src_size - 1)};
+        auto const sum{
+          _mm_add_ps(_mm_add_ps(Load(src_row0[x0]), Load(src_row0[x1])),
+                     _mm_add_ps(Load(src_row1[x0]), Load(src_row1[x1])))
+        };
+        dst[static_cast<std::size_t>(y) * dst_size + x] = Store(_mm_mul_ps(sum, quarter));
+      }
+    });
+  }
+}
+
+
+auto PrefilterCubeMap(CubeMap const& env, std::uint32_t const sample_count, unsigned const thread_count,
+                      std::uint32_t const mip_mask) -> CubeMap {
+  auto prefiltered{CreatePrefilteredCubeMap(env, mip_mask)};
+
+  for (std::uint32_t mip{1}; mip < prefiltered.mip_count; mip++) {
+    if ((mip_mask >> mip & 1) == 0) {
+      continue;
+    }
+
+    auto const samples{ComputePrefilterSamples(env, mip, sample_count, env.mip_count)};
+    auto const size{env.GetMipSize(mip)};
+
+    ForEachFaceRow(size, thread_count, [&](std::uint32_t const face, std::uint32_t const y) {
+      auto const row{prefiltered.GetFaceMip(face, mip).subspan(static_cast<std::size_t>(y) * size, size)};
+
+      for (std::uint32_t x{0}; x < size; x++) {
+        row[x] = PrefilterTexel(env, samples, ComputeCubeMapDirection(face, x, y, size));
+      }
+    });
+  }
+
+  return prefiltered;
+}
+
+
+auto PrefilterCubeMapMis(CubeMap const& env, std::uint32_t const sample_count, unsigned const thread_count,
+                         std::uint32_t const mip_mask) -> CubeMap {
+  auto prefiltered{CreatePrefilteredCubeMap(env, mip_mask)};
+
+  // Without a prefiltered mip the distribution is not worth building
+  if (prefiltered.mip_count == 1) {
+    return prefiltered;
+  }
+
+  auto const distribution{BuildPrefilterDistribution(env)};
+
+  for (std::uint32_t mip{1}; mip < prefiltered.mip_count; mip++) {
+    if ((mip_mask >> mip & 1) == 0) {
+      continue;
+    }
+
+    auto const samples{ComputeMisSamples(distribution, mip, sample_count, env.mip_count)};
+    auto const size{env.GetMipSize(mip)};
+
+    ForEachFaceRow(size, thread_count, [&](std::uint32_t const face, std::uint32_t const y) {
+      auto const row{prefiltered.GetFaceMip(face, mip).subspan(static_cast<std::size_t>(y) * size, size)};
+
+      for (std::uint32_t x{0}; x < size; x++) {
+        row[x] = PrefilterTexelMis(env, distribution, samples, ComputeCubeMapDirection(face, x, y, size));
+      }
+    });
+  }
+
+  return prefiltered;
+}
+
+
+auto PrefilterCubeMapReference(CubeMap const& env, std::uint32_t const sample_count,
+                               unsigned const thread_count) -> CubeMap {
+  auto prefiltered{CreateCubeMap(env.face_size, env.mip_count)};
+  CopyMip0(env, prefiltered);
+
+  for (std::uint32_t mip{1}; mip < env.mip_count; mip++) {
+    auto const roughness{GetPrefilterRoughness(mip, env.mip_count)};
+    auto const alpha{roughness * roughness};
+    auto const size{env.GetMipSize(mip)};
+
+    ForEachFaceRow(size, thread_count, [&](std::uint32_t const face, std::uint32_t const y) {
+      for (std::uint32_t x{0}; x < size; x++) {
+        auto const n{ComputeCubeMapDirection(face, x, y, size)};
+        auto const v{n};
+
+        DirectX::XMFLOAT3 t;
+        DirectX::XMFLOAT3 b;
+        BuildBasis(n, t, b);
+
+        DirectX::XMFLOAT3 accum_color{0, 0, 0};
+        auto accum_weight{0.0f};
+
+        for (std::uint32_t i{0}; i < sample_count; i++) {
+          auto const h_tan{SampleGgxNdf(Hammersley(i, sample_count), alpha)};
+          auto const h{
+            Normalize({
+              h_tan.x * t.x + h_tan.y * b.x + h_tan.z * n.x,
+              h_tan.x * t.y + h_tan.y * b.y + h_tan.z * n.y,
+              h_tan.x * t.z + h_tan.y * b.z + h_tan.z * n.z
+            })
+          };
+
+          // reflect(-V, H)
+          auto const v_dot_h_raw{Dot(v, h)};
+          DirectX::XMFLOAT3 const l{
+            2 * v_dot_h_raw * h.x - v.x, 2 * v_dot_h_raw * h.y - v.y, 2 * v_dot_h_raw * h.z - v.z
+          };
+          auto const n_dot_l{Saturate(Dot(n, l))};
+
+          if (n_dot_l <= 0) {
+            continue;
+          }
+
+          auto const n_dot_h{Saturate(Dot(n, h))};
+          auto const d{DistributionTrowbridgeReitz(n_dot_h, roughness)};
+          auto const v_dot_h{Saturate(Dot(v, h))};
+          auto const pdf{d * n_dot_h / (4 * v_dot_h)};
+
+          auto const env_sample{SampleCubeMap(env, l, ComputeSampleMip(pdf, sample_count, env.face_size))};
+
+          accum_color.x += env_sample[0] * n_dot_l;
+          accum_color.y += env_sample[1] * n_dot_l;
+          accum_color.z += env_sample[2] * n_dot_l;
+          accum_weight += n_dot_l;
+        }
+
+        prefiltered.GetFaceMip(face, mip)[static_cast<std::size_t>(y) * size + x] = accum_weight > 0
+          ? Vector4{accum_color.x / accum_weight, accum_color.y / accum_weight, accum_color.z / accum_weight, 1}
+          : Vector4{0, 0, 0, 1};
+      }
+    });
+  }
+
+  return prefiltered;
+}
+
+
+auto BakeIbl(EquirectMap const& equirect, IblBakeSettings const& settings, unsigned const thread_count,
+             std::uint32_t const mip_mask) -> CubeMap {
+  auto env{ConvertEquirectToCube(equirect, settings.face_size, thread_count)};
+  GenerateCubeMips(env, thread_count);
+  return Prefilter(env, settings, thread_count, mip_mask);
+}
+
+
+auto BakeIbl(HdrDecoder& decoder, IblBakeSettings const& settings, unsigned const thread_count,
+             std::uint32_t const mip_mask) -> std::optional<CubeMap> {
+  auto env{ConvertEquirectToCube(decoder, settings.face_size, thread_count)};
+
+  if (!env) {
+    return std::nullopt;
+  }
+
+  GenerateCubeMips(*env, thread_count);
+  return Prefilter(*env, settings, thread_count, mip_mask);
+}
+
+
+auto ComputePrefilteredMip(float const roughness, std::uint32_t const mip_count) -> float {
+  auto const last_mip{static_cast<float>(mip_count - 1)};
+  auto const mip{roughness * std::clamp(roughness * static_cast<float>(mip_count) - 1, 0.0f, last_mip)};
+  return std::clamp(mip, 0.0f, last_mip);
+}
+
+
+auto ComputeReachablePrefilteredMips(float const min_roughness, float const max_roughness,
+                                     std::uint32_t const mip_count) -> std::uint32_t {
+  // The mip grows with the roughness, and a trilinear lookup reads the mips on both sides of its own
+  auto const first{static_cast<std::uint32_t>(std::floor(ComputePrefilteredMip(min_roughness, mip_count)))};
+  auto const last{static_cast<std::uint32_t>(std::ceil(ComputePrefilteredMip(max_roughness, mip_count)))};
+  return (GetMipMask(last + 1) & ~GetMipMask(first)) | 1;
+}
+
+
+namespace {
+// Converts the environment to a cube and generates its mips. Radiance files are streamed in bands instead of being
+// decoded whole, other formats go through stb_image.
+auto LoadEnvironmentCube(std::filesystem::path const& hdr_path, std::uint32_t const face_size,
+                         unsigned const thread_count) -> std::optional<CubeMap> {
+  std::optional<CubeMap> env;
+
+  if (auto const decoder{HdrDecoder::New(hdr_path)}) {
+    env = ConvertEquirectToCube(*decoder, face_size, thread_count);
+  } else if (auto const equirect{LoadEquirectMap(hdr_path)}) {
+    env = ConvertEquirectToCube(*equirect, face_size, thread_count);
+  }
+
+  if (env) {
+    GenerateCubeMips(*env, thread_count);
+  }
+
+  return env;
+}
+
+
+// Copies the first mip_count mips of a cube, the rest of the chain is dropped
+auto TruncateMips(Bc6hCubeMap const& cube, std::uint32_t const mip_count) -> Bc6hCubeMap {
+  auto truncated{CreateBc6hCubeMap(cube.face_size, mip_count)};
+
+  for (std::uint32_t face{0}; face < 6; face++) {
+    for (std::uint32_t mip{0}; mip < mip_count; mip++) {
+      std::ranges::copy(cube.GetFaceMip(face, mip), truncated.GetFaceMip(face, mip).begin());
+    }
+  }
+
+  return truncated;
+}
+
+
+// Texels of the prefiltered mips of a chain in mip_mask, mip 0 is a copy
+auto CountPrefilteredTexels(CubeMap const& cube, std::uint32_t const mip_mask) -> std::size_t {
+  std::size_t count{0};
+
+  for (std::uint32_t mip{1}; mip < cube.mip_count; mip++) {
+    if ((mip_mask >> mip & 1) != 0) {
+      count += 6 * static_cast<std::size_t>(cube.GetMipSize(mip)) * cube.GetMipSize(mip);
+    }
+  }
+
+  return count;
+}
+
+
+// Blocks of the mips of a chain in mip_mask
+auto CountBlocks(Bc6hCubeMap const& cube, std::uint32_t const mip_mask) -> std::size_t {
+  std::size_t count{0};
+
+  for (std::uint32_t mip{0}; mip < cube.mip_count; mip++) {
+    if ((mip_mask >> mip & 1) != 0) {
+      count += 6 * static_cast<std::size_t>(cube.GetMipBlockCount(mip)) * cube.GetMipBlockCount(mip);
+    }
+  }
+
+  return count;
+}
+
+
+auto BakeIblFromFile(std::filesystem::path const& hdr_path, IblBakeSettings const& settings,
+                     unsigned const thread_count) -> std::optional<CubeMap> {
+  auto const env{LoadEnvironmentCube(hdr_path, settings.face_size, thread_count)};
+
+  if (!env) {
+    return std::nullopt;
+  }
+
+  return Prefilter(*env, settings, thread_count, ~0u);
+}
+}
+
+
+auto LoadPrefilteredEnvironment(std::filesystem::path const& hdr_path, IblBakeSettings const& settings,
+                                unsigned const thread_count) -> std::optional<CubeMap> {
+  using Milliseconds = std::chrono::duration<double, std::milli>;
+
+  auto const load_begin{std::chrono::steady_clock::now()};
+
+  auto const source_hash{HashFileContents(hdr_path)};
+
+  if (!source_hash) {
+    std::cerr << "Failed to read environment map file.\n";
+    return std::nullopt;
+  }
+
+  IblCacheKey const key{.settings = settings, .simd_level = GetSimdLevel(), .version = kIblBakeVersion};
+  auto const cache_key{HashValue(key, *source_hash)};
+  auto const cache_path{GetCacheFilePath(hdr_path, ".reflibl")};
+
+  if (auto cube{ReadCubeMapCache(cache_path, cache_key)}) {
+    auto const load_end{std::chrono::steady_clock::now()};
+    std::cout << std::format("Warm environment load (from cache) took {:.2f} ms.\n",
+                             Milliseconds{load_end - load_begin}.count());
+    return cube;
+  }
+
+  auto const bake_begin{std::chrono::steady_clock::now()};
+  auto cube{BakeIblFromFile(hdr_path, settings, thread_count)};
+  auto const bake_end{std::chrono::steady_clock::now()};
+
+  if (!cube) {
+    std::cerr << "Failed to load environment map image.\n";
+    return std::nullopt;
+  }
+
+  if (!WriteCubeMapCache(cache_path, cache_key, *cube)) {
+    std::cerr << "Failed to write environment cache.\n";
+  }
+
+  auto const load_end{std::chrono::steady_clock::now()};
+  std::cout << std::format("Cold environment load took {:.2f} ms, of which decoding and the IBL bake took {:.2f} ms "
+                           "and writing the cache {:.2f} ms.\n", Milliseconds{load_end - load_begin}.count(),
+                           Milliseconds{bake_end - bake_begin}.count(), Milliseconds{load_end - bake_end}.count());
+  return cube;
+}
+
+
+auto LoadCompressedPrefilteredEnvironment(std::filesystem::path const& hdr_path, IblBakeSettings const& settings,
+                                          std::uint32_t const required_mips, Bc6hQuality const quality,
+                                          unsigned const thread_count) -> std::optional<PartialBc6hCubeMap> {
+  using Milliseconds = std::chrono::duration<double, std::milli>;
+
+  auto const load_begin{std::chrono::steady_clock::now()};
+
+  if (settings.face_size % 4 != 0) {
+    std::cerr << "The face size of a BC6H environment must be a multiple of 4.\n";
+    return std::nullopt;
+  }
+
+  auto const source_hash{HashFileContents(hdr_path)};
+
+  if (!source_hash) {
+    std::cerr << "Failed to read environment map file.\n";
+    return std::nullopt;
+  }
+
+  CompressedIblCacheKey const key{
+    .settings = settings, .simd_level = GetSimdLevel(), .quality = quality, .version = kIblBakeVersion
+  };
+  auto const cache_key{HashValue(key, *source_hash)};
+  auto const cache_path{GetCacheFilePath(hdr_path, ".reflbc6")};
+
+  auto const full_chain{CreateBc6hCubeMap(settings.face_size)};
+  auto const required{(required_mips | 1) & GetMipMask(full_chain.mip_count)};
+  auto const mip_count{static_cast<std::uint32_t>(std::bit_width(required))};
+
+  auto constexpr bytes_per_mib{1024.0 * 1024.0};
+  auto const full_mib{static_cast<double>(full_chain.blocks.size() * sizeof(Bc6hBlock)) / bytes_per_mib};
+
+  // The mips the cache lacks are baked and added to it, so it covers every scene it served so far
+  auto cached{ReadPartialBc6hCubeMapCache(cache_path, cache_key)};
+  auto const cached_mips{cached ? cached->valid_mips : 0u};
+
+  if ((cached_mips & required) == required) {
+    PartialBc6hCubeMap ret{
+      .cube = TruncateMips(cached->cube, mip_count), .valid_mips = cached_mips & GetMipMask(mip_count)
+    };
+    auto const load_end{std::chrono::steady_clock::now()};
+    std::cout << std::format("Warm compressed environment load (from cache) of {} of {} mips took {:.2f} ms, the cube "
+                             "takes {:.2f} of {:.2f} MiB.\n", std::popcount(required), full_chain.mip_count,
+                             Milliseconds{load_end - load_begin}.count(),
+                             static_cast<double>(ret.cube.blocks.size() * sizeof(Bc6hBlock)) / bytes_per_mib,
+                             full_mib);
+    return ret;
+  }
+
+  auto const missing{required & ~cached_mips};
+
+  auto const bake_begin{std::chrono::steady_clock::now()};
+  auto const env{LoadEnvironmentCube(hdr_path, settings.face_size, thread_count)};
+
+  if (!env) {
+    std::cerr << "Failed to load environment map image.\n";
+    return std::nullopt;
+  }
+
+  auto const prefilter_begin{std::chrono::steady_clock::now()};
+  auto const cube{Prefilter(*env, settings, thread_count, missing)};
+  auto const prefilter_end{std::chrono::steady_clock::now()};
+  auto const compressed{EncodeBc6hCubeMap(cube, quality, thread_count, missing)};
+  auto const encode_end{std::chrono::steady_clock::now()};
+
+  // Merge the new mips into the chain of the cache, which is the longer one if it holds mips the scene does not need
+  PartialBc6hCubeMap merged{
+    .cube = CreateBc6hCubeMap(settings.face_size, std::max(cached ? cached->cube.mip_count : 0u, mip_count)),
+    .valid_mips = cached_mips | missing
+  };
+
+  for (std::uint32_t face{0}; face < 6; face++) {
+    for (std::uint32_t mip{0}; mip < merged.cube.mip_count; mip++) {
+      if ((missing >> mip & 1) != 0) {
+        std::ranges::copy(compressed.GetFaceMip(face, mip), merged.cube.GetFaceMip(face, mip).begin());
+      } else if ((cached_mips >> mip & 1) != 0) {
+        std::ranges::copy(cached->cube.GetFaceMip(face, mip), merged.cube.GetFaceMip(face, mip).begin());
+      }
+    }
+  }
+
+  if (!WritePartialBc6hCubeMapCache(cache_path, cache_key, merged)) {
+    std::cerr << "Failed to write compressed environment cache.\n";
+  }
+
+  PartialBc6hCubeMap ret{
+    .cube = TruncateMips(merged.cube, mip_count), .valid_mips = merged.valid_mips & GetMipMask(mip_count)
+  };
+
+  auto const load_end{std::chrono::steady_clock::now()};
+  std::cout << std::format("Cold compressed environment load took {:.2f} ms, of which decoding took {:.2f} ms, "
+                           "prefiltering {:.2f} ms, BC6H encoding {:.2f} ms and writing the cache {:.2f} ms.\n",
+                           Milliseconds{load_end - load_begin}.count(),
+                           Milliseconds{prefilter_begin - bake_begin}.count(),
+                           Milliseconds{prefilter_end - prefilter_begin}.count(),
+                           Milliseconds{encode_end - prefilter_end}.count(),
+                           Milliseconds{load_end - encode_end}.count());
+
+  auto const all_mips{GetMipMask(full_chain.mip_count)};
+
+  if (missing != all_mips) {
+    // Both passes take about the same time per texel on every mip, so the time of the skipped mips is extrapolated
+    // from that of the baked ones
+    auto const skipped{all_mips & ~missing};
+    auto const format_saving{
+      [](std::size_t const skipped_count, std::size_t const baked_count, Milliseconds const baked_time) {
+        auto const total{skipped_count + baked_count};
+        auto const percent{total > 0 ? 100.0 * static_cast<double>(skipped_count) / static_cast<double>(total) : 0.0};
+
+        if (baked_count == 0) {
+          return std::format("{:.0f}%", percent);
+        }
+
+        return std::format("{:.0f}% (about {:.0f} ms)", percent,
+                           baked_time.count() * static_cast<double>(skipped_count) / static_cast<double>(baked_count));
+      }
+    };
+
+    std::cout << std::format("Baked {} of {} mips for the roughness range of the scene, which skipped {} of the "
+                             "prefiltering and {} of the encoding. The cube takes {:.2f} of {:.2f} MiB.\n",
+                             std::popcount(missing), full_chain.mip_count,
+                             format_saving(CountPrefilteredTexels(*env, skipped), CountPrefilteredTexels(*env, missing),
+                                           prefilter_end - prefilter_begin),
+                             format_saving(CountBlocks(full_chain, skipped), CountBlocks(full_chain, missing),
+                                           encode_end - prefilter_end),
+                             static_cast<double>(ret.cube.blocks.size() * sizeof(Bc6hBlock)) / bytes_per_mib,
+                             full_mib);
+  }
+
+  return ret;
+}
+
+
+auto LoadCompressedPrefilteredEnvironment(std::filesystem::path const& hdr_path, IblBakeSettings const& settings,
+                                          Bc6hQuality const quality,
+                                          unsigned const thread_count) -> std::optional<Bc6hCubeMap> {
+  auto cube{LoadCompressedPrefilteredEnvironment(hdr_path, settings, ~0u, quality, thread_count)};
+
+  if (!cube) {
+    return std::nullopt;
+  }
+
+  return std::move(cube->cube);
+}
+}
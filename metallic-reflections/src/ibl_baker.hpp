@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+
+#include "bc6h.hpp"
+#include "cube_map_cache.hpp"
+#include "environment_map.hpp"
+#include "hdr_decoder.hpp"
+
+namespace refl {
+// How the prefilter picks the directions it integrates the environment over
+enum class PrefilterSampling : std::uint32_t {
+  kGgx, // Importance sampling the GGX lobe
+  kMultipleImportance // Half of the samples from the GGX lobe, half from the luminance of the environment
+};
+
+// Everything besides the source image that influences a bake. Part of the IBL cache key.
+struct IblBakeSettings {
+  std::uint32_t face_size;
+  std::uint32_t sample_count; // Samples per texel of the prefiltered mips
+  PrefilterSampling sampling;
+};
+
+// The parameters of the GPU path main.cpp used to run at every startup
+IblBakeSettings constexpr kDefaultIblBakeSettings{
+  .face_size = 1024, .sample_count = 1024, .sampling = PrefilterSampling::kGgx
+};
+
+// Fills mip 0 of a cube map with a full mip chain by bilinear lookups into the equirect map. The lookups of eight
+// texels are computed at once with AVX2 and the faces are split into tiles across the threads. Lookups wrap around in
+// longitude.
+[[nodiscard]] auto ConvertEquirectToCube(EquirectMap const& equirect, std::uint32_t face_size,
+                                         unsigned thread_count) -> CubeMap;
+// Scalar texel by texel conversion that ConvertEquirectToCube is checked against
+[[nodiscard]] auto ConvertEquirectToCubeReference(EquirectMap const& equirect, std::uint32_t face_size,
+                                                  unsigned thread_count) -> CubeMap;
+// Same as above, but decodes the equirect map in bands as it goes and never holds the whole image. The decoder must be
+// at its first row. Returns nullopt if decoding fails.
+[[nodiscard]] auto ConvertEquirectToCube(HdrDecoder& decoder, std::uint32_t face_size,
+                                         unsigned thread_count) -> std::optional<CubeMap>;
+// Builds every mip from the previous one with a 4x4 tent filter weighted by the solid angle of the texels. Footprints
+// at the edge of a face continue on the neighbouring faces, so edge texels blend across the seams and every mip keeps
+// the average radiance of mip 0.
+auto GenerateCubeMips(CubeMap& cube, unsigned thread_count) -> void;
+// Box filters every face on its own, like ID3D11DeviceContext::GenerateMips
+auto GenerateCubeMipsBox(CubeMap& cube, unsigned thread_count) -> void;
+
+// Prefilters by importance sampling the GGX lobe. Mip 0 is a copy of the environment, mip m holds the environment
+// prefiltered for roughness m / (mip_count - 1). With V = N the per-sample terms only depend on the mip, so they are
+// computed once per mip instead of per texel, and the sample directions are built four at a time with SSE. Only the
+// mips whose bit is set in mip_mask are filled, the others stay zeroed, and the chain ends at the last of them.
+[[nodiscard]] auto PrefilterCubeMap(CubeMap const& env, std::uint32_t sample_count, unsigned thread_count,
+                                    std::uint32_t mip_mask = ~0u) -> CubeMap;
+// Same integral as PrefilterCubeMap, but half of the samples are drawn from the luminance of the environment and
+// combined with the GGX samples by multiple importance sampling with the balance heuristic. The environment samples
+// find small bright lights the lobe rarely hits, but the filtered lookups of both already blur such lights, so the
+// gain depends on the map. The env-sampling benchmark measures it.
+[[nodiscard]] auto PrefilterCubeMapMis(CubeMap const& env, std::uint32_t sample_count, unsigned thread_count,
+                                       std::uint32_t mip_mask = ~0u) -> CubeMap;
+// Scalar texel by texel prefilter that PrefilterCubeMap is checked against
+[[nodiscard]] auto PrefilterCubeMapReference(CubeMap const& env, std::uint32_t sample_count,
+                                             unsigned thread_count) -> CubeMap;
+
+// Converts the equirect map, generates the mips of the cube and prefilters the mips in mip_mask with the sampling of
+// the settings
+[[nodiscard]] auto BakeIbl(EquirectMap const& equirect, IblBakeSettings const& settings, unsigned thread_count,
+                           std::uint32_t mip_mask = ~0u) -> CubeMap;
+[[nodiscard]] auto BakeIbl(HdrDecoder& decoder, IblBakeSettings const& settings, unsigned thread_count,
+                           std::uint32_t mip_mask = ~0u) -> std::optional<CubeMap>;
+
+// Port of the mip selection of lighting.hlsli: the mip of a prefiltered chain of mip_count mips that a lookup with the
+// given roughness reads
+[[nodiscard]] auto ComputePrefilteredMip(float roughness, std::uint32_t mip_count) -> float;
+// Mask of the mips the trilinear lookups of roughness in [min_roughness, max_roughness] read, bit m for mip m. Always
+// contains mip 0, which the background shows.
+[[nodiscard]] auto ComputeReachablePrefilteredMips(float min_roughness, float max_roughness,
+                                                   std::uint32_t mip_count) -> std::uint32_t;
+// Loads the prefiltered cube from the IBL cache if it matches the contents of the HDR file and the settings,
+// otherwise bakes it on thread_count threads and rebakes the cache. Radiance files are streamed while baking.
+[[nodiscard]] auto LoadPrefilteredEnvironment(std::filesystem::path const& hdr_path, IblBakeSettings const& settings,
+                                              unsigned thread_count) -> std::optional<CubeMap>;
+// Same as above, but BC6H compresses the baked cube and caches the compressed blocks, which take a sixteenth of the
+// space of the float texels. The face size must be a multiple of 4.
+[[nodiscard]] auto LoadCompressedPrefilteredEnvironment(std::filesystem::path const& hdr_path,
+                                                        IblBakeSettings const& settings, Bc6hQuality quality,
+                                                        unsigned thread_count) -> std::optional<Bc6hCubeMap>;
+// Same as above, but only bakes the mips in required_mips and mip 0. The returned chain ends at the last required mip
+// and the mips it does not require may be zeroed. Mips missing from the cache are baked on demand and added to it, so
+// the cache grows to serve every scene, and a scene needing one more mip only pays for that mip.
+[[nodiscard]] auto LoadCompressedPrefilteredEnvironment(std::filesystem::path const& hdr_path,
+                                                        IblBakeSettings const& settings, std::uint32_t required_mips,
+                                                        Bc6hQuality quality,
+                                                        unsigned thread_count) -> std::optional<PartialBc6hCubeMap>;
+}
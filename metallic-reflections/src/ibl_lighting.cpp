@@ -0,0 +1,86 @@
+#include "ibl_lighting.hpp"
+
+#include "brdf.hpp"
+
+import std;
+
+namespace refl {
+namespace {
+auto Dot(DirectX::XMFLOAT3 const& a, DirectX::XMFLOAT3 const& b) -> float {
+  return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+
+auto Saturate(float const value) -> float {
+  return std::clamp(value, 0.0f, 1.0f);
+}
+}
+
+
+auto EvaluateIblSpecular(CubeMap const& prefiltered_env, DfgLut const& dfg_lut, DirectX::XMFLOAT3 const& normal,
+                         DirectX::XMFLOAT3 const& view, Vector4 const& base_color,
+                         float const roughness) -> Vector4 {
+  auto const n_dot_v{Dot(normal, view)};
+  DirectX::XMFLOAT3 const r{
+    2 * n_dot_v * normal.x - view.x, 2 * n_dot_v * normal.y - view.y, 2 * n_dot_v * normal.z - view.z
+  };
+
+  auto const mip_count{static_cast<float>(prefiltered_env.mip_count)};
+  auto const env_mip{roughness * std::clamp(roughness * mip_count - 1, 0.0f, mip_count - 1)};
+  auto const env{SampleCubeMap(prefiltered_env, r, env_mip)};
+  auto const [scale, bias]{SampleDfgLut(dfg_lut, Saturate(n_dot_v), roughness)};
+
+  return {
+    env[0] * (base_color[0] * scale + bias), env[1] * (base_color[1] * scale + bias),
+    env[2] * (base_color[2] * scale + bias), 1
+  };
+}
+
+
+auto IntegrateIblSpecular(CubeMap const& env, DirectX::XMFLOAT3 const& normal, DirectX::XMFLOAT3 const& view,
+                          Vector4 const& base_color, float const roughness,
+                          std::uint32_t const grid_size) -> Vector4 {
+  DirectX::XMFLOAT3 tangent;
+  DirectX::XMFLOAT3 bitangent;
+  BuildBasis(normal, tangent, bitangent);
+
+  auto const n_dot_v{Dot(normal, view)};
+  std::array<double, 3> sum{};
+
+  for (std::uint32_t i{0}; i < grid_size; i++) {
+    for (std::uint32_t j{0}; j < grid_size; j++) {
+      std::array const xi{
+        (static_cast<float>(i) + 0.5f) / static_cast<float>(grid_size),
+        (static_cast<float>(j) + 0.5f) / static_cast<float>(grid_size)
+      };
+      auto const h_ts{SampleGgxNdf(xi, roughness * roughness)};
+      DirectX::XMFLOAT3 const h{
+        tangent.x * h_ts.x + bitangent.x * h_ts.y + normal.x * h_ts.z,
+        tangent.y * h_ts.x + bitangent.y * h_ts.y + normal.y * h_ts.z,
+        tangent.z * h_ts.x + bitangent.z * h_ts.y + normal.z * h_ts.z
+      };
+      auto const v_dot_h{Dot(view, h)};
+      DirectX::XMFLOAT3 const l{2 * v_dot_h * h.x - view.x, 2 * v_dot_h * h.y - view.y, 2 * v_dot_h * h.z - view.z};
+      auto const n_dot_l{Dot(normal, l)};
+
+      if (n_dot_l <= 0 || v_dot_h <= 0) {
+        continue;
+      }
+
+      // BRDF * N.L / pdf, with pdf = D * N.H / (4 V.H)
+      auto const g_vis{GeometrySmithIbl(n_dot_v, n_dot_l, roughness) * v_dot_h / (h_ts.z * n_dot_v)};
+      auto const radiance{SampleCubeMap(env, l, 0)};
+
+      for (std::size_t c{0}; c < 3; c++) {
+        sum[c] += static_cast<double>(radiance[c] * FresnelSchlick(v_dot_h, base_color[c]) * g_vis);
+      }
+    }
+  }
+
+  auto const inv_count{1.0 / (static_cast<double>(grid_size) * grid_size)};
+  return {
+    static_cast<float>(sum[0] * inv_count), static_cast<float>(sum[1] * inv_count),
+    static_cast<float>(sum[2] * inv_count), 1
+  };
+}
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+
+#include <DirectXMath.h>
+
+#include "dfg_lut.hpp"
+#include "environment_map.hpp"
+#include "scene.hpp"
+
+namespace refl {
+// Port of the environment term of lighting.hlsli. normal and view are unit vectors, view points from the surface
+// towards the camera. Only the rgb of the result is meaningful.
+[[nodiscard]] auto EvaluateIblSpecular(CubeMap const& prefiltered_env, DfgLut const& dfg_lut,
+                                       DirectX::XMFLOAT3 const& normal, DirectX::XMFLOAT3 const& view,
+                                       Vector4 const& base_color, float roughness) -> Vector4;
+// The integral the split sum approximates: the GGX specular BRDF against mip 0 of the environment, importance sampled
+// on a stratified grid of grid_size * grid_size half vectors
+[[nodiscard]] auto IntegrateIblSpecular(CubeMap const& env, DirectX::XMFLOAT3 const& normal,
+                                        DirectX::XMFLOAT3 const& view, Vector4 const& base_color, float roughness,
+                                        std::uint32_t grid_size) -> Vector4;
+}
@@ -0,0 +1,427 @@
+#include "irradiance_sh.hpp"
+
+#include <xmmintrin.h>
+
+#include "cache.hpp"
+#include "mapped_file.hpp"
+#include "parallel.hpp"
+
+import std;
+
+namespace refl {
+namespace {
+// Bump when the output of the projection changes
+std::uint32_t constexpr kIrradianceShVersion{1};
+
+std::array<char, 8> constexpr kIrradianceShCacheMagic{'R', 'E', 'F', 'L', 'S', 'H', '\0', '\0'};
+
+// Scanlines decoded at once when streaming a Radiance file
+std::uint32_t constexpr kShBandRowCount{64};
+// Rows handed to a thread at once
+std::size_t constexpr kShRowsPerChunk{8};
+
+// Per basis function, the square of its normalization times the coefficient of the clamped cosine in its band over
+// pi. The cosine coefficients are pi, 2 pi / 3 and pi / 4 for bands 0, 1 and 2.
+std::array constexpr kShScales{
+  1 / (4 * std::numbers::pi),
+  1 / (2 * std::numbers::pi), 1 / (2 * std::numbers::pi), 1 / (2 * std::numbers::pi),
+  15 / (16 * std::numbers::pi), 15 / (16 * std::numbers::pi), 5 / (64 * std::numbers::pi),
+  15 / (16 * std::numbers::pi), 15 / (64 * std::numbers::pi)
+};
+
+struct IrradianceShCacheHeader {
+  std::array<char, 8> magic;
+  std::uint64_t key;
+  std::uint64_t file_size;
+};
+
+
+// Integral of the radiance times every basis function before scaling, rgb
+using ShProjection = std::array<std::array<double, 3>, 9>;
+
+// Sums of the radiance of an equirect row weighted by the Fourier terms of the longitude: 1, cos, sin, cos 2, sin 2.
+// Every basis function is a polynomial in the sine and cosine of the polar angle times one of these terms, so a row
+// only takes five multiply-adds per texel.
+using EquirectRowSums = std::array<Vector4, 5>;
+
+
+struct LongitudeTable {
+  std::vector<float> cos;
+  std::vector<float> sin;
+  std::vector<float> cos2;
+  std::vector<float> sin2;
+};
+
+
+// Longitude of the center of an equirect column, the mapping of ConvertEquirectToCube
+auto GetColumnLongitude(std::uint32_t const x, std::uint32_t const width) -> double {
+  return ((x + 0.5) / width - 0.5) * 2 * std::numbers::pi;
+}
+
+
+// Polar angle of the center of an equirect row
+auto GetRowPolarAngle(std::uint32_t const y, std::uint32_t const height) -> double {
+  return (y + 0.5) / height * std::numbers::pi;
+}
+
+
+// Solid angle of a texel of an equirect row, exact for the band of the sphere the row covers
+auto GetRowTexelSolidAngle(std::uint32_t const y, std::uint32_t const width, std::uint32_t const height) -> double {
+  return 2 * std::numbers::pi / width *
+         (std::cos(std::numbers::pi * y / height) - std::cos(std::numbers::pi * (y + 1) / height));
+}
+
+
+auto BuildLongitudeTable(std::uint32_t const width) -> LongitudeTable {
+  LongitudeTable table{
+    .cos = std::vector<float>(width), .sin = std::vector<float>(width), .cos2 = std::vector<float>(width),
+    .sin2 = std::vector<float>(width)
+  };
+
+  for (std::uint32_t x{0}; x < width; x++) {
+    auto const phi{GetColumnLongitude(x, width)};
+    table.cos[x] = static_cast<float>(std::cos(phi));
+    table.sin[x] = static_cast<float>(std::sin(phi));
+    table.cos2[x] = static_cast<float>(std::cos(2 * phi));
+    table.sin2[x] = static_cast<float>(std::sin(2 * phi));
+  }
+
+  return table;
+}
+
+
+auto SumEquirectRow(std::span<Vector4 const> const row, LongitudeTable const& table) -> EquirectRowSums {
+  auto sum{_mm_setzero_ps()};
+  auto sum_cos{_mm_setzero_ps()};
+  auto sum_sin{_mm_setzero_ps()};
+  auto sum_cos2{_mm_setzero_ps()};
+  auto sum_sin2{_mm_setzero_ps()};
+
+  for (std::size_t x{0}; x < row.size(); x++) {
+    auto const texel{_mm_loadu_ps(row[x].data())};
+    sum = _mm_add_ps(sum, texel);
+    sum_cos = _mm_add_ps(sum_cos, _mm_mul_ps(texel, _mm_set1_ps(table.cos[x])));
+    sum_sin = _mm_add_ps(sum_sin, _mm_mul_ps(texel, _mm_set1_ps(table.sin[x])));
+    sum_cos2 = _mm_add_ps(sum_cos2, _mm_mul_ps(texel, _mm_set1_ps(table.cos2[x])));
+    sum_sin2 = _mm_add_ps(sum_sin2, _mm_mul_ps(texel, _mm_set1_ps(table.sin2[x])));
+  }
+
+  EquirectRowSums sums;
+  _mm_storeu_ps(sums[0].data(), sum);
+  _mm_storeu_ps(sums[1].data(), sum_cos);
+  _mm_storeu_ps(sums[2].data(), sum_sin);
+  _mm_storeu_ps(sums[3].data(), sum_cos2);
+  _mm_storeu_ps(sums[4].data(), sum_sin2);
+  return sums;
+}
+
+
+// With the direction (s cos phi, t, s sin phi), s and t the sine and cosine of the polar angle
+auto AddEquirectRow(EquirectRowSums const& sums, std::uint32_t const y, std::uint32_t const width,
+                    std::uint32_t const height, ShProjection& projection) -> void {
+  auto const theta{GetRowPolarAngle(y, height)};
+  auto const s{std::sin(theta)};
+  auto const t{std::cos(theta)};
+  auto const solid_angle{GetRowTexelSolidAngle(y, width, height)};
+
+  for (std::size_t c{0}; c < 3; c++) {
+    auto const sum{sums[0][c] * solid_angle};
+    auto const sum_cos{sums[1][c] * solid_angle};
+    auto const sum_sin{sums[2][c] * solid_angle};
+    auto const sum_cos2{sums[3][c] * solid_angle};
+    auto const sum_sin2{sums[4][c] * solid_angle};
+
+    projection[0][c] += sum;
+    projection[1][c] += s * sum_cos;
+    projection[2][c] += t * sum;
+    projection[3][c] += s * sum_sin;
+    projection[4][c] += s * t * sum_cos;
+    projection[5][c] += s * t * sum_sin;
+    projection[6][c] += (3 * t * t - 1) * sum;
+    projection[7][c] += s * s / 2 * sum_sin2; // xz = s^2 sin(2 phi) / 2
+    projection[8][c] -= s * s * sum_cos2; // z^2 - x^2 = -s^2 cos(2 phi)
+  }
+}
+
+
+auto EvaluateShBasis(double const x, double const y, double const z) -> std::array<double, 9> {
+  return {1, x, y, z, x * y, y * z, 3 * y * y - 1, x * z, z * z - x * x};
+}
+
+
+auto FinishProjection(ShProjection const& projection) -> IrradianceSh {
+  IrradianceSh sh{};
+
+  for (std::size_t i{0}; i < sh.coeffs.size(); i++) {
+    for (std::size_t c{0}; c < 3; c++) {
+      sh.coeffs[i][c] = static_cast<float>(projection[i][c] * kShScales[i]);
+    }
+  }
+
+  return sh;
+}
+
+
+auto FinishEquirectProjection(std::span<EquirectRowSums const> const row_sums,
+                              std::uint32_t const width) -> IrradianceSh {
+  ShProjection projection{};
+  auto const height{static_cast<std::uint32_t>(row_sums.size())};
+
+  for (std::uint32_t y{0}; y < height; y++) {
+    AddEquirectRow(row_sums[y], y, width, height, projection);
+  }
+
+  return FinishProjection(projection);
+}
+
+
+auto ProjectIrradianceShFromFile(std::filesystem::path const& hdr_path,
+                                 unsigned const thread_count) -> std::optional<IrradianceSh> {
+  if (auto const decoder{HdrDecoder::New(hdr_path)}) {
+    return ProjectIrradianceSh(*decoder, thread_count);
+  }
+
+  if (auto const equirect{LoadEquirectMap(hdr_path)}) {
+    return ProjectIrradianceSh(*equirect, thread_count);
+  }
+
+  return std::nullopt;
+}
+
+
+auto ReadIrradianceShCache(std::filesystem::path const& cache_path,
+                           std::uint64_t const key) -> std::optional<IrradianceSh> {
+  auto const file{MappedFile::New(cache_path)};
+
+  if (!file) {
+    return std::nullopt;
+  }
+
+  auto const data{file->GetData()};
+
+  if (data.size() != sizeof(IrradianceShCacheHeader) + sizeof(IrradianceSh)) {
+    return std::nullopt;
+  }
+
+  IrradianceShCacheHeader header;
+  std::memcpy(&header, data.data(), sizeof(header));
+
+  if (header.magic != kIrradianceShCacheMagic || header.key != key || header.file_size != data.size()) {
+    return std::nullopt;
+  }
+
+  IrradianceSh sh;
+  std::memcpy(&sh, data.data() + sizeof(IrradianceShCacheHeader), sizeof(sh));
+  return sh;
+}
+
+
+auto WriteIrradianceShCache(std::filesystem::path const& cache_path, std::uint64_t const key,
+                            IrradianceSh const& sh) -> bool {
+  IrradianceShCacheHeader const header{
+    .magic = kIrradianceShCacheMagic,
+    .key = key,
+    .file_size = sizeof(IrradianceShCacheHeader) + sizeof(IrradianceSh)
+  };
+
+  return WriteFileAtomically(cache_path, {std::as_bytes(std::span{&header, 1}), std::as_bytes(std::span{&sh, 1})});
+}
+}
+
+
+auto ProjectIrradianceSh(EquirectMap const& equirect, unsigned const thread_count) -> IrradianceSh {
+  auto const table{BuildLongitudeTable(equirect.width)};
+  std::vector<EquirectRowSums> row_sums(equirect.height);
+
+  ParallelFor(equirect.height, thread_count, [&](std::size_t const y) {
+    row_sums[y] = SumEquirectRow(std::span{equirect.texels}.subspan(y * equirect.width, equirect.width), table);
+  }, kShRowsPerChunk);
+
+  return FinishEquirectProjection(row_sums, equirect.width);
+}
+
+
+auto ProjectIrradianceSh(HdrDecoder& decoder, unsigned const thread_count) -> std::optional<IrradianceSh> {
+  auto const width{decoder.GetWidth()};
+  auto const height{decoder.GetHeight()};
+  auto const table{BuildLongitudeTable(width)};
+  std::vector<EquirectRowSums> row_sums(height);
+  std::vector<Vector4> band(static_cast<std::size_t>(width) * std::min(kShBandRowCount, height));
+
+  for (std::uint32_t first_row{0}; first_row < height; first_row += kShBandRowCount) {
+    auto const row_count{std::min(kShBandRowCount, height - first_row)};
+    auto const band_texels{std::span{band}.first(static_cast<std::size_t>(row_count) * width)};
+
+    if (!decoder.DecodeRows(band_texels)) {
+      return std::nullopt;
+    }
+
+    ParallelFor(row_count, thread_count, [&](std::size_t const i) {
+      row_sums[first_row + i] = SumEquirectRow(band_texels.subspan(i * width, width), table);
+    }, kShRowsPerChunk);
+  }
+
+  return FinishEquirectProjection(row_sums, width);
+}
+
+
+auto ProjectIrradianceSh(CubeMap const& cube, unsigned const thread_count) -> IrradianceSh {
+  auto const size{cube.face_size};
+  auto const solid_angles{ComputeCubeMapSolidAngles(size)};
+  std::vector<std::array<Vector4, 9>> row_sums(6 * static_cast<std::size_t>(size));
+
+  ParallelFor(row_sums.size(), thread_count, [&](std::size_t const row_idx) {
+    auto const face{static_cast<std::uint32_t>(row_idx / size)};
+    auto const y{static_cast<std::uint32_t>(row_idx % size)};
+    auto const texels{cube.GetFaceMip(face, 0).subspan(static_cast<std::size_t>(y) * size, size)};
+    std::array<__m128, 9> sums;
+    sums.fill(_mm_setzero_ps());
+
+    for (std::uint32_t x{0}; x < size; x++) {
+      auto const dir{ComputeCubeMapDirection(face, x, y, size)};
+      auto const basis{EvaluateShBasis(dir.x, dir.y, dir.z)};
+      auto const texel{
+        _mm_mul_ps(_mm_loadu_ps(texels[x].data()), _mm_set1_ps(solid_angles[static_cast<std::size_t>(y) * size + x]))
+      };
+
+      for (std::size_t i{0}; i < sums.size(); i++) {
+        sums[i] = _mm_add_ps(sums[i], _mm_mul_ps(texel, _mm_set1_ps(static_cast<float>(basis[i]))));
+      }
+    }
+
+    for (std::size_t i{0}; i < sums.size(); i++) {
+      _mm_storeu_ps(row_sums[row_idx][i].data(), sums[i]);
+    }
+  }, kShRowsPerChunk);
+
+  ShProjection projection{};
+
+  for (auto const& sums : row_sums) {
+    for (std::size_t i{0}; i < sums.size(); i++) {
+      for (std::size_t c{0}; c < 3; c++) {
+        projection[i][c] += sums[i][c];
+      }
+    }
+  }
+
+  return FinishProjection(projection);
+}
+
+
+auto ProjectIrradianceShReference(EquirectMap const& equirect) -> IrradianceSh {
+  ShProjection projection{};
+
+  for (std::uint32_t y{0}; y < equirect.height; y++) {
+    auto const theta{GetRowPolarAngle(y, equirect.height)};
+    auto const solid_angle{GetRowTexelSolidAngle(y, equirect.width, equirect.height)};
+
+    for (std::uint32_t x{0}; x < equirect.width; x++) {
+      auto const phi{GetColumnLongitude(x, equirect.width)};
+      auto const basis{
+        EvaluateShBasis(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi))
+      };
+      auto const& texel{equirect.texels[static_cast<std::size_t>(y) * equirect.width + x]};
+
+      for (std::size_t i{0}; i < basis.size(); i++) {
+        for (std::size_t c{0}; c < 3; c++) {
+          projection[i][c] += texel[c] * basis[i] * solid_angle;
+        }
+      }
+    }
+  }
+
+  return FinishProjection(projection);
+}
+
+
+auto EvaluateIrradianceSh(IrradianceSh const& sh, DirectX::XMFLOAT3 const& normal) -> Vector4 {
+  auto const& [x, y, z]{normal};
+  std::array const basis{1.0f, x, y, z, x * y, y * z, 3 * y * y - 1, x * z, z * z - x * x};
+  Vector4 ret{0, 0, 0, 1};
+
+  for (std::size_t i{0}; i < basis.size(); i++) {
+    for (std::size_t c{0}; c < 3; c++) {
+      ret[c] += sh.coeffs[i][c] * basis[i];
+    }
+  }
+
+  return ret;
+}
+
+
+auto IntegrateIrradiance(EquirectMap const& equirect, DirectX::XMFLOAT3 const& normal,
+                         IrradianceKernel const kernel) -> Vector4 {
+  auto const table{BuildLongitudeTable(equirect.width)};
+  std::array<double, 3> sum{};
+
+  for (std::uint32_t y{0}; y < equirect.height; y++) {
+    auto const theta{GetRowPolarAngle(y, equirect.height)};
+    auto const s{std::sin(theta)};
+    auto const t{std::cos(theta)};
+    auto const solid_angle{GetRowTexelSolidAngle(y, equirect.width, equirect.height)};
+
+    for (std::uint32_t x{0}; x < equirect.width; x++) {
+      auto const n_dot_l{normal.x * s * table.cos[x] + normal.y * t + normal.z * s * table.sin[x]};
+      // Legendre series of max(n_dot_l, 0) up to P2
+      auto const weight{
+        kernel == IrradianceKernel::kClampedCosine
+          ? std::max(n_dot_l, 0.0)
+          : 0.25 + 0.5 * n_dot_l + 5.0 / 32.0 * (3.0 * n_dot_l * n_dot_l - 1.0)
+      };
+
+      if (weight == 0) {
+        continue;
+      }
+
+      auto const& texel{equirect.texels[static_cast<std::size_t>(y) * equirect.width + x]};
+
+      for (std::size_t c{0}; c < 3; c++) {
+        sum[c] += texel[c] * weight * solid_angle;
+      }
+    }
+  }
+
+  return {
+    static_cast<float>(sum[0] / std::numbers::pi), static_cast<float>(sum[1] / std::numbers::pi),
+    static_cast<float>(sum[2] / std::numbers::pi), 1
+  };
+}
+
+
+auto LoadIrradianceSh(std::filesystem::path const& hdr_path,
+                      unsigned const thread_count) -> std::optional<IrradianceSh> {
+  using Milliseconds = std::chrono::duration<double, std::milli>;
+
+  auto const source_hash{HashFileContents(hdr_path)};
+
+  if (!source_hash) {
+    std::cerr << "Failed to read environment map file.\n";
+    return std::nullopt;
+  }
+
+  auto const cache_key{HashValue(kIrradianceShVersion, *source_hash)};
+  auto const cache_path{GetCacheFilePath(hdr_path, ".reflsh")};
+
+  if (auto const sh{ReadIrradianceShCache(cache_path, cache_key)}) {
+    return sh;
+  }
+
+  auto const begin{std::chrono::steady_clock::now()};
+  auto const sh{ProjectIrradianceShFromFile(hdr_path, thread_count)};
+  auto const end{std::chrono::steady_clock::now()};
+
+  if (!sh) {
+    std::cerr << "Failed to load environment map image.\n";
+    return std::nullopt;
+  }
+
+  std::cout << std::format("Decoding the environment and projecting it to spherical harmonics took {:.2f} ms.\n",
+                           Milliseconds{end - begin}.count());
+
+  if (!WriteIrradianceShCache(cache_path, cache_key, *sh)) {
+    std::cerr << "Failed to write irradiance cache.\n";
+  }
+
+  return sh;
+}
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+
+#include <DirectXMath.h>
+
+#include "environment_map.hpp"
+#include "hdr_decoder.hpp"
+
+namespace refl {
+// Diffuse lighting of an environment in the 9 real spherical harmonics of bands 0 to 2, in the order
+// 1, x, y, z, xy, yz, 3y^2 - 1, xz, z^2 - x^2. The coefficients already include the cosine convolution, the 1 / pi of
+// the Lambertian BRDF and the normalization of the basis, so evaluating them is a handful of multiply-adds. rgb in
+// the first three channels, the fourth is unused.
+struct IrradianceSh {
+  std::array<Vector4, 9> coeffs;
+};
+
+// Projections weighting every texel by its solid angle. Rows are reduced one by one and added in a fixed order, so
+// the result does not depend on the thread count.
+[[nodiscard]] auto ProjectIrradianceSh(EquirectMap const& equirect, unsigned thread_count) -> IrradianceSh;
+// Streams the scanlines of the decoder in bands. Returns nullopt if the file is truncated or corrupt.
+[[nodiscard]] auto ProjectIrradianceSh(HdrDecoder& decoder, unsigned thread_count) -> std::optional<IrradianceSh>;
+// Projects mip 0
+[[nodiscard]] auto ProjectIrradianceSh(CubeMap const& cube, unsigned thread_count) -> IrradianceSh;
+// Scalar projection in double precision, texel by texel, that the fast ones are checked against
+[[nodiscard]] auto ProjectIrradianceShReference(EquirectMap const& equirect) -> IrradianceSh;
+
+// Port of the diffuse term of lighting.hlsli: the radiance a white Lambertian surface with the given unit normal
+// reflects. Alpha is 1.
+[[nodiscard]] auto EvaluateIrradianceSh(IrradianceSh const& sh, DirectX::XMFLOAT3 const& normal) -> Vector4;
+// The cosine lobe IntegrateIrradiance convolves the environment with
+enum class IrradianceKernel : std::uint32_t {
+  kClampedCosine, // What the coefficients approximate
+  kBandLimited // The clamped cosine truncated to bands 0 to 2, which the coefficients reproduce up to rounding
+};
+
+// Brute force convolution of the environment with the kernel over every texel, divided by pi. The truncated kernel
+// rings around small bright lights, so the difference of the two is the error of the approximation. Alpha is 1.
+[[nodiscard]] auto IntegrateIrradiance(EquirectMap const& equirect, DirectX::XMFLOAT3 const& normal,
+                                       IrradianceKernel kernel) -> Vector4;
+
+// Reads the coefficients of an environment map from the cache or projects and caches them. Radiance files are
+// streamed, other formats go through stb_image.
+[[nodiscard]] auto LoadIrradianceSh(std::filesystem::path const& hdr_path,
+                                    unsigned thread_count) -> std::optional<IrradianceSh>;
+}
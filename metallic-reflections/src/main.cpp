@@ -5,13 +5,22 @@
 #define NOMINMAX
 #include <d3d11_4.h>
 #include <dxgi1_6.h>
-#include <stb_image.h>
 #include <Windows.h>
 #include <wrl/client.h>
 
+#include "benchmarks.hpp"
+#include "dfg_lut.hpp"
+#include "frustum.hpp"
+#include "gpu_scene.hpp"
+#include "ibl_baker.hpp"
+#include "irradiance_sh.hpp"
+#include "mesh_lod.hpp"
 #include "OrbitingCamera.hpp"
+#include "parallel.hpp"
 #include "scene.hpp"
+#include "scene_textures.hpp"
 #include "shader_collection.hpp"
+#include "ssr.hpp"
 #include "winapi_helpers.hpp"
 #include "window.hpp"
 #include "shaders/shader_interop.h"
@@ -19,11 +28,22 @@
 import std;
 
 auto wmain(int const argc, wchar_t** const argv) -> int {
+  if (argc > 1 && std::wstring_view{argv[1]} == L"--benchmark") {
+    return refl::RunBenchmark(std::span{argv + 2, argv + argc});
+  }
+
   if (argc <= 2) {
-    std::cerr << "Usage: metallic-reflections <path-to-model-file> <path-to-environment-map>\n";
+    std::cerr << "Usage: metallic-reflections <path-to-model-file> <path-to-environment-map> [--float-vertices]\n"
+                 "       metallic-reflections --benchmark <benchmark> <args...>\n";
     return -1;
   }
 
+  // Draws from the unpacked float vertex streams instead of the packed ones, to compare the two
+  auto const vertex_layout{
+    argc > 3 && std::wstring_view{argv[3]} == L"--float-vertices" ? refl::VertexLayout::kFloat
+                                                                   : refl::VertexLayout::kPacked
+  };
+
   auto wnd{refl::Window::New()};
 
   if (!wnd) {
@@ -191,6 +211,113 @@ auto wmain(int const argc, wchar_t** const argv) -> int {
   ComPtr<ID3D11ShaderResourceView> ssr_srv;
   ThrowIfFailed(dev->CreateShaderResourceView(ssr_tex.Get(), &ssr_srv_desc, &ssr_srv));
 
+  // Source and hit pixel of the rays the SSR pass traces one per block of pixels, sized for the smallest blocks. Larger
+  // blocks use its top left corner.
+
+  D3D11_TEXTURE2D_DESC const ssr_hits_tex_desc{
+    .Width = (output_width + 1) / 2,
+    .Height = (output_height + 1) / 2,
+    .MipLevels = 1,
+    .ArraySize = 1,
+    .Format = DXGI_FORMAT_R32G32_UINT,
+    .SampleDesc = {.Count = 1, .Quality = 0},
+    .Usage = D3D11_USAGE_DEFAULT,
+    .BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS,
+    .CPUAccessFlags = 0,
+    .MiscFlags = 0,
+  };
+
+  ComPtr<ID3D11Texture2D> ssr_hits_tex;
+  ThrowIfFailed(dev->CreateTexture2D(&ssr_hits_tex_desc, nullptr, &ssr_hits_tex));
+
+  D3D11_UNORDERED_ACCESS_VIEW_DESC const ssr_hits_uav_desc{
+    .Format = ssr_hits_tex_desc.Format,
+    .ViewDimension = D3D11_UAV_DIMENSION_TEXTURE2D,
+    .Texture2D = {.MipSlice = 0}
+  };
+
+  ComPtr<ID3D11UnorderedAccessView> ssr_hits_uav;
+  ThrowIfFailed(dev->CreateUnorderedAccessView(ssr_hits_tex.Get(), &ssr_hits_uav_desc, &ssr_hits_uav));
+
+  D3D11_SHADER_RESOURCE_VIEW_DESC const ssr_hits_srv_desc{
+    .Format = ssr_hits_tex_desc.Format,
+    .ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D,
+    .Texture2D = {.MostDetailedMip = 0, .MipLevels = 1}
+  };
+
+  ComPtr<ID3D11ShaderResourceView> ssr_hits_srv;
+  ThrowIfFailed(dev->CreateShaderResourceView(ssr_hits_tex.Get(), &ssr_hits_srv_desc, &ssr_hits_srv));
+
+  // View space distance from every pixel to the point its SSR ray hit, for the SSR temporal pass
+
+  D3D11_TEXTURE2D_DESC const ssr_hit_dist_tex_desc{
+    .Width = output_width,
+    .Height = output_height,
+    .MipLevels = 1,
+    .ArraySize = 1,
+    .Format = DXGI_FORMAT_R32_FLOAT,
+    .SampleDesc = {.Count = 1, .Quality = 0},
+    .Usage = D3D11_USAGE_DEFAULT,
+    .BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS,
+    .CPUAccessFlags = 0,
+    .MiscFlags = 0,
+  };
+
+  ComPtr<ID3D11Texture2D> ssr_hit_dist_tex;
+  ThrowIfFailed(dev->CreateTexture2D(&ssr_hit_dist_tex_desc, nullptr, &ssr_hit_dist_tex));
+
+  D3D11_UNORDERED_ACCESS_VIEW_DESC const ssr_hit_dist_uav_desc{
+    .Format = ssr_hit_dist_tex_desc.Format,
+    .ViewDimension = D3D11_UAV_DIMENSION_TEXTURE2D,
+    .Texture2D = {.MipSlice = 0}
+  };
+
+  ComPtr<ID3D11UnorderedAccessView> ssr_hit_dist_uav;
+  ThrowIfFailed(dev->CreateUnorderedAccessView(ssr_hit_dist_tex.Get(), &ssr_hit_dist_uav_desc, &ssr_hit_dist_uav));
+
+  D3D11_SHADER_RESOURCE_VIEW_DESC const ssr_hit_dist_srv_desc{
+    .Format = ssr_hit_dist_tex_desc.Format,
+    .ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D,
+    .Texture2D = {.MostDetailedMip = 0, .MipLevels = 1}
+  };
+
+  ComPtr<ID3D11ShaderResourceView> ssr_hit_dist_srv;
+  ThrowIfFailed(dev->CreateShaderResourceView(ssr_hit_dist_tex.Get(), &ssr_hit_dist_srv_desc, &ssr_hit_dist_srv));
+
+  // Color the SSR ray of every pixel hit scaled by its coverage, and the coverage, for the SSR temporal pass
+
+  ComPtr<ID3D11Texture2D> ssr_reflection_tex;
+  ThrowIfFailed(dev->CreateTexture2D(&ssr_tex_desc, nullptr, &ssr_reflection_tex));
+
+  ComPtr<ID3D11UnorderedAccessView> ssr_reflection_uav;
+  ThrowIfFailed(dev->CreateUnorderedAccessView(ssr_reflection_tex.Get(), &ssr_uav_tex, &ssr_reflection_uav));
+
+  ComPtr<ID3D11ShaderResourceView> ssr_reflection_srv;
+  ThrowIfFailed(dev->CreateShaderResourceView(ssr_reflection_tex.Get(), &ssr_srv_desc, &ssr_reflection_srv));
+
+  // Output of the SSR temporal pass, the accumulated reflection composited over the lighting of this frame
+
+  ComPtr<ID3D11Texture2D> ssr_temporal_tex;
+  ThrowIfFailed(dev->CreateTexture2D(&ssr_tex_desc, nullptr, &ssr_temporal_tex));
+
+  ComPtr<ID3D11UnorderedAccessView> ssr_temporal_uav;
+  ThrowIfFailed(dev->CreateUnorderedAccessView(ssr_temporal_tex.Get(), &ssr_uav_tex, &ssr_temporal_uav));
+
+  ComPtr<ID3D11ShaderResourceView> ssr_temporal_srv;
+  ThrowIfFailed(dev->CreateShaderResourceView(ssr_temporal_tex.Get(), &ssr_srv_desc, &ssr_temporal_srv));
+
+  // Reflection term the SSR temporal pass accumulates. Every frame writes one and reads the other as the history.
+
+  std::array<ComPtr<ID3D11Texture2D>, 2> ssr_history_texs;
+  std::array<ComPtr<ID3D11UnorderedAccessView>, 2> ssr_history_uavs;
+  std::array<ComPtr<ID3D11ShaderResourceView>, 2> ssr_history_srvs;
+
+  for (std::size_t i{0}; i < ssr_history_texs.size(); i++) {
+    ThrowIfFailed(dev->CreateTexture2D(&ssr_tex_desc, nullptr, &ssr_history_texs[i]));
+    ThrowIfFailed(dev->CreateUnorderedAccessView(ssr_history_texs[i].Get(), &ssr_uav_tex, &ssr_history_uavs[i]));
+    ThrowIfFailed(dev->CreateShaderResourceView(ssr_history_texs[i].Get(), &ssr_srv_desc, &ssr_history_srvs[i]));
+  }
+
   D3D11_TEXTURE2D_DESC const sdr_tex_desc{
     .Width = output_width,
     .Height = output_height,
@@ -319,6 +446,93 @@ auto wmain(int const argc, wchar_t** const argv) -> int {
   ComPtr<ID3D11ShaderResourceView> depth_srv;
   ThrowIfFailed(dev->CreateShaderResourceView(depth_tex.Get(), &depth_srv_desc, &depth_srv));
 
+  // Copy of the depth buffer of the previous frame, for the disocclusion test of the SSR temporal pass
+
+  D3D11_TEXTURE2D_DESC const prev_depth_tex_desc{
+    .Width = output_width,
+    .Height = output_height,
+    .MipLevels = 1,
+    .ArraySize = 1,
+    .Format = depth_tex_desc.Format,
+    .SampleDesc = {.Count = 1, .Quality = 0},
+    .Usage = D3D11_USAGE_DEFAULT,
+    .BindFlags = D3D11_BIND_SHADER_RESOURCE,
+    .CPUAccessFlags = 0,
+    .MiscFlags = 0
+  };
+
+  ComPtr<ID3D11Texture2D> prev_depth_tex;
+  ThrowIfFailed(dev->CreateTexture2D(&prev_depth_tex_desc, nullptr, &prev_depth_tex));
+
+  ComPtr<ID3D11ShaderResourceView> prev_depth_srv;
+  ThrowIfFailed(dev->CreateShaderResourceView(prev_depth_tex.Get(), &depth_srv_desc, &prev_depth_srv));
+
+  // Min and max linear view depth pyramid of the depth buffer for the Hi-Z march of the SSR pass. Every mip is built
+  // from the one above it, so each gets its own views.
+
+  auto const hiz_mip_count{static_cast<UINT>(std::bit_width(std::max(output_width, output_height)))};
+
+  D3D11_TEXTURE2D_DESC const hiz_tex_desc{
+    .Width = output_width,
+    .Height = output_height,
+    .MipLevels = hiz_mip_count,
+    .ArraySize = 1,
+    .Format = DXGI_FORMAT_R32G32_FLOAT,
+    .SampleDesc = {.Count = 1, .Quality = 0},
+    .Usage = D3D11_USAGE_DEFAULT,
+    .BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS,
+    .CPUAccessFlags = 0,
+    .MiscFlags = 0
+  };
+
+  ComPtr<ID3D11Texture2D> hiz_tex;
+  ThrowIfFailed(dev->CreateTexture2D(&hiz_tex_desc, nullptr, &hiz_tex));
+
+  D3D11_SHADER_RESOURCE_VIEW_DESC const hiz_srv_desc{
+    .Format = hiz_tex_desc.Format,
+    .ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D,
+    .Texture2D = {.MostDetailedMip = 0, .MipLevels = hiz_mip_count}
+  };
+
+  ComPtr<ID3D11ShaderResourceView> hiz_srv;
+  ThrowIfFailed(dev->CreateShaderResourceView(hiz_tex.Get(), &hiz_srv_desc, &hiz_srv));
+
+  std::vector<ComPtr<ID3D11ShaderResourceView>> hiz_mip_srvs(hiz_mip_count);
+  std::vector<ComPtr<ID3D11UnorderedAccessView>> hiz_mip_uavs(hiz_mip_count);
+  std::vector<ComPtr<ID3D11Buffer>> hiz_mip_cbufs(hiz_mip_count);
+
+  for (UINT mip{0}; mip < hiz_mip_count; mip++) {
+    D3D11_SHADER_RESOURCE_VIEW_DESC const hiz_mip_srv_desc{
+      .Format = hiz_tex_desc.Format,
+      .ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D,
+      .Texture2D = {.MostDetailedMip = mip, .MipLevels = 1}
+    };
+
+    ThrowIfFailed(dev->CreateShaderResourceView(hiz_tex.Get(), &hiz_mip_srv_desc, &hiz_mip_srvs[mip]));
+
+    D3D11_UNORDERED_ACCESS_VIEW_DESC const hiz_mip_uav_desc{
+      .Format = hiz_tex_desc.Format,
+      .ViewDimension = D3D11_UAV_DIMENSION_TEXTURE2D,
+      .Texture2D = {.MipSlice = mip}
+    };
+
+    ThrowIfFailed(dev->CreateUnorderedAccessView(hiz_tex.Get(), &hiz_mip_uav_desc, &hiz_mip_uavs[mip]));
+
+    HiZConstants const hiz_constants{.cur_mip = mip, .pad = {}};
+
+    D3D11_BUFFER_DESC constexpr hiz_cbuf_desc{
+      .ByteWidth = sizeof(HiZConstants),
+      .Usage = D3D11_USAGE_IMMUTABLE,
+      .BindFlags = D3D11_BIND_CONSTANT_BUFFER,
+      .CPUAccessFlags = 0,
+      .MiscFlags = 0,
+      .StructureByteStride = 0
+    };
+
+    D3D11_SUBRESOURCE_DATA const hiz_cbuf_data{.pSysMem = &hiz_constants, .SysMemPitch = 0, .SysMemSlicePitch = 0};
+    ThrowIfFailed(dev->CreateBuffer(&hiz_cbuf_desc, &hiz_cbuf_data, &hiz_mip_cbufs[mip]));
+  }
+
   D3D11_SAMPLER_DESC constexpr sampler_point_clamp_desc{
     .Filter = D3D11_FILTER_MIN_MAG_MIP_POINT,
     .AddressU = D3D11_TEXTURE_ADDRESS_CLAMP,
@@ -363,6 +577,30 @@ auto wmain(int const argc, wchar_t** const argv) -> int {
   ComPtr<ID3D11Buffer> cam_cbuf;
   ThrowIfFailed(dev->CreateBuffer(&cam_cbuf_desc, nullptr, &cam_cbuf));
 
+  D3D11_BUFFER_DESC constexpr ssr_cbuf_desc{
+    .ByteWidth = sizeof(SsrConstants),
+    .Usage = D3D11_USAGE_DYNAMIC,
+    .BindFlags = D3D11_BIND_CONSTANT_BUFFER,
+    .CPUAccessFlags = D3D11_CPU_ACCESS_WRITE,
+    .MiscFlags = 0,
+    .StructureByteStride = 0
+  };
+
+  ComPtr<ID3D11Buffer> ssr_cbuf;
+  ThrowIfFailed(dev->CreateBuffer(&ssr_cbuf_desc, nullptr, &ssr_cbuf));
+
+  D3D11_BUFFER_DESC constexpr ssr_temporal_cbuf_desc{
+    .ByteWidth = sizeof(SsrTemporalConstants),
+    .Usage = D3D11_USAGE_DYNAMIC,
+    .BindFlags = D3D11_BIND_CONSTANT_BUFFER,
+    .CPUAccessFlags = D3D11_CPU_ACCESS_WRITE,
+    .MiscFlags = 0,
+    .StructureByteStride = 0
+  };
+
+  ComPtr<ID3D11Buffer> ssr_temporal_cbuf;
+  ThrowIfFailed(dev->CreateBuffer(&ssr_temporal_cbuf_desc, nullptr, &ssr_temporal_cbuf));
+
   ShowWindow(wnd->GetHwnd(), SW_SHOW);
 
   // Load scene from disk
@@ -373,219 +611,147 @@ auto wmain(int const argc, wchar_t** const argv) -> int {
     return -1;
   }
 
+  // Load material textures from disk
+
+  auto scene_textures{refl::LoadSceneTextures(*cpu_scene, argv[1], refl::GetDefaultThreadCount(), true)};
+  refl::PrintTextureLoadStats(scene_textures.stats);
+
   // Create scene gpu data
 
-  auto const gpu_scene{refl::CreateGpuScene(*cpu_scene, *dev.Get())};
+  auto const gpu_scene{refl::CreateGpuScene(*cpu_scene, scene_textures, vertex_layout, *dev.Get())};
 
   if (!gpu_scene) {
     return -1;
   }
 
-  // Load environment map from disk
+  // The textures live on the GPU from now on
+  scene_textures = {};
 
-  struct Image {
-    int width;
-    int height;
-    int channel_count;
-    float* data;
+  // Load the prefiltered environment cube, baking and compressing it on the CPU if the cache is stale. Only the mips
+  // the roughness of the scene reaches are baked, the cache is filled in with the others as later scenes need them.
+
+  auto const prefiltered_env_mip_count{
+    static_cast<std::uint32_t>(std::bit_width(refl::kDefaultIblBakeSettings.face_size))
+  };
+  auto const roughness_range{refl::ComputeRoughnessRange(*cpu_scene)};
+  auto const prefiltered_env_mips{
+    roughness_range
+      ? refl::ComputeReachablePrefilteredMips(roughness_range->min, roughness_range->max, prefiltered_env_mip_count)
+      : 1u
   };
 
-  Image env_map_info;
-  env_map_info.data = stbi_loadf(reinterpret_cast<char const*>(std::filesystem::path{argv[2]}.u8string().data()),
-                                 &env_map_info.width, &env_map_info.height, &env_map_info.channel_count, 4);
+  auto prefiltered_env{
+    refl::LoadCompressedPrefilteredEnvironment(argv[2], refl::kDefaultIblBakeSettings, prefiltered_env_mips,
+                                               refl::Bc6hQuality::kQuality, refl::GetDefaultThreadCount())
+  };
 
-  if (!env_map_info.data) {
-    std::cerr << "Failed to load environment map image.\n";
+  if (!prefiltered_env) {
     return -1;
   }
 
-  // Create 2D texture and SRV for equirectangular environment map
-
-  D3D11_TEXTURE2D_DESC const equi_env_map_tex_desc{
-    .Width = static_cast<UINT>(env_map_info.width),
-    .Height = static_cast<UINT>(env_map_info.height),
-    .MipLevels = 1,
-    .ArraySize = 1,
-    .Format = DXGI_FORMAT_R32G32B32A32_FLOAT,
+  D3D11_TEXTURE2D_DESC const prefiltered_env_cube_tex_desc{
+    .Width = prefiltered_env->cube.face_size,
+    .Height = prefiltered_env->cube.face_size,
+    .MipLevels = prefiltered_env->cube.mip_count,
+    .ArraySize = 6,
+    .Format = DXGI_FORMAT_BC6H_UF16,
     .SampleDesc = {.Count = 1, .Quality = 0},
     .Usage = D3D11_USAGE_IMMUTABLE,
     .BindFlags = D3D11_BIND_SHADER_RESOURCE,
     .CPUAccessFlags = 0,
-    .MiscFlags = 0
-  };
-
-  D3D11_SUBRESOURCE_DATA const equi_env_map_tex_data{
-    .pSysMem = env_map_info.data,
-    .SysMemPitch = static_cast<UINT>(env_map_info.width * 4 * sizeof(float)),
-    .SysMemSlicePitch = 0
+    .MiscFlags = D3D11_RESOURCE_MISC_TEXTURECUBE
   };
 
-  ComPtr<ID3D11Texture2D> equi_env_map_tex;
-  ThrowIfFailed(dev->CreateTexture2D(&equi_env_map_tex_desc, &equi_env_map_tex_data, &equi_env_map_tex));
-
-  stbi_image_free(env_map_info.data);
-  env_map_info.data = nullptr;
-
-  D3D11_SHADER_RESOURCE_VIEW_DESC const equi_env_map_srv_desc{
-    .Format = equi_env_map_tex_desc.Format,
-    .ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D,
-    .Texture2D = {.MostDetailedMip = 0, .MipLevels = 1}
-  };
+  // The cube map stores its blocks in subresource order, the pitch is that of a row of blocks
+  std::vector<D3D11_SUBRESOURCE_DATA> prefiltered_env_cube_tex_data;
 
-  ComPtr<ID3D11ShaderResourceView> equi_env_map_srv;
-  ThrowIfFailed(dev->CreateShaderResourceView(equi_env_map_tex.Get(), &equi_env_map_srv_desc, &equi_env_map_srv));
+  for (unsigned face{0}; face < 6; face++) {
+    for (unsigned mip{0}; mip < prefiltered_env->cube.mip_count; mip++) {
+      prefiltered_env_cube_tex_data.push_back({
+        .pSysMem = prefiltered_env->cube.GetFaceMip(face, mip).data(),
+        .SysMemPitch = static_cast<UINT>(prefiltered_env->cube.GetMipBlockCount(mip) * sizeof(refl::Bc6hBlock)),
+        .SysMemSlicePitch = 0
+      });
+    }
+  }
 
-  // Create cubemap texture for environment map
+  ComPtr<ID3D11Texture2D> prefiltered_env_cube_tex;
+  ThrowIfFailed(dev->CreateTexture2D(&prefiltered_env_cube_tex_desc, prefiltered_env_cube_tex_data.data(),
+                                     &prefiltered_env_cube_tex));
 
-  auto constexpr env_cube_size{1024u};
-  auto const env_cube_mip_count{
-    static_cast<UINT>(std::floor(std::log2(static_cast<float>(env_cube_size)))) + 1U
-  };
+  // Create srv for all mips of the prefiltered environment cubemap
 
-  D3D11_TEXTURE2D_DESC const env_cube_tex_desc{
-    .Width = env_cube_size,
-    .Height = env_cube_size,
-    .MipLevels = env_cube_mip_count,
-    .ArraySize = 6,
-    .Format = DXGI_FORMAT_R32G32B32A32_FLOAT,
-    .SampleDesc = {.Count = 1, .Quality = 0},
-    .Usage = D3D11_USAGE_DEFAULT,
-    .BindFlags = D3D11_BIND_UNORDERED_ACCESS | D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_RENDER_TARGET,
-    .CPUAccessFlags = 0,
-    .MiscFlags = D3D11_RESOURCE_MISC_TEXTURECUBE | D3D11_RESOURCE_MISC_GENERATE_MIPS
+  D3D11_SHADER_RESOURCE_VIEW_DESC const prefiltered_env_cube_srv_desc{
+    .Format = prefiltered_env_cube_tex_desc.Format,
+    .ViewDimension = D3D11_SRV_DIMENSION_TEXTURECUBE,
+    .TextureCube = {.MostDetailedMip = 0, .MipLevels = prefiltered_env_cube_tex_desc.MipLevels}
   };
 
-  ComPtr<ID3D11Texture2D> env_cube_tex;
-  ThrowIfFailed(dev->CreateTexture2D(&env_cube_tex_desc, nullptr, &env_cube_tex));
-
-  // Render equirectangular environment map to cubemap mip0
+  ComPtr<ID3D11ShaderResourceView> prefiltered_env_cube_srv;
+  ThrowIfFailed(dev->CreateShaderResourceView(prefiltered_env_cube_tex.Get(), &prefiltered_env_cube_srv_desc,
+                                              &prefiltered_env_cube_srv));
 
-  D3D11_UNORDERED_ACCESS_VIEW_DESC const env_cube_mip0_uav_desc{
-    .Format = env_cube_tex_desc.Format,
-    .ViewDimension = D3D11_UAV_DIMENSION_TEXTURE2DARRAY,
-    .Texture2DArray = {.MipSlice = 0, .FirstArraySlice = 0, .ArraySize = 6}
-  };
+  // The environment lives on the GPU from now on
+  prefiltered_env.reset();
 
-  ComPtr<ID3D11UnorderedAccessView> env_cube_mip0_uav;
-  ThrowIfFailed(dev->CreateUnorderedAccessView(env_cube_tex.Get(), &env_cube_mip0_uav_desc, &env_cube_mip0_uav));
+  // Load the split-sum DFG table, generating it on the CPU if the cache is stale
 
-  ctx->CSSetShader(shaders->equirect_to_cubemap_cs.Get(), nullptr, 0);
-  ctx->CSSetUnorderedAccessViews(ENV_CUBE_UAV_SLOT, 1, env_cube_mip0_uav.GetAddressOf(), nullptr);
-  ctx->CSSetShaderResources(EQUIRECT_ENV_MAP_SRV_SLOT, 1, equi_env_map_srv.GetAddressOf());
-  ctx->CSSetSamplers(EQUIRECT_ENV_MAP_SAMPLER_SLOT, 1, sampler_trilinear_clamp.GetAddressOf());
+  auto const dfg_lut{refl::LoadDfgLut(refl::kDefaultDfgLutSettings, refl::GetDefaultThreadCount())};
 
-  auto constexpr equirect_to_cube_cs_group_size_x{
-    (env_cube_size + EQUIRECT_TO_CUBE_THREADS_X - 1) / EQUIRECT_TO_CUBE_THREADS_X
-  };
-  auto constexpr equirect_to_cube_cs_group_size_y{
-    (env_cube_size + EQUIRECT_TO_CUBE_THREADS_Y - 1) / EQUIRECT_TO_CUBE_THREADS_Y
+  D3D11_TEXTURE2D_DESC const dfg_lut_tex_desc{
+    .Width = dfg_lut.size,
+    .Height = dfg_lut.size,
+    .MipLevels = 1,
+    .ArraySize = 1,
+    .Format = DXGI_FORMAT_R16G16_UNORM,
+    .SampleDesc = {.Count = 1, .Quality = 0},
+    .Usage = D3D11_USAGE_IMMUTABLE,
+    .BindFlags = D3D11_BIND_SHADER_RESOURCE,
+    .CPUAccessFlags = 0,
+    .MiscFlags = 0
   };
-  ctx->Dispatch(equirect_to_cube_cs_group_size_x, equirect_to_cube_cs_group_size_y, 6);
-
-  ComPtr<ID3D11UnorderedAccessView> const null_uav{nullptr};
-  ctx->CSSetUnorderedAccessViews(ENV_CUBE_UAV_SLOT, 1, null_uav.GetAddressOf(), nullptr);
-
-  // Generate mips for environment cubemap
 
-  D3D11_SHADER_RESOURCE_VIEW_DESC const env_cube_srv_desc{
-    .Format = env_cube_tex_desc.Format,
-    .ViewDimension = D3D11_SRV_DIMENSION_TEXTURECUBE,
-    .TextureCube = {.MostDetailedMip = 0, .MipLevels = env_cube_mip_count}
+  D3D11_SUBRESOURCE_DATA const dfg_lut_tex_data{
+    .pSysMem = dfg_lut.texels.data(),
+    .SysMemPitch = static_cast<UINT>(dfg_lut.size * sizeof(refl::DfgTexel)),
+    .SysMemSlicePitch = 0
   };
 
-  ComPtr<ID3D11ShaderResourceView> env_cube_srv;
-  ThrowIfFailed(dev->CreateShaderResourceView(env_cube_tex.Get(), &env_cube_srv_desc, &env_cube_srv));
+  ComPtr<ID3D11Texture2D> dfg_lut_tex;
+  ThrowIfFailed(dev->CreateTexture2D(&dfg_lut_tex_desc, &dfg_lut_tex_data, &dfg_lut_tex));
 
-  ctx->GenerateMips(env_cube_srv.Get());
+  ComPtr<ID3D11ShaderResourceView> dfg_lut_srv;
+  ThrowIfFailed(dev->CreateShaderResourceView(dfg_lut_tex.Get(), nullptr, &dfg_lut_srv));
 
-  // Create cubemap for prefiltered environment map
+  // Project the environment to spherical harmonics for the diffuse term, unless the cache has them
 
-  D3D11_TEXTURE2D_DESC const prefiltered_env_cube_tex_desc{
-    .Width = env_cube_size,
-    .Height = env_cube_size,
-    .MipLevels = env_cube_mip_count,
-    .ArraySize = 6,
-    .Format = DXGI_FORMAT_R32G32B32A32_FLOAT,
-    .SampleDesc = {.Count = 1, .Quality = 0},
-    .Usage = D3D11_USAGE_DEFAULT,
-    .BindFlags = D3D11_BIND_UNORDERED_ACCESS | D3D11_BIND_SHADER_RESOURCE,
-    .CPUAccessFlags = 0,
-    .MiscFlags = D3D11_RESOURCE_MISC_TEXTURECUBE
-  };
+  auto const irradiance_sh{refl::LoadIrradianceSh(argv[2], refl::GetDefaultThreadCount())};
 
-  ComPtr<ID3D11Texture2D> prefiltered_env_cube_tex;
-  ThrowIfFailed(dev->CreateTexture2D(&prefiltered_env_cube_tex_desc, nullptr, &prefiltered_env_cube_tex));
+  if (!irradiance_sh) {
+    return -1;
+  }
 
-  // Copy env_cube mip0 to prefiltered_env_cube mip0
+  EnvironmentConstants env_constants{};
+  env_constants.prefiltered_mip_count = prefiltered_env_mip_count;
 
-  for (unsigned face{0}; face < 6; face++) {
-    auto const subresource{D3D11CalcSubresource(0, face, env_cube_mip_count)};
-    ctx->CopySubresourceRegion(prefiltered_env_cube_tex.Get(), subresource, 0, 0, 0, env_cube_tex.Get(), subresource,
-                               nullptr);
+  for (std::size_t i{0}; i < irradiance_sh->coeffs.size(); i++) {
+    auto const& coeff{irradiance_sh->coeffs[i]};
+    env_constants.sh_coeffs[i] = {coeff[0], coeff[1], coeff[2], 0};
   }
 
-  // Prefilter environment cubemap into mip1...N
-
-  D3D11_BUFFER_DESC constexpr env_prefilter_cbv_desc{
-    .ByteWidth = sizeof(EnvPrefilterConstants),
-    .Usage = D3D11_USAGE_DYNAMIC,
+  D3D11_BUFFER_DESC constexpr env_cbuf_desc{
+    .ByteWidth = sizeof(EnvironmentConstants),
+    .Usage = D3D11_USAGE_IMMUTABLE,
     .BindFlags = D3D11_BIND_CONSTANT_BUFFER,
-    .CPUAccessFlags = D3D11_CPU_ACCESS_WRITE,
+    .CPUAccessFlags = 0,
     .MiscFlags = 0,
     .StructureByteStride = 0
   };
 
-  ComPtr<ID3D11Buffer> env_prefilter_cbv;
-  ThrowIfFailed(dev->CreateBuffer(&env_prefilter_cbv_desc, nullptr, &env_prefilter_cbv));
-
-  for (auto mip{1u}; mip < env_cube_mip_count; ++mip) {
-    D3D11_UNORDERED_ACCESS_VIEW_DESC const env_cube_mip_uav_desc{
-      .Format = prefiltered_env_cube_tex_desc.Format,
-      .ViewDimension = D3D11_UAV_DIMENSION_TEXTURE2DARRAY,
-      .Texture2DArray = {.MipSlice = mip, .FirstArraySlice = 0, .ArraySize = 6}
-    };
-
-    ComPtr<ID3D11UnorderedAccessView> prefiltered_env_cube_mip_uav;
-    ThrowIfFailed(dev->CreateUnorderedAccessView(prefiltered_env_cube_tex.Get(), &env_cube_mip_uav_desc,
-                                                 &prefiltered_env_cube_mip_uav));
+  D3D11_SUBRESOURCE_DATA const env_cbuf_data{.pSysMem = &env_constants, .SysMemPitch = 0, .SysMemSlicePitch = 0};
 
-    D3D11_MAPPED_SUBRESOURCE mapped_prefilter_cbv;
-    ThrowIfFailed(ctx->Map(env_prefilter_cbv.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped_prefilter_cbv));
-
-    *static_cast<EnvPrefilterConstants*>(mapped_prefilter_cbv.pData) = {
-      .cur_mip = mip,
-      .num_mips = env_cube_mip_count,
-      .face_base_size = env_cube_size,
-      .sample_count = 1024
-    };
-
-    ctx->Unmap(env_prefilter_cbv.Get(), 0);
-
-    ctx->CSSetShader(shaders->env_prefilter_cs.Get(), nullptr, 0);
-    ctx->CSSetUnorderedAccessViews(ENV_PREFILTER_ENV_CUBE_UAV_SLOT, 1, prefiltered_env_cube_mip_uav.GetAddressOf(),
-                                   nullptr);
-    ctx->CSSetShaderResources(ENV_PREFILTER_CUBE_SRV_SLOT, 1, env_cube_srv.GetAddressOf());
-    ctx->CSSetConstantBuffers(ENV_PREFILTER_CB_SLOT, 1, env_prefilter_cbv.GetAddressOf());
-    ctx->CSSetSamplers(ENV_PREFILTER_SAMPLER_SLOT, 1, sampler_trilinear_clamp.GetAddressOf());
-
-    auto const mip_size{std::max(env_cube_size >> mip, 1u)};
-    auto const group_count_x{std::ceil(mip_size / static_cast<float>(ENV_PREFILTER_THREADS_X))};
-    auto const group_count_y{std::ceil(mip_size / static_cast<float>(ENV_PREFILTER_THREADS_Y))};
-    ctx->Dispatch(static_cast<UINT>(group_count_x), static_cast<UINT>(group_count_y), 6);
-  }
-  ctx->CSSetUnorderedAccessViews(ENV_PREFILTER_ENV_CUBE_UAV_SLOT, 1, null_uav.GetAddressOf(), nullptr);
-
-  // Create srv for all mips of the prefiltered environment cubemap
-
-  D3D11_SHADER_RESOURCE_VIEW_DESC const prefiltered_env_cube_srv_desc{
-    .Format = prefiltered_env_cube_tex_desc.Format,
-    .ViewDimension = D3D11_SRV_DIMENSION_TEXTURECUBE,
-    .TextureCube = {.MostDetailedMip = 0, .MipLevels = env_cube_mip_count}
-  };
-
-  ComPtr<ID3D11ShaderResourceView> prefiltered_env_cube_srv;
-  ThrowIfFailed(dev->CreateShaderResourceView(prefiltered_env_cube_tex.Get(), &prefiltered_env_cube_srv_desc,
-                                              &prefiltered_env_cube_srv));
+  ComPtr<ID3D11Buffer> env_cbuf;
+  ThrowIfFailed(dev->CreateBuffer(&env_cbuf_desc, &env_cbuf_data, &env_cbuf));
 
   D3D11_VIEWPORT const viewport{
     .TopLeftX = 0.0F, .TopLeftY = 0.0F,
@@ -600,6 +766,50 @@ auto wmain(int const argc, wchar_t** const argv) -> int {
   constexpr auto cam_far{5.F};
   refl::OrbitingCamera cam{{0, 0, 0}, 2.5f, cam_near, cam_far, 65.0f};
 
+  refl::VisibleDraws visible_draws;
+
+  // Copies a texture of the output size to the CPU row by row
+  auto const read_back_tex{
+    [&dev, &ctx, output_height](ID3D11Texture2D* const tex, std::span<std::byte> const dst) {
+      D3D11_TEXTURE2D_DESC staging_tex_desc;
+      tex->GetDesc(&staging_tex_desc);
+      staging_tex_desc.Usage = D3D11_USAGE_STAGING;
+      staging_tex_desc.BindFlags = 0;
+      staging_tex_desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+
+      ComPtr<ID3D11Texture2D> staging_tex;
+      ThrowIfFailed(dev->CreateTexture2D(&staging_tex_desc, nullptr, &staging_tex));
+      ctx->CopyResource(staging_tex.Get(), tex);
+
+      D3D11_MAPPED_SUBRESOURCE mapped_staging_tex;
+      ThrowIfFailed(ctx->Map(staging_tex.Get(), 0, D3D11_MAP_READ, 0, &mapped_staging_tex));
+
+      auto const row_size{dst.size() / output_height};
+
+      for (unsigned y{0}; y < output_height; y++) {
+        std::memcpy(dst.data() + y * row_size,
+                    static_cast<std::byte const*>(mapped_staging_tex.pData) + y * mapped_staging_tex.RowPitch,
+                    row_size);
+      }
+
+      ctx->Unmap(staging_tex.Get(), 0);
+    }
+  };
+
+  std::filesystem::path const ssr_frame_path{"ssr_frame.reflssr"};
+  auto ssr_dump_key_was_pressed{false};
+
+  auto ssr_constants{refl::kDefaultSsrConstants};
+  ssr_constants.hiz_mip_count = hiz_mip_count;
+  auto ssr_mode_key_was_pressed{false};
+  auto ssr_scale_key_was_pressed{false};
+
+  auto ssr_temporal{false};
+  auto ssr_temporal_key_was_pressed{false};
+  auto ssr_history_valid{false};
+  std::size_t ssr_history_idx{0}; // Of the history texture written this frame
+  DirectX::XMFLOAT4X4 prev_view_proj_mtx{};
+
   int ret;
 
   auto begin{std::chrono::steady_clock::now()};
@@ -644,6 +854,40 @@ auto wmain(int const argc, wchar_t** const argv) -> int {
       cam.Rotate(-cam_rotate_speed * cam_multiplier * delta_time);
     }
 
+    // H cycles through the linear, the Hi-Z, and the DDA march of the SSR pass
+    auto const ssr_mode_key_pressed{wnd->IsKeyPressed(0x48)};
+
+    if (ssr_mode_key_pressed && !ssr_mode_key_was_pressed) {
+      std::array constexpr ssr_mode_names{"linear", "Hi-Z", "DDA"};
+      ssr_constants.march_mode = (ssr_constants.march_mode + 1) % ssr_mode_names.size();
+      std::cout << std::format("SSR march: {}\n", ssr_mode_names[ssr_constants.march_mode]);
+    }
+
+    ssr_mode_key_was_pressed = ssr_mode_key_pressed;
+
+    // R cycles through tracing the SSR rays at full, half, and quarter resolution
+    auto const ssr_scale_key_pressed{wnd->IsKeyPressed(0x52)};
+
+    if (ssr_scale_key_pressed && !ssr_scale_key_was_pressed) {
+      std::array constexpr ssr_scale_names{"full", "half", "quarter"};
+      ssr_constants.trace_scale_log2 = (ssr_constants.trace_scale_log2 + 1) % ssr_scale_names.size();
+      std::cout << std::format("SSR trace resolution: {}\n", ssr_scale_names[ssr_constants.trace_scale_log2]);
+    }
+
+    ssr_scale_key_was_pressed = ssr_scale_key_pressed;
+
+    // T toggles accumulating the SSR output over frames, which also rotates the pixels the rays of blocks start from
+    auto const ssr_temporal_key_pressed{wnd->IsKeyPressed(0x54)};
+
+    if (ssr_temporal_key_pressed && !ssr_temporal_key_was_pressed) {
+      ssr_temporal = !ssr_temporal;
+      ssr_history_valid = false;
+      ssr_constants.rotate_sources = ssr_temporal;
+      std::cout << std::format("SSR temporal accumulation: {}\n", ssr_temporal ? "on" : "off");
+    }
+
+    ssr_temporal_key_was_pressed = ssr_temporal_key_pressed;
+
     auto const view_mtx{cam.ComputeViewMatrix()};
     auto const proj_mtx{cam.ComputeProjMatrix(static_cast<float>(output_width) / static_cast<float>(output_height))};
 
@@ -663,10 +907,7 @@ auto wmain(int const argc, wchar_t** const argv) -> int {
     DirectX::XMFLOAT4X4 view_proj_inv_mtx;
     DirectX::XMStoreFloat4x4(&view_proj_inv_mtx, xm_view_proj_inv_mtx);
 
-    D3D11_MAPPED_SUBRESOURCE mapped_cam_cbuf;
-    ThrowIfFailed(ctx->Map(cam_cbuf.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped_cam_cbuf));
-
-    *static_cast<CameraConstants*>(mapped_cam_cbuf.pData) = {
+    CameraConstants const cam_constants{
       .view_mtx = view_mtx,
       .view_inv_mtx = view_inv_mtx,
       .proj_mtx = proj_mtx,
@@ -679,8 +920,29 @@ auto wmain(int const argc, wchar_t** const argv) -> int {
       .pad = {}
     };
 
+    D3D11_MAPPED_SUBRESOURCE mapped_cam_cbuf;
+    ThrowIfFailed(ctx->Map(cam_cbuf.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped_cam_cbuf));
+    *static_cast<CameraConstants*>(mapped_cam_cbuf.pData) = cam_constants;
     ctx->Unmap(cam_cbuf.Get(), 0);
 
+    // Frustum culling and LOD selection
+
+    refl::LodSelection const lod_selection{
+      .camera_pos = cam.ComputePosition(),
+      .lod_scale = refl::ComputeLodScale(cam.GetVerticalFovDegrees(), static_cast<float>(output_height)),
+      .max_pixel_error = refl::kDefaultMaxLodPixelError
+    };
+
+    refl::CullScene(gpu_scene->culling_scene, refl::ComputeFrustum(view_mtx, proj_mtx), lod_selection,
+                    visible_draws);
+
+    D3D11_MAPPED_SUBRESOURCE mapped_draw_instance_buf;
+    ThrowIfFailed(ctx->Map(gpu_scene->draw_instance_buf.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0,
+                           &mapped_draw_instance_buf));
+    std::ranges::copy(visible_draws.draw_instances,
+                      static_cast<refl::DrawInstance*>(mapped_draw_instance_buf.pData));
+    ctx->Unmap(gpu_scene->draw_instance_buf.Get(), 0);
+
     // GBuffer pass
 
     std::array const gbuffer_rtvs{gbuffer0_rtv.Get(), gbuffer1_rtv.Get()};
@@ -692,32 +954,46 @@ auto wmain(int const argc, wchar_t** const argv) -> int {
 
     ctx->ClearDepthStencilView(depth_dsv.Get(), D3D11_CLEAR_DEPTH, 1.0F, 0);
 
-    ctx->VSSetShader(shaders->gbuffer_vs.Get(), nullptr, 0);
+    auto const float_vertices{gpu_scene->vertex_layout == refl::VertexLayout::kFloat};
+    ctx->VSSetShader(float_vertices ? shaders->gbuffer_float_vs.Get() : shaders->gbuffer_vs.Get(), nullptr, 0);
     ctx->PSSetShader(shaders->gbuffer_ps.Get(), nullptr, 0);
 
     ctx->RSSetViewports(1, &viewport);
 
     ctx->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-    ctx->IASetInputLayout(shaders->mesh_il.Get());
+    ctx->IASetInputLayout(float_vertices ? shaders->mesh_float_il.Get() : shaders->mesh_il.Get());
 
     ctx->VSSetConstantBuffers(CAMERA_CB_SLOT, 1, cam_cbuf.GetAddressOf());
     ctx->PSSetSamplers(MATERIAL_SAMPLER_SLOT, 1, sampler_trilinear_clamp.GetAddressOf());
 
-    for (auto const& mesh : gpu_scene->meshes) {
+    {
       std::array const vertex_buffers{
-        mesh.pos_buf.Get(), mesh.norm_buf.Get(), mesh.uv_buf.Get(), mesh.tan_buf.Get()
-      };
-      std::array constexpr strides{
-        16u, 16u, 8u, 16u
+        gpu_scene->pos_buf.Get(), gpu_scene->norm_buf.Get(), gpu_scene->uv_buf.Get(), gpu_scene->tan_buf.Get(),
+        gpu_scene->draw_instance_buf.Get()
       };
       std::array constexpr offsets{
-        0u, 0u, 0u, 0u
+        0u, 0u, 0u, 0u, 0u
       };
-      ctx->IASetVertexBuffers(0, 4, vertex_buffers.data(), strides.data(), offsets.data());
-      ctx->IASetIndexBuffer(mesh.idx_buf.Get(), DXGI_FORMAT_R32_UINT, 0);
-      ctx->VSSetConstantBuffers(OBJECT_CB_SLOT, 1, mesh.transform_buf.GetAddressOf());
-      ctx->PSSetConstantBuffers(MATERIAL_CB_SLOT, 1, mesh.mtl_buf.GetAddressOf());
-      ctx->DrawIndexed(mesh.idx_count, 0, 0);
+      ctx->IASetVertexBuffers(0, static_cast<UINT>(vertex_buffers.size()), vertex_buffers.data(),
+                              gpu_scene->vertex_strides.data(), offsets.data());
+    }
+
+    ctx->IASetIndexBuffer(gpu_scene->idx_buf.Get(), DXGI_FORMAT_R32_UINT, 0);
+    ctx->VSSetShaderResources(INSTANCE_TRANSFORM_BUFFER_SLOT, 1, gpu_scene->transform_srv.GetAddressOf());
+    ctx->PSSetShaderResources(MATERIAL_BUFFER_SLOT, 1, gpu_scene->mtl_srv.GetAddressOf());
+
+    // The maps are only rebound when the material changes between draws
+    auto bound_mtl_idx{std::numeric_limits<std::uint32_t>::max()};
+
+    for (auto const& draw : visible_draws.draws) {
+      if (draw.mtl_idx != bound_mtl_idx) {
+        auto const& maps{gpu_scene->material_maps[draw.mtl_idx]};
+        ctx->PSSetShaderResources(MATERIAL_BASE_COLOR_MAP_SLOT, static_cast<UINT>(maps.size()), maps.data());
+        bound_mtl_idx = draw.mtl_idx;
+      }
+
+      ctx->DrawIndexedInstanced(draw.index_count, draw.instance_count, draw.first_index, draw.base_vertex,
+                                draw.first_instance);
     }
 
     // Lighting pass
@@ -729,10 +1005,12 @@ auto wmain(int const argc, wchar_t** const argv) -> int {
     ctx->PSSetShader(shaders->lighting_ps.Get(), nullptr, 0);
 
     ctx->PSSetConstantBuffers(LIGHTING_CAM_CB_SLOT, 1, cam_cbuf.GetAddressOf());
+    ctx->PSSetConstantBuffers(LIGHTING_ENV_CB_SLOT, 1, env_cbuf.GetAddressOf());
     ctx->PSSetShaderResources(LIGHTING_GBUFFER0_SRV_SLOT, 1, gbuffer0_srv.GetAddressOf());
     ctx->PSSetShaderResources(LIGHTING_GBUFFER1_SRV_SLOT, 1, gbuffer1_srv.GetAddressOf());
     ctx->PSSetShaderResources(LIGHTING_DEPTH_SRV_SLOT, 1, depth_srv.GetAddressOf());
     ctx->PSSetShaderResources(LIGHTING_ENV_MAP_SRV_SLOT, 1, prefiltered_env_cube_srv.GetAddressOf());
+    ctx->PSSetShaderResources(LIGHTING_DFG_LUT_SRV_SLOT, 1, dfg_lut_srv.GetAddressOf());
     ctx->PSSetSamplers(LIGHTING_GBUFFER_SAMPLER_SLOT, 1, sampler_point_clamp.GetAddressOf());
     ctx->PSSetSamplers(LIGHTING_ENV_SAMPLER_SLOT, 1, sampler_trilinear_clamp.GetAddressOf());
 
@@ -741,8 +1019,41 @@ auto wmain(int const argc, wchar_t** const argv) -> int {
     ComPtr<ID3D11RenderTargetView> const null_rtv{nullptr};
     ctx->OMSetRenderTargets(1, null_rtv.GetAddressOf(), nullptr);
 
+    // Hi-Z pass
+
+    if (ssr_constants.march_mode == static_cast<UINT>(refl::SsrMarchMode::kHiZ)) {
+      ctx->CSSetShader(shaders->hiz_cs.Get(), nullptr, 0);
+      ctx->CSSetConstantBuffers(HIZ_CAM_CB_SLOT, 1, cam_cbuf.GetAddressOf());
+      ctx->CSSetShaderResources(HIZ_DEPTH_SRV_SLOT, 1, depth_srv.GetAddressOf());
+
+      ComPtr<ID3D11ShaderResourceView> const null_hiz_srv{nullptr};
+      ComPtr<ID3D11UnorderedAccessView> const null_hiz_uav{nullptr};
+
+      for (UINT mip{0}; mip < hiz_mip_count; mip++) {
+        // Every mip is unbound for writing before it is bound for reading by the next one
+        ctx->CSSetShaderResources(HIZ_SRC_SRV_SLOT, 1, mip > 0 ? hiz_mip_srvs[mip - 1].GetAddressOf()
+                                                                : null_hiz_srv.GetAddressOf());
+        ctx->CSSetUnorderedAccessViews(HIZ_DST_UAV_SLOT, 1, hiz_mip_uavs[mip].GetAddressOf(), nullptr);
+        ctx->CSSetConstantBuffers(HIZ_CB_SLOT, 1, hiz_mip_cbufs[mip].GetAddressOf());
+
+        auto const mip_width{std::max(output_width >> mip, 1u)};
+        auto const mip_height{std::max(output_height >> mip, 1u)};
+        ctx->Dispatch((mip_width + HIZ_THREADS_X - 1) / HIZ_THREADS_X, (mip_height + HIZ_THREADS_Y - 1) / HIZ_THREADS_Y,
+                      1);
+
+        ctx->CSSetUnorderedAccessViews(HIZ_DST_UAV_SLOT, 1, null_hiz_uav.GetAddressOf(), nullptr);
+      }
+
+      ctx->CSSetShaderResources(HIZ_SRC_SRV_SLOT, 1, null_hiz_srv.GetAddressOf());
+    }
+
     // SSR pass
 
+    D3D11_MAPPED_SUBRESOURCE mapped_ssr_cbuf;
+    ThrowIfFailed(ctx->Map(ssr_cbuf.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped_ssr_cbuf));
+    *static_cast<SsrConstants*>(mapped_ssr_cbuf.pData) = ssr_constants;
+    ctx->Unmap(ssr_cbuf.Get(), 0);
+
     ctx->CSSetShader(shaders->ssr_cs.Get(), nullptr, 0);
 
     ctx->CSSetShaderResources(SSR_DEPTH_SRV_SLOT, 1, depth_srv.GetAddressOf());
@@ -750,13 +1061,138 @@ auto wmain(int const argc, wchar_t** const argv) -> int {
     ctx->CSSetShaderResources(SSR_GBUFFER1_SRV_SLOT, 1, gbuffer1_srv.GetAddressOf());
     ctx->CSSetShaderResources(SSR_IBL_SRV_SLOT, 1, ibl_srv.GetAddressOf());
     ctx->CSSetUnorderedAccessViews(SSR_SSR_UAV_SLOT, 1, ssr_uav.GetAddressOf(), nullptr);
+    ctx->CSSetUnorderedAccessViews(SSR_HITS_UAV_SLOT, 1, ssr_hits_uav.GetAddressOf(), nullptr);
+    ctx->CSSetUnorderedAccessViews(SSR_HIT_DIST_UAV_SLOT, 1, ssr_hit_dist_uav.GetAddressOf(), nullptr);
+    ctx->CSSetUnorderedAccessViews(SSR_REFLECTION_UAV_SLOT, 1, ssr_reflection_uav.GetAddressOf(), nullptr);
+    ctx->CSSetShaderResources(SSR_HIZ_SRV_SLOT, 1, hiz_srv.GetAddressOf());
     ctx->CSSetConstantBuffers(SSR_CAM_CB_SLOT, 1, cam_cbuf.GetAddressOf());
+    ctx->CSSetConstantBuffers(SSR_CB_SLOT, 1, ssr_cbuf.GetAddressOf());
 
-    auto const ssr_group_count_x{(output_width + SSR_THREADS_X - 1) / SSR_THREADS_X};
-    auto const ssr_group_count_y{(output_height + SSR_THREADS_Y - 1) / SSR_THREADS_Y};
-    ctx->Dispatch(ssr_group_count_x, ssr_group_count_y, 1);
+    // Below full resolution there is a thread per block of pixels
+    auto const ssr_block_size{1u << ssr_constants.trace_scale_log2};
+    auto const ssr_trace_width{(output_width + ssr_block_size - 1) / ssr_block_size};
+    auto const ssr_trace_height{(output_height + ssr_block_size - 1) / ssr_block_size};
+    ctx->Dispatch((ssr_trace_width + SSR_THREADS_X - 1) / SSR_THREADS_X,
+                  (ssr_trace_height + SSR_THREADS_Y - 1) / SSR_THREADS_Y, 1);
 
+    ComPtr<ID3D11UnorderedAccessView> const null_uav{nullptr};
     ctx->CSSetUnorderedAccessViews(SSR_SSR_UAV_SLOT, 1, null_uav.GetAddressOf(), nullptr);
+    ctx->CSSetUnorderedAccessViews(SSR_HITS_UAV_SLOT, 1, null_uav.GetAddressOf(), nullptr);
+    ctx->CSSetUnorderedAccessViews(SSR_HIT_DIST_UAV_SLOT, 1, null_uav.GetAddressOf(), nullptr);
+    ctx->CSSetUnorderedAccessViews(SSR_REFLECTION_UAV_SLOT, 1, null_uav.GetAddressOf(), nullptr);
+
+    // The pyramid is written again next frame
+    ComPtr<ID3D11ShaderResourceView> const null_srv{nullptr};
+    ctx->CSSetShaderResources(SSR_HIZ_SRV_SLOT, 1, null_srv.GetAddressOf());
+
+    // SSR upsample pass, resolves the rays traced per block to every pixel
+
+    if (ssr_constants.trace_scale_log2 > 0) {
+      ctx->CSSetShader(shaders->ssr_upsample_cs.Get(), nullptr, 0);
+
+      ctx->CSSetShaderResources(SSR_UPSAMPLE_DEPTH_SRV_SLOT, 1, depth_srv.GetAddressOf());
+      ctx->CSSetShaderResources(SSR_UPSAMPLE_GBUFFER0_SRV_SLOT, 1, gbuffer0_srv.GetAddressOf());
+      ctx->CSSetShaderResources(SSR_UPSAMPLE_GBUFFER1_SRV_SLOT, 1, gbuffer1_srv.GetAddressOf());
+      ctx->CSSetShaderResources(SSR_UPSAMPLE_IBL_SRV_SLOT, 1, ibl_srv.GetAddressOf());
+      ctx->CSSetShaderResources(SSR_UPSAMPLE_HITS_SRV_SLOT, 1, ssr_hits_srv.GetAddressOf());
+      ctx->CSSetUnorderedAccessViews(SSR_UPSAMPLE_SSR_UAV_SLOT, 1, ssr_uav.GetAddressOf(), nullptr);
+      ctx->CSSetUnorderedAccessViews(SSR_UPSAMPLE_HIT_DIST_UAV_SLOT, 1, ssr_hit_dist_uav.GetAddressOf(), nullptr);
+      ctx->CSSetUnorderedAccessViews(SSR_UPSAMPLE_REFLECTION_UAV_SLOT, 1, ssr_reflection_uav.GetAddressOf(), nullptr);
+      ctx->CSSetConstantBuffers(SSR_UPSAMPLE_CAM_CB_SLOT, 1, cam_cbuf.GetAddressOf());
+      ctx->CSSetConstantBuffers(SSR_UPSAMPLE_CB_SLOT, 1, ssr_cbuf.GetAddressOf());
+
+      ctx->Dispatch((output_width + SSR_UPSAMPLE_THREADS_X - 1) / SSR_UPSAMPLE_THREADS_X,
+                    (output_height + SSR_UPSAMPLE_THREADS_Y - 1) / SSR_UPSAMPLE_THREADS_Y, 1);
+
+      ctx->CSSetUnorderedAccessViews(SSR_UPSAMPLE_SSR_UAV_SLOT, 1, null_uav.GetAddressOf(), nullptr);
+      ctx->CSSetUnorderedAccessViews(SSR_UPSAMPLE_HIT_DIST_UAV_SLOT, 1, null_uav.GetAddressOf(), nullptr);
+      ctx->CSSetUnorderedAccessViews(SSR_UPSAMPLE_REFLECTION_UAV_SLOT, 1, null_uav.GetAddressOf(), nullptr);
+      ctx->CSSetShaderResources(SSR_UPSAMPLE_HITS_SRV_SLOT, 1, null_srv.GetAddressOf());
+    }
+
+    // SSR temporal pass, blends the reflection of the SSR pass with that of the previous frames reprojected and
+    // composites it over the lighting of this frame
+
+    if (ssr_temporal) {
+      SsrTemporalConstants const ssr_temporal_constants{
+        .prev_view_proj_mtx = prev_view_proj_mtx,
+        .current_weight = refl::kDefaultSsrTemporalWeight,
+        .history_valid = ssr_history_valid,
+        .pad = {}
+      };
+
+      D3D11_MAPPED_SUBRESOURCE mapped_ssr_temporal_cbuf;
+      ThrowIfFailed(ctx->Map(ssr_temporal_cbuf.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped_ssr_temporal_cbuf));
+      *static_cast<SsrTemporalConstants*>(mapped_ssr_temporal_cbuf.pData) = ssr_temporal_constants;
+      ctx->Unmap(ssr_temporal_cbuf.Get(), 0);
+
+      ctx->CSSetShader(shaders->ssr_temporal_cs.Get(), nullptr, 0);
+
+      ctx->CSSetShaderResources(SSR_TEMPORAL_DEPTH_SRV_SLOT, 1, depth_srv.GetAddressOf());
+      ctx->CSSetShaderResources(SSR_TEMPORAL_GBUFFER0_SRV_SLOT, 1, gbuffer0_srv.GetAddressOf());
+      ctx->CSSetShaderResources(SSR_TEMPORAL_GBUFFER1_SRV_SLOT, 1, gbuffer1_srv.GetAddressOf());
+      ctx->CSSetShaderResources(SSR_TEMPORAL_IBL_SRV_SLOT, 1, ibl_srv.GetAddressOf());
+      ctx->CSSetShaderResources(SSR_TEMPORAL_SSR_SRV_SLOT, 1, ssr_srv.GetAddressOf());
+      ctx->CSSetShaderResources(SSR_TEMPORAL_REFLECTION_SRV_SLOT, 1, ssr_reflection_srv.GetAddressOf());
+      ctx->CSSetShaderResources(SSR_TEMPORAL_HIT_DIST_SRV_SLOT, 1, ssr_hit_dist_srv.GetAddressOf());
+      ctx->CSSetShaderResources(SSR_TEMPORAL_HISTORY_SRV_SLOT, 1,
+                                ssr_history_srvs[1 - ssr_history_idx].GetAddressOf());
+      ctx->CSSetShaderResources(SSR_TEMPORAL_PREV_DEPTH_SRV_SLOT, 1, prev_depth_srv.GetAddressOf());
+      ctx->CSSetUnorderedAccessViews(SSR_TEMPORAL_OUTPUT_UAV_SLOT, 1, ssr_temporal_uav.GetAddressOf(), nullptr);
+      ctx->CSSetUnorderedAccessViews(SSR_TEMPORAL_HISTORY_UAV_SLOT, 1, ssr_history_uavs[ssr_history_idx].GetAddressOf(),
+                                     nullptr);
+      ctx->CSSetConstantBuffers(SSR_TEMPORAL_CAM_CB_SLOT, 1, cam_cbuf.GetAddressOf());
+      ctx->CSSetConstantBuffers(SSR_TEMPORAL_CB_SLOT, 1, ssr_temporal_cbuf.GetAddressOf());
+
+      ctx->Dispatch((output_width + SSR_TEMPORAL_THREADS_X - 1) / SSR_TEMPORAL_THREADS_X,
+                    (output_height + SSR_TEMPORAL_THREADS_Y - 1) / SSR_TEMPORAL_THREADS_Y, 1);
+
+      // All of these are written again next frame
+      ctx->CSSetUnorderedAccessViews(SSR_TEMPORAL_OUTPUT_UAV_SLOT, 1, null_uav.GetAddressOf(), nullptr);
+      ctx->CSSetUnorderedAccessViews(SSR_TEMPORAL_HISTORY_UAV_SLOT, 1, null_uav.GetAddressOf(), nullptr);
+      ctx->CSSetShaderResources(SSR_TEMPORAL_SSR_SRV_SLOT, 1, null_srv.GetAddressOf());
+      ctx->CSSetShaderResources(SSR_TEMPORAL_REFLECTION_SRV_SLOT, 1, null_srv.GetAddressOf());
+      ctx->CSSetShaderResources(SSR_TEMPORAL_HIT_DIST_SRV_SLOT, 1, null_srv.GetAddressOf());
+      ctx->CSSetShaderResources(SSR_TEMPORAL_HISTORY_SRV_SLOT, 1, null_srv.GetAddressOf());
+      ctx->CSSetShaderResources(SSR_TEMPORAL_PREV_DEPTH_SRV_SLOT, 1, null_srv.GetAddressOf());
+
+      ctx->CopyResource(prev_depth_tex.Get(), depth_tex.Get());
+      ssr_history_valid = true;
+    }
+
+    // P dumps the inputs and output of the SSR pass for the CPU reference of the ssr-reference benchmark
+
+    auto const ssr_dump_key_pressed{wnd->IsKeyPressed(0x50)};
+
+    if (ssr_dump_key_pressed && !ssr_dump_key_was_pressed) {
+      auto const pixel_count{static_cast<std::size_t>(output_width) * output_height};
+
+      refl::SsrFrame ssr_frame{
+        .camera = cam_constants,
+        .constants = ssr_constants,
+        .width = output_width,
+        .height = output_height,
+        .depth = std::vector<float>(pixel_count),
+        .gbuffer0 = std::vector<refl::Vector4>(pixel_count),
+        .gbuffer1 = std::vector<refl::Vector4>(pixel_count),
+        .ibl = std::vector<refl::Vector4>(pixel_count),
+        .ssr = std::vector<refl::Vector4>(pixel_count)
+      };
+
+      read_back_tex(depth_tex.Get(), std::as_writable_bytes(std::span{ssr_frame.depth}));
+      read_back_tex(gbuffer0_tex.Get(), std::as_writable_bytes(std::span{ssr_frame.gbuffer0}));
+      read_back_tex(gbuffer1_tex.Get(), std::as_writable_bytes(std::span{ssr_frame.gbuffer1}));
+      read_back_tex(ibl_tex.Get(), std::as_writable_bytes(std::span{ssr_frame.ibl}));
+      read_back_tex(ssr_tex.Get(), std::as_writable_bytes(std::span{ssr_frame.ssr}));
+
+      if (refl::WriteSsrFrame(ssr_frame_path, ssr_frame)) {
+        std::cout << std::format("Dumped the SSR pass to {}.\n", ssr_frame_path.string());
+      } else {
+        std::cerr << std::format("Failed to dump the SSR pass to {}.\n", ssr_frame_path.string());
+      }
+    }
+
+    ssr_dump_key_was_pressed = ssr_dump_key_pressed;
 
     // Tonemapping pass
 
@@ -765,7 +1201,9 @@ auto wmain(int const argc, wchar_t** const argv) -> int {
     ctx->VSSetShader(shaders->tonemapping_vs.Get(), nullptr, 0);
     ctx->PSSetShader(shaders->tonemapping_ps.Get(), nullptr, 0);
 
-    ctx->PSSetShaderResources(TONEMAPPING_HDR_TEX_SRV_SLOT, 1, ssr_srv.GetAddressOf());
+    // With temporal accumulation the output is that of the SSR temporal pass
+    auto const& hdr_srv{ssr_temporal ? ssr_temporal_srv : ssr_srv};
+    ctx->PSSetShaderResources(TONEMAPPING_HDR_TEX_SRV_SLOT, 1, hdr_srv.GetAddressOf());
     ctx->PSSetSamplers(TONEMAPPING_SAMPLER_SLOT, 1, sampler_point_clamp.GetAddressOf());
 
     ctx->Draw(3, 0);
@@ -778,6 +1216,11 @@ auto wmain(int const argc, wchar_t** const argv) -> int {
 
     ThrowIfFailed(swap_chain->Present(0, present_flags));
 
+    // What the SSR temporal pass reprojects from next frame
+    prev_view_proj_mtx = view_proj_mtx;
+    ssr_history_idx = 1 - ssr_history_idx;
+    ssr_constants.frame_index += 1;
+
     begin = end;
     end = std::chrono::steady_clock::now();
   }
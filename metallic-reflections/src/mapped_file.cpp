@@ -0,0 +1,54 @@
+#include "mapped_file.hpp"
+
+namespace refl {
+auto MappedFile::New(std::filesystem::path const& path) -> std::unique_ptr<MappedFile> {
+  auto const file{
+    CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr)
+  };
+
+  if (file == INVALID_HANDLE_VALUE) {
+    return nullptr;
+  }
+
+  LARGE_INTEGER file_size;
+
+  if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+    CloseHandle(file);
+    return nullptr;
+  }
+
+  auto const mapping{CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr)};
+
+  if (!mapping) {
+    CloseHandle(file);
+    return nullptr;
+  }
+
+  auto const view{MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)};
+
+  if (!view) {
+    CloseHandle(mapping);
+    CloseHandle(file);
+    return nullptr;
+  }
+
+  return std::unique_ptr<MappedFile>{
+    new MappedFile{file, mapping, view, static_cast<std::size_t>(file_size.QuadPart)}
+  };
+}
+
+auto MappedFile::GetData() const -> std::span<std::byte const> {
+  return {static_cast<std::byte const*>(view_), size_};
+}
+
+MappedFile::~MappedFile() {
+  UnmapViewOfFile(view_);
+  CloseHandle(mapping_);
+  CloseHandle(file_);
+}
+
+MappedFile::MappedFile(HANDLE const file, HANDLE const mapping, void const* const view, std::size_t const size) :
+  file_{file}, mapping_{mapping}, view_{view}, size_{size} {
+}
+}
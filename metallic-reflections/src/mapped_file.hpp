@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <span>
+
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+
+namespace refl {
+// Read-only view of a whole file mapped into the address space.
+class MappedFile {
+public:
+  [[nodiscard]] static auto New(std::filesystem::path const& path) -> std::unique_ptr<MappedFile>;
+
+  [[nodiscard]] auto GetData() const -> std::span<std::byte const>;
+
+  MappedFile(MappedFile const& other) = delete;
+  MappedFile(MappedFile&& other) = delete;
+
+  ~MappedFile();
+
+  auto operator=(MappedFile const& other) -> MappedFile& = delete;
+  auto operator=(MappedFile&& other) -> MappedFile& = delete;
+
+private:
+  MappedFile(HANDLE file, HANDLE mapping, void const* view, std::size_t size);
+
+  HANDLE file_;
+  HANDLE mapping_;
+  void const* view_;
+  std::size_t size_;
+};
+}
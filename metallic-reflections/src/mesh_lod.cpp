@@ -0,0 +1,445 @@
+#include "mesh_lod.hpp"
+
+#include "mesh_optimization.hpp"
+#include "parallel.hpp"
+
+import std;
+
+namespace refl {
+namespace {
+// A level that keeps more than this fraction of the triangles of the previous one is not worth storing
+float constexpr kMinLodReduction{0.85f};
+
+// Collapses that rotate a triangle by more than about 75 degrees are rejected
+double constexpr kMaxCollapseNormalCos{0.25};
+
+using Float3 = std::array<double, 3>;
+
+
+auto ToFloat3(Vector4 const& v) -> Float3 {
+  return {v[0], v[1], v[2]};
+}
+
+
+auto Subtract(Float3 const& a, Float3 const& b) -> Float3 {
+  return {a[0] - b[0], a[1] - b[1], a[2] - b[2]};
+}
+
+
+auto Dot(Float3 const& a, Float3 const& b) -> double {
+  return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+
+auto Cross(Float3 const& a, Float3 const& b) -> Float3 {
+  return {a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0]};
+}
+
+
+// Sum of area weighted squared distances from planes, the upper triangle of a symmetric 4x4 matrix
+struct Quadric {
+  double xx, xy, xz, xw, yy, yz, yw, zz, zw, ww;
+  double weight;
+};
+
+
+auto MakePlaneQuadric(Float3 const& n, double const d, double const weight) -> Quadric {
+  return Quadric{
+    .xx = n[0] * n[0] * weight, .xy = n[0] * n[1] * weight, .xz = n[0] * n[2] * weight, .xw = n[0] * d * weight,
+    .yy = n[1] * n[1] * weight, .yz = n[1] * n[2] * weight, .yw = n[1] * d * weight,
+    .zz = n[2] * n[2] * weight, .zw = n[2] * d * weight,
+    .ww = d * d * weight,
+    .weight = weight
+  };
+}
+
+
+auto operator+(Quadric const& a, Quadric const& b) -> Quadric {
+  return Quadric{
+    .xx = a.xx + b.xx, .xy = a.xy + b.xy, .xz = a.xz + b.xz, .xw = a.xw + b.xw,
+    .yy = a.yy + b.yy, .yz = a.yz + b.yz, .yw = a.yw + b.yw,
+    .zz = a.zz + b.zz, .zw = a.zw + b.zw,
+    .ww = a.ww + b.ww,
+    .weight = a.weight + b.weight
+  };
+}
+
+
+// Mean squared distance of the point from the planes
+auto EvaluateQuadric(Quadric const& q, Float3 const& p) -> double {
+  if (q.weight <= 0) {
+    return 0;
+  }
+
+  auto const [x, y, z]{p};
+  auto const sum{
+    q.xx * x * x + 2 * q.xy * x * y + 2 * q.xz * x * z + 2 * q.xw * x +
+    q.yy * y * y + 2 * q.yz * y * z + 2 * q.yw * y +
+    q.zz * z * z + 2 * q.zw * z +
+    q.ww
+  };
+  return std::max(sum / q.weight, 0.0);
+}
+
+
+// Vertices split at normal or texture coordinate discontinuities share a position. Returns one id per distinct
+// position for every vertex, the ids are dense from 0.
+auto ComputePositionIds(std::span<Vector4 const> const positions) -> std::vector<std::uint32_t> {
+  std::vector<std::uint32_t> sorted_vertices(positions.size());
+  std::iota(sorted_vertices.begin(), sorted_vertices.end(), 0u);
+
+  auto const position_of{
+    [positions](std::uint32_t const v) {
+      return std::tuple{positions[v][0], positions[v][1], positions[v][2]};
+    }
+  };
+
+  std::ranges::sort(sorted_vertices, {}, position_of);
+
+  std::vector<std::uint32_t> position_ids(positions.size());
+  std::uint32_t position_id{0};
+
+  for (std::size_t i{0}; i < sorted_vertices.size(); i++) {
+    if (i > 0 && position_of(sorted_vertices[i]) != position_of(sorted_vertices[i - 1])) {
+      position_id += 1;
+    }
+
+    position_ids[sorted_vertices[i]] = position_id;
+  }
+
+  return position_ids;
+}
+
+
+// Locks every vertex on an attribute seam, or on an edge that is not shared by exactly two triangles
+auto ComputeLockedVertices(std::span<std::uint32_t const> const indices,
+                           std::span<std::uint32_t const> const position_ids,
+                           std::size_t const position_count) -> std::vector<std::uint8_t> {
+  std::vector<std::uint32_t> wedge_counts(position_count, 0);
+
+  for (auto const position_id : position_ids) {
+    wedge_counts[position_id] += 1;
+  }
+
+  std::vector<std::pair<std::uint32_t, std::uint32_t>> edges;
+  edges.reserve(indices.size());
+
+  for (std::size_t i{0}; i < indices.size(); i += 3) {
+    for (auto j{0}; j < 3; j++) {
+      auto const a{position_ids[indices[i + j]]};
+      auto const b{position_ids[indices[i + (j + 1) % 3]]};
+      edges.emplace_back(std::min(a, b), std::max(a, b));
+    }
+  }
+
+  std::ranges::sort(edges);
+
+  std::vector<std::uint8_t> locked_positions(position_count, 0);
+
+  for (std::size_t begin{0}; begin < edges.size();) {
+    auto end{begin + 1};
+
+    while (end < edges.size() && edges[end] == edges[begin]) {
+      end += 1;
+    }
+
+    if (end - begin != 2) {
+      locked_positions[edges[begin].first] = 1;
+      locked_positions[edges[begin].second] = 1;
+    }
+
+    begin = end;
+  }
+
+  std::vector<std::uint8_t> locked_vertices(position_ids.size());
+
+  for (std::size_t v{0}; v < position_ids.size(); v++) {
+    locked_vertices[v] = locked_positions[position_ids[v]] != 0 || wedge_counts[position_ids[v]] > 1 ? 1 : 0;
+  }
+
+  return locked_vertices;
+}
+
+
+struct Collapse {
+  double cost;
+  std::uint32_t from;
+  std::uint32_t to;
+};
+}
+
+
+auto SimplifyMesh(std::span<std::uint32_t const> const indices, std::span<Vector4 const> const positions,
+                  std::size_t const target_index_count) -> SimplifiedMesh {
+  SimplifiedMesh simplified{.indices = {indices.begin(), indices.end()}, .error = 0};
+
+  auto const position_ids{ComputePositionIds(positions)};
+  auto const position_count{position_ids.empty() ? 0 : std::ranges::max(position_ids) + std::size_t{1}};
+
+  std::vector<Quadric> quadrics(positions.size(), Quadric{});
+
+  for (std::size_t i{0}; i < indices.size(); i += 3) {
+    auto const a{ToFloat3(positions[indices[i]])};
+    auto const b{ToFloat3(positions[indices[i + 1]])};
+    auto const c{ToFloat3(positions[indices[i + 2]])};
+
+    auto const normal{Cross(Subtract(b, a), Subtract(c, a))};
+    auto const length{std::sqrt(Dot(normal, normal))};
+
+    if (length <= 0) {
+      continue;
+    }
+
+    Float3 const unit_normal{normal[0] / length, normal[1] / length, normal[2] / length};
+    auto const plane_quadric{MakePlaneQuadric(unit_normal, -Dot(unit_normal, a), length * 0.5)};
+
+    for (auto j{0}; j < 3; j++) {
+      quadrics[indices[i + j]] = quadrics[indices[i + j]] + plane_quadric;
+    }
+  }
+
+  auto const target_triangle_count{target_index_count / 3};
+  auto max_error_sq{0.0};
+
+  std::vector<std::uint32_t> adjacency_offsets;
+  std::vector<std::uint32_t> adjacent_triangles;
+  std::vector<Collapse> collapses;
+  std::vector<std::uint32_t> remap(positions.size());
+  std::vector<std::uint8_t> touched(positions.size());
+  std::vector<std::uint32_t> from_neighbors;
+  std::vector<std::uint32_t> to_neighbors;
+  std::vector<std::uint32_t> shared_neighbors;
+
+  // Every pass collapses a set of edges that do not share vertices, cheapest first
+  while (simplified.indices.size() / 3 > target_triangle_count) {
+    auto const& current{simplified.indices};
+    auto const triangle_count{current.size() / 3};
+    auto const locked{ComputeLockedVertices(current, position_ids, position_count)};
+
+    adjacency_offsets.assign(positions.size() + 1, 0);
+
+    for (auto const v : current) {
+      adjacency_offsets[v + 1] += 1;
+    }
+
+    std::inclusive_scan(adjacency_offsets.begin(), adjacency_offsets.end(), adjacency_offsets.begin());
+    adjacent_triangles.resize(current.size());
+
+    {
+      auto fill_offsets{adjacency_offsets};
+
+      for (std::size_t i{0}; i < current.size(); i++) {
+        adjacent_triangles[fill_offsets[current[i]]++] = static_cast<std::uint32_t>(i / 3);
+      }
+    }
+
+    collapses.clear();
+
+    for (std::size_t i{0}; i < current.size(); i += 3) {
+      for (auto j{0}; j < 3; j++) {
+        // Around unlocked vertices every edge has two triangles, and the other one lists the opposite direction
+        auto const from{current[i + j]};
+        auto const to{current[i + (j + 1) % 3]};
+
+        if (locked[from] == 0) {
+          auto const cost{EvaluateQuadric(quadrics[from] + quadrics[to], ToFloat3(positions[to]))};
+          collapses.emplace_back(cost, from, to);
+        }
+      }
+    }
+
+    std::ranges::sort(collapses, {}, [](Collapse const& collapse) {
+      return std::tuple{collapse.cost, collapse.from, collapse.to};
+    });
+
+    std::iota(remap.begin(), remap.end(), 0u);
+    std::ranges::fill(touched, std::uint8_t{0});
+
+    auto const gather_neighbors{
+      [&](std::uint32_t const v, std::vector<std::uint32_t>& neighbors) {
+        neighbors.clear();
+
+        for (auto k{adjacency_offsets[v]}; k < adjacency_offsets[v + 1]; k++) {
+          for (auto j{0}; j < 3; j++) {
+            auto const neighbor{remap[current[adjacent_triangles[k] * 3 + j]]};
+
+            if (neighbor != v) {
+              neighbors.push_back(position_ids[neighbor]);
+            }
+          }
+        }
+
+        std::ranges::sort(neighbors);
+        neighbors.erase(std::ranges::unique(neighbors).begin(), neighbors.end());
+      }
+    };
+
+    // Only the two vertices opposite of the edge may be adjacent to both ends, otherwise the collapse would fold
+    // triangles onto each other
+    auto const satisfies_link_condition{
+      [&](std::uint32_t const from, std::uint32_t const to) {
+        gather_neighbors(from, from_neighbors);
+        gather_neighbors(to, to_neighbors);
+        shared_neighbors.clear();
+        std::ranges::set_intersection(from_neighbors, to_neighbors, std::back_inserter(shared_neighbors));
+        return shared_neighbors.size() <= 2;
+      }
+    };
+
+    std::size_t removed_triangle_count{0};
+    std::size_t collapse_count{0};
+
+    for (auto const& collapse : collapses) {
+      if (triangle_count - removed_triangle_count <= target_triangle_count) {
+        break;
+      }
+
+      if (touched[collapse.from] != 0 || touched[collapse.to] != 0) {
+        continue;
+      }
+
+      // Triangles are checked with the collapses of this pass applied, so they are always up to date
+      auto flips{false};
+      std::size_t degenerate_count{0};
+
+      for (auto k{adjacency_offsets[collapse.from]}; k < adjacency_offsets[collapse.from + 1] && !flips; k++) {
+        auto const tri{adjacent_triangles[k]};
+        std::array const corners{remap[current[tri * 3]], remap[current[tri * 3 + 1]], remap[current[tri * 3 + 2]]};
+
+        if (corners[0] == corners[1] || corners[1] == corners[2] || corners[2] == corners[0]) {
+          continue;
+        }
+
+        if (std::ranges::find(corners, collapse.to) != corners.end()) {
+          degenerate_count += 1;
+          continue;
+        }
+
+        auto moved_corners{corners};
+        std::ranges::replace(moved_corners, collapse.from, collapse.to);
+
+        auto const normal_of{
+          [positions](std::array<std::uint32_t, 3> const& tri_corners) {
+            auto const a{ToFloat3(positions[tri_corners[0]])};
+            return Cross(Subtract(ToFloat3(positions[tri_corners[1]]), a),
+                         Subtract(ToFloat3(positions[tri_corners[2]]), a));
+          }
+        };
+
+        // Also rejects large rotations, many of them in a row could still turn a triangle over
+        auto const old_normal{normal_of(corners)};
+        auto const new_normal{normal_of(moved_corners)};
+        flips = Dot(old_normal, new_normal) <= kMaxCollapseNormalCos * std::sqrt(Dot(old_normal, old_normal) *
+                                                                                 Dot(new_normal, new_normal));
+      }
+
+      if (flips || !satisfies_link_condition(collapse.from, collapse.to)) {
+        continue;
+      }
+
+      remap[collapse.from] = collapse.to;
+      quadrics[collapse.to] = quadrics[collapse.to] + quadrics[collapse.from];
+      touched[collapse.from] = 1;
+      touched[collapse.to] = 1;
+      removed_triangle_count += degenerate_count;
+      collapse_count += 1;
+      max_error_sq = std::max(max_error_sq, collapse.cost);
+    }
+
+    if (collapse_count == 0) {
+      break;
+    }
+
+    std::vector<std::uint32_t> next;
+    next.reserve(current.size());
+
+    for (std::size_t i{0}; i < current.size(); i += 3) {
+      std::array const corners{remap[current[i]], remap[current[i + 1]], remap[current[i + 2]]};
+
+      if (corners[0] != corners[1] && corners[1] != corners[2] && corners[2] != corners[0]) {
+        next.insert(next.end(), corners.begin(), corners.end());
+      }
+    }
+
+    simplified.indices = std::move(next);
+  }
+
+  simplified.error = static_cast<float>(std::sqrt(max_error_sq));
+  return simplified;
+}
+
+
+auto GenerateLods(CpuMesh& mesh) -> void {
+  mesh.lods.clear();
+  mesh.lod_indices.clear();
+
+  std::vector<std::uint32_t> previous_indices{mesh.indices};
+  auto error{0.0f};
+
+  for (auto level{0u}; level < kMaxLodCount && previous_indices.size() / 3 >= kMinLodTriangleCount; level++) {
+    auto const target_triangle_count{
+      static_cast<std::size_t>(static_cast<float>(previous_indices.size() / 3) * kLodTriangleRatio)
+    };
+    auto simplified{SimplifyMesh(previous_indices, mesh.positions, target_triangle_count * 3)};
+
+    if (static_cast<float>(simplified.indices.size()) > static_cast<float>(previous_indices.size()) *
+        kMinLodReduction) {
+      break;
+    }
+
+    OptimizeVertexCache(simplified.indices, mesh.positions.size());
+
+    // Every level is simplified from the previous one, so the distances from the full detail mesh add up
+    error += simplified.error;
+    mesh.lods.push_back(CpuMeshLod{
+      .first_index = static_cast<std::uint32_t>(mesh.lod_indices.size()),
+      .index_count = static_cast<std::uint32_t>(simplified.indices.size()),
+      .error = error
+    });
+    mesh.lod_indices.insert(mesh.lod_indices.end(), simplified.indices.begin(), simplified.indices.end());
+    previous_indices = std::move(simplified.indices);
+  }
+}
+
+
+auto GenerateSceneLods(CpuScene& scene, unsigned const thread_count) -> void {
+  using Milliseconds = std::chrono::duration<double, std::milli>;
+
+  auto const begin{std::chrono::steady_clock::now()};
+
+  ParallelFor(scene.meshes.size(), thread_count, [&scene](std::size_t const i) {
+    GenerateLods(scene.meshes[i]);
+  });
+
+  auto const end{std::chrono::steady_clock::now()};
+
+  std::size_t lod_count{0};
+  std::size_t base_triangle_count{0};
+  std::size_t coarsest_triangle_count{0};
+
+  for (auto const& mesh : scene.meshes) {
+    lod_count += mesh.lods.size();
+    base_triangle_count += mesh.indices.size() / 3;
+    coarsest_triangle_count += (mesh.lods.empty() ? mesh.indices.size() : mesh.lods.back().index_count) / 3;
+  }
+
+  std::cout << std::format("LOD generation took {:.2f} ms, {} levels for {} meshes, coarsest levels have {} of {} "
+                           "triangles.\n", Milliseconds{end - begin}.count(), lod_count, scene.meshes.size(),
+                           coarsest_triangle_count, base_triangle_count);
+}
+
+
+auto ComputeLodScale(float const vertical_fov_degrees, float const viewport_height) -> float {
+  return viewport_height / (2 * std::tan(vertical_fov_degrees * std::numbers::pi_v<float> / 360.0f));
+}
+
+
+auto ComputeScreenSpaceError(float const error, float const world_scale, float const distance,
+                             float const lod_scale) -> float {
+  if (distance <= 0) {
+    return std::numeric_limits<float>::infinity();
+  }
+
+  return error * world_scale / distance * lod_scale;
+}
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "scene.hpp"
+
+namespace refl {
+// Simplified levels generated per mesh in addition to the full detail one
+unsigned constexpr kMaxLodCount{4};
+// Every level targets this fraction of the triangles of the previous one
+float constexpr kLodTriangleRatio{0.5f};
+// Meshes with fewer triangles than this are not simplified further
+std::size_t constexpr kMinLodTriangleCount{64};
+// The coarsest level whose error projects to at most this many pixels is drawn
+float constexpr kDefaultMaxLodPixelError{1.0f};
+
+struct SimplifiedMesh {
+  std::vector<std::uint32_t> indices;
+  // Largest error of the collapses, the RMS distance of the kept vertex from the planes of the merged triangles
+  float error;
+};
+
+// Collapses edges in order of their quadric error (Garland and Heckbert, Surface Simplification Using Quadric Error
+// Metrics) until at most target_index_count indices remain or no more edges can be collapsed. Vertices only move onto
+// existing vertices, so the vertex streams are shared with the input. Vertices on open borders and attribute seams
+// are never removed.
+[[nodiscard]] auto SimplifyMesh(std::span<std::uint32_t const> indices, std::span<Vector4 const> positions,
+                                std::size_t target_index_count) -> SimplifiedMesh;
+
+// Replaces the LOD chain of the mesh, stops early once simplification stalls
+auto GenerateLods(CpuMesh& mesh) -> void;
+// Generates the LOD chains on thread_count threads and prints the statistics
+auto GenerateSceneLods(CpuScene& scene, unsigned thread_count) -> void;
+
+// Pixels covered by one world unit one unit away from the camera
+[[nodiscard]] auto ComputeLodScale(float vertical_fov_degrees, float viewport_height) -> float;
+// Size in pixels of an object space error of an instance scaled by world_scale at the given distance
+[[nodiscard]] auto ComputeScreenSpaceError(float error, float world_scale, float distance, float lod_scale) -> float;
+}
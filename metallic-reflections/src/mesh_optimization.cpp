@@ -0,0 +1,596 @@
+#include "mesh_optimization.hpp"
+
+#include "parallel.hpp"
+
+import std;
+
+namespace refl {
+namespace {
+// Tuning constants of Forsyth's scoring function
+unsigned constexpr kScoringCacheSize{32};
+float constexpr kCacheDecayPower{1.5f};
+float constexpr kLastTriangleScore{0.75f};
+float constexpr kValenceBoostScale{2.0f};
+float constexpr kValenceBoostPower{0.5f};
+
+// Resolution of the overdraw analysis views
+int constexpr kOverdrawGridSize{256};
+
+std::uint32_t constexpr kInvalidIndex{std::numeric_limits<std::uint32_t>::max()};
+
+
+auto ComputeVertexScore(int const cache_position, std::uint32_t const live_triangle_count) -> float {
+  if (live_triangle_count == 0) {
+    return -1.0f;
+  }
+
+  auto score{0.0f};
+
+  if (cache_position >= 0) {
+    if (cache_position < 3) {
+      // The vertices of the last triangle get a fixed score so that strips of it are not preferred
+      score = kLastTriangleScore;
+    } else {
+      auto const scaler{1.0f / static_cast<float>(kScoringCacheSize - 3)};
+      score = std::pow(1.0f - static_cast<float>(cache_position - 3) * scaler, kCacheDecayPower);
+    }
+  }
+
+  // Prefer vertices with few triangles left so that they can leave the cache for good
+  return score + kValenceBoostScale * std::pow(static_cast<float>(live_triangle_count), -kValenceBoostPower);
+}
+
+
+// FIFO cache simulation with timestamps, so that resetting the cache is O(1)
+class FifoCacheSimulator {
+public:
+  FifoCacheSimulator(std::size_t const vertex_count, unsigned const cache_size) :
+    timestamps_(vertex_count, 0),
+    cache_size_{cache_size},
+    time_{cache_size + 1} {}
+
+
+  // Returns the number of cache misses caused by the triangle
+  auto AddTriangle(std::span<std::uint32_t const, 3> const triangle) -> unsigned {
+    auto misses{0u};
+
+    for (auto const idx : triangle) {
+      if (time_ - timestamps_[idx] > cache_size_) {
+        timestamps_[idx] = time_++;
+        misses += 1;
+      }
+    }
+
+    return misses;
+  }
+
+
+  auto Reset() -> void {
+    time_ += cache_size_ + 1;
+  }
+
+private:
+  std::vector<std::size_t> timestamps_;
+  std::size_t cache_size_;
+  std::size_t time_;
+};
+
+
+auto GetTriangle(std::span<std::uint32_t const> const indices, std::size_t const tri) -> std::span<std::uint32_t const, 3> {
+  return indices.subspan(tri * 3).first<3>();
+}
+
+
+auto Subtract(Vector4 const& a, Vector4 const& b) -> std::array<float, 3> {
+  return {a[0] - b[0], a[1] - b[1], a[2] - b[2]};
+}
+
+
+auto Cross(std::array<float, 3> const& a, std::array<float, 3> const& b) -> std::array<float, 3> {
+  return {a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0]};
+}
+
+
+// Draws the triangles in order with a less depth test and counts the fragments that pass it
+auto RasterizeOverdrawView(std::span<std::uint32_t const> const indices,
+                           std::span<std::array<float, 3> const> const projected, std::vector<float>& depth_buf,
+                           OverdrawStats& stats) -> void {
+  std::ranges::fill(depth_buf, std::numeric_limits<float>::infinity());
+
+  for (std::size_t tri{0}; tri < indices.size() / 3; tri++) {
+    auto const& a{projected[indices[tri * 3]]};
+    auto const& b{projected[indices[tri * 3 + 1]]};
+    auto const& c{projected[indices[tri * 3 + 2]]};
+
+    auto const area{(b[0] - a[0]) * (c[1] - a[1]) - (b[1] - a[1]) * (c[0] - a[0])};
+
+    // Backfacing or degenerate, drawn by the opposite view instead
+    if (area <= 0) {
+      continue;
+    }
+
+    auto const min_x{std::max(static_cast<int>(std::floor(std::min({a[0], b[0], c[0]}))), 0)};
+    auto const min_y{std::max(static_cast<int>(std::floor(std::min({a[1], b[1], c[1]}))), 0)};
+    auto const max_x{std::min(static_cast<int>(std::ceil(std::max({a[0], b[0], c[0]}))), kOverdrawGridSize - 1)};
+    auto const max_y{std::min(static_cast<int>(std::ceil(std::max({a[1], b[1], c[1]}))), kOverdrawGridSize - 1)};
+
+    for (auto y{min_y}; y <= max_y; y++) {
+      for (auto x{min_x}; x <= max_x; x++) {
+        auto const px{static_cast<float>(x) + 0.5f};
+        auto const py{static_cast<float>(y) + 0.5f};
+
+        auto const w0{(c[0] - b[0]) * (py - b[1]) - (c[1] - b[1]) * (px - b[0])};
+        auto const w1{(a[0] - c[0]) * (py - c[1]) - (a[1] - c[1]) * (px - c[0])};
+        auto const w2{(b[0] - a[0]) * (py - a[1]) - (b[1] - a[1]) * (px - a[0])};
+
+        if (w0 < 0 || w1 < 0 || w2 < 0) {
+          continue;
+        }
+
+        auto const z{(w0 * a[2] + w1 * b[2] + w2 * c[2]) / area};
+        auto& depth{depth_buf[static_cast<std::size_t>(y) * kOverdrawGridSize + x]};
+
+        if (z < depth) {
+          depth = z;
+          stats.shaded_pixel_count += 1;
+        }
+      }
+    }
+  }
+
+  stats.covered_pixel_count += static_cast<std::size_t>(std::ranges::count_if(depth_buf, [](float const depth) {
+    return depth != std::numeric_limits<float>::infinity();
+  }));
+}
+
+
+// Splits the triangle list where the cache starts over anyway, then splits those clusters further wherever the ACMR
+// up to that point is within the threshold. Returns the first triangle of every cluster.
+auto FindOverdrawClusters(std::span<std::uint32_t const> const indices, std::size_t const vertex_count,
+                          float const acmr_threshold) -> std::vector<std::size_t> {
+  auto const tri_count{indices.size() / 3};
+
+  FifoCacheSimulator cache{vertex_count, kAnalyzedVertexCacheSize};
+  std::vector<std::size_t> hard_boundaries;
+
+  for (std::size_t tri{0}; tri < tri_count; tri++) {
+    if (cache.AddTriangle(GetTriangle(indices, tri)) == 3 || tri == 0) {
+      hard_boundaries.push_back(tri);
+    }
+  }
+
+  hard_boundaries.push_back(tri_count);
+
+  std::vector<std::size_t> clusters;
+
+  for (std::size_t i{0}; i + 1 < hard_boundaries.size(); i++) {
+    auto const begin{hard_boundaries[i]};
+    auto const end{hard_boundaries[i + 1]};
+
+    cache.Reset();
+    auto cluster_misses{0u};
+
+    for (auto tri{begin}; tri < end; tri++) {
+      cluster_misses += cache.AddTriangle(GetTriangle(indices, tri));
+    }
+
+    auto const threshold{acmr_threshold * static_cast<float>(cluster_misses) / static_cast<float>(end - begin)};
+
+    cache.Reset();
+    clusters.push_back(begin);
+    auto sub_begin{begin};
+    auto sub_misses{0u};
+
+    for (auto tri{begin}; tri < end; tri++) {
+      sub_misses += cache.AddTriangle(GetTriangle(indices, tri));
+
+      if (tri + 1 < end && static_cast<float>(sub_misses) / static_cast<float>(tri + 1 - sub_begin) <= threshold) {
+        cache.Reset();
+        clusters.push_back(tri + 1);
+        sub_begin = tri + 1;
+        sub_misses = 0;
+      }
+    }
+  }
+
+  return clusters;
+}
+}
+
+
+auto VertexCacheStats::GetAcmr() const -> float {
+  return triangle_count == 0
+           ? 0.0f
+           : static_cast<float>(transformed_vertex_count) / static_cast<float>(triangle_count);
+}
+
+
+auto VertexCacheStats::GetAtvr() const -> float {
+  return vertex_count == 0 ? 0.0f : static_cast<float>(transformed_vertex_count) / static_cast<float>(vertex_count);
+}
+
+
+auto OverdrawStats::GetOverdraw() const -> float {
+  return covered_pixel_count == 0
+           ? 0.0f
+           : static_cast<float>(shaded_pixel_count) / static_cast<float>(covered_pixel_count);
+}
+
+
+auto AnalyzeVertexCache(std::span<std::uint32_t const> const indices, std::size_t const vertex_count,
+                        unsigned const cache_size) -> VertexCacheStats {
+  FifoCacheSimulator cache{vertex_count, cache_size};
+  VertexCacheStats stats{.transformed_vertex_count = 0, .triangle_count = indices.size() / 3, .vertex_count = 0};
+
+  for (std::size_t tri{0}; tri < stats.triangle_count; tri++) {
+    stats.transformed_vertex_count += cache.AddTriangle(GetTriangle(indices, tri));
+  }
+
+  // Only count vertices that are actually referenced
+  std::vector<bool> referenced(vertex_count, false);
+
+  for (auto const idx : indices) {
+    if (!referenced[idx]) {
+      referenced[idx] = true;
+      stats.vertex_count += 1;
+    }
+  }
+
+  return stats;
+}
+
+
+auto AnalyzeOverdraw(std::span<std::uint32_t const> const indices,
+                     std::span<Vector4 const> const positions) -> OverdrawStats {
+  OverdrawStats stats{.shaded_pixel_count = 0, .covered_pixel_count = 0};
+
+  if (positions.empty() || indices.empty()) {
+    return stats;
+  }
+
+  std::array<float, 3> min{positions[0][0], positions[0][1], positions[0][2]};
+  auto max{min};
+
+  for (auto const& pos : positions) {
+    for (auto i{0}; i < 3; i++) {
+      min[i] = std::min(min[i], pos[i]);
+      max[i] = std::max(max[i], pos[i]);
+    }
+  }
+
+  // Uniform scale so that the views keep the aspect ratio of the mesh
+  auto const extent{std::max({max[0] - min[0], max[1] - min[1], max[2] - min[2]})};
+  auto const scale{extent > 0 ? static_cast<float>(kOverdrawGridSize) / extent : 0.0f};
+
+  std::vector<std::array<float, 3>> projected(positions.size());
+  std::vector<float> depth_buf(static_cast<std::size_t>(kOverdrawGridSize) * kOverdrawGridSize);
+
+  for (auto axis{0}; axis < 3; axis++) {
+    auto const u_axis{(axis + 1) % 3};
+    auto const v_axis{(axis + 2) % 3};
+
+    // Looking along the axis from both sides. Mirroring u flips the winding, so every triangle is front facing in
+    // exactly one of the two views. Front faces are clockwise in our left-handed convention, i.e. their normal is
+    // cross(b - a, c - a), so the view with positive projected area looks at them from the positive side.
+    for (auto const dir : {1.0f, -1.0f}) {
+      for (std::size_t i{0}; i < positions.size(); i++) {
+        auto const& pos{positions[i]};
+        auto const u{(pos[u_axis] - min[u_axis]) * scale};
+        projected[i] = {
+          dir > 0 ? u : static_cast<float>(kOverdrawGridSize) - u, (pos[v_axis] - min[v_axis]) * scale,
+          -dir * pos[axis]
+        };
+      }
+
+      RasterizeOverdrawView(indices, projected, depth_buf, stats);
+    }
+  }
+
+  return stats;
+}
+
+
+auto AnalyzeMesh(CpuMesh const& mesh) -> MeshOptimizationStats {
+  return MeshOptimizationStats{
+    .vertex_cache = AnalyzeVertexCache(mesh.indices, mesh.positions.size()),
+    .overdraw = AnalyzeOverdraw(mesh.indices, mesh.positions)
+  };
+}
+
+
+auto AnalyzeScene(CpuScene const& scene, unsigned const thread_count) -> MeshOptimizationStats {
+  std::vector<MeshOptimizationStats> mesh_stats(scene.meshes.size());
+
+  ParallelFor(scene.meshes.size(), thread_count, [&](std::size_t const i) {
+    mesh_stats[i] = AnalyzeMesh(scene.meshes[i]);
+  });
+
+  MeshOptimizationStats total{};
+
+  for (auto const& stats : mesh_stats) {
+    total.vertex_cache.transformed_vertex_count += stats.vertex_cache.transformed_vertex_count;
+    total.vertex_cache.triangle_count += stats.vertex_cache.triangle_count;
+    total.vertex_cache.vertex_count += stats.vertex_cache.vertex_count;
+    total.overdraw.shaded_pixel_count += stats.overdraw.shaded_pixel_count;
+    total.overdraw.covered_pixel_count += stats.overdraw.covered_pixel_count;
+  }
+
+  return total;
+}
+
+
+auto OptimizeVertexCache(std::span<std::uint32_t> const indices, std::size_t const vertex_count) -> void {
+  auto const tri_count{indices.size() / 3};
+
+  if (tri_count == 0) {
+    return;
+  }
+
+  // Triangles referencing each vertex. The live ones are kept at the front of every vertex's range.
+  std::vector<std::uint32_t> live_tri_counts(vertex_count, 0);
+
+  for (auto const idx : indices) {
+    live_tri_counts[idx] += 1;
+  }
+
+  std::vector<std::uint32_t> adjacency_offsets(vertex_count + 1, 0);
+  std::inclusive_scan(live_tri_counts.begin(), live_tri_counts.end(), adjacency_offsets.begin() + 1);
+
+  std::vector<std::uint32_t> adjacency(indices.size());
+  {
+    auto fill_cursors{adjacency_offsets};
+
+    for (std::size_t i{0}; i < indices.size(); i++) {
+      adjacency[fill_cursors[indices[i]]++] = static_cast<std::uint32_t>(i / 3);
+    }
+  }
+
+  std::vector<int> cache_positions(vertex_count, -1);
+  std::vector<float> vertex_scores(vertex_count);
+
+  for (std::size_t v{0}; v < vertex_count; v++) {
+    vertex_scores[v] = ComputeVertexScore(-1, live_tri_counts[v]);
+  }
+
+  std::vector<float> tri_scores(tri_count, 0.0f);
+  std::vector<bool> emitted(tri_count, false);
+
+  for (std::size_t i{0}; i < indices.size(); i++) {
+    tri_scores[i / 3] += vertex_scores[indices[i]];
+  }
+
+  auto best_tri{static_cast<std::uint32_t>(std::ranges::max_element(tri_scores) - tri_scores.begin())};
+
+  std::vector<std::uint32_t> optimized;
+  optimized.reserve(indices.size());
+
+  std::vector<std::uint32_t> cache;
+  std::vector<std::uint32_t> new_cache;
+  cache.reserve(kScoringCacheSize + 3);
+  new_cache.reserve(kScoringCacheSize + 3);
+
+  std::size_t fallback_cursor{0};
+
+  for (std::size_t emitted_count{0}; emitted_count < tri_count; emitted_count++) {
+    if (best_tri == kInvalidIndex) {
+      // Nothing in the cache has live triangles, continue with the first unemitted triangle
+      while (emitted[fallback_cursor]) {
+        fallback_cursor += 1;
+      }
+
+      best_tri = static_cast<std::uint32_t>(fallback_cursor);
+    }
+
+    auto const triangle{GetTriangle(indices, best_tri)};
+    optimized.insert(optimized.end(), triangle.begin(), triangle.end());
+    emitted[best_tri] = true;
+
+    new_cache.clear();
+
+    for (auto const v : triangle) {
+      // Remove the triangle from the live range of the vertex
+      auto const live_begin{adjacency.begin() + adjacency_offsets[v]};
+      auto const live_end{live_begin + live_tri_counts[v]};
+      std::iter_swap(std::ranges::find(live_begin, live_end, best_tri), live_end - 1);
+      live_tri_counts[v] -= 1;
+
+      if (std::ranges::find(new_cache, v) == new_cache.end()) {
+        new_cache.push_back(v);
+      }
+    }
+
+    for (auto const v : cache) {
+      if (std::ranges::find(new_cache, v) == new_cache.end()) {
+        new_cache.push_back(v);
+      }
+    }
+
+    // Vertices pushed out of the scoring cache still need their scores updated
+    for (auto i{kScoringCacheSize}; i < new_cache.size(); i++) {
+      cache_positions[new_cache[i]] = -1;
+    }
+
+    for (std::size_t i{0}; i < std::min<std::size_t>(new_cache.size(), kScoringCacheSize); i++) {
+      cache_positions[new_cache[i]] = static_cast<int>(i);
+    }
+
+    for (auto const v : new_cache) {
+      auto const score{ComputeVertexScore(cache_positions[v], live_tri_counts[v])};
+      auto const delta{score - vertex_scores[v]};
+      vertex_scores[v] = score;
+
+      for (auto i{adjacency_offsets[v]}; i < adjacency_offsets[v] + live_tri_counts[v]; i++) {
+        tri_scores[adjacency[i]] += delta;
+      }
+    }
+
+    // The next triangle is the best scoring one among those touching the cache
+    best_tri = kInvalidIndex;
+    auto best_score{-1.0f};
+
+    for (auto const v : new_cache) {
+      if (cache_positions[v] < 0) {
+        continue;
+      }
+
+      for (auto i{adjacency_offsets[v]}; i < adjacency_offsets[v] + live_tri_counts[v]; i++) {
+        if (tri_scores[adjacency[i]] > best_score) {
+          best_score = tri_scores[adjacency[i]];
+          best_tri = adjacency[i];
+        }
+      }
+    }
+
+    if (new_cache.size() > kScoringCacheSize) {
+      new_cache.resize(kScoringCacheSize);
+    }
+
+    std::swap(cache, new_cache);
+  }
+
+  std::ranges::copy(optimized, indices.begin());
+}
+
+
+auto OptimizeOverdraw(std::span<std::uint32_t> const indices, std::span<Vector4 const> const positions,
+                      float const acmr_threshold) -> void {
+  auto const tri_count{indices.size() / 3};
+
+  if (tri_count == 0) {
+    return;
+  }
+
+  auto const clusters{FindOverdrawClusters(indices, positions.size(), acmr_threshold)};
+
+  std::array<float, 3> mesh_centroid{0, 0, 0};
+
+  for (auto const& pos : positions) {
+    for (auto i{0}; i < 3; i++) {
+      mesh_centroid[i] += pos[i] / static_cast<float>(positions.size());
+    }
+  }
+
+  // Clusters that face away from the center of the mesh are likely to occlude others, so they are drawn first
+  std::vector<float> sort_keys(clusters.size());
+
+  for (std::size_t i{0}; i < clusters.size(); i++) {
+    auto const end{i + 1 < clusters.size() ? clusters[i + 1] : tri_count};
+
+    std::array<float, 3> centroid{0, 0, 0};
+    std::array<float, 3> normal{0, 0, 0};
+    auto area_sum{0.0f};
+
+    for (auto tri{clusters[i]}; tri < end; tri++) {
+      auto const& a{positions[indices[tri * 3]]};
+      auto const& b{positions[indices[tri * 3 + 1]]};
+      auto const& c{positions[indices[tri * 3 + 2]]};
+
+      // Twice the area weighted normal
+      auto const tri_normal{Cross(Subtract(b, a), Subtract(c, a))};
+      auto const area{std::sqrt(tri_normal[0] * tri_normal[0] + tri_normal[1] * tri_normal[1] +
+                                tri_normal[2] * tri_normal[2])};
+
+      for (auto j{0}; j < 3; j++) {
+        centroid[j] += (a[j] + b[j] + c[j]) / 3.0f * area;
+        normal[j] += tri_normal[j];
+      }
+
+      area_sum += area;
+    }
+
+    auto const normal_length{std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2])};
+
+    if (area_sum <= 0 || normal_length <= 0) {
+      sort_keys[i] = -std::numeric_limits<float>::max();
+      continue;
+    }
+
+    sort_keys[i] = 0;
+
+    for (auto j{0}; j < 3; j++) {
+      sort_keys[i] += (centroid[j] / area_sum - mesh_centroid[j]) * normal[j] / normal_length;
+    }
+  }
+
+  std::vector<std::size_t> order(clusters.size());
+  std::iota(order.begin(), order.end(), std::size_t{0});
+  std::ranges::stable_sort(order, std::ranges::greater{}, [&sort_keys](std::size_t const i) {
+    return sort_keys[i];
+  });
+
+  std::vector<std::uint32_t> reordered;
+  reordered.reserve(indices.size());
+
+  for (auto const i : order) {
+    auto const end{i + 1 < clusters.size() ? clusters[i + 1] : tri_count};
+    reordered.insert(reordered.end(), indices.begin() + clusters[i] * 3, indices.begin() + end * 3);
+  }
+
+  std::ranges::copy(reordered, indices.begin());
+}
+
+
+auto OptimizeVertexFetch(CpuMesh& mesh) -> void {
+  std::vector<std::uint32_t> remap(mesh.positions.size(), kInvalidIndex);
+  std::uint32_t next_idx{0};
+
+  for (auto& idx : mesh.indices) {
+    if (remap[idx] == kInvalidIndex) {
+      remap[idx] = next_idx++;
+    }
+
+    idx = remap[idx];
+  }
+
+  auto const remap_stream{
+    [&remap, next_idx]<typename T>(std::vector<T>& stream) {
+      if (stream.empty()) {
+        return;
+      }
+
+      std::vector<T> remapped(next_idx);
+
+      for (std::size_t i{0}; i < stream.size(); i++) {
+        if (remap[i] != kInvalidIndex) {
+          remapped[remap[i]] = stream[i];
+        }
+      }
+
+      stream = std::move(remapped);
+    }
+  };
+
+  remap_stream(mesh.positions);
+  remap_stream(mesh.normals);
+  remap_stream(mesh.texcoords);
+  remap_stream(mesh.tangents);
+}
+
+
+auto OptimizeMesh(CpuMesh& mesh) -> void {
+  OptimizeVertexCache(mesh.indices, mesh.positions.size());
+  OptimizeOverdraw(mesh.indices, mesh.positions);
+  OptimizeVertexFetch(mesh);
+}
+
+
+auto OptimizeScene(CpuScene& scene, unsigned const thread_count) -> void {
+  using Milliseconds = std::chrono::duration<double, std::milli>;
+
+  auto const before{AnalyzeScene(scene, thread_count)};
+  auto const begin{std::chrono::steady_clock::now()};
+
+  ParallelFor(scene.meshes.size(), thread_count, [&scene](std::size_t const i) {
+    OptimizeMesh(scene.meshes[i]);
+  });
+
+  auto const end{std::chrono::steady_clock::now()};
+  auto const after{AnalyzeScene(scene, thread_count)};
+
+  std::cout << std::format("Mesh optimization took {:.2f} ms.\n", Milliseconds{end - begin}.count());
+  std::cout << std::format("ACMR: {:.3f} -> {:.3f}, ATVR: {:.3f} -> {:.3f}, overdraw: {:.3f} -> {:.3f}\n",
+                           before.vertex_cache.GetAcmr(), after.vertex_cache.GetAcmr(),
+                           before.vertex_cache.GetAtvr(), after.vertex_cache.GetAtvr(),
+                           before.overdraw.GetOverdraw(), after.overdraw.GetOverdraw());
+}
+}
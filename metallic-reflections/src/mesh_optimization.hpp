@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#include "scene.hpp"
+
+namespace refl {
+// Size of the FIFO post-transform cache the statistics are measured with
+unsigned constexpr kAnalyzedVertexCacheSize{16};
+// Overdraw optimization may make the ACMR this much worse in exchange for a better draw order
+float constexpr kOverdrawAcmrThreshold{1.05f};
+
+struct VertexCacheStats {
+  std::size_t transformed_vertex_count;
+  std::size_t triangle_count;
+  std::size_t vertex_count;
+
+  // Average cache miss ratio, transformed vertices per triangle. 0.5 is the theoretical best, 3 the worst.
+  [[nodiscard]] auto GetAcmr() const -> float;
+  // Average transformed to vertex ratio, 1 is optimal
+  [[nodiscard]] auto GetAtvr() const -> float;
+};
+
+struct OverdrawStats {
+  std::size_t shaded_pixel_count;
+  std::size_t covered_pixel_count;
+
+  // Shaded pixels per covered pixel averaged over the axis aligned views, 1 is optimal
+  [[nodiscard]] auto GetOverdraw() const -> float;
+};
+
+struct MeshOptimizationStats {
+  VertexCacheStats vertex_cache;
+  OverdrawStats overdraw;
+};
+
+// Simulates a FIFO post-transform cache of cache_size entries over the triangle list
+[[nodiscard]] auto AnalyzeVertexCache(std::span<std::uint32_t const> indices, std::size_t vertex_count,
+                                      unsigned cache_size = kAnalyzedVertexCacheSize) -> VertexCacheStats;
+// Rasterizes the mesh with depth testing from the six axis aligned directions in index order
+[[nodiscard]] auto AnalyzeOverdraw(std::span<std::uint32_t const> indices,
+                                   std::span<Vector4 const> positions) -> OverdrawStats;
+[[nodiscard]] auto AnalyzeMesh(CpuMesh const& mesh) -> MeshOptimizationStats;
+// Analyzes the meshes on thread_count threads and sums the counts
+[[nodiscard]] auto AnalyzeScene(CpuScene const& scene, unsigned thread_count) -> MeshOptimizationStats;
+
+// Reorders triangles for post-transform cache efficiency (Forsyth, Linear-Speed Vertex Cache Optimisation)
+auto OptimizeVertexCache(std::span<std::uint32_t> indices, std::size_t vertex_count) -> void;
+// Reorders clusters of the cache optimized triangle list so that outward facing clusters are drawn first
+// (Sander et al., Fast Triangle Reordering for Vertex Locality and Reduced Overdraw). Clusters are split at points
+// where the ACMR stays within acmr_threshold times that of the input.
+auto OptimizeOverdraw(std::span<std::uint32_t> indices, std::span<Vector4 const> positions,
+                      float acmr_threshold = kOverdrawAcmrThreshold) -> void;
+// Reorders the vertex streams in the order of first use by the index buffer and drops unreferenced vertices
+auto OptimizeVertexFetch(CpuMesh& mesh) -> void;
+
+// Runs all of the above in order
+auto OptimizeMesh(CpuMesh& mesh) -> void;
+// Optimizes the meshes on thread_count threads and prints the statistics before and after
+auto OptimizeScene(CpuScene& scene, unsigned thread_count) -> void;
+}
@@ -0,0 +1,343 @@
+#include "meshlets.hpp"
+
+#include "parallel.hpp"
+
+import std;
+
+namespace refl {
+namespace {
+using Float3 = std::array<float, 3>;
+
+// Meshlets whose normals deviate more than this from the cone axis get no cone, as it would almost never cull
+float constexpr kMinConeAxisDot{0.1f};
+
+
+auto ToFloat3(Vector4 const& v) -> Float3 {
+  return {v[0], v[1], v[2]};
+}
+
+
+auto Subtract(Float3 const& a, Float3 const& b) -> Float3 {
+  return {a[0] - b[0], a[1] - b[1], a[2] - b[2]};
+}
+
+
+auto Dot(Float3 const& a, Float3 const& b) -> float {
+  return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+
+auto Cross(Float3 const& a, Float3 const& b) -> Float3 {
+  return {a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0]};
+}
+
+
+auto Length(Float3 const& v) -> float {
+  return std::sqrt(Dot(v, v));
+}
+
+
+struct Sphere {
+  Float3 center;
+  float radius;
+};
+
+
+// Ritter's bounding sphere, within about 5% of the minimal one
+auto ComputeBoundingSphere(std::span<Float3 const> const points) -> Sphere {
+  auto const farthest_from{
+    [points](Float3 const& from) {
+      return *std::ranges::max_element(points, {}, [&from](Float3 const& p) {
+        auto const d{Subtract(p, from)};
+        return Dot(d, d);
+      });
+    }
+  };
+
+  auto const a{farthest_from(points[0])};
+  auto const b{farthest_from(a)};
+
+  Sphere sphere{
+    .center = {(a[0] + b[0]) * 0.5f, (a[1] + b[1]) * 0.5f, (a[2] + b[2]) * 0.5f},
+    .radius = Length(Subtract(a, b)) * 0.5f
+  };
+
+  for (auto const& p : points) {
+    auto const d{Subtract(p, sphere.center)};
+    auto const dist{Length(d)};
+
+    if (dist > sphere.radius) {
+      // Grow the sphere just enough to touch the point, moving the center towards it
+      auto const new_radius{(sphere.radius + dist) * 0.5f};
+      auto const shift{(new_radius - sphere.radius) / dist};
+
+      for (auto i{0}; i < 3; i++) {
+        sphere.center[i] += d[i] * shift;
+      }
+
+      sphere.radius = new_radius;
+    }
+  }
+
+  return sphere;
+}
+
+
+// Bounding sphere and normal cone (Zeux, meshoptimizer's meshopt_computeClusterBounds)
+auto ComputeMeshletBounds(CpuMesh const& mesh, MeshletMesh const& meshlet_mesh,
+                          Meshlet const& meshlet) -> MeshletBounds {
+  std::vector<Float3> positions;
+  positions.reserve(meshlet.vertex_count);
+
+  for (auto i{0u}; i < meshlet.vertex_count; i++) {
+    positions.push_back(ToFloat3(mesh.positions[meshlet_mesh.vertex_indices[meshlet.vertex_offset + i]]));
+  }
+
+  auto const sphere{ComputeBoundingSphere(positions)};
+
+  MeshletBounds bounds{
+    .center = {sphere.center[0], sphere.center[1], sphere.center[2]},
+    .radius = sphere.radius,
+    .cone_apex = {sphere.center[0], sphere.center[1], sphere.center[2]},
+    .cone_axis = {0, 0, 1},
+    .cone_cutoff = 1
+  };
+
+  // Front faces are clockwise in our left-handed convention, so cross(b - a, c - a) points outwards
+  std::vector<Float3> normals;
+  std::vector<Float3> first_corners;
+  normals.reserve(meshlet.triangle_count);
+  first_corners.reserve(meshlet.triangle_count);
+
+  for (auto i{0u}; i < meshlet.triangle_count; i++) {
+    auto const local{std::span{meshlet_mesh.local_indices}.subspan(meshlet.triangle_offset + i * 3, 3)};
+    auto const& a{positions[local[0]]};
+    auto const& b{positions[local[1]]};
+    auto const& c{positions[local[2]]};
+
+    auto const normal{Cross(Subtract(b, a), Subtract(c, a))};
+    auto const length{Length(normal)};
+
+    if (length > 0) {
+      normals.push_back({normal[0] / length, normal[1] / length, normal[2] / length});
+      first_corners.push_back(a);
+    }
+  }
+
+  if (normals.empty()) {
+    return bounds;
+  }
+
+  // The axis is the center of the bounding sphere of the normals on the unit sphere
+  auto const normal_sphere{ComputeBoundingSphere(normals)};
+  auto const axis_length{Length(normal_sphere.center)};
+
+  if (axis_length <= 0) {
+    return bounds;
+  }
+
+  Float3 const axis{
+    normal_sphere.center[0] / axis_length, normal_sphere.center[1] / axis_length,
+    normal_sphere.center[2] / axis_length
+  };
+
+  auto const min_dot{
+    std::ranges::min(normals | std::views::transform([&axis](Float3 const& n) {
+      return Dot(n, axis);
+    }))
+  };
+
+  if (min_dot <= kMinConeAxisDot) {
+    return bounds;
+  }
+
+  // Move the apex back along the axis until every triangle plane is in front of it
+  auto max_t{0.0f};
+
+  for (std::size_t i{0}; i < normals.size(); i++) {
+    auto const dc{Dot(Subtract(sphere.center, first_corners[i]), normals[i])};
+    auto const dn{Dot(axis, normals[i])};
+    max_t = std::max(max_t, dc / dn);
+  }
+
+  bounds.cone_apex = {
+    sphere.center[0] - axis[0] * max_t, sphere.center[1] - axis[1] * max_t, sphere.center[2] - axis[2] * max_t
+  };
+  bounds.cone_axis = {axis[0], axis[1], axis[2]};
+  bounds.cone_cutoff = std::sqrt(1 - min_dot * min_dot);
+  return bounds;
+}
+
+
+auto TransformPoint(DirectX::XMFLOAT3 const& p, DirectX::XMFLOAT4X4 const& mtx) -> Float3 {
+  return {
+    p.x * mtx._11 + p.y * mtx._21 + p.z * mtx._31 + mtx._41,
+    p.x * mtx._12 + p.y * mtx._22 + p.z * mtx._32 + mtx._42,
+    p.x * mtx._13 + p.y * mtx._23 + p.z * mtx._33 + mtx._43
+  };
+}
+
+
+auto TransformDirection(DirectX::XMFLOAT3 const& d, DirectX::XMFLOAT4X4 const& mtx) -> Float3 {
+  return {
+    d.x * mtx._11 + d.y * mtx._21 + d.z * mtx._31,
+    d.x * mtx._12 + d.y * mtx._22 + d.z * mtx._32,
+    d.x * mtx._13 + d.y * mtx._23 + d.z * mtx._33
+  };
+}
+}
+
+
+auto BuildMeshlets(CpuMesh const& mesh, unsigned const max_vertices, unsigned const max_triangles) -> MeshletMesh {
+  MeshletMesh meshlet_mesh;
+
+  auto constexpr no_meshlet{std::numeric_limits<std::uint32_t>::max()};
+  // Meshlet each vertex was last added to and its local index there
+  std::vector<std::uint32_t> vertex_meshlets(mesh.positions.size(), no_meshlet);
+  std::vector<std::uint8_t> local_vertex_indices(mesh.positions.size());
+
+  Meshlet meshlet{.vertex_offset = 0, .triangle_offset = 0, .vertex_count = 0, .triangle_count = 0};
+
+  auto const flush{
+    [&] {
+      meshlet_mesh.meshlets.push_back(meshlet);
+      meshlet = Meshlet{
+        .vertex_offset = static_cast<std::uint32_t>(meshlet_mesh.vertex_indices.size()),
+        .triangle_offset = static_cast<std::uint32_t>(meshlet_mesh.local_indices.size()),
+        .vertex_count = 0,
+        .triangle_count = 0
+      };
+    }
+  };
+
+  for (std::size_t tri{0}; tri < mesh.indices.size() / 3; tri++) {
+    auto const triangle{std::span{mesh.indices}.subspan(tri * 3, 3)};
+    auto const meshlet_idx{static_cast<std::uint32_t>(meshlet_mesh.meshlets.size())};
+
+    auto new_vertex_count{0u};
+
+    for (auto i{0}; i < 3; i++) {
+      auto const preceding{triangle.first(i)};
+      auto const is_duplicate{std::ranges::find(preceding, triangle[i]) != preceding.end()};
+
+      if (!is_duplicate && vertex_meshlets[triangle[i]] != meshlet_idx) {
+        new_vertex_count += 1;
+      }
+    }
+
+    if (meshlet.vertex_count + new_vertex_count > max_vertices || meshlet.triangle_count + 1 > max_triangles) {
+      flush();
+    }
+
+    auto const current_meshlet_idx{static_cast<std::uint32_t>(meshlet_mesh.meshlets.size())};
+
+    for (auto const v : triangle) {
+      if (vertex_meshlets[v] != current_meshlet_idx) {
+        vertex_meshlets[v] = current_meshlet_idx;
+        local_vertex_indices[v] = static_cast<std::uint8_t>(meshlet.vertex_count++);
+        meshlet_mesh.vertex_indices.push_back(v);
+      }
+
+      meshlet_mesh.local_indices.push_back(local_vertex_indices[v]);
+    }
+
+    meshlet.triangle_count += 1;
+  }
+
+  if (meshlet.triangle_count > 0) {
+    flush();
+  }
+
+  meshlet_mesh.bounds.reserve(meshlet_mesh.meshlets.size());
+
+  for (auto const& m : meshlet_mesh.meshlets) {
+    meshlet_mesh.bounds.push_back(ComputeMeshletBounds(mesh, meshlet_mesh, m));
+  }
+
+  return meshlet_mesh;
+}
+
+
+auto BuildMeshlets(CpuScene const& scene, unsigned const thread_count) -> std::vector<MeshletMesh> {
+  std::vector<MeshletMesh> meshlet_meshes(scene.meshes.size());
+
+  ParallelFor(scene.meshes.size(), thread_count, [&](std::size_t const i) {
+    meshlet_meshes[i] = BuildMeshlets(scene.meshes[i]);
+  });
+
+  return meshlet_meshes;
+}
+
+
+auto MeshletFillStats::GetVertexFillRate() const -> float {
+  return meshlet_count == 0
+           ? 0.0f
+           : static_cast<float>(vertex_count) / static_cast<float>(meshlet_count * kMaxMeshletVertices);
+}
+
+
+auto MeshletFillStats::GetTriangleFillRate() const -> float {
+  return meshlet_count == 0
+           ? 0.0f
+           : static_cast<float>(triangle_count) / static_cast<float>(meshlet_count * kMaxMeshletTriangles);
+}
+
+
+auto ComputeMeshletFillStats(std::span<MeshletMesh const> const meshlet_meshes) -> MeshletFillStats {
+  MeshletFillStats stats{.meshlet_count = 0, .vertex_count = 0, .triangle_count = 0};
+
+  for (auto const& meshlet_mesh : meshlet_meshes) {
+    for (auto const& meshlet : meshlet_mesh.meshlets) {
+      stats.meshlet_count += 1;
+      stats.vertex_count += meshlet.vertex_count;
+      stats.triangle_count += meshlet.triangle_count;
+    }
+  }
+
+  return stats;
+}
+
+
+auto CullMeshlets(MeshletMesh const& meshlet_mesh, CpuMeshTransform const& transform, Frustum const& frustum,
+                  DirectX::XMFLOAT3 const& camera_pos, std::vector<std::uint32_t>& visible_meshlets,
+                  MeshletCullingStats& stats) -> void {
+  auto const& world_mtx{transform.world_mtx};
+
+  // Rows of the upper 3x3 are the transformed basis vectors, the longest one bounds the scaling of the radius
+  auto const radius_scale{
+    std::sqrt(std::max({
+      world_mtx._11 * world_mtx._11 + world_mtx._12 * world_mtx._12 + world_mtx._13 * world_mtx._13,
+      world_mtx._21 * world_mtx._21 + world_mtx._22 * world_mtx._22 + world_mtx._23 * world_mtx._23,
+      world_mtx._31 * world_mtx._31 + world_mtx._32 * world_mtx._32 + world_mtx._33 * world_mtx._33
+    }))
+  };
+
+  Float3 const camera{camera_pos.x, camera_pos.y, camera_pos.z};
+
+  for (std::uint32_t i{0}; i < meshlet_mesh.bounds.size(); i++) {
+    auto const& bounds{meshlet_mesh.bounds[i]};
+    stats.tested_count += 1;
+
+    auto const center{TransformPoint(bounds.center, world_mtx)};
+
+    if (!IsSphereInFrustum(frustum, {center[0], center[1], center[2]}, bounds.radius * radius_scale)) {
+      stats.frustum_culled_count += 1;
+      continue;
+    }
+
+    if (bounds.cone_cutoff < 1) {
+      auto const apex{TransformPoint(bounds.cone_apex, world_mtx)};
+      auto const axis{TransformDirection(bounds.cone_axis, transform.normal_mtx)};
+      auto const view_dir{Subtract(apex, camera)};
+      auto const length_product{Length(view_dir) * Length(axis)};
+
+      if (length_product > 0 && Dot(view_dir, axis) >= bounds.cone_cutoff * length_product) {
+        stats.cone_culled_count += 1;
+        continue;
+      }
+    }
+
+    visible_meshlets.push_back(i);
+  }
+}
+}
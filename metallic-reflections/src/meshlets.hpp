@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include <DirectXMath.h>
+
+#include "frustum.hpp"
+#include "scene.hpp"
+
+namespace refl {
+// Limits recommended for mesh shaders, the vertex limit must stay within the range of the 8-bit local indices
+unsigned constexpr kMaxMeshletVertices{64};
+unsigned constexpr kMaxMeshletTriangles{124};
+
+struct Meshlet {
+  std::uint32_t vertex_offset; // Into MeshletMesh::vertex_indices
+  std::uint32_t triangle_offset; // Into MeshletMesh::local_indices, three per triangle
+  std::uint32_t vertex_count;
+  std::uint32_t triangle_count;
+};
+
+// Object space culling data of a meshlet
+struct MeshletBounds {
+  DirectX::XMFLOAT3 center;
+  float radius;
+  // The meshlet is backfacing if dot(normalize(cone_apex - camera_pos), cone_axis) >= cone_cutoff.
+  // A cutoff of 1 disables the test for meshlets whose normals spread too wide.
+  DirectX::XMFLOAT3 cone_apex;
+  DirectX::XMFLOAT3 cone_axis;
+  float cone_cutoff;
+};
+
+struct MeshletMesh {
+  std::vector<Meshlet> meshlets;
+  std::vector<MeshletBounds> bounds; // One per meshlet
+  std::vector<std::uint32_t> vertex_indices; // Into the vertex streams of the CpuMesh
+  std::vector<std::uint8_t> local_indices; // Into the meshlet's range of vertex_indices
+};
+
+// Splits the triangle list into meshlets in index order, so the vertex cache optimized order of the mesh keeps the
+// meshlets spatially coherent. max_vertices must not exceed 256.
+[[nodiscard]] auto BuildMeshlets(CpuMesh const& mesh, unsigned max_vertices = kMaxMeshletVertices,
+                                 unsigned max_triangles = kMaxMeshletTriangles) -> MeshletMesh;
+// Builds the meshlets of every mesh of the scene on thread_count threads
+[[nodiscard]] auto BuildMeshlets(CpuScene const& scene, unsigned thread_count) -> std::vector<MeshletMesh>;
+
+struct MeshletFillStats {
+  std::size_t meshlet_count;
+  std::size_t vertex_count;
+  std::size_t triangle_count;
+
+  // Average fraction of the vertex and triangle limits used by a meshlet
+  [[nodiscard]] auto GetVertexFillRate() const -> float;
+  [[nodiscard]] auto GetTriangleFillRate() const -> float;
+};
+
+[[nodiscard]] auto ComputeMeshletFillStats(std::span<MeshletMesh const> meshlet_meshes) -> MeshletFillStats;
+
+struct MeshletCullingStats {
+  std::size_t tested_count;
+  std::size_t frustum_culled_count;
+  std::size_t cone_culled_count;
+};
+
+// Tests the meshlets of an instance against the frustum and their normal cones, appends the indices of the visible
+// ones and accumulates the stats. The cone test assumes that the world matrix has no non-uniform scaling.
+auto CullMeshlets(MeshletMesh const& meshlet_mesh, CpuMeshTransform const& transform, Frustum const& frustum,
+                  DirectX::XMFLOAT3 const& camera_pos, std::vector<std::uint32_t>& visible_meshlets,
+                  MeshletCullingStats& stats) -> void;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace refl {
+[[nodiscard]] inline auto GetDefaultThreadCount() -> unsigned {
+  return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+
+// Calls func(i) for every i in [0, count) using at most thread_count threads, including the calling one.
+// Indices are handed out dynamically in chunks of chunk_size, so unevenly sized work items balance out.
+// func must be safe to call concurrently for different indices.
+template<typename Func>
+auto ParallelFor(std::size_t const count, unsigned const thread_count, Func&& func,
+                 std::size_t const chunk_size = 1) -> void {
+  auto const worker_count{std::min<std::size_t>(thread_count, (count + chunk_size - 1) / chunk_size)};
+
+  if (worker_count <= 1) {
+    for (std::size_t i{0}; i < count; i++) {
+      func(i);
+    }
+    return;
+  }
+
+  std::atomic<std::size_t> next{0};
+
+  auto const work{
+    [&] {
+      for (auto begin{next.fetch_add(chunk_size)}; begin < count; begin = next.fetch_add(chunk_size)) {
+        auto const end{std::min(begin + chunk_size, count)};
+
+        for (auto i{begin}; i < end; i++) {
+          func(i);
+        }
+      }
+    }
+  };
+
+  std::vector<std::jthread> workers;
+  workers.reserve(worker_count - 1);
+
+  for (std::size_t i{1}; i < worker_count; i++) {
+    workers.emplace_back(work);
+  }
+
+  work();
+}
+
+
+template<typename Func>
+auto ParallelFor(std::size_t const count, Func&& func) -> void {
+  ParallelFor(count, GetDefaultThreadCount(), std::forward<Func>(func));
+}
+}
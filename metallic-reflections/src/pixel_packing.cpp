@@ -0,0 +1,577 @@
+#include "pixel_packing.hpp"
+
+#include <immintrin.h>
+#include <intrin.h>
+
+import std;
+
+namespace refl {
+namespace {
+// Difference of the exponent biases of floats and of the 5 bit exponents of halves and R11G11B10 channels
+std::uint32_t constexpr kExponentRebias{(127 - 15) << 23};
+std::uint32_t constexpr kFloatInfinity{0x7F800000};
+std::uint32_t constexpr kFloatQuietBit{0x400000};
+// Float bits of 2^16, the first value whose exponent does not fit in 5 bits
+std::uint32_t constexpr kSmallFloatOverflow{(127 + 16) << 23};
+
+int constexpr kHalfMantissaBits{10};
+int constexpr kR11MantissaBits{6}; // Red and green
+int constexpr kB10MantissaBits{5}; // Blue
+
+
+// Largest finite value of an unsigned small float, as float bits
+template<int kMantissaBits>
+auto constexpr kSmallFloatMax{(127u + 15) << 23 | ((1u << kMantissaBits) - 1) << (23 - kMantissaBits)};
+
+
+// Rounds the bits of a non-negative float below 2^16 to the nearest even small float with a 5 bit exponent and
+// kMantissaBits of mantissa. Halves and the channels of R11G11B10 only differ in the width of the mantissa.
+template<int kMantissaBits>
+auto RoundToSmallFloat(std::uint32_t const abs_bits) -> std::uint32_t {
+  auto constexpr shift{23 - kMantissaBits};
+
+  if (abs_bits >= (127 - 14) << 23) {
+    // Rebias the exponent and round, adding one more if the lowest kept mantissa bit is odd
+    return (abs_bits - kExponentRebias + (1u << (shift - 1)) - 1 + (abs_bits >> shift & 1)) >> shift;
+  }
+
+  // Below the smallest normal the result is a denormal, the value in units of the smallest denormal rounded
+  auto const denormal_shift{(127 + 23 - 14 - kMantissaBits) - static_cast<int>(abs_bits >> 23)};
+
+  // Less than half of the smallest denormal, float denormals included
+  if (denormal_shift > 24) {
+    return 0;
+  }
+
+  auto const mantissa{(abs_bits & 0x7FFFFF) | 0x800000};
+  auto const rounded{mantissa >> denormal_shift};
+  auto const remainder{mantissa & ((1u << denormal_shift) - 1)};
+  auto const halfway{1u << (denormal_shift - 1)};
+  return rounded + (remainder > halfway || (remainder == halfway && (rounded & 1) != 0) ? 1 : 0);
+}
+
+
+// Float bits of an unsigned small float with a 5 bit exponent
+template<int kMantissaBits>
+auto SmallFloatToFloatBits(std::uint32_t const small) -> std::uint32_t {
+  auto constexpr shift{23 - kMantissaBits};
+  auto const exponent{small >> kMantissaBits};
+  auto const mantissa{small & ((1u << kMantissaBits) - 1)};
+
+  if (exponent == 0) {
+    auto constexpr denormal_scale{1.0f / static_cast<float>(1 << (14 + kMantissaBits))};
+    return std::bit_cast<std::uint32_t>(static_cast<float>(mantissa) * denormal_scale);
+  }
+
+  if (exponent == 31) {
+    return kFloatInfinity | (mantissa != 0 ? kFloatQuietBit : 0) | mantissa << shift;
+  }
+
+  return (small << shift) + kExponentRebias;
+}
+
+
+template<int kMantissaBits>
+auto FloatToUnsignedSmallFloat(float const value) -> std::uint32_t {
+  auto const bits{std::bit_cast<std::uint32_t>(value)};
+
+  if ((bits & 0x7FFFFFFF) > kFloatInfinity) {
+    return (1u << (kMantissaBits + 5)) - 1;
+  }
+
+  if (bits == kFloatInfinity) {
+    return 31u << kMantissaBits;
+  }
+
+  // Negative values, -0 and -INF included
+  if (bits >> 31 != 0) {
+    return 0;
+  }
+
+  return RoundToSmallFloat<kMantissaBits>(std::min(bits, kSmallFloatMax<kMantissaBits>));
+}
+
+
+auto Select(__m128i const mask, __m128i const a, __m128i const b) -> __m128i {
+  return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+
+auto Select(__m256i const mask, __m256i const a, __m256i const b) -> __m256i {
+  return _mm256_blendv_epi8(b, a, mask);
+}
+
+
+// SSE2 port of RoundToSmallFloat, lanes hold the bits of non-negative floats below 2^16
+template<int kMantissaBits>
+auto RoundToSmallFloatSse2(__m128i const abs_bits) -> __m128i {
+  auto constexpr shift{23 - kMantissaBits};
+  auto const min_normal{_mm_set1_epi32((127 - 14) << 23)};
+  // A float whose ulp is the smallest denormal, adding it lets the FPU do the denormalization and its rounding
+  auto const denormal_magic{_mm_set1_epi32((127 + 23 - 14 - kMantissaBits) << 23)};
+  auto const normal_bias{_mm_set1_epi32(static_cast<int>((1u << (shift - 1)) - 1 - kExponentRebias))};
+
+  auto const denormal{
+    _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(_mm_castsi128_ps(abs_bits), _mm_castsi128_ps(denormal_magic))),
+                  denormal_magic)
+  };
+  auto const mantissa_odd{_mm_and_si128(_mm_srli_epi32(abs_bits, shift), _mm_set1_epi32(1))};
+  auto const normal{_mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(abs_bits, normal_bias), mantissa_odd), shift)};
+  return Select(_mm_cmpgt_epi32(min_normal, abs_bits), denormal, normal);
+}
+
+
+template<int kMantissaBits>
+auto RoundToSmallFloatAvx2(__m256i const abs_bits) -> __m256i {
+  auto constexpr shift{23 - kMantissaBits};
+  auto const min_normal{_mm256_set1_epi32((127 - 14) << 23)};
+  auto const denormal_magic{_mm256_set1_epi32((127 + 23 - 14 - kMantissaBits) << 23)};
+  auto const normal_bias{_mm256_set1_epi32(static_cast<int>((1u << (shift - 1)) - 1 - kExponentRebias))};
+
+  auto const denormal{
+    _mm256_sub_epi32(
+      _mm256_castps_si256(_mm256_add_ps(_mm256_castsi256_ps(abs_bits), _mm256_castsi256_ps(denormal_magic))),
+      denormal_magic)
+  };
+  auto const mantissa_odd{_mm256_and_si256(_mm256_srli_epi32(abs_bits, shift), _mm256_set1_epi32(1))};
+  auto const normal{
+    _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(abs_bits, normal_bias), mantissa_odd), shift)
+  };
+  return Select(_mm256_cmpgt_epi32(min_normal, abs_bits), denormal, normal);
+}
+
+
+// SSE2 port of SmallFloatToFloatBits
+template<int kMantissaBits>
+auto SmallFloatToFloatSse2(__m128i const small) -> __m128 {
+  auto constexpr shift{23 - kMantissaBits};
+  auto const exponent_mask{_mm_set1_epi32(31 << kMantissaBits)};
+  auto const mantissa_mask{_mm_set1_epi32((1 << kMantissaBits) - 1)};
+  auto const denormal_scale{_mm_set1_ps(1.0f / static_cast<float>(1 << (14 + kMantissaBits)))};
+  auto const zero{_mm_setzero_si128()};
+
+  auto const exponent{_mm_and_si128(small, exponent_mask)};
+  auto const mantissa{_mm_and_si128(small, mantissa_mask)};
+
+  auto const normal{_mm_add_epi32(_mm_slli_epi32(small, shift), _mm_set1_epi32(kExponentRebias))};
+  auto const denormal{_mm_castps_si128(_mm_mul_ps(_mm_cvtepi32_ps(mantissa), denormal_scale))};
+  auto const quiet{_mm_andnot_si128(_mm_cmpeq_epi32(mantissa, zero), _mm_set1_epi32(kFloatQuietBit))};
+  auto const special{_mm_or_si128(_mm_or_si128(_mm_slli_epi32(mantissa, shift), quiet),
+                                  _mm_set1_epi32(kFloatInfinity))};
+
+  auto const finite{Select(_mm_cmpeq_epi32(exponent, zero), denormal, normal)};
+  return _mm_castsi128_ps(Select(_mm_cmpeq_epi32(exponent, exponent_mask), special, finite));
+}
+
+
+template<int kMantissaBits>
+auto SmallFloatToFloatAvx2(__m256i const small) -> __m256 {
+  auto constexpr shift{23 - kMantissaBits};
+  auto const exponent_mask{_mm256_set1_epi32(31 << kMantissaBits)};
+  auto const mantissa_mask{_mm256_set1_epi32((1 << kMantissaBits) - 1)};
+  auto const denormal_scale{_mm256_set1_ps(1.0f / static_cast<float>(1 << (14 + kMantissaBits)))};
+  auto const zero{_mm256_setzero_si256()};
+
+  auto const exponent{_mm256_and_si256(small, exponent_mask)};
+  auto const mantissa{_mm256_and_si256(small, mantissa_mask)};
+
+  auto const normal{_mm256_add_epi32(_mm256_slli_epi32(small, shift), _mm256_set1_epi32(kExponentRebias))};
+  auto const denormal{_mm256_castps_si256(_mm256_mul_ps(_mm256_cvtepi32_ps(mantissa), denormal_scale))};
+  auto const quiet{_mm256_andnot_si256(_mm256_cmpeq_epi32(mantissa, zero), _mm256_set1_epi32(kFloatQuietBit))};
+  auto const special{_mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(mantissa, shift), quiet),
+                                     _mm256_set1_epi32(kFloatInfinity))};
+
+  auto const finite{Select(_mm256_cmpeq_epi32(exponent, zero), denormal, normal)};
+  return _mm256_castsi256_ps(Select(_mm256_cmpeq_epi32(exponent, exponent_mask), special, finite));
+}
+
+
+// The result is in the low 16 bits of every lane
+auto FloatToHalfSse2(__m128 const value) -> __m128i {
+  auto const bits{_mm_castps_si128(value)};
+  auto const sign{_mm_and_si128(bits, _mm_set1_epi32(static_cast<int>(0x80000000u)))};
+  auto const abs_bits{_mm_xor_si128(bits, sign)};
+
+  auto const is_nan{_mm_cmpgt_epi32(abs_bits, _mm_set1_epi32(kFloatInfinity))};
+  auto const overflows{_mm_cmpgt_epi32(abs_bits, _mm_set1_epi32(kSmallFloatOverflow - 1))};
+  auto const nan{_mm_or_si128(_mm_and_si128(_mm_srli_epi32(abs_bits, 13), _mm_set1_epi32(0x3FF)),
+                              _mm_set1_epi32(0x7E00))};
+  auto const special{Select(is_nan, nan, _mm_set1_epi32(0x7C00))};
+
+  auto const result{Select(overflows, special, RoundToSmallFloatSse2<kHalfMantissaBits>(abs_bits))};
+  return _mm_or_si128(result, _mm_srli_epi32(sign, 16));
+}
+
+
+// Halves in the low 16 bits of every lane, the high bits must be zero
+auto HalfToFloatSse2(__m128i const halves) -> __m128 {
+  auto const sign{_mm_slli_epi32(_mm_and_si128(halves, _mm_set1_epi32(0x8000)), 16)};
+  auto const abs_halves{_mm_and_si128(halves, _mm_set1_epi32(0x7FFF))};
+  return _mm_or_ps(SmallFloatToFloatSse2<kHalfMantissaBits>(abs_halves), _mm_castsi128_ps(sign));
+}
+
+
+// Packs the low halves of the lanes of two vectors, sign extending first so the saturation leaves them untouched
+auto PackHalves(__m128i const lo, __m128i const hi) -> __m128i {
+  return _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(lo, 16), 16), _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16));
+}
+
+
+template<int kMantissaBits>
+auto FloatToUnsignedSmallFloatSse2(__m128 const value) -> __m128i {
+  auto const max{_mm_castsi128_ps(_mm_set1_epi32(kSmallFloatMax<kMantissaBits>))};
+  auto const is_nan{_mm_castps_si128(_mm_cmpunord_ps(value, value))};
+  auto const is_infinity{_mm_cmpeq_epi32(_mm_castps_si128(value), _mm_set1_epi32(kFloatInfinity))};
+
+  // max returns its second operand for NaN and for zeros of either sign, so both become +0
+  auto const clamped{_mm_min_ps(_mm_max_ps(value, _mm_setzero_ps()), max)};
+  auto const result{RoundToSmallFloatSse2<kMantissaBits>(_mm_castps_si128(clamped))};
+  return Select(is_nan, _mm_set1_epi32((1 << (kMantissaBits + 5)) - 1),
+                Select(is_infinity, _mm_set1_epi32(31 << kMantissaBits), result));
+}
+
+
+template<int kMantissaBits>
+auto FloatToUnsignedSmallFloatAvx2(__m256 const value) -> __m256i {
+  auto const max{_mm256_castsi256_ps(_mm256_set1_epi32(kSmallFloatMax<kMantissaBits>))};
+  auto const is_nan{_mm256_castps_si256(_mm256_cmp_ps(value, value, _CMP_UNORD_Q))};
+  auto const is_infinity{_mm256_cmpeq_epi32(_mm256_castps_si256(value), _mm256_set1_epi32(kFloatInfinity))};
+
+  auto const clamped{_mm256_min_ps(_mm256_max_ps(value, _mm256_setzero_ps()), max)};
+  auto const result{RoundToSmallFloatAvx2<kMantissaBits>(_mm256_castps_si256(clamped))};
+  return Select(is_nan, _mm256_set1_epi32((1 << (kMantissaBits + 5)) - 1),
+                Select(is_infinity, _mm256_set1_epi32(31 << kMantissaBits), result));
+}
+
+
+auto ConvertFloatsToHalvesScalar(std::span<float const> const values, std::span<std::uint16_t> const halves) -> void {
+  std::ranges::transform(values, halves.begin(), &FloatToHalf);
+}
+
+
+auto ConvertFloatsToHalvesSse2(std::span<float const> const values, std::span<std::uint16_t> const halves) -> void {
+  std::size_t i{0};
+
+  for (; i + 8 <= values.size(); i += 8) {
+    auto const lo{FloatToHalfSse2(_mm_loadu_ps(&values[i]))};
+    auto const hi{FloatToHalfSse2(_mm_loadu_ps(&values[i + 4]))};
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&halves[i]), PackHalves(lo, hi));
+  }
+
+  ConvertFloatsToHalvesScalar(values.subspan(i), halves.subspan(i));
+}
+
+
+auto ConvertFloatsToHalvesAvx2(std::span<float const> const values, std::span<std::uint16_t> const halves) -> void {
+  std::size_t i{0};
+
+  for (; i + 8 <= values.size(); i += 8) {
+    auto const converted{_mm256_cvtps_ph(_mm256_loadu_ps(&values[i]), _MM_FROUND_TO_NEAREST_INT)};
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&halves[i]), converted);
+  }
+
+  ConvertFloatsToHalvesScalar(values.subspan(i), halves.subspan(i));
+}
+
+
+auto ConvertHalvesToFloatsScalar(std::span<std::uint16_t const> const halves, std::span<float> const values) -> void {
+  std::ranges::transform(halves, values.begin(), &HalfToFloat);
+}
+
+
+auto ConvertHalvesToFloatsSse2(std::span<std::uint16_t const> const halves, std::span<float> const values) -> void {
+  auto const zero{_mm_setzero_si128()};
+  std::size_t i{0};
+
+  for (; i + 8 <= halves.size(); i += 8) {
+    auto const packed{_mm_loadu_si128(reinterpret_cast<__m128i const*>(&halves[i]))};
+    _mm_storeu_ps(&values[i], HalfToFloatSse2(_mm_unpacklo_epi16(packed, zero)));
+    _mm_storeu_ps(&values[i + 4], HalfToFloatSse2(_mm_unpackhi_epi16(packed, zero)));
+  }
+
+  ConvertHalvesToFloatsScalar(halves.subspan(i), values.subspan(i));
+}
+
+
+auto ConvertHalvesToFloatsAvx2(std::span<std::uint16_t const> const halves, std::span<float> const values) -> void {
+  std::size_t i{0};
+
+  for (; i + 8 <= halves.size(); i += 8) {
+    _mm256_storeu_ps(&values[i], _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<__m128i const*>(&halves[i]))));
+  }
+
+  ConvertHalvesToFloatsScalar(halves.subspan(i), values.subspan(i));
+}
+
+
+auto PackR11G11B10Scalar(std::span<Vector4 const> const values, std::span<PackedR11G11B10> const packed) -> void {
+  std::ranges::transform(values, packed.begin(), [](Vector4 const& value) { return PackR11G11B10(value); });
+}
+
+
+auto PackR11G11B10Sse2(std::span<Vector4 const> const values, std::span<PackedR11G11B10> const packed) -> void {
+  std::size_t i{0};
+
+  for (; i + 4 <= values.size(); i += 4) {
+    auto r{_mm_loadu_ps(values[i].data())};
+    auto g{_mm_loadu_ps(values[i + 1].data())};
+    auto b{_mm_loadu_ps(values[i + 2].data())};
+    auto a{_mm_loadu_ps(values[i + 3].data())};
+    _MM_TRANSPOSE4_PS(r, g, b, a);
+
+    auto const red{FloatToUnsignedSmallFloatSse2<kR11MantissaBits>(r)};
+    auto const green{FloatToUnsignedSmallFloatSse2<kR11MantissaBits>(g)};
+    auto const blue{FloatToUnsignedSmallFloatSse2<kB10MantissaBits>(b)};
+    auto const result{_mm_or_si128(_mm_or_si128(red, _mm_slli_epi32(green, 11)), _mm_slli_epi32(blue, 22))};
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&packed[i]), result);
+  }
+
+  PackR11G11B10Scalar(values.subspan(i), packed.subspan(i));
+}
+
+
+// Loads texels i to i + 3 into the low and i + 4 to i + 7 into the high lanes
+auto LoadTexelPair(std::span<Vector4 const> const values, std::size_t const i) -> __m256 {
+  return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(values[i].data())),
+                              _mm_loadu_ps(values[i + 4].data()), 1);
+}
+
+
+auto PackR11G11B10Avx2(std::span<Vector4 const> const values, std::span<PackedR11G11B10> const packed) -> void {
+  std::size_t i{0};
+
+  for (; i + 8 <= values.size(); i += 8) {
+    auto const t0{LoadTexelPair(values, i)};
+    auto const t1{LoadTexelPair(values, i + 1)};
+    auto const t2{LoadTexelPair(values, i + 2)};
+    auto const t3{LoadTexelPair(values, i + 3)};
+
+    // The 4x4 transpose of _MM_TRANSPOSE4_PS in both lanes gives the channels of the 8 texels in order
+    auto const rg01{_mm256_unpacklo_ps(t0, t1)};
+    auto const rg23{_mm256_unpacklo_ps(t2, t3)};
+    auto const ba01{_mm256_unpackhi_ps(t0, t1)};
+    auto const ba23{_mm256_unpackhi_ps(t2, t3)};
+    auto const r{_mm256_shuffle_ps(rg01, rg23, _MM_SHUFFLE(1, 0, 1, 0))};
+    auto const g{_mm256_shuffle_ps(rg01, rg23, _MM_SHUFFLE(3, 2, 3, 2))};
+    auto const b{_mm256_shuffle_ps(ba01, ba23, _MM_SHUFFLE(1, 0, 1, 0))};
+
+    auto const red{FloatToUnsignedSmallFloatAvx2<kR11MantissaBits>(r)};
+    auto const green{FloatToUnsignedSmallFloatAvx2<kR11MantissaBits>(g)};
+    auto const blue{FloatToUnsignedSmallFloatAvx2<kB10MantissaBits>(b)};
+    auto const result{
+      _mm256_or_si256(_mm256_or_si256(red, _mm256_slli_epi32(green, 11)), _mm256_slli_epi32(blue, 22))
+    };
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(&packed[i]), result);
+  }
+
+  PackR11G11B10Scalar(values.subspan(i), packed.subspan(i));
+}
+
+
+auto UnpackR11G11B10Scalar(std::span<PackedR11G11B10 const> const packed, std::span<Vector4> const values) -> void {
+  std::ranges::transform(packed, values.begin(), [](PackedR11G11B10 const p) { return UnpackR11G11B10(p); });
+}
+
+
+auto UnpackR11G11B10Sse2(std::span<PackedR11G11B10 const> const packed, std::span<Vector4> const values) -> void {
+  auto const r11_mask{_mm_set1_epi32(0x7FF)};
+  std::size_t i{0};
+
+  for (; i + 4 <= packed.size(); i += 4) {
+    auto const p{_mm_loadu_si128(reinterpret_cast<__m128i const*>(&packed[i]))};
+    auto r{SmallFloatToFloatSse2<kR11MantissaBits>(_mm_and_si128(p, r11_mask))};
+    auto g{SmallFloatToFloatSse2<kR11MantissaBits>(_mm_and_si128(_mm_srli_epi32(p, 11), r11_mask))};
+    auto b{SmallFloatToFloatSse2<kB10MantissaBits>(_mm_srli_epi32(p, 22))};
+    auto a{_mm_set1_ps(1)};
+    _MM_TRANSPOSE4_PS(r, g, b, a);
+
+    _mm_storeu_ps(values[i].data(), r);
+    _mm_storeu_ps(values[i + 1].data(), g);
+    _mm_storeu_ps(values[i + 2].data(), b);
+    _mm_storeu_ps(values[i + 3].data(), a);
+  }
+
+  UnpackR11G11B10Scalar(packed.subspan(i), values.subspan(i));
+}
+
+
+auto UnpackR11G11B10Avx2(std::span<PackedR11G11B10 const> const packed, std::span<Vector4> const values) -> void {
+  auto const r11_mask{_mm256_set1_epi32(0x7FF)};
+  auto const a{_mm256_set1_ps(1)};
+  std::size_t i{0};
+
+  for (; i + 8 <= packed.size(); i += 8) {
+    auto const p{_mm256_loadu_si256(reinterpret_cast<__m256i const*>(&packed[i]))};
+    auto const r{SmallFloatToFloatAvx2<kR11MantissaBits>(_mm256_and_si256(p, r11_mask))};
+    auto const g{SmallFloatToFloatAvx2<kR11MantissaBits>(_mm256_and_si256(_mm256_srli_epi32(p, 11), r11_mask))};
+    auto const b{SmallFloatToFloatAvx2<kB10MantissaBits>(_mm256_srli_epi32(p, 22))};
+
+    // Transposes back in both lanes, texel j ends up in the low lane of row j and texel j + 4 in the high one
+    auto const rg01{_mm256_unpacklo_ps(r, g)};
+    auto const ba01{_mm256_unpacklo_ps(b, a)};
+    auto const rg23{_mm256_unpackhi_ps(r, g)};
+    auto const ba23{_mm256_unpackhi_ps(b, a)};
+    std::array const rows{
+      _mm256_shuffle_ps(rg01, ba01, _MM_SHUFFLE(1, 0, 1, 0)), _mm256_shuffle_ps(rg01, ba01, _MM_SHUFFLE(3, 2, 3, 2)),
+      _mm256_shuffle_ps(rg23, ba23, _MM_SHUFFLE(1, 0, 1, 0)), _mm256_shuffle_ps(rg23, ba23, _MM_SHUFFLE(3, 2, 3, 2))
+    };
+
+    for (std::size_t j{0}; j < 4; j++) {
+      _mm_storeu_ps(values[i + j].data(), _mm256_castps256_ps128(rows[j]));
+      _mm_storeu_ps(values[i + j + 4].data(), _mm256_extractf128_ps(rows[j], 1));
+    }
+  }
+
+  UnpackR11G11B10Scalar(packed.subspan(i), values.subspan(i));
+}
+
+
+auto DetectSimdLevel() -> SimdLevel {
+  std::array<int, 4> info;
+  __cpuid(info.data(), 0);
+  auto const max_leaf{info[0]};
+
+  __cpuid(info.data(), 1);
+  auto const f16c{(info[2] & 1 << 29) != 0};
+  auto const avx{(info[2] & 1 << 28) != 0};
+  // The OS must save the upper halves of the YMM registers too
+  auto const ymm_enabled{(info[2] & 1 << 27) != 0 && (_xgetbv(0) & 6) == 6};
+
+  auto avx2{false};
+
+  if (max_leaf >= 7) {
+    __cpuidex(info.data(), 7, 0);
+    avx2 = (info[1] & 1 << 5) != 0;
+  }
+
+  // SSE2 is part of x64
+  return f16c && avx && ymm_enabled && avx2 ? SimdLevel::kAvx2 : SimdLevel::kSse2;
+}
+}
+
+
+auto GetSimdLevel() -> SimdLevel {
+  static auto const level{DetectSimdLevel()};
+  return level;
+}
+
+
+auto GetSimdLevelName(SimdLevel const level) -> std::string_view {
+  switch (level) {
+    case SimdLevel::kScalar:
+      return "scalar";
+    case SimdLevel::kSse2:
+      return "sse2";
+    case SimdLevel::kAvx2:
+      return "avx2";
+  }
+
+  return "unknown";
+}
+
+
+auto FloatToHalf(float const value) -> std::uint16_t {
+  auto const bits{std::bit_cast<std::uint32_t>(value)};
+  auto const sign{bits >> 16 & 0x8000};
+  auto const abs_bits{bits & 0x7FFFFFFF};
+
+  if (abs_bits > kFloatInfinity) {
+    return static_cast<std::uint16_t>(sign | 0x7E00 | (abs_bits >> 13 & 0x3FF));
+  }
+
+  // Values from 65520 up round to infinity on their own, the exponent of 2^16 and above does not fit
+  if (abs_bits >= kSmallFloatOverflow) {
+    return static_cast<std::uint16_t>(sign | 0x7C00);
+  }
+
+  return static_cast<std::uint16_t>(sign | RoundToSmallFloat<kHalfMantissaBits>(abs_bits));
+}
+
+
+auto HalfToFloat(std::uint16_t const half) -> float {
+  auto const sign{static_cast<std::uint32_t>(half & 0x8000) << 16};
+  return std::bit_cast<float>(sign | SmallFloatToFloatBits<kHalfMantissaBits>(half & 0x7FFFu));
+}
+
+
+auto PackR11G11B10(Vector4 const& value) -> PackedR11G11B10 {
+  return FloatToUnsignedSmallFloat<kR11MantissaBits>(value[0]) |
+         FloatToUnsignedSmallFloat<kR11MantissaBits>(value[1]) << 11 |
+         FloatToUnsignedSmallFloat<kB10MantissaBits>(value[2]) << 22;
+}
+
+
+auto UnpackR11G11B10(PackedR11G11B10 const packed) -> Vector4 {
+  return {
+    std::bit_cast<float>(SmallFloatToFloatBits<kR11MantissaBits>(packed & 0x7FF)),
+    std::bit_cast<float>(SmallFloatToFloatBits<kR11MantissaBits>(packed >> 11 & 0x7FF)),
+    std::bit_cast<float>(SmallFloatToFloatBits<kB10MantissaBits>(packed >> 22)), 1
+  };
+}
+
+
+auto ConvertFloatsToHalves(std::span<float const> const values, std::span<std::uint16_t> const halves,
+                           SimdLevel const level) -> void {
+  switch (level) {
+    case SimdLevel::kScalar:
+      return ConvertFloatsToHalvesScalar(values, halves);
+    case SimdLevel::kSse2:
+      return ConvertFloatsToHalvesSse2(values, halves);
+    case SimdLevel::kAvx2:
+      return ConvertFloatsToHalvesAvx2(values, halves);
+  }
+}
+
+
+auto ConvertHalvesToFloats(std::span<std::uint16_t const> const halves, std::span<float> const values,
+                           SimdLevel const level) -> void {
+  switch (level) {
+    case SimdLevel::kScalar:
+      return ConvertHalvesToFloatsScalar(halves, values);
+    case SimdLevel::kSse2:
+      return ConvertHalvesToFloatsSse2(halves, values);
+    case SimdLevel::kAvx2:
+      return ConvertHalvesToFloatsAvx2(halves, values);
+  }
+}
+
+
+auto ConvertFloatsToHalves(std::span<Vector4 const> const values, std::span<HalfVector4> const halves,
+                           SimdLevel const level) -> void {
+  ConvertFloatsToHalves(std::span{reinterpret_cast<float const*>(values.data()), 4 * values.size()},
+                        std::span{reinterpret_cast<std::uint16_t*>(halves.data()), 4 * halves.size()}, level);
+}
+
+
+auto ConvertHalvesToFloats(std::span<HalfVector4 const> const halves, std::span<Vector4> const values,
+                           SimdLevel const level) -> void {
+  ConvertHalvesToFloats(std::span{reinterpret_cast<std::uint16_t const*>(halves.data()), 4 * halves.size()},
+                        std::span{reinterpret_cast<float*>(values.data()), 4 * values.size()}, level);
+}
+
+
+auto PackR11G11B10(std::span<Vector4 const> const values, std::span<PackedR11G11B10> const packed,
+                   SimdLevel const level) -> void {
+  switch (level) {
+    case SimdLevel::kScalar:
+      return PackR11G11B10Scalar(values, packed);
+    case SimdLevel::kSse2:
+      return PackR11G11B10Sse2(values, packed);
+    case SimdLevel::kAvx2:
+      return PackR11G11B10Avx2(values, packed);
+  }
+}
+
+
+auto UnpackR11G11B10(std::span<PackedR11G11B10 const> const packed, std::span<Vector4> const values,
+                     SimdLevel const level) -> void {
+  switch (level) {
+    case SimdLevel::kScalar:
+      return UnpackR11G11B10Scalar(packed, values);
+    case SimdLevel::kSse2:
+      return UnpackR11G11B10Sse2(packed, values);
+    case SimdLevel::kAvx2:
+      return UnpackR11G11B10Avx2(packed, values);
+  }
+}
+}
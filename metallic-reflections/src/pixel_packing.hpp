@@ -0,0 +1,49 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+#include "scene.hpp"
+
+namespace refl {
+using HalfVector4 = std::array<std::uint16_t, 4>; // R16G16B16A16_FLOAT
+using PackedR11G11B10 = std::uint32_t; // R11G11B10_FLOAT, red in the low bits
+
+// Instruction sets the bulk conversions can run on. Every level gives bit for bit the same results.
+enum class SimdLevel : std::uint32_t {
+  kScalar,
+  kSse2,
+  kAvx2 // AVX2 and F16C
+};
+
+// Best level the CPU and the OS support
+[[nodiscard]] auto GetSimdLevel() -> SimdLevel;
+[[nodiscard]] auto GetSimdLevelName(SimdLevel level) -> std::string_view;
+
+// Round to nearest even, values beyond the half range become infinity. NaNs stay NaNs of the same sign, quieted and
+// with the top of their payload kept, exactly like F16C.
+[[nodiscard]] auto FloatToHalf(float value) -> std::uint16_t;
+[[nodiscard]] auto HalfToFloat(std::uint16_t half) -> float;
+
+// Round to nearest even. R11G11B10 has no sign bit, so negative values become 0 and finite values beyond the range
+// saturate to the largest finite value instead of becoming infinity. +INF stays infinity, NaNs become the all ones
+// NaN of the channel. Alpha is ignored when packing and unpacked as 1.
+[[nodiscard]] auto PackR11G11B10(Vector4 const& value) -> PackedR11G11B10;
+[[nodiscard]] auto UnpackR11G11B10(PackedR11G11B10 packed) -> Vector4;
+
+// Bulk versions of the conversions above. The source and destination spans must have the same size.
+auto ConvertFloatsToHalves(std::span<float const> values, std::span<std::uint16_t> halves,
+                           SimdLevel level = GetSimdLevel()) -> void;
+auto ConvertHalvesToFloats(std::span<std::uint16_t const> halves, std::span<float> values,
+                           SimdLevel level = GetSimdLevel()) -> void;
+auto ConvertFloatsToHalves(std::span<Vector4 const> values, std::span<HalfVector4> halves,
+                           SimdLevel level = GetSimdLevel()) -> void;
+auto ConvertHalvesToFloats(std::span<HalfVector4 const> halves, std::span<Vector4> values,
+                           SimdLevel level = GetSimdLevel()) -> void;
+auto PackR11G11B10(std::span<Vector4 const> values, std::span<PackedR11G11B10> packed,
+                   SimdLevel level = GetSimdLevel()) -> void;
+auto UnpackR11G11B10(std::span<PackedR11G11B10 const> packed, std::span<Vector4> values,
+                     SimdLevel level = GetSimdLevel()) -> void;
+}
@@ -1,50 +1,104 @@
 #include "scene.hpp"
 
+#include <assimp/DefaultIOSystem.h>
 #include <assimp/Importer.hpp>
 #include <assimp/postprocess.h>
 #include <assimp/scene.h>
 
+#include "cache.hpp"
+#include "mesh_lod.hpp"
+#include "mesh_optimization.hpp"
+#include "parallel.hpp"
+#include "scene_cache.hpp"
+
 import std;
 
 namespace refl {
-auto LoadCpuScene(std::filesystem::path const& scene_file_path) -> std::optional<CpuScene> {
-  namespace dx = DirectX;
-
-  Assimp::Importer importer;
-
+namespace {
+// Everything that influences the imported data. Part of the scene cache key, so changing any of these invalidates
+// previously baked scenes.
+struct SceneImportSettings {
+  unsigned post_process_flags;
+  int removed_components;
+  int removed_primitive_types;
+  float max_smoothing_angle;
+  // Bump when the output of OptimizeMesh changes
+  unsigned mesh_optimization_version;
+  // Bump when the output of GenerateLods changes
+  unsigned lod_generation_version;
+};
+
+
+SceneImportSettings constexpr kImportSettings{
+  // Triangle order is optimized by OptimizeScene instead of aiProcess_ImproveCacheLocality
+  .post_process_flags = (aiProcessPreset_TargetRealtime_MaxQuality & ~aiProcess_ImproveCacheLocality) |
+                        aiProcess_ConvertToLeftHanded | aiProcess_TransformUVCoords | aiProcess_RemoveComponent,
   // We don't need these scene objects
-  importer.SetPropertyInteger(AI_CONFIG_PP_RVC_FLAGS, aiComponent_CAMERAS | aiComponent_LIGHTS | aiComponent_COLORS);
+  .removed_components = aiComponent_CAMERAS | aiComponent_LIGHTS | aiComponent_COLORS,
   // We don't want to bother with non-triangle primitives
-  importer.SetPropertyInteger(AI_CONFIG_PP_SBP_REMOVE, aiPrimitiveType_POINT | aiPrimitiveType_LINE);
+  .removed_primitive_types = aiPrimitiveType_POINT | aiPrimitiveType_LINE,
   // Smoothing angle for smooth normal generation
-  importer.SetPropertyFloat(AI_CONFIG_PP_GSN_MAX_SMOOTHING_ANGLE, 80.0f);
+  .max_smoothing_angle = 80.0f,
+  .mesh_optimization_version = 1,
+  .lod_generation_version = 1
+};
 
-  auto const ai_scene{
-    importer.ReadFile(reinterpret_cast<char const*>(scene_file_path.u8string().data()),
-                      aiProcessPreset_TargetRealtime_MaxQuality | aiProcess_ConvertToLeftHanded |
-                      aiProcess_TransformUVCoords |
-                      aiProcess_RemoveComponent)
-  };
 
-  if (!ai_scene || ai_scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !ai_scene->mRootNode) {
-    std::cerr << "Error loading scene: " << importer.GetErrorString() << "\n";
-    return std::nullopt;
+// Records the files the importer opens, so that the scene cache can key on the external buffers and material
+// libraries of a scene besides its main file
+class RecordingIoSystem final : public Assimp::DefaultIOSystem {
+public:
+  explicit RecordingIoSystem(std::vector<std::filesystem::path>& opened_files) :
+    opened_files_{opened_files} {}
+
+  using DefaultIOSystem::Open;
+
+  auto Open(char const* const file, char const* const mode) -> Assimp::IOStream* override {
+    auto const stream{DefaultIOSystem::Open(file, mode)};
+
+    if (stream) {
+      auto path{
+        std::filesystem::absolute(std::filesystem::path{reinterpret_cast<char8_t const*>(file)}).lexically_normal()
+      };
+
+      if (std::ranges::find(opened_files_, path) == opened_files_.end()) {
+        opened_files_.push_back(std::move(path));
+      }
+    }
+
+    return stream;
   }
 
+private:
+  std::vector<std::filesystem::path>& opened_files_;
+};
+
+
+// Serial part of the conversion: walks the node hierarchy breadth first and records every mesh reference with its
+// accumulated world matrix. The order of the entries is the order of CpuScene::instances.
+struct FlattenedMesh {
+  unsigned ai_mesh_idx;
+  DirectX::XMFLOAT4X4 world_mtx;
+};
+
+
+auto FlattenNodeHierarchy(aiScene const& ai_scene) -> std::vector<FlattenedMesh> {
+  namespace dx = DirectX;
+
   struct NodeTransformData {
     aiNode const* node;
     dx::XMFLOAT4X4 parent_world_mtx;
   };
 
   std::queue<NodeTransformData> node_queue;
-  node_queue.emplace(ai_scene->mRootNode, dx::XMFLOAT4X4{
+  node_queue.emplace(ai_scene.mRootNode, dx::XMFLOAT4X4{
                        1.0F, 0.0F, 0.0F, 0.0F,
                        0.0F, 1.0F, 0.0F, 0.0F,
                        0.0F, 0.0F, 1.0F, 0.0F,
                        0.0F, 0.0F, 0.0F, 1.0F
                      });
 
-  CpuScene scene;
+  std::vector<FlattenedMesh> flattened;
 
   while (!node_queue.empty()) {
     auto const [node, parent_world_mtx]{node_queue.front()};
@@ -62,240 +116,312 @@ auto LoadCpuScene(std::filesystem::path const& scene_file_path) -> std::optional
       &world_mtx, dx::XMMatrixMultiply(dx::XMLoadFloat4x4(&local_mtx), dx::XMLoadFloat4x4(&parent_world_mtx)));
 
     for (unsigned int i = 0; i < node->mNumMeshes; ++i) {
-      auto const ai_mesh{ai_scene->mMeshes[node->mMeshes[i]]};
-      auto& mesh{scene.meshes.emplace_back()};
-
-      mesh.positions.resize(ai_mesh->mNumVertices);
-      mesh.normals.resize(ai_mesh->mNumVertices);
-      mesh.texcoords.resize(ai_mesh->mNumVertices);
-      mesh.tangents.resize(ai_mesh->mNumVertices);
-      mesh.indices.reserve(ai_mesh->mNumFaces * 3);
-
-      std::ranges::transform(ai_mesh->mVertices, ai_mesh->mVertices + ai_mesh->mNumVertices, mesh.positions.begin(),
-                             [](auto const& ai_vec) {
-                               return Vector4{ai_vec.x, ai_vec.y, ai_vec.z, 1};
-                             });
-
-      std::ranges::transform(ai_mesh->mNormals, ai_mesh->mNormals + ai_mesh->mNumVertices, mesh.normals.begin(),
-                             [](auto const& ai_vec) {
-                               return Vector4{ai_vec.x, ai_vec.y, ai_vec.z, 0};
-                             });
-
-      if (ai_mesh->HasTextureCoords(0)) {
-        std::ranges::transform(ai_mesh->mTextureCoords[0],
-                               ai_mesh->mTextureCoords[0] + ai_mesh->mNumVertices, mesh.texcoords.begin(),
-                               [](auto const& ai_vec) {
-                                 return Vector2{ai_vec.x, ai_vec.y};
-                               });
-      }
+      flattened.emplace_back(node->mMeshes[i], world_mtx);
+    }
 
-      if (ai_mesh->HasTangentsAndBitangents()) {
-        std::ranges::transform(ai_mesh->mTangents, ai_mesh->mTangents + ai_mesh->mNumVertices, mesh.tangents.begin(),
-                               [](auto const& ai_vec) {
-                                 return Vector4{ai_vec.x, ai_vec.y, ai_vec.z, 0};
-                               });
-      }
+    for (unsigned int j = 0; j < node->mNumChildren; ++j) {
+      node_queue.emplace(node->mChildren[j], world_mtx);
+    }
+  }
 
-      for (unsigned int j = 0; j < ai_mesh->mNumFaces; ++j) {
-        auto const& face{ai_mesh->mFaces[j]};
-        mesh.indices.insert(mesh.indices.end(), face.mIndices, face.mIndices + face.mNumIndices);
-      }
+  return flattened;
+}
 
-      mesh.transform.world_mtx = world_mtx;
-      dx::XMStoreFloat4x4(&mesh.transform.normal_mtx,
-                          dx::XMMatrixTranspose(dx::XMMatrixInverse(nullptr, dx::XMLoadFloat4x4(&world_mtx))));
 
-      auto const ai_mtl{ai_scene->mMaterials[ai_mesh->mMaterialIndex]};
+// Parallel part of the conversion: copies the vertex streams and indices of a single unique mesh.
+auto ConvertMesh(aiMesh const* const ai_mesh, CpuMesh& mesh) -> void {
+  mesh.positions.resize(ai_mesh->mNumVertices);
+  mesh.normals.resize(ai_mesh->mNumVertices);
+  mesh.indices.reserve(ai_mesh->mNumFaces * 3);
+
+  std::ranges::transform(ai_mesh->mVertices, ai_mesh->mVertices + ai_mesh->mNumVertices, mesh.positions.begin(),
+                         [](auto const& ai_vec) {
+                           return Vector4{ai_vec.x, ai_vec.y, ai_vec.z, 1};
+                         });
+
+  std::ranges::transform(ai_mesh->mNormals, ai_mesh->mNormals + ai_mesh->mNumVertices, mesh.normals.begin(),
+                         [](auto const& ai_vec) {
+                           return Vector4{ai_vec.x, ai_vec.y, ai_vec.z, 0};
+                         });
+
+  if (ai_mesh->HasTextureCoords(0)) {
+    mesh.texcoords.resize(ai_mesh->mNumVertices);
+    std::ranges::transform(ai_mesh->mTextureCoords[0],
+                           ai_mesh->mTextureCoords[0] + ai_mesh->mNumVertices, mesh.texcoords.begin(),
+                           [](auto const& ai_vec) {
+                             return Vector2{ai_vec.x, ai_vec.y};
+                           });
+  }
 
-      if (aiColor3D base_color; ai_mtl->Get(AI_MATKEY_BASE_COLOR, base_color) == aiReturn_SUCCESS) {
-        mesh.mtl.base_color = dx::XMFLOAT3{base_color.r, base_color.g, base_color.b};
-      }
+  if (ai_mesh->HasTangentsAndBitangents()) {
+    mesh.tangents.resize(ai_mesh->mNumVertices);
 
-      if (float roughness; ai_mtl->Get(AI_MATKEY_ROUGHNESS_FACTOR, roughness) == aiReturn_SUCCESS) {
-        mesh.mtl.roughness = roughness;
-      }
+    for (unsigned int j = 0; j < ai_mesh->mNumVertices; ++j) {
+      auto const& n{ai_mesh->mNormals[j]};
+      auto const& t{ai_mesh->mTangents[j]};
+      auto const& b{ai_mesh->mBitangents[j]};
+      // Handedness is the sign that makes cross(N, T) point along the imported bitangent
+      auto const handedness{
+        (n.y * t.z - n.z * t.y) * b.x + (n.z * t.x - n.x * t.z) * b.y + (n.x * t.y - n.y * t.x) * b.z < 0 ? -1.0f : 1.0f
+      };
+      mesh.tangents[j] = Vector4{t.x, t.y, t.z, handedness};
     }
+  }
 
-    for (unsigned int j = 0; j < node->mNumChildren; ++j) {
-      node_queue.emplace(node->mChildren[j], world_mtx);
+  for (unsigned int j = 0; j < ai_mesh->mNumFaces; ++j) {
+    auto const& face{ai_mesh->mFaces[j]};
+    mesh.indices.insert(mesh.indices.end(), face.mIndices, face.mIndices + face.mNumIndices);
+  }
+}
+
+
+auto GetTexturePath(aiMaterial const* const ai_mtl, aiTextureType const type) -> std::optional<std::filesystem::path> {
+  aiString ai_path;
+
+  if (ai_mtl->GetTexture(type, 0, &ai_path) != aiReturn_SUCCESS || ai_path.length == 0) {
+    return std::nullopt;
+  }
+
+  // Embedded textures are referenced as "*<index>" and would have to be decoded from the aiScene
+  if (ai_path.data[0] == '*') {
+    std::cerr << std::format("Ignoring embedded texture {}.\n", ai_path.C_Str());
+    return std::nullopt;
+  }
+
+  return std::filesystem::path{
+    std::u8string_view{reinterpret_cast<char8_t const*>(ai_path.data), ai_path.length}
+  }.lexically_normal();
+}
+
+
+// Materials sharing an image file with the same usage reference the same texture
+auto AddTexture(std::vector<CpuTexture>& textures, std::filesystem::path path,
+                TextureUsage const usage) -> std::uint32_t {
+  CpuTexture texture{.path = std::move(path), .usage = usage};
+
+  if (auto const it{std::ranges::find(textures, texture)}; it != textures.end()) {
+    return static_cast<std::uint32_t>(it - textures.begin());
+  }
+
+  textures.push_back(std::move(texture));
+  return static_cast<std::uint32_t>(textures.size() - 1);
+}
+
+
+auto ConvertMaterial(aiMaterial const* const ai_mtl, std::vector<CpuTexture>& textures) -> CpuMaterial {
+  CpuMaterial mtl{
+    .base_color = {},
+    .roughness = 0,
+    .base_color_map_idx = kNoTexture,
+    .roughness_map_idx = kNoTexture,
+    .normal_map_idx = kNoTexture
+  };
+
+  if (aiColor3D base_color; ai_mtl->Get(AI_MATKEY_BASE_COLOR, base_color) == aiReturn_SUCCESS) {
+    mtl.base_color = DirectX::XMFLOAT3{base_color.r, base_color.g, base_color.b};
+  }
+
+  if (float roughness; ai_mtl->Get(AI_MATKEY_ROUGHNESS_FACTOR, roughness) == aiReturn_SUCCESS) {
+    mtl.roughness = roughness;
+  }
+
+  if (auto path{GetTexturePath(ai_mtl, aiTextureType_BASE_COLOR)}) {
+    mtl.base_color_map_idx = AddTexture(textures, std::move(*path), TextureUsage::BaseColor);
+  } else if (auto diffuse_path{GetTexturePath(ai_mtl, aiTextureType_DIFFUSE)}) {
+    mtl.base_color_map_idx = AddTexture(textures, std::move(*diffuse_path), TextureUsage::BaseColor);
+  }
+
+  if (auto path{GetTexturePath(ai_mtl, aiTextureType_DIFFUSE_ROUGHNESS)}) {
+    // The glTF importer reports the packed metallic-roughness texture as both the roughness and the metalness map
+    auto const usage{
+      path == GetTexturePath(ai_mtl, aiTextureType_METALNESS) ? TextureUsage::PackedRoughness : TextureUsage::Roughness
+    };
+    mtl.roughness_map_idx = AddTexture(textures, std::move(*path), usage);
+  }
+
+  if (auto path{GetTexturePath(ai_mtl, aiTextureType_NORMALS)}) {
+    mtl.normal_map_idx = AddTexture(textures, std::move(*path), TextureUsage::Normal);
+  }
+
+  return mtl;
+}
+
+
+// Appends the files the import read other than the scene file to dependencies
+auto ImportCpuScene(std::filesystem::path const& scene_file_path,
+                    std::vector<std::filesystem::path>& dependencies) -> std::optional<CpuScene> {
+  Assimp::Importer importer;
+
+  std::vector<std::filesystem::path> opened_files;
+  importer.SetIOHandler(new RecordingIoSystem{opened_files}); // Owned by the importer
+
+  auto const ai_scene{ReadAssimpScene(importer, scene_file_path)};
+
+  if (!ai_scene) {
+    return std::nullopt;
+  }
+
+  std::error_code ec;
+
+  for (auto& path : opened_files) {
+    if (!std::filesystem::equivalent(path, scene_file_path, ec)) {
+      dependencies.push_back(std::move(path));
     }
   }
 
+  auto scene{ConvertAssimpScene(*ai_scene, GetDefaultThreadCount())};
+  OptimizeScene(scene, GetDefaultThreadCount());
+  // After OptimizeVertexFetch, which reorders the vertices the LODs index into
+  GenerateSceneLods(scene, GetDefaultThreadCount());
   return scene;
 }
+}
 
-auto CreateGpuScene(CpuScene const& cpu_scene, ID3D11Device& dev) -> std::optional<GpuScene> {
-  GpuScene gpu_scene;
 
-  for (auto const& cpu_mesh : cpu_scene.meshes) {
-    auto& gpu_mesh{gpu_scene.meshes.emplace_back()};
+auto ReadAssimpScene(Assimp::Importer& importer, std::filesystem::path const& scene_file_path) -> aiScene const* {
+  importer.SetPropertyInteger(AI_CONFIG_PP_RVC_FLAGS, kImportSettings.removed_components);
+  importer.SetPropertyInteger(AI_CONFIG_PP_SBP_REMOVE, kImportSettings.removed_primitive_types);
+  importer.SetPropertyFloat(AI_CONFIG_PP_GSN_MAX_SMOOTHING_ANGLE, kImportSettings.max_smoothing_angle);
 
-    {
-      D3D11_BUFFER_DESC const pos_buf_desc{
-        .ByteWidth = static_cast<UINT>(cpu_mesh.positions.size() * sizeof(Vector4)),
-        .Usage = D3D11_USAGE_DEFAULT,
-        .BindFlags = D3D11_BIND_VERTEX_BUFFER,
-        .CPUAccessFlags = 0,
-        .MiscFlags = 0,
-        .StructureByteStride = 0
-      };
+  auto const ai_scene{
+    importer.ReadFile(reinterpret_cast<char const*>(scene_file_path.u8string().data()),
+                      kImportSettings.post_process_flags)
+  };
 
-      D3D11_SUBRESOURCE_DATA const pos_buf_data{
-        .pSysMem = cpu_mesh.positions.data(),
-        .SysMemPitch = 0,
-        .SysMemSlicePitch = 0
-      };
+  if (!ai_scene || ai_scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !ai_scene->mRootNode) {
+    std::cerr << "Error loading scene: " << importer.GetErrorString() << "\n";
+    return nullptr;
+  }
 
-      if (FAILED(dev.CreateBuffer(&pos_buf_desc, &pos_buf_data, &gpu_mesh.pos_buf))) {
-        std::cerr << "Failed to create position buffer\n";
-        return std::nullopt;
-      }
-    }
+  return ai_scene;
+}
 
-    {
-      D3D11_BUFFER_DESC const norm_buf_desc{
-        .ByteWidth = static_cast<UINT>(cpu_mesh.normals.size() * sizeof(Vector4)),
-        .Usage = D3D11_USAGE_DEFAULT,
-        .BindFlags = D3D11_BIND_VERTEX_BUFFER,
-        .CPUAccessFlags = 0,
-        .MiscFlags = 0,
-        .StructureByteStride = 0
-      };
 
-      D3D11_SUBRESOURCE_DATA const norm_buf_data{
-        .pSysMem = cpu_mesh.normals.data(),
-        .SysMemPitch = 0,
-        .SysMemSlicePitch = 0
-      };
+auto ConvertAssimpScene(aiScene const& ai_scene, unsigned const thread_count) -> CpuScene {
+  namespace dx = DirectX;
 
-      if (FAILED(dev.CreateBuffer(&norm_buf_desc, &norm_buf_data, &gpu_mesh.norm_buf))) {
-        std::cerr << "Failed to create normal buffer\n";
-        return std::nullopt;
-      }
+  CpuScene scene;
+
+  // Meshes are numbered in the order of their first reference, unreferenced ones are dropped
+  auto constexpr unassigned_mesh_idx{std::numeric_limits<std::uint32_t>::max()};
+  std::vector mesh_indices(ai_scene.mNumMeshes, unassigned_mesh_idx);
+  std::vector<aiMesh const*> referenced_ai_meshes;
+
+  for (auto const& [ai_mesh_idx, world_mtx] : FlattenNodeHierarchy(ai_scene)) {
+    if (mesh_indices[ai_mesh_idx] == unassigned_mesh_idx) {
+      mesh_indices[ai_mesh_idx] = static_cast<std::uint32_t>(referenced_ai_meshes.size());
+      referenced_ai_meshes.push_back(ai_scene.mMeshes[ai_mesh_idx]);
     }
 
-    {
-      D3D11_BUFFER_DESC const uv_buf_desc{
-        .ByteWidth = static_cast<UINT>(cpu_mesh.texcoords.size() * sizeof(Vector2)),
-        .Usage = D3D11_USAGE_DEFAULT,
-        .BindFlags = D3D11_BIND_VERTEX_BUFFER,
-        .CPUAccessFlags = 0,
-        .MiscFlags = 0,
-        .StructureByteStride = 0
-      };
+    auto& instance{scene.instances.emplace_back()};
+    instance.transform.world_mtx = world_mtx;
+    dx::XMStoreFloat4x4(&instance.transform.normal_mtx,
+                        dx::XMMatrixTranspose(dx::XMMatrixInverse(nullptr, dx::XMLoadFloat4x4(&world_mtx))));
+    instance.mesh_idx = mesh_indices[ai_mesh_idx];
+    instance.mtl_idx = ai_scene.mMeshes[ai_mesh_idx]->mMaterialIndex;
+  }
 
-      D3D11_SUBRESOURCE_DATA const uv_buf_data{
-        .pSysMem = cpu_mesh.texcoords.data(),
-        .SysMemPitch = 0,
-        .SysMemSlicePitch = 0
-      };
+  scene.materials.reserve(ai_scene.mNumMaterials);
+  std::ranges::transform(ai_scene.mMaterials, ai_scene.mMaterials + ai_scene.mNumMaterials,
+                         std::back_inserter(scene.materials), [&scene](aiMaterial const* const ai_mtl) {
+                           return ConvertMaterial(ai_mtl, scene.textures);
+                         });
 
-      if (FAILED(dev.CreateBuffer(&uv_buf_desc, &uv_buf_data, &gpu_mesh.uv_buf))) {
-        std::cerr << "Failed to create uv buffer\n";
-        return std::nullopt;
-      }
-    }
+  scene.meshes.resize(referenced_ai_meshes.size());
 
-    {
-      D3D11_BUFFER_DESC const tan_buf_desc{
-        .ByteWidth = static_cast<UINT>(cpu_mesh.tangents.size() * sizeof(Vector4)),
-        .Usage = D3D11_USAGE_DEFAULT,
-        .BindFlags = D3D11_BIND_VERTEX_BUFFER,
-        .CPUAccessFlags = 0,
-        .MiscFlags = 0,
-        .StructureByteStride = 0
-      };
+  // Every mesh is written to its own preallocated slot, so the output order does not depend on scheduling
+  ParallelFor(referenced_ai_meshes.size(), thread_count, [&](std::size_t const i) {
+    ConvertMesh(referenced_ai_meshes[i], scene.meshes[i]);
+  });
 
-      D3D11_SUBRESOURCE_DATA const tan_buf_data{
-        .pSysMem = cpu_mesh.tangents.data(),
-        .SysMemPitch = 0,
-        .SysMemSlicePitch = 0
-      };
+  return scene;
+}
 
-      if (FAILED(dev.CreateBuffer(&tan_buf_desc, &tan_buf_data, &gpu_mesh.tan_buf))) {
-        std::cerr << "Failed to create tangent buffer\n";
-        return std::nullopt;
-      }
-    }
 
-    {
-      D3D11_BUFFER_DESC const idx_buf_desc{
-        .ByteWidth = static_cast<UINT>(cpu_mesh.indices.size() * sizeof(std::uint32_t)),
-        .Usage = D3D11_USAGE_DEFAULT,
-        .BindFlags = D3D11_BIND_INDEX_BUFFER,
-        .CPUAccessFlags = 0,
-        .MiscFlags = 0,
-        .StructureByteStride = 0
-      };
+auto BatchInstances(std::span<CpuInstance const> const instances) -> InstanceBatches {
+  InstanceBatches batches;
+  batches.instance_indices.resize(instances.size());
+  std::iota(batches.instance_indices.begin(), batches.instance_indices.end(), 0u);
 
-      D3D11_SUBRESOURCE_DATA const idx_buf_data{
-        .pSysMem = cpu_mesh.indices.data(),
-        .SysMemPitch = 0,
-        .SysMemSlicePitch = 0
-      };
+  std::ranges::stable_sort(batches.instance_indices, {}, [instances](std::uint32_t const i) {
+    return std::pair{instances[i].mesh_idx, instances[i].mtl_idx};
+  });
 
-      if (FAILED(dev.CreateBuffer(&idx_buf_desc, &idx_buf_data, &gpu_mesh.idx_buf))) {
-        std::cerr << "Failed to create index buffer\n";
-        return std::nullopt;
-      }
+  for (std::uint32_t i{0}; i < batches.instance_indices.size(); i++) {
+    auto const& instance{instances[batches.instance_indices[i]]};
+
+    if (batches.batches.empty() || batches.batches.back().mesh_idx != instance.mesh_idx ||
+        batches.batches.back().mtl_idx != instance.mtl_idx) {
+      batches.batches.emplace_back(instance.mesh_idx, instance.mtl_idx, i, 0u);
     }
 
-    {
-      D3D11_BUFFER_DESC constexpr transform_buf_desc{
-        .ByteWidth = static_cast<UINT>(sizeof(GpuMeshTransform)),
-        .Usage = D3D11_USAGE_DEFAULT,
-        .BindFlags = D3D11_BIND_CONSTANT_BUFFER,
-        .CPUAccessFlags = 0,
-        .MiscFlags = 0,
-        .StructureByteStride = 0
-      };
+    batches.batches.back().instance_count += 1;
+  }
 
-      D3D11_SUBRESOURCE_DATA const transform_buf_data{
-        .pSysMem = &cpu_mesh.transform,
-        .SysMemPitch = 0,
-        .SysMemSlicePitch = 0
-      };
+  return batches;
+}
 
-      if (FAILED(dev.CreateBuffer(&transform_buf_desc, &transform_buf_data, &gpu_mesh.transform_buf))) {
-        std::cerr << "Failed to create transform buffer\n";
-        return std::nullopt;
-      }
+
+auto ComputeRoughnessRange(CpuScene const& scene) -> std::optional<RoughnessRange> {
+  std::optional<RoughnessRange> range;
+
+  for (auto const& instance : scene.instances) {
+    auto const& mtl{scene.materials[instance.mtl_idx]};
+    auto const has_map{mtl.roughness_map_idx != kNoTexture};
+    auto const min{has_map ? std::min(mtl.roughness, 0.0f) : mtl.roughness};
+    auto const max{has_map ? std::max(mtl.roughness, 0.0f) : mtl.roughness};
+
+    if (range) {
+      range->min = std::min(range->min, min);
+      range->max = std::max(range->max, max);
+    } else {
+      range = RoughnessRange{.min = min, .max = max};
     }
+  }
 
-    {
-      D3D11_BUFFER_DESC constexpr mtl_buf_desc{
-        .ByteWidth = static_cast<UINT>(sizeof(GpuMaterial)),
-        .Usage = D3D11_USAGE_DEFAULT,
-        .BindFlags = D3D11_BIND_CONSTANT_BUFFER,
-        .CPUAccessFlags = 0,
-        .MiscFlags = 0,
-        .StructureByteStride = 0
-      };
+  return range;
+}
 
-      GpuMaterial const gpu_mtl{
-        .base_color = cpu_mesh.mtl.base_color,
-        .roughness = cpu_mesh.mtl.roughness,
-        .has_base_color_map = FALSE,
-        .has_roughness_map = FALSE,
-        .has_normal_map = FALSE,
-        .pad = {}
-      };
 
-      D3D11_SUBRESOURCE_DATA const mtl_buf_data{
-        .pSysMem = &gpu_mtl,
-        .SysMemPitch = 0,
-        .SysMemSlicePitch = 0
-      };
+auto LoadCpuScene(std::filesystem::path const& scene_file_path) -> std::optional<CpuScene> {
+  using Milliseconds = std::chrono::duration<double, std::milli>;
 
-      if (FAILED(dev.CreateBuffer(&mtl_buf_desc, &mtl_buf_data, &gpu_mesh.mtl_buf))) {
-        std::cerr << "Failed to create material buffer\n";
-        return std::nullopt;
-      }
-    }
+  auto const load_begin{std::chrono::steady_clock::now()};
+
+  auto const source_hash{HashFileContents(scene_file_path)};
+
+  if (!source_hash) {
+    std::cerr << "Failed to read scene file.\n";
+    return std::nullopt;
+  }
+
+  auto const cache_key{HashValue(kImportSettings, *source_hash)};
+  auto const cache_path{GetCacheFilePath(scene_file_path, ".reflscene")};
 
-    gpu_mesh.idx_count = static_cast<UINT>(cpu_mesh.indices.size());
+  if (auto scene{ReadSceneCache(cache_path, cache_key)}) {
+    auto const load_end{std::chrono::steady_clock::now()};
+    std::cout << std::format("Warm scene load (from cache) took {:.2f} ms.\n",
+                             Milliseconds{load_end - load_begin}.count());
+    return scene;
   }
 
-  return gpu_scene;
+  std::vector<std::filesystem::path> dependencies;
+  auto scene{ImportCpuScene(scene_file_path, dependencies)};
+
+  if (!scene) {
+    return std::nullopt;
+  }
+
+  auto const import_end{std::chrono::steady_clock::now()};
+
+  if (!WriteSceneCache(cache_path, cache_key, *scene, dependencies)) {
+    std::cerr << "Failed to write scene cache.\n";
+  }
+
+  auto const load_end{std::chrono::steady_clock::now()};
+  std::cout << std::format("Cold scene load (Assimp import) took {:.2f} ms, writing the cache took {:.2f} ms.\n",
+                           Milliseconds{import_end - load_begin}.count(), Milliseconds{load_end - import_end}.count());
+
+  return scene;
 }
 }
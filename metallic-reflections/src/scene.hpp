@@ -3,7 +3,9 @@
 #include <array>
 #include <cstdint>
 #include <filesystem>
+#include <limits>
 #include <optional>
+#include <span>
 #include <vector>
 
 #define WIN32_LEAN_AND_MEAN
@@ -12,13 +14,41 @@
 #include <DirectXMath.h>
 #include <wrl/client.h>
 
+struct aiScene;
+
+namespace Assimp {
+class Importer;
+}
+
 namespace refl {
 using Vector2 = std::array<float, 2>;
 using Vector4 = std::array<float, 4>;
 
+// Texture index of materials without the map
+std::uint32_t constexpr kNoTexture{std::numeric_limits<std::uint32_t>::max()};
+
+// Decides how the pixels of a texture are decoded, filtered and sampled
+enum class TextureUsage : std::uint32_t {
+  BaseColor, // sRGB encoded RGBA
+  Roughness, // Red channel
+  PackedRoughness, // Green channel of a glTF metallic-roughness texture
+  Normal // Tangent space RGB, renormalized in every mip
+};
+
+// Image file referenced by the materials, unique per path and usage
+struct CpuTexture {
+  std::filesystem::path path; // As referenced by the scene file, relative to its directory
+  TextureUsage usage;
+
+  auto operator==(CpuTexture const& other) const -> bool = default;
+};
+
 struct CpuMaterial {
   DirectX::XMFLOAT3 base_color;
   float roughness;
+  std::uint32_t base_color_map_idx; // Into CpuScene::textures, or kNoTexture
+  std::uint32_t roughness_map_idx; // Into CpuScene::textures, or kNoTexture
+  std::uint32_t normal_map_idx; // Into CpuScene::textures, or kNoTexture
 };
 
 struct CpuMeshTransform {
@@ -26,47 +56,66 @@ struct CpuMeshTransform {
   DirectX::XMFLOAT4X4 normal_mtx;
 };
 
+struct CpuMeshLod {
+  std::uint32_t first_index; // Into CpuMesh::lod_indices
+  std::uint32_t index_count;
+  float error; // Object space distance from the full detail mesh
+};
+
+// Unique geometry, shared by all instances that reference it
 struct CpuMesh {
   std::vector<Vector4> positions;
   std::vector<Vector4> normals;
-  std::vector<Vector2> texcoords;
-  std::vector<Vector4> tangents;
+  std::vector<Vector2> texcoords; // Empty if the mesh has no texture coordinates
+  std::vector<Vector4> tangents; // w is the bitangent sign. Empty if the mesh has no tangents.
   std::vector<std::uint32_t> indices;
+  std::vector<CpuMeshLod> lods; // Simplified versions of indices over the same vertices, finest first
+  std::vector<std::uint32_t> lod_indices; // Indices of every level in lods
+};
+
+struct CpuInstance {
   CpuMeshTransform transform;
-  CpuMaterial mtl;
+  std::uint32_t mesh_idx; // Into CpuScene::meshes
+  std::uint32_t mtl_idx; // Into CpuScene::materials
 };
 
 struct CpuScene {
   std::vector<CpuMesh> meshes;
+  std::vector<CpuMaterial> materials;
+  std::vector<CpuTexture> textures; // Referenced by the materials, never decoded as part of the scene
+  std::vector<CpuInstance> instances; // One per mesh reference in the node hierarchy
 };
 
-struct GpuMaterial {
-  DirectX::XMFLOAT3 base_color;
-  float roughness;
-  BOOL has_base_color_map;
-  BOOL has_roughness_map;
-  BOOL has_normal_map;
-  UINT pad;
+// Instances sharing a mesh and material, drawn with a single instanced draw
+struct InstanceBatch {
+  std::uint32_t mesh_idx;
+  std::uint32_t mtl_idx;
+  std::uint32_t first_instance; // Into InstanceBatches::instance_indices
+  std::uint32_t instance_count;
 };
 
-using GpuMeshTransform = CpuMeshTransform;
-
-struct GpuMesh {
-  Microsoft::WRL::ComPtr<ID3D11Buffer> pos_buf; // Vector4s
-  Microsoft::WRL::ComPtr<ID3D11Buffer> norm_buf; // Vector4s
-  Microsoft::WRL::ComPtr<ID3D11Buffer> uv_buf; // Vector2s
-  Microsoft::WRL::ComPtr<ID3D11Buffer> tan_buf; //Vector4s
-  Microsoft::WRL::ComPtr<ID3D11Buffer> idx_buf; // u32s
-  Microsoft::WRL::ComPtr<ID3D11Buffer> transform_buf; // GpuMeshTransform
-  Microsoft::WRL::ComPtr<ID3D11Buffer> mtl_buf;
-  UINT idx_count;
+struct InstanceBatches {
+  std::vector<std::uint32_t> instance_indices; // Into CpuScene::instances, grouped by batch
+  std::vector<InstanceBatch> batches; // Ordered by mesh, then material
 };
 
-struct GpuScene {
-  std::vector<GpuMesh> meshes;
+struct RoughnessRange {
+  float min;
+  float max;
 };
 
 
+// Runs the Assimp import with the settings the scene cache is keyed on. The returned scene is owned by the importer.
+auto ReadAssimpScene(Assimp::Importer& importer, std::filesystem::path const& scene_file_path) -> aiScene const*;
+// Flattens the node hierarchy serially into instances, then converts every referenced mesh once on thread_count
+// threads. The result does not depend on thread_count.
+auto ConvertAssimpScene(aiScene const& ai_scene, unsigned thread_count) -> CpuScene;
+// Groups the instances by mesh and material for instanced drawing. Instances keep their relative order within a batch.
+auto BatchInstances(std::span<CpuInstance const> instances) -> InstanceBatches;
+// Roughness gbuffer.hlsli can write for the materials the instances use. Roughness maps scale the roughness of their
+// material, so they extend the range down to 0. Returns nullopt if there are no instances.
+auto ComputeRoughnessRange(CpuScene const& scene) -> std::optional<RoughnessRange>;
+// Loads the baked scene cache if it matches the source files and import settings, otherwise imports the file with
+// Assimp, optimizes the meshes for the vertex cache and overdraw, generates their LODs, and rebakes the cache.
 auto LoadCpuScene(std::filesystem::path const& scene_file_path) -> std::optional<CpuScene>;
-auto CreateGpuScene(CpuScene const& cpu_scene, ID3D11Device& dev) -> std::optional<GpuScene>;
 }
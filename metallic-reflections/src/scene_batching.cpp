@@ -0,0 +1,344 @@
+#include "scene_batching.hpp"
+
+#include "parallel.hpp"
+
+import std;
+
+namespace refl {
+namespace {
+auto ComputeInstanceTransform(CpuInstance const& instance,
+                              DirectX::XMFLOAT4X4 const& dequantization_mtx) -> InstanceTransform {
+  namespace dx = DirectX;
+
+  // The vertex shader receives [0, 1] positions, dequantization is folded into the world matrix
+  InstanceTransform transform{.world_mtx = {}, .normal_mtx = instance.transform.normal_mtx};
+  dx::XMStoreFloat4x4(&transform.world_mtx,
+                      dx::XMMatrixMultiply(dx::XMLoadFloat4x4(&dequantization_mtx),
+                                           dx::XMLoadFloat4x4(&instance.transform.world_mtx)));
+  return transform;
+}
+
+
+// Dequantization matrix of the float layout, which draws the object space positions as they are
+auto GetIdentityMatrix() -> DirectX::XMFLOAT4X4 {
+  return {
+    1, 0, 0, 0,
+    0, 1, 0, 0,
+    0, 0, 1, 0,
+    0, 0, 0, 1
+  };
+}
+
+
+auto ConvertMaterial(CpuMaterial const& mtl) -> Material {
+  return Material{
+    .base_color = mtl.base_color,
+    .roughness = mtl.roughness,
+    .has_base_color_map = mtl.base_color_map_idx != kNoTexture,
+    .has_roughness_map = mtl.roughness_map_idx != kNoTexture,
+    .has_normal_map = mtl.normal_map_idx != kNoTexture,
+    .pad = 0
+  };
+}
+
+
+// Converts object space lengths to world space, bounded by the longest transformed basis vector
+auto ComputeInstanceScale(DirectX::XMFLOAT4X4 const& world_mtx) -> float {
+  return std::sqrt(std::max({
+    world_mtx._11 * world_mtx._11 + world_mtx._12 * world_mtx._12 + world_mtx._13 * world_mtx._13,
+    world_mtx._21 * world_mtx._21 + world_mtx._22 * world_mtx._22 + world_mtx._23 * world_mtx._23,
+    world_mtx._31 * world_mtx._31 + world_mtx._32 * world_mtx._32 + world_mtx._33 * world_mtx._33
+  }));
+}
+
+
+template<typename T>
+auto AppendStream(std::vector<T>& pool, std::vector<T> const& stream, std::size_t const vertex_count) -> void {
+  if (stream.empty()) {
+    pool.resize(pool.size() + vertex_count);
+  } else {
+    pool.insert(pool.end(), stream.begin(), stream.end());
+  }
+}
+
+
+template<typename T>
+auto SliceEquals(std::vector<T> const& pool, std::size_t const offset, std::vector<T> const& stream) -> bool {
+  return offset + stream.size() <= pool.size() &&
+         std::memcmp(pool.data() + offset, stream.data(), stream.size() * sizeof(T)) == 0;
+}
+
+
+// Whether the streams of the layout of the pools hold the vertices of the mesh from base_vertex on
+auto VerticesMatch(ScenePools const& pools, std::size_t const base_vertex, CpuMesh const& mesh,
+                   PackedMesh const& packed_mesh) -> bool {
+  if (pools.vertex_layout == VertexLayout::kFloat) {
+    return SliceEquals(pools.float_positions, base_vertex, mesh.positions) &&
+           SliceEquals(pools.float_normals, base_vertex, mesh.normals) &&
+           (pools.float_texcoords.empty() || SliceEquals(pools.float_texcoords, base_vertex, mesh.texcoords)) &&
+           (pools.float_tangents.empty() || SliceEquals(pools.float_tangents, base_vertex, mesh.tangents));
+  }
+
+  return SliceEquals(pools.positions, base_vertex, packed_mesh.positions) &&
+         SliceEquals(pools.normals, base_vertex, packed_mesh.normals) &&
+         (pools.texcoords.empty() || SliceEquals(pools.texcoords, base_vertex, packed_mesh.texcoords)) &&
+         (pools.tangents.empty() || SliceEquals(pools.tangents, base_vertex, packed_mesh.tangents));
+}
+}
+
+
+auto BuildScenePools(CpuScene const& scene, VertexLayout const vertex_layout,
+                     unsigned const thread_count) -> ScenePools {
+  auto const packed{vertex_layout == VertexLayout::kPacked};
+  std::vector<PackedMesh> packed_meshes(packed ? scene.meshes.size() : 0);
+  std::vector<Aabb> mesh_bounds(scene.meshes.size());
+
+  ParallelFor(scene.meshes.size(), thread_count, [&](std::size_t const i) {
+    if (packed) {
+      packed_meshes[i] = PackMesh(scene.meshes[i]);
+    }
+
+    mesh_bounds[i] = ComputeAabb(scene.meshes[i].positions);
+  });
+
+  auto const has_texcoords{std::ranges::any_of(scene.meshes, [](CpuMesh const& mesh) {
+    return !mesh.texcoords.empty();
+  })};
+
+  auto const has_tangents{std::ranges::any_of(scene.meshes, [](CpuMesh const& mesh) {
+    return !mesh.tangents.empty();
+  })};
+
+  ScenePools pools;
+  pools.vertex_layout = vertex_layout;
+  pools.vertex_count = 0;
+
+  // Offsets of every mesh in the pools
+  std::vector<std::int32_t> base_vertices;
+  std::vector<std::uint32_t> first_lods;
+  std::vector<DirectX::XMFLOAT4X4> dequantization_mtxs;
+  base_vertices.reserve(scene.meshes.size());
+  first_lods.reserve(scene.meshes.size());
+  dequantization_mtxs.reserve(scene.meshes.size());
+
+  for (std::size_t i{0}; i < scene.meshes.size(); i++) {
+    auto const& mesh{scene.meshes[i]};
+    auto const vertex_count{mesh.positions.size()};
+
+    base_vertices.push_back(static_cast<std::int32_t>(pools.vertex_count));
+    first_lods.push_back(static_cast<std::uint32_t>(pools.lods.size()));
+    pools.vertex_count += static_cast<std::uint32_t>(vertex_count);
+
+    if (packed) {
+      auto const& packed_mesh{packed_meshes[i]};
+      dequantization_mtxs.push_back(ComputeDequantizationMatrix(packed_mesh));
+
+      pools.positions.insert(pools.positions.end(), packed_mesh.positions.begin(), packed_mesh.positions.end());
+      pools.normals.insert(pools.normals.end(), packed_mesh.normals.begin(), packed_mesh.normals.end());
+
+      if (has_texcoords) {
+        AppendStream(pools.texcoords, packed_mesh.texcoords, vertex_count);
+      }
+
+      if (has_tangents) {
+        AppendStream(pools.tangents, packed_mesh.tangents, vertex_count);
+      }
+    } else {
+      dequantization_mtxs.push_back(GetIdentityMatrix());
+
+      pools.float_positions.insert(pools.float_positions.end(), mesh.positions.begin(), mesh.positions.end());
+      pools.float_normals.insert(pools.float_normals.end(), mesh.normals.begin(), mesh.normals.end());
+
+      if (has_texcoords) {
+        AppendStream(pools.float_texcoords, mesh.texcoords, vertex_count);
+      }
+
+      if (has_tangents) {
+        AppendStream(pools.float_tangents, mesh.tangents, vertex_count);
+      }
+    }
+
+    pools.lods.push_back(PoolLod{
+      .index_count = static_cast<std::uint32_t>(mesh.indices.size()),
+      .first_index = static_cast<std::uint32_t>(pools.indices.size()),
+      .error = 0
+    });
+    pools.indices.insert(pools.indices.end(), mesh.indices.begin(), mesh.indices.end());
+
+    for (auto const& lod : mesh.lods) {
+      pools.lods.push_back(PoolLod{
+        .index_count = lod.index_count,
+        .first_index = static_cast<std::uint32_t>(pools.indices.size()),
+        .error = lod.error
+      });
+      auto const lod_indices{std::span{mesh.lod_indices}.subspan(lod.first_index, lod.index_count)};
+      pools.indices.insert(pools.indices.end(), lod_indices.begin(), lod_indices.end());
+    }
+  }
+
+  pools.materials.reserve(scene.materials.size());
+  std::ranges::transform(scene.materials, std::back_inserter(pools.materials), &ConvertMaterial);
+
+  auto const batches{BatchInstances(scene.instances)};
+  pools.transforms.reserve(batches.instance_indices.size());
+  pools.draw_instances.reserve(batches.instance_indices.size());
+  pools.instance_bounds.reserve(batches.instance_indices.size());
+  pools.instance_scales.reserve(batches.instance_indices.size());
+  pools.draws.reserve(batches.batches.size());
+
+  for (auto const& batch : batches.batches) {
+    for (auto i{batch.first_instance}; i < batch.first_instance + batch.instance_count; i++) {
+      auto const& instance{scene.instances[batches.instance_indices[i]]};
+      pools.draw_instances.emplace_back(static_cast<std::uint32_t>(pools.transforms.size()), instance.mtl_idx);
+      pools.transforms.push_back(ComputeInstanceTransform(instance, dequantization_mtxs[instance.mesh_idx]));
+      pools.instance_bounds.push_back(TransformAabb(mesh_bounds[instance.mesh_idx], instance.transform.world_mtx));
+      pools.instance_scales.push_back(ComputeInstanceScale(instance.transform.world_mtx));
+    }
+
+    auto const& full_detail_lod{pools.lods[first_lods[batch.mesh_idx]]};
+
+    pools.draws.push_back(PoolDraw{
+      .index_count = full_detail_lod.index_count,
+      .first_index = full_detail_lod.first_index,
+      .base_vertex = base_vertices[batch.mesh_idx],
+      .first_instance = batch.first_instance,
+      .instance_count = batch.instance_count,
+      .mesh_idx = batch.mesh_idx,
+      .mtl_idx = batch.mtl_idx,
+      .first_lod = first_lods[batch.mesh_idx],
+      .lod_count = static_cast<std::uint32_t>(scene.meshes[batch.mesh_idx].lods.size()) + 1
+    });
+  }
+
+  return pools;
+}
+
+
+auto ValidateScenePools(CpuScene const& scene, ScenePools const& pools) -> bool {
+  auto const packed{pools.vertex_layout == VertexLayout::kPacked};
+  auto const packed_vertex_count{packed ? pools.vertex_count : 0};
+  auto const float_vertex_count{packed ? 0 : pools.vertex_count};
+
+  if (pools.positions.size() != packed_vertex_count || pools.normals.size() != packed_vertex_count ||
+      (!pools.texcoords.empty() && pools.texcoords.size() != packed_vertex_count) ||
+      (!pools.tangents.empty() && pools.tangents.size() != packed_vertex_count) ||
+      pools.float_positions.size() != float_vertex_count || pools.float_normals.size() != float_vertex_count ||
+      (!pools.float_texcoords.empty() && pools.float_texcoords.size() != float_vertex_count) ||
+      (!pools.float_tangents.empty() && pools.float_tangents.size() != float_vertex_count) ||
+      pools.transforms.size() != scene.instances.size() || pools.draw_instances.size() != scene.instances.size() ||
+      pools.instance_bounds.size() != scene.instances.size() ||
+      pools.instance_scales.size() != scene.instances.size() ||
+      pools.materials.size() != scene.materials.size()) {
+    std::cerr << "Scene pool sizes do not match the scene.\n";
+    return false;
+  }
+
+  std::vector<PackedMesh> packed_meshes;
+  packed_meshes.reserve(scene.meshes.size());
+  std::ranges::transform(scene.meshes, std::back_inserter(packed_meshes), &PackMesh);
+
+  // Every instance of the scene must be drawn exactly once
+  std::vector<std::uint32_t> expected_instance_counts(scene.meshes.size(), 0);
+  std::vector<std::uint32_t> drawn_instance_counts(scene.meshes.size(), 0);
+
+  for (auto const& instance : scene.instances) {
+    expected_instance_counts[instance.mesh_idx] += 1;
+  }
+
+  for (auto const& draw : pools.draws) {
+    if (draw.mesh_idx >= scene.meshes.size() || draw.mtl_idx >= pools.materials.size() ||
+        draw.first_instance + draw.instance_count > pools.draw_instances.size() ||
+        draw.first_lod + draw.lod_count > pools.lods.size()) {
+      std::cerr << "Draw references data outside the pools.\n";
+      return false;
+    }
+
+    auto const& mesh{scene.meshes[draw.mesh_idx]};
+    auto const base_vertex{static_cast<std::size_t>(draw.base_vertex)};
+
+    if (draw.index_count != mesh.indices.size() || !SliceEquals(pools.indices, draw.first_index, mesh.indices) ||
+        !VerticesMatch(pools, base_vertex, mesh, packed_meshes[draw.mesh_idx])) {
+      std::cerr << std::format("Draw of mesh {} does not reproduce the mesh.\n", draw.mesh_idx);
+      return false;
+    }
+
+    auto lods_match{
+      draw.lod_count == mesh.lods.size() + 1 && pools.lods[draw.first_lod].first_index == draw.first_index &&
+      pools.lods[draw.first_lod].index_count == draw.index_count
+    };
+
+    for (std::size_t i{0}; i < mesh.lods.size() && lods_match; i++) {
+      auto const& lod{mesh.lods[i]};
+      auto const& pool_lod{pools.lods[draw.first_lod + 1 + i]};
+      auto const lod_indices{std::span{mesh.lod_indices}.subspan(lod.first_index, lod.index_count)};
+      lods_match = pool_lod.index_count == lod.index_count && pool_lod.error == lod.error &&
+                   pool_lod.first_index + lod.index_count <= pools.indices.size() &&
+                   std::ranges::equal(lod_indices, std::span{pools.indices}.subspan(pool_lod.first_index,
+                                                                                     lod.index_count));
+    }
+
+    if (!lods_match) {
+      std::cerr << std::format("Draw of mesh {} does not reproduce the LODs of the mesh.\n", draw.mesh_idx);
+      return false;
+    }
+
+    for (auto i{draw.first_instance}; i < draw.first_instance + draw.instance_count; i++) {
+      auto const& draw_instance{pools.draw_instances[i]};
+
+      if (draw_instance.transform_idx >= pools.transforms.size() || draw_instance.mtl_idx != draw.mtl_idx) {
+        std::cerr << std::format("Draw of mesh {} has an invalid instance.\n", draw.mesh_idx);
+        return false;
+      }
+    }
+
+    drawn_instance_counts[draw.mesh_idx] += draw.instance_count;
+  }
+
+  if (drawn_instance_counts != expected_instance_counts) {
+    std::cerr << "Draws do not cover every instance exactly once.\n";
+    return false;
+  }
+
+  // The transforms drawn with every mesh must be the same multiset as the transforms of its instances
+  std::vector<DirectX::XMFLOAT4X4> dequantization_mtxs;
+  dequantization_mtxs.reserve(scene.meshes.size());
+
+  for (auto const& packed_mesh : packed_meshes) {
+    dequantization_mtxs.push_back(packed ? ComputeDequantizationMatrix(packed_mesh) : GetIdentityMatrix());
+  }
+
+  auto const transform_less{
+    [](InstanceTransform const& a, InstanceTransform const& b) {
+      return std::memcmp(&a, &b, sizeof(InstanceTransform)) < 0;
+    }
+  };
+
+  std::vector<std::vector<InstanceTransform>> expected_transforms(scene.meshes.size());
+  std::vector<std::vector<InstanceTransform>> drawn_transforms(scene.meshes.size());
+
+  for (auto const& instance : scene.instances) {
+    expected_transforms[instance.mesh_idx].push_back(
+      ComputeInstanceTransform(instance, dequantization_mtxs[instance.mesh_idx]));
+  }
+
+  for (auto const& draw : pools.draws) {
+    for (auto i{draw.first_instance}; i < draw.first_instance + draw.instance_count; i++) {
+      drawn_transforms[draw.mesh_idx].push_back(pools.transforms[pools.draw_instances[i].transform_idx]);
+    }
+  }
+
+  for (std::size_t i{0}; i < scene.meshes.size(); i++) {
+    std::ranges::sort(expected_transforms[i], transform_less);
+    std::ranges::sort(drawn_transforms[i], transform_less);
+
+    if (!std::ranges::equal(expected_transforms[i], drawn_transforms[i], [](auto const& a, auto const& b) {
+      return std::memcmp(&a, &b, sizeof(InstanceTransform)) == 0;
+    })) {
+      std::cerr << std::format("Instances of mesh {} are drawn with wrong transforms.\n", i);
+      return false;
+    }
+  }
+
+  return true;
+}
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "bvh.hpp"
+#include "scene.hpp"
+#include "vertex_packing.hpp"
+#include "shaders/shader_interop.h"
+
+namespace refl {
+// Per-instance vertex data of the merged scene. SV_InstanceID does not include StartInstanceLocation, so the indices
+// are fetched through a per-instance stream instead.
+struct DrawInstance {
+  std::uint32_t transform_idx; // Into ScenePools::transforms
+  std::uint32_t mtl_idx; // Into ScenePools::materials
+};
+
+// Index range of one level of detail of a mesh in the index pool
+struct PoolLod {
+  std::uint32_t index_count;
+  std::uint32_t first_index; // Into ScenePools::indices
+  float error; // Object space, 0 for the full detail level
+};
+
+// One instanced draw out of the shared pools
+struct PoolDraw {
+  std::uint32_t index_count;
+  std::uint32_t first_index; // Into ScenePools::indices
+  std::int32_t base_vertex; // Into the vertex streams of ScenePools, the indices are local to the mesh
+  std::uint32_t first_instance; // StartInstanceLocation into ScenePools::draw_instances
+  std::uint32_t instance_count;
+  std::uint32_t mesh_idx; // Into CpuScene::meshes
+  std::uint32_t mtl_idx; // Into ScenePools::materials
+  std::uint32_t first_lod; // Into ScenePools::lods, the full detail level the index range above draws
+  std::uint32_t lod_count;
+};
+
+// Every mesh of the scene concatenated into a single set of vertex streams and a single index buffer, with transforms
+// and materials in flat arrays for structured buffers. Builds without a device.
+struct ScenePools {
+  VertexLayout vertex_layout; // Only the streams of this layout are filled
+  std::uint32_t vertex_count;
+  std::vector<PackedPosition> positions;
+  std::vector<PackedNormal> normals;
+  // Empty if no mesh has texture coordinates. Otherwise zero filled for the meshes without them.
+  std::vector<PackedTexcoord> texcoords;
+  // Empty if no mesh has tangents. Otherwise zero filled for the meshes without them.
+  std::vector<PackedTangent> tangents;
+  // The CpuMesh streams of VertexLayout::kFloat, texture coordinates and tangents are filled like the packed ones
+  std::vector<Vector4> float_positions;
+  std::vector<Vector4> float_normals;
+  std::vector<Vector2> float_texcoords;
+  std::vector<Vector4> float_tangents;
+  std::vector<std::uint32_t> indices; // Every level of detail of every mesh
+  std::vector<PoolLod> lods; // The levels of every mesh from finest to coarsest
+  // In draw order, the world matrices include the dequantization of the packed positions
+  std::vector<InstanceTransform> transforms;
+  std::vector<Material> materials; // Same order as CpuScene::materials
+  std::vector<DrawInstance> draw_instances;
+  std::vector<Aabb> instance_bounds; // World space, parallel to draw_instances
+  std::vector<float> instance_scales; // Largest axis scale of the world matrix, parallel to draw_instances
+  std::vector<PoolDraw> draws; // One per InstanceBatch
+};
+
+// Packs the meshes on thread_count threads for the packed layout, then lays them out in the pools serially
+[[nodiscard]] auto BuildScenePools(CpuScene const& scene, VertexLayout vertex_layout,
+                                   unsigned thread_count) -> ScenePools;
+
+// Checks that every draw reproduces the mesh in the layout of the pools, and the LODs, transforms and material of every
+// instance of the scene
+[[nodiscard]] auto ValidateScenePools(CpuScene const& scene, ScenePools const& pools) -> bool;
+}
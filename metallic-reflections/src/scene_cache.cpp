@@ -0,0 +1,268 @@
+#include "scene_cache.hpp"
+
+#include "cache.hpp"
+#include "mapped_file.hpp"
+
+import std;
+
+namespace refl {
+namespace {
+std::array<char, 8> constexpr kSceneCacheMagic{'R', 'E', 'F', 'L', 'S', 'C', 'N', '\0'};
+std::uint32_t constexpr kSceneCacheVersion{6};
+std::uint64_t constexpr kSceneCacheAlignment{16};
+
+
+struct SceneCacheStream {
+  std::uint64_t offset; // From the start of the file
+  std::uint64_t count; // Number of elements
+};
+
+
+struct SceneCacheHeader {
+  std::array<char, 8> magic;
+  std::uint32_t version;
+  std::uint32_t mesh_count;
+  std::uint64_t key; // Of the source asset and import settings, combined with the contents of the dependencies
+  std::uint64_t file_size;
+  SceneCacheStream materials;
+  SceneCacheStream instances;
+  SceneCacheStream texture_usages;
+  SceneCacheStream texture_paths; // UTF-8 characters of every path, each one terminated by a null character
+  SceneCacheStream dependency_paths; // Absolute, in the format of texture_paths
+};
+
+
+struct SceneCacheMesh {
+  SceneCacheStream positions;
+  SceneCacheStream normals;
+  SceneCacheStream texcoords;
+  SceneCacheStream tangents;
+  SceneCacheStream indices;
+  SceneCacheStream lods;
+  SceneCacheStream lod_indices;
+};
+
+
+auto AlignUp(std::uint64_t const value) -> std::uint64_t {
+  return (value + kSceneCacheAlignment - 1) / kSceneCacheAlignment * kSceneCacheAlignment;
+}
+
+
+template<typename T>
+auto CopyStream(std::span<std::byte const> const data, SceneCacheStream const& stream, std::vector<T>& out) -> bool {
+  if (stream.offset % kSceneCacheAlignment != 0 || stream.offset > data.size() ||
+      stream.count > (data.size() - stream.offset) / sizeof(T)) {
+    return false;
+  }
+
+  out.resize(stream.count);
+  std::memcpy(out.data(), data.data() + stream.offset, stream.count * sizeof(T));
+  return true;
+}
+
+
+template<typename T>
+auto PlaceStream(std::vector<T> const& vec, std::uint64_t& cursor) -> SceneCacheStream {
+  SceneCacheStream const stream{.offset = cursor, .count = vec.size()};
+  cursor = AlignUp(cursor + vec.size() * sizeof(T));
+  return stream;
+}
+
+
+// Inverse of JoinPaths. Returns nullopt if the last path is not terminated.
+auto SplitPaths(std::span<char8_t const> const chars) -> std::optional<std::vector<std::filesystem::path>> {
+  std::vector<std::filesystem::path> paths;
+  auto path_begin{chars.begin()};
+
+  while (path_begin != chars.end()) {
+    auto const path_end{std::ranges::find(path_begin, chars.end(), u8'\0')};
+
+    if (path_end == chars.end()) {
+      return std::nullopt;
+    }
+
+    paths.emplace_back(std::u8string{path_begin, path_end});
+    path_begin = path_end + 1;
+  }
+
+  return paths;
+}
+
+
+auto JoinPaths(std::span<std::filesystem::path const> const paths) -> std::vector<char8_t> {
+  std::vector<char8_t> chars;
+
+  for (auto const& path : paths) {
+    auto const str{path.u8string()};
+    chars.insert(chars.end(), str.begin(), str.end());
+    chars.push_back(u8'\0');
+  }
+
+  return chars;
+}
+
+
+template<typename T>
+auto WriteAt(std::vector<std::byte>& bytes, std::uint64_t const offset, std::span<T const> const data) -> void {
+  std::memcpy(bytes.data() + offset, data.data(), data.size_bytes());
+}
+}
+
+
+auto ReadSceneCache(std::filesystem::path const& cache_path, std::uint64_t const key) -> std::optional<CpuScene> {
+  auto const file{MappedFile::New(cache_path)};
+
+  if (!file) {
+    return std::nullopt;
+  }
+
+  auto const data{file->GetData()};
+
+  if (data.size() < sizeof(SceneCacheHeader)) {
+    return std::nullopt;
+  }
+
+  SceneCacheHeader header;
+  std::memcpy(&header, data.data(), sizeof(header));
+
+  if (header.magic != kSceneCacheMagic || header.version != kSceneCacheVersion || header.file_size != data.size() ||
+      header.mesh_count > (data.size() - sizeof(SceneCacheHeader)) / sizeof(SceneCacheMesh)) {
+    return std::nullopt;
+  }
+
+  std::vector<char8_t> dependency_chars;
+
+  if (!CopyStream(data, header.dependency_paths, dependency_chars)) {
+    return std::nullopt;
+  }
+
+  // Missing dependencies make the cache stale, as they would fail the import
+  if (auto const dependencies{SplitPaths(dependency_chars)};
+    !dependencies || HashFiles(*dependencies, key) != header.key) {
+    return std::nullopt;
+  }
+
+  std::vector<SceneCacheMesh> records(header.mesh_count);
+  std::memcpy(records.data(), data.data() + sizeof(SceneCacheHeader), records.size() * sizeof(SceneCacheMesh));
+
+  CpuScene scene;
+  scene.meshes.resize(records.size());
+
+  std::vector<TextureUsage> texture_usages;
+  std::vector<char8_t> texture_chars;
+
+  if (!CopyStream(data, header.materials, scene.materials) || !CopyStream(data, header.instances, scene.instances) ||
+      !CopyStream(data, header.texture_usages, texture_usages) ||
+      !CopyStream(data, header.texture_paths, texture_chars)) {
+    return std::nullopt;
+  }
+
+  auto texture_paths{SplitPaths(texture_chars)};
+
+  if (!texture_paths || texture_paths->size() != texture_usages.size()) {
+    return std::nullopt;
+  }
+
+  for (std::size_t i{0}; i < texture_usages.size(); i++) {
+    scene.textures.emplace_back(std::move((*texture_paths)[i]), texture_usages[i]);
+  }
+
+  for (std::size_t i{0}; i < records.size(); i++) {
+    auto const& record{records[i]};
+    auto& mesh{scene.meshes[i]};
+
+    if (!CopyStream(data, record.positions, mesh.positions) ||
+        !CopyStream(data, record.normals, mesh.normals) ||
+        !CopyStream(data, record.texcoords, mesh.texcoords) ||
+        !CopyStream(data, record.tangents, mesh.tangents) ||
+        !CopyStream(data, record.indices, mesh.indices) ||
+        !CopyStream(data, record.lods, mesh.lods) ||
+        !CopyStream(data, record.lod_indices, mesh.lod_indices)) {
+      return std::nullopt;
+    }
+  }
+
+  return scene;
+}
+
+
+auto WriteSceneCache(std::filesystem::path const& cache_path, std::uint64_t const key, CpuScene const& scene,
+                     std::span<std::filesystem::path const> const dependencies) -> bool {
+  auto const dependency_key{HashFiles(dependencies, key)};
+
+  if (!dependency_key) {
+    return false;
+  }
+
+  std::vector<SceneCacheMesh> records;
+  records.reserve(scene.meshes.size());
+
+  auto cursor{AlignUp(sizeof(SceneCacheHeader) + scene.meshes.size() * sizeof(SceneCacheMesh))};
+
+  for (auto const& mesh : scene.meshes) {
+    auto& record{records.emplace_back()};
+    record.positions = PlaceStream(mesh.positions, cursor);
+    record.normals = PlaceStream(mesh.normals, cursor);
+    record.texcoords = PlaceStream(mesh.texcoords, cursor);
+    record.tangents = PlaceStream(mesh.tangents, cursor);
+    record.indices = PlaceStream(mesh.indices, cursor);
+    record.lods = PlaceStream(mesh.lods, cursor);
+    record.lod_indices = PlaceStream(mesh.lod_indices, cursor);
+  }
+
+  std::vector<TextureUsage> texture_usages;
+  std::vector<std::filesystem::path> texture_paths;
+
+  for (auto const& texture : scene.textures) {
+    texture_usages.push_back(texture.usage);
+    texture_paths.push_back(texture.path);
+  }
+
+  auto const texture_chars{JoinPaths(texture_paths)};
+  auto const dependency_chars{JoinPaths(dependencies)};
+
+  auto const materials{PlaceStream(scene.materials, cursor)};
+  auto const instances{PlaceStream(scene.instances, cursor)};
+  auto const texture_usages_stream{PlaceStream(texture_usages, cursor)};
+  auto const texture_paths_stream{PlaceStream(texture_chars, cursor)};
+  auto const dependency_paths_stream{PlaceStream(dependency_chars, cursor)};
+
+  SceneCacheHeader const header{
+    .magic = kSceneCacheMagic,
+    .version = kSceneCacheVersion,
+    .mesh_count = static_cast<std::uint32_t>(scene.meshes.size()),
+    .key = *dependency_key,
+    .file_size = cursor,
+    .materials = materials,
+    .instances = instances,
+    .texture_usages = texture_usages_stream,
+    .texture_paths = texture_paths_stream,
+    .dependency_paths = dependency_paths_stream
+  };
+
+  // Serialized in memory first, the zero fill covers the alignment padding between the streams
+  std::vector<std::byte> bytes(cursor);
+
+  WriteAt(bytes, 0, std::span{&header, 1});
+  WriteAt(bytes, sizeof(SceneCacheHeader), std::span<SceneCacheMesh const>{records});
+  WriteAt(bytes, materials.offset, std::span{scene.materials});
+  WriteAt(bytes, instances.offset, std::span{scene.instances});
+  WriteAt(bytes, texture_usages_stream.offset, std::span<TextureUsage const>{texture_usages});
+  WriteAt(bytes, texture_paths_stream.offset, std::span{texture_chars});
+  WriteAt(bytes, dependency_paths_stream.offset, std::span{dependency_chars});
+
+  for (std::size_t i{0}; i < records.size(); i++) {
+    auto const& mesh{scene.meshes[i]};
+    auto const& record{records[i]};
+    WriteAt(bytes, record.positions.offset, std::span{mesh.positions});
+    WriteAt(bytes, record.normals.offset, std::span{mesh.normals});
+    WriteAt(bytes, record.texcoords.offset, std::span{mesh.texcoords});
+    WriteAt(bytes, record.tangents.offset, std::span{mesh.tangents});
+    WriteAt(bytes, record.indices.offset, std::span{mesh.indices});
+    WriteAt(bytes, record.lods.offset, std::span{mesh.lods});
+    WriteAt(bytes, record.lod_indices.offset, std::span{mesh.lod_indices});
+  }
+
+  return WriteFileAtomically(cache_path, {bytes});
+}
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+
+#include "scene.hpp"
+
+namespace refl {
+// Baked scene format. Every CpuMesh stream is stored 16-byte aligned in the exact memory layout of its vector, so
+// reading a cache is one bulk copy per stream out of the mapped file instead of an Assimp import.
+// The key identifies the source asset and the import settings; a cache with a different key is treated as stale.
+// The cache also records the other files the import read, such as the external buffers of a glTF, and is stale if the
+// contents of any of them changed since it was written.
+[[nodiscard]] auto ReadSceneCache(std::filesystem::path const& cache_path,
+                                  std::uint64_t key) -> std::optional<CpuScene>;
+[[nodiscard]] auto WriteSceneCache(std::filesystem::path const& cache_path, std::uint64_t key, CpuScene const& scene,
+                                   std::span<std::filesystem::path const> dependencies) -> bool;
+}
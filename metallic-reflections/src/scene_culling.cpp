@@ -0,0 +1,97 @@
+#include "scene_culling.hpp"
+
+import std;
+
+namespace refl {
+namespace {
+auto ComputeDistance(Aabb const& aabb, DirectX::XMFLOAT3 const& point) -> float {
+  auto const dx{std::max({aabb.min.x - point.x, 0.0f, point.x - aabb.max.x})};
+  auto const dy{std::max({aabb.min.y - point.y, 0.0f, point.y - aabb.max.y})};
+  auto const dz{std::max({aabb.min.z - point.z, 0.0f, point.z - aabb.max.z})};
+  return std::sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+
+// The errors grow with the level, so the first one over the limit ends the search
+auto SelectLod(std::span<PoolLod const> const lods, float const distance, float const instance_scale,
+               LodSelection const& lod_selection) -> std::uint32_t {
+  std::uint32_t selected{0};
+
+  for (std::uint32_t i{1}; i < lods.size(); i++) {
+    if (ComputeScreenSpaceError(lods[i].error, instance_scale, distance, lod_selection.lod_scale) >
+        lod_selection.max_pixel_error) {
+      break;
+    }
+
+    selected = i;
+  }
+
+  return selected;
+}
+}
+
+
+auto BuildCullingScene(ScenePools const& pools) -> CullingScene {
+  return CullingScene{
+    .bvh = BuildBvh(pools.instance_bounds),
+    .instance_bounds = pools.instance_bounds,
+    .instance_scales = pools.instance_scales,
+    .draw_instances = pools.draw_instances,
+    .lods = pools.lods,
+    .draws = pools.draws
+  };
+}
+
+
+auto CullScene(CullingScene const& scene, Frustum const& frustum, LodSelection const& lod_selection,
+               VisibleDraws& visible_draws) -> void {
+  visible_draws.visible_instances.clear();
+  CullBvh(scene.bvh, frustum, visible_draws.visible_instances);
+
+  // The traversal finds the instances in spatial order, a LOD per instance restores the draw order without sorting
+  visible_draws.instance_lods.assign(scene.draw_instances.size(), 0);
+
+  for (auto const instance_idx : visible_draws.visible_instances) {
+    visible_draws.instance_lods[instance_idx] = 1;
+  }
+
+  for (auto const& draw : scene.draws) {
+    auto const lods{std::span{scene.lods}.subspan(draw.first_lod, draw.lod_count)};
+
+    for (auto i{draw.first_instance}; i < draw.first_instance + draw.instance_count; i++) {
+      if (visible_draws.instance_lods[i] != 0) {
+        auto const distance{ComputeDistance(scene.instance_bounds[i], lod_selection.camera_pos)};
+        auto const lod{SelectLod(lods, distance, scene.instance_scales[i], lod_selection)};
+        visible_draws.instance_lods[i] = static_cast<std::uint8_t>(lod + 1);
+      }
+    }
+  }
+
+  visible_draws.draw_instances.clear();
+  visible_draws.draws.clear();
+
+  for (auto const& draw : scene.draws) {
+    for (auto lod{0u}; lod < draw.lod_count; lod++) {
+      auto const first_instance{static_cast<std::uint32_t>(visible_draws.draw_instances.size())};
+
+      for (auto i{draw.first_instance}; i < draw.first_instance + draw.instance_count; i++) {
+        if (visible_draws.instance_lods[i] == lod + 1) {
+          visible_draws.draw_instances.push_back(scene.draw_instances[i]);
+        }
+      }
+
+      auto const instance_count{static_cast<std::uint32_t>(visible_draws.draw_instances.size()) - first_instance};
+
+      if (instance_count > 0) {
+        auto const& pool_lod{scene.lods[draw.first_lod + lod]};
+        auto visible_draw{draw};
+        visible_draw.index_count = pool_lod.index_count;
+        visible_draw.first_index = pool_lod.first_index;
+        visible_draw.first_instance = first_instance;
+        visible_draw.instance_count = instance_count;
+        visible_draws.draws.push_back(visible_draw);
+      }
+    }
+  }
+}
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <DirectXMath.h>
+
+#include "bvh.hpp"
+#include "frustum.hpp"
+#include "mesh_lod.hpp"
+#include "scene_batching.hpp"
+
+namespace refl {
+// What the frame loop needs to rebuild the draw list of the pools every frame
+struct CullingScene {
+  Bvh bvh; // Over ScenePools::instance_bounds
+  std::vector<Aabb> instance_bounds;
+  std::vector<float> instance_scales;
+  std::vector<DrawInstance> draw_instances;
+  std::vector<PoolLod> lods;
+  std::vector<PoolDraw> draws;
+};
+
+// Every visible instance is drawn with the coarsest LOD whose error projects to at most max_pixel_error pixels
+struct LodSelection {
+  DirectX::XMFLOAT3 camera_pos;
+  float lod_scale; // See ComputeLodScale
+  float max_pixel_error;
+};
+
+// Output of CullScene. Kept across frames so the vectors are only allocated once.
+struct VisibleDraws {
+  std::vector<std::uint32_t> visible_instances; // Into CullingScene::draw_instances, in traversal order
+  std::vector<std::uint8_t> instance_lods; // 0 for culled instances, otherwise the index of the selected LOD plus 1
+  std::vector<DrawInstance> draw_instances; // Uploaded in place of ScenePools::draw_instances
+  // CullingScene::draws with the culled instances removed, split by the selected LOD. Empty draws are dropped.
+  std::vector<PoolDraw> draws;
+};
+
+[[nodiscard]] auto BuildCullingScene(ScenePools const& pools) -> CullingScene;
+auto CullScene(CullingScene const& scene, Frustum const& frustum, LodSelection const& lod_selection,
+               VisibleDraws& visible_draws) -> void;
+}
@@ -0,0 +1,248 @@
+#include "scene_textures.hpp"
+
+#include <stb_image.h>
+
+#include "cache.hpp"
+#include "mapped_file.hpp"
+#include "parallel.hpp"
+#include "texture_cache.hpp"
+
+import std;
+
+namespace refl {
+namespace {
+// Everything besides the file contents that influences a decoded texture. Part of the texture cache key.
+struct TextureDecodeSettings {
+  TextureUsage usage;
+  unsigned mip_generation_version;
+};
+
+
+// A file may be used with several usages, each one is cached separately
+auto GetCacheExtension(TextureUsage const usage) -> std::string_view {
+  switch (usage) {
+    case TextureUsage::BaseColor:
+      return ".base-color.refltex";
+    case TextureUsage::Roughness:
+      return ".roughness.refltex";
+    case TextureUsage::PackedRoughness:
+      return ".packed-roughness.refltex";
+    case TextureUsage::Normal:
+      return ".normal.refltex";
+  }
+
+  return ".refltex";
+}
+
+
+// Tracks the texel memory held by the pipeline across threads
+class TexelMemoryCounter {
+public:
+  auto Add(std::uint64_t const bytes) -> void {
+    auto const current{current_.fetch_add(bytes) + bytes};
+    auto peak{peak_.load()};
+
+    while (current > peak && !peak_.compare_exchange_weak(peak, current)) {}
+  }
+
+  auto Remove(std::uint64_t const bytes) -> void {
+    current_.fetch_sub(bytes);
+  }
+
+  [[nodiscard]] auto GetPeak() const -> std::uint64_t {
+    return peak_.load();
+  }
+
+private:
+  std::atomic<std::uint64_t> current_{0};
+  std::atomic<std::uint64_t> peak_{0};
+};
+
+
+auto DecodeTexture(std::span<std::byte const> const file_data, TextureUsage const usage,
+                   TexelMemoryCounter& memory) -> std::optional<TextureImage> {
+  if (file_data.size() > static_cast<std::size_t>(std::numeric_limits<int>::max())) {
+    return std::nullopt;
+  }
+
+  // Everything is expanded to RGBA so that roughness can come from any channel, grey images replicate into RGB
+  int width;
+  int height;
+  int channel_count;
+  auto const pixels{
+    stbi_load_from_memory(reinterpret_cast<stbi_uc const*>(file_data.data()), static_cast<int>(file_data.size()),
+                          &width, &height, &channel_count, 4)
+  };
+
+  if (!pixels) {
+    return std::nullopt;
+  }
+
+  auto const pixel_count{static_cast<std::size_t>(width) * static_cast<std::size_t>(height)};
+  memory.Add(pixel_count * 4);
+
+  auto image{CreateTextureImage(usage, static_cast<std::uint32_t>(width), static_cast<std::uint32_t>(height))};
+  memory.Add(image.texels.size());
+
+  if (GetTexelSize(usage) == 4) {
+    std::memcpy(image.texels.data(), pixels, pixel_count * 4);
+  } else {
+    auto const channel{usage == TextureUsage::PackedRoughness ? 1 : 0};
+
+    for (std::size_t i{0}; i < pixel_count; i++) {
+      image.texels[i] = pixels[i * 4 + channel];
+    }
+  }
+
+  stbi_image_free(pixels);
+  memory.Remove(pixel_count * 4);
+
+  GenerateMips(image);
+  return image;
+}
+
+
+enum class TextureLoadResult {
+  Failed,
+  Cached,
+  Decoded
+};
+}
+
+
+auto LoadSceneTextures(CpuScene const& scene, std::filesystem::path const& scene_file_path,
+                       unsigned const thread_count, bool const use_cache) -> SceneTextures {
+  auto const load_begin{std::chrono::steady_clock::now()};
+
+  auto const scene_dir{scene_file_path.parent_path()};
+  std::vector<std::unique_ptr<MappedFile>> files(scene.textures.size());
+  std::vector<std::uint64_t> content_hashes(scene.textures.size());
+
+  ParallelFor(scene.textures.size(), thread_count, [&](std::size_t const i) {
+    if ((files[i] = MappedFile::New(scene_dir / scene.textures[i].path))) {
+      content_hashes[i] = HashBytes(files[i]->GetData());
+    }
+  });
+
+  SceneTextures textures{.images = {}, .image_indices = {}, .stats = {}};
+  textures.image_indices.resize(scene.textures.size(), kNoTexture);
+
+  // Materials that reference the same image through different paths, such as copies of a file, share the result.
+  // Sources holds the first texture of every distinct image.
+  std::map<std::pair<std::uint64_t, TextureUsage>, std::uint32_t> unique_images;
+  std::vector<std::uint32_t> sources;
+
+  for (std::uint32_t i{0}; i < scene.textures.size(); i++) {
+    if (!files[i]) {
+      std::cerr << std::format("Failed to open texture {}.\n", scene.textures[i].path.string());
+      continue;
+    }
+
+    auto const [it, inserted]{
+      unique_images.try_emplace({content_hashes[i], scene.textures[i].usage},
+                                static_cast<std::uint32_t>(sources.size()))
+    };
+
+    if (inserted) {
+      sources.push_back(i);
+    }
+
+    textures.image_indices[i] = it->second;
+  }
+
+  auto const decode_begin{std::chrono::steady_clock::now()};
+
+  TexelMemoryCounter memory;
+  std::vector<std::optional<TextureImage>> images(sources.size());
+  std::vector<TextureLoadResult> results(sources.size(), TextureLoadResult::Failed);
+
+  // Images differ wildly in size, so they are handed out one at a time
+  ParallelFor(sources.size(), thread_count, [&](std::size_t const i) {
+    auto const& texture{scene.textures[sources[i]]};
+    auto const key{
+      HashValue(TextureDecodeSettings{.usage = texture.usage, .mip_generation_version = kMipGenerationVersion},
+                content_hashes[sources[i]])
+    };
+    auto const cache_path{
+      use_cache ? GetCacheFilePath(scene_dir / texture.path, GetCacheExtension(texture.usage)) : std::filesystem::path{}
+    };
+
+    if (use_cache && (images[i] = ReadTextureCache(cache_path, key))) {
+      memory.Add(images[i]->texels.size());
+      results[i] = TextureLoadResult::Cached;
+      return;
+    }
+
+    if (!(images[i] = DecodeTexture(files[sources[i]]->GetData(), texture.usage, memory))) {
+      return;
+    }
+
+    results[i] = TextureLoadResult::Decoded;
+
+    if (use_cache && !WriteTextureCache(cache_path, key, *images[i])) {
+      std::cerr << std::format("Failed to write texture cache {}.\n", cache_path.string());
+    }
+  });
+
+  auto const decode_end{std::chrono::steady_clock::now()};
+
+  // Compact the images that loaded and renumber the references
+  std::vector<std::uint32_t> remap(sources.size(), kNoTexture);
+
+  for (std::size_t i{0}; i < sources.size(); i++) {
+    auto& stats{textures.stats};
+
+    switch (results[i]) {
+      case TextureLoadResult::Failed:
+        std::cerr << std::format("Failed to decode texture {}.\n", scene.textures[sources[i]].path.string());
+        stats.failed_count += 1;
+        continue;
+      case TextureLoadResult::Cached:
+        stats.cached_count += 1;
+        break;
+      case TextureLoadResult::Decoded:
+        stats.decoded_count += 1;
+        stats.encoded_bytes += files[sources[i]]->GetData().size();
+        stats.decoded_pixels += static_cast<std::uint64_t>(images[i]->mips[0].width) * images[i]->mips[0].height;
+        break;
+    }
+
+    remap[i] = static_cast<std::uint32_t>(textures.images.size());
+    textures.images.push_back(std::move(*images[i]));
+  }
+
+  for (auto& image_idx : textures.image_indices) {
+    if (image_idx != kNoTexture) {
+      image_idx = remap[image_idx];
+    }
+  }
+
+  auto const load_end{std::chrono::steady_clock::now()};
+
+  textures.stats.referenced_count = scene.textures.size();
+  textures.stats.unique_count = sources.size();
+  textures.stats.peak_bytes = memory.GetPeak();
+  textures.stats.load_ms = std::chrono::duration<double, std::milli>{decode_end - decode_begin}.count();
+  textures.stats.total_ms = std::chrono::duration<double, std::milli>{load_end - load_begin}.count();
+  return textures;
+}
+
+
+auto PrintTextureLoadStats(TextureLoadStats const& stats) -> void {
+  auto constexpr bytes_per_mib{1024.0 * 1024.0};
+  auto const load_seconds{stats.load_ms / 1000.0};
+
+  std::cout << std::format("Textures: {} referenced, {} unique, {} from cache, {} decoded, {} failed in {:.2f} ms.\n",
+                           stats.referenced_count, stats.unique_count, stats.cached_count, stats.decoded_count,
+                           stats.failed_count, stats.total_ms);
+
+  if (stats.decoded_count > 0) {
+    std::cout << std::format("Decoded {:.2f} MiB of image files into {:.2f} Mpixels: {:.2f} MiB/s, {:.2f} Mpixels/s.\n",
+                             stats.encoded_bytes / bytes_per_mib, stats.decoded_pixels / 1e6,
+                             stats.encoded_bytes / bytes_per_mib / load_seconds,
+                             stats.decoded_pixels / 1e6 / load_seconds);
+  }
+
+  std::cout << std::format("Peak texel memory: {:.2f} MiB.\n", stats.peak_bytes / bytes_per_mib);
+}
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+#include "scene.hpp"
+#include "texture_image.hpp"
+
+namespace refl {
+struct TextureLoadStats {
+  std::size_t referenced_count; // CpuScene::textures
+  std::size_t unique_count; // Distinct file contents per usage
+  std::size_t cached_count;
+  std::size_t decoded_count;
+  std::size_t failed_count;
+  std::uint64_t encoded_bytes; // Size of the image files that were decoded
+  std::uint64_t decoded_pixels; // Top level pixels of the decoded images
+  // Most texel memory alive at once: stb_image's output, the mip chains in flight and the finished images
+  std::uint64_t peak_bytes;
+  double load_ms; // Decoding, mip generation and cache traffic, after the files are hashed
+  double total_ms;
+};
+
+struct SceneTextures {
+  std::vector<TextureImage> images;
+  std::vector<std::uint32_t> image_indices; // Into images per CpuScene::textures, kNoTexture if loading failed
+  TextureLoadStats stats;
+};
+
+// Resolves the textures relative to the directory of the scene file and loads every distinct file content once per
+// usage on thread_count threads. Images missing from the on-disk cache are decoded with stb_image, mipmapped and
+// written back to the cache. Without use_cache every image is decoded and the cache is left alone.
+[[nodiscard]] auto LoadSceneTextures(CpuScene const& scene, std::filesystem::path const& scene_file_path,
+                                     unsigned thread_count, bool use_cache) -> SceneTextures;
+auto PrintTextureLoadStats(TextureLoadStats const& stats) -> void;
+}
@@ -1,23 +1,27 @@
 #include "shader_collection.hpp"
 
 #ifndef NDEBUG
-#include "shaders/generated/Debug/env_prefilter_cs.h"
-#include "shaders/generated/Debug/equirect_to_cube.h"
+#include "shaders/generated/Debug/gbuffer_float_vs.h"
 #include "shaders/generated/Debug/gbuffer_ps.h"
 #include "shaders/generated/Debug/gbuffer_vs.h"
+#include "shaders/generated/Debug/hiz_cs.h"
 #include "shaders/generated/Debug/lighting_ps.h"
 #include "shaders/generated/Debug/lighting_vs.h"
 #include "shaders/generated/Debug/ssr_cs.h"
+#include "shaders/generated/Debug/ssr_temporal_cs.h"
+#include "shaders/generated/Debug/ssr_upsample_cs.h"
 #include "shaders/generated/Debug/tonemapping_ps.h"
 #include "shaders/generated/Debug/tonemapping_vs.h"
 #else
-#include "shaders/generated/Release/env_prefilter_cs.h"
-#include "shaders/generated/Release/equirect_to_cube.h"
+#include "shaders/generated/Release/gbuffer_float_vs.h"
 #include "shaders/generated/Release/gbuffer_ps.h"
 #include "shaders/generated/Release/gbuffer_vs.h"
+#include "shaders/generated/Release/hiz_cs.h"
 #include "shaders/generated/Release/lighting_ps.h"
 #include "shaders/generated/Release/lighting_vs.h"
 #include "shaders/generated/Release/ssr_cs.h"
+#include "shaders/generated/Release/ssr_temporal_cs.h"
+#include "shaders/generated/Release/ssr_upsample_cs.h"
 #include "shaders/generated/Release/tonemapping_ps.h"
 #include "shaders/generated/Release/tonemapping_vs.h"
 #endif
@@ -58,6 +62,12 @@ auto LoadShaders(ID3D11Device5& dev) -> std::optional<ShaderCollection> {
     return std::nullopt;
   }
 
+  if (FAILED(dev.CreateVertexShader(
+    g_gbuffer_float_vs_bytes, ARRAYSIZE(g_gbuffer_float_vs_bytes), nullptr,
+    &shaders.gbuffer_float_vs))) {
+    return std::nullopt;
+  }
+
   if (FAILED(dev.CreatePixelShader(
     g_gbuffer_ps_bytes, ARRAYSIZE(g_gbuffer_ps_bytes), nullptr,
     &shaders.gbuffer_ps))) {
@@ -65,24 +75,88 @@ auto LoadShaders(ID3D11Device5& dev) -> std::optional<ShaderCollection> {
   }
 
   if (FAILED(dev.CreateComputeShader(
-    g_equirect_to_cube_bytes, ARRAYSIZE(g_equirect_to_cube_bytes), nullptr,
-    &shaders.equirect_to_cubemap_cs))) {
+    g_hiz_cs_bytes, ARRAYSIZE(g_hiz_cs_bytes), nullptr,
+    &shaders.hiz_cs))) {
     return std::nullopt;
   }
 
   if (FAILED(dev.CreateComputeShader(
-    g_env_prefilter_cs_bytes, ARRAYSIZE(g_env_prefilter_cs_bytes), nullptr,
-    &shaders.env_prefilter_cs))) {
+    g_ssr_cs_bytes, ARRAYSIZE(g_ssr_cs_bytes), nullptr,
+    &shaders.ssr_cs))) {
     return std::nullopt;
   }
 
   if (FAILED(dev.CreateComputeShader(
-    g_ssr_cs_bytes, ARRAYSIZE(g_ssr_cs_bytes), nullptr,
-    &shaders.ssr_cs))) {
+    g_ssr_upsample_cs_bytes, ARRAYSIZE(g_ssr_upsample_cs_bytes), nullptr,
+    &shaders.ssr_upsample_cs))) {
     return std::nullopt;
   }
 
+  if (FAILED(dev.CreateComputeShader(
+    g_ssr_temporal_cs_bytes, ARRAYSIZE(g_ssr_temporal_cs_bytes), nullptr,
+    &shaders.ssr_temporal_cs))) {
+    return std::nullopt;
+  }
+
+  // Packed vertex layout, see vertex_packing.hpp
   std::array constexpr input_elements{
+    D3D11_INPUT_ELEMENT_DESC{
+      .SemanticName = "POSITION",
+      .SemanticIndex = 0,
+      .Format = DXGI_FORMAT_R16G16B16A16_UNORM,
+      .InputSlot = 0,
+      .AlignedByteOffset = 0,
+      .InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA,
+      .InstanceDataStepRate = 0
+    },
+    D3D11_INPUT_ELEMENT_DESC{
+      .SemanticName = "NORMAL",
+      .SemanticIndex = 0,
+      .Format = DXGI_FORMAT_R16G16_SNORM,
+      .InputSlot = 1,
+      .AlignedByteOffset = 0,
+      .InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA,
+      .InstanceDataStepRate = 0
+    },
+    D3D11_INPUT_ELEMENT_DESC{
+      .SemanticName = "TEXCOORD",
+      .SemanticIndex = 0,
+      .Format = DXGI_FORMAT_R16G16_FLOAT,
+      .InputSlot = 2,
+      .AlignedByteOffset = 0,
+      .InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA,
+      .InstanceDataStepRate = 0
+    },
+    D3D11_INPUT_ELEMENT_DESC{
+      .SemanticName = "TANGENT",
+      .SemanticIndex = 0,
+      .Format = DXGI_FORMAT_R32_UINT,
+      .InputSlot = 3,
+      .AlignedByteOffset = 0,
+      .InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA,
+      .InstanceDataStepRate = 0
+    },
+    // Per-instance DrawInstance, see scene_batching.hpp
+    D3D11_INPUT_ELEMENT_DESC{
+      .SemanticName = "DRAW_INSTANCE",
+      .SemanticIndex = 0,
+      .Format = DXGI_FORMAT_R32G32_UINT,
+      .InputSlot = 4,
+      .AlignedByteOffset = 0,
+      .InputSlotClass = D3D11_INPUT_PER_INSTANCE_DATA,
+      .InstanceDataStepRate = 1
+    },
+  };
+
+  if (FAILED(dev.CreateInputLayout(
+    input_elements.data(), static_cast<UINT>(input_elements.size()),
+    g_gbuffer_vs_bytes, ARRAYSIZE(g_gbuffer_vs_bytes),
+    &shaders.mesh_il))) {
+    return std::nullopt;
+  }
+
+  // VertexLayout::kFloat, the CpuMesh streams with w padding
+  std::array constexpr float_input_elements{
     D3D11_INPUT_ELEMENT_DESC{
       .SemanticName = "POSITION",
       .SemanticIndex = 0,
@@ -119,12 +193,13 @@ auto LoadShaders(ID3D11Device5& dev) -> std::optional<ShaderCollection> {
       .InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA,
       .InstanceDataStepRate = 0
     },
+    input_elements.back() // DRAW_INSTANCE
   };
 
   if (FAILED(dev.CreateInputLayout(
-    input_elements.data(), static_cast<UINT>(input_elements.size()),
-    g_gbuffer_vs_bytes, ARRAYSIZE(g_gbuffer_vs_bytes),
-    &shaders.mesh_il))) {
+    float_input_elements.data(), static_cast<UINT>(float_input_elements.size()),
+    g_gbuffer_float_vs_bytes, ARRAYSIZE(g_gbuffer_float_vs_bytes),
+    &shaders.mesh_float_il))) {
     return std::nullopt;
   }
 
@@ -11,16 +11,19 @@
 namespace refl {
 struct ShaderCollection {
 	Microsoft::WRL::ComPtr<ID3D11VertexShader> gbuffer_vs;
+  Microsoft::WRL::ComPtr<ID3D11VertexShader> gbuffer_float_vs; // VertexLayout::kFloat
 	Microsoft::WRL::ComPtr<ID3D11PixelShader> gbuffer_ps;
   Microsoft::WRL::ComPtr<ID3D11VertexShader> lighting_vs;
   Microsoft::WRL::ComPtr<ID3D11PixelShader> lighting_ps;
   Microsoft::WRL::ComPtr<ID3D11VertexShader> tonemapping_vs;
   Microsoft::WRL::ComPtr<ID3D11PixelShader> tonemapping_ps;
-	Microsoft::WRL::ComPtr<ID3D11ComputeShader> equirect_to_cubemap_cs;
-  Microsoft::WRL::ComPtr<ID3D11ComputeShader> env_prefilter_cs;
+  Microsoft::WRL::ComPtr<ID3D11ComputeShader> hiz_cs;
   Microsoft::WRL::ComPtr<ID3D11ComputeShader> ssr_cs;
+  Microsoft::WRL::ComPtr<ID3D11ComputeShader> ssr_upsample_cs;
+  Microsoft::WRL::ComPtr<ID3D11ComputeShader> ssr_temporal_cs;
 
   Microsoft::WRL::ComPtr<ID3D11InputLayout> mesh_il;
+  Microsoft::WRL::ComPtr<ID3D11InputLayout> mesh_float_il; // VertexLayout::kFloat
 };
 
 
@@ -11,6 +11,12 @@ float2 NdcToUv(const float3 ndc) {
   return ndc.xy * float2(0.5, -0.5) + float2(0.5, 0.5);
 }
 
+// Position the inverse of a projection maps the NDC of uv at an NDC depth back to
+float3 UvToPos(const float2 uv, const float ndc_depth, const row_major float4x4 proj_inv_mtx) {
+  const float4 pos4 = mul(float4(UvToNdc(uv), ndc_depth, 1.0), proj_inv_mtx);
+  return pos4.xyz / pos4.w;
+}
+
 float NdcToViewDepth(const float ndc_depth, const float near_clip, const float far_clip) {
   return (near_clip * far_clip) / (far_clip - ndc_depth * (far_clip - near_clip));
 }
@@ -1 +0,0 @@
-#include "../env_prefilter.hlsli"
\ No newline at end of file
@@ -1 +0,0 @@
-#include "../equirect_to_cube.hlsli"
@@ -0,0 +1,2 @@
+#define FLOAT_VERTICES
+#include "../gbuffer.hlsli"
\ No newline at end of file
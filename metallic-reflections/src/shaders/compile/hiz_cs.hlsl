@@ -0,0 +1 @@
+#include "../hiz.hlsli"
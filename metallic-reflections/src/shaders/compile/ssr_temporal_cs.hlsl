@@ -0,0 +1 @@
+#include "../ssr_temporal.hlsli"
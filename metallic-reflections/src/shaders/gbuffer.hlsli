@@ -5,34 +5,39 @@
 
 #include "resource_binding_helpers.hlsli"
 #include "shader_interop.h"
-
-cbuffer g_object_cb : register(MAKE_REGISTER(b, OBJECT_CB_SLOT)) {
-  ObjectConstants g_object_cb;
-}
-
+#include "vertex_packing.hlsli"
 
 cbuffer g_camera_cb : register(MAKE_REGISTER(b, CAMERA_CB_SLOT)) {
   CameraConstants g_camera_cb;
 }
 
 
-cbuffer g_material_cb : register(MAKE_REGISTER(b, MATERIAL_CB_SLOT)) {
-  Material g_material;
-}
-
-
 Texture2D<float3> g_base_color_map : register(MAKE_REGISTER(t, MATERIAL_BASE_COLOR_MAP_SLOT));
 Texture2D<float> g_roughness_map : register(MAKE_REGISTER(t, MATERIAL_ROUGHNESS_MAP_SLOT));
 Texture2D<float3> g_normal_map : register(MAKE_REGISTER(t, MATERIAL_NORMAL_MAP_SLOT));
+StructuredBuffer<Material> g_materials : register(MAKE_REGISTER(t, MATERIAL_BUFFER_SLOT));
 SamplerState g_sampler : register(MAKE_REGISTER(s, MATERIAL_SAMPLER_SLOT));
 
+StructuredBuffer<InstanceTransform> g_instance_transforms : register(MAKE_REGISTER(t, INSTANCE_TRANSFORM_BUFFER_SLOT));
+
 
+#ifdef FLOAT_VERTICES
 struct VsIn {
   float3 pos_os : POSITION;
   float3 norm_os : NORMAL;
-  float3 tan_os : TANGENT;
+  float4 tan_os : TANGENT; // w is handedness
   float2 uv : TEXCOORD;
+  uint2 draw_instance : DRAW_INSTANCE; // Transform and material index
 };
+#else
+struct VsIn {
+  float3 pos_os : POSITION; // [0, 1] within the mesh AABB
+  float2 norm_oct : NORMAL;
+  uint tan_packed : TANGENT;
+  float2 uv : TEXCOORD;
+  uint2 draw_instance : DRAW_INSTANCE; // Transform and material index
+};
+#endif
 
 
 struct PsIn {
@@ -41,30 +46,43 @@ struct PsIn {
   float3 norm_ws : NORMAL;
   float4 tan_ws : TANGENT;
   float2 uv : TEXCOORD;
+  nointerpolation uint mtl_idx : MATERIAL_INDEX;
 };
 
 
 PsIn VsMain(const VsIn vs_in) {
+  const InstanceTransform transform = g_instance_transforms[vs_in.draw_instance.x];
+
   PsIn ret;
-  ret.pos_ws = mul(float4(vs_in.pos_os, 1), g_object_cb.world_mtx).xyz;
-  ret.norm_ws = mul(float4(vs_in.norm_os, 0), g_object_cb.normal_mtx).xyz;
-  ret.tan_ws = float4(mul(float4(vs_in.tan_os, 0), g_object_cb.normal_mtx).xyz, 1); // w is handedness
+  ret.pos_ws = mul(float4(vs_in.pos_os, 1), transform.world_mtx).xyz;
+#ifdef FLOAT_VERTICES
+  const float3 norm_os = vs_in.norm_os;
+  const float4 tan_os = vs_in.tan_os;
+#else
+  const float3 norm_os = UnpackNormal(vs_in.norm_oct);
+  const float4 tan_os = UnpackTangent(vs_in.tan_packed);
+#endif
+  ret.norm_ws = mul(float4(norm_os, 0), transform.normal_mtx).xyz;
+  ret.tan_ws = float4(mul(float4(tan_os.xyz, 0), transform.normal_mtx).xyz, tan_os.w); // w is handedness
   ret.pos_cs = mul(float4(ret.pos_ws, 1), g_camera_cb.view_proj_mtx);
   ret.uv = vs_in.uv;
+  ret.mtl_idx = vs_in.draw_instance.y;
   return ret;
 }
 
 
 void PsMain(const PsIn ps_in, out float4 gbuffer0 : SV_Target0, out float3 gbuffer1 : SV_Target1) {
-  gbuffer0.rgb = g_material.has_base_color_map
-                   ? g_material.base_color * g_base_color_map.Sample(g_sampler, ps_in.uv).rgb
-                   : g_material.base_color;
+  const Material mtl = g_materials[ps_in.mtl_idx];
+
+  gbuffer0.rgb = mtl.has_base_color_map
+                   ? mtl.base_color * g_base_color_map.Sample(g_sampler, ps_in.uv).rgb
+                   : mtl.base_color;
 
-  gbuffer0.a = g_material.has_roughness_map
-                 ? g_material.roughness * g_roughness_map.Sample(g_sampler, ps_in.uv).r
-                 : g_material.roughness;
+  gbuffer0.a = mtl.has_roughness_map
+                 ? mtl.roughness * g_roughness_map.Sample(g_sampler, ps_in.uv).r
+                 : mtl.roughness;
 
-  if (g_material.has_normal_map) {
+  if (mtl.has_normal_map) {
     const float3 normal_ws = normalize(ps_in.norm_ws);
     const float3 tangent_ws = normalize(ps_in.tan_ws.xyz - normal_ws * dot(normal_ws, ps_in.tan_ws.xyz));
     const float3 bitangent_ws = cross(normal_ws, tangent_ws) * ps_in.tan_ws.w; // w is handedness
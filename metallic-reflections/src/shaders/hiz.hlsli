@@ -0,0 +1,56 @@
+// ReSharper disable CppEnforceCVQualifiersPlacement
+
+#ifndef HIZ_HLSLI
+#define HIZ_HLSLI
+
+#include "change_of_basis.hlsli"
+#include "resource_binding_helpers.hlsli"
+#include "shader_interop.h"
+
+cbuffer CameraCbuffer : register(MAKE_REGISTER(b, HIZ_CAM_CB_SLOT)) {
+  CameraConstants g_cam_constants;
+}
+
+cbuffer Constants : register(MAKE_REGISTER(b, HIZ_CB_SLOT)) {
+  HiZConstants g_constants;
+}
+
+Texture2D<float> g_depth_tex : register(MAKE_REGISTER(t, HIZ_DEPTH_SRV_SLOT)); // Read for mip 0
+Texture2D<float2> g_src_mip : register(MAKE_REGISTER(t, HIZ_SRC_SRV_SLOT)); // The mip above, read for the others
+RWTexture2D<float2> g_dst_mip : register(MAKE_REGISTER(u, HIZ_DST_UAV_SLOT)); // Min and max linear view depth
+
+[numthreads(HIZ_THREADS_X, HIZ_THREADS_Y, 1)]
+void CsMain(const uint3 dtid : SV_DispatchThreadID) {
+  uint2 dst_size;
+  g_dst_mip.GetDimensions(dst_size.x, dst_size.y);
+
+  if (dtid.x >= dst_size.x || dtid.y >= dst_size.y) {
+    return;
+  }
+
+  if (g_constants.cur_mip == 0) {
+    const float depth_vs = NdcToViewDepth(g_depth_tex[dtid.xy], g_cam_constants.near_clip, g_cam_constants.far_clip);
+    g_dst_mip[dtid.xy] = float2(depth_vs, depth_vs);
+    return;
+  }
+
+  uint2 src_size;
+  g_src_mip.GetDimensions(src_size.x, src_size.y);
+
+  // The last column and row also take the odd column and row of the mip above that halving drops
+  const uint2 src_end = uint2(dtid.x == dst_size.x - 1 ? src_size.x : 2 * dtid.x + 2,
+                              dtid.y == dst_size.y - 1 ? src_size.y : 2 * dtid.y + 2);
+
+  float2 min_max = float2(1.#INF, -1.#INF);
+
+  for (uint y = 2 * dtid.y; y < src_end.y; y++) {
+    for (uint x = 2 * dtid.x; x < src_end.x; x++) {
+      const float2 texel = g_src_mip[uint2(x, y)];
+      min_max = float2(min(min_max.x, texel.x), max(min_max.y, texel.y));
+    }
+  }
+
+  g_dst_mip[dtid.xy] = min_max;
+}
+
+#endif
@@ -10,10 +10,15 @@ cbuffer CamCbuffer : register(MAKE_REGISTER(b, LIGHTING_CAM_CB_SLOT)) {
   CameraConstants g_cam_constants;
 }
 
+cbuffer EnvCbuffer : register(MAKE_REGISTER(b, LIGHTING_ENV_CB_SLOT)) {
+  EnvironmentConstants g_env_constants;
+}
+
 Texture2D g_gbuffer0 : register(MAKE_REGISTER(t, LIGHTING_GBUFFER0_SRV_SLOT));
 Texture2D g_gbuffer1 : register(MAKE_REGISTER(t, LIGHTING_GBUFFER1_SRV_SLOT));
 Texture2D g_depth_tex : register(MAKE_REGISTER(t, LIGHTING_DEPTH_SRV_SLOT));
 TextureCube g_env_map : register(MAKE_REGISTER(t, LIGHTING_ENV_MAP_SRV_SLOT));
+Texture2D<float2> g_dfg_lut : register(MAKE_REGISTER(t, LIGHTING_DFG_LUT_SRV_SLOT)); // Split-sum scale and bias of F0
 SamplerState g_gbuffer_samp : register(MAKE_REGISTER(s, LIGHTING_GBUFFER_SAMPLER_SLOT));
 SamplerState g_env_samp : register(MAKE_REGISTER(s, LIGHTING_ENV_SAMPLER_SLOT));
 
@@ -27,6 +32,21 @@ float3 ReconstructWorldDir(float2 uv) {
 }
 
 
+// Radiance a white Lambertian surface reflects from the environment, from spherical harmonics that already include the
+// cosine convolution
+float3 EvaluateIrradianceSh(float3 n) {
+  return g_env_constants.sh_coeffs[0].rgb +
+         g_env_constants.sh_coeffs[1].rgb * n.x +
+         g_env_constants.sh_coeffs[2].rgb * n.y +
+         g_env_constants.sh_coeffs[3].rgb * n.z +
+         g_env_constants.sh_coeffs[4].rgb * (n.x * n.y) +
+         g_env_constants.sh_coeffs[5].rgb * (n.y * n.z) +
+         g_env_constants.sh_coeffs[6].rgb * (3 * n.y * n.y - 1) +
+         g_env_constants.sh_coeffs[7].rgb * (n.x * n.z) +
+         g_env_constants.sh_coeffs[8].rgb * (n.z * n.z - n.x * n.x);
+}
+
+
 struct PsIn {
   float4 pos_os : SV_Position;
   float2 uv : TEXCOORD;
@@ -61,13 +81,18 @@ float4 PsMain(const PsIn ps_in) : SV_Target {
   const float3 V = normalize(g_cam_constants.pos_ws - pos_ws);
   const float3 R = reflect(-V, normal_ws);
 
-  float3 env_map_size; // width, height, mips
-  g_env_map.GetDimensions(0, env_map_size.x, env_map_size.y, env_map_size.z);
-
-  const float env_mip = roughness * clamp(roughness * env_map_size.z - 1, 0, env_map_size.z - 1);
+  // The texture only holds the mips the roughness of the scene reaches, so the mip count is that of the full chain
+  const float env_mip_count = g_env_constants.prefiltered_mip_count;
+  const float env_mip = roughness * clamp(roughness * env_mip_count - 1, 0, env_mip_count - 1);
   const float3 env = g_env_map.SampleLevel(g_env_samp, R, env_mip).rgb;
-  const float3 F = FresnelSchlick(dot(normal_ws, V), base_color);
+  const float2 dfg = g_dfg_lut.SampleLevel(g_env_samp, float2(saturate(dot(normal_ws, V)), roughness), 0);
+
+  const float3 specular_albedo = base_color * dfg.x + dfg.y;
+
+  // Materials have no metalness, so the light the specular lobe does not reflect is scattered diffusely with the base
+  // color as albedo
+  const float3 diffuse = (1 - specular_albedo) * base_color * EvaluateIrradianceSh(normal_ws);
 
-  const float3 final_color = env * F;
+  const float3 final_color = env * specular_albedo + diffuse;
   return float4(final_color, 1);
 }
@@ -5,6 +5,8 @@
 #ifndef RAY_MARCH_HLSLI
 #define RAY_MARCH_HLSLI
 
+#include "change_of_basis.hlsli"
+
 inline void Swap(inout float a, inout float b) {
   float t = a;
   a = b;
@@ -17,43 +19,125 @@ inline float DistanceSquared(float2 A, float2 B) {
   return dot(D, D);
 }
 
+
+// Jimenez, Next Generation Post Processing in Call of Duty: Advanced Warfare, SIGGRAPH 2014
+inline float InterleavedGradientNoise(uint2 pixel) {
+  return frac(52.9829189 * frac(0.06711056 * float(pixel.x) + 0.00583715 * float(pixel.y)));
+}
+
+
+// Ray projected to pixels. Points along it are given in strides from the start. The axis the ray moves faster along on
+// screen is the major one, which advances by exactly one stride per stride.
+struct PixelRay {
+  float2 pixelStart; // Major, minor
+  float2 dPixel;
+  float homogZ; // View depth divided by clip space w, which is linear in pixels unlike view depth
+  float dHomogZ;
+  float invW;
+  float dInvW;
+  float end; // Strides to the end of the ray
+  bool permuteXY; // Whether the major axis is y
+};
+
+
+struct PixelRaySample {
+  bool onScreen;
+  bool hit;
+  uint2 pixel;
+};
+
+
+/**
+  Tests the pixel t strides along the ray against the part of the ray from t - halfWidth to t + halfWidth strides.
+  It hits if the view depth of that part comes within vsDepthThickness of the depth of the pixel.
+*/
+PixelRaySample SamplePixelRay(
+  PixelRay ray,
+  Texture2D<float> zBuffer,
+  uint2 zBufferSize,
+  float vsDepthThickness,
+  float nearPlaneZ,
+  float farPlaneZ,
+  float t,
+  float halfWidth) {
+  PixelRaySample sample;
+  sample.hit = false;
+  sample.pixel = uint2(0, 0);
+
+  float2 pixelPos = ray.pixelStart + ray.dPixel * t;
+  if (ray.permuteXY) {
+    pixelPos = pixelPos.yx;
+  }
+
+  sample.onScreen = all(pixelPos >= 0.0) && all(pixelPos < float2(zBufferSize));
+  if (!sample.onScreen) {
+    return sample;
+  }
+
+  sample.pixel = uint2(pixelPos);
+
+  float tFirst = clamp(t - halfWidth, 0.0, ray.end);
+  float tLast = clamp(t + halfWidth, 0.0, ray.end);
+  float vsRayZMin = (ray.homogZ + ray.dHomogZ * tFirst) / (ray.invW + ray.dInvW * tFirst);
+  float vsRayZMax = (ray.homogZ + ray.dHomogZ * tLast) / (ray.invW + ray.dInvW * tLast);
+  if (vsRayZMin > vsRayZMax) {
+    Swap(vsRayZMin, vsRayZMax);
+  }
+
+  float vsSceneDepth = NdcToViewDepth(zBuffer.Load(int3(sample.pixel, 0)), nearPlaneZ, farPlaneZ);
+  sample.hit = (vsRayZMax - vsSceneDepth > -vsDepthThickness) && (vsRayZMin - vsSceneDepth < vsDepthThickness);
+  return sample;
+}
+
 /**
-  Native left-handed view-space ray trace (single layer, row-major, minimized).
+  Native left-handed view-space ray trace (single layer, row-major, minimized), with binary search refinement.
 
-  Returns true if the ray intersects any pixel depth voxel.
+  Returns true if the ray intersects any pixel depth voxel. Steps through the pixels the ray covers a stride at a time.
+  Once a stride hits it is halved, the first half tested and the second one if the first misses, and the hit pixel is
+  the last one that passed. MarchDda of ssr.cpp is the CPU port.
 
   Parameters:
-    vsRayOrigin        View-space origin (+Z forward).
+    vsRayOrigin        View-space origin (+Z forward), at least nearPlaneZ deep.
     vsRayDirection     Unit view-space direction.
     viewToPixelMatrix  Row-major matrix mapping view space to pixel space.
-    vsZBuffer          Depth texture storing either linear positive z or hyperbolic depth.
-    vsDepthThickness   Voxel thickness along +Z for each pixel.
-    zBufferIsHyperbolic If true, call ReconstructCSZ for positive z.
+    zBuffer            Depth texture storing hyperbolic depth.
+    vsDepthThickness   Distance along Z within which the ray hits the depth of a pixel, from either side.
     nearPlaneZ         > 0 near plane (z = nearPlaneZ).
     farPlaneZ          > 0 far plane.
     pixelStride        Pixel step size (>= 1).
     jitterFraction     Fractional stride offset (0..1) for banding reduction.
-    maxSteps           Max pixel iterations.
+    maxSteps           Max stride iterations.
+    refineSteps        Times the stride that hit is halved.
     maxTraceDistance   Max linear distance along the ray.
   Outputs:
-    hitPixel           First intersected pixel or (-1,-1) on miss.
-    vsHitPoint         View-space hit position (undefined if miss).
+    hitPixel           First intersected pixel or (0,0) on miss.
+    stepCount          Depth tests taken, refinement included.
 */
 bool MarchRay(
   float3 vsRayOrigin,
   float3 vsRayDirection,
   row_major float4x4 viewToPixelMatrix,
-  Texture2D<float> vsZBuffer,
+  Texture2D<float> zBuffer,
   float vsDepthThickness,
-  bool zBufferIsHyperbolic,
   float nearPlaneZ,
   float farPlaneZ,
   float pixelStride,
   float jitterFraction,
-  float maxSteps,
+  uint maxSteps,
+  uint refineSteps,
   float maxTraceDistance,
-  out float2 hitPixel,
-  out float3 vsHitPoint) {
+  out uint2 hitPixel,
+  out uint stepCount) {
+  hitPixel = uint2(0, 0);
+  stepCount = 0;
+
+  if (vsRayOrigin.z < nearPlaneZ) {
+    return false;
+  }
+
+  uint2 zBufferSize;
+  zBuffer.GetDimensions(zBufferSize.x, zBufferSize.y);
+
   // Clip backward ray against near plane
   float endZCandidate = vsRayOrigin.z + vsRayDirection.z * maxTraceDistance;
   float rayLength = maxTraceDistance;
@@ -69,92 +153,81 @@ bool MarchRay(
   float invW0 = 1.0 / H0.w;
   float invW1 = 1.0 / H1.w;
 
-  float3 vsHomogRayStart = vsRayOrigin * invW0;
-  float3 vsHomogRayEnd = vsRayEndPoint * invW1;
-
   float2 pixelStart = H0.xy * invW0;
   float2 pixelEnd = H1.xy * invW1;
 
-  hitPixel = float2(-1.0, -1.0);
-
   // Ensure non-degenerate extent
   if (DistanceSquared(pixelStart, pixelEnd) < 0.0001) {
     pixelEnd.x += 0.01;
   }
 
   float2 pixelDelta = pixelEnd - pixelStart;
-  bool permuteXY = false;
-  if (abs(pixelDelta.x) < abs(pixelDelta.y)) {
-    permuteXY = true;
+
+  PixelRay ray;
+  ray.permuteXY = abs(pixelDelta.x) < abs(pixelDelta.y);
+  if (ray.permuteXY) {
     pixelDelta = pixelDelta.yx;
     pixelStart = pixelStart.yx;
-    pixelEnd = pixelEnd.yx;
   }
 
   float stepDir = (pixelDelta.x >= 0.0) ? 1.0 : -1.0;
-  float invdx = stepDir / pixelDelta.x;
-
-  float2 dPixel = float2(stepDir, invdx * pixelDelta.y);
-  float3 dHomogRay = (vsHomogRayEnd - vsHomogRayStart) * invdx;
-  float dInvW = (invW1 - invW0) * invdx;
-
-  dPixel *= pixelStride;
-  dHomogRay *= pixelStride;
-  dInvW *= pixelStride;
-
-  pixelStart += dPixel * jitterFraction;
-  vsHomogRayStart += dHomogRay * jitterFraction;
-  invW0 += dInvW * jitterFraction;
-
-  float3 vsHomogRayPoint = vsHomogRayStart;
-  float invW = invW0;
-
-  float prevRayZMaxEstimate = vsRayOrigin.z;
-  float stepCount = 0.0;
-  float vsRayZMax = prevRayZMaxEstimate;
-  float vsRayZMin = prevRayZMaxEstimate;
-
-  float vsSceneDepth = 1e30; // Large initial depth
-  float end = pixelEnd.x * stepDir;
-
-  for (float2 pixelPos = pixelStart;
-       (pixelPos.x * stepDir) <= end &&
-       (stepCount < maxSteps) &&
-       (vsSceneDepth != 0.0);
-       pixelPos += dPixel, vsHomogRayPoint.z += dHomogRay.z, invW += dInvW, stepCount += 1.0) {
-    hitPixel = permuteXY ? pixelPos.yx : pixelPos;
-
-    vsRayZMin = prevRayZMaxEstimate;
-    vsRayZMax = (dHomogRay.z * 0.5 + vsHomogRayPoint.z) / (dInvW * 0.5 + invW);
-    prevRayZMaxEstimate = vsRayZMax;
-    if (vsRayZMin > vsRayZMax) {
-      Swap(vsRayZMin, vsRayZMax);
+  float invdx = stepDir / pixelDelta.x * pixelStride;
+
+  ray.pixelStart = pixelStart;
+  ray.dPixel = float2(stepDir * pixelStride, pixelDelta.y * invdx);
+  ray.homogZ = vsRayOrigin.z * invW0;
+  ray.dHomogZ = (vsRayEndPoint.z * invW1 - vsRayOrigin.z * invW0) * invdx;
+  ray.invW = invW0;
+  ray.dInvW = (invW1 - invW0) * invdx;
+  ray.end = abs(pixelDelta.x) / pixelStride;
+
+  for (uint i = 0; i < maxSteps; i++) {
+    float t = float(i) + jitterFraction;
+    if (t > ray.end) {
+      break;
     }
 
-    int2 ipixel = int2(hitPixel);
-    vsSceneDepth = vsZBuffer.Load(int3(ipixel, 0));
+    stepCount += 1;
+    PixelRaySample sample = SamplePixelRay(ray, zBuffer, zBufferSize, vsDepthThickness, nearPlaneZ, farPlaneZ, t, 0.5);
+    if (!sample.onScreen) {
+      break;
+    }
 
-    if (zBufferIsHyperbolic) {
-      vsSceneDepth = NdcToViewDepth(vsSceneDepth, nearPlaneZ, farPlaneZ); // Expect positive z
-      // If ReconstructCSZ returns negative z, uncomment:
-      // vsSceneDepth = -vsSceneDepth;
+    if (!sample.hit) {
+      continue;
     }
 
-    float vsVoxelZMin = vsSceneDepth - vsDepthThickness;
-    if ((vsRayZMax >= vsVoxelZMin) && (vsRayZMin <= vsSceneDepth)) {
+    hitPixel = sample.pixel;
+    float halfWidth = 0.5;
+
+    for (uint j = 0; j < refineSteps; j++) {
+      halfWidth *= 0.5;
+      stepCount += 1;
+      PixelRaySample first = SamplePixelRay(ray, zBuffer, zBufferSize, vsDepthThickness, nearPlaneZ, farPlaneZ,
+                                            t - halfWidth, halfWidth);
+      if (first.hit) {
+        t -= halfWidth;
+        hitPixel = first.pixel;
+        continue;
+      }
+
+      stepCount += 1;
+      PixelRaySample second = SamplePixelRay(ray, zBuffer, zBufferSize, vsDepthThickness, nearPlaneZ, farPlaneZ,
+                                             t + halfWidth, halfWidth);
+      if (second.hit) {
+        t += halfWidth;
+        hitPixel = second.pixel;
+        continue;
+      }
+
+      // The ray hit across the boundary of two pixels
       break;
     }
-  }
 
-  vsHomogRayPoint.xy += dHomogRay.xy * stepCount;
-  vsHitPoint = vsHomogRayPoint * (1.0 / invW);
-
-  float vsVoxelZMinFinal = vsSceneDepth - vsDepthThickness;
-  bool hit = (vsSceneDepth != 0.0) &&
-    (vsRayZMax >= vsVoxelZMinFinal) &&
-    (vsRayZMin <= vsSceneDepth);
+    return true;
+  }
 
-  return hit;
+  return false;
 }
 
 #endif
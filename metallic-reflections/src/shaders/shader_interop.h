@@ -5,9 +5,13 @@
 #define row_major
 #include <cstdint>
 #include <DirectXMath.h>
+using float2 = DirectX::XMFLOAT2;
 using float3 = DirectX::XMFLOAT3;
+using float4 = DirectX::XMFLOAT4;
 using float4x4 = DirectX::XMFLOAT4X4;
 using uint = std::uint32_t;
+using uint2 = DirectX::XMUINT2;
+using uint3 = DirectX::XMUINT3;
 #else
 #define BOOL bool
 #endif
@@ -18,40 +22,75 @@ using uint = std::uint32_t;
 #define MATERIAL_BASE_COLOR_MAP_SLOT 0
 #define MATERIAL_ROUGHNESS_MAP_SLOT 1
 #define MATERIAL_NORMAL_MAP_SLOT 2
+#define MATERIAL_BUFFER_SLOT 3
 #define MATERIAL_SAMPLER_SLOT 0
-#define OBJECT_CB_SLOT 0
+#define INSTANCE_TRANSFORM_BUFFER_SLOT 0
 #define CAMERA_CB_SLOT 1
-#define MATERIAL_CB_SLOT 2
-
-#define EQUIRECT_ENV_MAP_SRV_SLOT 0
-#define ENV_CUBE_UAV_SLOT 0
-#define EQUIRECT_ENV_MAP_SAMPLER_SLOT 0
-#define EQUIRECT_TO_CUBE_THREADS_X 8
-#define EQUIRECT_TO_CUBE_THREADS_Y 8
-
-#define ENV_PREFILTER_CUBE_SRV_SLOT 0
-#define ENV_PREFILTER_ENV_CUBE_UAV_SLOT 0
-#define ENV_PREFILTER_SAMPLER_SLOT 0
-#define ENV_PREFILTER_CB_SLOT 0
-#define ENV_PREFILTER_THREADS_X 8
-#define ENV_PREFILTER_THREADS_Y 8
 
 #define LIGHTING_GBUFFER0_SRV_SLOT 0
 #define LIGHTING_GBUFFER1_SRV_SLOT 1
 #define LIGHTING_DEPTH_SRV_SLOT 2
 #define LIGHTING_ENV_MAP_SRV_SLOT 3
+#define LIGHTING_DFG_LUT_SRV_SLOT 4
 #define LIGHTING_GBUFFER_SAMPLER_SLOT 0
 #define LIGHTING_ENV_SAMPLER_SLOT 1
 #define LIGHTING_CAM_CB_SLOT 0
+#define LIGHTING_ENV_CB_SLOT 1
 
 #define SSR_DEPTH_SRV_SLOT 0
 #define SSR_GBUFFER0_SRV_SLOT 1
 #define SSR_GBUFFER1_SRV_SLOT 2
 #define SSR_IBL_SRV_SLOT 3
+#define SSR_HIZ_SRV_SLOT 4
 #define SSR_SSR_UAV_SLOT 0
+#define SSR_HITS_UAV_SLOT 1
+#define SSR_HIT_DIST_UAV_SLOT 2
+#define SSR_REFLECTION_UAV_SLOT 3
 #define SSR_CAM_CB_SLOT 0
+#define SSR_CB_SLOT 1
 #define SSR_THREADS_X 8
 #define SSR_THREADS_Y 8
+#define SSR_MARCH_LINEAR 0
+#define SSR_MARCH_HIZ 1
+#define SSR_MARCH_DDA 2
+#define SSR_NO_HIT 0xFFFFFFFF // Of the source or the hit pixel of a texel of the hit texture, see SsrConstants
+
+#define SSR_UPSAMPLE_DEPTH_SRV_SLOT 0
+#define SSR_UPSAMPLE_GBUFFER0_SRV_SLOT 1
+#define SSR_UPSAMPLE_GBUFFER1_SRV_SLOT 2
+#define SSR_UPSAMPLE_IBL_SRV_SLOT 3
+#define SSR_UPSAMPLE_HITS_SRV_SLOT 4
+#define SSR_UPSAMPLE_SSR_UAV_SLOT 0
+#define SSR_UPSAMPLE_HIT_DIST_UAV_SLOT 1
+#define SSR_UPSAMPLE_REFLECTION_UAV_SLOT 2
+#define SSR_UPSAMPLE_CAM_CB_SLOT 0
+#define SSR_UPSAMPLE_CB_SLOT 1
+#define SSR_UPSAMPLE_THREADS_X 8
+#define SSR_UPSAMPLE_THREADS_Y 8
+
+#define SSR_TEMPORAL_DEPTH_SRV_SLOT 0
+#define SSR_TEMPORAL_GBUFFER0_SRV_SLOT 1
+#define SSR_TEMPORAL_SSR_SRV_SLOT 2
+#define SSR_TEMPORAL_HIT_DIST_SRV_SLOT 3
+#define SSR_TEMPORAL_HISTORY_SRV_SLOT 4
+#define SSR_TEMPORAL_PREV_DEPTH_SRV_SLOT 5
+#define SSR_TEMPORAL_GBUFFER1_SRV_SLOT 6
+#define SSR_TEMPORAL_IBL_SRV_SLOT 7
+#define SSR_TEMPORAL_REFLECTION_SRV_SLOT 8
+#define SSR_TEMPORAL_OUTPUT_UAV_SLOT 0
+#define SSR_TEMPORAL_HISTORY_UAV_SLOT 1
+#define SSR_TEMPORAL_CAM_CB_SLOT 0
+#define SSR_TEMPORAL_CB_SLOT 1
+#define SSR_TEMPORAL_THREADS_X 8
+#define SSR_TEMPORAL_THREADS_Y 8
+
+#define HIZ_DEPTH_SRV_SLOT 0
+#define HIZ_SRC_SRV_SLOT 1
+#define HIZ_DST_UAV_SLOT 0
+#define HIZ_CAM_CB_SLOT 0
+#define HIZ_CB_SLOT 1
+#define HIZ_THREADS_X 8
+#define HIZ_THREADS_Y 8
 
 
 struct Material {
@@ -63,8 +102,8 @@ struct Material {
   float pad;
 };
 
-struct ObjectConstants {
-  row_major float4x4 world_mtx;
+struct InstanceTransform {
+  row_major float4x4 world_mtx; // Includes the dequantization of the packed positions
   row_major float4x4 normal_mtx;
 };
 
@@ -81,11 +120,41 @@ struct CameraConstants {
   float3 pad;
 };
 
-struct EnvPrefilterConstants {
-  uint cur_mip; // 0 is original env map
-  uint num_mips;
-  uint face_base_size; // Size of face at mip 0
-  uint sample_count; // Number of GGX samples to use for this prefiltering pass
+struct EnvironmentConstants {
+  float4 sh_coeffs[9]; // See IrradianceSh, rgb in xyz
+  uint prefiltered_mip_count; // Of the full chain, the texture may end earlier
+  float3 pad;
+};
+
+struct SsrConstants {
+  uint march_mode; // SSR_MARCH_*
+  uint hiz_mip_count;
+  float dda_pixel_stride; // Pixels between the steps of the DDA march before refinement, at least 1
+  float dda_jitter; // Fraction of a stride the DDA march starts at of up to 1, varying per pixel against banding
+  uint dda_max_steps; // Of the DDA march before refinement
+  uint dda_refine_steps; // Times the DDA march halves the stride it hit in
+  // 0 traces every pixel into the output. Otherwise one ray is traced per block of 2^trace_scale_log2 squared pixels,
+  // from the closest pixel of the block that reflects, into the hit texture, which holds the packed source and hit
+  // pixel of every block. ssr_upsample.hlsli then resolves it to the output.
+  uint trace_scale_log2;
+  // If set, the ray of a block starts from the pixel frame_index picks instead, in an order that visits every pixel of
+  // the block once every 4^trace_scale_log2 frames, for ssr_temporal.hlsli to accumulate them. Blocks whose pick does
+  // not reflect fall back to the closest pixel.
+  BOOL rotate_sources;
+  uint frame_index;
+  uint3 pad;
+};
+
+struct SsrTemporalConstants {
+  row_major float4x4 prev_view_proj_mtx; // The clip planes are assumed not to change between frames
+  float current_weight; // Of the current frame in the blend with the history
+  BOOL history_valid; // False while the history holds nothing to blend with, like on the first frame
+  float2 pad;
+};
+
+struct HiZConstants {
+  uint cur_mip; // 0 linearizes the depth buffer, the others reduce the mip above
+  uint3 pad;
 };
 
 #endif
@@ -2,6 +2,7 @@
 
 #include "brdf.hlsli"
 #include "change_of_basis.hlsli"
+#include "ray_march.hlsli"
 #include "resource_binding_helpers.hlsli"
 #include "shader_interop.h"
 
@@ -9,105 +10,340 @@ cbuffer CameraCbuffer : register(MAKE_REGISTER(b, SSR_CAM_CB_SLOT)) {
   CameraConstants g_cam_constants;
 }
 
+cbuffer SsrCbuffer : register(MAKE_REGISTER(b, SSR_CB_SLOT)) {
+  SsrConstants g_ssr_constants;
+}
+
 Texture2D<float> g_depth_tex : register(MAKE_REGISTER(t, SSR_DEPTH_SRV_SLOT));
 Texture2D g_gbuffer0 : register(MAKE_REGISTER(t, SSR_GBUFFER0_SRV_SLOT));
 Texture2D g_gbuffer1 : register(MAKE_REGISTER(t, SSR_GBUFFER1_SRV_SLOT));
 Texture2D g_ibl_tex : register(MAKE_REGISTER(t, SSR_IBL_SRV_SLOT));
+Texture2D<float2> g_hiz_tex : register(MAKE_REGISTER(t, SSR_HIZ_SRV_SLOT)); // See hiz.hlsli
 RWTexture2D<float4> g_ssr_tex : register(MAKE_REGISTER(u, SSR_SSR_UAV_SLOT));
+RWTexture2D<uint2> g_ssr_hits_tex : register(MAKE_REGISTER(u, SSR_HITS_UAV_SLOT)); // See SsrConstants
+// View space distance from every pixel to the point its reflection hit, 0 without one, for ssr_temporal.hlsli
+RWTexture2D<float> g_ssr_hit_dist_tex : register(MAKE_REGISTER(u, SSR_HIT_DIST_UAV_SLOT));
+// Color the reflection of every pixel hit scaled by its coverage in rgb and the coverage in a, 0 without a hit. The
+// part of the output ssr_temporal.hlsli accumulates, the lighting of the surface is composited over it every frame.
+RWTexture2D<float4> g_ssr_reflection_tex : register(MAKE_REGISTER(u, SSR_REFLECTION_UAV_SLOT));
 
-[numthreads(SSR_THREADS_X, SSR_THREADS_Y, 1)]
-void CsMain(const uint3 dtid : SV_DispatchThreadID) {
-  uint2 depth_tex_size;
-  g_depth_tex.GetDimensions(depth_tex_size.x, depth_tex_size.y);
+static const float kStepSize = 0.001;
+static const float kThickness = 0.005;
+static const int kLastStep = 10000;
 
-  // Check bounds
 
-  if (dtid.x > depth_tex_size.x || dtid.y > depth_tex_size.y) {
-    return;
+struct RaySample {
+  float3 pos_vs;
+  float w; // Clip space
+  uint2 px;
+  bool on_screen;
+};
+
+
+RaySample SampleRay(const float3 ray_start_vs, const float3 R, const int step, const uint2 depth_tex_size) {
+  RaySample sample;
+  sample.pos_vs = ray_start_vs + step * kStepSize * R;
+  const float4 pos_cs = mul(float4(sample.pos_vs, 1), g_cam_constants.proj_mtx);
+  const float2 uv = NdcToUv(pos_cs.xyz / pos_cs.w);
+  sample.w = pos_cs.w;
+  sample.px = uint2(uv * float2(depth_tex_size));
+  sample.on_screen = sample.px.x < depth_tex_size.x && sample.px.y < depth_tex_size.y;
+  return sample;
+}
+
+
+bool IsHit(const RaySample sample) {
+  const float depth_vs = NdcToViewDepth(g_depth_tex[sample.px], g_cam_constants.near_clip, g_cam_constants.far_clip);
+  return abs(sample.pos_vs.z - depth_vs) < kThickness;
+}
+
+
+bool MarchLinear(const float3 ray_start_vs, const float3 R, const uint2 depth_tex_size, out uint2 hit_pixel) {
+  hit_pixel = uint2(0, 0);
+
+  for (int i = 0; i <= kLastStep; i++) {
+    const RaySample sample = SampleRay(ray_start_vs, R, i, depth_tex_size);
+
+    if (!sample.on_screen) {
+      break;
+    }
+
+    if (IsHit(sample)) {
+      hit_pixel = sample.px;
+      return true;
+    }
   }
 
-  const float depth = g_depth_tex[dtid.xy];
+  return false;
+}
 
-  // Check background
 
-  if (depth >= 0.9999) {
-    g_ssr_tex[dtid.xy] = g_ibl_tex[dtid.xy];
-    return;
+// Last step from the first one on for which f0 + step * df stays at least 0, given that it is at the first step
+int LastStepInside(const float f0, const float df, const int first_step) {
+  if (df >= 0) {
+    return kLastStep;
   }
 
-  const float4 gbuffer0_value = g_gbuffer0[dtid.xy];
-  const float roughness = gbuffer0_value.a;
+  return int(clamp(floor(-f0 / df), float(first_step - 1), float(kLastStep)));
+}
 
-  // Check roughness
 
-  if (roughness >= 0.5) {
-    g_ssr_tex[dtid.xy] = g_ibl_tex[dtid.xy];
-    return;
+bool IsInCell(const RaySample sample, const uint2 cell_begin, const uint2 cell_end) {
+  return sample.on_screen && sample.w > 0 && all(sample.px >= cell_begin) && all(sample.px < cell_end);
+}
+
+
+// Takes the steps of MarchLinear, skipping the runs of them that stay within a cell of the depth pyramid and cannot
+// come within the thickness of its min and max. Same hits as MarchLinear, see MarchHiZ in ssr.cpp.
+bool MarchHiZ(const float3 ray_start_vs, const float3 R, const uint2 depth_tex_size, out uint2 hit_pixel) {
+  hit_pixel = uint2(0, 0);
+
+  // The clip space position of a step is linear in the step index, so every edge of a cell is a linear inequality
+  const float4 cs_start = mul(float4(ray_start_vs, 1), g_cam_constants.proj_mtx);
+  const float4 cs_step = mul(float4(R * kStepSize, 0), g_cam_constants.proj_mtx);
+  const float2 size = float2(depth_tex_size);
+  const uint top_level = g_ssr_constants.hiz_mip_count - 1;
+
+  uint level = 0;
+  int i = 0;
+  RaySample sample = SampleRay(ray_start_vs, R, i, depth_tex_size);
+
+  while (i <= kLastStep && sample.on_screen) {
+    uint2 mip_size;
+    uint mip_count;
+    g_hiz_tex.GetDimensions(level, mip_size.x, mip_size.y, mip_count);
+
+    const uint2 cell = min(sample.px >> level, mip_size - 1);
+    const float2 depth_min_max = g_hiz_tex.Load(int3(cell, level));
+
+    const uint2 cell_begin = cell << level;
+    const uint2 cell_end = uint2(cell.x == mip_size.x - 1 ? depth_tex_size.x : (cell.x + 1) << level,
+                                 cell.y == mip_size.y - 1 ? depth_tex_size.y : (cell.y + 1) << level);
+
+    // Steps left of and above the screen clamp to its first column and row, so those edges never end a cell
+    int last = LastStepInside(cs_start.w, cs_step.w, i);
+
+    if (cell_begin.x > 0) {
+      const float b = 2 * cell_begin.x / size.x - 1;
+      last = min(last, LastStepInside(cs_start.x - b * cs_start.w, cs_step.x - b * cs_step.w, i));
+    }
+
+    if (cell_begin.y > 0) {
+      const float b = 1 - 2 * cell_begin.y / size.y;
+      last = min(last, LastStepInside(b * cs_start.w - cs_start.y, b * cs_step.w - cs_step.y, i));
+    }
+
+    const float2 b_end = float2(2 * cell_end.x / size.x - 1, 1 - 2 * cell_end.y / size.y);
+    last = min(last, LastStepInside(b_end.x * cs_start.w - cs_start.x, b_end.x * cs_step.w - cs_step.x, i));
+    last = min(last, LastStepInside(cs_start.y - b_end.y * cs_start.w, cs_step.y - b_end.y * cs_step.w, i));
+
+    // The inequalities are solved in floats, so the last step is checked against the pixels the march computes
+    bool skip = false;
+
+    if (last >= i && sample.w > 0) {
+      RaySample last_sample = SampleRay(ray_start_vs, R, last, depth_tex_size);
+
+      if (!IsInCell(last_sample, cell_begin, cell_end) && last > i) {
+        last -= 1;
+        last_sample = SampleRay(ray_start_vs, R, last, depth_tex_size);
+      }
+
+      if (IsInCell(last_sample, cell_begin, cell_end)) {
+        const float z_min = min(sample.pos_vs.z, last_sample.pos_vs.z);
+        const float z_max = max(sample.pos_vs.z, last_sample.pos_vs.z);
+        skip = !(z_max - depth_min_max.x > -kThickness && z_min - depth_min_max.y < kThickness);
+      }
+    }
+
+    if (skip) {
+      i = last + 1;
+      level = min(level + 1, top_level);
+      sample = SampleRay(ray_start_vs, R, i, depth_tex_size);
+    } else if (level > 0) {
+      level -= 1;
+    } else if (IsHit(sample)) {
+      hit_pixel = sample.px;
+      return true;
+    } else {
+      i += 1;
+      sample = SampleRay(ray_start_vs, R, i, depth_tex_size);
+    }
   }
 
-  const float4 gbuffer1_value = g_gbuffer1[dtid.xy];
+  return false;
+}
+
+
+// Pixels that are background or too rough keep the output of the lighting pass
+bool ReflectsScreen(const float depth, const float roughness) {
+  return depth < 0.9999 && roughness < 0.5;
+}
+
+
+uint PackPixel(const uint2 px) {
+  return px.x | px.y << 16;
+}
+
+
+float3 PixelToView(const uint2 px, const uint2 depth_tex_size) {
+  return UvToPos(float2(px) / float2(depth_tex_size), g_depth_tex[px], g_cam_constants.proj_inv_mtx);
+}
+
+
+// Traces the reflection of a pixel that reflects the screen, returns the pixel it hits or SSR_NO_HIT
+uint TracePixel(const uint2 px, const uint2 depth_tex_size, out float3 normal_vs, out float3 V) {
+  const float4 gbuffer1_value = g_gbuffer1[px];
   const float3 normal_ws = gbuffer1_value.rgb;
-  const float3 normal_vs = mul(float4(normal_ws, 0.0), g_cam_constants.view_mtx).xyz;
+  normal_vs = mul(float4(normal_ws, 0.0), g_cam_constants.view_mtx).xyz;
 
-  const float4 pos4_vs = mul(float4(UvToNdc(float2(dtid.xy) / float2(depth_tex_size)), depth, 1.0),
-                             g_cam_constants.proj_inv_mtx);
-  const float3 pos_vs = pos4_vs.xyz / pos4_vs.w;
+  const float3 pos_vs = PixelToView(px, depth_tex_size);
 
-  const float3 V = normalize(-pos_vs);
+  V = normalize(-pos_vs);
   const float3 R = reflect(-V, normal_vs);
 
-  bool hit = false;
+  const float3 ray_start_vs = pos_vs + 0.1 * R;
+
+  // Both sides of ?: are evaluated, so the marches are picked by branching
   uint2 hit_pixel;
+  bool hit;
 
-  const float step_size = 0.001;
-  const float thickness = 0.005;
+  if (g_ssr_constants.march_mode == SSR_MARCH_HIZ) {
+    hit = MarchHiZ(ray_start_vs, R, depth_tex_size, hit_pixel);
+  } else if (g_ssr_constants.march_mode == SSR_MARCH_DDA) {
+    const float2 half_depth_tex_size = float2(depth_tex_size) / 2;
 
-  const float3 ray_start_vs = pos_vs + 0.1 * R;
+    const float4x4 cs_to_px = {
+      half_depth_tex_size.x, 0.0, 0.0, 0.0,
+      0.0, -half_depth_tex_size.y, 0.0, 0.0,
+      0.0, 0.0, 1.0, 0.0,
+      half_depth_tex_size.x, half_depth_tex_size.y, 0.0, 1.0
+    };
 
-  for (int i = 0; i <= 10000; i++) {
-    const float3 test_pos_vs = ray_start_vs + i * step_size * R;
-    const float4 test_pos_cs = mul(float4(test_pos_vs, 1), g_cam_constants.proj_mtx);
-    const float3 test_pos_ndc = test_pos_cs.xyz / test_pos_cs.w;
-    const float2 test_uv = NdcToUv(test_pos_ndc);
-    const uint2 test_px = uint2(test_uv * float2(depth_tex_size));
+    const float4x4 view_to_px = mul(g_cam_constants.proj_mtx, cs_to_px);
+    const float jitter = saturate(g_ssr_constants.dda_jitter) * InterleavedGradientNoise(px);
 
-    if (test_px.x >= depth_tex_size.x || test_px.y >= depth_tex_size.y) {
-      break;
+    // Covers the same distance as the linear march
+    uint step_count;
+    hit = MarchRay(ray_start_vs, R, view_to_px, g_depth_tex, kThickness, g_cam_constants.near_clip,
+                   g_cam_constants.far_clip, max(g_ssr_constants.dda_pixel_stride, 1), jitter,
+                   g_ssr_constants.dda_max_steps, g_ssr_constants.dda_refine_steps, kLastStep * kStepSize, hit_pixel,
+                   step_count);
+  } else {
+    hit = MarchLinear(ray_start_vs, R, depth_tex_size, hit_pixel);
+  }
+
+  if (hit) {
+    return PackPixel(hit_pixel);
+  }
+
+  return SSR_NO_HIT;
+}
+
+
+// Offset in a block of the pixel its ray starts from on a frame when the sources rotate. Every level of the block
+// from the largest quadrants down takes the next two bits of the frame index, and visits its quadrants in the order
+// (0, 0), (1, 1), (1, 0), (0, 1), so the frames spread over the block like the thresholds of a Bayer matrix.
+uint2 RotatedSourceOffset(const uint frame_index, const uint scale_log2) {
+  uint2 offset = uint2(0, 0);
+
+  for (uint level = 0; level < scale_log2; level++) {
+    const uint quadrant = (frame_index >> (2 * level)) & 3;
+    const uint quadrant_size = 1u << (scale_log2 - 1 - level);
+    offset += quadrant_size * uint2(quadrant == 1 || quadrant == 2 ? 1 : 0, quadrant == 1 || quadrant == 3 ? 1 : 0);
+  }
+
+  return offset;
+}
+
+
+// One ray per block for ssr_upsample.hlsli, from the pixel of the rotation if the constants rotate the sources and it
+// reflects the screen, and from the closest pixel of the block that does otherwise
+void TraceBlock(const uint2 block, const uint2 depth_tex_size) {
+  const uint block_size = 1u << g_ssr_constants.trace_scale_log2;
+  const uint2 block_begin = block * block_size;
+  const uint2 block_end = min(block_begin + block_size, depth_tex_size);
+
+  uint2 source = block_begin + RotatedSourceOffset(g_ssr_constants.frame_index, g_ssr_constants.trace_scale_log2);
+  float source_depth = 1;
+  bool has_source = g_ssr_constants.rotate_sources && all(source < block_end) &&
+                    ReflectsScreen(g_depth_tex[source], g_gbuffer0[source].a);
+
+  if (!has_source) {
+    for (uint y = block_begin.y; y < block_end.y; y++) {
+      for (uint x = block_begin.x; x < block_end.x; x++) {
+        const float depth = g_depth_tex[uint2(x, y)];
+
+        if (ReflectsScreen(depth, g_gbuffer0[uint2(x, y)].a) && (!has_source || depth < source_depth)) {
+          source = uint2(x, y);
+          source_depth = depth;
+          has_source = true;
+        }
+      }
     }
+  }
 
-    const float test_depth_ndc = g_depth_tex[test_px].r;
-    const float test_depth_vs = NdcToViewDepth(test_depth_ndc, g_cam_constants.near_clip, g_cam_constants.far_clip);
+  if (!has_source) {
+    g_ssr_hits_tex[block] = uint2(SSR_NO_HIT, SSR_NO_HIT);
+    return;
+  }
 
-    if (abs(test_pos_vs.z - test_depth_vs) < thickness) {
-      hit = true;
-      hit_pixel = test_px;
-      break;
+  float3 normal_vs;
+  float3 V;
+  g_ssr_hits_tex[block] = uint2(PackPixel(source), TracePixel(source, depth_tex_size, normal_vs, V));
+}
+
+
+[numthreads(SSR_THREADS_X, SSR_THREADS_Y, 1)]
+void CsMain(const uint3 dtid : SV_DispatchThreadID) {
+  uint2 depth_tex_size;
+  g_depth_tex.GetDimensions(depth_tex_size.x, depth_tex_size.y);
+
+  if (g_ssr_constants.trace_scale_log2 > 0) {
+    const uint block_size = 1u << g_ssr_constants.trace_scale_log2;
+
+    if (all(dtid.xy < (depth_tex_size + block_size - 1) >> g_ssr_constants.trace_scale_log2)) {
+      TraceBlock(dtid.xy, depth_tex_size);
     }
+
+    return;
+  }
+
+  // Check bounds
+
+  if (dtid.x > depth_tex_size.x || dtid.y > depth_tex_size.y) {
+    return;
   }
 
-  //const float2 half_depth_tex_size = float2(depth_tex_size) / 2;
+  const float depth = g_depth_tex[dtid.xy];
+  const float4 gbuffer0_value = g_gbuffer0[dtid.xy];
+  const float roughness = gbuffer0_value.a;
 
-  //const float4x4 cs_to_px = {
-  //  half_depth_tex_size.x, 0.0, 0.0, 0.0,
-  //  0.0, -half_depth_tex_size.y, 0.0, 0.0,
-  //  0.0, 0.0, 1.0, 0.0,
-  //  half_depth_tex_size.x, half_depth_tex_size.y, 0.0, 1.0
-  //};
+  // Check background and roughness
 
-  //float4x4 proj_to_px = mul(g_cam_constants.proj_mtx, cs_to_px);
+  if (!ReflectsScreen(depth, roughness)) {
+    g_ssr_tex[dtid.xy] = g_ibl_tex[dtid.xy];
+    g_ssr_hit_dist_tex[dtid.xy] = 0;
+    g_ssr_reflection_tex[dtid.xy] = float4(0, 0, 0, 0);
+    return;
+  }
 
-  //float2 hit_pixel;
-  //float3 hit_point_vs;
-  //const bool hit = MarchRay(pos_vs + 0.1 * R, R, proj_to_px, g_depth_tex, 1.0, true, g_cam_constants.near_clip,
-  //                          g_cam_constants.far_clip, 1, 0, 1000, 1000, hit_pixel, hit_point_vs);
+  float3 normal_vs;
+  float3 V;
+  const uint hit = TracePixel(dtid.xy, depth_tex_size, normal_vs, V);
 
-  if (hit) {
+  if (hit != SSR_NO_HIT) {
+    const uint2 hit_pixel = uint2(hit & 0xFFFF, hit >> 16);
     const float3 hit_color = g_ibl_tex[hit_pixel].rgb;
     const float3 px_color = g_ibl_tex[dtid.xy].rgb;
     const float3 F = FresnelSchlick(saturate(dot(normal_vs, V)), hit_color);
     const float3 weight = pow(1.0 - roughness, 3.0) * F;
     g_ssr_tex[dtid.xy] = float4(lerp(px_color, hit_color, weight), 1);
+    g_ssr_hit_dist_tex[dtid.xy] = distance(PixelToView(dtid.xy, depth_tex_size),
+                                           PixelToView(hit_pixel, depth_tex_size));
+    g_ssr_reflection_tex[dtid.xy] = float4(hit_color, 1);
   } else {
     g_ssr_tex[dtid.xy] = g_ibl_tex[dtid.xy];
+    g_ssr_hit_dist_tex[dtid.xy] = 0;
+    g_ssr_reflection_tex[dtid.xy] = float4(0, 0, 0, 0);
   }
 }
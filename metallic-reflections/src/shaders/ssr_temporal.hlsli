@@ -0,0 +1,157 @@
+// ReSharper disable CppEnforceCVQualifiersPlacement
+
+#include "brdf.hlsli"
+#include "change_of_basis.hlsli"
+#include "resource_binding_helpers.hlsli"
+#include "shader_interop.h"
+
+cbuffer CameraCbuffer : register(MAKE_REGISTER(b, SSR_TEMPORAL_CAM_CB_SLOT)) {
+  CameraConstants g_cam_constants;
+}
+
+cbuffer SsrTemporalCbuffer : register(MAKE_REGISTER(b, SSR_TEMPORAL_CB_SLOT)) {
+  SsrTemporalConstants g_temporal_constants;
+}
+
+Texture2D<float> g_depth_tex : register(MAKE_REGISTER(t, SSR_TEMPORAL_DEPTH_SRV_SLOT));
+Texture2D g_gbuffer0 : register(MAKE_REGISTER(t, SSR_TEMPORAL_GBUFFER0_SRV_SLOT));
+Texture2D g_gbuffer1 : register(MAKE_REGISTER(t, SSR_TEMPORAL_GBUFFER1_SRV_SLOT));
+Texture2D g_ibl_tex : register(MAKE_REGISTER(t, SSR_TEMPORAL_IBL_SRV_SLOT));
+Texture2D g_ssr_tex : register(MAKE_REGISTER(t, SSR_TEMPORAL_SSR_SRV_SLOT)); // This frame
+Texture2D g_reflection_tex : register(MAKE_REGISTER(t, SSR_TEMPORAL_REFLECTION_SRV_SLOT)); // This frame, see ssr.hlsli
+Texture2D<float> g_hit_dist_tex : register(MAKE_REGISTER(t, SSR_TEMPORAL_HIT_DIST_SRV_SLOT)); // See ssr.hlsli
+// Reflection term this pass accumulated last frame
+Texture2D g_history_tex : register(MAKE_REGISTER(t, SSR_TEMPORAL_HISTORY_SRV_SLOT));
+Texture2D<float> g_prev_depth_tex : register(MAKE_REGISTER(t, SSR_TEMPORAL_PREV_DEPTH_SRV_SLOT));
+RWTexture2D<float4> g_output_tex : register(MAKE_REGISTER(u, SSR_TEMPORAL_OUTPUT_UAV_SLOT));
+// Reflection term accumulated this frame, the history of the next one
+RWTexture2D<float4> g_history_output_tex : register(MAKE_REGISTER(u, SSR_TEMPORAL_HISTORY_UAV_SLOT));
+
+// The history of a surface is rejected as disoccluded where the view depth last frame at where the surface was differs
+// from the depth the surface had by more than this fraction of it
+static const float kDisocclusionDepthRatio = 0.05;
+
+
+// Point the reflection of a pixel moves with. The ray hit a point hit_dist from the surface, whose mirror image lies
+// as far behind the surface along the view ray, which is where a planar reflector shows it. Without a hit the
+// reflection moves with the surface.
+float3 ReflectionPosition(const float3 pos_ws, const float3 cam_pos_ws, const float hit_dist) {
+  return pos_ws - normalize(cam_pos_ws - pos_ws) * hit_dist;
+}
+
+
+// Where a point was on screen last frame and its view depth then, false if it was behind the camera or off screen
+bool ProjectToPrevUv(const float3 pos_ws, out float2 uv, out float depth_vs) {
+  const float4 pos_cs = mul(float4(pos_ws, 1), g_temporal_constants.prev_view_proj_mtx);
+  depth_vs = pos_cs.w;
+  uv = NdcToUv(pos_cs.xyz / pos_cs.w);
+  return pos_cs.w > 0 && all(uv >= 0) && all(uv < 1);
+}
+
+
+bool IsDisoccluded(const float expected_depth_vs, const float prev_depth_vs) {
+  return abs(prev_depth_vs - expected_depth_vs) > kDisocclusionDepthRatio * expected_depth_vs;
+}
+
+
+// Bilinear fetch with the edge texels repeated
+float4 SampleHistory(const float2 uv, const uint2 size) {
+  const float2 pos = uv * float2(size) - 0.5;
+  const int2 base = int2(floor(pos));
+  const float2 f = pos - float2(base);
+
+  float4 reflection = float4(0, 0, 0, 0);
+
+  for (int i = 0; i < 4; i++) {
+    const int2 offset = int2(i & 1, i >> 1);
+    const int2 px = clamp(base + offset, int2(0, 0), int2(size) - 1);
+    const float weight = (offset.x == 1 ? f.x : 1 - f.x) * (offset.y == 1 ? f.y : 1 - f.y);
+    reflection += weight * g_history_tex[uint2(px)];
+  }
+
+  return reflection;
+}
+
+
+// Blends an accumulated reflection term over the lighting of the surface this frame, as ssr.hlsli and
+// ssr_upsample.hlsli blend the reflection of a single frame
+float4 Composite(const uint2 px, const uint2 size, const float depth, const float4 reflection) {
+  if (!(reflection.a > 0)) {
+    return g_ibl_tex[px];
+  }
+
+  const float3 normal_vs = mul(float4(g_gbuffer1[px].rgb, 0.0), g_cam_constants.view_mtx).xyz;
+  const float3 V = normalize(-UvToPos(float2(px) / float2(size), depth, g_cam_constants.proj_inv_mtx));
+  const float3 hit_color = reflection.rgb / reflection.a;
+  const float3 F = FresnelSchlick(saturate(dot(normal_vs, V)), hit_color);
+  const float3 weight = pow(1.0 - g_gbuffer0[px].a, 3.0) * F * reflection.a;
+  return float4(lerp(g_ibl_tex[px].rgb, hit_color, weight), 1);
+}
+
+
+// Blends the reflection term of this frame with the one this pass accumulated last frame where the reflection was
+// then, so that the rays of successive frames accumulate, and composites the result over the lighting of the surface
+// this frame. Only the reflection moves with the mirror image of the hit point, the surface lighting under it is never
+// taken from the history, so it does not smear. The history is taken at the reprojected mirror image, rejected where
+// the surface was off screen or hidden last frame, and clamped to the range of the reflection terms around the pixel
+// this frame against ghosting. Where it is rejected the SSR output of this frame is kept. ResolveSsrTemporal of
+// ssr.cpp is the CPU port.
+[numthreads(SSR_TEMPORAL_THREADS_X, SSR_TEMPORAL_THREADS_Y, 1)]
+void CsMain(const uint3 dtid : SV_DispatchThreadID) {
+  uint2 depth_tex_size;
+  g_depth_tex.GetDimensions(depth_tex_size.x, depth_tex_size.y);
+
+  if (any(dtid.xy >= depth_tex_size)) {
+    return;
+  }
+
+  const float4 current = g_reflection_tex[dtid.xy];
+  const float depth = g_depth_tex[dtid.xy];
+
+  // Kept wherever the history is rejected below
+  g_output_tex[dtid.xy] = g_ssr_tex[dtid.xy];
+  g_history_output_tex[dtid.xy] = current;
+
+  if (!g_temporal_constants.history_valid || depth >= 0.9999 || g_gbuffer0[dtid.xy].a >= 0.5) {
+    return;
+  }
+
+  // Pixel centers, so that a still camera reprojects every pixel onto itself
+  const float2 uv = (float2(dtid.xy) + 0.5) / float2(depth_tex_size);
+  const float3 pos_ws = UvToPos(uv, depth, g_cam_constants.view_proj_inv_mtx);
+  const float3 reflection_ws = ReflectionPosition(pos_ws, g_cam_constants.pos_ws, g_hit_dist_tex[dtid.xy]);
+
+  float2 surface_uv;
+  float surface_depth_vs;
+  float2 reflection_uv;
+  float reflection_depth_vs;
+
+  if (!ProjectToPrevUv(pos_ws, surface_uv, surface_depth_vs) ||
+      !ProjectToPrevUv(reflection_ws, reflection_uv, reflection_depth_vs)) {
+    return;
+  }
+
+  const float prev_depth_vs = NdcToViewDepth(g_prev_depth_tex[uint2(surface_uv * float2(depth_tex_size))],
+                                             g_cam_constants.near_clip, g_cam_constants.far_clip);
+
+  if (IsDisoccluded(surface_depth_vs, prev_depth_vs)) {
+    return;
+  }
+
+  float4 neighborhood_min = current;
+  float4 neighborhood_max = current;
+
+  for (int y = -1; y <= 1; y++) {
+    for (int x = -1; x <= 1; x++) {
+      const int2 px = clamp(int2(dtid.xy) + int2(x, y), int2(0, 0), int2(depth_tex_size) - 1);
+      const float4 reflection = g_reflection_tex[uint2(px)];
+      neighborhood_min = min(neighborhood_min, reflection);
+      neighborhood_max = max(neighborhood_max, reflection);
+    }
+  }
+
+  const float4 history = clamp(SampleHistory(reflection_uv, depth_tex_size), neighborhood_min, neighborhood_max);
+  const float4 reflection = lerp(history, current, g_temporal_constants.current_weight);
+  g_output_tex[dtid.xy] = Composite(dtid.xy, depth_tex_size, depth, reflection);
+  g_history_output_tex[dtid.xy] = reflection;
+}
@@ -0,0 +1,171 @@
+// ReSharper disable CppEnforceCVQualifiersPlacement
+
+#include "brdf.hlsli"
+#include "change_of_basis.hlsli"
+#include "resource_binding_helpers.hlsli"
+#include "shader_interop.h"
+
+cbuffer CameraCbuffer : register(MAKE_REGISTER(b, SSR_UPSAMPLE_CAM_CB_SLOT)) {
+  CameraConstants g_cam_constants;
+}
+
+cbuffer SsrCbuffer : register(MAKE_REGISTER(b, SSR_UPSAMPLE_CB_SLOT)) {
+  SsrConstants g_ssr_constants;
+}
+
+Texture2D<float> g_depth_tex : register(MAKE_REGISTER(t, SSR_UPSAMPLE_DEPTH_SRV_SLOT));
+Texture2D g_gbuffer0 : register(MAKE_REGISTER(t, SSR_UPSAMPLE_GBUFFER0_SRV_SLOT));
+Texture2D g_gbuffer1 : register(MAKE_REGISTER(t, SSR_UPSAMPLE_GBUFFER1_SRV_SLOT));
+Texture2D g_ibl_tex : register(MAKE_REGISTER(t, SSR_UPSAMPLE_IBL_SRV_SLOT));
+Texture2D<uint2> g_ssr_hits_tex : register(MAKE_REGISTER(t, SSR_UPSAMPLE_HITS_SRV_SLOT)); // See SsrConstants
+RWTexture2D<float4> g_ssr_tex : register(MAKE_REGISTER(u, SSR_UPSAMPLE_SSR_UAV_SLOT));
+RWTexture2D<float> g_ssr_hit_dist_tex : register(MAKE_REGISTER(u, SSR_UPSAMPLE_HIT_DIST_UAV_SLOT)); // See ssr.hlsli
+RWTexture2D<float4> g_ssr_reflection_tex : register(MAKE_REGISTER(u, SSR_UPSAMPLE_REFLECTION_UAV_SLOT)); // Ditto
+
+// Falloff of the weight of a ray with the difference of its source depth to the depth of the pixel, relative to the
+// latter, and sharpness of the falloff with the angle between their normals
+static const float kDepthSigma = 0.02;
+static const float kNormalPower = 16;
+// Below this sum of the bilinear and bilateral weights, the blocks with the best bilateral weight are averaged instead
+static const float kMinWeight = 1e-3;
+
+
+uint2 UnpackPixel(const uint packed) {
+  return uint2(packed & 0xFFFF, packed >> 16);
+}
+
+
+float3 PixelToView(const uint2 px, const uint2 depth_tex_size) {
+  return UvToPos(float2(px) / float2(depth_tex_size), g_depth_tex[px], g_cam_constants.proj_inv_mtx);
+}
+
+
+// Joint bilateral upsampling of the rays ssr.hlsli traced per block. The color every ray hit is weighted by the
+// bilinear weight of its block and by how close the depth and normal of the pixel it started from are to those of the
+// output pixel, so that rays from across depth and normal edges do not bleed over them. Rays that missed take part in
+// the weighting with no color, which fades the reflection out towards the blocks that missed. The distances the rays
+// traveled to their hits are averaged like their colors, and the reflection texture gets the averaged color scaled by
+// the coverage. UpsamplePixel of ssr.cpp is the CPU port.
+[numthreads(SSR_UPSAMPLE_THREADS_X, SSR_UPSAMPLE_THREADS_Y, 1)]
+void CsMain(const uint3 dtid : SV_DispatchThreadID) {
+  uint2 depth_tex_size;
+  g_depth_tex.GetDimensions(depth_tex_size.x, depth_tex_size.y);
+
+  if (any(dtid.xy >= depth_tex_size)) {
+    return;
+  }
+
+  const float depth = g_depth_tex[dtid.xy];
+  const float roughness = g_gbuffer0[dtid.xy].a;
+
+  if (depth >= 0.9999 || roughness >= 0.5) {
+    g_ssr_tex[dtid.xy] = g_ibl_tex[dtid.xy];
+    g_ssr_hit_dist_tex[dtid.xy] = 0;
+    g_ssr_reflection_tex[dtid.xy] = float4(0, 0, 0, 0);
+    return;
+  }
+
+  const float3 normal_ws = g_gbuffer1[dtid.xy].rgb;
+  const float3 normal_vs = mul(float4(normal_ws, 0.0), g_cam_constants.view_mtx).xyz;
+  const float3 pos_vs = PixelToView(dtid.xy, depth_tex_size);
+  const float3 V = normalize(-pos_vs);
+  const float depth_vs = NdcToViewDepth(depth, g_cam_constants.near_clip, g_cam_constants.far_clip);
+
+  // The four blocks around the pixel, by their centers
+  const uint block_size = 1u << g_ssr_constants.trace_scale_log2;
+  const int2 block_count = int2((depth_tex_size + block_size - 1) >> g_ssr_constants.trace_scale_log2);
+  const float2 block_pos = (float2(dtid.xy) + 0.5) / float(block_size) - 0.5;
+  const int2 block_base = int2(floor(block_pos));
+  const float2 f = block_pos - float2(block_base);
+
+  float weight_sum = 0;
+  float hit_weight_sum = 0;
+  float3 color_sum = float3(0, 0, 0);
+  float hit_dist_sum = 0;
+  float best_weight = 0;
+  float best_count = 0;
+  float best_hit_count = 0;
+  float3 best_color_sum = float3(0, 0, 0);
+  float best_hit_dist_sum = 0;
+
+  for (int i = 0; i < 4; i++) {
+    const int2 offset = int2(i & 1, i >> 1);
+    const int2 block = clamp(block_base + offset, int2(0, 0), block_count - 1);
+    const uint2 source_hit = g_ssr_hits_tex[uint2(block)];
+
+    if (source_hit.x == SSR_NO_HIT) {
+      continue;
+    }
+
+    const uint2 source = UnpackPixel(source_hit.x);
+    const float source_depth_vs = NdcToViewDepth(g_depth_tex[source], g_cam_constants.near_clip,
+                                                 g_cam_constants.far_clip);
+    const float3 source_normal_ws = g_gbuffer1[source].rgb;
+
+    const float bilinear = (offset.x == 1 ? f.x : 1 - f.x) * (offset.y == 1 ? f.y : 1 - f.y);
+    const float bilateral = exp(-abs(source_depth_vs - depth_vs) / (kDepthSigma * depth_vs)) *
+                            pow(saturate(dot(normal_ws, source_normal_ws)), kNormalPower);
+    const float weight = bilinear * bilateral;
+    const bool hit = source_hit.y != SSR_NO_HIT;
+    // Both sides of ?: are evaluated, loads of the out of bounds pixel of SSR_NO_HIT return 0
+    const uint2 hit_pixel = UnpackPixel(source_hit.y);
+    const float3 hit_color = hit ? g_ibl_tex[hit_pixel].rgb : float3(0, 0, 0);
+    const float hit_dist = hit
+                             ? distance(PixelToView(source, depth_tex_size), PixelToView(hit_pixel, depth_tex_size))
+                             : 0;
+
+    weight_sum += weight;
+
+    if (hit) {
+      hit_weight_sum += weight;
+      color_sum += weight * hit_color;
+      hit_dist_sum += weight * hit_dist;
+    }
+
+    if (bilateral > best_weight) {
+      best_weight = bilateral;
+      best_count = 0;
+      best_hit_count = 0;
+      best_color_sum = float3(0, 0, 0);
+      best_hit_dist_sum = 0;
+    }
+
+    if (bilateral > 0 && bilateral == best_weight) {
+      best_count += 1;
+
+      if (hit) {
+        best_hit_count += 1;
+        best_color_sum += hit_color;
+        best_hit_dist_sum += hit_dist;
+      }
+    }
+  }
+
+  float coverage = 0;
+  float3 hit_color = float3(0, 0, 0);
+  float hit_dist = 0;
+
+  if (weight_sum >= kMinWeight) {
+    coverage = hit_weight_sum / weight_sum;
+    hit_color = hit_weight_sum > 0 ? color_sum / hit_weight_sum : float3(0, 0, 0);
+    hit_dist = hit_weight_sum > 0 ? hit_dist_sum / hit_weight_sum : 0;
+  } else if (best_hit_count > 0) {
+    coverage = best_hit_count / best_count;
+    hit_color = best_color_sum / best_hit_count;
+    hit_dist = best_hit_dist_sum / best_hit_count;
+  }
+
+  const float3 px_color = g_ibl_tex[dtid.xy].rgb;
+
+  if (coverage > 0) {
+    const float3 F = FresnelSchlick(saturate(dot(normal_vs, V)), hit_color);
+    const float3 weight = pow(1.0 - roughness, 3.0) * F * coverage;
+    g_ssr_tex[dtid.xy] = float4(lerp(px_color, hit_color, weight), 1);
+    g_ssr_hit_dist_tex[dtid.xy] = hit_dist;
+    g_ssr_reflection_tex[dtid.xy] = float4(hit_color * coverage, coverage);
+  } else {
+    g_ssr_tex[dtid.xy] = g_ibl_tex[dtid.xy];
+    g_ssr_hit_dist_tex[dtid.xy] = 0;
+    g_ssr_reflection_tex[dtid.xy] = float4(0, 0, 0, 0);
+  }
+}
@@ -0,0 +1,28 @@
+// ReSharper disable CppEnforceCVQualifiersPlacement
+
+#ifndef VERTEX_PACKING_HLSLI
+#define VERTEX_PACKING_HLSLI
+
+// Decoding of the packed vertex layout, must match vertex_packing.cpp
+
+float3 OctDecode(const float2 oct) {
+  float3 dir = float3(oct, 1.0 - abs(oct.x) - abs(oct.y));
+  const float t = saturate(-dir.z);
+  dir.xy += dir.xy >= 0.0 ? -t : t; // Component-wise select
+  return normalize(dir);
+}
+
+
+// Octahedral normal from R16G16_SNORM
+float3 UnpackNormal(const float2 packed) {
+  return OctDecode(packed);
+}
+
+
+// 15 bit biased octahedral x and y, handedness in the top bit. Returns the bitangent sign in w.
+float4 UnpackTangent(const uint packed) {
+  const float2 oct = (float2(packed & 0x7FFF, (packed >> 15) & 0x7FFF) - 16383.0) / 16383.0;
+  return float4(OctDecode(oct), (packed & 0x80000000) ? -1.0 : 1.0);
+}
+
+#endif
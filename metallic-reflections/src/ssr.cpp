@@ -0,0 +1,1197 @@
+#include "ssr.hpp"
+
+#include <DirectXMath.h>
+
+#include "cache.hpp"
+#include "parallel.hpp"
+
+import std;
+
+namespace refl {
+namespace {
+namespace dx = DirectX;
+
+std::array<char, 8> constexpr kSsrFrameMagic{'R', 'E', 'F', 'L', 'S', 'S', 'R', '\0'};
+std::uint32_t constexpr kSsrFrameVersion{4};
+
+// Constants of ssr.hlsli
+float constexpr kBackgroundDepth{0.9999f};
+float constexpr kMaxRoughness{0.5f};
+float constexpr kStepSize{0.001f};
+float constexpr kThickness{0.005f};
+float constexpr kRayStartOffset{0.1f};
+int constexpr kLastStep{10000};
+// The DDA march covers the same distance as the linear one
+float constexpr kDdaMaxDistance{static_cast<float>(kLastStep) * kStepSize};
+
+// Constants of ssr_upsample.hlsli
+float constexpr kUpsampleDepthSigma{0.02f};
+float constexpr kUpsampleNormalPower{16};
+float constexpr kUpsampleMinWeight{1e-3f};
+
+// Constants of ssr_temporal.hlsli
+float constexpr kDisocclusionDepthRatio{0.05f};
+
+
+struct SsrFrameHeader {
+  std::array<char, 8> magic;
+  std::uint32_t version;
+  std::uint32_t width;
+  std::uint32_t height;
+};
+
+
+// Matrices of the camera constants, loaded once for the whole pass
+struct SsrMatrices {
+  dx::XMMATRIX view;
+  dx::XMMATRIX proj;
+  dx::XMMATRIX proj_inv;
+};
+
+
+struct SsrPixel {
+  Vector4 color;
+  std::uint32_t step_count;
+  std::uint32_t hit;
+  float hit_distance;
+  Vector4 reflection;
+};
+
+
+// Port of NdcToViewDepth of change_of_basis.hlsli
+auto NdcToViewDepth(float const ndc_depth, float const near_clip, float const far_clip) -> float {
+  return near_clip * far_clip / (far_clip - ndc_depth * (far_clip - near_clip));
+}
+
+
+// Port of FresnelSchlick of brdf.hlsli
+auto FresnelSchlick(float const v_dot_h, dx::XMVECTOR const f0) -> dx::XMVECTOR {
+  auto const factor{std::pow(std::clamp(1 - v_dot_h, 0.0f, 1.0f), 5.0f)};
+  return dx::XMVectorAdd(f0, dx::XMVectorScale(dx::XMVectorSubtract(dx::XMVectorReplicate(1), f0), factor));
+}
+
+
+// The float to uint conversion of D3D clamps out of range values and turns NaN into 0. Rays that leave the screen to
+// the left or top therefore keep marching along the first column or row instead of stopping.
+auto FloatToUint(float const value) -> std::uint32_t {
+  if (!(value > 0)) {
+    return 0;
+  }
+
+  if (value >= 4294967296.0f) {
+    return std::numeric_limits<std::uint32_t>::max();
+  }
+
+  return static_cast<std::uint32_t>(value);
+}
+
+
+auto LoadVector4(Vector4 const& v) -> dx::XMVECTOR {
+  return dx::XMVectorSet(v[0], v[1], v[2], v[3]);
+}
+
+
+auto StoreVector4(dx::XMVECTOR const v) -> Vector4 {
+  return {dx::XMVectorGetX(v), dx::XMVectorGetY(v), dx::XMVectorGetZ(v), dx::XMVectorGetW(v)};
+}
+
+
+struct SsrRay {
+  dx::XMVECTOR start_vs;
+  dx::XMVECTOR dir_vs;
+  dx::XMVECTOR normal_vs;
+  dx::XMVECTOR view_dir;
+  float roughness;
+};
+
+
+// A point of the march and the pixel it projects to
+struct RaySample {
+  dx::XMVECTOR pos_vs;
+  float w; // Clip space
+  std::uint32_t x;
+  std::uint32_t y;
+  bool on_screen;
+};
+
+
+struct SsrMarch {
+  std::optional<std::size_t> hit_idx;
+  std::uint32_t step_count;
+};
+
+
+// Pixels that are background or too rough keep the output of the lighting pass
+auto ReflectsScreen(float const depth, float const roughness) -> bool {
+  return depth < kBackgroundDepth && roughness < kMaxRoughness;
+}
+
+
+// PixelToView of ssr.hlsli
+auto PixelToView(SsrFrame const& frame, SsrMatrices const& matrices, std::uint32_t const x,
+                 std::uint32_t const y) -> dx::XMVECTOR {
+  auto const depth{frame.depth[static_cast<std::size_t>(y) * frame.width + x]};
+
+  // UvToNdc of change_of_basis.hlsli
+  auto const u{static_cast<float>(x) / static_cast<float>(frame.width)};
+  auto const v{static_cast<float>(y) / static_cast<float>(frame.height)};
+  auto const pos4_vs{dx::XMVector4Transform(dx::XMVectorSet(u * 2 - 1, v * -2 + 1, depth, 1), matrices.proj_inv)};
+  return dx::XMVectorSetW(dx::XMVectorDivide(pos4_vs, dx::XMVectorSplatW(pos4_vs)), 0);
+}
+
+
+// View space distance between two pixels, the hit distance of a ray from the first that hit the second
+auto PixelDistance(SsrFrame const& frame, SsrMatrices const& matrices, std::size_t const from_idx,
+                   std::size_t const to_idx) -> float {
+  auto const from{PixelToView(frame, matrices, static_cast<std::uint32_t>(from_idx % frame.width),
+                              static_cast<std::uint32_t>(from_idx / frame.width))};
+  auto const to{PixelToView(frame, matrices, static_cast<std::uint32_t>(to_idx % frame.width),
+                            static_cast<std::uint32_t>(to_idx / frame.width))};
+  return dx::XMVectorGetX(dx::XMVector3Length(dx::XMVectorSubtract(to, from)));
+}
+
+
+// Everything CsMain of ssr.hlsli computes before the march, nullopt for the pixels that keep the lighting pass output
+auto SetUpRay(SsrFrame const& frame, SsrMatrices const& matrices, std::uint32_t const x,
+              std::uint32_t const y) -> std::optional<SsrRay> {
+  auto const idx{static_cast<std::size_t>(y) * frame.width + x};
+  auto const depth{frame.depth[idx]};
+  auto const roughness{frame.gbuffer0[idx][3]};
+
+  if (!ReflectsScreen(depth, roughness)) {
+    return std::nullopt;
+  }
+
+  auto const& normal_ws{frame.gbuffer1[idx]};
+  auto const normal_vs{
+    dx::XMVector4Transform(dx::XMVectorSet(normal_ws[0], normal_ws[1], normal_ws[2], 0), matrices.view)
+  };
+
+  auto const pos_vs{PixelToView(frame, matrices, x, y)};
+  auto const view_dir{dx::XMVector3Normalize(dx::XMVectorNegate(pos_vs))};
+  auto const reflected{dx::XMVectorSetW(dx::XMVector3Reflect(dx::XMVectorNegate(view_dir), normal_vs), 0)};
+
+  return SsrRay{
+    .start_vs = dx::XMVectorAdd(pos_vs, dx::XMVectorScale(reflected, kRayStartOffset)),
+    .dir_vs = reflected,
+    .normal_vs = normal_vs,
+    .view_dir = view_dir,
+    .roughness = roughness
+  };
+}
+
+
+auto SampleRay(SsrFrame const& frame, SsrMatrices const& matrices, SsrRay const& ray, int const step) -> RaySample {
+  auto const pos_vs{dx::XMVectorAdd(ray.start_vs, dx::XMVectorScale(ray.dir_vs, static_cast<float>(step) * kStepSize))};
+  auto const pos_cs{dx::XMVector4Transform(dx::XMVectorSetW(pos_vs, 1), matrices.proj)};
+  auto const pos_ndc{dx::XMVectorDivide(pos_cs, dx::XMVectorSplatW(pos_cs))};
+
+  // NdcToUv of change_of_basis.hlsli
+  auto const u{dx::XMVectorGetX(pos_ndc) * 0.5f + 0.5f};
+  auto const v{dx::XMVectorGetY(pos_ndc) * -0.5f + 0.5f};
+  auto const x{FloatToUint(u * static_cast<float>(frame.width))};
+  auto const y{FloatToUint(v * static_cast<float>(frame.height))};
+
+  return {
+    .pos_vs = pos_vs, .w = dx::XMVectorGetW(pos_cs), .x = x, .y = y,
+    .on_screen = x < frame.width && y < frame.height
+  };
+}
+
+
+auto IsHit(SsrFrame const& frame, RaySample const& sample) -> bool {
+  auto const depth{frame.depth[static_cast<std::size_t>(sample.y) * frame.width + sample.x]};
+  auto const depth_vs{NdcToViewDepth(depth, frame.camera.near_clip, frame.camera.far_clip)};
+  return std::abs(dx::XMVectorGetZ(sample.pos_vs) - depth_vs) < kThickness;
+}
+
+
+auto MarchLinear(SsrFrame const& frame, SsrMatrices const& matrices, SsrRay const& ray) -> SsrMarch {
+  std::uint32_t step_count{0};
+
+  for (int i{0}; i <= kLastStep; i++) {
+    step_count += 1;
+
+    auto const sample{SampleRay(frame, matrices, ray, i)};
+
+    if (!sample.on_screen) {
+      break;
+    }
+
+    if (IsHit(frame, sample)) {
+      return {.hit_idx = static_cast<std::size_t>(sample.y) * frame.width + sample.x, .step_count = step_count};
+    }
+  }
+
+  return {.hit_idx = std::nullopt, .step_count = step_count};
+}
+
+
+// Last step from the first one on for which f0 + step * df stays at least 0, given that it is at the first step
+auto LastStepInside(float const f0, float const df, int const first_step) -> int {
+  if (df >= 0) {
+    return kLastStep;
+  }
+
+  return static_cast<int>(std::clamp(std::floor(-f0 / df), static_cast<float>(first_step - 1),
+                                     static_cast<float>(kLastStep)));
+}
+
+
+// Takes the steps of MarchLinear, but before testing one it looks up the cell of the current pyramid mip the step
+// lands in and finds the last step still in that cell. If the view depth of the ray between the two cannot come within
+// the thickness of the min and max of the cell, none of those steps can hit, so they are skipped and the step after
+// them is looked up one mip coarser. Otherwise the same step is looked up one mip finer, and at mip 0 it is tested as
+// MarchLinear would. The hits are the same as those of MarchLinear, every lookup counts as a step.
+auto MarchHiZ(SsrFrame const& frame, SsrMatrices const& matrices, HiZPyramid const& hiz,
+              SsrRay const& ray) -> SsrMarch {
+  // The clip space position of a step is linear in the step index, so every edge of a cell is a linear inequality
+  dx::XMFLOAT4 cs_start;
+  dx::XMStoreFloat4(&cs_start, dx::XMVector4Transform(dx::XMVectorSetW(ray.start_vs, 1), matrices.proj));
+  dx::XMFLOAT4 cs_step;
+  dx::XMStoreFloat4(&cs_step, dx::XMVector4Transform(dx::XMVectorScale(ray.dir_vs, kStepSize), matrices.proj));
+
+  auto const width{static_cast<float>(frame.width)};
+  auto const height{static_cast<float>(frame.height)};
+  auto const top_level{static_cast<std::uint32_t>(hiz.mips.size() - 1)};
+
+  std::uint32_t level{0};
+  std::uint32_t step_count{0};
+  auto i{0};
+  auto sample{SampleRay(frame, matrices, ray, i)};
+
+  while (i <= kLastStep) {
+    step_count += 1;
+
+    if (!sample.on_screen) {
+      break;
+    }
+
+    auto const& mip{hiz.mips[level]};
+    auto const cell_x{std::min(sample.x >> level, mip.width - 1)};
+    auto const cell_y{std::min(sample.y >> level, mip.height - 1)};
+    auto const [depth_min, depth_max]{mip.texels[static_cast<std::size_t>(cell_y) * mip.width + cell_x]};
+
+    auto const x0{cell_x << level};
+    auto const y0{cell_y << level};
+    auto const x1{cell_x == mip.width - 1 ? frame.width : (cell_x + 1) << level};
+    auto const y1{cell_y == mip.height - 1 ? frame.height : (cell_y + 1) << level};
+
+    // Steps left of and above the screen clamp to its first column and row, so those edges never end a cell
+    auto last{LastStepInside(cs_start.w, cs_step.w, i)};
+
+    if (x0 > 0) {
+      auto const b{2 * static_cast<float>(x0) / width - 1};
+      last = std::min(last, LastStepInside(cs_start.x - b * cs_start.w, cs_step.x - b * cs_step.w, i));
+    }
+
+    if (y0 > 0) {
+      auto const b{1 - 2 * static_cast<float>(y0) / height};
+      last = std::min(last, LastStepInside(b * cs_start.w - cs_start.y, b * cs_step.w - cs_step.y, i));
+    }
+
+    auto const b_right{2 * static_cast<float>(x1) / width - 1};
+    last = std::min(last, LastStepInside(b_right * cs_start.w - cs_start.x, b_right * cs_step.w - cs_step.x, i));
+    auto const b_bottom{1 - 2 * static_cast<float>(y1) / height};
+    last = std::min(last, LastStepInside(cs_start.y - b_bottom * cs_start.w, cs_step.y - b_bottom * cs_step.w, i));
+
+    // The inequalities are solved in floats, so the last step is checked against the pixels the march computes
+    auto const in_cell{
+      [&](RaySample const& s) {
+        return s.on_screen && s.w > 0 && s.x >= x0 && s.x < x1 && s.y >= y0 && s.y < y1;
+      }
+    };
+
+    auto skip{false};
+
+    if (last >= i && sample.w > 0) {
+      auto last_sample{SampleRay(frame, matrices, ray, last)};
+
+      if (!in_cell(last_sample) && last > i) {
+        last -= 1;
+        last_sample = SampleRay(frame, matrices, ray, last);
+      }
+
+      if (in_cell(last_sample)) {
+        auto const z_first{dx::XMVectorGetZ(sample.pos_vs)};
+        auto const z_last{dx::XMVectorGetZ(last_sample.pos_vs)};
+        auto const could_hit{
+          std::max(z_first, z_last) - depth_min > -kThickness && std::min(z_first, z_last) - depth_max < kThickness
+        };
+        skip = !could_hit;
+      }
+    }
+
+    if (skip) {
+      i = last + 1;
+      level = std::min(level + 1, top_level);
+      sample = SampleRay(frame, matrices, ray, i);
+      continue;
+    }
+
+    if (level > 0) {
+      level -= 1;
+      continue;
+    }
+
+    if (IsHit(frame, sample)) {
+      return {.hit_idx = static_cast<std::size_t>(sample.y) * frame.width + sample.x, .step_count = step_count};
+    }
+
+    i += 1;
+    sample = SampleRay(frame, matrices, ray, i);
+  }
+
+  return {.hit_idx = std::nullopt, .step_count = step_count};
+}
+
+
+// Port of InterleavedGradientNoise of ray_march.hlsli
+auto InterleavedGradientNoise(std::uint32_t const x, std::uint32_t const y) -> float {
+  auto const frac{[](float const value) { return value - std::floor(value); }};
+  return frac(52.9829189f * frac(0.06711056f * static_cast<float>(x) + 0.00583715f * static_cast<float>(y)));
+}
+
+
+// The ray of MarchDda projected to pixels. Points along it are given in strides from the start. The axis the ray moves
+// faster along on screen is the major one, which advances by exactly one stride per stride.
+struct DdaRay {
+  float start_major;
+  float start_minor;
+  float d_major;
+  float d_minor;
+  float homog_z; // View depth divided by clip space w, which is linear in pixels unlike view depth
+  float d_homog_z;
+  float inv_w;
+  float d_inv_w;
+  float end; // Strides to the end of the ray
+  bool permute; // Whether the major axis is y
+};
+
+
+// The part of MarchRay of ray_march.hlsli before the loop, nullopt for rays that start in front of the near plane
+auto SetUpDda(SsrFrame const& frame, SsrMatrices const& matrices, SsrRay const& ray,
+              float const pixel_stride) -> std::optional<DdaRay> {
+  auto const near_clip{frame.camera.near_clip};
+  auto const start_z{dx::XMVectorGetZ(ray.start_vs)};
+  auto const dir_z{dx::XMVectorGetZ(ray.dir_vs)};
+
+  if (start_z < near_clip) {
+    return std::nullopt;
+  }
+
+  // Clip the ray against the near plane so that clip space w stays positive along it
+  auto length{kDdaMaxDistance};
+
+  if (dir_z < 0 && start_z + dir_z * length < near_clip) {
+    length = (near_clip - start_z) / dir_z;
+  }
+
+  auto const end_vs{dx::XMVectorAdd(ray.start_vs, dx::XMVectorScale(ray.dir_vs, length))};
+  auto const end_z{dx::XMVectorGetZ(end_vs)};
+
+  // Clip space to pixels, cs_to_px of ssr.hlsli
+  auto const half_width{static_cast<float>(frame.width) / 2};
+  auto const half_height{static_cast<float>(frame.height) / 2};
+  auto const to_pixels{
+    [&](dx::XMVECTOR const pos_vs) {
+      dx::XMFLOAT4 cs;
+      dx::XMStoreFloat4(&cs, dx::XMVector4Transform(dx::XMVectorSetW(pos_vs, 1), matrices.proj));
+      return dx::XMFLOAT4{cs.x * half_width + cs.w * half_width, cs.y * -half_height + cs.w * half_height, cs.z, cs.w};
+    }
+  };
+
+  auto const h0{to_pixels(ray.start_vs)};
+  auto const h1{to_pixels(end_vs)};
+  auto const inv_w0{1 / h0.w};
+  auto const inv_w1{1 / h1.w};
+
+  auto start_x{h0.x * inv_w0};
+  auto start_y{h0.y * inv_w0};
+  auto delta_x{h1.x * inv_w1 - start_x};
+  auto delta_y{h1.y * inv_w1 - start_y};
+
+  // Rays along the view direction stay within a pixel, give them some extent
+  if (delta_x * delta_x + delta_y * delta_y < 0.0001f) {
+    delta_x += 0.01f;
+  }
+
+  auto const permute{std::abs(delta_x) < std::abs(delta_y)};
+
+  if (permute) {
+    std::swap(start_x, start_y);
+    std::swap(delta_x, delta_y);
+  }
+
+  auto const step_dir{delta_x >= 0 ? 1.0f : -1.0f};
+  auto const inv_dx{step_dir / delta_x * pixel_stride};
+
+  return DdaRay{
+    .start_major = start_x,
+    .start_minor = start_y,
+    .d_major = step_dir * pixel_stride,
+    .d_minor = delta_y * inv_dx,
+    .homog_z = start_z * inv_w0,
+    .d_homog_z = (end_z * inv_w1 - start_z * inv_w0) * inv_dx,
+    .inv_w = inv_w0,
+    .d_inv_w = (inv_w1 - inv_w0) * inv_dx,
+    .end = std::abs(delta_x) / pixel_stride,
+    .permute = permute
+  };
+}
+
+
+struct DdaSample {
+  bool on_screen;
+  bool hit;
+  std::size_t idx;
+};
+
+
+// Tests the pixel at t strides against the part of the ray from t - half_width to t + half_width strides. It hits if
+// the view depth of that part comes within the thickness of the depth of the pixel, the criterion of IsHit.
+auto SampleDda(SsrFrame const& frame, DdaRay const& ray, float const t, float const half_width) -> DdaSample {
+  auto const major{ray.start_major + ray.d_major * t};
+  auto const minor{ray.start_minor + ray.d_minor * t};
+  auto const x{ray.permute ? minor : major};
+  auto const y{ray.permute ? major : minor};
+
+  if (!(x >= 0 && y >= 0 && x < static_cast<float>(frame.width) && y < static_cast<float>(frame.height))) {
+    return {.on_screen = false, .hit = false, .idx = 0};
+  }
+
+  auto const idx{static_cast<std::size_t>(y) * frame.width + static_cast<std::size_t>(x)};
+
+  auto const z_at{
+    [&ray](float const s) {
+      auto const clamped{std::clamp(s, 0.0f, ray.end)};
+      return (ray.homog_z + ray.d_homog_z * clamped) / (ray.inv_w + ray.d_inv_w * clamped);
+    }
+  };
+
+  auto const z_first{z_at(t - half_width)};
+  auto const z_last{z_at(t + half_width)};
+  auto const depth_vs{NdcToViewDepth(frame.depth[idx], frame.camera.near_clip, frame.camera.far_clip)};
+  auto const hit{
+    std::max(z_first, z_last) - depth_vs > -kThickness && std::min(z_first, z_last) - depth_vs < kThickness
+  };
+
+  return {.on_screen = true, .hit = hit, .idx = idx};
+}
+
+
+// Port of MarchRay of ray_march.hlsli. Steps through the pixels the ray covers on screen a stride at a time, starting
+// at a jittered fraction of a stride. Once a stride hits it is halved, the first half tested and the second one if
+// the first misses, and the hit pixel is the last one that passed. Every test counts as a step.
+auto MarchDda(SsrFrame const& frame, SsrMatrices const& matrices, SsrConstants const& constants, SsrRay const& ray,
+              std::uint32_t const x, std::uint32_t const y) -> SsrMarch {
+  auto const dda{SetUpDda(frame, matrices, ray, std::max(constants.dda_pixel_stride, 1.0f))};
+
+  if (!dda) {
+    return {.hit_idx = std::nullopt, .step_count = 0};
+  }
+
+  auto const jitter{std::clamp(constants.dda_jitter, 0.0f, 1.0f) * InterleavedGradientNoise(x, y)};
+  std::uint32_t step_count{0};
+
+  for (std::uint32_t i{0}; i < constants.dda_max_steps; i++) {
+    auto t{static_cast<float>(i) + jitter};
+
+    if (t > dda->end) {
+      break;
+    }
+
+    step_count += 1;
+    auto const sample{SampleDda(frame, *dda, t, 0.5f)};
+
+    if (!sample.on_screen) {
+      break;
+    }
+
+    if (!sample.hit) {
+      continue;
+    }
+
+    auto hit_idx{sample.idx};
+    auto half_width{0.5f};
+
+    for (std::uint32_t j{0}; j < constants.dda_refine_steps; j++) {
+      half_width *= 0.5f;
+      step_count += 1;
+
+      if (auto const first{SampleDda(frame, *dda, t - half_width, half_width)}; first.hit) {
+        t -= half_width;
+        hit_idx = first.idx;
+        continue;
+      }
+
+      step_count += 1;
+
+      if (auto const second{SampleDda(frame, *dda, t + half_width, half_width)}; second.hit) {
+        t += half_width;
+        hit_idx = second.idx;
+        continue;
+      }
+
+      // The ray hit across the boundary of two pixels
+      break;
+    }
+
+    return {.hit_idx = hit_idx, .step_count = step_count};
+  }
+
+  return {.hit_idx = std::nullopt, .step_count = step_count};
+}
+
+
+// Picks the march of the constants, TracePixel of ssr.hlsli
+auto MarchRay(SsrFrame const& frame, SsrMatrices const& matrices, SsrConstants const& constants, HiZPyramid const& hiz,
+              SsrRay const& ray, std::uint32_t const x, std::uint32_t const y) -> SsrMarch {
+  switch (static_cast<SsrMarchMode>(constants.march_mode)) {
+    case SsrMarchMode::kHiZ:
+      return MarchHiZ(frame, matrices, hiz, ray);
+    case SsrMarchMode::kDda:
+      return MarchDda(frame, matrices, constants, ray, x, y);
+    default:
+      return MarchLinear(frame, matrices, ray);
+  }
+}
+
+
+// Blends the color a ray hit over the output of the lighting pass, by coverage for the rays of ssr_upsample.hlsli
+auto ShadeHit(SsrFrame const& frame, SsrRay const& ray, std::size_t const idx, dx::XMVECTOR const hit_color,
+              float const coverage) -> Vector4 {
+  auto const px_color{dx::XMVectorSetW(LoadVector4(frame.ibl[idx]), 0)};
+  auto const n_dot_v{std::clamp(dx::XMVectorGetX(dx::XMVector3Dot(ray.normal_vs, ray.view_dir)), 0.0f, 1.0f)};
+  auto const f{FresnelSchlick(n_dot_v, hit_color)};
+  auto const weight{dx::XMVectorScale(dx::XMVectorScale(f, std::pow(1 - ray.roughness, 3.0f)), coverage)};
+  auto color{StoreVector4(dx::XMVectorLerpV(px_color, hit_color, weight))};
+  color[3] = 1;
+  return color;
+}
+
+
+// CsMain of ssr.hlsli for a single pixel when it traces every pixel
+auto TracePixel(SsrFrame const& frame, SsrMatrices const& matrices, SsrConstants const& constants,
+                HiZPyramid const& hiz, std::uint32_t const x, std::uint32_t const y) -> SsrPixel {
+  auto const idx{static_cast<std::size_t>(y) * frame.width + x};
+  auto const ray{SetUpRay(frame, matrices, x, y)};
+
+  if (!ray) {
+    return {.color = frame.ibl[idx], .step_count = 0, .hit = kSsrNoHit, .hit_distance = 0, .reflection = {}};
+  }
+
+  auto const [hit_idx, step_count]{MarchRay(frame, matrices, constants, hiz, *ray, x, y)};
+
+  if (!hit_idx) {
+    return {.color = frame.ibl[idx], .step_count = step_count, .hit = kSsrNoHit, .hit_distance = 0, .reflection = {}};
+  }
+
+  auto const hit_color{dx::XMVectorSetW(LoadVector4(frame.ibl[*hit_idx]), 0)};
+  return {
+    .color = ShadeHit(frame, *ray, idx, hit_color, 1), .step_count = step_count,
+    .hit = static_cast<std::uint32_t>(*hit_idx), .hit_distance = PixelDistance(frame, matrices, idx, *hit_idx),
+    .reflection = StoreVector4(dx::XMVectorSetW(hit_color, 1))
+  };
+}
+
+
+// The rays traced one per block of pixels, the hit texture of ssr.hlsli
+struct SsrBlocks {
+  std::uint32_t width;
+  std::uint32_t height;
+  std::vector<std::uint32_t> sources; // Index of the pixel the ray of every block starts from, or kSsrNoHit
+  std::vector<std::uint32_t> hits; // Index of the pixel it hit, or kSsrNoHit
+};
+
+
+struct SsrBlockRay {
+  std::uint32_t source;
+  std::uint32_t hit;
+  std::uint32_t step_count;
+};
+
+
+// RotatedSourceOffset of ssr.hlsli
+auto RotatedSourceOffset(std::uint32_t const frame_index,
+                         std::uint32_t const scale_log2) -> std::pair<std::uint32_t, std::uint32_t> {
+  std::pair<std::uint32_t, std::uint32_t> offset{0, 0};
+
+  for (std::uint32_t level{0}; level < scale_log2; level++) {
+    auto const quadrant{(frame_index >> (2 * level)) & 3};
+    auto const quadrant_size{1u << (scale_log2 - 1 - level)};
+    offset.first += quadrant == 1 || quadrant == 2 ? quadrant_size : 0;
+    offset.second += quadrant == 1 || quadrant == 3 ? quadrant_size : 0;
+  }
+
+  return offset;
+}
+
+
+// TraceBlock of ssr.hlsli, the ray starts from the pixel of the rotation if the constants rotate the sources and it
+// reflects the screen, and from the closest pixel of the block that does otherwise
+auto TraceBlock(SsrFrame const& frame, SsrMatrices const& matrices, SsrConstants const& constants,
+                HiZPyramid const& hiz, std::uint32_t const block_x, std::uint32_t const block_y) -> SsrBlockRay {
+  auto const block_size{1u << constants.trace_scale_log2};
+  auto const block_end_x{std::min((block_x + 1) * block_size, frame.width)};
+  auto const block_end_y{std::min((block_y + 1) * block_size, frame.height)};
+  std::optional<std::pair<std::uint32_t, std::uint32_t>> source;
+
+  if (constants.rotate_sources) {
+    auto const [offset_x, offset_y]{RotatedSourceOffset(constants.frame_index, constants.trace_scale_log2)};
+    auto const x{block_x * block_size + offset_x};
+    auto const y{block_y * block_size + offset_y};
+
+    if (x < block_end_x && y < block_end_y) {
+      auto const idx{static_cast<std::size_t>(y) * frame.width + x};
+
+      if (ReflectsScreen(frame.depth[idx], frame.gbuffer0[idx][3])) {
+        source = std::pair{x, y};
+      }
+    }
+  }
+
+  if (!source) {
+    auto source_depth{1.0f};
+
+    for (auto y{block_y * block_size}; y < block_end_y; y++) {
+      for (auto x{block_x * block_size}; x < block_end_x; x++) {
+        auto const idx{static_cast<std::size_t>(y) * frame.width + x};
+        auto const depth{frame.depth[idx]};
+
+        if (ReflectsScreen(depth, frame.gbuffer0[idx][3]) && (!source || depth < source_depth)) {
+          source = std::pair{x, y};
+          source_depth = depth;
+        }
+      }
+    }
+  }
+
+  if (!source) {
+    return {.source = kSsrNoHit, .hit = kSsrNoHit, .step_count = 0};
+  }
+
+  auto const [x, y]{*source};
+  auto const [hit_idx, step_count]{MarchRay(frame, matrices, constants, hiz, *SetUpRay(frame, matrices, x, y), x, y)};
+  return {
+    .source = y * frame.width + x, .hit = hit_idx ? static_cast<std::uint32_t>(*hit_idx) : kSsrNoHit,
+    .step_count = step_count
+  };
+}
+
+
+struct SsrUpsampledPixel {
+  Vector4 color;
+  float hit_distance;
+  Vector4 reflection;
+};
+
+
+// Port of CsMain of ssr_upsample.hlsli for a single pixel
+auto UpsamplePixel(SsrFrame const& frame, SsrMatrices const& matrices, SsrConstants const& constants,
+                   SsrBlocks const& blocks, std::uint32_t const x, std::uint32_t const y) -> SsrUpsampledPixel {
+  auto const idx{static_cast<std::size_t>(y) * frame.width + x};
+  auto const ray{SetUpRay(frame, matrices, x, y)};
+
+  if (!ray) {
+    return {.color = frame.ibl[idx], .hit_distance = 0, .reflection = {}};
+  }
+
+  auto const& normal_ws{frame.gbuffer1[idx]};
+  auto const depth_vs{NdcToViewDepth(frame.depth[idx], frame.camera.near_clip, frame.camera.far_clip)};
+
+  // The four blocks around the pixel, by their centers
+  auto const block_size{static_cast<float>(1u << constants.trace_scale_log2)};
+  auto const block_pos_x{(static_cast<float>(x) + 0.5f) / block_size - 0.5f};
+  auto const block_pos_y{(static_cast<float>(y) + 0.5f) / block_size - 0.5f};
+  auto const block_base_x{static_cast<int>(std::floor(block_pos_x))};
+  auto const block_base_y{static_cast<int>(std::floor(block_pos_y))};
+  auto const fx{block_pos_x - static_cast<float>(block_base_x)};
+  auto const fy{block_pos_y - static_cast<float>(block_base_y)};
+
+  auto weight_sum{0.0f};
+  auto hit_weight_sum{0.0f};
+  auto color_sum{dx::XMVectorZero()};
+  auto hit_distance_sum{0.0f};
+  auto best_weight{0.0f};
+  auto best_count{0.0f};
+  auto best_hit_count{0.0f};
+  auto best_color_sum{dx::XMVectorZero()};
+  auto best_hit_distance_sum{0.0f};
+
+  for (auto i{0}; i < 4; i++) {
+    auto const offset_x{i & 1};
+    auto const offset_y{i >> 1};
+    auto const block_x{std::clamp(block_base_x + offset_x, 0, static_cast<int>(blocks.width) - 1)};
+    auto const block_y{std::clamp(block_base_y + offset_y, 0, static_cast<int>(blocks.height) - 1)};
+    auto const block_idx{static_cast<std::size_t>(block_y) * blocks.width + static_cast<std::size_t>(block_x)};
+    auto const source{blocks.sources[block_idx]};
+
+    if (source == kSsrNoHit) {
+      continue;
+    }
+
+    auto const source_depth_vs{
+      NdcToViewDepth(frame.depth[source], frame.camera.near_clip, frame.camera.far_clip)
+    };
+    auto const& source_normal_ws{frame.gbuffer1[source]};
+    auto const n_dot_n{
+      std::clamp(normal_ws[0] * source_normal_ws[0] + normal_ws[1] * source_normal_ws[1] +
+                 normal_ws[2] * source_normal_ws[2], 0.0f, 1.0f)
+    };
+
+    auto const bilinear{(offset_x == 1 ? fx : 1 - fx) * (offset_y == 1 ? fy : 1 - fy)};
+    auto const bilateral{
+      std::exp(-std::abs(source_depth_vs - depth_vs) / (kUpsampleDepthSigma * depth_vs)) *
+      std::pow(n_dot_n, kUpsampleNormalPower)
+    };
+    auto const weight{bilinear * bilateral};
+    auto const hit{blocks.hits[block_idx]};
+    auto const hit_color{
+      hit == kSsrNoHit ? dx::XMVectorZero() : dx::XMVectorSetW(LoadVector4(frame.ibl[hit]), 0)
+    };
+    auto const hit_distance{hit == kSsrNoHit ? 0.0f : PixelDistance(frame, matrices, source, hit)};
+
+    weight_sum += weight;
+
+    if (hit != kSsrNoHit) {
+      hit_weight_sum += weight;
+      color_sum = dx::XMVectorAdd(color_sum, dx::XMVectorScale(hit_color, weight));
+      hit_distance_sum += weight * hit_distance;
+    }
+
+    if (bilateral > best_weight) {
+      best_weight = bilateral;
+      best_count = 0;
+      best_hit_count = 0;
+      best_color_sum = dx::XMVectorZero();
+      best_hit_distance_sum = 0;
+    }
+
+    if (bilateral > 0 && bilateral == best_weight) {
+      best_count += 1;
+
+      if (hit != kSsrNoHit) {
+        best_hit_count += 1;
+        best_color_sum = dx::XMVectorAdd(best_color_sum, hit_color);
+        best_hit_distance_sum += hit_distance;
+      }
+    }
+  }
+
+  auto coverage{0.0f};
+  auto hit_color{dx::XMVectorZero()};
+  auto hit_distance{0.0f};
+
+  if (weight_sum >= kUpsampleMinWeight) {
+    coverage = hit_weight_sum / weight_sum;
+    hit_color = hit_weight_sum > 0 ? dx::XMVectorScale(color_sum, 1 / hit_weight_sum) : dx::XMVectorZero();
+    hit_distance = hit_weight_sum > 0 ? hit_distance_sum / hit_weight_sum : 0;
+  } else if (best_hit_count > 0) {
+    coverage = best_hit_count / best_count;
+    hit_color = dx::XMVectorScale(best_color_sum, 1 / best_hit_count);
+    hit_distance = best_hit_distance_sum / best_hit_count;
+  }
+
+  if (!(coverage > 0)) {
+    return {.color = frame.ibl[idx], .hit_distance = 0, .reflection = {}};
+  }
+
+  return {
+    .color = ShadeHit(frame, *ray, idx, hit_color, coverage), .hit_distance = hit_distance,
+    .reflection = StoreVector4(dx::XMVectorSetW(dx::XMVectorScale(hit_color, coverage), coverage))
+  };
+}
+
+
+// SampleHistory of ssr_temporal.hlsli
+auto SampleHistory(SsrFrame const& frame, SsrHistory const& history, Vector2 const& uv) -> dx::XMVECTOR {
+  auto const pos_x{uv[0] * static_cast<float>(frame.width) - 0.5f};
+  auto const pos_y{uv[1] * static_cast<float>(frame.height) - 0.5f};
+  auto const base_x{static_cast<int>(std::floor(pos_x))};
+  auto const base_y{static_cast<int>(std::floor(pos_y))};
+  auto const fx{pos_x - static_cast<float>(base_x)};
+  auto const fy{pos_y - static_cast<float>(base_y)};
+
+  auto reflection{dx::XMVectorZero()};
+
+  for (auto i{0}; i < 4; i++) {
+    auto const offset_x{i & 1};
+    auto const offset_y{i >> 1};
+    auto const x{std::clamp(base_x + offset_x, 0, static_cast<int>(frame.width) - 1)};
+    auto const y{std::clamp(base_y + offset_y, 0, static_cast<int>(frame.height) - 1)};
+    auto const weight{(offset_x == 1 ? fx : 1 - fx) * (offset_y == 1 ? fy : 1 - fy)};
+    auto const& texel{history.reflection[static_cast<std::size_t>(y) * frame.width + static_cast<std::size_t>(x)]};
+    reflection = dx::XMVectorAdd(reflection, dx::XMVectorScale(LoadVector4(texel), weight));
+  }
+
+  return reflection;
+}
+
+
+// Composite of ssr_temporal.hlsli, for a pixel that reflects the screen
+auto CompositeReflection(SsrFrame const& frame, SsrMatrices const& matrices, std::uint32_t const x,
+                         std::uint32_t const y, dx::XMVECTOR const reflection) -> Vector4 {
+  auto const idx{static_cast<std::size_t>(y) * frame.width + x};
+  auto const coverage{dx::XMVectorGetW(reflection)};
+
+  if (!(coverage > 0)) {
+    return frame.ibl[idx];
+  }
+
+  auto const hit_color{dx::XMVectorSetW(dx::XMVectorDivide(reflection, dx::XMVectorSplatW(reflection)), 0)};
+  return ShadeHit(frame, *SetUpRay(frame, matrices, x, y), idx, hit_color, coverage);
+}
+
+
+struct SsrTemporalPixel {
+  Vector4 color;
+  Vector4 reflection;
+};
+
+
+// CsMain of ssr_temporal.hlsli for a single pixel
+auto ResolveTemporalPixel(SsrFrame const& frame, SsrMatrices const& matrices, SsrResult const& current,
+                          SsrHistory const& history, dx::XMMATRIX const& view_proj_inv, std::uint32_t const x,
+                          std::uint32_t const y) -> SsrTemporalPixel {
+  auto const idx{static_cast<std::size_t>(y) * frame.width + x};
+  auto const depth{frame.depth[idx]};
+
+  // Kept wherever the history is rejected below
+  SsrTemporalPixel const current_pixel{.color = current.color[idx], .reflection = current.reflection[idx]};
+
+  if (!history.constants.history_valid || !ReflectsScreen(depth, frame.gbuffer0[idx][3])) {
+    return current_pixel;
+  }
+
+  // Pixel centers, so that a still camera reprojects every pixel onto itself
+  auto const u{(static_cast<float>(x) + 0.5f) / static_cast<float>(frame.width)};
+  auto const v{(static_cast<float>(y) + 0.5f) / static_cast<float>(frame.height)};
+  auto const pos4_ws{dx::XMVector4Transform(dx::XMVectorSet(u * 2 - 1, v * -2 + 1, depth, 1), view_proj_inv)};
+  dx::XMFLOAT3 pos_ws;
+  dx::XMStoreFloat3(&pos_ws, dx::XMVectorDivide(pos4_ws, dx::XMVectorSplatW(pos4_ws)));
+
+  auto const& prev_view_proj{history.constants.prev_view_proj_mtx};
+  auto const surface{ReprojectSsr(pos_ws, prev_view_proj)};
+  auto const reflection{
+    ReprojectSsr(SsrReflectionPosition(pos_ws, frame.camera.pos_ws, current.hit_distances[idx]), prev_view_proj)
+  };
+
+  if (!surface || !reflection) {
+    return current_pixel;
+  }
+
+  auto const prev_x{std::min(static_cast<std::uint32_t>(surface->uv[0] * static_cast<float>(frame.width)),
+                             frame.width - 1)};
+  auto const prev_y{std::min(static_cast<std::uint32_t>(surface->uv[1] * static_cast<float>(frame.height)),
+                             frame.height - 1)};
+  auto const prev_depth_vs{
+    NdcToViewDepth(history.depth[static_cast<std::size_t>(prev_y) * frame.width + prev_x], frame.camera.near_clip,
+                   frame.camera.far_clip)
+  };
+
+  if (IsSsrHistoryDisoccluded(surface->depth_vs, prev_depth_vs)) {
+    return current_pixel;
+  }
+
+  auto const current_reflection{LoadVector4(current_pixel.reflection)};
+  auto neighborhood_min{current_reflection};
+  auto neighborhood_max{current_reflection};
+
+  for (auto offset_y{-1}; offset_y <= 1; offset_y++) {
+    for (auto offset_x{-1}; offset_x <= 1; offset_x++) {
+      auto const neighbor_x{std::clamp(static_cast<int>(x) + offset_x, 0, static_cast<int>(frame.width) - 1)};
+      auto const neighbor_y{std::clamp(static_cast<int>(y) + offset_y, 0, static_cast<int>(frame.height) - 1)};
+      auto const neighbor{
+        LoadVector4(current.reflection[static_cast<std::size_t>(neighbor_y) * frame.width +
+                                       static_cast<std::size_t>(neighbor_x)])
+      };
+      neighborhood_min = dx::XMVectorMin(neighborhood_min, neighbor);
+      neighborhood_max = dx::XMVectorMax(neighborhood_max, neighbor);
+    }
+  }
+
+  auto const history_reflection{
+    dx::XMVectorClamp(SampleHistory(frame, history, reflection->uv), neighborhood_min, neighborhood_max)
+  };
+  auto const blended{dx::XMVectorLerp(history_reflection, current_reflection, history.constants.current_weight)};
+  return {.color = CompositeReflection(frame, matrices, x, y, blended), .reflection = StoreVector4(blended)};
+}
+}
+
+
+auto BuildHiZPyramid(SsrFrame const& frame, unsigned const thread_count) -> HiZPyramid {
+  HiZPyramid hiz;
+
+  auto& base{
+    hiz.mips.emplace_back(HiZMip{
+      .width = frame.width, .height = frame.height,
+      .texels = std::vector<Vector2>(static_cast<std::size_t>(frame.width) * frame.height)
+    })
+  };
+
+  ParallelFor(frame.height, thread_count, [&frame, &base](std::size_t const y) {
+    for (std::size_t x{0}; x < frame.width; x++) {
+      auto const idx{y * frame.width + x};
+      auto const depth_vs{NdcToViewDepth(frame.depth[idx], frame.camera.near_clip, frame.camera.far_clip)};
+      base.texels[idx] = {depth_vs, depth_vs};
+    }
+  });
+
+  while (hiz.mips.back().width > 1 || hiz.mips.back().height > 1) {
+    auto const& src{hiz.mips.back()};
+    HiZMip dst{.width = std::max(src.width / 2, 1u), .height = std::max(src.height / 2, 1u), .texels = {}};
+    dst.texels.resize(static_cast<std::size_t>(dst.width) * dst.height);
+
+    ParallelFor(dst.height, thread_count, [&src, &dst](std::size_t const y) {
+      auto const src_y_end{y == dst.height - 1 ? src.height : 2 * y + 2};
+
+      for (std::size_t x{0}; x < dst.width; x++) {
+        auto const src_x_end{x == dst.width - 1 ? src.width : 2 * x + 2};
+        Vector2 min_max{std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity()};
+
+        for (auto src_y{2 * y}; src_y < src_y_end; src_y++) {
+          for (auto src_x{2 * x}; src_x < src_x_end; src_x++) {
+            auto const& texel{src.texels[src_y * src.width + src_x]};
+            min_max = {std::min(min_max[0], texel[0]), std::max(min_max[1], texel[1])};
+          }
+        }
+
+        dst.texels[y * dst.width + x] = min_max;
+      }
+    });
+
+    hiz.mips.push_back(std::move(dst));
+  }
+
+  return hiz;
+}
+
+
+auto TraceSsr(SsrFrame const& frame, SsrConstants const& constants, HiZPyramid const& hiz,
+              unsigned const thread_count) -> SsrResult {
+  auto const pixel_count{static_cast<std::size_t>(frame.width) * frame.height};
+
+  SsrResult result{
+    .color = std::vector<Vector4>(pixel_count),
+    .step_counts = std::vector<std::uint32_t>(pixel_count),
+    .hits = std::vector<std::uint32_t>(pixel_count, kSsrNoHit),
+    .hit_distances = std::vector<float>(pixel_count),
+    .reflection = std::vector<Vector4>(pixel_count)
+  };
+
+  SsrMatrices const matrices{
+    .view = dx::XMLoadFloat4x4(&frame.camera.view_mtx),
+    .proj = dx::XMLoadFloat4x4(&frame.camera.proj_mtx),
+    .proj_inv = dx::XMLoadFloat4x4(&frame.camera.proj_inv_mtx)
+  };
+
+  // Splits the pixels or blocks into tiles of the thread group size
+  auto const for_each_tile{
+    [thread_count](std::uint32_t const width, std::uint32_t const height, auto const& func) {
+      auto const tile_count_x{(width + SSR_THREADS_X - 1) / SSR_THREADS_X};
+      auto const tile_count_y{(height + SSR_THREADS_Y - 1) / SSR_THREADS_Y};
+
+      ParallelFor(static_cast<std::size_t>(tile_count_x) * tile_count_y, thread_count, [&](std::size_t const tile) {
+        auto const tile_x{static_cast<std::uint32_t>(tile % tile_count_x) * SSR_THREADS_X};
+        auto const tile_y{static_cast<std::uint32_t>(tile / tile_count_x) * SSR_THREADS_Y};
+
+        for (auto y{tile_y}; y < std::min(tile_y + SSR_THREADS_Y, height); y++) {
+          for (auto x{tile_x}; x < std::min(tile_x + SSR_THREADS_X, width); x++) {
+            func(x, y);
+          }
+        }
+      });
+    }
+  };
+
+  if (constants.trace_scale_log2 == 0) {
+    for_each_tile(frame.width, frame.height, [&](std::uint32_t const x, std::uint32_t const y) {
+      auto const [color, step_count, hit, hit_distance, reflection]{TracePixel(frame, matrices, constants, hiz, x, y)};
+      auto const idx{static_cast<std::size_t>(y) * frame.width + x};
+      result.color[idx] = color;
+      result.step_counts[idx] = step_count;
+      result.hits[idx] = hit;
+      result.hit_distances[idx] = hit_distance;
+      result.reflection[idx] = reflection;
+    });
+
+    return result;
+  }
+
+  auto const block_size{1u << constants.trace_scale_log2};
+  SsrBlocks blocks{
+    .width = (frame.width + block_size - 1) >> constants.trace_scale_log2,
+    .height = (frame.height + block_size - 1) >> constants.trace_scale_log2,
+    .sources = {},
+    .hits = {}
+  };
+  blocks.sources.resize(static_cast<std::size_t>(blocks.width) * blocks.height);
+  blocks.hits.resize(blocks.sources.size());
+
+  for_each_tile(blocks.width, blocks.height, [&](std::uint32_t const x, std::uint32_t const y) {
+    auto const [source, hit, step_count]{TraceBlock(frame, matrices, constants, hiz, x, y)};
+    auto const block_idx{static_cast<std::size_t>(y) * blocks.width + x};
+    blocks.sources[block_idx] = source;
+    blocks.hits[block_idx] = hit;
+
+    if (source != kSsrNoHit) {
+      result.step_counts[source] = step_count;
+      result.hits[source] = hit;
+    }
+  });
+
+  ParallelFor(frame.height, thread_count, [&](std::size_t const y) {
+    for (std::uint32_t x{0}; x < frame.width; x++) {
+      auto const [color, hit_distance, reflection]{
+        UpsamplePixel(frame, matrices, constants, blocks, x, static_cast<std::uint32_t>(y))
+      };
+      result.color[y * frame.width + x] = color;
+      result.hit_distances[y * frame.width + x] = hit_distance;
+      result.reflection[y * frame.width + x] = reflection;
+    }
+  });
+
+  return result;
+}
+
+
+auto SsrReflectionPosition(dx::XMFLOAT3 const& pos_ws, dx::XMFLOAT3 const& cam_pos_ws,
+                           float const hit_distance) -> dx::XMFLOAT3 {
+  auto const pos{dx::XMLoadFloat3(&pos_ws)};
+  auto const view_dir{dx::XMVector3Normalize(dx::XMVectorSubtract(dx::XMLoadFloat3(&cam_pos_ws), pos))};
+
+  dx::XMFLOAT3 reflection_ws;
+  dx::XMStoreFloat3(&reflection_ws, dx::XMVectorSubtract(pos, dx::XMVectorScale(view_dir, hit_distance)));
+  return reflection_ws;
+}
+
+
+auto ReprojectSsr(dx::XMFLOAT3 const& pos_ws,
+                  dx::XMFLOAT4X4 const& prev_view_proj) -> std::optional<SsrReprojection> {
+  auto const pos_cs{
+    dx::XMVector4Transform(dx::XMVectorSet(pos_ws.x, pos_ws.y, pos_ws.z, 1), dx::XMLoadFloat4x4(&prev_view_proj))
+  };
+  auto const w{dx::XMVectorGetW(pos_cs)};
+
+  // NdcToUv of change_of_basis.hlsli
+  Vector2 const uv{dx::XMVectorGetX(pos_cs) / w * 0.5f + 0.5f, dx::XMVectorGetY(pos_cs) / w * -0.5f + 0.5f};
+
+  if (!(w > 0 && uv[0] >= 0 && uv[0] < 1 && uv[1] >= 0 && uv[1] < 1)) {
+    return std::nullopt;
+  }
+
+  return SsrReprojection{.uv = uv, .depth_vs = w};
+}
+
+
+auto IsSsrHistoryDisoccluded(float const expected_depth_vs, float const prev_depth_vs) -> bool {
+  return std::abs(prev_depth_vs - expected_depth_vs) > kDisocclusionDepthRatio * expected_depth_vs;
+}
+
+
+auto ResolveSsrTemporal(SsrFrame const& frame, SsrResult const& current, SsrHistory const& history,
+                        unsigned const thread_count) -> SsrTemporalResult {
+  SsrTemporalResult output{
+    .color = std::vector<Vector4>(current.color.size()),
+    .reflection = std::vector<Vector4>(current.reflection.size())
+  };
+
+  SsrMatrices const matrices{
+    .view = dx::XMLoadFloat4x4(&frame.camera.view_mtx),
+    .proj = dx::XMLoadFloat4x4(&frame.camera.proj_mtx),
+    .proj_inv = dx::XMLoadFloat4x4(&frame.camera.proj_inv_mtx)
+  };
+  auto const view_proj_inv{dx::XMLoadFloat4x4(&frame.camera.view_proj_inv_mtx)};
+
+  ParallelFor(frame.height, thread_count, [&](std::size_t const y) {
+    for (std::uint32_t x{0}; x < frame.width; x++) {
+      auto const [color, reflection]{
+        ResolveTemporalPixel(frame, matrices, current, history, view_proj_inv, x, static_cast<std::uint32_t>(y))
+      };
+      output.color[y * frame.width + x] = color;
+      output.reflection[y * frame.width + x] = reflection;
+    }
+  });
+
+  return output;
+}
+
+
+auto ReadSsrFrame(std::filesystem::path const& path) -> std::optional<SsrFrame> {
+  std::ifstream file{path, std::ios::binary};
+
+  if (!file) {
+    return std::nullopt;
+  }
+
+  SsrFrameHeader header;
+
+  if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != kSsrFrameMagic ||
+      header.version != kSsrFrameVersion) {
+    return std::nullopt;
+  }
+
+  // Check the size before allocating anything for a corrupt header
+  auto const pixel_count{static_cast<std::uint64_t>(header.width) * header.height};
+  auto const expected_size{
+    sizeof(SsrFrameHeader) + sizeof(CameraConstants) + sizeof(SsrConstants) +
+    pixel_count * (sizeof(float) + 4 * sizeof(Vector4))
+  };
+
+  std::error_code ec;
+
+  if (std::filesystem::file_size(path, ec) != expected_size || ec) {
+    return std::nullopt;
+  }
+
+  SsrFrame frame{
+    .camera = {},
+    .constants = {},
+    .width = header.width,
+    .height = header.height,
+    .depth = std::vector<float>(pixel_count),
+    .gbuffer0 = std::vector<Vector4>(pixel_count),
+    .gbuffer1 = std::vector<Vector4>(pixel_count),
+    .ibl = std::vector<Vector4>(pixel_count),
+    .ssr = std::vector<Vector4>(pixel_count)
+  };
+
+  auto const read{
+    [&file](auto& elements) {
+      auto const bytes{std::as_writable_bytes(std::span{elements})};
+      return static_cast<bool>(file.read(reinterpret_cast<char*>(bytes.data()),
+                                         static_cast<std::streamsize>(bytes.size())));
+    }
+  };
+
+  if (!file.read(reinterpret_cast<char*>(&frame.camera), sizeof(frame.camera)) ||
+      !file.read(reinterpret_cast<char*>(&frame.constants), sizeof(frame.constants)) || !read(frame.depth) ||
+      !read(frame.gbuffer0) || !read(frame.gbuffer1) || !read(frame.ibl) || !read(frame.ssr)) {
+    return std::nullopt;
+  }
+
+  return frame;
+}
+
+
+auto WriteSsrFrame(std::filesystem::path const& path, SsrFrame const& frame) -> bool {
+  auto const pixel_count{static_cast<std::size_t>(frame.width) * frame.height};
+
+  if (frame.depth.size() != pixel_count || frame.gbuffer0.size() != pixel_count ||
+      frame.gbuffer1.size() != pixel_count || frame.ibl.size() != pixel_count || frame.ssr.size() != pixel_count) {
+    return false;
+  }
+
+  SsrFrameHeader const header{
+    .magic = kSsrFrameMagic, .version = kSsrFrameVersion, .width = frame.width, .height = frame.height
+  };
+
+  return WriteFileAtomically(path, {
+    std::as_bytes(std::span{&header, 1}), std::as_bytes(std::span{&frame.camera, 1}),
+    std::as_bytes(std::span{&frame.constants, 1}), std::as_bytes(std::span{frame.depth}),
+    std::as_bytes(std::span{frame.gbuffer0}), std::as_bytes(std::span{frame.gbuffer1}),
+    std::as_bytes(std::span{frame.ibl}), std::as_bytes(std::span{frame.ssr})
+  });
+}
+}
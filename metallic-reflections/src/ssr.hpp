@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <limits>
+#include <optional>
+#include <vector>
+
+#include "scene.hpp"
+#include "shaders/shader_interop.h"
+
+namespace refl {
+// How the SSR pass walks the reflected rays, see SsrConstants
+enum class SsrMarchMode : std::uint32_t {
+  kLinear = SSR_MARCH_LINEAR, // Fixed steps in view space, one depth fetch each
+  kHiZ = SSR_MARCH_HIZ, // The same steps, skipping the runs of them the depth pyramid proves cannot hit
+  kDda = SSR_MARCH_DDA // Pixel by pixel in screen space, with a stride and a binary search in the stride that hit
+};
+
+// Settings main.cpp starts with, the pyramid mip count depends on the output size
+SsrConstants constexpr kDefaultSsrConstants{
+  .march_mode = static_cast<std::uint32_t>(SsrMarchMode::kHiZ),
+  .hiz_mip_count = 0,
+  .dda_pixel_stride = 4,
+  .dda_jitter = 1,
+  .dda_max_steps = 1024,
+  .dda_refine_steps = 2,
+  .trace_scale_log2 = 0,
+  .rotate_sources = false,
+  .frame_index = 0,
+  .pad = {}
+};
+
+// Weight of the current frame in the blend of ssr_temporal.hlsli main.cpp uses, the history averages about the last
+// 1 / weight frames
+float constexpr kDefaultSsrTemporalWeight{0.1f};
+
+// Hit of a pixel that did not hit anything
+std::uint32_t constexpr kSsrNoHit{std::numeric_limits<std::uint32_t>::max()};
+
+// Inputs and output of the SSR pass of one frame as main.cpp dumps them. Every image has the size of the output and is
+// stored row by row.
+struct SsrFrame {
+  CameraConstants camera;
+  SsrConstants constants; // The settings ssr was traced with
+  std::uint32_t width;
+  std::uint32_t height;
+  std::vector<float> depth; // NDC depth
+  std::vector<Vector4> gbuffer0; // rgb base color, a roughness
+  std::vector<Vector4> gbuffer1; // rgb world space normal
+  std::vector<Vector4> ibl; // Output of the lighting pass
+  std::vector<Vector4> ssr; // Output of ssr.hlsli for the same inputs
+};
+
+struct SsrResult {
+  std::vector<Vector4> color;
+  std::vector<std::uint32_t> step_counts; // Iterations of the march per pixel, 0 for pixels that skip it
+  std::vector<std::uint32_t> hits; // Index of the pixel the ray of every pixel hit, or kSsrNoHit
+  std::vector<float> hit_distances; // The hit distance texture of ssr.hlsli
+  std::vector<Vector4> reflection; // The reflection texture of ssr.hlsli, the hit color scaled by coverage and coverage
+};
+
+// What ssr_temporal.hlsli reads of the frame before
+struct SsrHistory {
+  SsrTemporalConstants constants;
+  std::vector<Vector4> reflection; // Reflection term the pass accumulated, in the format of SsrResult::reflection
+  std::vector<float> depth; // NDC depth
+};
+
+struct SsrTemporalResult {
+  std::vector<Vector4> color; // The accumulated reflection composited over the lighting of the frame
+  std::vector<Vector4> reflection; // The history of the next frame
+};
+
+// Where a point was on screen in the previous frame
+struct SsrReprojection {
+  Vector2 uv;
+  float depth_vs;
+};
+
+struct HiZMip {
+  std::uint32_t width;
+  std::uint32_t height;
+  std::vector<Vector2> texels; // Min and max
+};
+
+// Min and max linear view depth of the depth buffer in mip 0 and over ever larger blocks of it in the mips below, as
+// hiz.hlsli builds it. Mip sizes halve rounding down like those of a D3D texture, the last column and row of a mip
+// also cover the texels of the odd column and row of the mip above it that rounding drops.
+struct HiZPyramid {
+  std::vector<HiZMip> mips;
+};
+
+[[nodiscard]] auto BuildHiZPyramid(SsrFrame const& frame, unsigned thread_count) -> HiZPyramid;
+
+// Port of ssr.hlsli, followed by ssr_upsample.hlsli if the constants trace one ray per block of pixels, in which case
+// only the pixels the rays start from have step counts and hits. The pixels or blocks are split into tiles of the
+// thread group size, which are handed out dynamically, since the cost of a tile depends on how far its rays march. The
+// result does not depend on thread_count. The pyramid is only read by SsrMarchMode::kHiZ, which takes its mip count
+// from it rather than from the constants.
+[[nodiscard]] auto TraceSsr(SsrFrame const& frame, SsrConstants const& constants, HiZPyramid const& hiz,
+                            unsigned thread_count) -> SsrResult;
+
+// Steps of ssr_temporal.hlsli, see ResolveSsrTemporal
+
+// Point the reflection of a pixel moves with, hit_distance is 0 if its ray missed
+[[nodiscard]] auto SsrReflectionPosition(DirectX::XMFLOAT3 const& pos_ws, DirectX::XMFLOAT3 const& cam_pos_ws,
+                                         float hit_distance) -> DirectX::XMFLOAT3;
+// Where a point was on screen last frame, nullopt if it was behind the camera or off screen
+[[nodiscard]] auto ReprojectSsr(DirectX::XMFLOAT3 const& pos_ws,
+                                DirectX::XMFLOAT4X4 const& prev_view_proj) -> std::optional<SsrReprojection>;
+// Whether a surface was hidden last frame, given its view depth then and that of the depth buffer where it was
+[[nodiscard]] auto IsSsrHistoryDisoccluded(float expected_depth_vs, float prev_depth_vs) -> bool;
+
+// Port of ssr_temporal.hlsli, blends the reflection term of current, as TraceSsr returns it for the frame, with the
+// history and composites it over the lighting of the frame
+[[nodiscard]] auto ResolveSsrTemporal(SsrFrame const& frame, SsrResult const& current, SsrHistory const& history,
+                                      unsigned thread_count) -> SsrTemporalResult;
+
+// The dump only uses the standard library, so it can be read on machines without D3D
+[[nodiscard]] auto ReadSsrFrame(std::filesystem::path const& path) -> std::optional<SsrFrame>;
+[[nodiscard]] auto WriteSsrFrame(std::filesystem::path const& path, SsrFrame const& frame) -> bool;
+}
@@ -0,0 +1,91 @@
+#include "texture_cache.hpp"
+
+#include "cache.hpp"
+#include "mapped_file.hpp"
+
+import std;
+
+namespace refl {
+namespace {
+std::array<char, 8> constexpr kTextureCacheMagic{'R', 'E', 'F', 'L', 'T', 'E', 'X', '\0'};
+std::uint32_t constexpr kTextureCacheVersion{1};
+
+
+struct TextureCacheHeader {
+  std::array<char, 8> magic;
+  std::uint32_t version;
+  TextureUsage usage;
+  std::uint64_t key;
+  std::uint64_t file_size;
+  std::uint64_t mip_count; // TextureMip records following the header
+  std::uint64_t texels_offset; // From the start of the file
+  std::uint64_t texel_count;
+};
+}
+
+
+auto ReadTextureCache(std::filesystem::path const& cache_path,
+                      std::uint64_t const key) -> std::optional<TextureImage> {
+  auto const file{MappedFile::New(cache_path)};
+
+  if (!file) {
+    return std::nullopt;
+  }
+
+  auto const data{file->GetData()};
+
+  if (data.size() < sizeof(TextureCacheHeader)) {
+    return std::nullopt;
+  }
+
+  TextureCacheHeader header;
+  std::memcpy(&header, data.data(), sizeof(header));
+
+  if (header.magic != kTextureCacheMagic || header.version != kTextureCacheVersion || header.key != key ||
+      header.file_size != data.size() ||
+      header.mip_count > (data.size() - sizeof(TextureCacheHeader)) / sizeof(TextureMip) ||
+      header.texels_offset < sizeof(TextureCacheHeader) + header.mip_count * sizeof(TextureMip) ||
+      header.texels_offset > data.size() || header.texel_count != data.size() - header.texels_offset) {
+    return std::nullopt;
+  }
+
+  TextureImage image{.usage = header.usage, .mips = {}, .texels = {}};
+  image.mips.resize(header.mip_count);
+  image.texels.resize(header.texel_count);
+  std::memcpy(image.mips.data(), data.data() + sizeof(TextureCacheHeader), image.mips.size() * sizeof(TextureMip));
+  std::memcpy(image.texels.data(), data.data() + header.texels_offset, image.texels.size());
+
+  // The texel layout is trusted as far as it stays within the texels, which is what the upload reads
+  auto const texel_size{GetTexelSize(image.usage)};
+
+  if (!std::ranges::all_of(image.mips, [&image, texel_size](TextureMip const& mip) {
+    return mip.offset <= image.texels.size() &&
+           static_cast<std::uint64_t>(mip.width) * mip.height * texel_size <= image.texels.size() - mip.offset;
+  })) {
+    return std::nullopt;
+  }
+
+  return image;
+}
+
+
+auto WriteTextureCache(std::filesystem::path const& cache_path, std::uint64_t const key,
+                       TextureImage const& image) -> bool {
+  auto const texels_offset{sizeof(TextureCacheHeader) + image.mips.size() * sizeof(TextureMip)};
+
+  TextureCacheHeader const header{
+    .magic = kTextureCacheMagic,
+    .version = kTextureCacheVersion,
+    .usage = image.usage,
+    .key = key,
+    .file_size = texels_offset + image.texels.size(),
+    .mip_count = image.mips.size(),
+    .texels_offset = texels_offset,
+    .texel_count = image.texels.size()
+  };
+
+  return WriteFileAtomically(cache_path, {
+    std::as_bytes(std::span{&header, 1}), std::as_bytes(std::span{image.mips}), std::as_bytes(std::span{image.texels})
+  });
+}
+}
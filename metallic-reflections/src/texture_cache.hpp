@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+
+#include "texture_image.hpp"
+
+namespace refl {
+// Decoded texture format. The mip chain is stored in the exact layout of TextureImage, so reading a cache is a single
+// copy out of the mapped file instead of decoding the image and filtering its mips.
+// The key identifies the image contents, its usage and the mip generation; a cache with a different key is stale.
+[[nodiscard]] auto ReadTextureCache(std::filesystem::path const& cache_path,
+                                    std::uint64_t key) -> std::optional<TextureImage>;
+[[nodiscard]] auto WriteTextureCache(std::filesystem::path const& cache_path, std::uint64_t key,
+                                     TextureImage const& image) -> bool;
+}
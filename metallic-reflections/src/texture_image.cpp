@@ -0,0 +1,289 @@
+#include "texture_image.hpp"
+
+#include <emmintrin.h>
+
+import std;
+
+namespace refl {
+namespace {
+// Resolution of the first guess of the sRGB encoding. Fine enough that the guess is off by at most one code.
+std::size_t constexpr kSrgbEncodeTableSize{4096};
+
+
+auto SrgbToLinear(float const srgb) -> float {
+  return srgb <= 0.04045f ? srgb / 12.92f : std::pow((srgb + 0.055f) / 1.055f, 2.4f);
+}
+
+
+auto LinearToSrgb(float const linear) -> float {
+  return linear <= 0.0031308f ? linear * 12.92f : 1.055f * std::pow(linear, 1.0f / 2.4f) - 0.055f;
+}
+
+
+struct SrgbTables {
+  std::array<float, 256> to_linear;
+  std::array<std::uint8_t, kSrgbEncodeTableSize> encode_guesses;
+  // thresholds[c] is the linear value halfway between codes c - 1 and c in sRGB space
+  std::array<float, 257> thresholds;
+};
+
+
+auto GetSrgbTables() -> SrgbTables const& {
+  static SrgbTables const tables{
+    [] {
+      SrgbTables ret{};
+
+      for (std::size_t i{0}; i < ret.to_linear.size(); i++) {
+        ret.to_linear[i] = SrgbToLinear(static_cast<float>(i) / 255.0f);
+      }
+
+      for (std::size_t i{0}; i < ret.encode_guesses.size(); i++) {
+        auto const linear{static_cast<float>(i) / static_cast<float>(kSrgbEncodeTableSize - 1)};
+        ret.encode_guesses[i] = static_cast<std::uint8_t>(std::lround(LinearToSrgb(linear) * 255.0f));
+      }
+
+      ret.thresholds.front() = -std::numeric_limits<float>::infinity();
+      ret.thresholds.back() = std::numeric_limits<float>::infinity();
+
+      for (std::size_t i{1}; i < ret.thresholds.size() - 1; i++) {
+        ret.thresholds[i] = SrgbToLinear((static_cast<float>(i) - 0.5f) / 255.0f);
+      }
+
+      return ret;
+    }()
+  };
+
+  return tables;
+}
+
+
+// The guess comes from the nearest table entry, comparing against the code boundaries makes the rounding exact
+auto EncodeSrgb(float const linear, std::int32_t const guess_idx, SrgbTables const& tables) -> std::uint8_t {
+  auto code{static_cast<unsigned>(tables.encode_guesses[guess_idx])};
+
+  if (linear >= tables.thresholds[code + 1]) {
+    code += 1;
+  } else if (linear < tables.thresholds[code]) {
+    code -= 1;
+  }
+
+  return static_cast<std::uint8_t>(code);
+}
+
+
+// Zero extends the four bytes of an RGBA8 texel to 32-bit lanes
+auto LoadTexel(std::uint8_t const* const texel) -> __m128i {
+  std::int32_t packed;
+  std::memcpy(&packed, texel, sizeof(packed));
+  auto const zero{_mm_setzero_si128()};
+  return _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+}
+
+
+// Rounds the lanes, which must be in [0, 255], and stores them as an RGBA8 texel
+auto StoreTexel(__m128 const value, std::uint8_t* const texel) -> void {
+  auto const ints{_mm_cvttps_epi32(_mm_add_ps(value, _mm_set1_ps(0.5f)))};
+  auto const words{_mm_packs_epi32(ints, ints)};
+  auto const bytes{_mm_packus_epi16(words, words)};
+  auto const packed{_mm_cvtsi128_si32(bytes)};
+  std::memcpy(texel, &packed, sizeof(packed));
+}
+
+
+// Source texels of an output texel, the second row and column are clamped for sources of size 1
+struct FootprintRows {
+  std::uint8_t const* row0;
+  std::uint8_t const* row1;
+};
+
+
+auto GetFootprintRows(std::uint8_t const* const src, TextureMip const& src_mip, std::uint32_t const texel_size,
+                      std::uint32_t const y) -> FootprintRows {
+  auto const y1{std::min(2 * y + 1, src_mip.height - 1)};
+  return {
+    src + static_cast<std::size_t>(2 * y) * src_mip.width * texel_size,
+    src + static_cast<std::size_t>(y1) * src_mip.width * texel_size
+  };
+}
+
+
+auto DownsampleBaseColor(std::uint8_t const* const src, TextureMip const& src_mip, std::uint8_t* const dst,
+                         TextureMip const& dst_mip) -> void {
+  auto const& tables{GetSrgbTables()};
+  auto const quarter{_mm_set1_ps(0.25f)};
+  // Alpha is linear and goes straight back to 8 bits, the color channels become indices into the encode table
+  auto const alpha_scale{_mm_set_ps(1.0f / 255.0f, 1, 1, 1)};
+  auto constexpr guess_scale{static_cast<float>(kSrgbEncodeTableSize - 1)};
+  auto const index_scale{_mm_set_ps(255, guess_scale, guess_scale, guess_scale)};
+
+  for (std::uint32_t y{0}; y < dst_mip.height; y++) {
+    auto const [row0, row1]{GetFootprintRows(src, src_mip, 4, y)};
+
+    for (std::uint32_t x{0}; x < dst_mip.width; x++) {
+      auto const x0{2 * x * 4};
+      auto const x1{std::min(2 * x + 1, src_mip.width - 1) * 4};
+
+      auto sum{_mm_setzero_ps()};
+
+      for (auto const texel : {row0 + x0, row0 + x1, row1 + x0, row1 + x1}) {
+        sum = _mm_add_ps(sum, _mm_set_ps(texel[3], tables.to_linear[texel[2]], tables.to_linear[texel[1]],
+                                         tables.to_linear[texel[0]]));
+      }
+
+      auto const avg{_mm_mul_ps(_mm_mul_ps(sum, quarter), alpha_scale)};
+
+      std::array<float, 4> linear;
+      std::array<std::int32_t, 4> indices;
+      _mm_storeu_ps(linear.data(), avg);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(indices.data()),
+                       _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(avg, index_scale), _mm_set1_ps(0.5f))));
+
+      auto const out{dst + (static_cast<std::size_t>(y) * dst_mip.width + x) * 4};
+      out[0] = EncodeSrgb(linear[0], indices[0], tables);
+      out[1] = EncodeSrgb(linear[1], indices[1], tables);
+      out[2] = EncodeSrgb(linear[2], indices[2], tables);
+      out[3] = static_cast<std::uint8_t>(indices[3]);
+    }
+  }
+}
+
+
+auto DownsampleNormal(std::uint8_t const* const src, TextureMip const& src_mip, std::uint8_t* const dst,
+                      TextureMip const& dst_mip) -> void {
+  auto const xyz_mask{_mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1))};
+  // Maps the sum of four unorm texels to [-1, 1] for xyz and to the average for alpha
+  auto const sum_scale{_mm_set_ps(0.25f, 2.0f / (4 * 255), 2.0f / (4 * 255), 2.0f / (4 * 255))};
+  auto const sum_bias{_mm_set_ps(0, -1, -1, -1)};
+  auto const min_length_sq{_mm_set1_ps(1e-12f)};
+
+  for (std::uint32_t y{0}; y < dst_mip.height; y++) {
+    auto const [row0, row1]{GetFootprintRows(src, src_mip, 4, y)};
+
+    for (std::uint32_t x{0}; x < dst_mip.width; x++) {
+      auto const x0{2 * x * 4};
+      auto const x1{std::min(2 * x + 1, src_mip.width - 1) * 4};
+
+      auto const sum{
+        _mm_add_epi32(_mm_add_epi32(LoadTexel(row0 + x0), LoadTexel(row0 + x1)),
+                      _mm_add_epi32(LoadTexel(row1 + x0), LoadTexel(row1 + x1)))
+      };
+
+      auto const avg{_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(sum), sum_scale), sum_bias)};
+
+      auto const sq{_mm_and_ps(_mm_mul_ps(avg, avg), xyz_mask)};
+      auto const length_sq{
+        _mm_add_ps(_mm_add_ps(_mm_shuffle_ps(sq, sq, _MM_SHUFFLE(0, 0, 0, 0)),
+                              _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(1, 1, 1, 1))),
+                   _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(2, 2, 2, 2)))
+      };
+
+      // Averaged normals are shorter than unit length, degenerate ones are kept as they are
+      auto const can_normalize{_mm_and_ps(_mm_cmpgt_ps(length_sq, min_length_sq), xyz_mask)};
+      auto const normalized{_mm_div_ps(avg, _mm_sqrt_ps(_mm_max_ps(length_sq, min_length_sq)))};
+      auto const value{_mm_or_ps(_mm_and_ps(can_normalize, normalized), _mm_andnot_ps(can_normalize, avg))};
+
+      // Back to unorm, alpha is already in [0, 255]
+      auto const unorm{
+        _mm_or_ps(_mm_and_ps(_mm_add_ps(_mm_mul_ps(value, _mm_set1_ps(127.5f)), _mm_set1_ps(127.5f)), xyz_mask),
+                  _mm_andnot_ps(xyz_mask, value))
+      };
+
+      StoreTexel(unorm, dst + (static_cast<std::size_t>(y) * dst_mip.width + x) * 4);
+    }
+  }
+}
+
+
+auto DownsampleRoughness(std::uint8_t const* const src, TextureMip const& src_mip, std::uint8_t* const dst,
+                         TextureMip const& dst_mip) -> void {
+  auto const low_bytes{_mm_set1_epi16(0x00FF)};
+  auto const two{_mm_set1_epi16(2)};
+
+  // Sums the horizontal pairs of both rows as 16-bit lanes, 8 output texels per 16 bytes of each row
+  auto const sum_pairs{
+    [low_bytes](__m128i const a, __m128i const b) {
+      return _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a, low_bytes), _mm_srli_epi16(a, 8)),
+                           _mm_add_epi16(_mm_and_si128(b, low_bytes), _mm_srli_epi16(b, 8)));
+    }
+  };
+
+  for (std::uint32_t y{0}; y < dst_mip.height; y++) {
+    auto const [row0, row1]{GetFootprintRows(src, src_mip, 1, y)};
+    auto const out{dst + static_cast<std::size_t>(y) * dst_mip.width};
+
+    std::uint32_t x{0};
+
+    for (; x + 16 <= dst_mip.width; x += 16) {
+      auto const lo{
+        sum_pairs(_mm_loadu_si128(reinterpret_cast<__m128i const*>(row0 + 2 * x)),
+                  _mm_loadu_si128(reinterpret_cast<__m128i const*>(row1 + 2 * x)))
+      };
+      auto const hi{
+        sum_pairs(_mm_loadu_si128(reinterpret_cast<__m128i const*>(row0 + 2 * x + 16)),
+                  _mm_loadu_si128(reinterpret_cast<__m128i const*>(row1 + 2 * x + 16)))
+      };
+
+      auto const avg{
+        _mm_packus_epi16(_mm_srli_epi16(_mm_add_epi16(lo, two), 2), _mm_srli_epi16(_mm_add_epi16(hi, two), 2))
+      };
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), avg);
+    }
+
+    for (; x < dst_mip.width; x++) {
+      auto const x0{2 * x};
+      auto const x1{std::min(2 * x + 1, src_mip.width - 1)};
+      out[x] = static_cast<std::uint8_t>((row0[x0] + row0[x1] + row1[x0] + row1[x1] + 2) / 4);
+    }
+  }
+}
+}
+
+
+auto GetTexelSize(TextureUsage const usage) -> std::uint32_t {
+  return usage == TextureUsage::BaseColor || usage == TextureUsage::Normal ? 4 : 1;
+}
+
+
+auto CreateTextureImage(TextureUsage const usage, std::uint32_t const width,
+                        std::uint32_t const height) -> TextureImage {
+  TextureImage image{.usage = usage, .mips = {}, .texels = {}};
+
+  std::uint64_t offset{0};
+
+  for (auto mip_width{width}, mip_height{height};; mip_width = std::max(mip_width / 2, 1u),
+       mip_height = std::max(mip_height / 2, 1u)) {
+    image.mips.emplace_back(mip_width, mip_height, offset);
+    offset += static_cast<std::uint64_t>(mip_width) * mip_height * GetTexelSize(usage);
+
+    if (mip_width == 1 && mip_height == 1) {
+      break;
+    }
+  }
+
+  image.texels.resize(offset);
+  return image;
+}
+
+
+auto GenerateMips(TextureImage& image) -> void {
+  for (std::size_t i{1}; i < image.mips.size(); i++) {
+    auto const& src_mip{image.mips[i - 1]};
+    auto const& dst_mip{image.mips[i]};
+    auto const src{image.texels.data() + src_mip.offset};
+    auto const dst{image.texels.data() + dst_mip.offset};
+
+    switch (image.usage) {
+      case TextureUsage::BaseColor:
+        DownsampleBaseColor(src, src_mip, dst, dst_mip);
+        break;
+      case TextureUsage::Normal:
+        DownsampleNormal(src, src_mip, dst, dst_mip);
+        break;
+      case TextureUsage::Roughness:
+      case TextureUsage::PackedRoughness:
+        DownsampleRoughness(src, src_mip, dst, dst_mip);
+        break;
+    }
+  }
+}
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "scene.hpp"
+
+namespace refl {
+struct TextureMip {
+  std::uint32_t width;
+  std::uint32_t height;
+  std::uint64_t offset; // Into TextureImage::texels
+
+  auto operator==(TextureMip const& other) const -> bool = default;
+};
+
+// Texture with its complete mip chain in the texel layout of its GPU format: RGBA8 for base color and normal maps,
+// R8 for roughness maps
+struct TextureImage {
+  TextureUsage usage;
+  std::vector<TextureMip> mips; // Largest first, down to 1x1
+  std::vector<std::uint8_t> texels; // Every level tightly packed
+
+  auto operator==(TextureImage const& other) const -> bool = default;
+};
+
+// Bump when the output of GenerateMips changes
+unsigned constexpr kMipGenerationVersion{1};
+
+[[nodiscard]] auto GetTexelSize(TextureUsage usage) -> std::uint32_t;
+// Lays out the whole mip chain of a width x height texture with zeroed texels
+[[nodiscard]] auto CreateTextureImage(TextureUsage usage, std::uint32_t width, std::uint32_t height) -> TextureImage;
+// Box filters every level from the one above it. Base color is averaged in linear space and re-encoded to sRGB with
+// exact rounding, normals are renormalized. Odd dimensions drop their last row or column.
+auto GenerateMips(TextureImage& image) -> void;
+}
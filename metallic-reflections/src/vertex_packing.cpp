@@ -0,0 +1,302 @@
+#include "vertex_packing.hpp"
+
+#include <DirectXPackedVector.h>
+
+import std;
+
+namespace refl {
+namespace {
+auto constexpr kPositionMax{65535.0f};
+auto constexpr kNormalMax{32767.0f};
+auto constexpr kTangentMax{16383.0f}; // Biased by kTangentMax into 15 bits per component
+std::uint32_t constexpr kTangentComponentMask{0x7FFF};
+std::uint32_t constexpr kTangentHandednessBit{1u << 31};
+
+
+auto SignNotZero(float const value) -> float {
+  return value >= 0 ? 1.0f : -1.0f;
+}
+
+
+// Octahedral mapping of a direction onto [-1, 1]^2 (Cigolle et al., A Survey of Efficient Representations for
+// Independent Unit Vectors, 2014)
+auto OctEncode(float x, float y, float z) -> std::array<float, 2> {
+  auto const l1_norm{std::abs(x) + std::abs(y) + std::abs(z)};
+
+  if (l1_norm <= 0) {
+    return {0, 0};
+  }
+
+  x /= l1_norm;
+  y /= l1_norm;
+  z /= l1_norm;
+
+  if (z < 0) {
+    return {(1 - std::abs(y)) * SignNotZero(x), (1 - std::abs(x)) * SignNotZero(y)};
+  }
+
+  return {x, y};
+}
+
+
+auto OctDecode(float const u, float const v) -> Vector4 {
+  auto x{u};
+  auto y{v};
+  auto const z{1 - std::abs(u) - std::abs(v)};
+  auto const t{std::max(-z, 0.0f)};
+  x += x >= 0 ? -t : t;
+  y += y >= 0 ? -t : t;
+
+  auto const len{std::sqrt(x * x + y * y + z * z)};
+  return {x / len, y / len, z / len, 0};
+}
+
+
+// Quantizes an octahedral encoding with symmetric [-max_value, max_value] steps. Instead of rounding each component
+// independently all four neighboring grid points are tried and the one decoding closest to the input is kept.
+auto OctQuantize(Vector4 const& dir, float const max_value) -> std::array<int, 2> {
+  auto const [u, v]{OctEncode(dir[0], dir[1], dir[2])};
+  auto const len{std::sqrt(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2])};
+
+  std::array best{static_cast<int>(std::round(u * max_value)), static_cast<int>(std::round(v * max_value))};
+
+  if (len <= 0) {
+    return best;
+  }
+
+  auto best_dot{-2.0f};
+
+  for (auto const qu : {std::floor(u * max_value), std::ceil(u * max_value)}) {
+    for (auto const qv : {std::floor(v * max_value), std::ceil(v * max_value)}) {
+      auto const decoded{OctDecode(qu / max_value, qv / max_value)};
+      auto const dot{(decoded[0] * dir[0] + decoded[1] * dir[1] + decoded[2] * dir[2]) / len};
+
+      if (dot > best_dot) {
+        best_dot = dot;
+        best = {static_cast<int>(qu), static_cast<int>(qv)};
+      }
+    }
+  }
+
+  return best;
+}
+
+
+// Angle between two directions, accurate for small angles unlike acos of the dot product
+auto AngleDegrees(Vector4 const& a, Vector4 const& b) -> double {
+  std::array const ad{static_cast<double>(a[0]), static_cast<double>(a[1]), static_cast<double>(a[2])};
+  std::array const bd{static_cast<double>(b[0]), static_cast<double>(b[1]), static_cast<double>(b[2])};
+  std::array const cross{
+    ad[1] * bd[2] - ad[2] * bd[1],
+    ad[2] * bd[0] - ad[0] * bd[2],
+    ad[0] * bd[1] - ad[1] * bd[0]
+  };
+  auto const cross_len{std::sqrt(cross[0] * cross[0] + cross[1] * cross[1] + cross[2] * cross[2])};
+  auto const dot{ad[0] * bd[0] + ad[1] * bd[1] + ad[2] * bd[2]};
+  return std::atan2(cross_len, dot) * 180.0 / std::numbers::pi;
+}
+
+
+auto IsZeroDirection(Vector4 const& dir) -> bool {
+  return dir[0] == 0 && dir[1] == 0 && dir[2] == 0;
+}
+}
+
+
+auto PackMesh(CpuMesh const& mesh) -> PackedMesh {
+  PackedMesh packed{};
+
+  if (!mesh.positions.empty()) {
+    Vector4 pos_min{mesh.positions.front()};
+    Vector4 pos_max{mesh.positions.front()};
+
+    for (auto const& pos : mesh.positions) {
+      for (auto i{0}; i < 3; i++) {
+        pos_min[i] = std::min(pos_min[i], pos[i]);
+        pos_max[i] = std::max(pos_max[i], pos[i]);
+      }
+    }
+
+    packed.pos_min = {pos_min[0], pos_min[1], pos_min[2]};
+    packed.pos_extent = {pos_max[0] - pos_min[0], pos_max[1] - pos_min[1], pos_max[2] - pos_min[2]};
+  }
+
+  packed.positions.resize(mesh.positions.size());
+  std::ranges::transform(mesh.positions, packed.positions.begin(), [&packed](Vector4 const& pos) {
+    return PackPosition(pos, packed.pos_min, packed.pos_extent);
+  });
+
+  packed.normals.resize(mesh.normals.size());
+  std::ranges::transform(mesh.normals, packed.normals.begin(), &PackNormal);
+
+  packed.texcoords.resize(mesh.texcoords.size());
+  std::ranges::transform(mesh.texcoords, packed.texcoords.begin(), &PackTexcoord);
+
+  packed.tangents.resize(mesh.tangents.size());
+  std::ranges::transform(mesh.tangents, packed.tangents.begin(), &PackTangent);
+
+  return packed;
+}
+
+
+auto ComputeDequantizationMatrix(PackedMesh const& mesh) -> DirectX::XMFLOAT4X4 {
+  return {
+    mesh.pos_extent.x, 0, 0, 0,
+    0, mesh.pos_extent.y, 0, 0,
+    0, 0, mesh.pos_extent.z, 0,
+    mesh.pos_min.x, mesh.pos_min.y, mesh.pos_min.z, 1
+  };
+}
+
+
+auto PackPosition(Vector4 const& pos, DirectX::XMFLOAT3 const& pos_min,
+                  DirectX::XMFLOAT3 const& pos_extent) -> PackedPosition {
+  auto const quantize{
+    [](float const value, float const min, float const extent) {
+      auto const normalized{extent > 0 ? std::clamp((value - min) / extent, 0.0f, 1.0f) : 0.0f};
+      return static_cast<std::uint16_t>(std::round(normalized * kPositionMax));
+    }
+  };
+
+  return {
+    quantize(pos[0], pos_min.x, pos_extent.x),
+    quantize(pos[1], pos_min.y, pos_extent.y),
+    quantize(pos[2], pos_min.z, pos_extent.z),
+    static_cast<std::uint16_t>(kPositionMax)
+  };
+}
+
+
+auto UnpackPosition(PackedPosition const& packed, DirectX::XMFLOAT3 const& pos_min,
+                    DirectX::XMFLOAT3 const& pos_extent) -> Vector4 {
+  return {
+    pos_min.x + packed[0] / kPositionMax * pos_extent.x,
+    pos_min.y + packed[1] / kPositionMax * pos_extent.y,
+    pos_min.z + packed[2] / kPositionMax * pos_extent.z,
+    1
+  };
+}
+
+
+auto PackNormal(Vector4 const& normal) -> PackedNormal {
+  auto const [qu, qv]{OctQuantize(normal, kNormalMax)};
+  return {static_cast<std::int16_t>(qu), static_cast<std::int16_t>(qv)};
+}
+
+
+auto UnpackNormal(PackedNormal const& packed) -> Vector4 {
+  // Same as the hardware SNORM conversion, -32768 and -32767 both map to -1
+  return OctDecode(std::max(packed[0] / kNormalMax, -1.0f), std::max(packed[1] / kNormalMax, -1.0f));
+}
+
+
+auto PackTexcoord(Vector2 const& uv) -> PackedTexcoord {
+  using DirectX::PackedVector::XMConvertFloatToHalf;
+  return {XMConvertFloatToHalf(uv[0]), XMConvertFloatToHalf(uv[1])};
+}
+
+
+auto UnpackTexcoord(PackedTexcoord const& packed) -> Vector2 {
+  using DirectX::PackedVector::XMConvertHalfToFloat;
+  return {XMConvertHalfToFloat(packed[0]), XMConvertHalfToFloat(packed[1])};
+}
+
+
+auto PackTangent(Vector4 const& tangent) -> PackedTangent {
+  auto const [qu, qv]{OctQuantize(tangent, kTangentMax)};
+  auto const bias{static_cast<int>(kTangentMax)};
+  auto const x{static_cast<std::uint32_t>(qu + bias)};
+  auto const y{static_cast<std::uint32_t>(qv + bias)};
+  return x | y << 15 | (tangent[3] < 0 ? kTangentHandednessBit : 0);
+}
+
+
+auto UnpackTangent(PackedTangent const packed) -> Vector4 {
+  auto const u{(static_cast<float>(packed & kTangentComponentMask) - kTangentMax) / kTangentMax};
+  auto const v{(static_cast<float>(packed >> 15 & kTangentComponentMask) - kTangentMax) / kTangentMax};
+  auto tangent{OctDecode(u, v)};
+  tangent[3] = packed & kTangentHandednessBit ? -1.0f : 1.0f;
+  return tangent;
+}
+
+
+auto GetPackedVertexDataSize(PackedMesh const& mesh) -> std::size_t {
+  return mesh.positions.size() * sizeof(PackedPosition) + mesh.normals.size() * sizeof(PackedNormal) +
+         mesh.texcoords.size() * sizeof(PackedTexcoord) + mesh.tangents.size() * sizeof(PackedTangent);
+}
+
+
+auto GetUnpackedVertexDataSize(CpuMesh const& mesh) -> std::size_t {
+  // The float layout always uploads all four streams, zero filled if the mesh lacks them
+  return mesh.positions.size() * (3 * sizeof(Vector4) + sizeof(Vector2));
+}
+
+
+auto PackingErrorReport::IsWithinBounds() const -> bool {
+  return max_position_error <= position_error_bound &&
+         max_normal_error_degrees <= kMaxPackedNormalErrorDegrees &&
+         max_tangent_error_degrees <= kMaxPackedTangentErrorDegrees &&
+         max_texcoord_error <= 1 &&
+         handedness_mismatches == 0;
+}
+
+
+auto MeasurePackingError(CpuMesh const& mesh, PackedMesh const& packed) -> PackingErrorReport {
+  PackingErrorReport report{};
+
+  auto const& extent{packed.pos_extent};
+  auto const& min{packed.pos_min};
+  auto const magnitude{
+    std::max({std::abs(min.x) + extent.x, std::abs(min.y) + extent.y, std::abs(min.z) + extent.z})
+  };
+
+  // Half a quantization step per axis plus the float rounding of the dequantization itself
+  report.position_error_bound =
+    0.5f * std::sqrt(extent.x * extent.x + extent.y * extent.y + extent.z * extent.z) / kPositionMax +
+    4 * std::numeric_limits<float>::epsilon() * magnitude;
+
+  for (std::size_t i{0}; i < mesh.positions.size(); i++) {
+    auto const& pos{mesh.positions[i]};
+    auto const decoded{UnpackPosition(packed.positions[i], min, extent)};
+    auto const dx{static_cast<double>(decoded[0]) - pos[0]};
+    auto const dy{static_cast<double>(decoded[1]) - pos[1]};
+    auto const dz{static_cast<double>(decoded[2]) - pos[2]};
+    report.max_position_error = std::max(report.max_position_error,
+                                         static_cast<float>(std::sqrt(dx * dx + dy * dy + dz * dz)));
+  }
+
+  for (std::size_t i{0}; i < mesh.normals.size(); i++) {
+    if (!IsZeroDirection(mesh.normals[i])) {
+      report.max_normal_error_degrees = std::max(report.max_normal_error_degrees,
+                                                 static_cast<float>(AngleDegrees(
+                                                   mesh.normals[i], UnpackNormal(packed.normals[i]))));
+    }
+  }
+
+  for (std::size_t i{0}; i < mesh.tangents.size(); i++) {
+    auto const decoded{UnpackTangent(packed.tangents[i])};
+
+    if (!IsZeroDirection(mesh.tangents[i])) {
+      report.max_tangent_error_degrees = std::max(report.max_tangent_error_degrees,
+                                                  static_cast<float>(AngleDegrees(mesh.tangents[i], decoded)));
+    }
+
+    if ((mesh.tangents[i][3] < 0) != (decoded[3] < 0)) {
+      ++report.handedness_mismatches;
+    }
+  }
+
+  for (std::size_t i{0}; i < mesh.texcoords.size(); i++) {
+    auto const decoded{UnpackTexcoord(packed.texcoords[i])};
+
+    for (auto j{0}; j < 2; j++) {
+      // Round to nearest half is off by at most half an ulp: 2^-11 relative, 2^-25 absolute in the subnormal range
+      auto const bound{std::max(std::abs(mesh.texcoords[i][j]) * 0x1p-11f, 0x1p-25f)};
+      report.max_texcoord_error = std::max(report.max_texcoord_error,
+                                           std::abs(decoded[j] - mesh.texcoords[i][j]) / bound);
+    }
+  }
+
+  return report;
+}
+}
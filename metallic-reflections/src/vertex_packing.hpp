@@ -0,0 +1,74 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <DirectXMath.h>
+
+#include "scene.hpp"
+
+namespace refl {
+// GPU vertex layout, 20 bytes per vertex instead of the 56 of the CpuMesh streams.
+// Must match the mesh input layout in shader_collection.cpp and the decoding in vertex_packing.hlsli.
+using PackedPosition = std::array<std::uint16_t, 4>; // R16G16B16A16_UNORM, xyz relative to the mesh AABB, w unused
+using PackedNormal = std::array<std::int16_t, 2>; // R16G16_SNORM, octahedral
+using PackedTexcoord = std::array<std::uint16_t, 2>; // R16G16_FLOAT
+using PackedTangent = std::uint32_t; // R32_UINT, 15 bit octahedral x and y, handedness in the top bit
+
+// Vertex streams the scene is drawn from. The float layout uploads the CpuMesh streams as they are, at full precision.
+enum class VertexLayout : std::uint8_t {
+  kPacked,
+  kFloat
+};
+
+struct PackedMesh {
+  std::vector<PackedPosition> positions;
+  std::vector<PackedNormal> normals;
+  std::vector<PackedTexcoord> texcoords; // Empty if the mesh has no texture coordinates
+  std::vector<PackedTangent> tangents; // Empty if the mesh has no tangents
+  // Object space position = pos_min + unorm(packed) * pos_extent
+  DirectX::XMFLOAT3 pos_min;
+  DirectX::XMFLOAT3 pos_extent;
+};
+
+[[nodiscard]] auto PackMesh(CpuMesh const& mesh) -> PackedMesh;
+
+// Maps the [0, 1] unorm positions back to the object space AABB. Meant to be premultiplied onto the world matrix.
+[[nodiscard]] auto ComputeDequantizationMatrix(PackedMesh const& mesh) -> DirectX::XMFLOAT4X4;
+
+[[nodiscard]] auto PackPosition(Vector4 const& pos, DirectX::XMFLOAT3 const& pos_min,
+                                DirectX::XMFLOAT3 const& pos_extent) -> PackedPosition;
+[[nodiscard]] auto UnpackPosition(PackedPosition const& packed, DirectX::XMFLOAT3 const& pos_min,
+                                  DirectX::XMFLOAT3 const& pos_extent) -> Vector4;
+[[nodiscard]] auto PackNormal(Vector4 const& normal) -> PackedNormal;
+[[nodiscard]] auto UnpackNormal(PackedNormal const& packed) -> Vector4;
+[[nodiscard]] auto PackTexcoord(Vector2 const& uv) -> PackedTexcoord;
+[[nodiscard]] auto UnpackTexcoord(PackedTexcoord const& packed) -> Vector2;
+// The w component of the tangent is the bitangent sign
+[[nodiscard]] auto PackTangent(Vector4 const& tangent) -> PackedTangent;
+[[nodiscard]] auto UnpackTangent(PackedTangent packed) -> Vector4;
+
+// Total size of the vertex streams in bytes, for the packed format and for the float format of the CpuMesh streams
+[[nodiscard]] auto GetPackedVertexDataSize(PackedMesh const& mesh) -> std::size_t;
+[[nodiscard]] auto GetUnpackedVertexDataSize(CpuMesh const& mesh) -> std::size_t;
+
+// Guaranteed worst case angular errors of the octahedral encodings
+float constexpr kMaxPackedNormalErrorDegrees{0.01f};
+float constexpr kMaxPackedTangentErrorDegrees{0.02f};
+
+struct PackingErrorReport {
+  float max_position_error; // Object space distance
+  float position_error_bound; // Half a quantization step along the AABB diagonal
+  float max_normal_error_degrees;
+  float max_tangent_error_degrees;
+  float max_texcoord_error; // Relative to the half precision rounding bound, <= 1 is within bounds
+  std::size_t handedness_mismatches;
+
+  [[nodiscard]] auto IsWithinBounds() const -> bool;
+};
+
+// Round-trips the mesh through the packed format and measures the error of every stream against its bound
+[[nodiscard]] auto MeasurePackingError(CpuMesh const& mesh, PackedMesh const& packed) -> PackingErrorReport;
+}
@@ -1,5 +1,7 @@
 #include "winapi_helpers.hpp"
 
+#include <Psapi.h>
+
 import std;
 
 namespace refl {
@@ -8,4 +10,15 @@ auto ThrowIfFailed(HRESULT const hr) -> void {
     throw std::runtime_error{"Error"};
   }
 }
+
+
+auto GetWorkingSetSize() -> std::size_t {
+  PROCESS_MEMORY_COUNTERS counters{};
+
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+    return 0;
+  }
+
+  return counters.WorkingSetSize;
+}
 }
@@ -1,9 +1,13 @@
 #pragma once
 
+#include <cstddef>
+
 #define WIN32_LEAN_AND_MEAN
 #define NOMINMAX
 #include <Windows.h>
 
 namespace refl {
 auto ThrowIfFailed(HRESULT hr) -> void;
+// Physical memory currently used by the process in bytes
+[[nodiscard]] auto GetWorkingSetSize() -> std::size_t;
 }